@@ -35,12 +35,16 @@
 
 #include <ctime>
 #include <cutils/properties.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -120,11 +124,49 @@ static const char* dfs_sched_wakeup_path =
     "/d/tracing/events/sched/sched_wakeup/enable";
 static const char* dfs_control_path =
     "/d/tracing/tracing_on";
+static const char* dfs_trace_pipe_path =
+    "/d/tracing/trace_pipe";
 static const char* dfs_buffer_size_path =
     "/d/tracing/buffer_size_kb";
 static const char* dfs_tags_property = "debug.atrace.tags.enableflags";
 static const char* dfs_apps_property = "debug.atrace.app_cmdlines";
 
+/*
+ * Userspace trace history ring. A drain thread continuously splices
+ * trace_pipe into a pre-reserved, pre-faulted buffer, so a dump is a
+ * copy of already-captured history instead of fresh trace file I/O
+ * issued while the system is stalled. Single producer (drain thread),
+ * single consumer (dump): the producer only advances ring_head after
+ * the bytes are in place, so no lock is needed.
+ */
+static const size_t drain_chunk = 64 * 1024;
+static uint8_t *ring_buf;
+static size_t ring_size;
+static uint64_t ring_head;     /* total bytes ever produced */
+static int drain_pipe[2] = { -1, -1 };
+static bool ring_active = false;
+
+/* Dump input: the ring snapshot (up to two segments) when active,
+ * otherwise the trace file. */
+static const uint8_t *dump_seg[2];
+static size_t dump_seg_len[2];
+static int dump_seg_idx;
+
+/*
+ * PSI trigger. The kernel's cpu "some" pressure is the time runnable
+ * tasks spent waiting for a cpu, so a single monitor covers both stall
+ * and waiting-task triggering. The monitor thread wakes on POLLPRI
+ * within the configured window and turns tracing on itself, so capture
+ * starts microseconds after the stall instead of at the next
+ * /proc/stat poll; the main loop then takes over stop and dump.
+ */
+static const char* psi_cpu_path = "/proc/pressure/cpu";
+static bool psi_enabled = false;
+static int psi_stall_us = 150000;
+static int psi_window_us = 1000000;
+static volatile bool psi_triggered = false;
+static const char* trigger_reason = "cpu-idle-poll";
+
 /*
  * Read accumulated cpu data from /proc/stat
  */
@@ -247,6 +289,200 @@ static void dfs_set_property(uint64_t mtag, const char* mapp, bool enable) {
     }
 }
 
+/*
+ * Consume a pending PSI trigger, if any.
+ */
+static bool psi_pending(void) {
+    if (!psi_triggered)
+        return false;
+    psi_triggered = false;
+    return true;
+}
+
+/*
+ * PSI monitor thread: register a trigger on cpu pressure and block in
+ * poll() until the kernel reports the stall threshold was crossed.
+ */
+static void *psi_monitor(void *arg __unused)
+{
+    char trigger[64];
+
+    int fd = open(psi_cpu_path, O_RDWR | O_NONBLOCK);
+    if (fd == -1) {
+        ALOGE("Can't open %s (no PSI support?). PSI trigger disabled.",
+            psi_cpu_path);
+        return NULL;
+    }
+    int len = snprintf(trigger, sizeof(trigger), "some %d %d",
+            psi_stall_us, psi_window_us);
+    if (write(fd, trigger, len + 1) != len + 1) {
+        ALOGE("Error %d registering PSI trigger \"%s\".", errno, trigger);
+        close(fd);
+        return NULL;
+    }
+    ALOGI("PSI trigger active: %s.", trigger);
+
+    while (true) {
+        struct pollfd pfd = { fd, POLLPRI, 0 };
+        int n = poll(&pfd, 1, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("Error %d polling PSI, monitor exiting.", errno);
+            break;
+        }
+        if (pfd.revents & (POLLERR | POLLNVAL)) {
+            ALOGE("PSI trigger fd failed, monitor exiting.");
+            break;
+        }
+        if (!(pfd.revents & POLLPRI) || suspend)
+            continue;
+
+        /* Start capturing right away; bookkeeping catches up in the
+         * main loop at its next wakeup. */
+        int control_fd = open(dfs_control_path, O_WRONLY);
+        if (control_fd != -1) {
+            if (write(control_fd, "1", 1) != 1)
+                ALOGE("Error %d enabling tracing from PSI monitor.", errno);
+            close(control_fd);
+        }
+        psi_triggered = true;
+    }
+    close(fd);
+    return NULL;
+}
+
+/*
+ * Drain thread: splice trace_pipe into an anonymous pipe, then pull the
+ * data into the history ring. The thread blocks in splice() whenever
+ * tracing is off, so it costs nothing while idle.
+ */
+static void *ring_drain(void *arg __unused)
+{
+    int trace_fd = open(dfs_trace_pipe_path, O_RDONLY);
+    if (trace_fd == -1) {
+        ALOGE("Can't open %s, falling back to dumping the trace file.",
+            dfs_trace_pipe_path);
+        ring_active = false;
+        return NULL;
+    }
+
+    while (true) {
+        ssize_t n = splice(trace_fd, NULL, drain_pipe[1], NULL, drain_chunk,
+                SPLICE_F_MOVE);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("Error %d draining trace_pipe, drain thread exiting.", errno);
+            break;
+        }
+        while (n > 0) {
+            size_t off = ring_head % ring_size;
+            size_t chunk = ring_size - off;
+            if ((size_t)n < chunk)
+                chunk = n;
+            ssize_t r = read(drain_pipe[0], ring_buf + off, chunk);
+            if (r <= 0) {
+                if (r == -1 && errno == EINTR)
+                    continue;
+                break;
+            }
+            __atomic_store_n(&ring_head, ring_head + r, __ATOMIC_RELEASE);
+            n -= r;
+        }
+    }
+    close(trace_fd);
+    ring_active = false;
+    return NULL;
+}
+
+/*
+ * Reserve the history ring and start the drain thread. The ring holds
+ * as much as the kernel buffers do (buf_size_kb is per core) and is
+ * faulted in up front so the drain never takes a page fault under
+ * memory pressure. Failure is not fatal: dumps fall back to reading the
+ * trace file directly.
+ */
+static void ring_start(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_CONF);
+    if (cores < 1)
+        cores = 1;
+    ring_size = (size_t)atoi(buf_size_kb) * 1024 * cores;
+
+    ring_buf = (uint8_t *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring_buf == MAP_FAILED) {
+        ALOGE("Can't reserve %zu bytes for the trace ring.", ring_size);
+        ring_buf = NULL;
+        return;
+    }
+    memset(ring_buf, 0, ring_size);
+
+    if (pipe(drain_pipe) != 0) {
+        ALOGE("Can't create the drain pipe.");
+        munmap(ring_buf, ring_size);
+        ring_buf = NULL;
+        return;
+    }
+
+    pthread_t thread;
+    ring_active = true;
+    if (pthread_create(&thread, NULL, ring_drain, NULL) != 0) {
+        ALOGE("Can't start the trace drain thread.");
+        ring_active = false;
+        close(drain_pipe[0]);
+        close(drain_pipe[1]);
+        munmap(ring_buf, ring_size);
+        ring_buf = NULL;
+        return;
+    }
+    pthread_detach(thread);
+    ALOGI("Trace history ring of %zu bytes active.", ring_size);
+}
+
+/*
+ * Feed the dump either from the ring snapshot or from the trace file.
+ */
+static ssize_t dump_read(int trace_fd, uint8_t *buf, size_t len)
+{
+    if (trace_fd != -1)
+        return read(trace_fd, buf, len);
+
+    while (dump_seg_idx < 2 && dump_seg_len[dump_seg_idx] == 0)
+        dump_seg_idx++;
+    if (dump_seg_idx == 2)
+        return 0;
+
+    size_t n = dump_seg_len[dump_seg_idx];
+    if (n > len)
+        n = len;
+    memcpy(buf, dump_seg[dump_seg_idx], n);
+    dump_seg[dump_seg_idx] += n;
+    dump_seg_len[dump_seg_idx] -= n;
+    return n;
+}
+
+/*
+ * Snapshot the ring: the oldest ring_size bytes of history, in order,
+ * as up to two contiguous segments.
+ */
+static void dump_snapshot_ring(void)
+{
+    uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    size_t len = (head < ring_size) ? head : ring_size;
+    size_t start = (size_t)((head - len) % ring_size);
+    size_t seg = ring_size - start;
+
+    if (seg > len)
+        seg = len;
+    dump_seg[0] = ring_buf + start;
+    dump_seg_len[0] = seg;
+    dump_seg[1] = ring_buf;
+    dump_seg_len[1] = len - seg;
+    dump_seg_idx = 0;
+}
+
 /*
  * Dump the log in a compressed format for systrace to visualize.
  * Create a dump file "dump_of_anrdaemon.<current_time>" under /data/misc/anrd
@@ -277,11 +513,16 @@ static void dump_trace()
         return;
     }
 
-    int trace_fd = open(dfs_trace_output_path, O_RDWR);
-    if (trace_fd == -1) {
-        ALOGE("Failed to open %s. Dump aborted.", dfs_trace_output_path);
-        close(output_fd);
-        return;
+    int trace_fd = -1;
+    if (ring_active) {
+        dump_snapshot_ring();
+    } else {
+        trace_fd = open(dfs_trace_output_path, O_RDWR);
+        if (trace_fd == -1) {
+            ALOGE("Failed to open %s. Dump aborted.", dfs_trace_output_path);
+            close(output_fd);
+            return;
+        }
     }
 
     z_stream zs;
@@ -292,7 +533,8 @@ static void dump_trace()
     result = deflateInit(&zs, Z_DEFAULT_COMPRESSION);
     if (result != Z_OK) {
         ALOGE("error initializing zlib: %d\n", result);
-        close(trace_fd);
+        if (trace_fd != -1)
+            close(trace_fd);
         close(output_fd);
         return;
     }
@@ -305,9 +547,17 @@ static void dump_trace()
     zs.next_out = out;
     zs.avail_out = bufSize;
 
+    /* Tag the capture with what fired it, as an ftrace comment at the
+     * start of the deflated stream. */
+    char reason_buf[96];
+    int reason_len = snprintf(reason_buf, sizeof(reason_buf),
+            "# ANRdaemon trigger: %s\n", trigger_reason);
+    zs.next_in = (uint8_t*)reason_buf;
+    zs.avail_in = reason_len;
+
     do {
         if (zs.avail_in == 0) {
-            result = read(trace_fd, in, bufSize);
+            result = dump_read(trace_fd, in, bufSize);
             if (result < 0) {
                 ALOGE("error reading trace: %s", strerror(errno));
                 result = Z_STREAM_END;
@@ -354,7 +604,8 @@ static void dump_trace()
     free(in);
     free(out);
 
-    close(trace_fd);
+    if (trace_fd != -1)
+        close(trace_fd);
     close(output_fd);
 
     ALOGI("Finished dump. Output file stored at: %s", path_buf);
@@ -373,10 +624,11 @@ static void start_tracing(void) {
     }
     tracing = true;
 
-    /* Stop logging when cpu usage drops or the daemon is suspended.*/
+    /* Stop logging when cpu usage drops, the pressure stalls stop and
+     * the daemon is not suspended. */
     do {
         usleep(tracing_check_period);
-    } while (!suspend && !dump_requested && is_heavy_load());
+    } while (!suspend && !dump_requested && (is_heavy_load() || psi_pending()));
 
     if (dfs_enable(false, dfs_control_path) != 0) {
         ALOGE("Failed to stop tracing.");
@@ -427,18 +679,33 @@ static void start(void) {
     dfs_set_property(tag, apps, true);
     dfs_poke_binder();
 
+    ring_start();
+
+    if (psi_enabled) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, psi_monitor, NULL) == 0)
+            pthread_detach(thread);
+        else
+            ALOGE("Can't start the PSI monitor thread.");
+    }
+
     get_cpu_stat(&old_cpu);
     sleep(check_period);
 
     while (!quit && !err) {
-        if (!suspend && is_heavy_load()) {
-            /*
-             * Increase process priority to make sure we can stop logging when
-             * necessary and do not overwrite the buffer
-             */
-            setpriority(PRIO_PROCESS, 0, -20);
-            start_tracing();
-            setpriority(PRIO_PROCESS, 0, 0);
+        if (!suspend) {
+            bool heavy = is_heavy_load();
+            bool psi_fired = psi_pending();
+            if (heavy || psi_fired) {
+                trigger_reason = psi_fired ? "psi-cpu-stall" : "cpu-idle-poll";
+                /*
+                 * Increase process priority to make sure we can stop logging
+                 * when necessary and do not overwrite the buffer
+                 */
+                setpriority(PRIO_PROCESS, 0, -20);
+                start_tracing();
+                setpriority(PRIO_PROCESS, 0, 0);
+            }
         }
         sleep(check_period);
     }
@@ -513,6 +780,10 @@ static void show_help(void) {
                         "(uint = 0.01%%, min = 5000, max = 9999, default = 9990)\n"
                     "   -s N        use a trace buffer size of N KB "
                         "default to 2048KB\n"
+                    "   -p S/W      also trigger on cpu pressure stalls of S "
+                        "us within a W us\n"
+                    "               window (default 150000/1000000, needs "
+                        "kernel PSI support)\n"
                     "   -h          show helps\n");
     fprintf(stdout, "Categoris includes:\n"
                     "   am         - activity manager\n"
@@ -539,11 +810,23 @@ static void show_help(void) {
 static int get_options(int argc, char *argv[]) {
     int opt = 0;
     int threshold;
-    while ((opt = getopt(argc, argv, "a:s:t:h")) >= 0) {
+    while ((opt = getopt(argc, argv, "a:p:s:t:h")) >= 0) {
         switch(opt) {
             case 'a':
                 apps = optarg;
                 break;
+            case 'p':
+                psi_enabled = true;
+                if (strcmp(optarg, "default") != 0
+                        && (sscanf(optarg, "%d/%d", &psi_stall_us,
+                                &psi_window_us) != 2
+                            || psi_stall_us <= 0
+                            || psi_window_us < psi_stall_us)) {
+                    fprintf(stderr, "PSI threshold should be "
+                            "stall_us/window_us with stall <= window\n");
+                    return 1;
+                }
+                break;
             case 's':
                 if (atoi(optarg) > max_buffer_size)
                     buf_size_kb = max_buffer_size_str;
@@ -8,14 +8,25 @@
 #include <algorithm>
 #include <tuple>
 #include <numeric>
+#include <atomic>
+#include <map>
 #include <fcntl.h>
 #include <string>
 #include <fstream>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 
 using namespace std;
 
+// Slots in the shared stats ring; old samples are overwritten.
+#define STATS_RING_ENTRIES 16384
+// A per-MB allocation latency above this is reported as a stall in the
+// timeline.
+#define STALL_THRESHOLD_NS (20ULL * 1000 * 1000)
+
 #define ASSERT_TRUE(cond) \
 do { \
     if (!(cond)) {\
@@ -101,7 +112,105 @@ public:
     }
 };
 
-void createProcess(Pipe pipe, const char *exName, const char *arg)
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// One allocation sample logged by a worker. Latency is normalized to
+// nanoseconds per MB so different allocation sizes stay comparable.
+struct StatsEntry {
+    int32_t pid;
+    int32_t oomadj;
+    uint64_t allocMb;
+    uint64_t latencyNs;
+    uint64_t timestampNs;
+};
+
+// Lock-free ring shared between the workers and the parent. It lives in
+// an unlinked tmpfile mapping so it survives the exec of the workers;
+// the fd is handed down the same way as the pipe fds.
+struct StatsRing {
+    atomic<uint32_t> next;
+    StatsEntry entries[STATS_RING_ENTRIES];
+
+    void log(int32_t pid, int32_t oomadj, uint64_t allocMb, uint64_t latencyNs) {
+        uint32_t slot = next.fetch_add(1) % STATS_RING_ENTRIES;
+        entries[slot].pid = pid;
+        entries[slot].oomadj = oomadj;
+        entries[slot].allocMb = allocMb;
+        entries[slot].latencyNs = latencyNs;
+        entries[slot].timestampNs = nowNs();
+    }
+    uint32_t count() {
+        return min(next.load(), (uint32_t)STATS_RING_ENTRIES);
+    }
+};
+
+// A child death observed by the parent, with whatever the kernel and
+// PSI had to say about it at that moment.
+struct KillEvent {
+    uint64_t timestampNs;
+    int oomadj;
+    uint64_t allocMb;
+    string psi;
+    vector<string> kmsg;
+};
+
+static int createStatsRing() {
+    char path[] = "/data/local/tmp/alloc-stress-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_TRUE(fd >= 0);
+    unlink(path);
+    int error = ftruncate(fd, sizeof(StatsRing));
+    ASSERT_TRUE(error == 0);
+    return fd;
+}
+
+static StatsRing *mapStatsRing(int fd) {
+    void *ptr = mmap(nullptr, sizeof(StatsRing), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    ASSERT_TRUE(ptr != MAP_FAILED);
+    return (StatsRing *)ptr;
+}
+
+static string readPsiMemory() {
+    // Not all kernels expose PSI; the timeline just notes its absence.
+    ifstream f("/proc/pressure/memory");
+    string line;
+    if (f && getline(f, line))
+        return line;
+    return "psi unavailable";
+}
+
+// Returns the kill-related kernel log lines that arrived since the last
+// drain. The fd is opened non-blocking at startup and seeked to the
+// end, so only records from this run show up.
+static vector<string> drainKmsg(int fd) {
+    vector<string> lines;
+    if (fd < 0)
+        return lines;
+    char buf[1024];
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf) - 1)) > 0) {
+        buf[len] = '\0';
+        string line{buf};
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        if (line.find("Kill") != string::npos ||
+            line.find("lowmemorykiller") != string::npos ||
+            line.find("lmkd") != string::npos ||
+            line.find("oom") != string::npos) {
+            // Keep only the message part of the kmsg record.
+            size_t semi = line.find(';');
+            lines.push_back(semi == string::npos ? line : line.substr(semi + 1));
+        }
+    }
+    return lines;
+}
+
+void createProcess(Pipe pipe, const char *exName, const char *arg, int statsFd)
 {
     pipe.preserveOverFork(true);
     pid_t pid = fork();
@@ -109,9 +218,12 @@ void createProcess(Pipe pipe, const char *exName, const char *arg)
     if (pid == 0) {
         char readFdStr[16];
         char writeFdStr[16];
+        char statsFdStr[16];
         snprintf(readFdStr, sizeof(readFdStr), "%d", pipe.getReadFd());
         snprintf(writeFdStr, sizeof(writeFdStr), "%d", pipe.getWriteFd());
-        execl(exName, exName, "--worker", arg, readFdStr, writeFdStr, nullptr);
+        snprintf(statsFdStr, sizeof(statsFdStr), "%d", statsFd);
+        execl(exName, exName, "--worker", arg, readFdStr, writeFdStr,
+              statsFdStr, nullptr);
         ASSERT_TRUE(0);
     }
     // parent process
@@ -172,6 +284,166 @@ static void create_memcg() {
 }
 #endif
 
+// One memcg in a --topology run: its hard limit, the paced allocation
+// rate of each worker in it, and how many workers it holds.
+struct MemcgGroup {
+    string name;
+    size_t limitMb;
+    size_t rateMbPerSec;
+    int procs;
+    string path;
+};
+
+// Spec format: name:limitMB:rateMBps:procs, comma separated, e.g.
+// "fg:512:64:2,bg:256:16:4". A rate of 0 means allocate flat out.
+static bool parseTopology(const char *spec, vector<MemcgGroup> &groups) {
+    string str{spec};
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == string::npos)
+            end = str.size();
+        string item = str.substr(pos, end - pos);
+        char name[64];
+        unsigned long long limit, rate;
+        int procs;
+        if (sscanf(item.c_str(), "%63[^:]:%llu:%llu:%d",
+                   name, &limit, &rate, &procs) != 4 || procs < 1)
+            return false;
+        MemcgGroup g;
+        g.name = name;
+        g.limitMb = limit;
+        g.rateMbPerSec = rate;
+        g.procs = procs;
+        groups.push_back(g);
+        pos = end + 1;
+    }
+    return !groups.empty();
+}
+
+// The memory controller is mounted in different places depending on the
+// device; probe the usual ones.
+static string findMemcgRoot() {
+    static const char *candidates[] = {
+        "/dev/memcg", "/dev/memctl", "/sys/fs/cgroup/memory",
+    };
+    for (const char *c : candidates) {
+        string probe = string(c) + "/memory.limit_in_bytes";
+        if (access(probe.c_str(), F_OK) == 0)
+            return c;
+    }
+    return "";
+}
+
+static bool writeCgroupFile(const string &path, const string &value) {
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+    ssize_t written = write(fd, value.c_str(), value.size());
+    close(fd);
+    return written == (ssize_t)value.size();
+}
+
+static string readCgroupFile(const string &path) {
+    ifstream f(path);
+    string line;
+    if (f && getline(f, line))
+        return line;
+    return "?";
+}
+
+static pid_t spawnTopologyWorker(Pipe pipe, const char *exName, int groupIdx,
+                                 size_t rateMbPerSec, const string &tasksPath,
+                                 int statsFd) {
+    pipe.preserveOverFork(true);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char idxStr[16];
+        char rateStr[16];
+        char readFdStr[16];
+        char writeFdStr[16];
+        char statsFdStr[16];
+        snprintf(idxStr, sizeof(idxStr), "%d", groupIdx);
+        snprintf(rateStr, sizeof(rateStr), "%zu", rateMbPerSec);
+        snprintf(readFdStr, sizeof(readFdStr), "%d", pipe.getReadFd());
+        snprintf(writeFdStr, sizeof(writeFdStr), "%d", pipe.getWriteFd());
+        snprintf(statsFdStr, sizeof(statsFdStr), "%d", statsFd);
+        execl(exName, exName, "--memcg-worker", idxStr, rateStr,
+              tasksPath.c_str(), readFdStr, writeFdStr, statsFdStr, nullptr);
+        ASSERT_TRUE(0);
+    }
+    ASSERT_TRUE(pid > 0);
+    pipe.preserveOverFork(false);
+    return pid;
+}
+
+// Prints a log2 histogram of per-MB allocation latency for each oomadj
+// level seen in the ring.
+static void printLatencyHistograms(StatsRing *ring) {
+    map<int, vector<uint64_t>> perAdj;
+    uint32_t count = ring->count();
+    for (uint32_t i = 0; i < count; i++)
+        perAdj[ring->entries[i].oomadj].push_back(ring->entries[i].latencyNs);
+
+    for (auto &it : perAdj) {
+        vector<uint64_t> &lat = it.second;
+        sort(lat.begin(), lat.end());
+        cout << "adj " << it.first << ": " << lat.size()
+             << " allocs, p50: " << lat[lat.size() / 2] / 1000 << "us/MB"
+             << ", p99: " << lat[(size_t)(lat.size() * 0.99)] / 1000 << "us/MB"
+             << ", max: " << lat.back() / 1000 << "us/MB" << endl;
+        size_t hist[32] = {};
+        for (uint64_t l : lat) {
+            int bucket = 0;
+            for (uint64_t us = l / 1000; us > 0; us >>= 1)
+                bucket++;
+            hist[min(bucket, 31)]++;
+        }
+        for (int b = 0; b < 32; b++) {
+            if (hist[b] == 0)
+                continue;
+            cout << "    <= " << (1ULL << b) << "us/MB: " << hist[b] << endl;
+        }
+    }
+}
+
+// Emits the allocation stalls and kills in one chronological timeline
+// so a kill can be read against the stalls that preceded it.
+static void printTimeline(StatsRing *ring, const vector<KillEvent> &kills,
+                          uint64_t startNs) {
+    vector<pair<uint64_t, string>> events;
+    uint32_t count = ring->count();
+    for (uint32_t i = 0; i < count; i++) {
+        StatsEntry &e = ring->entries[i];
+        if (e.latencyNs < STALL_THRESHOLD_NS)
+            continue;
+        char buf[128];
+        snprintf(buf, sizeof(buf),
+                 "stall: pid %d adj %d at %llu MB, %.3f ms/MB",
+                 e.pid, e.oomadj, (unsigned long long)e.allocMb,
+                 e.latencyNs / 1e6);
+        events.push_back(make_pair(e.timestampNs, string(buf)));
+    }
+    for (const KillEvent &k : kills) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "kill: adj %d after %llu MB, %s",
+                 k.oomadj, (unsigned long long)k.allocMb, k.psi.c_str());
+        string msg{buf};
+        for (const string &line : k.kmsg)
+            msg += "\n             " + line;
+        events.push_back(make_pair(k.timestampNs, msg));
+    }
+    sort(events.begin(), events.end());
+
+    cout << "timeline (" << events.size() << " events):" << endl;
+    for (auto &ev : events) {
+        char stamp[32];
+        snprintf(stamp, sizeof(stamp), "[%9.3fs] ",
+                 (ev.first - startNs) / 1e9);
+        cout << stamp << ev.second << endl;
+    }
+}
+
 size_t s = 4 * (1 << 20);
 void *gptr;
 int main(int argc, char *argv[])
@@ -180,17 +452,24 @@ int main(int argc, char *argv[])
 #ifdef ENABLE_MEM_CGROUPS
         create_memcg();
 #endif
-        write_oomadj_to_lmkd(atoi(argv[2]));
+        int oomadj = atoi(argv[2]);
+        write_oomadj_to_lmkd(oomadj);
         Pipe p{atoi(argv[3]), atoi(argv[4])};
+        StatsRing *ring = (argc > 5) ? mapStatsRing(atoi(argv[5])) : nullptr;
 
         long long allocCount = 0;
         while (1) {
             p.wait();
+            uint64_t allocStart = nowNs();
             char *ptr = (char*)malloc(s);
             memset(ptr, (int)allocCount >> 10, s);
             for (int i = 0; i < s; i+= 4096) {
                 *((long long*)&ptr[i]) = allocCount + i;
             }
+            if (ring) {
+                ring->log(getpid(), oomadj, allocCount >> 20,
+                          (nowNs() - allocStart) / (s >> 20));
+            }
             usleep(10 * 1000);
             gptr = ptr;
             //cout << "total alloc: " << allocCount / (1<<20)<< " adj: " << argv[2]<< endl;;
@@ -198,15 +477,161 @@ int main(int argc, char *argv[])
             p.signal();
             allocCount += s;
         }
+    } else if ((argc > 7) && (std::string(argv[1]) == "--memcg-worker")) {
+        int groupIdx = atoi(argv[2]);
+        size_t rateMbPerSec = atol(argv[3]);
+        // Join the group before the first allocation so every charge is
+        // accounted to it.
+        char pidStr[16];
+        snprintf(pidStr, sizeof(pidStr), "%u", getpid());
+        ASSERT_TRUE(writeCgroupFile(argv[4], pidStr));
+        Pipe p{atoi(argv[5]), atoi(argv[6])};
+        StatsRing *ring = mapStatsRing(atoi(argv[7]));
+        p.signal();
+
+        // Pace allocations to the configured rate; latency above the
+        // pace budget eats into later chunks instead of being hidden.
+        uint64_t chunkNs = rateMbPerSec ?
+                (s >> 20) * 1000000000ULL / rateMbPerSec : 0;
+        long long allocCount = 0;
+        while (1) {
+            uint64_t allocStart = nowNs();
+            char *ptr = (char*)malloc(s);
+            memset(ptr, (int)allocCount >> 10, s);
+            for (int i = 0; i < s; i+= 4096) {
+                *((long long*)&ptr[i]) = allocCount + i;
+            }
+            uint64_t elapsed = nowNs() - allocStart;
+            // The group index rides in the oomadj slot of the ring.
+            ring->log(getpid(), groupIdx, allocCount >> 20,
+                      elapsed / (s >> 20));
+            gptr = ptr;
+            allocCount += s;
+            if (chunkNs && elapsed < chunkNs)
+                usleep((chunkNs - elapsed) / 1000);
+        }
+    } else if ((argc > 2) && (std::string(argv[1]) == "--topology")) {
+        vector<MemcgGroup> groups;
+        if (!parseTopology(argv[2], groups)) {
+            cerr << "bad topology spec, expected "
+                    "name:limitMB:rateMBps:procs[,...]" << endl;
+            return 1;
+        }
+        int durationSec = (argc > 3) ? atoi(argv[3]) : 30;
+        string root = findMemcgRoot();
+        if (root.empty()) {
+            cerr << "no memory cgroup hierarchy found" << endl;
+            return 1;
+        }
+
+        uint64_t startNs = nowNs();
+        int statsFd = createStatsRing();
+        StatsRing *ring = mapStatsRing(statsFd);
+
+        map<pid_t, int> pidGroup;
+        vector<Pipe> readyPipes;
+        for (size_t gi = 0; gi < groups.size(); gi++) {
+            MemcgGroup &g = groups[gi];
+            g.path = root + "/alloc-stress-" + g.name;
+            // The directory may be left over from an interrupted run.
+            mkdir(g.path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+            char limitStr[32];
+            snprintf(limitStr, sizeof(limitStr), "%llu",
+                     (unsigned long long)g.limitMb << 20);
+            ASSERT_TRUE(writeCgroupFile(g.path + "/memory.limit_in_bytes",
+                                        limitStr));
+            for (int w = 0; w < g.procs; w++) {
+                auto pipes = Pipe::createPipePair();
+                pid_t pid = spawnTopologyWorker(std::move(std::get<1>(pipes)),
+                                                argv[0], (int)gi,
+                                                g.rateMbPerSec,
+                                                g.path + "/tasks", statsFd);
+                // Wait until the worker is inside its group.
+                std::get<0>(pipes).wait();
+                pidGroup[pid] = gi;
+                readyPipes.push_back(std::move(std::get<0>(pipes)));
+            }
+            cout << "group " << g.name << ": " << g.procs
+                 << " workers, limit " << g.limitMb << "MB, "
+                 << g.rateMbPerSec << "MB/s each" << endl;
+        }
+
+        // Let the topology run, noting any worker the kernel or lmkd
+        // kills along the way.
+        vector<int> killsPerGroup(groups.size(), 0);
+        uint64_t deadlineNs = nowNs() + durationSec * 1000000000ULL;
+        while (nowNs() < deadlineNs) {
+            int status;
+            pid_t dead = waitpid(-1, &status, WNOHANG);
+            if (dead > 0 && pidGroup.count(dead)) {
+                cout << "worker " << dead << " in group "
+                     << groups[pidGroup[dead]].name << " killed after "
+                     << (nowNs() - startNs) / 1000000000ULL << "s, "
+                     << readPsiMemory() << endl;
+                killsPerGroup[pidGroup[dead]]++;
+                pidGroup.erase(dead);
+            }
+            usleep(100 * 1000);
+        }
+
+        for (auto &it : pidGroup)
+            kill(it.first, SIGKILL);
+        for (auto &it : pidGroup)
+            waitpid(it.first, nullptr, 0);
+
+        // Allocation latency inside a group sitting at its limit is
+        // dominated by the reclaim done on each charge, so the per-group
+        // percentiles are the reclaim latency picture.
+        uint32_t count = ring->count();
+        for (size_t gi = 0; gi < groups.size(); gi++) {
+            vector<uint64_t> lat;
+            for (uint32_t i = 0; i < count; i++) {
+                if (ring->entries[i].oomadj == (int)gi)
+                    lat.push_back(ring->entries[i].latencyNs);
+            }
+            MemcgGroup &g = groups[gi];
+            cout << "group " << g.name << ": ";
+            if (lat.empty()) {
+                cout << "no samples" << endl;
+            } else {
+                sort(lat.begin(), lat.end());
+                cout << lat.size() << " allocs, p50: "
+                     << lat[lat.size() / 2] / 1000 << "us/MB, p99: "
+                     << lat[(size_t)(lat.size() * 0.99)] / 1000
+                     << "us/MB, max: " << lat.back() / 1000 << "us/MB"
+                     << endl;
+            }
+            cout << "    max usage: "
+                 << readCgroupFile(g.path + "/memory.max_usage_in_bytes")
+                 << ", limit hits: "
+                 << readCgroupFile(g.path + "/memory.failcnt")
+                 << ", kills: " << killsPerGroup[gi] << endl;
+            rmdir(g.path.c_str());
+        }
+        close(statsFd);
+        return 0;
     } else {
         cout << "parent:" << argc << endl;
 
+        uint64_t startNs = nowNs();
+        int statsFd = createStatsRing();
+        StatsRing *ring = mapStatsRing(statsFd);
+        int kmsgFd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK);
+        if (kmsgFd >= 0) {
+            // Only records logged from here on matter.
+            lseek(kmsgFd, 0, SEEK_END);
+        } else {
+            cout << "Cannot open /dev/kmsg, kills will not be correlated "
+                    "with the kernel log." << endl;
+        }
+        vector<KillEvent> kills;
+
         write_oomadj_to_lmkd(-1000);
         for (int i = 1000; i >= 0; i -= 100) {
             auto pipes = Pipe::createPipePair();
             char arg[16];
             snprintf(arg, sizeof(arg), "%d", i);
-            createProcess(std::move(std::get<1>(pipes)), argv[0], arg);
+            createProcess(std::move(std::get<1>(pipes)), argv[0], arg, statsFd);
             Pipe &p = std::get<0>(pipes);
 
             size_t t = 0;
@@ -214,14 +639,29 @@ int main(int argc, char *argv[])
                 //;cout << getpid() << ":" << "parent signal" << endl;
                 p.signal();
                 if (p.wait_ret_error()) {
+                    KillEvent ev;
+                    ev.timestampNs = nowNs();
+                    ev.oomadj = i;
+                    ev.allocMb = t >> 20;
+                    ev.psi = readPsiMemory();
                     int status;
                     waitpid(0, &status, 0);
+                    // Give the kill report a moment to reach the log.
+                    usleep(100 * 1000);
+                    ev.kmsg = drainKmsg(kmsgFd);
+                    kills.push_back(std::move(ev));
                     break;
                 }
                 t += s;
             }
             cout << "adj: " << i << " sz: " << t / (1 << 20) << endl;
         }
+
+        printLatencyHistograms(ring);
+        printTimeline(ring, kills, startNs);
+        if (kmsgFd >= 0)
+            close(kmsgFd);
+        close(statsFd);
     }
     return 0;
 }
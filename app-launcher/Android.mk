@@ -16,6 +16,20 @@ LOCAL_MODULE := computestats
 LOCAL_MODULE_TAGS := debug
 include $(BUILD_HOST_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := launch_perf.c
+LOCAL_MODULE := launch_perf
+LOCAL_MODULE_TAGS := debug
+LOCAL_CFLAGS := -Wall -Werror
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := pin_cache.c
+LOCAL_MODULE := pin_cache
+LOCAL_MODULE_TAGS := debug
+LOCAL_CFLAGS := -Wall -Werror
+include $(BUILD_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_PREBUILT_EXECUTABLES := app-launcher
 LOCAL_MODULE_HOST_OS := linux
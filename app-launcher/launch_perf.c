@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * launch_perf: wrap a single app launch with system-wide perf counters
+ * and report per-phase deltas in machine readable form.
+ *
+ * The launch command (typically "am start -W -n pkg/activity") is run
+ * as a child with its output echoed through. Counters are snapshotted
+ * at phase boundaries driven by that output:
+ *
+ *   fork        start of the helper to the "Starting:" line
+ *   bind        "Starting:" to the "Status:" line
+ *   firstFrame  "Status:" to command exit (-W returns once the first
+ *               frame is drawn)
+ *
+ * Each phase emits one CSV line on stdout (or -o FILE):
+ *
+ *   launch_perf,<phase>,<ns>,<cycles>,<instructions>,<major-faults>,<block-rq>
+ *
+ * Events that can not be opened (no PMU, no debugfs) are reported as 0
+ * with a single warning, so the harness keeps working on any device.
+ * Block I/O is counted with the block:block_rq_issue tracepoint, the
+ * closest system-wide analogue to per-cgroup I/O that perf can count.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CPUS 16
+#define MAX_LINE 1024
+
+/* One counter, opened per-cpu and summed on read, in the style of
+ * simpleperf's EventFd. */
+struct event_fd {
+    const char *name;
+    int fds[MAX_CPUS];
+    int nr_fds;
+};
+
+enum {
+    EVENT_CYCLES,
+    EVENT_INSTRUCTIONS,
+    EVENT_MAJOR_FAULTS,
+    EVENT_BLOCK_RQ,
+    NR_EVENTS
+};
+
+static struct event_fd events[NR_EVENTS];
+static int nr_cpus;
+
+static int sys_perf_event_open(struct perf_event_attr *attr, pid_t pid,
+        int cpu, int group_fd, unsigned long flags) {
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+static int event_fd_open(struct event_fd *event, const char *name,
+        uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    int cpu;
+
+    event->name = name;
+    event->nr_fds = 0;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+
+    for (cpu = 0; cpu < nr_cpus; cpu++) {
+        int fd = sys_perf_event_open(&attr, -1, cpu, -1, 0);
+        if (fd == -1) {
+            if (errno == ENODEV)
+                continue;   /* cpu is offline */
+            while (event->nr_fds > 0)
+                close(event->fds[--event->nr_fds]);
+            fprintf(stderr, "launch_perf: %s not available (errno %d)\n",
+                    name, errno);
+            return -1;
+        }
+        event->fds[event->nr_fds++] = fd;
+    }
+    return (event->nr_fds > 0) ? 0 : -1;
+}
+
+static uint64_t event_fd_read(struct event_fd *event) {
+    uint64_t total = 0, value;
+    int i;
+
+    for (i = 0; i < event->nr_fds; i++) {
+        if (read(event->fds[i], &value, sizeof(value)) == sizeof(value))
+            total += value;
+    }
+    return total;
+}
+
+/*
+ * Look up the tracepoint id of block:block_rq_issue for the block I/O
+ * counter. Tracefs moved around over the years, so try both mounts.
+ */
+static int block_tracepoint_id(void) {
+    static const char *paths[] = {
+        "/sys/kernel/debug/tracing/events/block/block_rq_issue/id",
+        "/sys/kernel/tracing/events/block/block_rq_issue/id",
+        "/d/tracing/events/block/block_rq_issue/id",
+    };
+    char buf[16];
+    size_t i;
+
+    for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd == -1)
+            continue;
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n > 0) {
+            buf[n] = '\0';
+            return atoi(buf);
+        }
+    }
+    return -1;
+}
+
+static void open_events(void) {
+    int tracepoint;
+
+    event_fd_open(&events[EVENT_CYCLES], "cpu-cycles",
+            PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    event_fd_open(&events[EVENT_INSTRUCTIONS], "instructions",
+            PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    event_fd_open(&events[EVENT_MAJOR_FAULTS], "major-faults",
+            PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ);
+
+    tracepoint = block_tracepoint_id();
+    if (tracepoint > 0) {
+        event_fd_open(&events[EVENT_BLOCK_RQ], "block-rq-issue",
+                PERF_TYPE_TRACEPOINT, tracepoint);
+    } else {
+        events[EVENT_BLOCK_RQ].name = "block-rq-issue";
+        fprintf(stderr, "launch_perf: block-rq-issue not available "
+                "(no tracefs)\n");
+    }
+}
+
+struct snapshot {
+    uint64_t ns;
+    uint64_t counts[NR_EVENTS];
+};
+
+static void take_snapshot(struct snapshot *snap) {
+    struct timespec ts;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    snap->ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    for (i = 0; i < NR_EVENTS; i++)
+        snap->counts[i] = event_fd_read(&events[i]);
+}
+
+static void emit_phase(FILE *out, const char *phase,
+        const struct snapshot *from, const struct snapshot *to) {
+    fprintf(out, "launch_perf,%s,%llu,%llu,%llu,%llu,%llu\n", phase,
+            (unsigned long long)(to->ns - from->ns),
+            (unsigned long long)(to->counts[EVENT_CYCLES]
+                    - from->counts[EVENT_CYCLES]),
+            (unsigned long long)(to->counts[EVENT_INSTRUCTIONS]
+                    - from->counts[EVENT_INSTRUCTIONS]),
+            (unsigned long long)(to->counts[EVENT_MAJOR_FAULTS]
+                    - from->counts[EVENT_MAJOR_FAULTS]),
+            (unsigned long long)(to->counts[EVENT_BLOCK_RQ]
+                    - from->counts[EVENT_BLOCK_RQ]));
+    fflush(out);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: launch_perf [-o FILE] -- command [args...]\n"
+            "Wraps one app launch with system-wide perf counters and\n"
+            "emits per-phase (fork/bind/firstFrame) counter deltas as\n"
+            "CSV. Needs root for system-wide counters.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    FILE *out = stdout;
+    struct snapshot start, last, now;
+    char line[MAX_LINE];
+    int pipefd[2];
+    int opt, status;
+    int saw_starting = 0, saw_status = 0;
+
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            out = fopen(optarg, "we");
+            if (!out) {
+                fprintf(stderr, "launch_perf: can't open %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'h':
+        default:
+            usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (nr_cpus > MAX_CPUS)
+        nr_cpus = MAX_CPUS;
+    open_events();
+
+    if (pipe(pipefd) != 0) {
+        fprintf(stderr, "launch_perf: can't create pipe\n");
+        return 1;
+    }
+
+    take_snapshot(&start);
+    last = start;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "launch_perf: fork failed\n");
+        return 1;
+    }
+    if (pid == 0) {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        execvp(argv[optind], &argv[optind]);
+        fprintf(stderr, "launch_perf: can't exec %s\n", argv[optind]);
+        _exit(127);
+    }
+    close(pipefd[1]);
+
+    FILE *child_out = fdopen(pipefd[0], "r");
+    while (child_out && fgets(line, sizeof(line), child_out)) {
+        fputs(line, stdout);
+        if (!saw_starting && strncmp(line, "Starting:", 9) == 0) {
+            take_snapshot(&now);
+            emit_phase(out, "fork", &last, &now);
+            last = now;
+            saw_starting = 1;
+        } else if (saw_starting && !saw_status
+                && strncmp(line, "Status:", 7) == 0) {
+            take_snapshot(&now);
+            emit_phase(out, "bind", &last, &now);
+            last = now;
+            saw_status = 1;
+        }
+    }
+    if (child_out)
+        fclose(child_out);
+    waitpid(pid, &status, 0);
+
+    take_snapshot(&now);
+    emit_phase(out, "firstFrame", &last, &now);
+    emit_phase(out, "total", &start, &now);
+
+    if (out != stdout)
+        fclose(out);
+    return (WIFEXITED(status)) ? WEXITSTATUS(status) : 1;
+}
@@ -133,7 +133,7 @@ static bool copy_data(int src_fd, int dst_fd, size_t num_bytes)
 
 int module_setActiveBootSlot(boot_control_module_t *module, unsigned slot)
 {
-  BrilloBootInfo info;
+  BrilloBootInfo *info;
   int src_fd, dst_fd;
   uint64_t src_size, dst_size;
   char src_name[32];
@@ -141,24 +141,17 @@ int module_setActiveBootSlot(boot_control_module_t *module, unsigned slot)
   if (slot >= 2)
     return -EINVAL;
 
-  if (!boot_info_load(&info)) {
-    fprintf(stderr, "WARNING: Error loading boot-info. Resetting.\n");
-    boot_info_reset(&info);
-  } else {
-    if (!boot_info_validate(&info)) {
-      fprintf(stderr, "WARNING: boot-info is invalid. Resetting.\n");
-      boot_info_reset(&info);
-    }
-  }
-
-  info.active_slot = slot;
-  info.slot_info[slot].bootable = true;
-  snprintf(info.bootctrl_suffix,
-           sizeof(info.bootctrl_suffix),
+  /* all field changes land on the misc partition in one write */
+  info = boot_info_get_cached();
+  info->active_slot = slot;
+  info->slot_info[slot].bootable = true;
+  snprintf(info->bootctrl_suffix,
+           sizeof(info->bootctrl_suffix),
            "_%c", slot + 'a');
 
-  if (!boot_info_save(&info)) {
+  if (!boot_info_sync()) {
     fprintf(stderr, "Error saving boot-info.\n");
+    boot_info_invalidate();
     return -errno;
   }
 
@@ -206,25 +199,14 @@ int module_setActiveBootSlot(boot_control_module_t *module, unsigned slot)
 
 int module_setSlotAsUnbootable(struct boot_control_module *module, unsigned slot)
 {
-  BrilloBootInfo info;
-
   if (slot >= 2)
     return -EINVAL;
 
-  if (!boot_info_load(&info)) {
-    fprintf(stderr, "WARNING: Error loading boot-info. Resetting.\n");
-    boot_info_reset(&info);
-  } else {
-    if (!boot_info_validate(&info)) {
-      fprintf(stderr, "WARNING: boot-info is invalid. Resetting.\n");
-      boot_info_reset(&info);
-    }
-  }
-
-  info.slot_info[slot].bootable = false;
+  boot_info_get_cached()->slot_info[slot].bootable = false;
 
-  if (!boot_info_save(&info)) {
+  if (!boot_info_sync()) {
     fprintf(stderr, "Error saving boot-info.\n");
+    boot_info_invalidate();
     return -errno;
   }
 
@@ -233,22 +215,11 @@ int module_setSlotAsUnbootable(struct boot_control_module *module, unsigned slot
 
 int module_isSlotBootable(struct boot_control_module *module, unsigned slot)
 {
-  BrilloBootInfo info;
-
   if (slot >= 2)
     return -EINVAL;
 
-  if (!boot_info_load(&info)) {
-    fprintf(stderr, "WARNING: Error loading boot-info. Resetting.\n");
-    boot_info_reset(&info);
-  } else {
-    if (!boot_info_validate(&info)) {
-      fprintf(stderr, "WARNING: boot-info is invalid. Resetting.\n");
-      boot_info_reset(&info);
-    }
-  }
-
-  return info.slot_info[slot].bootable;
+  /* served from the cache; only the first call reads misc */
+  return boot_info_get_cached()->slot_info[slot].bootable;
 }
 
 const char* module_getSuffix(boot_control_module_t *module, unsigned slot)
@@ -161,6 +161,36 @@ bool boot_info_save(BrilloBootInfo *info)
   return true;
 }
 
+static BrilloBootInfo cached_info;
+static bool cache_valid = false;
+
+BrilloBootInfo *boot_info_get_cached(void)
+{
+  if (!cache_valid) {
+    if (!boot_info_load(&cached_info)) {
+      fprintf(stderr, "WARNING: Error loading boot-info. Resetting.\n");
+      boot_info_reset(&cached_info);
+    } else if (!boot_info_validate(&cached_info)) {
+      fprintf(stderr, "WARNING: boot-info is invalid. Resetting.\n");
+      boot_info_reset(&cached_info);
+    }
+    cache_valid = true;
+  }
+  return &cached_info;
+}
+
+bool boot_info_sync(void)
+{
+  if (!cache_valid)
+    return true;
+  return boot_info_save(&cached_info);
+}
+
+void boot_info_invalidate(void)
+{
+  cache_valid = false;
+}
+
 bool boot_info_validate(BrilloBootInfo* info)
 {
   if (info->magic[0] != 'B' ||
@@ -49,6 +49,18 @@ typedef struct BrilloBootInfo {
 bool boot_info_load(BrilloBootInfo *out_info);
 bool boot_info_save(BrilloBootInfo *info);
 
+// Cached access. The first call to boot_info_get_cached() reads the
+// misc partition once (resetting the struct if it is unreadable or
+// invalid, like the direct callers used to); every later call is served
+// from memory. Mutations made through the returned pointer are
+// committed with boot_info_sync(), which writes the whole struct back
+// in a single write, and boot_info_invalidate() drops the cache so the
+// next access re-reads the partition. Callers are expected to
+// serialize access; there is no locking here.
+BrilloBootInfo *boot_info_get_cached(void);
+bool boot_info_sync(void);
+void boot_info_invalidate(void);
+
 // Returns non-zero if valid.
 bool boot_info_validate(BrilloBootInfo* info);
 void boot_info_reset(BrilloBootInfo* info);
@@ -14,14 +14,15 @@
 
 LOCAL_PATH:= $(call my-dir)
 
-# Create the cppreopts that does the copy
+# Create the cppreopts binary that does the copy
 include $(CLEAR_VARS)
 
-LOCAL_MODULE:= cppreopts.sh
-LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_MODULE:= cppreopts
 LOCAL_INIT_RC := cppreopts.rc
-LOCAL_SRC_FILES := cppreopts.sh
+LOCAL_SRC_FILES := cppreopts.cpp
+LOCAL_CFLAGS := -Wall -Werror
+LOCAL_SHARED_LIBRARIES := libbase
 
 LOCAL_REQUIRED_MODULES := preopt2cachename
 
-include $(BUILD_PREBUILT)
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/macros.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG "cppreopts"
+#endif
+
+static const char* kPreopt2CacheNameBin = "/system/bin/preopt2cachename";
+static const char* kOdexMarker = "/system-other-odex-marker";
+
+// Copying is I/O bound; a few workers are enough to keep the source and
+// destination devices busy without thrashing the rest of first boot.
+static constexpr size_t kMaxCopyThreads = 4;
+
+// Collected by the nftw() callback, which can't take user data.
+static std::vector<std::string>* collected_files;
+
+static int CollectFile(const char* fpath, const struct stat* sb ATTRIBUTE_UNUSED,
+                       int typeflag, struct FTW* ftwbuf ATTRIBUTE_UNUSED) {
+  if (typeflag == FTW_F) {
+    std::string path(fpath);
+    if (android::base::EndsWith(path, ".odex") ||
+        android::base::EndsWith(path, ".vdex")) {
+      collected_files->push_back(std::move(path));
+    }
+  }
+  return 0;
+}
+
+// Run one preopt2cachename process in batch mode to map every name in
+// [preopt_names] (the locations the files will have on /system) to its
+// dalvik-cache location, where the runtime looks for it. Doing all the
+// translations over a pipe to a single child avoids paying the exec and
+// linker cost once per file. Names that fail to translate are simply absent
+// from [cache_names].
+static bool TranslateToCacheNames(
+    const std::vector<std::string>& preopt_names,
+    std::unordered_map<std::string, std::string>* cache_names) {
+  int in_fds[2];
+  int out_fds[2];
+  if (pipe(in_fds) != 0 || pipe(out_fds) != 0) {
+    PLOG(ERROR) << "Unable to create pipes for preopt2cachename";
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    PLOG(ERROR) << "Unable to fork preopt2cachename";
+    close(in_fds[0]);
+    close(in_fds[1]);
+    close(out_fds[0]);
+    close(out_fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    dup2(in_fds[0], STDIN_FILENO);
+    dup2(out_fds[1], STDOUT_FILENO);
+    close(in_fds[0]);
+    close(in_fds[1]);
+    close(out_fds[0]);
+    close(out_fds[1]);
+    execl(kPreopt2CacheNameBin, "preopt2cachename", "-", nullptr);
+    _exit(1);
+  }
+  close(in_fds[0]);
+  close(out_fds[1]);
+  // Feed the input from a separate thread while we drain the output, so
+  // neither side blocks on a full pipe.
+  std::thread writer([&preopt_names, in_fd = in_fds[1]]() {
+    for (const std::string& name : preopt_names) {
+      std::string line = name + "\n";
+      if (TEMP_FAILURE_RETRY(write(in_fd, line.c_str(), line.size())) !=
+          static_cast<ssize_t>(line.size())) {
+        break;
+      }
+    }
+    close(in_fd);
+  });
+  std::string output;
+  char buf[4096];
+  ssize_t bytes;
+  while ((bytes = TEMP_FAILURE_RETRY(read(out_fds[0], buf, sizeof(buf)))) > 0) {
+    output.append(buf, bytes);
+  }
+  close(out_fds[0]);
+  writer.join();
+  int status;
+  if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != pid ||
+      !WIFEXITED(status)) {
+    return false;
+  }
+  // Each output line is "<preopt-location> <cache-location>".
+  for (const std::string& line : android::base::Split(output, "\n")) {
+    size_t split = line.find(' ');
+    if (split == std::string::npos) {
+      continue;
+    }
+    (*cache_names)[line.substr(0, split)] = line.substr(split + 1);
+  }
+  return true;
+}
+
+// Copy [source] to [dest] through a temporary file, so the preopted file
+// appears atomically at [dest]. The copy stays in the kernel via sendfile(),
+// and the destination blocks are preallocated, so hundreds of MB on first
+// boot don't get pumped through a userspace buffer.
+static bool CopyFile(const std::string& source, const std::string& dest) {
+  android::base::unique_fd src_fd(
+      TEMP_FAILURE_RETRY(open(source.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (src_fd == -1) {
+    PLOG(WARNING) << "Unable to open file " << source;
+    return false;
+  }
+  struct stat st;
+  if (fstat(src_fd, &st) != 0) {
+    PLOG(WARNING) << "Unable to stat file " << source;
+    return false;
+  }
+  std::string temp_dest = dest + ".tmp";
+  android::base::unique_fd dst_fd(TEMP_FAILURE_RETRY(
+      open(temp_dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)));
+  if (dst_fd == -1) {
+    PLOG(WARNING) << "Unable to create file " << temp_dest;
+    return false;
+  }
+  // Reserve the blocks up front, so the filesystem doesn't allocate them
+  // piecemeal while we copy. Not supported everywhere, so failure is fine.
+  if (st.st_size > 0) {
+    fallocate(dst_fd, 0, 0, st.st_size);
+  }
+  off_t offset = 0;
+  while (offset < st.st_size) {
+    ssize_t copied = TEMP_FAILURE_RETRY(
+        sendfile(dst_fd, src_fd, &offset, st.st_size - offset));
+    if (copied <= 0) {
+      PLOG(WARNING) << "Unable to copy file " << source << " to " << temp_dest;
+      unlink(temp_dest.c_str());
+      return false;
+    }
+  }
+  // Make sure the contents are on disk before the rename publishes the file.
+  if (fsync(dst_fd) != 0) {
+    PLOG(WARNING) << "Unable to sync file " << temp_dest;
+    unlink(temp_dest.c_str());
+    return false;
+  }
+  if (rename(temp_dest.c_str(), dest.c_str()) != 0) {
+    PLOG(WARNING) << "Unable to rename temporary file from " << temp_dest
+                  << " to " << dest;
+    unlink(temp_dest.c_str());
+    return false;
+  }
+  return true;
+}
+
+static void CopyWorker(
+    const std::vector<std::string>& files,
+    const std::unordered_map<std::string, std::string>& cache_names,
+    std::atomic<size_t>* next_index) {
+  for (size_t i = next_index->fetch_add(1); i < files.size();
+       i = next_index->fetch_add(1)) {
+    const std::string& file = files[i];
+    auto it = cache_names.find(file);
+    if (it == cache_names.end()) {
+      LOG(WARNING) << "Unable to figure out destination for " << file;
+      continue;
+    }
+    if (CopyFile(file, it->second)) {
+      LOG(INFO) << "Copied file from " << file << " to " << it->second;
+    }
+  }
+}
+
+// This program copies the preopted odex/vdex files stored in the unused
+// system_other partition into the dalvik cache on first boot, so apps don't
+// need to be reoptimized on device.
+int main(int argc, char* argv[]) {
+  android::base::InitLogging(argv);
+  if (argc != 2) {
+    LOG(ERROR) << "Usage: cppreopts <preopts-mount-point>";
+    return 1;
+  }
+  // Create files with 644 (global read) permissions.
+  umask(0022);
+  std::string mountpoint = argv[1];
+  if (access((mountpoint + kOdexMarker).c_str(), F_OK) != 0) {
+    LOG(INFO) << "system_other partition does not appear to have been built "
+              << "to contain preopted files.";
+    return 1;
+  }
+  LOG(INFO) << "cppreopts from " << mountpoint;
+
+  std::vector<std::string> files;
+  collected_files = &files;
+  if (nftw(mountpoint.c_str(), CollectFile, 16, FTW_PHYS) != 0) {
+    PLOG(ERROR) << "Unable to walk " << mountpoint;
+    return 1;
+  }
+
+  // Map <mountpoint>/app/... to the /system/app/... names the files will
+  // have once this slot's system image is active, and translate them all to
+  // dalvik-cache names with a single preopt2cachename invocation.
+  std::vector<std::string> real_names;
+  real_names.reserve(files.size());
+  for (const std::string& file : files) {
+    real_names.push_back("/system" + file.substr(mountpoint.size()));
+  }
+  std::unordered_map<std::string, std::string> translated;
+  if (!TranslateToCacheNames(real_names, &translated)) {
+    LOG(ERROR) << "Unable to run " << kPreopt2CacheNameBin;
+    return 1;
+  }
+  std::unordered_map<std::string, std::string> cache_names;
+  for (size_t i = 0; i < files.size(); ++i) {
+    auto it = translated.find(real_names[i]);
+    if (it != translated.end()) {
+      cache_names[files[i]] = it->second;
+    }
+  }
+
+  // Copy independent files in parallel to speed things up.
+  std::atomic<size_t> next_index(0);
+  size_t thread_count = std::min(kMaxCopyThreads, files.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back(CopyWorker, std::cref(files), std::cref(cache_names),
+                         &next_index);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return 0;
+}
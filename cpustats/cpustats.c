@@ -29,13 +29,17 @@
  * SUCH DAMAGE.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MAX_BUF_SIZE 64
 
+#define NSEC_PER_SEC 1000000000LL
+
 struct freq_info {
     unsigned freq;
     long unsigned time;
@@ -50,14 +54,16 @@ struct cpu_info {
 #define die(...) { fprintf(stderr, __VA_ARGS__); exit(EXIT_FAILURE); }
 
 static struct cpu_info old_total_cpu, new_total_cpu, *old_cpus, *new_cpus;
-static int cpu_count, delay, iterations;
-static char minimal, aggregate_freq_stats;
+static int cpu_count, iterations;
+static long long interval_ns, sample_time_ns;
+static char minimal, aggregate_freq_stats, stream;
 
 static int get_cpu_count();
 static int get_cpu_count_from_file(char *filename);
 static long unsigned get_cpu_total_time(struct cpu_info *cpu);
 static int get_freq_scales_count(int cpu);
 static void print_stats();
+static void print_stream_header();
 static void print_cpu_stats(char *label, struct cpu_info *new_cpu, struct cpu_info *old_cpu,
         char print_freq);
 static void print_freq_stats(struct cpu_info *new_cpu, struct cpu_info *old_cpu);
@@ -69,12 +75,15 @@ static void usage(char *cmd);
 
 int main(int argc, char *argv[]) {
     struct cpu_info *tmp_cpus, tmp_total_cpu;
+    struct timespec next_wake, now;
+    double delay;
     int i, freq_count;
 
     delay = 3;
     iterations = -1;
     minimal = 0;
     aggregate_freq_stats = 0;
+    stream = 0;
 
     for (i = 0; i < argc; i++) {
         if (!strcmp(argv[i], "-n")) {
@@ -92,17 +101,28 @@ int main(int argc, char *argv[]) {
                 usage(argv[0]);
                 exit(EXIT_FAILURE);
             }
-            delay = atoi(argv[++i]);
+            delay = atof(argv[++i]);
+            if (delay <= 0) {
+                fprintf(stderr, "Option -d expects a positive number of seconds.\n");
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
             continue;
         }
         if (!strcmp(argv[i], "-m")) {
             minimal = 1;
         }
+        if (!strcmp(argv[i], "-s")) {
+            /* streaming implies the machine readable format */
+            stream = 1;
+            minimal = 1;
+        }
         if (!strcmp(argv[i], "-h")) {
             usage(argv[0]);
             exit(EXIT_SUCCESS);
         }
     }
+    interval_ns = (long long)(delay * NSEC_PER_SEC);
 
     cpu_count = get_cpu_count();
     if (cpu_count < 1) die("Unexpected cpu count\n");
@@ -137,6 +157,12 @@ int main(int argc, char *argv[]) {
         read_stats();
     }
 
+    if (stream) {
+        print_stream_header();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &next_wake);
+
     while ((iterations == -1) || (iterations-- > 0)) {
         // Swap new and old cpu buffers;
         tmp_total_cpu = old_total_cpu;
@@ -147,7 +173,24 @@ int main(int argc, char *argv[]) {
         old_cpus = new_cpus;
         new_cpus = tmp_cpus;
 
-        sleep(delay);
+        // Sleep until an absolute deadline so the sampling rate does not
+        // drift by the time spent reading and printing the stats.
+        next_wake.tv_nsec += interval_ns % NSEC_PER_SEC;
+        next_wake.tv_sec += interval_ns / NSEC_PER_SEC;
+        if (next_wake.tv_nsec >= NSEC_PER_SEC) {
+            next_wake.tv_nsec -= NSEC_PER_SEC;
+            next_wake.tv_sec++;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_wake, NULL)) ;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sample_time_ns = now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+        // If we fell more than a full interval behind, resync the deadline
+        // instead of printing a burst of back to back samples.
+        if (sample_time_ns - (next_wake.tv_sec * NSEC_PER_SEC + next_wake.tv_nsec) > interval_ns) {
+            next_wake = now;
+        }
+
         read_stats();
         print_stats();
     }
@@ -312,6 +355,17 @@ static void print_stats() {
         print_cpu_stats(label, &new_cpus[i], &old_cpus[i], print_freq);
     }
     printf("\n");
+    if (stream) {
+        fflush(stdout);
+    }
+}
+
+/*
+ * Print a one time header describing the streaming CSV columns.
+ */
+static void print_stream_header() {
+    printf("#timestamp_ns,cpu,user,nice,sys,idle,iow,irq,sirq[,freq_khz,time]...\n");
+    fflush(stdout);
 }
 
 /*
@@ -337,6 +391,9 @@ static void print_cpu_stats(char *label, struct cpu_info *new_cpu, struct cpu_in
             print_freq_stats(new_cpu, old_cpu);
         }
     } else {
+        if (stream) {
+            printf("%lld,", sample_time_ns);
+        }
         printf("%s,%ld,%ld,%ld,%ld,%ld,%ld,%ld", label,
                 new_cpu->utime - old_cpu->utime,
                 new_cpu->ntime - old_cpu->ntime,
@@ -430,10 +487,11 @@ static char should_aggregate_freq_stats() {
  * Print the usage message.
  */
 static void usage(char *cmd) {
-    fprintf(stderr, "Usage %s [ -n iterations ] [ -d delay ] [ -c cpu ] [ -m ] [ -h ]\n"
+    fprintf(stderr, "Usage %s [ -n iterations ] [ -d delay ] [ -c cpu ] [ -m ] [ -s ] [ -h ]\n"
             "    -n num  Updates to show before exiting.\n"
-            "    -d num  Seconds to wait between updates.\n"
+            "    -d num  Seconds to wait between updates, may be fractional.\n"
             "    -m      Display minimal output.\n"
+            "    -s      Stream minimal output with monotonic timestamps.\n"
             "    -h      Display this help screen.\n",
             cmd);
 }
@@ -4,6 +4,7 @@ include $(CLEAR_VARS)
 
 LOCAL_CFLAGS := -O0 -march=armv8-a+crypto
 LOCAL_SRC_FILES := crypto.cpp
+LOCAL_SHARED_LIBRARIES := libcrypto
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
 LOCAL_MODULE_TAGS := debug
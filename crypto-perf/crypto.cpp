@@ -6,20 +6,126 @@
 #include <sched.h>
 #include <sys/resource.h>
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
 #define USEC_PER_SEC 1000000ULL
 #define MAX_COUNT 1000000000ULL
 #define NUM_INSTS_GARBAGE 18
 
+// Batched mode processes bio segment sized buffers between 4K and 128K.
+#define BATCH_MIN_SIZE 4096
+#define BATCH_MAX_SIZE 131072
+// Bytes to process per thread at each buffer size.
+#define BATCH_BYTES_PER_SIZE (64ULL << 20)
+// Old kernels limit an skcipher request on an AF_ALG socket to
+// ALG_MAX_PAGES pages, so larger buffers are split the same way
+// dm-crypt splits oversized bios.
+#define AFALG_MAX_CHUNK (16 * 4096)
+
+#define BATCH_ALG_AES 0x1
+#define BATCH_ALG_SHA 0x2
+#define BATCH_ENGINE_KERNEL 0x1
+#define BATCH_ENGINE_OPENSSL 0x2
+
 // Contains information about benchmark options.
 typedef struct {
     int cpu_to_lock;
     int locked_freq;
+    int batch;
+    int threads;
+    int algs;
+    int engines;
 } command_data_t;
 
+// Per-thread state for the batched mode.
+typedef struct {
+    pthread_t thread_id;
+    int cpu;
+    int batch;
+    size_t size;
+    int alg;
+    int engine;
+    unsigned long long bytes;
+    long long cycles;
+    long long instructions;
+    int error;
+} batch_thread_t;
+
+// Opens a hardware counter on the calling thread. Kernel mode is
+// included on purpose: the AF_ALG engine does its work in the kernel.
+// Returns -1 where perf_event_open is unavailable or restricted.
+static int perfOpen(unsigned int type, unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perfStart(int fd) {
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+// Returns the count, or -1 if the counter could not be opened or read.
+static long long perfStop(int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    long long value;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return -1;
+    }
+    return value;
+}
+
+static void perfClose(int fd) {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static const unsigned char batch_aes_key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+static const unsigned char batch_aes_iv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
+
 void usage() {
     printf("--------------------------------------------------------------------------------\n");
     printf("Usage:");
-    printf("	crypto [--cpu_to_lock CPU] [--locked_freq FREQ_IN_KHZ]\n\n");
+    printf("	crypto [--cpu_to_lock CPU] [--locked_freq FREQ_IN_KHZ]\n");
+    printf("	       [--batch NUM_BUFFERS] [--threads NUM_THREADS]\n");
+    printf("	       [--alg aes|sha] [--engine kernel|openssl]\n\n");
+    printf("Without --batch, runs the crypto instruction throughput loops.\n");
+    printf("With --batch, encrypts/hashes batches of NUM_BUFFERS independent\n");
+    printf("buffers at bio segment sizes (4K..128K) and reports GB/s and\n");
+    printf("cycles/byte per size, through the kernel (AF_ALG) and userspace\n");
+    printf("(OpenSSL) engines. --alg and --engine restrict the runs.\n\n");
     printf("!!!!!!Lock the desired core to a desired frequency before invoking this benchmark.\n");
     printf(
           "Hint: Set scaling_max_freq=scaling_min_freq=FREQ_IN_KHZ. FREQ_IN_KHZ "
@@ -31,6 +137,10 @@ int processOptions(int argc, char **argv, command_data_t *cmd_data) {
     // Initialize the command_flags.
     cmd_data->cpu_to_lock = 0;
     cmd_data->locked_freq = 1;
+    cmd_data->batch = 0;
+    cmd_data->threads = 1;
+    cmd_data->algs = BATCH_ALG_AES | BATCH_ALG_SHA;
+    cmd_data->engines = BATCH_ENGINE_KERNEL | BATCH_ENGINE_OPENSSL;
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
             int *save_value = NULL;
@@ -38,6 +148,38 @@ int processOptions(int argc, char **argv, command_data_t *cmd_data) {
                 save_value = &cmd_data->cpu_to_lock;
 	    } else if (strcmp(argv[i], "--locked_freq") == 0) {
                 save_value = &cmd_data->locked_freq;
+            } else if (strcmp(argv[i], "--batch") == 0) {
+                save_value = &cmd_data->batch;
+            } else if (strcmp(argv[i], "--threads") == 0) {
+                save_value = &cmd_data->threads;
+            } else if (strcmp(argv[i], "--alg") == 0) {
+                if (i == argc - 1) {
+                    printf("The option %s requires one argument.\n", argv[i]);
+                    return -1;
+                }
+                i++;
+                if (strcmp(argv[i], "aes") == 0) {
+                    cmd_data->algs = BATCH_ALG_AES;
+                } else if (strcmp(argv[i], "sha") == 0) {
+                    cmd_data->algs = BATCH_ALG_SHA;
+                } else {
+                    printf("Unknown algorithm %s\n", argv[i]);
+                    return -1;
+                }
+            } else if (strcmp(argv[i], "--engine") == 0) {
+                if (i == argc - 1) {
+                    printf("The option %s requires one argument.\n", argv[i]);
+                    return -1;
+                }
+                i++;
+                if (strcmp(argv[i], "kernel") == 0) {
+                    cmd_data->engines = BATCH_ENGINE_KERNEL;
+                } else if (strcmp(argv[i], "openssl") == 0) {
+                    cmd_data->engines = BATCH_ENGINE_OPENSSL;
+                } else {
+                    printf("Unknown engine %s\n", argv[i]);
+                    return -1;
+                }
             } else {
                 printf("Unknown option %s\n", argv[i]);
                 return -1;
@@ -56,6 +198,334 @@ int processOptions(int argc, char **argv, command_data_t *cmd_data) {
             }
 	}
     }
+    if (cmd_data->batch < 0) {
+        printf("The --batch value must be a positive number.\n");
+        return -1;
+    }
+    if (cmd_data->threads < 1) {
+        printf("The --threads value must be at least one.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Creates the AF_ALG transform and operation sockets for the given
+// kernel algorithm.
+static int kernelSetup(const char *type, const char *name, int set_key,
+                       int *tfmfd, int *opfd) {
+    struct sockaddr_alg sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    strcpy((char *)sa.salg_type, type);
+    strcpy((char *)sa.salg_name, name);
+    *tfmfd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+    if (*tfmfd < 0) {
+        perror("AF_ALG socket failed");
+        return -1;
+    }
+    if (bind(*tfmfd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        printf("AF_ALG bind of %s(%s) failed: %s\n", type, name,
+               strerror(errno));
+        close(*tfmfd);
+        return -1;
+    }
+    if (set_key &&
+        setsockopt(*tfmfd, SOL_ALG, ALG_SET_KEY, batch_aes_key,
+                   sizeof(batch_aes_key)) < 0) {
+        perror("ALG_SET_KEY failed");
+        close(*tfmfd);
+        return -1;
+    }
+    *opfd = accept(*tfmfd, NULL, NULL);
+    if (*opfd < 0) {
+        perror("AF_ALG accept failed");
+        close(*tfmfd);
+        return -1;
+    }
+    return 0;
+}
+
+// Encrypts one buffer through the kernel skcipher, splitting it into
+// chunks the AF_ALG interface is guaranteed to accept in one request.
+static int kernelEncrypt(int opfd, unsigned char *in, unsigned char *out,
+                         size_t size) {
+    size_t off = 0;
+    while (off < size) {
+        size_t chunk = size - off;
+        if (chunk > AFALG_MAX_CHUNK) {
+            chunk = AFALG_MAX_CHUNK;
+        }
+        char cbuf[CMSG_SPACE(4) + CMSG_SPACE(4 + sizeof(batch_aes_iv))];
+        memset(cbuf, 0, sizeof(cbuf));
+        struct iovec iov;
+        iov.iov_base = in + off;
+        iov.iov_len = chunk;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_ALG;
+        cmsg->cmsg_type = ALG_SET_OP;
+        cmsg->cmsg_len = CMSG_LEN(4);
+        *(uint32_t *)CMSG_DATA(cmsg) = ALG_OP_ENCRYPT;
+        cmsg = CMSG_NXTHDR(&msg, cmsg);
+        cmsg->cmsg_level = SOL_ALG;
+        cmsg->cmsg_type = ALG_SET_IV;
+        cmsg->cmsg_len = CMSG_LEN(4 + sizeof(batch_aes_iv));
+        struct af_alg_iv *alg_iv = (struct af_alg_iv *)CMSG_DATA(cmsg);
+        alg_iv->ivlen = sizeof(batch_aes_iv);
+        memcpy(alg_iv->iv, batch_aes_iv, sizeof(batch_aes_iv));
+        if (sendmsg(opfd, &msg, 0) != (ssize_t)chunk) {
+            perror("AF_ALG sendmsg failed");
+            return -1;
+        }
+        if (read(opfd, out + off, chunk) != (ssize_t)chunk) {
+            perror("AF_ALG read failed");
+            return -1;
+        }
+        off += chunk;
+    }
+    return 0;
+}
+
+static int kernelHash(int opfd, unsigned char *in, size_t size,
+                      unsigned char *digest) {
+    if (send(opfd, in, size, 0) != (ssize_t)size) {
+        perror("AF_ALG send failed");
+        return -1;
+    }
+    if (read(opfd, digest, SHA256_DIGEST_LENGTH) != SHA256_DIGEST_LENGTH) {
+        perror("AF_ALG read failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Processes this thread's batch of independent buffers over and over
+// until BATCH_BYTES_PER_SIZE bytes have gone through the engine.
+void *batchThread(void *data) {
+    batch_thread_t *thread = (batch_thread_t *)data;
+    thread->error = 1;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(thread->cpu, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+        perror("sched_setaffinity failed");
+        return NULL;
+    }
+
+    unsigned char **buffers =
+        (unsigned char **)malloc(thread->batch * sizeof(unsigned char *));
+    unsigned char *out = (unsigned char *)malloc(thread->size);
+    if (buffers == NULL || out == NULL) {
+        printf("Cannot allocate batch buffers.\n");
+        return NULL;
+    }
+    for (int i = 0; i < thread->batch; i++) {
+        buffers[i] = (unsigned char *)malloc(thread->size);
+        if (buffers[i] == NULL) {
+            printf("Cannot allocate batch buffers.\n");
+            return NULL;
+        }
+        // Independent, non-trivial contents per buffer.
+        for (size_t j = 0; j < thread->size; j++) {
+            buffers[i][j] = (unsigned char)(j ^ (i + thread->cpu));
+        }
+    }
+
+    unsigned long long iters =
+        BATCH_BYTES_PER_SIZE / ((unsigned long long)thread->batch * thread->size);
+    if (iters == 0) {
+        iters = 1;
+    }
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    int tfmfd = -1;
+    int opfd = -1;
+    EVP_CIPHER_CTX *ctx = NULL;
+    if (thread->engine == BATCH_ENGINE_KERNEL) {
+        if (thread->alg == BATCH_ALG_AES) {
+            if (kernelSetup("skcipher", "cbc(aes)", 1, &tfmfd, &opfd) == -1) {
+                return NULL;
+            }
+        } else {
+            if (kernelSetup("hash", "sha256", 0, &tfmfd, &opfd) == -1) {
+                return NULL;
+            }
+        }
+    } else if (thread->alg == BATCH_ALG_AES) {
+        ctx = EVP_CIPHER_CTX_new();
+        if (ctx == NULL) {
+            printf("Cannot allocate cipher context.\n");
+            return NULL;
+        }
+    }
+
+    int cycles_fd = perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    int insns_fd = perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perfStart(cycles_fd);
+    perfStart(insns_fd);
+
+    for (unsigned long long it = 0; it < iters; it++) {
+        for (int i = 0; i < thread->batch; i++) {
+            if (thread->engine == BATCH_ENGINE_KERNEL) {
+                if (thread->alg == BATCH_ALG_AES) {
+                    if (kernelEncrypt(opfd, buffers[i], out, thread->size) == -1) {
+                        return NULL;
+                    }
+                } else {
+                    if (kernelHash(opfd, buffers[i], thread->size, digest) == -1) {
+                        return NULL;
+                    }
+                }
+            } else if (thread->alg == BATCH_ALG_AES) {
+                int outl;
+                if (!EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL,
+                                        batch_aes_key, batch_aes_iv) ||
+                    !EVP_CIPHER_CTX_set_padding(ctx, 0) ||
+                    !EVP_EncryptUpdate(ctx, out, &outl, buffers[i],
+                                       thread->size) ||
+                    !EVP_EncryptFinal_ex(ctx, out + outl, &outl)) {
+                    printf("OpenSSL encrypt failed.\n");
+                    return NULL;
+                }
+            } else {
+                SHA256(buffers[i], thread->size, digest);
+            }
+        }
+    }
+    thread->cycles = perfStop(cycles_fd);
+    thread->instructions = perfStop(insns_fd);
+    perfClose(cycles_fd);
+    perfClose(insns_fd);
+    thread->bytes = iters * (unsigned long long)thread->batch * thread->size;
+
+    if (ctx != NULL) {
+        EVP_CIPHER_CTX_free(ctx);
+    }
+    if (opfd != -1) {
+        close(opfd);
+    }
+    if (tfmfd != -1) {
+        close(tfmfd);
+    }
+    for (int i = 0; i < thread->batch; i++) {
+        free(buffers[i]);
+    }
+    free(buffers);
+    free(out);
+    thread->error = 0;
+    return NULL;
+}
+
+// Runs one engine/algorithm combination over the bio segment size
+// sweep and prints GB/s plus cycles/byte per size.
+int benchmarkBatchedOne(command_data_t *cmd_data, int engine, int alg) {
+    int num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    batch_thread_t *threads =
+        (batch_thread_t *)calloc(cmd_data->threads, sizeof(batch_thread_t));
+    if (threads == NULL) {
+        printf("Cannot allocate thread data.\n");
+        return -1;
+    }
+
+    fprintf(stderr, "%s %s: batch %d, threads %d\n",
+            engine == BATCH_ENGINE_KERNEL ? "kernel" : "openssl",
+            alg == BATCH_ALG_AES ? "aes-128-cbc" : "sha256",
+            cmd_data->batch, cmd_data->threads);
+    for (size_t size = BATCH_MIN_SIZE; size <= BATCH_MAX_SIZE; size <<= 1) {
+        struct timeval begin_time, end_time, elapsed_time;
+        gettimeofday(&begin_time, NULL);
+        for (int t = 0; t < cmd_data->threads; t++) {
+            threads[t].cpu = (cmd_data->cpu_to_lock + t) % num_cpus;
+            threads[t].batch = cmd_data->batch;
+            threads[t].size = size;
+            threads[t].alg = alg;
+            threads[t].engine = engine;
+            threads[t].bytes = 0;
+            if (pthread_create(&threads[t].thread_id, NULL, batchThread,
+                               &threads[t]) != 0) {
+                printf("Cannot create batch thread.\n");
+                free(threads);
+                return -1;
+            }
+        }
+        unsigned long long total_bytes = 0;
+        long long total_cycles = 0;
+        long long total_insns = 0;
+        int errors = 0;
+        for (int t = 0; t < cmd_data->threads; t++) {
+            pthread_join(threads[t].thread_id, NULL);
+            total_bytes += threads[t].bytes;
+            errors += threads[t].error;
+            if (total_cycles >= 0 && threads[t].cycles >= 0) {
+                total_cycles += threads[t].cycles;
+            } else {
+                total_cycles = -1;
+            }
+            if (total_insns >= 0 && threads[t].instructions >= 0) {
+                total_insns += threads[t].instructions;
+            } else {
+                total_insns = -1;
+            }
+        }
+        gettimeofday(&end_time, NULL);
+        if (errors != 0) {
+            free(threads);
+            return -1;
+        }
+        timersub(&end_time, &begin_time, &elapsed_time);
+        unsigned long long elapsed_us =
+            elapsed_time.tv_sec * USEC_PER_SEC + elapsed_time.tv_usec;
+        fprintf(stderr, "  size %6zu: %8.3f GB/s",
+                size,
+                ((double)total_bytes / (1ULL << 30)) /
+                    ((double)elapsed_us / USEC_PER_SEC));
+        if (total_cycles > 0) {
+            // Counted cycles are frequency-independent, so these
+            // numbers compare across devices and governors.
+            fprintf(stderr, ", %8.3f cycles/byte",
+                    (double)total_cycles / total_bytes);
+            if (total_insns > 0) {
+                fprintf(stderr, ", %5.2f insn/cycle",
+                        (double)total_insns / total_cycles);
+            }
+        } else if (cmd_data->locked_freq != 0) {
+            // No counters (perf_event restricted): estimate from the
+            // locked frequency. locked_freq is in kHz, so freq * 1000
+            // * seconds gives the cycles spent on each locked core.
+            fprintf(stderr, ", %8.3f cycles/byte (est)",
+                    (double)cmd_data->locked_freq * 1000.0 *
+                        ((double)elapsed_us / USEC_PER_SEC) *
+                        cmd_data->threads / total_bytes);
+        }
+        fprintf(stderr, "\n");
+    }
+    free(threads);
+    return 0;
+}
+
+int benchmarkBatched(command_data_t *cmd_data) {
+    static const int engines[] = { BATCH_ENGINE_KERNEL, BATCH_ENGINE_OPENSSL };
+    static const int algs[] = { BATCH_ALG_AES, BATCH_ALG_SHA };
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+        if ((cmd_data->engines & engines[e]) == 0) {
+            continue;
+        }
+        for (size_t a = 0; a < sizeof(algs) / sizeof(algs[0]); a++) {
+            if ((cmd_data->algs & algs[a]) == 0) {
+                continue;
+            }
+            if (benchmarkBatchedOne(cmd_data, engines[e], algs[a]) == -1) {
+                return -1;
+            }
+            printf("--------------------------------------------------------------------------------\n");
+        }
+    }
     return 0;
 }
 /* Performs encryption on garbage values. In Cortex-A57 r0p1 and later
@@ -123,12 +593,20 @@ int main(int argc, char **argv) {
 	perror("sched_setaffinity failed");
 	return false;
     }
+    if (cmd_data.batch > 0) {
+        return benchmarkBatched(&cmd_data);
+    }
+    int cycles_fd = perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    long long cycles;
+
+    perfStart(cycles_fd);
     gettimeofday(&begin_time, NULL);
     while (count < MAX_COUNT) {
       garbage_encrypt();
       count++;
     }
     gettimeofday(&end_time, NULL);
+    cycles = perfStop(cycles_fd);
     timersub(&end_time, &begin_time, &elapsed_time);
     fprintf(stderr, "encrypt: %llu us\n",
             elapsed_time.tv_sec * USEC_PER_SEC + elapsed_time.tv_usec);
@@ -137,8 +615,12 @@ int main(int argc, char **argv) {
     fprintf(stderr, "encrypt instructions per second: %f\n",
             (float)(MAX_COUNT * NUM_INSTS_GARBAGE * USEC_PER_SEC) /
                 (elapsed_time.tv_sec * USEC_PER_SEC + elapsed_time.tv_usec));
-    if (cmd_data.locked_freq != 0) {
+    if (cycles > 0) {
+	fprintf(stderr, "encrypt cycles: %lld\n", cycles);
 	fprintf(stderr, "encrypt instructions per cycle: %f\n",
+		(float)(MAX_COUNT * NUM_INSTS_GARBAGE) / cycles);
+    } else if (cmd_data.locked_freq != 0) {
+	fprintf(stderr, "encrypt instructions per cycle (est): %f\n",
 		(float)(MAX_COUNT * NUM_INSTS_GARBAGE * USEC_PER_SEC) /
 		((elapsed_time.tv_sec * USEC_PER_SEC + elapsed_time.tv_usec) *
 		 1000 * cmd_data.locked_freq));
@@ -146,12 +628,14 @@ int main(int argc, char **argv) {
     printf("--------------------------------------------------------------------------------\n");
 
     count = 0;
+    perfStart(cycles_fd);
     gettimeofday(&begin_time, NULL);
     while (count < MAX_COUNT) {
       garbage_decrypt();
       count++;
     }
     gettimeofday(&end_time, NULL);
+    cycles = perfStop(cycles_fd);
     timersub(&end_time, &begin_time, &elapsed_time);
     fprintf(stderr, "decrypt: %llu us\n",
             elapsed_time.tv_sec * USEC_PER_SEC + elapsed_time.tv_usec);
@@ -160,11 +644,16 @@ int main(int argc, char **argv) {
     fprintf(stderr, "decrypt instructions per second: %f\n",
             (float)(MAX_COUNT * NUM_INSTS_GARBAGE * USEC_PER_SEC) /
                 (elapsed_time.tv_sec * USEC_PER_SEC + elapsed_time.tv_usec));
-    if (cmd_data.locked_freq != 0) {
+    if (cycles > 0) {
+	fprintf(stderr, "decrypt cycles: %lld\n", cycles);
 	fprintf(stderr, "decrypt instructions per cycle: %f\n",
+		(float)(MAX_COUNT * NUM_INSTS_GARBAGE) / cycles);
+    } else if (cmd_data.locked_freq != 0) {
+	fprintf(stderr, "decrypt instructions per cycle (est): %f\n",
 		(float)(MAX_COUNT * NUM_INSTS_GARBAGE * USEC_PER_SEC) /
 		((elapsed_time.tv_sec * USEC_PER_SEC + elapsed_time.tv_usec) *
 		 1000 * cmd_data.locked_freq));
     }
+    perfClose(cycles_fd);
     return 0;
 }
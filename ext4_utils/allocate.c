@@ -234,6 +234,7 @@ static void free_blocks(struct block_group_info *bg, u32 block, u32 num_blocks)
 	for (i = 0; i < num_blocks; i++, block--)
 		bg->block_bitmap[block / 8] &= ~(1 << (block % 8));
 	bg->free_blocks += num_blocks;
+	bg->max_hole_stale = true;
 	for (i = bg->chunk_count; i > 0 ;) {
 		--i;
 		if (bg->chunks[i].len >= num_blocks && bg->chunks[i].block <= block) {
@@ -349,6 +350,30 @@ void block_allocator_free()
 	free(aux_info.bgs);
 }
 
+/* Recomputes the size of the largest free hole between the chunks of a
+   block group.  Chunks are kept sorted by block, so the holes are the gaps
+   between consecutive chunks */
+static u32 bg_max_hole(struct block_group_info *bg)
+{
+	int j;
+	u32 max_hole = 0;
+
+	if (!bg->max_hole_stale)
+		return bg->max_hole;
+
+	for (j = 1; j < bg->chunk_count; j++) {
+		u32 hole_start = bg->chunks[j-1].block + bg->chunks[j-1].len;
+		u32 hole_size = bg->chunks[j].block - hole_start;
+		if (hole_size > max_hole)
+			max_hole = hole_size;
+	}
+
+	bg->max_hole = max_hole;
+	bg->max_hole_stale = false;
+
+	return max_hole;
+}
+
 /* Allocate a single block and return its block number */
 u32 allocate_block()
 {
@@ -368,11 +393,34 @@ static struct region *ext4_allocate_best_fit_partial(u32 len)
 	int j;
 	unsigned int found_bg = 0, found_prev_chunk = 0, found_block = 0;
 	u32 found_allocate_len = 0;
-	bool minimize = false;
 	struct block_group_info *bgs = aux_info.bgs;
 	struct region *reg;
 
+	u32 largest_hole = 0;
+
+	/* consult the cached largest hole of each block group first, so groups
+	   that cannot satisfy the request are skipped without scanning their
+	   chunks */
+	for (i = 0; i < aux_info.groups; i++) {
+		u32 max_hole = bg_max_hole(&bgs[i]);
+		if (max_hole > largest_hole)
+			largest_hole = max_hole;
+	}
+
+	if (largest_hole == 0) {
+		error("failed to allocate %u blocks, out of space?", len);
+		return NULL;
+	}
+
+	if (largest_hole < len) {
+		/* no hole fits the whole request; allocate the largest one and
+		   let the caller loop for the rest */
+		len = largest_hole;
+	}
+
 	for (i = 0; i < aux_info.groups; i++) {
+		if (bg_max_hole(&bgs[i]) < len)
+			continue;
 		for (j = 1; j < bgs[i].chunk_count; j++) {
 			u32 hole_start, hole_size;
 			hole_start = bgs[i].chunks[j-1].block + bgs[i].chunks[j-1].len;
@@ -389,14 +437,6 @@ static struct region *ext4_allocate_best_fit_partial(u32 len)
 				found_prev_chunk = j - 1;
 				found_block = hole_start;
 				found_allocate_len = hole_size;
-				minimize = true;
-			} else if (!minimize) {
-				if (found_allocate_len < hole_size) {
-					found_bg = i;
-					found_prev_chunk = j - 1;
-					found_block = hole_start;
-					found_allocate_len = hole_size;
-				}
 			}
 		}
 	}
@@ -405,10 +445,11 @@ static struct region *ext4_allocate_best_fit_partial(u32 len)
 		error("failed to allocate %u blocks, out of space?", len);
 		return NULL;
 	}
-	if (found_allocate_len > len) found_allocate_len = len;
+	found_allocate_len = len;
 done:
 	// reclaim allocated space in chunk
 	bgs[found_bg].chunks[found_prev_chunk].len += found_allocate_len;
+	bgs[found_bg].max_hole_stale = true;
 	if (reserve_blocks(&bgs[found_bg],
 				found_bg,
 				found_block,
@@ -812,6 +853,7 @@ void reserve_bg_chunk(int bg, u32 start_block, u32 size) {
 	bgs[bg].chunks[chunk_count].len = size;
 	bgs[bg].chunks[chunk_count].bg = bg;
 	bgs[bg].chunk_count++;
+	bgs[bg].max_hole_stale = true;
 }
 
 int reserve_blocks_for_allocation(struct block_allocation *alloc) {
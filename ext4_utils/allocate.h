@@ -60,6 +60,10 @@ struct block_group_info {
 	int chunk_count;
 	int max_chunk_count;
 	struct region *chunks;
+	/* cached size of the largest free hole between chunks; recomputed
+	   lazily when max_hole_stale is set */
+	u32 max_hole;
+	int max_hole_stale;
 };
 
 void block_allocator_init();
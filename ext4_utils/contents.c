@@ -24,7 +24,8 @@
 #include "ext4_utils/ext4_utils.h"
 #include "ext4_utils/make_ext4fs.h"
 #include "extent.h"
-#include "indirect.h"
+#include "readahead.h"
+#include "sha1.h"
 
 #ifdef __ANDROID__
 #include <linux/capability.h>
@@ -45,6 +46,88 @@ struct block_allocation* get_saved_allocation_chain() {
 	return saved_allocation_head;
 }
 
+/* Files created so far, for content dedup.  Hashes are computed lazily, so
+   a file whose size never recurs is not read an extra time. */
+struct dedup_entry {
+	u64 size;
+	int hashed;
+	u8 sha1[SHA1_DIGEST_LENGTH];
+	char *filename;
+	u32 inode_num;
+	struct dedup_entry *next;
+};
+
+static struct dedup_entry *dedup_entries = NULL;
+
+static int hash_file_contents(const char *filename, u8 *digest)
+{
+	char buf[65536];
+	SHA1_CTX ctx;
+	size_t len;
+	FILE *f = fopen(filename, "rb");
+
+	if (!f) {
+		error_errno("fopen %s", filename);
+		return -1;
+	}
+
+	SHA1Init(&ctx);
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		SHA1Update(&ctx, (const u_char *)buf, len);
+
+	if (ferror(f)) {
+		error("failed to read %s", filename);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	SHA1Final(digest, &ctx);
+	return 0;
+}
+
+/* Returns the inode number of an already-created file with the same
+   contents, or 0 if there is none */
+static u32 find_duplicate(const char *filename, u64 len)
+{
+	struct dedup_entry *entry;
+	u8 digest[SHA1_DIGEST_LENGTH];
+	int have_digest = 0;
+
+	for (entry = dedup_entries; entry; entry = entry->next) {
+		if (entry->size != len)
+			continue;
+		if (!have_digest) {
+			if (hash_file_contents(filename, digest))
+				return 0;
+			have_digest = 1;
+		}
+		if (!entry->hashed) {
+			if (hash_file_contents(entry->filename, entry->sha1))
+				continue;
+			entry->hashed = 1;
+		}
+		if (!memcmp(digest, entry->sha1, SHA1_DIGEST_LENGTH))
+			return entry->inode_num;
+	}
+
+	return 0;
+}
+
+static void remember_file(const char *filename, u64 len, u32 inode_num)
+{
+	struct dedup_entry *entry = calloc(1, sizeof(struct dedup_entry));
+
+	if (!entry)
+		critical_error_errno("calloc");
+
+	entry->size = len;
+	entry->filename = strdup(filename);
+	entry->inode_num = inode_num;
+	entry->next = dedup_entries;
+	dedup_entries = entry;
+}
+
 static u32 dentry_size(u32 entries, struct dentry *dentries)
 {
 	u32 len = 24;
@@ -180,6 +263,15 @@ u32 make_file(const char *filename, u64 len)
 {
 	struct ext4_inode *inode;
 	u32 inode_num;
+	u32 dup_inode_num = 0;
+
+	/* this file's turn has come; let the prefetch workers move further
+	   ahead of the build cursor */
+	if (len > 0)
+		readahead_consume(len);
+
+	if (info.dedup && len > 0)
+		dup_inode_num = find_duplicate(filename, len);
 
 	inode_num = allocate_inode(info);
 	if (inode_num == EXT4_ALLOCATE_FAILED) {
@@ -193,13 +285,28 @@ u32 make_file(const char *filename, u64 len)
 		return EXT4_ALLOCATE_FAILED;
 	}
 
-	if (len > 0) {
+	if (dup_inode_num) {
+		/* Point this inode at the blocks of the identical file that was
+		   already created.  i_block holds either the inline extents or
+		   an index to an extent block, so copying it shares either form,
+		   including the extent block itself. */
+		struct ext4_inode *dup_inode = get_inode(dup_inode_num);
+
+		memcpy(inode->i_block, dup_inode->i_block, sizeof(inode->i_block));
+		inode->i_flags |= EXT4_EXTENTS_FL;
+		inode->i_size_lo = dup_inode->i_size_lo;
+		inode->i_size_high = dup_inode->i_size_high;
+		inode->i_blocks_lo = dup_inode->i_blocks_lo;
+		inode->osd2.linux2.l_i_blocks_high = dup_inode->osd2.linux2.l_i_blocks_high;
+	} else if (len > 0) {
 		struct block_allocation* alloc = inode_allocate_file_extents(inode, len, filename);
 		if (alloc) {
 			alloc->filename = strdup(filename);
 			alloc->next = saved_allocation_head;
 			saved_allocation_head = alloc;
 		}
+		if (info.dedup)
+			remember_file(filename, len, inode_num);
 	}
 
 	inode->i_mode = S_IFREG;
@@ -237,9 +344,18 @@ u32 make_link(const char *link)
 		/* Fast symlink */
 		memcpy((char*)inode->i_block, link, len);
 	} else {
-		u8 *data = inode_allocate_data_indirect(inode, info.block_size, info.block_size);
+		/* Slow symlink: store the target in an extent-mapped block,
+		   like every other inode the builder emits */
+		u8 *data = inode_allocate_data_extents(inode, info.block_size, info.block_size);
+		if (data == NULL) {
+			error("failed to allocate data block for symlink");
+			return EXT4_ALLOCATE_FAILED;
+		}
 		memcpy(data, link, len);
-		inode->i_blocks_lo = info.block_size / 512;
+		/* inode_allocate_data_extents sizes the inode for the whole
+		   block; a symlink's size is its target length */
+		inode->i_size_lo = len;
+		inode->i_size_high = 0;
 	}
 
 	return inode_num;
@@ -78,12 +78,18 @@ static void policy_to_hex(const char* policy, char* hex) {
     hex[EXT4_KEY_DESCRIPTOR_SIZE_HEX - 1] = '\0';
 }
 
-static bool is_dir_empty(const char *dirname, bool *is_empty)
+static bool is_dir_empty(int base_dirfd, const char *dirname, bool *is_empty)
 {
     int n = 0;
-    auto dirp = std::unique_ptr<DIR, int (*)(DIR*)>(opendir(dirname), closedir);
+    int fd = openat(base_dirfd, dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        PLOG(ERROR) << "Unable to read directory: " << dirname;
+        return false;
+    }
+    auto dirp = std::unique_ptr<DIR, int (*)(DIR*)>(fdopendir(fd), closedir);
     if (!dirp) {
         PLOG(ERROR) << "Unable to read directory: " << dirname;
+        close(fd);
         return false;
     }
     for (;;) {
@@ -123,15 +129,15 @@ static uint8_t e4crypt_get_policy_flags(int filenames_encryption_mode) {
     return EXT4_POLICY_FLAGS_PAD_4;
 }
 
-static bool e4crypt_policy_set(const char *directory, const char *policy,
-                               size_t policy_length,
+static bool e4crypt_policy_set(int base_dirfd, const char *directory,
+                               const char *policy, size_t policy_length,
                                int contents_encryption_mode,
                                int filenames_encryption_mode) {
     if (policy_length != EXT4_KEY_DESCRIPTOR_SIZE) {
         LOG(ERROR) << "Policy wrong length: " << policy_length;
         return false;
     }
-    int fd = open(directory, O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int fd = openat(base_dirfd, directory, O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
     if (fd == -1) {
         PLOG(ERROR) << "Failed to open directory " << directory;
         return false;
@@ -156,8 +162,8 @@ static bool e4crypt_policy_set(const char *directory, const char *policy,
     return true;
 }
 
-static bool e4crypt_policy_get(const char *directory, char *policy,
-                               size_t policy_length,
+static bool e4crypt_policy_get(int base_dirfd, const char *directory,
+                               char *policy, size_t policy_length,
                                int contents_encryption_mode,
                                int filenames_encryption_mode) {
     if (policy_length != EXT4_KEY_DESCRIPTOR_SIZE) {
@@ -165,7 +171,7 @@ static bool e4crypt_policy_get(const char *directory, char *policy,
         return false;
     }
 
-    int fd = open(directory, O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int fd = openat(base_dirfd, directory, O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
     if (fd == -1) {
         PLOG(ERROR) << "Failed to open directory " << directory;
         return false;
@@ -193,8 +199,8 @@ static bool e4crypt_policy_get(const char *directory, char *policy,
     return true;
 }
 
-static bool e4crypt_policy_check(const char *directory, const char *policy,
-                                 size_t policy_length,
+static bool e4crypt_policy_check(int base_dirfd, const char *directory,
+                                 const char *policy, size_t policy_length,
                                  int contents_encryption_mode,
                                  int filenames_encryption_mode) {
     if (policy_length != EXT4_KEY_DESCRIPTOR_SIZE) {
@@ -202,7 +208,8 @@ static bool e4crypt_policy_check(const char *directory, const char *policy,
         return false;
     }
     char existing_policy[EXT4_KEY_DESCRIPTOR_SIZE];
-    if (!e4crypt_policy_get(directory, existing_policy, EXT4_KEY_DESCRIPTOR_SIZE,
+    if (!e4crypt_policy_get(base_dirfd, directory, existing_policy,
+                            EXT4_KEY_DESCRIPTOR_SIZE,
                             contents_encryption_mode,
                             filenames_encryption_mode)) return false;
     char existing_policy_hex[EXT4_KEY_DESCRIPTOR_SIZE_HEX];
@@ -221,10 +228,10 @@ static bool e4crypt_policy_check(const char *directory, const char *policy,
     return true;
 }
 
-int e4crypt_policy_ensure(const char *directory, const char *policy,
-                          size_t policy_length,
-                          const char *contents_encryption_mode,
-                          const char *filenames_encryption_mode) {
+int e4crypt_policy_ensure_at(int base_dirfd, const char *directory,
+                             const char *policy, size_t policy_length,
+                             const char *contents_encryption_mode,
+                             const char *filenames_encryption_mode) {
     int contents_mode = 0;
     int filenames_mode = 0;
 
@@ -250,13 +257,22 @@ int e4crypt_policy_ensure(const char *directory, const char *policy,
     }
 
     bool is_empty;
-    if (!is_dir_empty(directory, &is_empty)) return -1;
+    if (!is_dir_empty(base_dirfd, directory, &is_empty)) return -1;
     if (is_empty) {
-        if (!e4crypt_policy_set(directory, policy, policy_length,
+        if (!e4crypt_policy_set(base_dirfd, directory, policy, policy_length,
                                 contents_mode, filenames_mode)) return -1;
     } else {
-        if (!e4crypt_policy_check(directory, policy, policy_length,
+        if (!e4crypt_policy_check(base_dirfd, directory, policy, policy_length,
                                   contents_mode, filenames_mode)) return -1;
     }
     return 0;
 }
+
+int e4crypt_policy_ensure(const char *directory, const char *policy,
+                          size_t policy_length,
+                          const char *contents_encryption_mode,
+                          const char *filenames_encryption_mode) {
+    return e4crypt_policy_ensure_at(AT_FDCWD, directory, policy, policy_length,
+                                    contents_encryption_mode,
+                                    filenames_encryption_mode);
+}
@@ -18,6 +18,7 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -65,14 +66,16 @@ int e4crypt_do_init_user0()
     return rc;
 }
 
-int e4crypt_set_directory_policy(const char* dir)
+// Returns true if dir is one of the directories whose encryption policy
+// init manages: first level /data directories that aren't special cased.
+static bool e4crypt_policy_wanted(const char* dir)
 {
     // Only set policy on first level /data directories
     // To make this less restrictive, consider using a policy file.
     // However this is overkill for as long as the policy is simply
     // to apply a global policy to all /data folders created via makedir
     if (!dir || strncmp(dir, "/data/", 6) || strchr(dir + 6, '/')) {
-        return 0;
+        return false;
     }
 
     // Special case various directories that must not be encrypted,
@@ -89,14 +92,20 @@ int e4crypt_set_directory_policy(const char* dir)
     for (auto d: directories_to_exclude) {
         if ((prefix + d) == dir) {
             LOG(INFO) << "Not setting policy on " << dir;
-            return 0;
+            return false;
         }
     }
 
+    return true;
+}
+
+// Reads the system policy reference and encryption modes from /data.
+static int e4crypt_load_policy(std::string* policy,
+                               std::vector<std::string>* modes)
+{
     std::string ref_filename = std::string("/data") + e4crypt_key_ref;
-    std::string policy;
-    if (!android::base::ReadFileToString(ref_filename, &policy)) {
-        LOG(ERROR) << "Unable to read system policy to set on " << dir;
+    if (!android::base::ReadFileToString(ref_filename, policy)) {
+        LOG(ERROR) << "Unable to read system policy";
         return -1;
     }
 
@@ -106,18 +115,28 @@ int e4crypt_set_directory_policy(const char* dir)
         LOG(ERROR) << "Cannot read mode";
     }
 
-    std::vector<std::string> modes = android::base::Split(modestring, ":");
+    *modes = android::base::Split(modestring, ":");
 
-    if (modes.size() < 1 || modes.size() > 2) {
+    if (modes->size() < 1 || modes->size() > 2) {
         LOG(ERROR) << "Invalid encryption mode string: " << modestring;
         return -1;
     }
 
+    return 0;
+}
+
+// Applies an already loaded policy to the directory named name relative to
+// base_dirfd.  dir is the full path, used for logging only.
+static int e4crypt_apply_policy(int base_dirfd, const char* name,
+                                const char* dir, const std::string& policy,
+                                const std::vector<std::string>& modes)
+{
     LOG(INFO) << "Setting policy on " << dir;
-    int result = e4crypt_policy_ensure(dir, policy.c_str(), policy.length(),
-                                       modes[0].c_str(),
-                                       modes.size() >= 2 ?
-                                            modes[1].c_str() : "aes-256-cts");
+    int result = e4crypt_policy_ensure_at(base_dirfd, name,
+                                          policy.c_str(), policy.length(),
+                                          modes[0].c_str(),
+                                          modes.size() >= 2 ?
+                                               modes[1].c_str() : "aes-256-cts");
     if (result) {
         LOG(ERROR) << android::base::StringPrintf(
             "Setting %02x%02x%02x%02x policy on %s failed!",
@@ -127,3 +146,64 @@ int e4crypt_set_directory_policy(const char* dir)
 
     return 0;
 }
+
+int e4crypt_set_directory_policy(const char* dir)
+{
+    if (!e4crypt_policy_wanted(dir)) {
+        return 0;
+    }
+
+    std::string policy;
+    std::vector<std::string> modes;
+    if (e4crypt_load_policy(&policy, &modes)) {
+        return -1;
+    }
+
+    return e4crypt_apply_policy(AT_FDCWD, dir, dir, policy, modes);
+}
+
+int e4crypt_set_directory_policies(const char* const* dirs, size_t count)
+{
+    std::vector<const char*> wanted;
+    for (size_t i = 0; i < count; i++) {
+        if (e4crypt_policy_wanted(dirs[i])) {
+            wanted.push_back(dirs[i]);
+        }
+    }
+    if (wanted.empty()) {
+        return 0;
+    }
+
+    std::string policy;
+    std::vector<std::string> modes;
+    if (e4crypt_load_policy(&policy, &modes)) {
+        return -1;
+    }
+
+    // All wanted directories are first level /data directories, so open
+    // /data once and address them through openat instead of walking the
+    // full path for every ioctl.
+    int data_fd = open("/data", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (data_fd == -1) {
+        PLOG(ERROR) << "Failed to open /data";
+    }
+
+    int result = 0;
+    for (auto dir : wanted) {
+        // Keep applying to the remaining directories if one fails
+        if (data_fd != -1) {
+            if (e4crypt_apply_policy(data_fd, dir + 6, dir, policy, modes)) {
+                result = -1;
+            }
+        } else {
+            if (e4crypt_apply_policy(AT_FDCWD, dir, dir, policy, modes)) {
+                result = -1;
+            }
+        }
+    }
+
+    if (data_fd != -1) {
+        close(data_fd);
+    }
+    return result;
+}
@@ -198,6 +198,21 @@ void write_ext4_image(int fd, int gz, int sparse, int crc)
 		block_device_write_sb(fd);
 }
 
+/* Stream the filesystem image into a caller-provided sink, one chunk at a
+ * time.  The sink can pipe the chunks straight into a compressor or an
+ * uploader, so the uncompressed image never has to be written out.  Not
+ * supported for block devices, since backup superblocks are written with
+ * seeks.
+ */
+void write_ext4_image_sink(ext4_sink_func_t sink, void *priv, int sparse,
+	int crc)
+{
+	if (info.block_device)
+		critical_error("cannot stream an image to a block device");
+
+	sparse_file_callback(ext4_sparse_file, sparse, crc, sink, priv);
+}
+
 /* Compute the rest of the parameters of the filesystem from the basic info */
 void ext4_create_fs_aux_info()
 {
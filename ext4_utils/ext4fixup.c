@@ -78,6 +78,8 @@ static int new_inodes_per_group = 0;
 
 static int no_write_fixup_state = 0;
 
+static void flush_dirty_blocks(int fd);
+
 static int compute_new_inum(unsigned int old_inum)
 {
     unsigned int group, offset;
@@ -130,6 +132,11 @@ static int set_fs_fixup_state(int fd, int state)
         return 0;
     }
 
+    /* make sure all writes from the current phase are on disk before
+     * advancing the restart state
+     */
+    flush_dirty_blocks(fd);
+
     switch (state) {
         case STATE_MARKING_INUMS:
             magic = MAGIC_STATE_MARKING_INUMS;
@@ -192,10 +199,137 @@ static int read_inode(int fd, unsigned int inum, struct ext4_inode *inode)
     return 0;
 }
 
+/* Dirty block cache.  write_block() batches modified blocks here, and
+ * flush_dirty_blocks() writes them out sorted by block number and coalesced
+ * into large sequential writes, which is much faster than random 4K writes
+ * on flash storage.  The cache is flushed before every fixup state
+ * transition, so the restart logic still sees all writes from a completed
+ * phase on disk.
+ */
+#define DIRTY_CACHE_BLOCKS 1024
+
+struct dirty_block {
+    unsigned long long block_num;
+    unsigned char *data;
+};
+
+static struct dirty_block *dirty_blocks;
+static unsigned char *dirty_data;
+static unsigned char *flush_buf;
+static int dirty_count;
+
+static void dirty_cache_free(void);
+
+static void dirty_cache_init(void)
+{
+    /* drop any state left over from an interrupted previous run */
+    dirty_cache_free();
+
+    dirty_blocks = malloc(DIRTY_CACHE_BLOCKS * sizeof(struct dirty_block));
+    dirty_data = malloc(DIRTY_CACHE_BLOCKS * MAX_EXT4_BLOCK_SIZE);
+    flush_buf = malloc(DIRTY_CACHE_BLOCKS * MAX_EXT4_BLOCK_SIZE);
+
+    if (!dirty_blocks || !dirty_data || !flush_buf) {
+        critical_error("failed to allocate memory for dirty block cache\n");
+    }
+
+    dirty_count = 0;
+}
+
+static void dirty_cache_free(void)
+{
+    free(dirty_blocks);
+    free(dirty_data);
+    free(flush_buf);
+
+    dirty_blocks = NULL;
+    dirty_data = NULL;
+    flush_buf = NULL;
+    dirty_count = 0;
+}
+
+static struct dirty_block *dirty_cache_find(unsigned long long block_num)
+{
+    int i;
+
+    for (i = 0; i < dirty_count; i++) {
+        if (dirty_blocks[i].block_num == block_num) {
+            return &dirty_blocks[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int compare_dirty_blocks(const void *a, const void *b)
+{
+    unsigned long long block_a = ((struct dirty_block *)a)->block_num;
+    unsigned long long block_b = ((struct dirty_block *)b)->block_num;
+
+    if (block_a < block_b) {
+        return -1;
+    } else if (block_a > block_b) {
+        return 1;
+    }
+    return 0;
+}
+
+static void flush_dirty_blocks(int fd)
+{
+    int i, run_start, run_len, j;
+    off64_t off;
+    ssize_t len;
+
+    if (dirty_count == 0) {
+        return;
+    }
+
+    qsort(dirty_blocks, dirty_count, sizeof(struct dirty_block),
+          compare_dirty_blocks);
+
+    for (i = 0; i < dirty_count; i += run_len) {
+        /* find a run of consecutive blocks */
+        run_start = i;
+        run_len = 1;
+        while (run_start + run_len < dirty_count &&
+               dirty_blocks[run_start + run_len].block_num ==
+                   dirty_blocks[run_start].block_num + run_len) {
+            run_len++;
+        }
+
+        for (j = 0; j < run_len; j++) {
+            memcpy(flush_buf + (j * info.block_size),
+                   dirty_blocks[run_start + j].data, info.block_size);
+        }
+
+        off = dirty_blocks[run_start].block_num * info.block_size;
+
+        if (lseek64(fd, off, SEEK_SET) < 0) {
+            critical_error_errno("failed to seek to block %lld\n",
+                    dirty_blocks[run_start].block_num);
+        }
+
+        len = write(fd, flush_buf, (size_t)run_len * info.block_size);
+        if (len != (ssize_t)run_len * info.block_size) {
+            critical_error_errno("failed to write %d blocks at %lld\n",
+                    run_len, dirty_blocks[run_start].block_num);
+        }
+    }
+
+    dirty_count = 0;
+}
+
 static int read_block(int fd, unsigned long long block_num, void *block)
 {
     off64_t off;
     unsigned int len;
+    struct dirty_block *dirty = dirty_cache_find(block_num);
+
+    /* return pending writes from the cache so reads see them */
+    if (dirty) {
+        memcpy(block, dirty->data, info.block_size);
+        return 0;
+    }
 
     off = block_num * info.block_size;
 
@@ -213,24 +347,27 @@ static int read_block(int fd, unsigned long long block_num, void *block)
 
 static int write_block(int fd, unsigned long long block_num, void *block)
 {
-    off64_t off;
-    unsigned int len;
+    struct dirty_block *dirty;
 
     if (no_write) {
         return 0;
     }
 
-    off = block_num * info.block_size;
+    dirty = dirty_cache_find(block_num);
 
-    if (lseek64(fd, off, SEEK_SET) < 0) {
-        critical_error_errno("failed to seek to block %lld\n", block_num);
-    }
+    if (!dirty) {
+        if (dirty_count == DIRTY_CACHE_BLOCKS) {
+            flush_dirty_blocks(fd);
+        }
 
-    len=write(fd, block, info.block_size);
-    if (len != info.block_size) {
-        critical_error_errno("failed to write block %lld\n", block_num);
+        dirty = &dirty_blocks[dirty_count];
+        dirty->block_num = block_num;
+        dirty->data = dirty_data + (dirty_count * MAX_EXT4_BLOCK_SIZE);
+        dirty_count++;
     }
 
+    memcpy(dirty->data, block, info.block_size);
+
     return 0;
 }
 
@@ -710,6 +847,8 @@ int ext4fixup_internal(char *fsdev, int v_flag, int n_flag,
     if (fd < 0)
         critical_error_errno("failed to open filesystem image");
 
+    dirty_cache_init();
+
     read_ext(fd, verbose);
 
     if (info.feat_incompat & EXT4_FEATURE_INCOMPAT_RECOVER) {
@@ -810,6 +949,9 @@ int ext4fixup_internal(char *fsdev, int v_flag, int n_flag,
         }
     }
 
+    flush_dirty_blocks(fd);
+    dirty_cache_free();
+
     close(fd);
     free(dirbuf);
 
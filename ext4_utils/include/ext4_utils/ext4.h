@@ -496,6 +496,7 @@ struct ext4_super_block {
 #define EXT4_FEATURE_RO_COMPAT_HAS_SNAPSHOT 0x0080
 #define EXT4_FEATURE_RO_COMPAT_QUOTA 0x0100
 #define EXT4_FEATURE_RO_COMPAT_BIGALLOC 0x0200
+#define EXT4_FEATURE_RO_COMPAT_SHARED_BLOCKS 0x4000
 
 #define EXT4_FEATURE_INCOMPAT_COMPRESSION 0x0001
 #define EXT4_FEATURE_INCOMPAT_FILETYPE 0x0002
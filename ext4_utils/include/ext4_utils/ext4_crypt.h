@@ -30,6 +30,15 @@ int e4crypt_policy_ensure(const char *directory, const char *policy,
                           const char *contents_encryption_mode,
                           const char *filenames_encryption_mode);
 
+// Same as e4crypt_policy_ensure, but resolves directory relative to
+// base_dirfd (pass AT_FDCWD for the plain path-based behavior).  Callers
+// applying one policy to many sibling directories can open the parent once
+// and skip the full path walk on every call.
+int e4crypt_policy_ensure_at(int base_dirfd, const char *directory,
+                             const char *policy, size_t policy_length,
+                             const char *contents_encryption_mode,
+                             const char *filenames_encryption_mode);
+
 static const char* e4crypt_unencrypted_folder = "/unencrypted";
 static const char* e4crypt_key_ref = "/unencrypted/ref";
 static const char* e4crypt_key_mode = "/unencrypted/mode";
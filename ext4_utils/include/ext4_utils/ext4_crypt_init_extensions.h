@@ -19,6 +19,7 @@
 
 #include <sys/cdefs.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <cutils/multiuser.h>
 
 __BEGIN_DECLS
@@ -27,6 +28,10 @@ __BEGIN_DECLS
 // They will not operate properly outside of init
 int e4crypt_install_keyring();
 int e4crypt_set_directory_policy(const char* path);
+// Applies the policy to every eligible path in paths, reading the policy
+// files once and reusing an open /data fd.  Keeps going past individual
+// failures and returns -1 if any path failed.
+int e4crypt_set_directory_policies(const char* const* paths, size_t count);
 int e4crypt_do_init_user0();
 
 __END_DECLS
@@ -45,6 +45,7 @@ struct fs_info {
 	uint32_t bg_desc_reserve_blocks;
 	const char *label;
 	uint8_t no_journal;
+	uint8_t dedup;	/* share blocks between files with identical contents */
 	bool block_device;	/* target fd is a block device? */
 };
 
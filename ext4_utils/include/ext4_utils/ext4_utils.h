@@ -141,6 +141,14 @@ int ext4_bg_has_super_block(int bg);
 void read_sb(int fd, struct ext4_super_block *sb);
 void write_sb(int fd, unsigned long long offset, struct ext4_super_block *sb);
 void write_ext4_image(int fd, int gz, int sparse, int crc);
+
+/* Chunk sink for write_ext4_image_sink; returns nonzero on failure.  The
+ * data pointer is only valid for the duration of the call.
+ */
+typedef int (*ext4_sink_func_t)(void *priv, const void *data, int len);
+
+void write_ext4_image_sink(ext4_sink_func_t sink, void *priv, int sparse,
+	int crc);
 void ext4_create_fs_aux_info(void);
 void ext4_free_fs_aux_info(void);
 void ext4_fill_in_sb(int real_uuid);
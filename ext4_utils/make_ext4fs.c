@@ -38,6 +38,7 @@
 #include "contents.h"
 #include "ext4_utils/ext4_utils.h"
 #include "ext4_utils/wipe.h"
+#include "readahead.h"
 
 #ifdef _WIN32
 
@@ -271,6 +272,16 @@ static u32 build_directory_structure(const char *full_path, const char *dir_path
 	}
 	free(namelist);
 
+	/* queue the regular files of this directory for prefetching before the
+	   loop below reads them (the dedup hasher directly, the sparse image
+	   writer later).  Queueing follows the same order the files are
+	   processed in, so the workers act as a lookahead stage over the
+	   upcoming file list */
+	for (i = 0; i < entries; i++) {
+		if (dentries[i].file_type == EXT4_FT_REG_FILE && dentries[i].size > 0)
+			readahead_queue(dentries[i].full_path, dentries[i].size);
+	}
+
 	if (needs_lost_and_found) {
 		/* insert a lost+found directory at the beginning of the dentries */
 		struct dentry *tmp = calloc(entries + 1, sizeof(struct dentry));
@@ -684,6 +695,8 @@ static void extract_base_fs_allocations(const char *directory, const char *mount
 
 	for (i = 0; i < aux_info.groups; i++) {
 		qsort(bgs[i].chunks, bgs[i].chunk_count, sizeof(struct region), compare_chunks);
+		/* sorting changed the holes between chunks */
+		bgs[i].max_hole_stale = true;
 	}
 
 	free(base_file_line);
@@ -795,6 +808,11 @@ int make_ext4fs_internal(int fd, const char *_directory, const char *_target_out
 			EXT4_FEATURE_RO_COMPAT_LARGE_FILE |
 			EXT4_FEATURE_RO_COMPAT_GDT_CSUM;
 
+	/* identical files share data blocks, so the image must never be
+	   mounted read-write */
+	if (info.dedup)
+		info.feat_ro_compat |= EXT4_FEATURE_RO_COMPAT_SHARED_BLOCKS;
+
 	info.feat_incompat |=
 			EXT4_FEATURE_INCOMPAT_EXTENTS |
 			EXT4_FEATURE_INCOMPAT_FILETYPE;
@@ -840,11 +858,17 @@ int make_ext4fs_internal(int fd, const char *_directory, const char *_target_out
 	assert(!directory);
 	root_inode_num = build_default_directory_structure(mountpoint, sehnd);
 #else
-	if (directory)
+	if (directory) {
+		/* overlap content reads with the directory tree walk and the
+		   image writer: file contents queued for the sparse image are
+		   prefetched on worker threads while metadata is still being
+		   generated */
+		readahead_init();
 		root_inode_num = build_directory_structure(directory, mountpoint, target_out_directory, 0,
 			fs_config_func, sehnd, verbose, fixed_time);
-	else
+	} else {
 		root_inode_num = build_default_directory_structure(mountpoint, sehnd);
+	}
 #endif
 
 	root_mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
@@ -902,6 +926,10 @@ int make_ext4fs_internal(int fd, const char *_directory, const char *_target_out
 		wipe_block_device(fd, info.len);
 	}
 
+	/* make sure all queued prefetches have been issued before the writer
+	   starts reading the same files */
+	readahead_wait();
+
 	write_ext4_image(fd, gzip, sparse, crc);
 
 	sparse_file_destroy(ext4_sparse_file);
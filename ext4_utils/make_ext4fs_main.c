@@ -19,6 +19,10 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
 #if defined(__linux__)
 #include <linux/fs.h>
 #elif defined(__APPLE__) && defined(__MACH__)
@@ -58,10 +62,54 @@ static void usage(char *path)
 	fprintf(stderr, "    [ -L <label> ] [ -f ] [ -a <android mountpoint> ] [ -u ]\n");
 	fprintf(stderr, "    [ -S file_contexts ] [ -C fs_config ] [ -T timestamp ]\n");
 	fprintf(stderr, "    [ -z | -s ] [ -w ] [ -c ] [ -J ] [ -v ] [ -B <block_list_file> ]\n");
-	fprintf(stderr, "    [ -d <base_alloc_file_in> ] [ -D <base_alloc_file_out> ]\n");
+	fprintf(stderr, "    [ -d <base_alloc_file_in> ] [ -D <base_alloc_file_out> ] [ -p ]\n");
+	fprintf(stderr, "    [ -Z <compress command> ]\n");
 	fprintf(stderr, "    <filename> [[<directory>] <target_out_directory>]\n");
 }
 
+#ifndef _WIN32
+/* Spawns `command' with its stdin connected to a pipe and its stdout
+ * connected to `out_fd', and returns the write end of the pipe.  The image
+ * is streamed into the compressor as it is written, with the pipe providing
+ * bounded buffering, so the uncompressed image never touches disk.
+ */
+static int spawn_compressor(const char *command, int out_fd, pid_t *pid)
+{
+	int pipefd[2];
+
+	if (pipe(pipefd) < 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	*pid = fork();
+	if (*pid < 0) {
+		perror("fork");
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	}
+
+	if (*pid == 0) {
+		close(pipefd[1]);
+		if (dup2(pipefd[0], STDIN_FILENO) < 0 ||
+		    dup2(out_fd, STDOUT_FILENO) < 0) {
+			perror("dup2");
+			_exit(127);
+		}
+		close(pipefd[0]);
+		if (out_fd != STDOUT_FILENO)
+			close(out_fd);
+		execl("/bin/sh", "sh", "-c", command, NULL);
+		perror("execl");
+		_exit(127);
+	}
+
+	close(pipefd[0]);
+	return pipefd[1];
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	int opt;
@@ -84,11 +132,15 @@ int main(int argc, char **argv)
 	FILE* block_list_file = NULL;
 	FILE* base_alloc_file_in = NULL;
 	FILE* base_alloc_file_out = NULL;
+	const char *compress_command = NULL;
+#ifndef _WIN32
+	pid_t compress_pid = -1;
+#endif
 #ifndef _WIN32
 	struct selinux_opt seopts[] = { { SELABEL_OPT_PATH, "" } };
 #endif
 
-	while ((opt = getopt(argc, argv, "l:j:b:g:i:I:e:o:L:a:S:T:C:B:d:D:fwzJsctvu")) != -1) {
+	while ((opt = getopt(argc, argv, "l:j:b:g:i:I:e:o:L:a:S:T:C:B:d:D:Z:fwzJpsctvu")) != -1) {
 		switch (opt) {
 		case 'l':
 			info.len = parse_num(optarg);
@@ -144,6 +196,11 @@ int main(int argc, char **argv)
 		case 'c':
 			crc = 1;
 			break;
+		case 'p':
+			/* share data blocks between identical files; the image
+			   is marked read-only via a ro_compat feature flag */
+			info.dedup = 1;
+			break;
 		case 's':
 			sparse = 1;
 			break;
@@ -183,6 +240,15 @@ int main(int argc, char **argv)
 				exit(EXIT_FAILURE);
 			}
 			break;
+		case 'Z':
+#ifndef _WIN32
+			compress_command = optarg;
+#else
+			fprintf(stderr, "-Z is not supported on windows\n");
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+#endif
+			break;
 		case 'D':
 			base_alloc_file_out = fopen(optarg, "w");
 			if (base_alloc_file_out == NULL) {
@@ -230,6 +296,12 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (compress_command && (wipe || gzip)) {
+		fprintf(stderr, "Cannot specifiy both compress command and wipe or gzip\n");
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
 	if (optind >= argc) {
 		fprintf(stderr, "Expected filename after options\n");
 		usage(argv[0]);
@@ -260,10 +332,41 @@ int main(int argc, char **argv)
 		fd = STDOUT_FILENO;
 	}
 
+#ifndef _WIN32
+	if (compress_command) {
+		int pipe_fd = spawn_compressor(compress_command, fd, &compress_pid);
+
+		if (pipe_fd < 0) {
+			if (strcmp(filename, "-"))
+				unlink(filename);
+			return EXIT_FAILURE;
+		}
+
+		/* the compressor owns the output file now; the image is
+		   written to the pipe instead */
+		if (fd != STDOUT_FILENO)
+			close(fd);
+		fd = pipe_fd;
+	}
+#endif
+
 	exitcode = make_ext4fs_internal(fd, directory, target_out_directory, mountpoint, fs_config_func, gzip,
 		sparse, crc, wipe, real_uuid, sehnd, verbose, fixed_time,
 		block_list_file, base_alloc_file_in, base_alloc_file_out);
 	close(fd);
+
+#ifndef _WIN32
+	if (compress_pid > 0) {
+		int status;
+
+		if (waitpid(compress_pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "compress command failed\n");
+			if (!exitcode)
+				exitcode = EXIT_FAILURE;
+		}
+	}
+#endif
 	if (block_list_file)
 		fclose(block_list_file);
 	if (base_alloc_file_out)
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "readahead.h"
+
+#ifdef _WIN32
+
+/* Windows builds only create empty filesystems, so there is no file
+   content to prefetch */
+void readahead_init(void)
+{
+}
+
+void readahead_queue(const char *filename __attribute__((unused)),
+		u64 len __attribute__((unused)))
+{
+}
+
+void readahead_consume(u64 len __attribute__((unused)))
+{
+}
+
+void readahead_wait(void)
+{
+}
+
+#else
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define READAHEAD_MAX_THREADS 4
+
+/* How far prefetching may run ahead of the bytes reported consumed through
+   readahead_consume.  Once readahead_wait is called nothing reports
+   consumption anymore and the remaining queue is drained without pacing */
+#define READAHEAD_WINDOW_BYTES (256ULL << 20)
+
+struct readahead_entry {
+	char *filename;
+	u64 len;
+	struct readahead_entry *next;
+};
+
+static pthread_mutex_t readahead_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readahead_cond = PTHREAD_COND_INITIALIZER;
+static struct readahead_entry *readahead_head;
+static struct readahead_entry *readahead_tail;
+static pthread_t readahead_threads[READAHEAD_MAX_THREADS];
+static int readahead_thread_count;
+static bool readahead_done;
+static u64 readahead_issued_bytes;
+static u64 readahead_consumed_bytes;
+
+/* Asks the kernel to start reading the contents of filename into the page
+   cache.  Readahead is only an optimization, so errors are ignored */
+static void readahead_file(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return;
+
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#else
+	/* no fadvise; warm the page cache by reading the file */
+	char buf[65536];
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+#endif
+	close(fd);
+}
+
+static void *readahead_thread(void *arg __attribute__((unused)))
+{
+	pthread_mutex_lock(&readahead_lock);
+
+	while (true) {
+		while (!readahead_head && !readahead_done)
+			pthread_cond_wait(&readahead_cond, &readahead_lock);
+
+		if (!readahead_head)
+			break;
+
+		/* stay a bounded number of bytes ahead of the consumers, so
+		   prefetched pages aren't evicted again before they are used */
+		while (!readahead_done &&
+				readahead_issued_bytes > readahead_consumed_bytes &&
+				readahead_issued_bytes - readahead_consumed_bytes >=
+				READAHEAD_WINDOW_BYTES)
+			pthread_cond_wait(&readahead_cond, &readahead_lock);
+
+		struct readahead_entry *entry = readahead_head;
+		readahead_head = entry->next;
+		if (!readahead_head)
+			readahead_tail = NULL;
+		readahead_issued_bytes += entry->len;
+
+		pthread_mutex_unlock(&readahead_lock);
+
+		readahead_file(entry->filename);
+		free(entry->filename);
+		free(entry);
+
+		pthread_mutex_lock(&readahead_lock);
+	}
+
+	pthread_mutex_unlock(&readahead_lock);
+
+	return NULL;
+}
+
+/* Starts the readahead worker threads.  Thread creation failures leave the
+   queue serviced by fewer workers, or turn readahead_queue into a no-op if
+   no thread could be created */
+void readahead_init(void)
+{
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > READAHEAD_MAX_THREADS)
+		threads = READAHEAD_MAX_THREADS;
+
+	readahead_head = NULL;
+	readahead_tail = NULL;
+	readahead_done = false;
+	readahead_thread_count = 0;
+	readahead_issued_bytes = 0;
+	readahead_consumed_bytes = 0;
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&readahead_threads[i], NULL, readahead_thread,
+				NULL)) {
+			/* keep going with fewer workers */
+			fprintf(stderr, "warning: failed to create readahead thread\n");
+			break;
+		}
+		readahead_thread_count++;
+	}
+}
+
+/* Queues the contents of filename to be prefetched */
+void readahead_queue(const char *filename, u64 len)
+{
+	if (!readahead_thread_count)
+		return;
+
+	struct readahead_entry *entry = malloc(sizeof(struct readahead_entry));
+
+	if (!entry)
+		return;
+
+	entry->filename = strdup(filename);
+	entry->len = len;
+	entry->next = NULL;
+
+	if (!entry->filename) {
+		free(entry);
+		return;
+	}
+
+	pthread_mutex_lock(&readahead_lock);
+
+	if (readahead_tail)
+		readahead_tail->next = entry;
+	else
+		readahead_head = entry;
+	readahead_tail = entry;
+
+	pthread_cond_signal(&readahead_cond);
+	pthread_mutex_unlock(&readahead_lock);
+}
+
+/* Reports that len bytes of queued file content have been (or are about to
+   be) consumed, letting the workers prefetch further ahead */
+void readahead_consume(u64 len)
+{
+	if (!readahead_thread_count)
+		return;
+
+	pthread_mutex_lock(&readahead_lock);
+	readahead_consumed_bytes += len;
+	pthread_cond_broadcast(&readahead_cond);
+	pthread_mutex_unlock(&readahead_lock);
+}
+
+/* Waits until the queue has been drained and joins the worker threads */
+void readahead_wait(void)
+{
+	int i;
+
+	pthread_mutex_lock(&readahead_lock);
+	readahead_done = true;
+	pthread_cond_broadcast(&readahead_cond);
+	pthread_mutex_unlock(&readahead_lock);
+
+	for (i = 0; i < readahead_thread_count; i++)
+		pthread_join(readahead_threads[i], NULL);
+
+	readahead_thread_count = 0;
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _READAHEAD_H_
+#define _READAHEAD_H_
+
+#include "ext4_utils/ext4_utils.h"
+
+/* Prefetches the contents of files queued with readahead_queue on worker
+   threads, so that content consumers (the dedup hasher and the sparse image
+   writer) find them in the page cache instead of reading everything on the
+   critical path.  The workers stay a bounded number of bytes ahead of the
+   consumption cursor reported through readahead_consume, so prefetching a
+   tree bigger than memory doesn't evict pages before they are used.  All
+   functions are best-effort and degrade to no-ops when threads are not
+   available. */
+
+void readahead_init(void);
+void readahead_queue(const char *filename, u64 len);
+void readahead_consume(u64 len);
+void readahead_wait(void);
+
+#endif
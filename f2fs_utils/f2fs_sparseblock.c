@@ -322,6 +322,13 @@ static int gather_sit_info(int fd, struct f2fs_info *info)
     if (!info->sit_blocks)
         return -1;
 
+#ifdef POSIX_FADV_WILLNEED
+    /* ask the kernel to start reading both SIT copies now, so the
+       single-block reads below mostly hit the page cache */
+    posix_fadvise(fd, info->sit_blkaddr * F2FS_BLKSIZE,
+                  2 * info->blocks_per_sit * F2FS_BLKSIZE, POSIX_FADV_WILLNEED);
+#endif
+
     for(sit_block = 0; sit_block<num_sit_blocks; sit_block++) {
         off64_t address = info->sit_blkaddr + sit_block;
 
@@ -378,6 +385,38 @@ static int get_sit_summary(int fd, struct f2fs_info *info, struct f2fs_checkpoin
     return 0;
 }
 
+/*
+ * Build a per-segment index of SIT entries. The entries themselves already
+ * live in memory (sit_blocks and the journal in sit_sums); this resolves,
+ * once, which of the two is current for each segment so that
+ * run_on_used_blocks does not have to scan the journal for every block.
+ */
+static int build_sit_index(struct f2fs_info *info)
+{
+    u64 num_segments = (info->total_blocks - info->main_blkaddr
+            + info->blocks_per_segment - 1) / info->blocks_per_segment;
+    u64 segnum;
+    unsigned int i;
+
+    info->seg_entries = malloc(num_segments * sizeof(struct f2fs_sit_entry *));
+    if (!info->seg_entries)
+        return -1;
+
+    for (segnum = 0; segnum < num_segments; segnum++)
+        info->seg_entries[segnum] =
+            &info->sit_blocks[segnum / SIT_ENTRY_PER_BLOCK].entries[segnum % SIT_ENTRY_PER_BLOCK];
+
+    /* journaled entries are newer than the SIT blocks they shadow */
+    for (i = 0; i < le16_to_cpu(info->sit_sums->n_sits); i++) {
+        segnum = le32_to_cpu(segno_in_journal(info->sit_sums, i));
+        if (segnum < num_segments)
+            info->seg_entries[segnum] = &sit_in_journal(info->sit_sums, i);
+    }
+
+    info->num_segments = num_segments;
+    return 0;
+}
+
 struct f2fs_info *generate_f2fs_info(int fd)
 {
     struct f2fs_super_block *sb = NULL;
@@ -445,6 +484,10 @@ struct f2fs_info *generate_f2fs_info(int fd)
         SLOGE("Error getting SIT entries in summary area");
         goto error;
     }
+    if (build_sit_index(info)) {
+        SLOGE("Error building SIT index");
+        goto error;
+    }
     dbg_print_info_struct(info);
     return info;
 error:
@@ -465,6 +508,9 @@ void free_f2fs_info(struct f2fs_info *info)
 
         free(info->sit_sums);
         info->sit_sums = NULL;
+
+        free(info->seg_entries);
+        info->seg_entries = NULL;
     }
     free(info);
 }
@@ -484,59 +530,88 @@ int f2fs_test_bit(unsigned int nr, const char *p)
     return (mask & *addr) != 0;
 }
 
-int run_on_used_blocks(u64 startblock, struct f2fs_info *info, int (*func)(u64 pos, void *data), void *data) {
-    struct f2fs_sit_block sit_block_cache;
+int run_on_used_extents(u64 startblock, struct f2fs_info *info, int (*func)(u64 start, u64 len, void *data), void *data) {
     struct f2fs_sit_entry * sit_entry;
-    u64 sit_block_num_cur = 0, segnum = 0, block_offset;
+    u64 segnum = 0, block_offset;
     u64 block;
-    unsigned int used, found, started = 0, i;
+    u64 run_start = 0, run_len = 0;
+    unsigned int used;
 
     block = startblock;
     while (block < info->total_blocks) {
         /* TODO: Save only relevant portions of metadata */
         if (block < info->main_blkaddr) {
-            if (func(block, data)) {
-                SLOGI("func error");
-                return -1;
-            }
+            used = 1;
         } else {
             /* Main Section */
             segnum = (block - info->main_blkaddr)/info->blocks_per_segment;
 
-            /* check the SIT entries in the journal */
-            found = 0;
-            for(i = 0; i < le16_to_cpu(info->sit_sums->n_sits); i++) {
-                if (le32_to_cpu(segno_in_journal(info->sit_sums, i)) == segnum) {
-                    sit_entry = &sit_in_journal(info->sit_sums, i);
-                    found = 1;
-                    break;
-                }
-            }
-
-            /* get SIT entry from SIT section */
-            if (!found) {
-                sit_block_num_cur = segnum / SIT_ENTRY_PER_BLOCK;
-                sit_entry = &info->sit_blocks[sit_block_num_cur].entries[segnum % SIT_ENTRY_PER_BLOCK];
-            }
+            /* the index already points at the current SIT entry for the
+               segment, journaled or on-disk */
+            sit_entry = info->seg_entries[segnum];
 
             block_offset = (block - info->main_blkaddr) % info->blocks_per_segment;
 
             if (block_offset == 0 && GET_SIT_VBLOCKS(sit_entry) == 0) {
+                if (run_len && func(run_start, run_len, data)) {
+                    SLOGI("func error");
+                    return -1;
+                }
+                run_len = 0;
                 block += info->blocks_per_segment;
                 continue;
             }
 
             used = f2fs_test_bit(block_offset, (char *)sit_entry->valid_map);
-            if(used)
-                if (func(block, data))
-                    return -1;
+        }
+
+        if (used) {
+            if (run_len == 0)
+                run_start = block;
+            run_len++;
+        } else if (run_len) {
+            if (func(run_start, run_len, data)) {
+                SLOGI("func error");
+                return -1;
+            }
+            run_len = 0;
         }
 
         block++;
     }
+
+    if (run_len && func(run_start, run_len, data)) {
+        SLOGI("func error");
+        return -1;
+    }
+    return 0;
+}
+
+/* Adapts the single-block callback interface onto the extent walk */
+struct block_iter_adapter {
+    int (*func)(u64 pos, void *data);
+    void *data;
+};
+
+static int for_each_block_in_extent(u64 start, u64 len, void *data)
+{
+    struct block_iter_adapter *a = data;
+    u64 i;
+
+    for (i = 0; i < len; i++)
+        if (a->func(start + i, a->data))
+            return -1;
     return 0;
 }
 
+int run_on_used_blocks(u64 startblock, struct f2fs_info *info, int (*func)(u64 pos, void *data), void *data) {
+    struct block_iter_adapter adapter;
+
+    adapter.func = func;
+    adapter.data = data;
+    return run_on_used_extents(startblock, info, for_each_block_in_extent, &adapter);
+}
+
 struct privdata
 {
     int count;
@@ -554,38 +629,47 @@ struct privdata
  * filesystem, replacing blocks identified as unused with 0's.
  */
 
-int copy_used(u64 pos, void *data)
+/* bound the copy buffer to 4MB regardless of extent length */
+#define COPY_BUF_BLOCKS 1024
+
+int copy_used(u64 start, u64 len, void *data)
 {
     struct privdata *d = data;
-    char *buf;
-    int pdone = (pos * 100) / d->info->total_blocks;
+    int pdone = (start * 100) / d->info->total_blocks;
     if (pdone > d->done) {
         d->done = pdone;
         printf("Done with %d percent\n", d->done);
     }
 
-    d->count++;
-    buf = d->buf;
-    if(read_structure_blk(d->infd, (unsigned long long)pos, d->buf, 1)) {
-        printf("Error reading!!!\n");
-        return -1;
-    }
+    while (len) {
+        u64 n = len > COPY_BUF_BLOCKS ? COPY_BUF_BLOCKS : len;
+        ssize_t bytes = n * F2FS_BLKSIZE;
+        off64_t ret;
 
-    off64_t ret;
-    ret = lseek64(d->outfd, pos * F2FS_BLKSIZE, SEEK_SET);
-    if (ret < 0) {
-        SLOGE("failed to seek\n");
-        return ret;
-    }
+        if(read_structure_blk(d->infd, (unsigned long long)start, d->buf, n)) {
+            printf("Error reading!!!\n");
+            return -1;
+        }
 
-    ret = write(d->outfd, d->buf, F2FS_BLKSIZE);
-    if (ret < 0) {
-        SLOGE("failed to write\n");
-        return ret;
-    }
-    if (ret != F2FS_BLKSIZE) {
-        SLOGE("failed to read all\n");
-        return -1;
+        ret = lseek64(d->outfd, start * F2FS_BLKSIZE, SEEK_SET);
+        if (ret < 0) {
+            SLOGE("failed to seek\n");
+            return ret;
+        }
+
+        ret = write(d->outfd, d->buf, bytes);
+        if (ret < 0) {
+            SLOGE("failed to write\n");
+            return ret;
+        }
+        if (ret != bytes) {
+            SLOGE("failed to write all\n");
+            return -1;
+        }
+
+        d->count += n;
+        start += n;
+        len -= n;
     }
     return 0;
 }
@@ -616,14 +700,14 @@ int main(int argc, char **argv)
         printf("Failed to generate info!");
         return -1;
     }
-    char *buf = malloc(F2FS_BLKSIZE);
+    char *buf = malloc(COPY_BUF_BLOCKS * F2FS_BLKSIZE);
     char *zbuf = calloc(1, F2FS_BLKSIZE);
     d.buf = buf;
     d.zbuf = zbuf;
     d.done = 0;
     d.info = info;
     int expected_count = get_num_blocks_used(info);
-    run_on_used_blocks(0, info, &copy_used, &d);
+    run_on_used_extents(0, info, &copy_used, &d);
     printf("Copied %d blocks. Expected to copy %d\n", d.count, expected_count);
     ftruncate64(outfd, info->total_blocks * F2FS_BLKSIZE);
     free_f2fs_info(info);
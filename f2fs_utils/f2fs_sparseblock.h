@@ -34,6 +34,7 @@ extern "C" {
     ((long long)((a) - (b)) == 0))
 
 struct f2fs_sit_block;
+struct f2fs_sit_entry;
 struct f2fs_summary_block;
 
 struct f2fs_info {
@@ -46,6 +47,11 @@ struct f2fs_info {
     struct f2fs_sit_block *sit_blocks;
     struct f2fs_summary_block *sit_sums;
 
+    /* per-segment index of effective SIT entries with journaled entries
+     * already applied, so walking the block map is a pure memory walk */
+    struct f2fs_sit_entry **seg_entries;
+    u_int64_t num_segments;
+
     u_int64_t cp_blkaddr;
     u_int64_t cp_valid_cp_blkaddr;
 
@@ -66,6 +72,10 @@ struct f2fs_info *generate_f2fs_info(int fd);
 void free_f2fs_info(struct f2fs_info *info);
 unsigned int get_f2fs_filesystem_size_sec(char *dev);
 int run_on_used_blocks(u64 startblock, struct f2fs_info *info, int (*func)(u64 pos, void *data), void *data);
+/* Like run_on_used_blocks, but coalesces consecutive used blocks and hands
+ * the callback whole [start, start + len) runs so it can issue single large
+ * reads instead of one per block. */
+int run_on_used_extents(u64 startblock, struct f2fs_info *info, int (*func)(u64 start, u64 len, void *data), void *data);
 
 #ifdef __cplusplus
 }
@@ -17,13 +17,26 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 #LOCAL_32_BIT_ONLY = true
 LOCAL_MODULE_HOST_OS := linux
-LOCAL_SRC_FILES := ioshark_bench.c ioshark_bench_subr.c ioshark_bench_mmap.c
+LOCAL_SRC_FILES := ioshark_bench.c ioshark_bench_subr.c ioshark_bench_mmap.c \
+	ioshark_bench_verify.c
 LOCAL_CFLAGS := -g -O2 -Wall  -Werror
+# hardware CRC32 for the -V read-verify sidecars
+LOCAL_CFLAGS_arm64 := -march=armv8-a+crc
 LOCAL_MODULE := ioshark_bench
 LOCAL_MODULE_TAGS := debug
 LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+#LOCAL_32_BIT_ONLY = true
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_SRC_FILES := ioshark_capture.c
+LOCAL_CFLAGS := -g -O2 -Wall -Werror -D_GNU_SOURCE
+LOCAL_MODULE := libioshark_capture
+LOCAL_MODULE_TAGS := debug
+LOCAL_SHARED_LIBRARIES := libdl
+include $(BUILD_SHARED_LIBRARY)
+
 include $(CLEAR_VARS)
 #LOCAL_32_BIT_ONLY = true
 LOCAL_MODULE_HOST_OS := linux
@@ -83,12 +83,44 @@ struct flags_map_s fileop_map[] = {
 	{ "ftrace", IOSHARK_MAPPED_PREAD }
 };
 
-struct in_mem_file_op {
-	struct ioshark_file_operation disk_file_op;
-	struct in_mem_file_op *next;
+/*
+ * Parsed operations accumulate in large chunks rather than one malloc'ed
+ * list node per operation, so a chunk can later be written out with a
+ * single fwrite instead of one fwrite per record.
+ */
+#define OP_CHUNK_OPS	65536
+
+struct op_chunk {
+	struct ioshark_file_operation ops[OP_CHUNK_OPS];
+	int num_ops;
+	struct op_chunk *next;
 };
 
-struct in_mem_file_op *in_mem_file_op_head = NULL, *in_mem_file_op_tail = NULL;
+struct op_chunk *op_chunk_head = NULL, *op_chunk_tail = NULL;
+
+static struct ioshark_file_operation *
+alloc_file_op(void)
+{
+	struct op_chunk *chunk = op_chunk_tail;
+
+	if (chunk == NULL || chunk->num_ops == OP_CHUNK_OPS) {
+		chunk = malloc(sizeof(struct op_chunk));
+		if (chunk == NULL) {
+			fprintf(stderr,
+				"%s Can't allocate memory - this is fatal\n",
+				__func__);
+			exit(EXIT_FAILURE);
+		}
+		chunk->num_ops = 0;
+		chunk->next = NULL;
+		if (op_chunk_head == NULL)
+			op_chunk_head = chunk;
+		else
+			op_chunk_tail->next = chunk;
+		op_chunk_tail = chunk;
+	}
+	return &chunk->ops[chunk->num_ops++];
+}
 
 void usage(void)
 {
@@ -530,7 +562,6 @@ int main(int argc, char **argv)
 	int num_io_operations = 0;
 	struct ioshark_header header;
 	struct ioshark_file_operation *disk_file_op;
-	struct in_mem_file_op *in_mem_fop;
 	struct stat st;
 	char *infile, *outfile;
 	struct timeval prev_time;
@@ -565,8 +596,7 @@ int main(int argc, char **argv)
 		s = in_buf;
 		while (isspace(*s))
 			s++;
-		in_mem_fop = malloc(sizeof(struct in_mem_file_op));
-		disk_file_op = &in_mem_fop->disk_file_op;
+		disk_file_op = alloc_file_op();
 		disk_file_op->delta_us = get_delta_ts(s, &prev_time);
 		get_tracetype(s, trace_type);
 		if (strcmp(trace_type, "strace") == 0) {
@@ -640,16 +670,7 @@ int main(int argc, char **argv)
 		default:
 			break;
 		}
-		/* Chain at the end */
 		num_io_operations++;
-		in_mem_fop->next = NULL;
-		if (in_mem_file_op_head == NULL) {
-			in_mem_file_op_tail = in_mem_fop;
-			in_mem_file_op_head = in_mem_fop;
-		} else {
-			in_mem_file_op_tail->next = in_mem_fop;
-			in_mem_file_op_tail = in_mem_fop;
-		}
 	}
 	fclose(fp);
 	/*
@@ -669,18 +690,20 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 	files_db_write_objects(fp);
-	while (in_mem_file_op_head != NULL) {
-		struct in_mem_file_op *temp;
-
-		disk_file_op = &in_mem_file_op_head->disk_file_op;
-		if (fwrite(disk_file_op,
-			   sizeof(struct ioshark_file_operation), 1, fp) != 1) {
+	while (op_chunk_head != NULL) {
+		struct op_chunk *temp;
+
+		if (op_chunk_head->num_ops &&
+		    fwrite(op_chunk_head->ops,
+			   sizeof(struct ioshark_file_operation),
+			   op_chunk_head->num_ops, fp) !=
+		    (size_t)op_chunk_head->num_ops) {
 			fprintf(stderr, "%s Write error trace.outfile\n",
 				progname);
 			exit(EXIT_FAILURE);
 		}
-		temp = in_mem_file_op_head;
-		in_mem_file_op_head = in_mem_file_op_head->next;
+		temp = op_chunk_head;
+		op_chunk_head = op_chunk_head->next;
 		free(temp);
 	}
 	store_filename_cache();
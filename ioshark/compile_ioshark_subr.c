@@ -109,12 +109,45 @@ static struct ioshark_filename_struct *filename_cache;
 static int filename_cache_num_entries;
 static int filename_cache_size;
 
+/*
+ * Hash index over the global filename cache.  The cache array gets
+ * realloc'ed as it grows, so the chains store indices, not pointers.
+ */
+struct filename_cache_bucket_entry {
+	int ix;
+	struct filename_cache_bucket_entry *next;
+};
+
+static struct filename_cache_bucket_entry
+	*filename_cache_buckets[FILE_DB_HASHSIZE];
+
+static void
+filename_cache_index(int ix)
+{
+	struct filename_cache_bucket_entry *entry;
+	u_int32_t hash;
+
+	hash = jenkins_one_at_a_time_hash(filename_cache[ix].path,
+					  strlen(filename_cache[ix].path));
+	hash %= FILE_DB_HASHSIZE;
+	entry = malloc(sizeof(struct filename_cache_bucket_entry));
+	if (entry == NULL) {
+		fprintf(stderr, "%s Can't allocate memory - this is fatal\n",
+			__func__);
+		exit(EXIT_FAILURE);
+	}
+	entry->ix = ix;
+	entry->next = filename_cache_buckets[hash];
+	filename_cache_buckets[hash] = entry;
+}
+
 void
 init_filename_cache(void)
 {
 	static FILE *filename_cache_fp;
 	struct stat st;
 	int file_exists = 1;
+	int i;
 
 	if (stat("ioshark_filenames", &st) < 0) {
 		if (errno != ENOENT) {
@@ -156,17 +189,23 @@ init_filename_cache(void)
 	}
 	if (file_exists)
 		fclose(filename_cache_fp);
+	for (i = 0 ; i < filename_cache_num_entries ; i++)
+		filename_cache_index(i);
 }
 
 static int
 filename_cache_lookup(char *filename)
 {
+	struct filename_cache_bucket_entry *entry;
+	u_int32_t hash;
 	int ret;
-	int i;
 
-	for (i = 0 ; i < filename_cache_num_entries ; i++) {
-		if (strcmp(filename_cache[i].path, filename) == 0)
-			return i;
+	hash = jenkins_one_at_a_time_hash(filename, strlen(filename));
+	hash %= FILE_DB_HASHSIZE;
+	for (entry = filename_cache_buckets[hash] ; entry != NULL ;
+	     entry = entry->next) {
+		if (strcmp(filename_cache[entry->ix].path, filename) == 0)
+			return entry->ix;
 	}
 	if (filename_cache_num_entries >= filename_cache_size) {
 		int newsize;
@@ -187,6 +226,7 @@ filename_cache_lookup(char *filename)
 	       filename);
 	ret = filename_cache_num_entries;
 	filename_cache_num_entries++;
+	filename_cache_index(ret);
 	return ret;
 }
 
@@ -194,7 +234,18 @@ void
 store_filename_cache(void)
 {
 	static FILE *filename_cache_fp;
+	int i;
+
+	for (i = 0 ; i < FILE_DB_HASHSIZE ; i++) {
+		struct filename_cache_bucket_entry *entry, *next;
 
+		for (entry = filename_cache_buckets[i] ; entry != NULL ;
+		     entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+		filename_cache_buckets[i] = NULL;
+	}
 	filename_cache_fp = fopen("ioshark_filenames", "w+");
 	if (filename_cache_fp == NULL) {
 		fprintf(stderr, "%s Cannot open ioshark_filenames file\n",
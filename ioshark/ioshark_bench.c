@@ -15,6 +15,7 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -53,22 +54,54 @@ struct thread_state_s {
 	FILE *fp;
 	int num_files;
 	void *db_handle;
+	struct mount_pool_s *pool;
 };
 
 struct thread_state_s thread_state[MAX_INPUT_FILES];
 int num_input_files = 0;
 int next_input_file;
 
+/*
+ * One worker pool per replay mountpoint (-m). Each pool doles out its
+ * own slice of thread_state[] lock-free, so replaying against (say)
+ * /data and /sdcard at the same time never serializes the two device
+ * queues on a shared work lock. Per-pool replay time and worker CPU
+ * are accumulated here as usecs, also lock-free.
+ */
+struct mount_pool_s {
+	char *dir;			/* pre-created files live here */
+	int work_next;			/* next file ix, fetch-and-add */
+	int work_limit;			/* 1 past last file ix for pool */
+	u_int64_t pass_finish_usecs;	/* latest worker finish, this pass */
+	u_int64_t io_usecs;		/* total replay time for the pool */
+	u_int64_t cpu_user_usecs;	/* worker CPU, all passes */
+	u_int64_t cpu_system_usecs;
+};
+
+struct mount_pool_s mount_pools[MAX_MOUNTS];
+int num_mounts = 0;
+
 pthread_t tid[MAX_THREADS];
 
 /*
  * Global options
  */
 int do_delay = 0;
+double delay_scale = 1.0;
 int verbose = 0;
 int summary_mode = 0;
 int quick_mode = 0;
 
+/*
+ * Pacing bookkeeping: what the scaled trace asked for vs. what the
+ * replay actually achieved (always >=, we never fire an op early).
+ */
+u_int64_t aggr_pacing_intended_usecs;
+u_int64_t aggr_pacing_achieved_usecs;
+
+/* Gaps shorter than this are spun out, usleep() can't hit them */
+#define PACING_SPIN_US	500
+
 #if 0
 static long gettid()
 {
@@ -78,16 +111,23 @@ static long gettid()
 
 void usage()
 {
-	fprintf(stderr, "%s [-d preserve_delays] [-n num_iterations] [-t num_threads] -q -v | -s <list of parsed input files>\n",
+	fprintf(stderr, "%s [-d preserve_delays] [-l latency_log] [-m mount_dir]... [-n num_iterations] [-t num_threads] [-x delay_scale] [-V] -q -v | -s <list of parsed input files>\n",
 		progname);
 	fprintf(stderr, "%s -s, -v are mutually exclusive\n",
 		progname);
+	fprintf(stderr, "%s -m can be repeated (up to %d), 1 worker pool per mount\n",
+		progname, MAX_MOUNTS);
+	fprintf(stderr, "%s -x scales the captured inter-op delays (implies -d), e.g 0.5 replays twice as fast\n",
+		progname);
+	fprintf(stderr, "%s -V verifies read data against per-block CRCs (storage integrity stress)\n",
+		progname);
+	fprintf(stderr, "%s -l logs every op latency to a binary file (stream of lat_log_rec_s) for offline analysis\n",
+		progname);
 	exit(EXIT_FAILURE);
 }
 
 pthread_mutex_t time_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
 struct timeval aggregate_file_create_time;
 struct timeval debug_file_create_time;
 struct timeval aggregate_file_remove_time;
@@ -95,9 +135,21 @@ struct timeval aggregate_IO_time;
 struct timeval aggregate_delay_time;
 
 u_int64_t aggr_op_counts[IOSHARK_MAX_FILE_OP];
+struct lat_histogram_s aggr_lat_hists[IOSHARK_MAX_FILE_OP];
 struct rw_bytes_s aggr_io_rw_bytes;
 struct rw_bytes_s aggr_create_rw_bytes;
 
+/*
+ * Optional binary latency log (-l). Workers batch records locally
+ * and only take the mutex to append a full batch, so logging does
+ * not serialize the op path.
+ */
+char *lat_log_fname = NULL;
+FILE *lat_log_fp = NULL;
+pthread_mutex_t lat_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define LAT_LOG_BATCH	4096
+
 /*
  * Locking needed here because aggregate_delay_time is updated
  * from multiple threads concurrently.
@@ -125,6 +177,30 @@ update_op_counts(u_int64_t *op_counts)
 	pthread_mutex_unlock(&stats_mutex);
 }
 
+static void
+update_lat_hists(struct lat_histogram_s *lat_hists)
+{
+	int i;
+
+	pthread_mutex_lock(&stats_mutex);
+	for (i = IOSHARK_LSEEK ; i < IOSHARK_MAX_FILE_OP ; i++)
+		lat_hist_merge(&aggr_lat_hists[i], &lat_hists[i]);
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+static void
+lat_log_flush(struct lat_log_rec_s *recs, int nrecs)
+{
+	pthread_mutex_lock(&lat_log_mutex);
+	if (fwrite(recs, sizeof(struct lat_log_rec_s), nrecs,
+		   lat_log_fp) != (size_t)nrecs) {
+		fprintf(stderr, "%s: write error on latency log %s\n",
+			progname, lat_log_fname);
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_unlock(&lat_log_mutex);
+}
+
 static void
 update_byte_counts(struct rw_bytes_s *dest, struct rw_bytes_s *delta)
 {
@@ -134,29 +210,54 @@ update_byte_counts(struct rw_bytes_s *dest, struct rw_bytes_s *delta)
 	pthread_mutex_unlock(&stats_mutex);
 }
 
-static int work_next_file;
-static int work_num_files;
+static void
+atomic_max_u64(u_int64_t *dest, u_int64_t val)
+{
+	u_int64_t cur;
+
+	do {
+		cur = *dest;
+		if (val <= cur)
+			return;
+	} while (!__sync_bool_compare_and_swap(dest, cur, val));
+}
 
+/*
+ * Carve up [next_file, next_file + num_files) into one contiguous
+ * slice per mount pool and tag each input file with its pool, so the
+ * pre-created files (and the IOs replayed on them) land on that
+ * pool's mountpoint.
+ */
 void
 init_work(int next_file, int num_files)
 {
-	pthread_mutex_lock(&work_mutex);
-	work_next_file = next_file;
-	work_num_files = work_next_file + num_files;
-	pthread_mutex_unlock(&work_mutex);
+	int m, i, slice;
+	int ix = next_file;
+
+	for (m = 0; m < num_mounts; m++) {
+		struct mount_pool_s *pool = &mount_pools[m];
+
+		slice = num_files / num_mounts;
+		if (m < num_files % num_mounts)
+			slice++;
+		pool->work_next = ix;
+		pool->work_limit = ix + slice;
+		pool->pass_finish_usecs = 0;
+		for (i = ix; i < ix + slice; i++)
+			thread_state[i].pool = pool;
+		ix += slice;
+	}
 }
 
-/* Dole out the next file to work on to the thread */
+/* Dole out the next file to work on to the thread, lock-free */
 static struct thread_state_s *
-get_work()
+get_work(struct mount_pool_s *pool)
 {
-	struct thread_state_s *work = NULL;
+	int ix = __sync_fetch_and_add(&pool->work_next, 1);
 
-	pthread_mutex_lock(&work_mutex);
-	if (work_next_file < work_num_files)
-		work = &thread_state[work_next_file++];
-	pthread_mutex_unlock(&work_mutex);
-	return work;
+	if (ix < pool->work_limit)
+		return &thread_state[ix];
+	return NULL;
 }
 
 static void
@@ -169,6 +270,7 @@ create_files(struct thread_state_s *state)
 	struct rw_bytes_s rw_bytes;
 	char *filename;
 	int readonly;
+	void *sidecar = NULL;
 
 	memset(&rw_bytes, 0, sizeof(struct rw_bytes_s));
 	for (i = 0 ; i < state->num_files ; i++) {
@@ -189,11 +291,14 @@ create_files(struct thread_state_s *state)
 			assert(filename != NULL);
 		if (quick_mode == 0 ||
 		    is_readonly_mount(filename, file_state.size) == 0) {
-			sprintf(path, "file.%d.%d",
+			sprintf(path, "%s/file.%d.%d",
+				state->pool->dir,
 				(int)(state - thread_state),
 				file_state.fileno);
+			if (verify_mode)
+				sidecar = verify_new_sidecar(file_state.size);
 			create_file(path, file_state.size,
-				    &rw_bytes);
+				    &rw_bytes, sidecar);
 			filename = path;
 			readonly = 0;
 		} else {
@@ -202,6 +307,10 @@ create_files(struct thread_state_s *state)
 		db_node = files_db_add_byfileno(state->db_handle,
 						file_state.fileno,
 						readonly);
+		if (sidecar != NULL) {
+			files_db_set_sidecar(db_node, sidecar);
+			sidecar = NULL;
+		}
 		files_db_update_size(db_node, file_state.size);
 		files_db_update_filename(db_node, filename);
 	}
@@ -250,6 +359,9 @@ do_one_io(void *db_node,
 				file_op->prw_offset, errno);
 			exit(EXIT_FAILURE);
 		}
+		if (verify_mode && ret > 0)
+			verify_queue_read(db_node, file_op->prw_offset,
+					  p, ret);
 		break;
 	case IOSHARK_PWRITE64:
 		p = get_buf(bufp, buflen, file_op->prw_len, 1);
@@ -265,6 +377,9 @@ do_one_io(void *db_node,
 				file_op->prw_offset, errno);
 			exit(EXIT_FAILURE);
 		}
+		if (verify_mode && ret > 0)
+			verify_queue_write(db_node, file_op->prw_offset,
+					   p, ret);
 		break;
 	case IOSHARK_READ:
 		p = get_buf(bufp, buflen, file_op->rw_len, 0);
@@ -280,6 +395,19 @@ do_one_io(void *db_node,
 				errno);
 			exit(EXIT_FAILURE);
 		}
+		if (verify_mode && ret > 0) {
+			/*
+			 * Sequential read, the current offset tells us
+			 * where the data came from. The extra lseek is
+			 * verify mode only.
+			 */
+			off_t cur = lseek(files_db_get_fd(db_node),
+					  0, SEEK_CUR);
+
+			if (cur >= ret)
+				verify_queue_read(db_node, cur - ret,
+						  p, ret);
+		}
 		break;
 	case IOSHARK_WRITE:
 		p = get_buf(bufp, buflen, file_op->rw_len, 1);
@@ -295,9 +423,25 @@ do_one_io(void *db_node,
 				errno);
 			exit(EXIT_FAILURE);
 		}
+		if (verify_mode && ret > 0) {
+			off_t cur = lseek(files_db_get_fd(db_node),
+					  0, SEEK_CUR);
+
+			if (cur >= ret)
+				verify_queue_write(db_node, cur - ret,
+						   p, ret);
+		}
 		break;
 	case IOSHARK_MMAP:
 	case IOSHARK_MMAP2:
+		/*
+		 * Mapped writes bypass the verify queue, forget our
+		 * CRCs for the range.
+		 */
+		if (verify_mode && (file_op->mmap_prot & IOSHARK_PROT_WRITE))
+			verify_queue_invalidate(db_node,
+						file_op->mmap_offset,
+						file_op->mmap_len);
 		ioshark_handle_mmap(db_node, file_op,
 				    bufp, buflen, op_counts,
 				    rw_bytes);
@@ -344,6 +488,8 @@ do_one_io(void *db_node,
 				}
 			}
 		}
+		if (verify_mode && (file_op->open_flags & O_TRUNC))
+			verify_queue_invalidate(db_node, 0, (u_int64_t)-1);
 		files_db_close_fd(db_node);
 		files_db_update_fd(db_node, fd);
 		break;
@@ -401,7 +547,15 @@ do_io(struct thread_state_s *state)
 	char *buf = NULL;
 	int buflen = 0;
 	struct timeval total_delay_time;
+	struct timeval pacing_start;
+	u_int64_t pacing_target_us = 0;
+	u_int64_t pacing_elapsed_us = 0;
 	u_int64_t op_counts[IOSHARK_MAX_FILE_OP];
+	struct lat_histogram_s *lat_hists;
+	struct lat_log_rec_s *lat_log_buf = NULL;
+	int lat_log_n = 0;
+	struct timeval op_start, op_end;
+	u_int64_t op_usecs;
 	struct rw_bytes_s rw_bytes;
 
 	rewind(state->fp);
@@ -416,6 +570,27 @@ do_io(struct thread_state_s *state)
 	timerclear(&total_delay_time);
 	memset(&rw_bytes, 0, sizeof(struct rw_bytes_s));
 	memset(op_counts, 0, sizeof(op_counts));
+	/*
+	 * Histograms are too big for the thread stack. One calloc
+	 * per replayed trace file, nothing on the per-op path.
+	 */
+	lat_hists = calloc(IOSHARK_MAX_FILE_OP,
+			   sizeof(struct lat_histogram_s));
+	if (lat_hists == NULL) {
+		fprintf(stderr, "%s Can't allocate latency histograms\n",
+			progname);
+		exit(EXIT_FAILURE);
+	}
+	if (lat_log_fp) {
+		lat_log_buf = malloc(LAT_LOG_BATCH *
+				     sizeof(struct lat_log_rec_s));
+		if (lat_log_buf == NULL) {
+			fprintf(stderr,
+				"%s Can't allocate latency log buffer\n",
+				progname);
+			exit(EXIT_FAILURE);
+		}
+	}
 	fseek(state->fp,
 	      sizeof(struct ioshark_header) +
 	      header.num_files * sizeof(struct ioshark_file_state),
@@ -423,6 +598,8 @@ do_io(struct thread_state_s *state)
 	/*
 	 * Loop over all the IOs, and launch each
 	 */
+	if (do_delay)
+		(void)gettimeofday(&pacing_start, (struct timezone *)NULL);
 	for (i = 0 ; i < header.num_io_operations ; i++) {
 		if (fread(&file_op, sizeof(struct ioshark_file_operation),
 			  1, state->fp) != 1) {
@@ -431,11 +608,37 @@ do_io(struct thread_state_s *state)
 			exit(EXIT_FAILURE);
 		}
 		if (do_delay) {
-			struct timeval start;
+			struct timeval start, now;
 
+			/*
+			 * Pace against the absolute (scaled) schedule
+			 * rather than usleep()ing each delta, so
+			 * per-op sleep overshoot doesn't pile up over
+			 * a long trace. Gaps too short for usleep are
+			 * spun out.
+			 */
+			pacing_target_us +=
+				(u_int64_t)(file_op.delta_us * delay_scale);
 			(void)gettimeofday(&start, (struct timezone *)NULL);
-			usleep(file_op.delta_us);
-			update_delta_time(&start, &total_delay_time);
+			timersub(&start, &pacing_start, &now);
+			pacing_elapsed_us = (u_int64_t)now.tv_sec * 1000000 +
+				now.tv_usec;
+			if (pacing_elapsed_us < pacing_target_us) {
+				u_int64_t wait_us =
+					pacing_target_us - pacing_elapsed_us;
+
+				if (wait_us > PACING_SPIN_US)
+					usleep(wait_us - PACING_SPIN_US);
+				do {
+					(void)gettimeofday(&now,
+							   (struct timezone *)NULL);
+					timersub(&now, &pacing_start, &now);
+					pacing_elapsed_us =
+						(u_int64_t)now.tv_sec * 1000000 +
+						now.tv_usec;
+				} while (pacing_elapsed_us < pacing_target_us);
+				update_delta_time(&start, &total_delay_time);
+			}
 		}
 		db_node = files_db_lookup_byfileno(state->db_handle,
 						   file_op.fileno);
@@ -470,24 +673,74 @@ do_io(struct thread_state_s *state)
 			}
 			files_db_update_fd(db_node, fd);
 		}
+		(void)gettimeofday(&op_start, (struct timezone *)NULL);
 		do_one_io(db_node, &file_op,
 			  op_counts, &rw_bytes, &buf, &buflen);
+		(void)gettimeofday(&op_end, (struct timezone *)NULL);
+		timersub(&op_end, &op_start, &op_end);
+		op_usecs = (u_int64_t)op_end.tv_sec * 1000000 +
+			op_end.tv_usec;
+		lat_hist_add(&lat_hists[file_op.file_op], op_usecs);
+		if (lat_log_buf) {
+			struct lat_log_rec_s *rec =
+				&lat_log_buf[lat_log_n++];
+
+			rec->usecs = MIN(op_usecs, UINT32_MAX);
+			rec->op = file_op.file_op;
+			rec->pad = 0;
+			if (lat_log_n == LAT_LOG_BATCH) {
+				lat_log_flush(lat_log_buf, lat_log_n);
+				lat_log_n = 0;
+			}
+		}
 	}
 	files_db_fsync_discard_files(state->db_handle);
 	files_db_close_files(state->db_handle);
+	if (do_delay) {
+		__sync_fetch_and_add(&aggr_pacing_intended_usecs,
+				     pacing_target_us);
+		__sync_fetch_and_add(&aggr_pacing_achieved_usecs,
+				     pacing_elapsed_us);
+	}
+	if (lat_log_buf) {
+		if (lat_log_n)
+			lat_log_flush(lat_log_buf, lat_log_n);
+		free(lat_log_buf);
+	}
 	update_time(&aggregate_delay_time, &total_delay_time);
 	update_op_counts(op_counts);
+	update_lat_hists(lat_hists);
+	free(lat_hists);
 	update_byte_counts(&aggr_io_rw_bytes, &rw_bytes);
 }
 
 void *
-io_thread(void *unused __attribute__((unused)))
+io_thread(void *arg)
 {
+	struct mount_pool_s *pool = arg;
 	struct thread_state_s *state;
+	struct timeval finish;
+	struct rusage ru;
 
 	srand(gettid());
-	while ((state = get_work()))
+	while ((state = get_work(pool)))
 		do_io(state);
+	/*
+	 * Per-device accounting: the pool's replay time for this pass
+	 * runs until its last worker gets here, and the worker CPU is
+	 * charged to the pool the worker drained.
+	 */
+	(void)gettimeofday(&finish, (struct timezone *)NULL);
+	atomic_max_u64(&pool->pass_finish_usecs,
+		       (u_int64_t)finish.tv_sec * 1000000 + finish.tv_usec);
+	if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+		__sync_fetch_and_add(&pool->cpu_user_usecs,
+				     (u_int64_t)ru.ru_utime.tv_sec * 1000000 +
+				     ru.ru_utime.tv_usec);
+		__sync_fetch_and_add(&pool->cpu_system_usecs,
+				     (u_int64_t)ru.ru_stime.tv_sec * 1000000 +
+				     ru.ru_stime.tv_usec);
+	}
 	pthread_exit(NULL);
         return(NULL);
 }
@@ -508,11 +761,12 @@ do_create(struct thread_state_s *state)
 }
 
 void *
-create_files_thread(void *unused __attribute__((unused)))
+create_files_thread(void *arg)
 {
+	struct mount_pool_s *pool = arg;
 	struct thread_state_s *state;
 
-	while ((state = get_work()))
+	while ((state = get_work(pool)))
 		do_create(state);
 	pthread_exit(NULL);
 	return(NULL);
@@ -533,12 +787,23 @@ get_start_end(int *start_ix)
 
 	if (fssize_clamp_next_index == num_input_files)
 		return 0;
-	if (statfs("/data/local/tmp", &fsstat) < 0) {
-		fprintf(stderr, "%s: Can't statfs /data/local/tmp\n",
-			progname);
-		exit(EXIT_FAILURE);
+	/*
+	 * The input files get sliced across the mounts, clamp the
+	 * chunk to the tightest mount to be safe.
+	 */
+	free_fs_bytes = 0;
+	for (i = 0; i < num_mounts; i++) {
+		u_int64_t mount_free;
+
+		if (statfs(mount_pools[i].dir, &fsstat) < 0) {
+			fprintf(stderr, "%s: Can't statfs %s\n",
+				progname, mount_pools[i].dir);
+			exit(EXIT_FAILURE);
+		}
+		mount_free = (fsstat.f_bavail * fsstat.f_bsize) * 9 / 10;
+		if (i == 0 || mount_free < free_fs_bytes)
+			free_fs_bytes = mount_free;
 	}
-	free_fs_bytes = (fsstat.f_bavail * fsstat.f_bsize) * 9 /10;
 	for (i = fssize_clamp_next_index; i < num_input_files; i++) {
 		infile = thread_state[i].filename;
 		fp = fopen(infile, "r");
@@ -592,14 +857,37 @@ out:
 }
 
 int
-ioshark_pthread_create(pthread_t *tidp, void *(*start_routine)(void *))
+ioshark_pthread_create(pthread_t *tidp, void *(*start_routine)(void *),
+		       void *arg)
 {
 	pthread_attr_t attr;
 
 	pthread_attr_init(&attr);
 	pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
 	pthread_attr_setstacksize(&attr, (size_t)(1024*1024));
-	return pthread_create(tidp, &attr, start_routine, (void *)NULL);
+	return pthread_create(tidp, &attr, start_routine, arg);
+}
+
+/*
+ * Workers for a pool. An explicit -t is the total across pools, split
+ * evenly (at least 1 each), else 1 worker per file like before.
+ */
+static int
+pool_num_threads(struct mount_pool_s *pool, int num_threads)
+{
+	int nfiles = pool->work_limit - pool->work_next;
+	int nt;
+
+	if (num_threads == 0) {
+		nt = nfiles;
+	} else {
+		nt = num_threads / num_mounts;
+		if (nt == 0)
+			nt = 1;
+	}
+	if (nt > nfiles)
+		nt = nfiles;
+	return nt;
 }
 
 void
@@ -658,14 +946,23 @@ main(int argc, char **argv)
 	int num_iterations = 1;
 	int c;
 	int num_files, start_file;
+	int verify_failed = 0;
 	struct thread_state_s *state;
 
 	progname = argv[0];
-        while ((c = getopt(argc, argv, "dn:st:qv")) != EOF) {
+        while ((c = getopt(argc, argv, "dl:m:n:st:x:qvV")) != EOF) {
                 switch (c) {
                 case 'd':
 			do_delay = 1;
 			break;
+                case 'l':
+			lat_log_fname = optarg;
+			break;
+                case 'm':
+			if (num_mounts == MAX_MOUNTS)
+				usage();
+			mount_pools[num_mounts++].dir = optarg;
+			break;
                 case 'n':
 			num_iterations = atoi(optarg);
 			break;
@@ -676,6 +973,12 @@ main(int argc, char **argv)
                 case 't':
 			num_threads = atoi(optarg);
 			break;
+                case 'x':
+			delay_scale = atof(optarg);
+			if (delay_scale <= 0.0)
+				usage();
+			do_delay = 1;
+			break;
                 case 'q':
 			/*
 			 * If quick mode is enabled, then we won't
@@ -687,6 +990,9 @@ main(int argc, char **argv)
                 case 'v':
 			verbose = 1;
 			break;
+                case 'V':
+			verify_mode = 1;
+			break;
  	        default:
 			usage();
 		}
@@ -701,8 +1007,23 @@ main(int argc, char **argv)
 	if (optind == argc)
                 usage();
 
+	if (num_mounts == 0) {
+		/* Keep the old single-pool behavior, see get_start_end() */
+		mount_pools[0].dir = "/data/local/tmp";
+		num_mounts = 1;
+	}
+
 	sizeup_fd_limits();
 
+	if (lat_log_fname) {
+		lat_log_fp = fopen(lat_log_fname, "w");
+		if (lat_log_fp == NULL) {
+			fprintf(stderr, "%s: Can't create %s\n",
+				progname, lat_log_fname);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	for (i = optind; i < argc; i++) {
 		infile = argv[i];
 		if (stat(infile, &st) < 0) {
@@ -740,8 +1061,13 @@ main(int argc, char **argv)
 	if (quick_mode)
 		init_filename_cache();
 
+	for (i = 0; i < num_mounts; i++)
+		add_disk_util_device(mount_pools[i].dir);
 	capture_util_state_before();
 
+	if (verify_mode)
+		verify_start();
+
 	/*
 	 * We pre-create the files that we need once and then we
 	 * loop around N times doing IOs on the pre-created files.
@@ -754,28 +1080,36 @@ main(int argc, char **argv)
 	 */
 	while ((num_files = get_start_end(&start_file))) {
 		struct timeval time_for_pass;
+		u_int64_t pass_start_usecs;
+		int total_threads;
+		int m;
 
 		/* Create files once */
 		if (!summary_mode)
 			printf("Doing Pre-creation of Files\n");
 		if (quick_mode && !summary_mode)
 			printf("Skipping Pre-creation of read-only Files\n");
-		if (num_threads == 0 || num_threads > num_files)
-			num_threads = num_files;
 		(void)system("echo 3 > /proc/sys/vm/drop_caches");
 		init_work(start_file, num_files);
 		(void)gettimeofday(&time_for_pass,
 				   (struct timezone *)NULL);
-		for (i = 0; i < num_threads; i++) {
-			if (ioshark_pthread_create(&(tid[i]),
-						   create_files_thread)) {
-				fprintf(stderr,
-					"%s: Can't create creator thread %d\n",
-					progname, i);
-				exit(EXIT_FAILURE);
+		total_threads = 0;
+		for (m = 0; m < num_mounts; m++) {
+			struct mount_pool_s *pool = &mount_pools[m];
+			int nt = pool_num_threads(pool, num_threads);
+
+			for (i = 0; i < nt; i++) {
+				if (ioshark_pthread_create(
+					    &(tid[total_threads++]),
+					    create_files_thread, pool)) {
+					fprintf(stderr,
+						"%s: Can't create creator thread %d\n",
+						progname, i);
+					exit(EXIT_FAILURE);
+				}
 			}
 		}
-		wait_for_threads(num_threads);
+		wait_for_threads(total_threads);
 		update_delta_time(&time_for_pass, &aggregate_file_create_time);
 		/* Do the IOs N times */
 		for (i = 0 ; i < num_iterations ; i++) {
@@ -790,34 +1124,61 @@ main(int argc, char **argv)
 			init_work(start_file, num_files);
 			(void)gettimeofday(&time_for_pass,
 					   (struct timezone *)NULL);
-			for (c = 0; c < num_threads; c++) {
-				if (ioshark_pthread_create(&(tid[c]),
-							   io_thread)) {
-					fprintf(stderr,
-						"%s: Can't create thread %d\n",
-						progname, c);
-					exit(EXIT_FAILURE);
+			pass_start_usecs =
+				(u_int64_t)time_for_pass.tv_sec * 1000000 +
+				time_for_pass.tv_usec;
+			total_threads = 0;
+			for (m = 0; m < num_mounts; m++) {
+				struct mount_pool_s *pool = &mount_pools[m];
+				int nt = pool_num_threads(pool, num_threads);
+
+				for (c = 0; c < nt; c++) {
+					if (ioshark_pthread_create(
+						    &(tid[total_threads++]),
+						    io_thread, pool)) {
+						fprintf(stderr,
+							"%s: Can't create thread %d\n",
+							progname, c);
+						exit(EXIT_FAILURE);
+					}
 				}
 			}
-			wait_for_threads(num_threads);
+			wait_for_threads(total_threads);
 			update_delta_time(&time_for_pass,
 					  &aggregate_IO_time);
+			/* Replay time as seen by each pool */
+			for (m = 0; m < num_mounts; m++) {
+				struct mount_pool_s *pool = &mount_pools[m];
+
+				if (pool->pass_finish_usecs > pass_start_usecs)
+					pool->io_usecs +=
+						pool->pass_finish_usecs -
+						pass_start_usecs;
+			}
 		}
 
 		/*
 		 * We are done with the N iterations of IO.
-		 * Destroy the files we pre-created.
+		 * Destroy the files we pre-created. In verify mode
+		 * queued checks point into the sidecars we are about
+		 * to free, let the checker catch up first.
 		 */
-		init_work(start_file, num_files);
-		while ((state = get_work())) {
+		if (verify_mode)
+			verify_drain();
+		for (i = start_file; i < start_file + num_files; i++) {
 			struct timeval start;
 
+			state = &thread_state[i];
 			(void)gettimeofday(&start, (struct timezone *)NULL);
 			files_db_unlink_files(state->db_handle);
 			update_delta_time(&start, &aggregate_file_remove_time);
 			files_db_free_memory(state->db_handle);
 		}
 	}
+	if (verify_mode)
+		verify_stop();
+	if (lat_log_fp)
+		fclose(lat_log_fp);
 	if (!summary_mode) {
 		printf("Total Creation time = %ju.%ju (msecs.usecs)\n",
 		       get_msecs(&aggregate_file_create_time),
@@ -825,19 +1186,47 @@ main(int argc, char **argv)
 		printf("Total Remove time = %ju.%ju (msecs.usecs)\n",
 		       get_msecs(&aggregate_file_remove_time),
 		       get_usecs(&aggregate_file_remove_time));
-		if (do_delay)
+		if (do_delay) {
 			printf("Total delay time = %ju.%ju (msecs.usecs)\n",
 			       get_msecs(&aggregate_delay_time),
 			       get_usecs(&aggregate_delay_time));
+			printf("Pacing (scale %.2f): intended = %ju.%ju, achieved = %ju.%ju (msecs.usecs), overshoot = %.2f%%\n",
+			       delay_scale,
+			       (uintmax_t)(aggr_pacing_intended_usecs / 1000),
+			       (uintmax_t)(aggr_pacing_intended_usecs % 1000),
+			       (uintmax_t)(aggr_pacing_achieved_usecs / 1000),
+			       (uintmax_t)(aggr_pacing_achieved_usecs % 1000),
+			       aggr_pacing_intended_usecs ?
+			       (aggr_pacing_achieved_usecs -
+				aggr_pacing_intended_usecs) * 100.0 /
+			       aggr_pacing_intended_usecs : 0.0);
+		}
 		printf("Total Test (IO) time = %ju.%ju (msecs.usecs)\n",
 		       get_msecs(&aggregate_IO_time),
 		       get_usecs(&aggregate_IO_time));
+		if (num_mounts > 1) {
+			for (i = 0; i < num_mounts; i++) {
+				struct mount_pool_s *pool = &mount_pools[i];
+
+				printf("Mount %s : IO time = %ju.%ju (msecs.usecs), worker CPU = %ju.%ju user %ju.%ju system (msecs.usecs)\n",
+				       pool->dir,
+				       (uintmax_t)(pool->io_usecs / 1000),
+				       (uintmax_t)(pool->io_usecs % 1000),
+				       (uintmax_t)(pool->cpu_user_usecs / 1000),
+				       (uintmax_t)(pool->cpu_user_usecs % 1000),
+				       (uintmax_t)(pool->cpu_system_usecs / 1000),
+				       (uintmax_t)(pool->cpu_system_usecs % 1000));
+			}
+		}
 		if (verbose)
 			print_bytes("Upfront File Creation bytes",
 				    &aggr_create_rw_bytes);
 		print_bytes("Total Test (IO) bytes", &aggr_io_rw_bytes);
 		if (verbose)
 			print_op_stats(aggr_op_counts);
+		print_lat_stats(aggr_lat_hists);
+		if (verify_mode)
+			verify_failed = verify_report(0) != 0;
 		report_cpu_disk_util();
 	} else {
 		printf("%ju.%ju ",
@@ -854,9 +1243,13 @@ main(int argc, char **argv)
 		       get_msecs(&aggregate_IO_time),
 		       get_usecs(&aggregate_IO_time));
 		print_bytes(NULL, &aggr_io_rw_bytes);
+		if (verify_mode)
+			verify_failed = verify_report(1) != 0;
 		report_cpu_disk_util();
 		printf("\n");
 	}
 	if (quick_mode)
 		free_filename_cache();
+	if (verify_failed)
+		exit(EXIT_FAILURE);
 }
@@ -37,6 +37,9 @@ const char *IO_op[] = {
 #define MAX(A, B)	((A) > (B) ? (A) : (B))
 #define MIN(A, B)	((A) < (B) ? (A) : (B))
 
+/* Replay can be spread over multiple mountpoints, 1 worker pool each */
+#define MAX_MOUNTS	8
+
 #define MINBUFLEN	(16*1024)
 
 #define FILE_DB_HASHSIZE	8192
@@ -48,6 +51,7 @@ struct files_db_s {
 	int fd;
 	int readonly;
 	int debug_open_flags;
+	void *sidecar;		/* verify mode per-block CRCs */
 	struct files_db_s *next;
 };
 
@@ -64,6 +68,65 @@ struct rw_bytes_s {
 	u_int64_t bytes_written;
 };
 
+/*
+ * HDR-style latency histogram, one per file op type. Power-of-2
+ * major buckets with LAT_HIST_SUB linear sub-buckets each give
+ * better than 7% resolution over the entire usec range in fixed
+ * memory, so recording a latency on the op path is a shift and
+ * an increment - no allocation, no search.
+ */
+#define LAT_HIST_SUB_BITS	4
+#define LAT_HIST_SUB		(1 << LAT_HIST_SUB_BITS)
+/* 40 majors covers latencies up to ~2^42 usecs, over a month */
+#define LAT_HIST_MAJOR		40
+
+struct lat_histogram_s {
+	u_int64_t samples;
+	u_int64_t max_usecs;
+	u_int64_t buckets[LAT_HIST_MAJOR][LAT_HIST_SUB];
+};
+
+static inline void
+lat_hist_add(struct lat_histogram_s *hist, u_int64_t usecs)
+{
+	int major, minor;
+
+	if (usecs < LAT_HIST_SUB) {
+		major = 0;
+		minor = usecs;
+	} else {
+		int msb = 63 - __builtin_clzll(usecs);
+
+		major = msb - (LAT_HIST_SUB_BITS - 1);
+		minor = (usecs >> (msb - LAT_HIST_SUB_BITS)) &
+			(LAT_HIST_SUB - 1);
+		if (major >= LAT_HIST_MAJOR) {
+			major = LAT_HIST_MAJOR - 1;
+			minor = LAT_HIST_SUB - 1;
+		}
+	}
+	hist->buckets[major][minor]++;
+	hist->samples++;
+	if (usecs > hist->max_usecs)
+		hist->max_usecs = usecs;
+}
+
+void lat_hist_merge(struct lat_histogram_s *dest,
+		    struct lat_histogram_s *delta);
+u_int64_t lat_hist_percentile(struct lat_histogram_s *hist, double pct);
+void print_lat_stats(struct lat_histogram_s *hists);
+
+/*
+ * One record in the binary latency log (-l). The log is a raw
+ * stream of these in host byte order, one per replayed file op,
+ * for offline tail analysis.
+ */
+struct lat_log_rec_s {
+	u_int32_t usecs;	/* clamped at UINT32_MAX, ~71 minutes */
+	u_int16_t op;		/* enum file_op */
+	u_int16_t pad;
+};
+
 static inline void
 files_db_update_size(void *node, u_int64_t new_size)
 {
@@ -103,6 +166,18 @@ files_db_readonly(void *node)
 	return (((struct files_db_s *)node)->readonly);
 }
 
+static inline void *
+files_db_get_sidecar(void *node)
+{
+	return (((struct files_db_s *)node)->sidecar);
+}
+
+static inline void
+files_db_set_sidecar(void *node, void *sidecar)
+{
+	((struct files_db_s *)node)->sidecar = sidecar;
+}
+
 static inline u_int64_t
 get_msecs(struct timeval *tv)
 {
@@ -127,6 +202,24 @@ update_delta_time(struct timeval *start,
 	*destination = finish;
 }
 
+/*
+ * Lock-free flavor of update_delta_time for counters that are
+ * hammered from all the worker pools concurrently. The destination
+ * is in usecs so we can accumulate with a single fetch-and-add
+ * instead of taking time_mutex around a timeradd.
+ */
+static inline void
+update_delta_time_atomic(struct timeval *start,
+			 u_int64_t *dest_usecs)
+{
+	struct timeval res, finish;
+
+	(void)gettimeofday(&finish, (struct timezone *)NULL);
+	timersub(&finish, start, &res);
+	__sync_fetch_and_add(dest_usecs,
+			     (u_int64_t)res.tv_sec * 1000000 + res.tv_usec);
+}
+
 void *files_db_create_handle(void);
 void *files_db_lookup_byfileno(void *handle, int fileno);
 void *files_db_add_byfileno(void *handle, int fileno, int readonly);
@@ -136,7 +229,7 @@ void files_db_close_files(void *handle);
 void files_db_close_fd(void *node);
 void files_db_free_memory(void *handle);
 void create_file(char *path, size_t size,
-		 struct rw_bytes_s *rw_bytes);
+		 struct rw_bytes_s *rw_bytes, void *sidecar);
 char *get_buf(char **buf, int *buflen, int len, int do_fill);
 void files_db_fsync_discard_files(void *handle);
 void print_op_stats(u_int64_t *op_counts);
@@ -145,9 +238,26 @@ void ioshark_handle_mmap(void *db_node,
 			 struct ioshark_file_operation *file_op,
 			 char **bufp, int *buflen, u_int64_t *op_counts,
 			 struct rw_bytes_s *rw_bytes);
+void add_disk_util_device(char *mount_dir);
 void capture_util_state_before(void);
 void report_cpu_disk_util(void);
 
+/* Read-verify mode (ioshark_bench_verify.c) */
+extern int verify_mode;
+void *verify_new_sidecar(u_int64_t size);
+void verify_free_sidecar(void *sidecar);
+void verify_seed_sidecar(void *sidecar, u_int64_t offset,
+			 const char *buf, size_t len);
+void verify_queue_write(void *db_node, u_int64_t offset,
+			const char *buf, size_t len);
+void verify_queue_read(void *db_node, u_int64_t offset,
+		       const char *buf, size_t len);
+void verify_queue_invalidate(void *db_node, u_int64_t offset, u_int64_t len);
+void verify_start(void);
+void verify_drain(void);
+void verify_stop(void);
+u_int64_t verify_report(int summary);
+
 char *get_ro_filename(int ix);
 void init_filename_cache(void);
 void free_filename_cache(void);
@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <sys/vfs.h>
 #include <sys/statvfs.h>
+#include <sys/sysmacros.h>
 #include <sys/mman.h>
 #include "ioshark.h"
 #include "ioshark_bench.h"
@@ -78,6 +79,7 @@ void *files_db_add_byfileno(void *handle, int fileno, int readonly)
 		db_node->readonly = readonly;
 		db_node->size = 0;
 		db_node->fd = -1;
+		db_node->sidecar = NULL;
 		db_node->next = h->files_db_buckets[hash];
 		h->files_db_buckets[hash] = db_node;
 	} else {
@@ -228,6 +230,7 @@ files_db_free_memory(void *handle)
 			tmp = db_node;
 			db_node = db_node->next;
 			free(tmp->filename);
+			verify_free_sidecar(tmp->sidecar);
 			free(tmp);
 		}
 	}
@@ -267,11 +270,13 @@ get_buf(char **buf, int *buflen, int len, int do_fill __attribute__((unused)))
 }
 
 void
-create_file(char *path, size_t size, struct rw_bytes_s *rw_bytes)
+create_file(char *path, size_t size, struct rw_bytes_s *rw_bytes,
+	    void *sidecar)
 {
 	int fd, n;
 	char *buf = NULL;
 	int buflen = 0;
+	u_int64_t offset = 0;
 
 	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
 	if (fd < 0) {
@@ -288,7 +293,10 @@ create_file(char *path, size_t size, struct rw_bytes_s *rw_bytes)
 				progname, path, errno);
 			exit(EXIT_FAILURE);
 		}
+		if (sidecar != NULL)
+			verify_seed_sidecar(sidecar, offset, buf, n);
 		rw_bytes->bytes_written += n;
+		offset += n;
 		size -= n;
 	}
 	if (fsync(fd) < 0) {
@@ -318,6 +326,76 @@ print_op_stats(u_int64_t *op_counts)
 	}
 }
 
+void
+lat_hist_merge(struct lat_histogram_s *dest,
+	       struct lat_histogram_s *delta)
+{
+	int major, minor;
+
+	dest->samples += delta->samples;
+	if (delta->max_usecs > dest->max_usecs)
+		dest->max_usecs = delta->max_usecs;
+	for (major = 0 ; major < LAT_HIST_MAJOR ; major++)
+		for (minor = 0 ; minor < LAT_HIST_SUB ; minor++)
+			dest->buckets[major][minor] +=
+				delta->buckets[major][minor];
+}
+
+/* Lower bound in usecs of histogram bucket [major][minor] */
+static u_int64_t
+lat_hist_bucket_low(int major, int minor)
+{
+	if (major == 0)
+		return minor;
+	return (u_int64_t)(LAT_HIST_SUB + minor) << (major - 1);
+}
+
+u_int64_t
+lat_hist_percentile(struct lat_histogram_s *hist, double pct)
+{
+	u_int64_t rank, seen = 0;
+	int major, minor;
+
+	if (hist->samples == 0)
+		return 0;
+	rank = (u_int64_t)(hist->samples * (pct / 100.0));
+	if (rank == 0)
+		rank = 1;
+	for (major = 0 ; major < LAT_HIST_MAJOR ; major++) {
+		for (minor = 0 ; minor < LAT_HIST_SUB ; minor++) {
+			seen += hist->buckets[major][minor];
+			if (seen >= rank)
+				return lat_hist_bucket_low(major, minor);
+		}
+	}
+	return hist->max_usecs;
+}
+
+void
+print_lat_stats(struct lat_histogram_s *hists)
+{
+	int i;
+	extern char *IO_op[];
+
+	printf("IO Operation latencies (usecs) :\n");
+	printf("%-14s %12s %8s %8s %8s %8s %10s\n",
+	       "op", "count", "p50", "p95", "p99", "p999", "max");
+	for (i = IOSHARK_LSEEK ; i < IOSHARK_MAX_FILE_OP ; i++) {
+		struct lat_histogram_s *hist = &hists[i];
+
+		if (hist->samples == 0)
+			continue;
+		printf("%-14s %12ju %8ju %8ju %8ju %8ju %10ju\n",
+		       IO_op[i],
+		       hist->samples,
+		       lat_hist_percentile(hist, 50),
+		       lat_hist_percentile(hist, 95),
+		       lat_hist_percentile(hist, 99),
+		       lat_hist_percentile(hist, 99.9),
+		       hist->max_usecs);
+	}
+}
+
 void
 print_bytes(char *desc, struct rw_bytes_s *rw_bytes)
 {
@@ -355,6 +433,18 @@ static struct cpu_disk_util_stats after;
 
 #define BUFSIZE		8192
 
+/*
+ * Block devices backing the replay mounts, so disk util can be
+ * reported per device. Filled in by add_disk_util_device(), with a
+ * getprop fallback in capture_util_state_before() when no mount was
+ * registered.
+ */
+#define MAX_BDEV_NAMELEN	64
+static char util_bdevs[MAX_MOUNTS][MAX_BDEV_NAMELEN];
+static int num_util_bdevs;
+static struct cpu_disk_util_stats disk_before[MAX_MOUNTS];
+static struct cpu_disk_util_stats disk_after[MAX_MOUNTS];
+
 static int hz;
 
 static void
@@ -410,8 +500,56 @@ get_blockdev_name(char *bdev)
 	}
 }
 
+/*
+ * Resolve the disk backing mount_dir through /sys/dev/block and
+ * remember it for the disk util report. Dedups, so mounts sharing a
+ * disk (/data and /sdcard on most devices) are only counted once.
+ */
+void
+add_disk_util_device(char *mount_dir)
+{
+	struct stat st;
+	char sys_path[BUFSIZE];
+	char link_target[BUFSIZE];
+	char *bdev, *p;
+	ssize_t len;
+	int i;
+
+	if (stat(mount_dir, &st) < 0) {
+		fprintf(stderr, "%s: Can't stat %s\n",
+			progname, mount_dir);
+		exit(1);
+	}
+	snprintf(sys_path, sizeof(sys_path), "/sys/dev/block/%u:%u",
+		 major(st.st_dev), minor(st.st_dev));
+	len = readlink(sys_path, link_target, sizeof(link_target) - 1);
+	if (len < 0) {
+		/* No backing disk (tmpfs and friends), skip */
+		if (verbose)
+			printf("No block device for %s, skipping disk util\n",
+			       mount_dir);
+		return;
+	}
+	link_target[len] = '\0';
+	/* .../block/<disk>[/<partition>], we want <disk> */
+	bdev = strstr(link_target, "/block/");
+	if (bdev == NULL)
+		return;
+	bdev += strlen("/block/");
+	p = strchr(bdev, '/');
+	if (p)
+		*p = '\0';
+	for (i = 0; i < num_util_bdevs; i++)
+		if (strcmp(util_bdevs[i], bdev) == 0)
+			return;
+	strncpy(util_bdevs[num_util_bdevs], bdev, MAX_BDEV_NAMELEN - 1);
+	util_bdevs[num_util_bdevs][MAX_BDEV_NAMELEN - 1] = '\0';
+	num_util_bdevs++;
+}
+
 static void
-read_disk_util_state(struct cpu_disk_util_stats *state)
+read_disk_util_state(struct cpu_disk_util_stats *state,
+		     char *blockdev_name)
 {
 	FILE *fp;
         char line[BUFSIZE], dev_name[BUFSIZE];
@@ -423,7 +561,6 @@ read_disk_util_state(struct cpu_disk_util_stats *state)
 	unsigned long rd_merges;
 	unsigned long wr_merges;
 	unsigned long up_sec, up_cent;
-	char blockdev_name[BUFSIZE];
 
 	/* Read and parse /proc/uptime */
 	fp = fopen("/proc/uptime", "r");
@@ -438,7 +575,6 @@ read_disk_util_state(struct cpu_disk_util_stats *state)
 		(unsigned long long) up_cent * hz / 100;
 
 	/* Read and parse /proc/diskstats */
-	get_blockdev_name(blockdev_name);
 	fp = fopen("/proc/diskstats", "r");
 	while (fgets(line, sizeof(line), fp)) {
 		sscanf(line,
@@ -463,8 +599,8 @@ read_disk_util_state(struct cpu_disk_util_stats *state)
 			return;
 		}
 	}
-        fprintf(stderr, "%s: Did not find device sda in /proc/diskstats\n",
-		progname);
+        fprintf(stderr, "%s: Did not find device %s in /proc/diskstats\n",
+		progname, blockdev_name);
 	exit(1);
 }
 
@@ -496,8 +632,16 @@ read_cpu_util_state(struct cpu_disk_util_stats *state)
 void
 capture_util_state_before(void)
 {
+	int i;
+
 	get_HZ();
-	read_disk_util_state(&before);
+	if (num_util_bdevs == 0) {
+		/* No mounts registered, fall back to the getprop table */
+		get_blockdev_name(util_bdevs[0]);
+		num_util_bdevs = 1;
+	}
+	for (i = 0; i < num_util_bdevs; i++)
+		read_disk_util_state(&disk_before[i], util_bdevs[i]);
 	read_cpu_util_state(&before);
 }
 
@@ -506,8 +650,10 @@ report_cpu_disk_util(void)
 {
         double disk_util, cpu_util;
 	u_int64_t tot1, tot2, delta1, delta2;
+	int i;
 
-	read_disk_util_state(&after);
+	for (i = 0; i < num_util_bdevs; i++)
+		read_disk_util_state(&disk_after[i], util_bdevs[i]);
 	read_cpu_util_state(&after);
 	/* CPU Util */
 	tot2 = after.user_cpu_ticks + after.nice_cpu_ticks +
@@ -542,21 +688,33 @@ report_cpu_disk_util(void)
 		printf("System CPU util = %.2f%%\n", cpu_util);
 	else
 		printf("%.2f ", cpu_util);
-	/* Disk Util */
-	disk_util = (after.tot_ticks - before.tot_ticks) * 100.0 /
-		(after.uptime - before.uptime);
-	if (verbose) {
-		printf("Reads : nr_ios %lu, MB read %lu\n",
-	       (after.rd_ios - before.rd_ios),
-	       (after.rd_sec - before.rd_sec) / 2048);
-		printf("Writes : nr_ios %lu, MB written %lu\n",
-	       (after.wr_ios - before.wr_ios),
-		       (after.wr_sec - before.wr_sec) / 2048);
+	/* Disk Util, per backing device */
+	for (i = 0; i < num_util_bdevs; i++) {
+		disk_util = (disk_after[i].tot_ticks -
+			     disk_before[i].tot_ticks) * 100.0 /
+			(disk_after[i].uptime - disk_before[i].uptime);
+		if (verbose) {
+			printf("%s Reads : nr_ios %lu, MB read %lu\n",
+			       util_bdevs[i],
+			       (disk_after[i].rd_ios - disk_before[i].rd_ios),
+			       (disk_after[i].rd_sec - disk_before[i].rd_sec) / 2048);
+			printf("%s Writes : nr_ios %lu, MB written %lu\n",
+			       util_bdevs[i],
+			       (disk_after[i].wr_ios - disk_before[i].wr_ios),
+			       (disk_after[i].wr_sec - disk_before[i].wr_sec) / 2048);
+		}
+		if (!summary_mode) {
+			if (num_util_bdevs > 1)
+				printf("Disk util (%s) = %.2f%%\n",
+				       util_bdevs[i], disk_util);
+			else
+				printf("Disk util = %.2f%%\n", disk_util);
+		} else {
+			if (i > 0)
+				printf(" ");
+			printf("%.2f", disk_util);
+		}
 	}
-	if (!summary_mode)
-		printf("Disk util = %.2f%%\n", disk_util);
-	else
-		printf("%.2f", disk_util);
 }
 
 
@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "ioshark.h"
+#include "ioshark_bench.h"
+
+/*
+ * Read-verify mode (-V), for using ioshark as a storage integrity
+ * stressor (eMMC/UFS endurance runs) and not just a performance
+ * benchmark.
+ *
+ * Each pre-created file gets a sidecar of per-4KB-block CRC32s,
+ * seeded as create_file() writes the file out. The replay I/O path
+ * itself never computes a CRC : read and write payloads are copied
+ * off onto a queue and a single checker thread does all the CRC
+ * work lazily, so the replayed IO timing stays clean. The checker
+ * updates the sidecar on write items and compares on read items,
+ * and since workers replay a given file's ops in order and the
+ * queue is FIFO, the sidecar is always coherent with the data the
+ * reads should have seen.
+ *
+ * Blocks we can't know the content of (partial block writes, mmap
+ * writes, O_TRUNC) just get invalidated and are skipped by later
+ * reads until a full-block write makes them verifiable again.
+ */
+
+extern char *progname;
+
+int verify_mode = 0;
+
+#define VERIFY_BLOCK_SIZE	4096
+
+/* Cap on queued-but-unchecked items, so a read-heavy trace that
+ * outruns the checker can't eat all of memory. Workers stall on
+ * the full queue (reported, so fidelity loss isn't silent).
+ */
+#define VERIFY_MAX_QUEUED	4096
+
+struct verify_sidecar {
+	u_int64_t	size;
+	u_int64_t	num_blocks;
+	u_int32_t	*crcs;
+	unsigned char	*valid;
+};
+
+enum verify_item_op {
+	VERIFY_ITEM_WRITE,	/* update sidecar CRCs from payload */
+	VERIFY_ITEM_READ,	/* compare payload against sidecar */
+	VERIFY_ITEM_INVALIDATE	/* forget CRCs for the range */
+};
+
+struct verify_item_s {
+	enum verify_item_op	op;
+	struct verify_sidecar	*sidecar;
+	char			*filename;
+	u_int64_t		offset;
+	size_t			len;
+	char			*data;
+	struct verify_item_s	*next;
+};
+
+static pthread_mutex_t verify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t verify_work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t verify_space_cv = PTHREAD_COND_INITIALIZER;
+static struct verify_item_s *verify_queue_head;
+static struct verify_item_s *verify_queue_tail;
+static int verify_queue_len;
+static int verify_busy;
+static int verify_shutdown;
+static pthread_t verify_tid;
+
+static u_int64_t verify_blocks_checked;
+static u_int64_t verify_blocks_mismatched;
+static u_int64_t verify_queue_stalls;
+
+/*
+ * CRC32, using the CPU instructions where the build enables them
+ * (armv8+crc, SSE4.2), falling back to a bytewise table. The
+ * polynomial differs between the hardware flavors, which is fine :
+ * sidecar CRCs only ever live and die within one run.
+ */
+#if defined(__ARM_FEATURE_CRC32)
+
+#include <arm_acle.h>
+
+static u_int32_t
+verify_crc32(u_int32_t crc, const unsigned char *p, size_t len)
+{
+	crc = ~crc;
+	while (len >= 8) {
+		u_int64_t v;
+
+		memcpy(&v, p, 8);
+		crc = __crc32d(crc, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = __crc32b(crc, *p++);
+		len--;
+	}
+	return ~crc;
+}
+
+#elif defined(__SSE4_2__)
+
+static u_int32_t
+verify_crc32(u_int32_t crc, const unsigned char *p, size_t len)
+{
+	u_int64_t crc64 = ~crc;
+
+	while (len >= 8) {
+		u_int64_t v;
+
+		memcpy(&v, p, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, v);
+		p += 8;
+		len -= 8;
+	}
+	crc = (u_int32_t)crc64;
+	while (len > 0) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+		len--;
+	}
+	return ~crc;
+}
+
+#else
+
+static u_int32_t crc32_table[256];
+static int crc32_table_init;
+
+static void
+verify_crc32_table_setup(void)
+{
+	u_int32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ ((c & 1) ? 0xedb88320 : 0);
+		crc32_table[i] = c;
+	}
+	crc32_table_init = 1;
+}
+
+static u_int32_t
+verify_crc32(u_int32_t crc, const unsigned char *p, size_t len)
+{
+	if (!crc32_table_init)
+		verify_crc32_table_setup();
+	crc = ~crc;
+	while (len > 0) {
+		crc = (crc >> 8) ^ crc32_table[(crc ^ *p++) & 0xff];
+		len--;
+	}
+	return ~crc;
+}
+
+#endif
+
+void *
+verify_new_sidecar(u_int64_t size)
+{
+	struct verify_sidecar *sc;
+
+	sc = malloc(sizeof(struct verify_sidecar));
+	if (sc == NULL) {
+		fprintf(stderr, "%s: Can't allocate verify sidecar\n",
+			progname);
+		exit(EXIT_FAILURE);
+	}
+	sc->size = size;
+	sc->num_blocks = (size + VERIFY_BLOCK_SIZE - 1) / VERIFY_BLOCK_SIZE;
+	sc->crcs = calloc(sc->num_blocks ? sc->num_blocks : 1,
+			  sizeof(u_int32_t));
+	sc->valid = calloc(sc->num_blocks ? sc->num_blocks : 1, 1);
+	if (sc->crcs == NULL || sc->valid == NULL) {
+		fprintf(stderr, "%s: Can't allocate verify sidecar\n",
+			progname);
+		exit(EXIT_FAILURE);
+	}
+	return sc;
+}
+
+void
+verify_free_sidecar(void *sidecar)
+{
+	struct verify_sidecar *sc = sidecar;
+
+	if (sc == NULL)
+		return;
+	free(sc->crcs);
+	free(sc->valid);
+	free(sc);
+}
+
+/*
+ * Called from create_file()'s write loop (single threaded per file,
+ * before the sidecar is ever visible to the checker), so it can
+ * poke the sidecar directly. Creation writes are block-multiple
+ * except possibly the tail, which stays unverifiable.
+ */
+void
+verify_seed_sidecar(void *sidecar, u_int64_t offset,
+		    const char *buf, size_t len)
+{
+	struct verify_sidecar *sc = sidecar;
+	u_int64_t block = offset / VERIFY_BLOCK_SIZE;
+
+	assert((offset % VERIFY_BLOCK_SIZE) == 0);
+	while (len >= VERIFY_BLOCK_SIZE) {
+		sc->crcs[block] = verify_crc32(0, (const unsigned char *)buf,
+					       VERIFY_BLOCK_SIZE);
+		sc->valid[block] = 1;
+		block++;
+		buf += VERIFY_BLOCK_SIZE;
+		len -= VERIFY_BLOCK_SIZE;
+	}
+}
+
+static void
+verify_apply_write(struct verify_item_s *item)
+{
+	struct verify_sidecar *sc = item->sidecar;
+	u_int64_t start = item->offset;
+	u_int64_t end = item->offset + item->len;
+	u_int64_t block;
+
+	for (block = start / VERIFY_BLOCK_SIZE;
+	     block * VERIFY_BLOCK_SIZE < end && block < sc->num_blocks;
+	     block++) {
+		u_int64_t b_start = block * VERIFY_BLOCK_SIZE;
+		u_int64_t b_end = b_start + VERIFY_BLOCK_SIZE;
+
+		if (b_start >= start && b_end <= end) {
+			sc->crcs[block] =
+				verify_crc32(0,
+					     (const unsigned char *)
+					     (item->data + (b_start - start)),
+					     VERIFY_BLOCK_SIZE);
+			sc->valid[block] = 1;
+		} else {
+			/* Partially overwritten block, can't know it */
+			sc->valid[block] = 0;
+		}
+	}
+}
+
+static void
+verify_apply_read(struct verify_item_s *item)
+{
+	struct verify_sidecar *sc = item->sidecar;
+	u_int64_t start = item->offset;
+	u_int64_t end = item->offset + item->len;
+	u_int64_t block;
+
+	for (block = (start + VERIFY_BLOCK_SIZE - 1) / VERIFY_BLOCK_SIZE;
+	     (block + 1) * VERIFY_BLOCK_SIZE <= end && block < sc->num_blocks;
+	     block++) {
+		u_int64_t b_start = block * VERIFY_BLOCK_SIZE;
+		u_int32_t crc;
+
+		if (!sc->valid[block])
+			continue;
+		crc = verify_crc32(0,
+				   (const unsigned char *)
+				   (item->data + (b_start - start)),
+				   VERIFY_BLOCK_SIZE);
+		verify_blocks_checked++;
+		if (crc != sc->crcs[block]) {
+			verify_blocks_mismatched++;
+			fprintf(stderr,
+				"%s: VERIFY MISMATCH %s block %ju (offset %ju) expected crc 0x%x got 0x%x\n",
+				progname,
+				item->filename ? item->filename : "?",
+				(uintmax_t)block, (uintmax_t)b_start,
+				sc->crcs[block], crc);
+		}
+	}
+}
+
+static void
+verify_apply_invalidate(struct verify_item_s *item)
+{
+	struct verify_sidecar *sc = item->sidecar;
+	u_int64_t start = item->offset;
+	u_int64_t end = item->offset + item->len;
+	u_int64_t block;
+
+	for (block = start / VERIFY_BLOCK_SIZE;
+	     block * VERIFY_BLOCK_SIZE < end && block < sc->num_blocks;
+	     block++)
+		sc->valid[block] = 0;
+}
+
+static void *
+verify_checker_thread(void *arg __attribute__((unused)))
+{
+	struct verify_item_s *item;
+
+	pthread_mutex_lock(&verify_mutex);
+	while (1) {
+		while (verify_queue_head == NULL && !verify_shutdown)
+			pthread_cond_wait(&verify_work_cv, &verify_mutex);
+		item = verify_queue_head;
+		if (item == NULL) {
+			/* shutdown and drained */
+			break;
+		}
+		verify_queue_head = item->next;
+		if (verify_queue_head == NULL)
+			verify_queue_tail = NULL;
+		verify_queue_len--;
+		verify_busy = 1;
+		pthread_cond_broadcast(&verify_space_cv);
+		pthread_mutex_unlock(&verify_mutex);
+
+		switch (item->op) {
+		case VERIFY_ITEM_WRITE:
+			verify_apply_write(item);
+			break;
+		case VERIFY_ITEM_READ:
+			verify_apply_read(item);
+			break;
+		case VERIFY_ITEM_INVALIDATE:
+			verify_apply_invalidate(item);
+			break;
+		}
+		free(item->data);
+		free(item);
+
+		pthread_mutex_lock(&verify_mutex);
+		verify_busy = 0;
+		if (verify_queue_head == NULL)
+			/* wake up any verify_drain() waiters */
+			pthread_cond_broadcast(&verify_space_cv);
+	}
+	pthread_mutex_unlock(&verify_mutex);
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static void
+verify_enqueue(enum verify_item_op op, void *db_node,
+	       u_int64_t offset, const char *buf, size_t len)
+{
+	struct verify_item_s *item;
+	void *sc = files_db_get_sidecar(db_node);
+
+	if (sc == NULL)
+		/* quick mode readonly file, no sidecar to check against */
+		return;
+	item = malloc(sizeof(struct verify_item_s));
+	if (item == NULL) {
+		fprintf(stderr, "%s: Can't allocate verify item\n",
+			progname);
+		exit(EXIT_FAILURE);
+	}
+	item->op = op;
+	item->sidecar = sc;
+	item->filename = files_db_get_filename(db_node);
+	item->offset = offset;
+	item->len = len;
+	item->next = NULL;
+	if (buf != NULL) {
+		item->data = malloc(len);
+		if (item->data == NULL) {
+			fprintf(stderr, "%s: Can't allocate verify item\n",
+				progname);
+			exit(EXIT_FAILURE);
+		}
+		memcpy(item->data, buf, len);
+	} else {
+		item->data = NULL;
+	}
+	pthread_mutex_lock(&verify_mutex);
+	while (verify_queue_len >= VERIFY_MAX_QUEUED) {
+		verify_queue_stalls++;
+		pthread_cond_wait(&verify_space_cv, &verify_mutex);
+	}
+	if (verify_queue_tail != NULL)
+		verify_queue_tail->next = item;
+	else
+		verify_queue_head = item;
+	verify_queue_tail = item;
+	verify_queue_len++;
+	pthread_cond_signal(&verify_work_cv);
+	pthread_mutex_unlock(&verify_mutex);
+}
+
+void
+verify_queue_write(void *db_node, u_int64_t offset,
+		   const char *buf, size_t len)
+{
+	verify_enqueue(VERIFY_ITEM_WRITE, db_node, offset, buf, len);
+}
+
+void
+verify_queue_read(void *db_node, u_int64_t offset,
+		  const char *buf, size_t len)
+{
+	verify_enqueue(VERIFY_ITEM_READ, db_node, offset, buf, len);
+}
+
+void
+verify_queue_invalidate(void *db_node, u_int64_t offset, u_int64_t len)
+{
+	verify_enqueue(VERIFY_ITEM_INVALIDATE, db_node, offset, NULL, len);
+}
+
+void
+verify_start(void)
+{
+	if (pthread_create(&verify_tid, NULL, verify_checker_thread, NULL)) {
+		fprintf(stderr, "%s: Can't create verify checker thread\n",
+			progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Wait for the checker to catch up. Must be called before the
+ * files (and their sidecars) for a pass are torn down, since
+ * queued items point into them.
+ */
+void
+verify_drain(void)
+{
+	pthread_mutex_lock(&verify_mutex);
+	while (verify_queue_head != NULL || verify_busy)
+		pthread_cond_wait(&verify_space_cv, &verify_mutex);
+	pthread_mutex_unlock(&verify_mutex);
+}
+
+void
+verify_stop(void)
+{
+	pthread_mutex_lock(&verify_mutex);
+	verify_shutdown = 1;
+	pthread_cond_broadcast(&verify_work_cv);
+	pthread_mutex_unlock(&verify_mutex);
+	pthread_join(verify_tid, NULL);
+}
+
+/* Returns the number of mismatched blocks, so main() can fail the run */
+u_int64_t
+verify_report(int summary)
+{
+	if (summary)
+		printf("%ju %ju ",
+		       (uintmax_t)verify_blocks_checked,
+		       (uintmax_t)verify_blocks_mismatched);
+	else
+		printf("Verify: blocks checked = %ju, mismatched = %ju, queue stalls = %ju\n",
+		       (uintmax_t)verify_blocks_checked,
+		       (uintmax_t)verify_blocks_mismatched,
+		       (uintmax_t)verify_queue_stalls);
+	return verify_blocks_mismatched;
+}
@@ -0,0 +1,683 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Native binary capture for ioshark.
+ *
+ * LD_PRELOAD this library into the app to trace and it records the
+ * file IO directly as struct ioshark_file_operation records
+ * (ioshark.h), producing a workload file that ioshark_bench can
+ * replay as is -- no strace, no text parsing, no compile_ioshark
+ * pass. Each thread buffers records locally and dumps full buffers
+ * with one O_APPEND write, so the only contention is in the open()
+ * path where the fd -> fileno table is updated.
+ *
+ * Usage:
+ *   LD_PRELOAD=libioshark_capture.so \
+ *   IOSHARK_CAPTURE_FILE=/data/local/tmp/app.wl <app>
+ *
+ * IOSHARK_CAPTURE_PREFIX, if set, limits capture to paths under that
+ * prefix (e.g. /data). /proc, /sys and /dev are never captured.
+ *
+ * The op stream goes to an unlinked spill file during the run; the
+ * destructor prepends the ioshark_header and the file state table
+ * (sizes come from the largest offset seen per file) to build the
+ * final workload file. Every traced process writes its own
+ * <capture_file>.<pid>, pass the lot to ioshark_bench (1 workload
+ * file per process, same as 1 per app with the strace flow). A
+ * .filenames text sidecar maps fileno back to the original paths for
+ * post-mortem use; global_filename_ix is always 0 since replay only
+ * consults it in quick mode. Children that fork without exec'ing
+ * share the parent's capture state and are folded into its stream.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include "ioshark.h"
+
+#define MAX_CAPTURE_FDS		8192
+#define MAX_CAPTURE_FILES	8192
+/* 256 * sizeof(struct ioshark_file_operation), flushed in 1 write */
+#define THREAD_BUF_OPS		256
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_pread64)(int, void *, size_t, off64_t);
+static ssize_t (*real_pwrite64)(int, const void *, size_t, off64_t);
+static off_t (*real_lseek)(int, off_t, int);
+static off64_t (*real_lseek64)(int, off64_t, int);
+static int (*real_fsync)(int);
+static int (*real_fdatasync)(int);
+static int (*real_close)(int);
+static int (*real_dup)(int);
+static int (*real_dup2)(int, int);
+static int (*real_dup3)(int, int, int);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+
+/* fd -> fileno map. fileno == 0 means fd is not captured */
+struct capture_fd_s {
+	int fileno;
+	off_t offset;		/* implicit offset for read/write sizing */
+};
+
+struct capture_file_s {
+	char path[MAX_IOSHARK_PATHLEN];
+	size_t size;		/* largest offset + len seen */
+	int open_count;		/* fds (incl. dups) mapping to the file */
+};
+
+static struct capture_fd_s capture_fds[MAX_CAPTURE_FDS];
+static struct capture_file_s capture_files[MAX_CAPTURE_FILES];
+static int num_capture_files;
+static u_int64_t num_capture_ops;
+
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int spill_fd = -1;
+static char capture_file[MAX_IOSHARK_PATHLEN];
+static const char *capture_prefix;
+static int capture_done;
+
+/* Per-thread record buffer, registered so the destructor can flush */
+struct thread_buf_s {
+	struct ioshark_file_operation ops[THREAD_BUF_OPS];
+	int num_ops;
+	u_int64_t last_op_ns;
+	struct thread_buf_s *next;
+};
+
+static pthread_key_t thread_buf_key;
+static struct thread_buf_s *thread_buf_list;
+
+static u_int64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+flush_thread_buf(struct thread_buf_s *buf)
+{
+	if (buf->num_ops == 0)
+		return;
+	/*
+	 * Single O_APPEND write, atomic on regular files, so flushes
+	 * from different threads never need a lock or interleave.
+	 */
+	if (real_write(spill_fd, buf->ops,
+		       buf->num_ops * sizeof(struct ioshark_file_operation)) < 0)
+		fprintf(stderr, "ioshark_capture: spill write failed\n");
+	__sync_fetch_and_add(&num_capture_ops, buf->num_ops);
+	buf->num_ops = 0;
+}
+
+static void
+thread_buf_destructor(void *arg)
+{
+	flush_thread_buf((struct thread_buf_s *)arg);
+}
+
+static struct thread_buf_s *
+get_thread_buf(void)
+{
+	struct thread_buf_s *buf;
+
+	buf = pthread_getspecific(thread_buf_key);
+	if (buf == NULL) {
+		buf = calloc(1, sizeof(struct thread_buf_s));
+		if (buf == NULL)
+			return NULL;
+		pthread_setspecific(thread_buf_key, buf);
+		pthread_mutex_lock(&capture_mutex);
+		buf->next = thread_buf_list;
+		thread_buf_list = buf;
+		pthread_mutex_unlock(&capture_mutex);
+	}
+	return buf;
+}
+
+/* Reserve the next record in the thread's buffer and stamp delta_us */
+static struct ioshark_file_operation *
+new_op(enum file_op op, int fileno)
+{
+	struct thread_buf_s *buf;
+	struct ioshark_file_operation *fop;
+	u_int64_t now;
+
+	if (capture_done)
+		return NULL;
+	buf = get_thread_buf();
+	if (buf == NULL)
+		return NULL;
+	if (buf->num_ops == THREAD_BUF_OPS)
+		flush_thread_buf(buf);
+	now = now_ns();
+	fop = &buf->ops[buf->num_ops++];
+	memset(fop, 0, sizeof(*fop));
+	fop->delta_us = buf->last_op_ns ?
+		(now - buf->last_op_ns) / 1000 : 0;
+	buf->last_op_ns = now;
+	fop->file_op = op;
+	fop->fileno = fileno;
+	return fop;
+}
+
+static int
+captured_path(const char *path)
+{
+	if (strncmp(path, "/proc/", 6) == 0 ||
+	    strncmp(path, "/sys/", 5) == 0 ||
+	    strncmp(path, "/dev/", 5) == 0)
+		return 0;
+	if (capture_prefix &&
+	    strncmp(path, capture_prefix, strlen(capture_prefix)) != 0)
+		return 0;
+	return 1;
+}
+
+/*
+ * fileno for path, assigning the next one on first sight. Opens are
+ * the cold path, this is the only place capture takes the mutex.
+ */
+static int
+path_to_fileno(const char *path)
+{
+	int i;
+
+	if (strlen(path) >= MAX_IOSHARK_PATHLEN)
+		return 0;
+	pthread_mutex_lock(&capture_mutex);
+	for (i = 0; i < num_capture_files; i++) {
+		if (strcmp(capture_files[i].path, path) == 0) {
+			pthread_mutex_unlock(&capture_mutex);
+			return i + 1;
+		}
+	}
+	if (num_capture_files == MAX_CAPTURE_FILES) {
+		pthread_mutex_unlock(&capture_mutex);
+		return 0;
+	}
+	strcpy(capture_files[num_capture_files++].path, path);
+	i = num_capture_files;
+	pthread_mutex_unlock(&capture_mutex);
+	return i;
+}
+
+static void
+update_file_size(int fileno, off_t offset, size_t len)
+{
+	struct capture_file_s *file = &capture_files[fileno - 1];
+	size_t end = offset + len;
+
+	/* Racy max is fine, capture sizes only have to cover the IOs */
+	if (file->size < end)
+		file->size = end;
+}
+
+static void
+track_open(const char *path, int fd, int flags, mode_t mode)
+{
+	int fileno;
+	struct ioshark_file_operation *fop;
+	struct stat st;
+
+	if (fd < 0 || fd >= MAX_CAPTURE_FDS || capture_done)
+		return;
+	if (!captured_path(path))
+		return;
+	fileno = path_to_fileno(path);
+	if (fileno == 0)
+		return;
+	capture_fds[fd].fileno = fileno;
+	capture_fds[fd].offset = 0;
+	__sync_fetch_and_add(&capture_files[fileno - 1].open_count, 1);
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		update_file_size(fileno, st.st_size, 0);
+	fop = new_op(IOSHARK_OPEN, fileno);
+	if (fop) {
+		fop->open_flags = flags;
+		fop->open_mode = mode;
+	}
+}
+
+static inline int
+fd_fileno(int fd)
+{
+	if (fd < 0 || fd >= MAX_CAPTURE_FDS || capture_done)
+		return 0;
+	return capture_fds[fd].fileno;
+}
+
+/*
+ * dup'ed fds keep the fileno of the original so IO through them is
+ * still attributed (dd for instance dup2's the output file over
+ * stdout and closes the original fd). CLOSE is only recorded when
+ * the last fd for the file goes away.
+ */
+static void
+track_dup(int oldfd, int newfd)
+{
+	int fileno = fd_fileno(oldfd);
+
+	if (fileno == 0 || newfd < 0 || newfd >= MAX_CAPTURE_FDS)
+		return;
+	capture_fds[newfd].fileno = fileno;
+	capture_fds[newfd].offset = capture_fds[oldfd].offset;
+	__sync_fetch_and_add(&capture_files[fileno - 1].open_count, 1);
+}
+
+static void
+track_close(int fd)
+{
+	int fileno = fd_fileno(fd);
+
+	if (fileno == 0)
+		return;
+	capture_fds[fd].fileno = 0;
+	if (__sync_sub_and_fetch(&capture_files[fileno - 1].open_count, 1) == 0)
+		(void)new_op(IOSHARK_CLOSE, fileno);
+}
+
+/* ---------------- interposed entry points ---------------- */
+
+int
+open(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+	int fd;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	fd = real_open(path, flags, mode);
+	if (fd >= 0)
+		track_open(path, fd, flags, mode);
+	return fd;
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+	int fd;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	fd = real_open(path, flags | O_LARGEFILE, mode);
+	if (fd >= 0)
+		track_open(path, fd, flags, mode);
+	return fd;
+}
+
+int
+openat(int dirfd, const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode = 0;
+	int fd;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	fd = real_openat(dirfd, path, flags, mode);
+	/*
+	 * Relative opens against a dirfd can't be mapped back to a
+	 * path without hitting /proc on the hot path, skip those.
+	 */
+	if (fd >= 0 && (dirfd == AT_FDCWD || path[0] == '/'))
+		track_open(path, fd, flags, mode);
+	return fd;
+}
+
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+	ssize_t ret = real_read(fd, buf, count);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret > 0) {
+		struct ioshark_file_operation *fop =
+			new_op(IOSHARK_READ, fileno);
+
+		if (fop)
+			fop->rw_len = ret;
+		capture_fds[fd].offset += ret;
+		update_file_size(fileno, capture_fds[fd].offset, 0);
+	}
+	return ret;
+}
+
+ssize_t
+write(int fd, const void *buf, size_t count)
+{
+	ssize_t ret = real_write(fd, buf, count);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret > 0) {
+		struct ioshark_file_operation *fop =
+			new_op(IOSHARK_WRITE, fileno);
+
+		if (fop)
+			fop->rw_len = ret;
+		capture_fds[fd].offset += ret;
+		update_file_size(fileno, capture_fds[fd].offset, 0);
+	}
+	return ret;
+}
+
+ssize_t
+pread64(int fd, void *buf, size_t count, off64_t offset)
+{
+	ssize_t ret = real_pread64(fd, buf, count, offset);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret > 0) {
+		struct ioshark_file_operation *fop =
+			new_op(IOSHARK_PREAD64, fileno);
+
+		if (fop) {
+			fop->prw_offset = offset;
+			fop->prw_len = ret;
+		}
+		update_file_size(fileno, offset, ret);
+	}
+	return ret;
+}
+
+ssize_t
+pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+	ssize_t ret = real_pwrite64(fd, buf, count, offset);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret > 0) {
+		struct ioshark_file_operation *fop =
+			new_op(IOSHARK_PWRITE64, fileno);
+
+		if (fop) {
+			fop->prw_offset = offset;
+			fop->prw_len = ret;
+		}
+		update_file_size(fileno, offset, ret);
+	}
+	return ret;
+}
+
+/* pread/pwrite record through the 64-bit entry points */
+ssize_t
+pread(int fd, void *buf, size_t count, off_t offset)
+{
+	return pread64(fd, buf, count, offset);
+}
+
+ssize_t
+pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	return pwrite64(fd, buf, count, offset);
+}
+
+off_t
+lseek(int fd, off_t offset, int whence)
+{
+	off_t ret = real_lseek(fd, offset, whence);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret >= 0) {
+		struct ioshark_file_operation *fop =
+			new_op(IOSHARK_LSEEK, fileno);
+
+		if (fop) {
+			fop->lseek_offset = offset;
+			fop->lseek_action = whence;
+		}
+		capture_fds[fd].offset = ret;
+	}
+	return ret;
+}
+
+off64_t
+lseek64(int fd, off64_t offset, int whence)
+{
+	off64_t ret = real_lseek64(fd, offset, whence);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret >= 0) {
+		struct ioshark_file_operation *fop =
+			new_op(IOSHARK_LLSEEK, fileno);
+
+		if (fop) {
+			fop->lseek_offset = offset;
+			fop->lseek_action = whence;
+		}
+		capture_fds[fd].offset = ret;
+	}
+	return ret;
+}
+
+int
+fsync(int fd)
+{
+	int ret = real_fsync(fd);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret == 0)
+		(void)new_op(IOSHARK_FSYNC, fileno);
+	return ret;
+}
+
+int
+fdatasync(int fd)
+{
+	int ret = real_fdatasync(fd);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret == 0)
+		(void)new_op(IOSHARK_FDATASYNC, fileno);
+	return ret;
+}
+
+int
+close(int fd)
+{
+	track_close(fd);
+	return real_close(fd);
+}
+
+int
+dup(int oldfd)
+{
+	int ret = real_dup(oldfd);
+
+	if (ret >= 0)
+		track_dup(oldfd, ret);
+	return ret;
+}
+
+int
+dup2(int oldfd, int newfd)
+{
+	int ret = real_dup2(oldfd, newfd);
+
+	if (ret >= 0 && oldfd != newfd) {
+		track_close(newfd);
+		track_dup(oldfd, newfd);
+	}
+	return ret;
+}
+
+int
+dup3(int oldfd, int newfd, int flags)
+{
+	int ret = real_dup3(oldfd, newfd, flags);
+
+	if (ret >= 0) {
+		track_close(newfd);
+		track_dup(oldfd, newfd);
+	}
+	return ret;
+}
+
+void *
+mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	void *ret = real_mmap(addr, length, prot, flags, fd, offset);
+	int fileno = fd_fileno(fd);
+
+	if (fileno && ret != MAP_FAILED) {
+		struct ioshark_file_operation *fop =
+			new_op(IOSHARK_MMAP, fileno);
+
+		if (fop) {
+			fop->mmap_offset = offset;
+			fop->mmap_len = length;
+			fop->mmap_prot =
+				((prot & PROT_READ) ? IOSHARK_PROT_READ : 0) |
+				((prot & PROT_WRITE) ? IOSHARK_PROT_WRITE : 0);
+		}
+		update_file_size(fileno, offset, length);
+	}
+	return ret;
+}
+
+/* ---------------- setup and teardown ---------------- */
+
+static void __attribute__((constructor))
+ioshark_capture_init(void)
+{
+	const char *out;
+	char spill_path[MAX_IOSHARK_PATHLEN + 16];
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_pread64 = dlsym(RTLD_NEXT, "pread64");
+	real_pwrite64 = dlsym(RTLD_NEXT, "pwrite64");
+	real_lseek = dlsym(RTLD_NEXT, "lseek");
+	real_lseek64 = dlsym(RTLD_NEXT, "lseek64");
+	real_fsync = dlsym(RTLD_NEXT, "fsync");
+	real_fdatasync = dlsym(RTLD_NEXT, "fdatasync");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_dup = dlsym(RTLD_NEXT, "dup");
+	real_dup2 = dlsym(RTLD_NEXT, "dup2");
+	real_dup3 = dlsym(RTLD_NEXT, "dup3");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+
+	pthread_key_create(&thread_buf_key, thread_buf_destructor);
+
+	out = getenv("IOSHARK_CAPTURE_FILE");
+	if (out == NULL)
+		out = "ioshark.capture.wl";
+	if (strlen(out) + 16 >= MAX_IOSHARK_PATHLEN) {
+		fprintf(stderr, "ioshark_capture: capture file path too long\n");
+		capture_done = 1;
+		return;
+	}
+	sprintf(capture_file, "%s.%d", out, getpid());
+	capture_prefix = getenv("IOSHARK_CAPTURE_PREFIX");
+
+	/* Unlinked spill file for the raw op stream */
+	sprintf(spill_path, "%s.spill", capture_file);
+	spill_fd = real_open(spill_path, O_RDWR | O_CREAT | O_APPEND | O_TRUNC,
+			     0600);
+	if (spill_fd < 0) {
+		fprintf(stderr, "ioshark_capture: Can't create %s\n",
+			spill_path);
+		capture_done = 1;
+		return;
+	}
+	unlink(spill_path);
+}
+
+static void __attribute__((destructor))
+ioshark_capture_fini(void)
+{
+	struct ioshark_header header;
+	struct ioshark_file_state state;
+	struct thread_buf_s *buf;
+	char buffer[65536];
+	char filenames_path[MAX_IOSHARK_PATHLEN + 16];
+	FILE *out, *filenames;
+	off_t off;
+	ssize_t nr;
+	int i;
+
+	if (spill_fd < 0)
+		return;
+	capture_done = 1;
+	for (buf = thread_buf_list; buf != NULL; buf = buf->next)
+		flush_thread_buf(buf);
+
+	out = fopen(capture_file, "w");
+	if (out == NULL) {
+		fprintf(stderr, "ioshark_capture: Can't create %s\n",
+			capture_file);
+		return;
+	}
+	header.num_files = num_capture_files;
+	header.num_io_operations = num_capture_ops;
+	fwrite(&header, sizeof(header), 1, out);
+	for (i = 0; i < num_capture_files; i++) {
+		state.fileno = i + 1;
+		state.size = capture_files[i].size;
+		state.global_filename_ix = 0;
+		fwrite(&state, sizeof(state), 1, out);
+	}
+	off = 0;
+	while ((nr = real_pread64(spill_fd, buffer, sizeof(buffer), off)) > 0) {
+		fwrite(buffer, 1, nr, out);
+		off += nr;
+	}
+	fclose(out);
+	real_close(spill_fd);
+	spill_fd = -1;
+
+	/* fileno -> path sidecar */
+	sprintf(filenames_path, "%s.filenames", capture_file);
+	filenames = fopen(filenames_path, "w");
+	if (filenames) {
+		for (i = 0; i < num_capture_files; i++)
+			fprintf(filenames, "%d %s\n", i + 1,
+				capture_files[i].path);
+		fclose(filenames);
+	}
+}
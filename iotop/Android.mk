@@ -17,7 +17,7 @@ include $(CLEAR_VARS)
 
 LOCAL_CLANG := true
 
-LOCAL_SRC_FILES := iotop.cpp tasklist.cpp taskstats.cpp
+LOCAL_SRC_FILES := cgrouplist.cpp iotop.cpp tasklist.cpp taskstats.cpp
 
 LOCAL_MODULE := iotop
 
@@ -0,0 +1,83 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "cgrouplist.h"
+
+// Read the member tasks of one cgroup directory. cgroup v1
+// hierarchies list every thread in "tasks", the v2 unified hierarchy
+// calls it "cgroup.threads" (falling back to the processes in
+// "cgroup.procs" on kernels without it).
+static bool ReadGroupTasks(const std::string& dir, const std::string& group,
+                           std::unordered_map<pid_t, std::string>& pid_map) {
+  static const char* const kTaskFiles[] = {
+      "tasks", "cgroup.threads", "cgroup.procs"};
+
+  for (const char* task_file : kTaskFiles) {
+    std::unique_ptr<FILE, decltype(&fclose)> fp(
+        fopen((dir + "/" + task_file).c_str(), "re"), fclose);
+    if (!fp) {
+      continue;
+    }
+    pid_t pid;
+    while (fscanf(fp.get(), "%d", &pid) == 1) {
+      pid_map[pid] = group;
+    }
+    return true;
+  }
+  return false;
+}
+
+void CgroupList::ScanGroup(const std::string& root, const std::string& group,
+                           std::unordered_map<pid_t, std::string>& pid_map) {
+  std::string dir = group.empty() ? root : root + "/" + group;
+
+  ReadGroupTasks(dir, group, pid_map);
+
+  std::unique_ptr<DIR, decltype(&closedir)> d(opendir(dir.c_str()), closedir);
+  if (!d) {
+    return;
+  }
+
+  dirent* entry;
+  while ((entry = readdir(d.get())) != nullptr) {
+    if (entry->d_type != DT_DIR || entry->d_name[0] == '.') {
+      continue;
+    }
+    std::string child =
+        group.empty() ? entry->d_name : group + "/" + entry->d_name;
+    ScanGroup(root, child, pid_map);
+  }
+}
+
+bool CgroupList::Scan(const std::string& root,
+                      std::unordered_map<pid_t, std::string>& pid_map) {
+  pid_map.clear();
+
+  std::unique_ptr<DIR, decltype(&closedir)> d(opendir(root.c_str()), closedir);
+  if (!d) {
+    return false;
+  }
+  d.reset();
+
+  ScanGroup(root, "", pid_map);
+  return true;
+}
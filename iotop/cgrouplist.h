@@ -0,0 +1,37 @@
+// Copyright (C) 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+#ifndef _IOTOP_CGROUPLIST_H
+#define _IOTOP_CGROUPLIST_H
+
+class CgroupList {
+public:
+  // Walk the cgroup hierarchy under root and fill in a map from each
+  // member task to its cgroup path relative to root ("" for the root
+  // group itself).
+  static bool Scan(const std::string& root,
+                   std::unordered_map<pid_t, std::string>& pid_map);
+
+private:
+  CgroupList() {}
+  static void ScanGroup(const std::string& root, const std::string& group,
+                        std::unordered_map<pid_t, std::string>& pid_map);
+};
+
+#endif // _IOTOP_CGROUPLIST_H
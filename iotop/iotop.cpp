@@ -24,6 +24,7 @@
 
 #include <android-base/logging.h>
 
+#include "cgrouplist.h"
 #include "tasklist.h"
 #include "taskstats.h"
 
@@ -40,9 +41,13 @@ static float TimeToTgidPercent(uint64_t ns, int time, const TaskStatistics& stat
 
 static void usage(char* myname) {
   printf(
-      "Usage: %s [-h] [-P] [-d <delay>] [-n <cycles>] [-s <column>]\n"
+      "Usage: %s [-h] [-P] [-g [<root>]] [-d <delay>] [-n <cycles>] [-s <column>]\n"
       "   -a  Show byte count instead of rate\n"
       "   -d  Set the delay between refreshes in seconds.\n"
+      "   -g  Aggregate by cgroup (with hierarchical rollup) instead of\n"
+      "       by task, walking the hierarchy under /sys/fs/cgroup or the\n"
+      "       root given with -G.\n"
+      "   -G  Set the cgroup hierarchy root to walk for -g.\n"
       "   -h  Display this help screen.\n"
       "   -m  Set the number of processes or threads to show\n"
       "   -n  Set the number of refreshes before exiting.\n"
@@ -100,6 +105,8 @@ static Sorter GetSorter(const std::string& field) {
 int main(int argc, char* argv[]) {
   bool accumulated = false;
   bool processes = false;
+  bool cgroups = false;
+  std::string cgroup_root = "/sys/fs/cgroup";
   int delay = 1;
   int cycles = -1;
   int limit = -1;
@@ -112,6 +119,8 @@ int main(int argc, char* argv[]) {
     static const option longopts[] = {
         {"accumulated", 0, 0, 'a'},
         {"delay", required_argument, 0, 'd'},
+        {"cgroups", 0, 0, 'g'},
+        {"cgroup-root", required_argument, 0, 'G'},
         {"help", 0, 0, 'h'},
         {"limit", required_argument, 0, 'm'},
         {"iter", required_argument, 0, 'n'},
@@ -119,7 +128,7 @@ int main(int argc, char* argv[]) {
         {"processes", 0, 0, 'P'},
         {0, 0, 0, 0},
     };
-    c = getopt_long(argc, argv, "ad:hm:n:Ps:", longopts, NULL);
+    c = getopt_long(argc, argv, "ad:gG:hm:n:Ps:", longopts, NULL);
     if (c < 0) {
       break;
     }
@@ -130,6 +139,12 @@ int main(int argc, char* argv[]) {
     case 'd':
       delay = atoi(optarg);
       break;
+    case 'g':
+      cgroups = true;
+      break;
+    case 'G':
+      cgroup_root = optarg;
+      break;
     case 'h':
       usage(argv[0]);
       return(EXIT_SUCCESS);
@@ -159,6 +174,12 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (cgroups && processes) {
+    LOG(ERROR) << "-g and -P are mutually exclusive";
+    usage(argv[0]);
+    return(EXIT_FAILURE);
+  }
+
   std::map<pid_t, std::vector<pid_t>> tgid_map;
 
   TaskstatsSocket taskstats_socket;
@@ -166,44 +187,118 @@ int main(int argc, char* argv[]) {
 
   std::unordered_map<pid_t, TaskStatistics> pid_stats;
   std::unordered_map<pid_t, TaskStatistics> tgid_stats;
+  std::unordered_map<pid_t, TaskStatistics> pid_stats_new;
+  std::unordered_map<pid_t, TaskStatistics> tgid_stats_new;
+  std::vector<pid_t> pids;
+  std::vector<pid_t> tgids;
   std::vector<TaskStatistics> stats;
+  std::unordered_map<pid_t, std::string> cgroup_map;
+  std::map<std::string, TaskStatistics> cgroup_stats;
+  uint64_t generation = 0;
+
+  // Fold a task's delta into its cgroup and, rolling up the
+  // hierarchy, every ancestor group including the root ("").
+  auto add_to_cgroup = [&cgroup_stats](const std::string& group,
+                                       const TaskStatistics& delta) {
+    std::string name = group;
+    while (true) {
+      auto it = cgroup_stats.find(name);
+      if (it == cgroup_stats.end()) {
+        TaskStatistics group_stats = delta;
+        group_stats.set_pid(0);
+        group_stats.set_comm(name.empty() ? "/" : name);
+        cgroup_stats.emplace(name, group_stats);
+      } else {
+        it->second += delta;
+      }
+      if (name.empty()) {
+        break;
+      }
+      std::string::size_type slash = name.rfind('/');
+      name = (slash == std::string::npos) ? "" : name.substr(0, slash);
+    }
+  };
 
   bool first = true;
   bool second = true;
 
   while (true) {
     stats.clear();
+    generation++;
     if (!TaskList::Scan(tgid_map)) {
       LOG(FATAL) << "failed to scan tasks";
     }
+    if (cgroups) {
+      cgroup_stats.clear();
+      if (!CgroupList::Scan(cgroup_root, cgroup_map)) {
+        LOG(FATAL) << "failed to scan cgroups under " << cgroup_root;
+      }
+    }
+
+    // Batch the queries for all pids (and tgids if printing
+    // processes) into pipelined sweeps over the netlink socket,
+    // rather than a kernel round-trip per task.
+    pids.clear();
+    tgids.clear();
+    for (auto& tgid_it : tgid_map) {
+      if (processes) {
+        tgids.push_back(tgid_it.first);
+      }
+      for (pid_t pid : tgid_it.second) {
+        pids.push_back(pid);
+      }
+    }
+    if (processes) {
+      // If printing processes, collect stats for the tgid which will
+      // hold delay accounting data across all threads, including
+      // ones that have exited.
+      tgid_stats_new.clear();
+      if (!taskstats_socket.GetTgidStatsBatched(tgids, tgid_stats_new)) {
+        LOG(FATAL) << "failed to fetch tgid stats";
+      }
+    }
+    pid_stats_new.clear();
+    if (!taskstats_socket.GetPidStatsBatched(pids, pid_stats_new)) {
+      LOG(FATAL) << "failed to fetch pid stats";
+    }
+
     for (auto& tgid_it : tgid_map) {
       pid_t tgid = tgid_it.first;
       std::vector<pid_t>& pid_list = tgid_it.second;
 
-      TaskStatistics tgid_stats_new;
       TaskStatistics tgid_stats_delta;
 
       if (processes) {
-        // If printing processes, collect stats for the tgid which will
-        // hold delay accounting data across all threads, including
-        // ones that have exited.
-        if (!taskstats_socket.GetTgidStats(tgid, tgid_stats_new)) {
+        auto it = tgid_stats_new.find(tgid);
+        if (it == tgid_stats_new.end()) {
           continue;
         }
-        tgid_stats_delta = tgid_stats[tgid].Update(tgid_stats_new);
+        tgid_stats_delta = tgid_stats[tgid].Update(it->second);
+        tgid_stats[tgid].set_generation(generation);
       }
 
       // Collect per-thread stats
       for (pid_t pid : pid_list) {
-        TaskStatistics pid_stats_new;
-        if (!taskstats_socket.GetPidStats(pid, pid_stats_new)) {
+        auto it = pid_stats_new.find(pid);
+        if (it == pid_stats_new.end()) {
           continue;
         }
 
-        TaskStatistics pid_stats_delta = pid_stats[pid].Update(pid_stats_new);
+        TaskStatistics pid_stats_delta = pid_stats[pid].Update(it->second);
+        pid_stats[pid].set_generation(generation);
 
         if (processes) {
           tgid_stats_delta.AddPidToTgid(pid_stats_delta);
+        } else if (cgroups) {
+          // Threads missing from the walked hierarchy (e.g. they
+          // started since the walk) are charged to the root group.
+          auto group_it = cgroup_map.find(pid);
+          if (group_it == cgroup_map.end()) {
+            group_it = cgroup_map.find(tgid);
+          }
+          add_to_cgroup(group_it == cgroup_map.end() ? std::string()
+                                                     : group_it->second,
+                        pid_stats_delta);
         } else {
           stats.push_back(pid_stats_delta);
         }
@@ -214,29 +309,68 @@ int main(int argc, char* argv[]) {
       }
     }
 
+    if (cgroups) {
+      for (auto& cgroup_it : cgroup_stats) {
+        stats.push_back(cgroup_it.second);
+      }
+    }
+
+    // Sweep exited tasks out of the stats maps, otherwise they
+    // accumulate forever when running continuously.
+    for (auto it = pid_stats.begin(); it != pid_stats.end();) {
+      if (it->second.generation() != generation) {
+        it = pid_stats.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (auto it = tgid_stats.begin(); it != tgid_stats.end();) {
+      if (it->second.generation() != generation) {
+        it = tgid_stats.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
     if (!first) {
       sorter(stats);
       if (!second) {
         printf("\n");
       }
-      if (accumulated) {
-        printf("%6s %-16s %20s %34s\n", "", "",
-            "---- IO (KiB) ----", "----------- delayed on ----------");
+      if (cgroups) {
+        printf("%-40s %20s %34s\n", "",
+            accumulated ? "---- IO (KiB) ----" : "--- IO (KiB/s) ---",
+            "----------- delayed on ----------");
+        printf("%-40s %6s %6s %6s  %-5s  %-5s  %-5s  %-5s  %-5s\n",
+            "Cgroup",
+            "read",
+            "write",
+            "total",
+            "IO",
+            "swap",
+            "sched",
+            "mem",
+            "total");
       } else {
-        printf("%6s %-16s %20s %34s\n", "", "",
-            "--- IO (KiB/s) ---", "----------- delayed on ----------");
+        if (accumulated) {
+          printf("%6s %-16s %20s %34s\n", "", "",
+              "---- IO (KiB) ----", "----------- delayed on ----------");
+        } else {
+          printf("%6s %-16s %20s %34s\n", "", "",
+              "--- IO (KiB/s) ---", "----------- delayed on ----------");
+        }
+        printf("%6s %-16s %6s %6s %6s  %-5s  %-5s  %-5s  %-5s  %-5s\n",
+            "PID",
+            "Command",
+            "read",
+            "write",
+            "total",
+            "IO",
+            "swap",
+            "sched",
+            "mem",
+            "total");
       }
-      printf("%6s %-16s %6s %6s %6s  %-5s  %-5s  %-5s  %-5s  %-5s\n",
-          "PID",
-          "Command",
-          "read",
-          "write",
-          "total",
-          "IO",
-          "swap",
-          "sched",
-          "mem",
-          "total");
       int n = limit;
       const int delay_div = accumulated ? 1 : delay;
       uint64_t total_read = 0;
@@ -253,22 +387,39 @@ int main(int argc, char* argv[]) {
           n--;
         }
 
-        printf("%6d %-16s %6" PRIu64 " %6" PRIu64 " %6" PRIu64 " %5.2f%% %5.2f%% %5.2f%% %5.2f%% %5.2f%%\n",
-            statistics.pid(),
-            statistics.comm().c_str(),
-            BytesToKB(statistics.read()) / delay_div,
-            BytesToKB(statistics.write()) / delay_div,
-            BytesToKB(statistics.read_write()) / delay_div,
-            TimeToTgidPercent(statistics.delay_io(), delay, statistics),
-            TimeToTgidPercent(statistics.delay_swap(), delay, statistics),
-            TimeToTgidPercent(statistics.delay_sched(), delay, statistics),
-            TimeToTgidPercent(statistics.delay_mem(), delay, statistics),
-            TimeToTgidPercent(statistics.delay_total(), delay, statistics));
+        if (cgroups) {
+          printf("%-40s %6" PRIu64 " %6" PRIu64 " %6" PRIu64 " %5.2f%% %5.2f%% %5.2f%% %5.2f%% %5.2f%%\n",
+              statistics.comm().c_str(),
+              BytesToKB(statistics.read()) / delay_div,
+              BytesToKB(statistics.write()) / delay_div,
+              BytesToKB(statistics.read_write()) / delay_div,
+              TimeToTgidPercent(statistics.delay_io(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_swap(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_sched(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_mem(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_total(), delay, statistics));
+        } else {
+          printf("%6d %-16s %6" PRIu64 " %6" PRIu64 " %6" PRIu64 " %5.2f%% %5.2f%% %5.2f%% %5.2f%% %5.2f%%\n",
+              statistics.pid(),
+              statistics.comm().c_str(),
+              BytesToKB(statistics.read()) / delay_div,
+              BytesToKB(statistics.write()) / delay_div,
+              BytesToKB(statistics.read_write()) / delay_div,
+              TimeToTgidPercent(statistics.delay_io(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_swap(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_sched(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_mem(), delay, statistics),
+              TimeToTgidPercent(statistics.delay_total(), delay, statistics));
+        }
+      }
+      if (!cgroups) {
+        // With cgroups every ancestor group already contains its
+        // children, the root ("/") line is the total.
+        printf("%6s %-16s %6" PRIu64 " %6" PRIu64 " %6" PRIu64 "\n", "", "TOTAL",
+            BytesToKB(total_read) / delay_div,
+            BytesToKB(total_write) / delay_div,
+            BytesToKB(total_read_write) / delay_div);
       }
-      printf("%6s %-16s %6" PRIu64 " %6" PRIu64 " %6" PRIu64 "\n", "", "TOTAL",
-          BytesToKB(total_read) / delay_div,
-          BytesToKB(total_write) / delay_div,
-          BytesToKB(total_read_write) / delay_div);
 
       second = false;
 
@@ -46,14 +46,29 @@ static bool ScanPidsInDir(const std::string& name, Func f) {
 }
 
 bool TaskList::Scan(std::map<pid_t, std::vector<pid_t>>& tgid_map) {
-  tgid_map.clear();
+  // Empty out the pid lists but keep the map nodes and vector
+  // allocations, the bulk of the tgids are the same every scan.
+  for (auto& tgid_it : tgid_map) {
+    tgid_it.second.clear();
+  }
 
-  return ScanPidsInDir("/proc", [&tgid_map](pid_t tgid) {
-    std::vector<pid_t> pid_list;
-    if (ScanPid(tgid, pid_list)) {
-      tgid_map.insert({tgid, pid_list});
+  bool ret = ScanPidsInDir("/proc", [&tgid_map](pid_t tgid) {
+    std::vector<pid_t>& pid_list = tgid_map[tgid];
+    if (!ScanPid(tgid, pid_list)) {
+      pid_list.clear();
     }
   });
+
+  // A tgid left with no tasks exited since the last scan, drop it
+  for (auto it = tgid_map.begin(); it != tgid_map.end();) {
+    if (it->second.empty()) {
+      it = tgid_map.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  return ret;
 }
 
 bool TaskList::ScanPid(pid_t tgid, std::vector<pid_t>& pid_list) {
@@ -17,6 +17,9 @@
 #include <netlink/genl/ctrl.h>
 #include <netlink/genl/genl.h>
 
+#include <errno.h>
+#include <string.h>
+
 #include <algorithm>
 #include <memory>
 
@@ -24,6 +27,11 @@
 
 #include "taskstats.h"
 
+// How many requests we pipeline on the socket before draining the
+// replies, bounded so a burst of replies can't overrun the receive
+// buffer.
+constexpr int kBatchedRequests = 64;
+
 TaskstatsSocket::TaskstatsSocket()
     : nl_(nullptr, nl_socket_free), family_id_(0) {
 }
@@ -45,6 +53,13 @@ bool TaskstatsSocket::Open() {
     LOG(FATAL) << nl_geterror(family_id) << std::endl << "Unable to determine taskstats family id (does your kernel support taskstats?)";
   }
 
+  // Requests are pipelined with the replies matched up by the pid
+  // inside each reply, so we don't need acks or sequence number
+  // checking, and skipping the acks halves the message traffic.
+  nl_socket_disable_auto_ack(nl.get());
+  nl_socket_disable_seq_check(nl.get());
+  nl_socket_set_buffer_size(nl.get(), 1024 * 1024, 0);
+
   nl_ = std::move(nl);
   family_id_ = family_id;
 
@@ -56,8 +71,8 @@ void TaskstatsSocket::Close() {
 }
 
 struct TaskStatsRequest {
-  pid_t requested_pid;
-  taskstats stats;
+  std::unordered_map<pid_t, TaskStatistics>* stats;
+  int outstanding;
 };
 
 static pid_t ParseAggregateTaskStats(nlattr* attr, int attr_size,
@@ -103,11 +118,12 @@ static int ParseTaskStats(nl_msg* msg, void* arg) {
       ret = ParseAggregateTaskStats(nested_attr, nla_len(attr), &stats);
       if (ret < 0) {
         LOG(ERROR) << "Bad AGGR_PID contents";
-      } else if (ret == taskstats_request->requested_pid) {
-        taskstats_request->stats = stats;
       } else {
-        LOG(WARNING) << "got taskstats for unexpected pid " << ret <<
-            " (expected " << taskstats_request->requested_pid << ", continuing...";
+        // Replies are matched up with their requests by the pid (or
+        // tgid) the kernel echoes back inside each reply.
+        TaskStatistics statistics(stats);
+        statistics.set_pid(ret);
+        (*taskstats_request->stats)[ret] = statistics;
       }
       break;
     }
@@ -117,13 +133,23 @@ static int ParseTaskStats(nl_msg* msg, void* arg) {
       LOG(ERROR) << "unexpected attribute in taskstats";
     }
   }
+  taskstats_request->outstanding--;
   return NL_OK;
 }
 
-bool TaskstatsSocket::GetStats(int pid, int type, TaskStatistics& stats) {
-  TaskStatsRequest taskstats_request = TaskStatsRequest();
-  taskstats_request.requested_pid = pid;
+static int TaskStatsError(sockaddr_nl*, nlmsgerr* error, void* arg) {
+  TaskStatsRequest* taskstats_request = static_cast<TaskStatsRequest*>(arg);
+
+  // ESRCH just means the task exited between the /proc scan and our
+  // query, anything else is unexpected.
+  if (error->error != -ESRCH) {
+    LOG(ERROR) << "taskstats query failed: " << strerror(-error->error);
+  }
+  taskstats_request->outstanding--;
+  return NL_SKIP;
+}
 
+bool TaskstatsSocket::SendStatsRequest(int pid, int type) {
   std::unique_ptr<nl_msg, decltype(&nlmsg_free)> message(nlmsg_alloc(),
                                                          nlmsg_free);
 
@@ -131,24 +157,52 @@ bool TaskstatsSocket::GetStats(int pid, int type, TaskStatistics& stats) {
               TASKSTATS_CMD_GET, TASKSTATS_VERSION);
   nla_put_u32(message.get(), type, pid);
 
-  int result = nl_send_auto_complete(nl_.get(), message.get());
-  if (result < 0) {
-    return false;
-  }
+  return nl_send_auto_complete(nl_.get(), message.get()) >= 0;
+}
+
+bool TaskstatsSocket::GetStatsBatched(int type, const std::vector<pid_t>& pids,
+    std::unordered_map<pid_t, TaskStatistics>& stats) {
+  TaskStatsRequest taskstats_request = TaskStatsRequest();
+  taskstats_request.stats = &stats;
 
   std::unique_ptr<nl_cb, decltype(&nl_cb_put)> callbacks(
       nl_cb_alloc(NL_CB_DEFAULT), nl_cb_put);
   nl_cb_set(callbacks.get(), NL_CB_VALID, NL_CB_CUSTOM, &ParseTaskStats,
             static_cast<void*>(&taskstats_request));
+  nl_cb_err(callbacks.get(), NL_CB_CUSTOM, &TaskStatsError,
+            static_cast<void*>(&taskstats_request));
 
-  result = nl_recvmsgs(nl_.get(), callbacks.get());
-  if (result < 0) {
-    return false;
+  size_t sent = 0;
+  while (sent < pids.size()) {
+    size_t batch = std::min(pids.size() - sent,
+                            static_cast<size_t>(kBatchedRequests));
+    for (size_t i = 0; i < batch; i++) {
+      if (SendStatsRequest(pids[sent + i], type)) {
+        taskstats_request.outstanding++;
+      }
+    }
+    sent += batch;
+    while (taskstats_request.outstanding > 0) {
+      if (nl_recvmsgs(nl_.get(), callbacks.get()) < 0) {
+        return false;
+      }
+    }
   }
-  nl_wait_for_ack(nl_.get());
 
-  stats = TaskStatistics(taskstats_request.stats);
+  return true;
+}
 
+bool TaskstatsSocket::GetStats(int pid, int type, TaskStatistics& stats) {
+  std::unordered_map<pid_t, TaskStatistics> stats_map;
+
+  if (!GetStatsBatched(type, {static_cast<pid_t>(pid)}, stats_map)) {
+    return false;
+  }
+  auto it = stats_map.find(pid);
+  if (it == stats_map.end()) {
+    return false;
+  }
+  stats = it->second;
   return true;
 }
 
@@ -157,11 +211,17 @@ bool TaskstatsSocket::GetPidStats(int pid, TaskStatistics& stats) {
 }
 
 bool TaskstatsSocket::GetTgidStats(int tgid, TaskStatistics& stats) {
-  bool ret = GetStats(tgid, TASKSTATS_CMD_ATTR_TGID, stats);
-  if (ret) {
-    stats.set_pid(tgid);
-  }
-  return ret;
+  return GetStats(tgid, TASKSTATS_CMD_ATTR_TGID, stats);
+}
+
+bool TaskstatsSocket::GetPidStatsBatched(const std::vector<pid_t>& pids,
+    std::unordered_map<pid_t, TaskStatistics>& stats) {
+  return GetStatsBatched(TASKSTATS_CMD_ATTR_PID, pids, stats);
+}
+
+bool TaskstatsSocket::GetTgidStatsBatched(const std::vector<pid_t>& tgids,
+    std::unordered_map<pid_t, TaskStatistics>& stats) {
+  return GetStatsBatched(TASKSTATS_CMD_ATTR_TGID, tgids, stats);
 }
 
 TaskStatistics::TaskStatistics(const taskstats& taskstats_stats) {
@@ -215,6 +275,26 @@ void TaskStatistics::AddPidToTgid(const TaskStatistics& pid_statistics) {
   }
 }
 
+TaskStatistics& TaskStatistics::operator+=(const TaskStatistics& other) {
+  cpu_delay_count_       += other.cpu_delay_count_;
+  cpu_delay_ns_          += other.cpu_delay_ns_;
+  block_io_delay_count_  += other.block_io_delay_count_;
+  block_io_delay_ns_     += other.block_io_delay_ns_;
+  swap_in_delay_count_   += other.swap_in_delay_count_;
+  swap_in_delay_ns_      += other.swap_in_delay_ns_;
+  reclaim_delay_count_   += other.reclaim_delay_count_;
+  reclaim_delay_ns_      += other.reclaim_delay_ns_;
+  total_delay_ns_        += other.total_delay_ns_;
+  cpu_time_real_         += other.cpu_time_real_;
+  cpu_time_virtual_      += other.cpu_time_virtual_;
+  read_bytes_            += other.read_bytes_;
+  write_bytes_           += other.write_bytes_;
+  read_write_bytes_      += other.read_write_bytes_;
+  cancelled_write_bytes_ += other.cancelled_write_bytes_;
+  threads_               += other.threads_;
+  return *this;
+}
+
 // Store new statistics and return the delta from the old statistics
 TaskStatistics TaskStatistics::Update(const TaskStatistics& new_statistics) {
   TaskStatistics delta = new_statistics;
@@ -14,6 +14,8 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <stdint.h>
 
@@ -30,6 +32,9 @@ public:
   TaskStatistics(const TaskStatistics&) = default;
   void AddPidToTgid(const TaskStatistics&);
   TaskStatistics Update(const TaskStatistics&);
+  // Fold another task's statistics in wholesale (IO bytes and delay
+  // accounting), for aggregating across arbitrary groups of tasks.
+  TaskStatistics& operator+=(const TaskStatistics&);
 
   pid_t pid() const { return pid_; }
   const std::string& comm() const { return comm_; }
@@ -44,6 +49,12 @@ public:
   int threads() const { return threads_; }
 
   void set_pid(pid_t pid) { pid_ = pid; }
+  void set_comm(const std::string& comm) { comm_ = comm; }
+
+  // Generation stamp, used to sweep pids that have exited out of the
+  // stats maps without rebuilding them every interval.
+  uint64_t generation() const { return generation_; }
+  void set_generation(uint64_t generation) { generation_ = generation; }
 
 private:
   std::string comm_;
@@ -75,6 +86,8 @@ private:
   uint64_t cancelled_write_bytes_;
 
   int threads_;
+
+  uint64_t generation_ = 0;
 };
 
 class TaskstatsSocket {
@@ -85,8 +98,18 @@ public:
 
   bool GetPidStats(int, TaskStatistics&);
   bool GetTgidStats(int, TaskStatistics&);
+  // Pipeline requests for many pids over the persistent socket and
+  // collect the replies into stats, keyed by pid. One kernel
+  // round-trip per batch instead of one per pid.
+  bool GetPidStatsBatched(const std::vector<pid_t>&,
+                          std::unordered_map<pid_t, TaskStatistics>&);
+  bool GetTgidStatsBatched(const std::vector<pid_t>&,
+                           std::unordered_map<pid_t, TaskStatistics>&);
 private:
   bool GetStats(int, int, TaskStatistics& stats);
+  bool GetStatsBatched(int type, const std::vector<pid_t>&,
+                       std::unordered_map<pid_t, TaskStatistics>&);
+  bool SendStatsRequest(int pid, int type);
   std::unique_ptr<nl_sock, void(*)(nl_sock*)> nl_;
   int family_id_;
 };
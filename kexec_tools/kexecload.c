@@ -1,6 +1,8 @@
 #include <errno.h>
 #include <getopt.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <sys/mman.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,6 +35,86 @@ int get_file_size(int f)
     return st.st_size;
 }
 
+/*
+ * Segment loading. The atags and the zImage are read concurrently, one
+ * thread per file, into preallocated page-aligned buffers; the crc32 of
+ * each file is folded in chunk by chunk as it arrives, so checksum
+ * validation against precomputed values (-c) costs no extra pass.
+ */
+
+#define LOAD_CHUNK_SIZE 0x100000
+
+struct segment_load {
+    const char *path;
+    int fd;
+    int size;           /* buffer size, page rounded */
+    int file_size;
+    void *buf;
+    uint32_t crc;
+    int ok;
+};
+
+static uint32_t crc32_table[256];
+
+static void crc32_init(void)
+{
+    uint32_t c;
+    int n, k;
+
+    for (n = 0; n < 256; n++) {
+        c = (uint32_t) n;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc32_table[n] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char *buf, int len)
+{
+    int n;
+
+    crc = ~crc;
+    for (n = 0; n < len; n++)
+        crc = crc32_table[(crc ^ buf[n]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void *segment_loader(void *arg)
+{
+    struct segment_load *load = (struct segment_load *) arg;
+    int done = 0;
+
+    load->ok = 0;
+    if (posix_memalign(&load->buf, getpagesize(), load->size) != 0) {
+        fprintf(stderr, "Unable to allocate %d bytes for %s\n",
+                load->size, load->path);
+        return NULL;
+    }
+    while (done < load->file_size) {
+        int chunk = load->file_size - done;
+        ssize_t n;
+
+        if (chunk > LOAD_CHUNK_SIZE)
+            chunk = LOAD_CHUNK_SIZE;
+        n = read(load->fd, (char *) load->buf + done, chunk);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            fprintf(stderr, "Error reading %s: %s\n", load->path,
+                    strerror(errno));
+            return NULL;
+        }
+        load->crc = crc32_update(load->crc, (unsigned char *) load->buf + done,
+                                 n);
+        done += n;
+    }
+    /* the page-rounded tail is zero filled, as mmap used to provide */
+    memset((char *) load->buf + load->file_size, 0,
+           load->size - load->file_size);
+    load->ok = 1;
+    return NULL;
+}
+
 int test_kexeccall() {
     int rv;
 
@@ -56,6 +138,8 @@ void usage(void)
             "options:\n"
             "  -t                                       tests syscall\n"
             "  -s <start address>                       specify start address of kernel\n"
+            "  -c <atags crc32>,<zimage crc32>          validate files against precomputed\n"
+            "                                           crc32 values (hex)\n"
         );
 }
 
@@ -73,12 +157,17 @@ int main(int argc, char *argv[])
     void *atag_buffer;
     void *zimage_buffer;
     struct kexec_segment segment[2];
+    struct segment_load loads[2];
+    pthread_t loaders[2];
+    uint32_t expected_crc[2];
+    int check_crc = 0;
     int page_size = getpagesize();
     void *start_address = (void *)START_ADDRESS;
-    int c;
+    int c, i;
 
     const struct option longopts[] = {
         {"start_address", required_argument, 0, 's'},
+        {"crc", required_argument, 0, 'c'},
         {"test", 0, 0, 't'},
         {"help", 0, 0, 'h'},
         {0, 0, 0, 0}
@@ -86,7 +175,7 @@ int main(int argc, char *argv[])
 
     while (1) {
         int option_index = 0;
-        c = getopt_long(argc, argv, "s:th", longopts, NULL);
+        c = getopt_long(argc, argv, "s:c:th", longopts, NULL);
         if (c < 0) {
             break;
         }
@@ -95,6 +184,14 @@ int main(int argc, char *argv[])
         case 's':
             start_address = (void *) strtoul(optarg, 0, 16);
             break;
+        case 'c':
+            if (sscanf(optarg, "%x,%x",
+                       &expected_crc[0], &expected_crc[1]) != 2) {
+                usage();
+                return 1;
+            }
+            check_crc = 1;
+            break;
         case 'h':
             usage();
             return 1;
@@ -132,14 +229,47 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    atag_buffer = (char *) mmap(NULL, atag_size, PROT_READ, MAP_POPULATE | MAP_PRIVATE, atag_file, 0);
-    zimage_buffer = (char *) mmap(NULL, zimage_size, PROT_READ, MAP_POPULATE | MAP_PRIVATE, zimage_file, 0);
+    memset(loads, 0, sizeof(loads));
+    loads[0].path = argv[0];
+    loads[0].fd = atag_file;
+    loads[0].size = atag_size;
+    loads[0].file_size = get_file_size(atag_file);
+    loads[1].path = argv[1];
+    loads[1].fd = zimage_file;
+    loads[1].size = zimage_size;
+    loads[1].file_size = get_file_size(zimage_file);
 
-    if(atag_buffer == MAP_FAILED || zimage_buffer == MAP_FAILED) {
-        fprintf(stderr, "Unable to map files into memory");
-        return 1;
+    crc32_init();
+    for (i = 0; i < 2; i++) {
+        if (pthread_create(&loaders[i], NULL, segment_loader, &loads[i]) != 0) {
+            /* no thread: load on the main thread instead */
+            segment_loader(&loads[i]);
+            loaders[i] = pthread_self();
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if (!pthread_equal(loaders[i], pthread_self()))
+            pthread_join(loaders[i], NULL);
+        if (!loads[i].ok) {
+            fprintf(stderr, "Unable to read %s into memory\n", loads[i].path);
+            return 1;
+        }
     }
 
+    if (check_crc) {
+        for (i = 0; i < 2; i++) {
+            if (loads[i].crc != expected_crc[i]) {
+                fprintf(stderr,
+                        "Checksum mismatch for %s: expected %08x, got %08x\n",
+                        loads[i].path, expected_crc[i], loads[i].crc);
+                return 1;
+            }
+        }
+    }
+
+    atag_buffer = loads[0].buf;
+    zimage_buffer = loads[1].buf;
+
     segment[0].buf = zimage_buffer;
     segment[0].bufsz = zimage_size;
     segment[0].mem = (void *) ((uintptr_t) start_address + KEXEC_ARM_ZIMAGE_OFFSET);
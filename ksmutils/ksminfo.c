@@ -18,11 +18,13 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <pagemap/pagemap.h>
@@ -37,6 +39,16 @@
 #define PR_VERBOSE      2
 #define PR_ALL          4
 
+/* maximum number of contiguous KSM pages gathered into one iovec */
+#define READ_BATCH_PAGES 64
+
+/* maximum pages and distinct runs fetched by one process_vm_readv call */
+#define VM_READ_BATCH_PAGES 256
+#define VM_READ_BATCH_IOVS  64
+
+/* initial size of the hash index, must be a power of two */
+#define INDEX_INITIAL_SIZE 64
+
 struct vaddr {
     unsigned long addr;
     size_t num_pages;
@@ -55,30 +67,52 @@ struct ksm_page {
 struct ksm_pages {
     struct ksm_page *pages;
     size_t len, size;
+    /* open addressing index over pages, keyed by hash; a slot holds the
+     * page index plus one so that zero can mean empty */
+    size_t *index;
+    size_t index_mask;
+};
+
+/* shared state of the scanner threads */
+struct scan_args {
+    pm_kernel_t *ker;
+    pid_t *pids;
+    size_t num_procs;
+    struct ksm_pages *kp;
+    uint8_t pr_flags;
+    /* guards next_proc, rc and all of kp */
+    pthread_mutex_t lock;
+    size_t next_proc;
+    int rc;
 };
 
 static void usage(char *myname);
 static int getprocname(pid_t pid, char *buf, int len);
-static int read_pages(struct ksm_pages *kp, pm_map_t **maps, size_t num_maps, uint8_t pr_flags);
+static void *scan_worker(void *arg);
+static int read_pages(struct ksm_pages *kp, pm_map_t **maps, size_t num_maps,
+                      uint8_t pr_flags, pthread_mutex_t *lock);
 static void print_pages(struct ksm_pages *kp, uint8_t pr_flags);
 static void free_pages(struct ksm_pages *kp, uint8_t pr_flags);
 static bool is_pattern(uint8_t *data, size_t len);
 static int cmp_pages(const void *a, const void *b);
+static size_t find_page(const struct ksm_pages *kp, uint32_t hash);
+static void index_insert(struct ksm_pages *kp, size_t page_idx);
+static int grow_pages(struct ksm_pages *kp);
 extern uint32_t hashword(const uint32_t *, size_t, int32_t);
 
 int main(int argc, char *argv[]) {
     pm_kernel_t *ker;
-    pm_process_t *proc;
     pid_t *pids;
     size_t num_procs;
-    size_t i;
-    pm_map_t **maps;
-    size_t num_maps;
     char cmdline[256]; // this must be within the range of int
     int error;
     int rc = EXIT_SUCCESS;
     uint8_t pr_flags = 0;
     struct ksm_pages kp;
+    struct scan_args args;
+    pthread_t *threads = NULL;
+    long num_threads;
+    size_t spawned, t;
 
     memset(&kp, 0, sizeof(kp));
 
@@ -149,72 +183,335 @@ int main(int argc, char *argv[]) {
     printf("Warning: this tool only compares the KSM CRCs of pages, there is a chance of "
             "collisions\n");
 
-    for (i = 0; i < num_procs; i++) {
-        error = pm_process_create(ker, pids[i], &proc);
+    args.ker = ker;
+    args.pids = pids;
+    args.num_procs = num_procs;
+    args.kp = &kp;
+    args.pr_flags = pr_flags;
+    args.next_proc = 0;
+    args.rc = EXIT_SUCCESS;
+    pthread_mutex_init(&args.lock, NULL);
+
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1)
+        num_threads = 1;
+    if ((size_t)num_threads > num_procs)
+        num_threads = num_procs;
+
+    spawned = 0;
+    if (num_threads > 1) {
+        threads = malloc((num_threads - 1) * sizeof(*threads));
+        if (threads) {
+            for (t = 0; t < (size_t)(num_threads - 1); t++) {
+                if (pthread_create(&threads[t], NULL, scan_worker, &args))
+                    break;
+                spawned++;
+            }
+        }
+    }
+    scan_worker(&args);
+    for (t = 0; t < spawned; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&args.lock);
+
+    if (args.rc != EXIT_SUCCESS) {
+        rc = args.rc;
+        goto exit;
+    }
+
+    if (pr_flags & PR_SORTED) {
+        qsort(kp.pages, kp.len, sizeof(*kp.pages), cmp_pages);
+    }
+    print_pages(&kp, pr_flags);
+
+exit:
+    free_pages(&kp, pr_flags);
+    free(pids);
+    return rc;
+}
+
+static void *scan_worker(void *arg) {
+    struct scan_args *args = arg;
+    pm_process_t *proc;
+    pm_map_t **maps;
+    size_t num_maps;
+    size_t i;
+    int error;
+
+    while (1) {
+        pthread_mutex_lock(&args->lock);
+        i = args->next_proc++;
+        error = args->rc;
+        pthread_mutex_unlock(&args->lock);
+        if (i >= args->num_procs || error != EXIT_SUCCESS)
+            break;
+
+        error = pm_process_create(args->ker, args->pids[i], &proc);
         if (error) {
-            fprintf(stderr, "warning: could not create process interface for %d\n", pids[i]);
-            rc = EXIT_FAILURE;
-            goto exit;
+            fprintf(stderr, "warning: could not create process interface for %d\n",
+                    args->pids[i]);
+            goto fail;
         }
 
         error = pm_process_maps(proc, &maps, &num_maps);
         if (error) {
             pm_process_destroy(proc);
-            fprintf(stderr, "warning: could not read process map for %d\n", pids[i]);
-            rc = EXIT_FAILURE;
-            goto exit;
+            fprintf(stderr, "warning: could not read process map for %d\n",
+                    args->pids[i]);
+            goto fail;
         }
 
-        if (read_pages(&kp, maps, num_maps, pr_flags) < 0) {
-            free(maps);
-            pm_process_destroy(proc);
-            rc = EXIT_FAILURE;
-            goto exit;
-        }
+        error = read_pages(args->kp, maps, num_maps, args->pr_flags, &args->lock);
 
         free(maps);
         pm_process_destroy(proc);
+
+        if (error < 0)
+            goto fail;
     }
 
-    if (pr_flags & PR_SORTED) {
-        qsort(kp.pages, kp.len, sizeof(*kp.pages), cmp_pages);
+    return NULL;
+
+fail:
+    pthread_mutex_lock(&args->lock);
+    args->rc = EXIT_FAILURE;
+    pthread_mutex_unlock(&args->lock);
+    return NULL;
+}
+
+static size_t find_page(const struct ksm_pages *kp, uint32_t hash) {
+    size_t i;
+
+    if (kp->index == NULL)
+        return kp->len;
+
+    i = hash & kp->index_mask;
+    while (kp->index[i]) {
+        if (kp->pages[kp->index[i] - 1].hash == hash)
+            return kp->index[i] - 1;
+        i = (i + 1) & kp->index_mask;
     }
-    print_pages(&kp, pr_flags);
 
-exit:
-    free_pages(&kp, pr_flags);
-    free(pids);
-    return rc;
+    return kp->len;
 }
 
-static int read_pages(struct ksm_pages *kp, pm_map_t **maps, size_t num_maps, uint8_t pr_flags) {
-    size_t i, j, k;
+static void index_insert(struct ksm_pages *kp, size_t page_idx) {
+    size_t i = kp->pages[page_idx].hash & kp->index_mask;
+
+    while (kp->index[i])
+        i = (i + 1) & kp->index_mask;
+    kp->index[i] = page_idx + 1;
+}
+
+/* make room for one more page, keeping the hash index at most half full */
+static int grow_pages(struct ksm_pages *kp) {
+    size_t i;
+
+    if (kp->len == kp->size) {
+        struct ksm_page *tmp = realloc(kp->pages,
+                (kp->size + GROWTH_FACTOR) * sizeof(*kp->pages));
+        if (tmp == NULL) {
+            return -1;
+        }
+        memset(&tmp[kp->len], 0, sizeof(tmp[kp->len]) * GROWTH_FACTOR);
+        kp->pages = tmp;
+        kp->size += GROWTH_FACTOR;
+    }
+
+    if (kp->index == NULL || (kp->len + 1) * 2 > kp->index_mask + 1) {
+        size_t new_size = kp->index ? (kp->index_mask + 1) * 2 : INDEX_INITIAL_SIZE;
+        size_t *tmp = calloc(new_size, sizeof(*tmp));
+        if (tmp == NULL) {
+            return -1;
+        }
+        free(kp->index);
+        kp->index = tmp;
+        kp->index_mask = new_size - 1;
+        for (i = 0; i < kp->len; i++) {
+            index_insert(kp, i);
+        }
+    }
+
+    return 0;
+}
+
+/* a run of consecutive KSM pages within one map, in page indices */
+struct page_run {
+    size_t first;
+    size_t len;
+};
+
+/*
+ * Hash one page of data and account it in the shared page table.
+ * Returns 0 on success, -1 on failure.
+ */
+static int account_page(struct ksm_pages *kp, uint32_t *page_data,
+                        unsigned long vaddr, uint64_t pfn, pid_t pid,
+                        size_t pagesize, pm_kernel_t *ker, uint8_t pr_flags,
+                        pthread_mutex_t *lock) {
+    uint32_t hash;
+    uint16_t pattern;
+    struct ksm_page *cur_page;
+    size_t k;
+    int error;
+
+    hash = hashword(page_data, pagesize / sizeof(*page_data), 17);
+    pattern = is_pattern((uint8_t *)page_data, pagesize) ?
+            (page_data[0] & 0xFF) : NO_PATTERN;
+
+    if (lock) pthread_mutex_lock(lock);
+
+    k = find_page(kp, hash);
+
+    if (k == kp->len) {
+        if (grow_pages(kp) < 0) {
+            fprintf(stderr, "warning: not enough memory to realloc pages struct\n");
+            goto err;
+        }
+        error = pm_kernel_count(ker, pfn, &kp->pages[kp->len].count);
+        if (error) {
+            fprintf(stderr, "error reading page count\n");
+            goto err;
+        }
+        kp->pages[kp->len].hash = hash;
+        kp->pages[kp->len].pattern = pattern;
+        index_insert(kp, kp->len);
+        kp->len++;
+    }
+
+    cur_page = &kp->pages[k];
+
+    if (pr_flags & PR_VERBOSE) {
+        if (cur_page->vaddr_len > 0 &&
+                cur_page->vaddr[cur_page->vaddr_len - 1].pid == pid &&
+                cur_page->vaddr[cur_page->vaddr_len - 1].addr ==
+                vaddr - (cur_page->vaddr[cur_page->vaddr_len - 1].num_pages *
+                pagesize)) {
+            cur_page->vaddr[cur_page->vaddr_len - 1].num_pages++;
+        } else {
+            if (cur_page->vaddr_len == cur_page->vaddr_size) {
+                struct vaddr *tmp = realloc(cur_page->vaddr,
+                        (cur_page->vaddr_size + GROWTH_FACTOR) * sizeof(*(cur_page->vaddr)));
+                if (tmp == NULL) {
+                    fprintf(stderr, "warning: not enough memory to realloc vaddr array\n");
+                    goto err;
+                }
+                memset(&tmp[cur_page->vaddr_len], 0, sizeof(tmp[cur_page->vaddr_len]) * GROWTH_FACTOR);
+                cur_page->vaddr = tmp;
+                cur_page->vaddr_size += GROWTH_FACTOR;
+            }
+            cur_page->vaddr[cur_page->vaddr_len].addr = vaddr;
+            cur_page->vaddr[cur_page->vaddr_len].num_pages = 1;
+            cur_page->vaddr[cur_page->vaddr_len].pid = pid;
+            cur_page->vaddr_len++;
+        }
+    }
+    cur_page->vaddr_count++;
+
+    if (lock) pthread_mutex_unlock(lock);
+    return 0;
+
+err:
+    if (lock) pthread_mutex_unlock(lock);
+    return -1;
+}
+
+/*
+ * Fetch a batch of runs with a single process_vm_readv into the page
+ * arena and account every page.  The batch is only consumed from the
+ * arena if the whole gather succeeded; on a short or failed read (older
+ * kernel, or a mapping that went away) each run is retried through
+ * /proc/pid/mem like before.  Returns 0 on success, -1 on failure.
+ */
+static int read_batch(int fd, pid_t pid, pm_map_t *map, uint64_t *pagemap,
+                      const struct page_run *runs, size_t nr_runs,
+                      uint32_t *data, size_t pagesize, struct ksm_pages *kp,
+                      uint8_t pr_flags, pthread_mutex_t *lock) {
+    struct iovec local, remote[VM_READ_BATCH_IOVS];
+    size_t total = 0, off, got, r, p, j;
+    ssize_t len;
+    pm_kernel_t *ker = map->proc->ker;
+    unsigned long vaddr;
+
+    for (r = 0; r < nr_runs; r++) {
+        remote[r].iov_base = (void *)(pm_map_start(map) +
+                                      runs[r].first * pagesize);
+        remote[r].iov_len = runs[r].len * pagesize;
+        total += remote[r].iov_len;
+    }
+    local.iov_base = data;
+    local.iov_len = total;
+
+    len = process_vm_readv(pid, &local, 1, remote, nr_runs, 0);
+    if (len == (ssize_t)total) {
+        off = 0;
+        for (r = 0; r < nr_runs; r++) {
+            for (p = 0; p < runs[r].len; p++) {
+                j = runs[r].first + p;
+                if (account_page(kp, data + off,
+                        pm_map_start(map) + j * pagesize,
+                        PM_PAGEMAP_PFN(pagemap[j]), pid, pagesize, ker,
+                        pr_flags, lock)) {
+                    return -1;
+                }
+                off += pagesize / sizeof(*data);
+            }
+        }
+        return 0;
+    }
+
+    for (r = 0; r < nr_runs; r++) {
+        vaddr = pm_map_start(map) + runs[r].first * pagesize;
+        len = pread(fd, data, runs[r].len * pagesize, vaddr);
+        got = (len > 0) ? (size_t)len / pagesize : 0;
+        if (got == 0) {
+            fprintf(stderr, "warning: could not read page at 0x%08lx\n", vaddr);
+            continue;
+        }
+        for (p = 0; p < got; p++) {
+            j = runs[r].first + p;
+            if (account_page(kp, data + p * (pagesize / sizeof(*data)),
+                    pm_map_start(map) + j * pagesize,
+                    PM_PAGEMAP_PFN(pagemap[j]), pid, pagesize, ker,
+                    pr_flags, lock)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int read_pages(struct ksm_pages *kp, pm_map_t **maps, size_t num_maps,
+                      uint8_t pr_flags, pthread_mutex_t *lock) {
+    size_t i, j;
     uint64_t *pagemap;
+    uint64_t *pfns, *flags;
     size_t map_len;
-    uint64_t flags;
-    pm_kernel_t *ker;
+    size_t pagesize;
+    size_t run_len;
+    struct page_run runs[VM_READ_BATCH_IOVS];
+    size_t nr_runs, batch_pages;
     int error;
-    unsigned long vaddr;
     int fd;
-    off_t off;
     char filename[MAX_FILENAME];
     uint32_t *data;
-    uint32_t hash;
     int rc = 0;
-    struct ksm_page *cur_page;
     pid_t pid;
 
     if (num_maps == 0)
         return 0;
 
     pid = pm_process_pid(maps[0]->proc);
-    ker = maps[0]->proc->ker;
+    pagesize = pm_kernel_pagesize(maps[0]->proc->ker);
     error = snprintf(filename, MAX_FILENAME, "/proc/%d/mem", pid);
     if (error < 0 || error >= MAX_FILENAME) {
         return -1;
     }
 
-    data = malloc(pm_kernel_pagesize(ker));
+    /* page arena, reused for every batch of this process */
+    data = malloc(VM_READ_BATCH_PAGES * pagesize);
     if (data == NULL) {
         fprintf(stderr, "warning: not enough memory to malloc data buffer\n");
         return -1;
@@ -234,106 +531,91 @@ static int read_pages(struct ksm_pages *kp, pm_map_t **maps, size_t num_maps, ui
                     pm_process_pid(maps[i]->proc));
             continue;
         }
+
+        if (map_len == 0) {
+            free(pagemap);
+            continue;
+        }
+
+        pfns = malloc(map_len * sizeof(*pfns));
+        flags = malloc(map_len * sizeof(*flags));
+        if (pfns == NULL || flags == NULL) {
+            fprintf(stderr, "warning: not enough memory to malloc flags buffer\n");
+            free(flags);
+            free(pfns);
+            free(pagemap);
+            rc = -1;
+            goto err_map;
+        }
+
         for (j = 0; j < map_len; j++) {
-            error = pm_kernel_flags(ker, PM_PAGEMAP_PFN(pagemap[j]), &flags);
-            if (error) {
-                fprintf(stderr, "warning: could not read flags for pfn at address 0x%016" PRIx64 "\n",
-                        pagemap[i]);
-                continue;
-            }
-            if (!(flags & KPF_KSM)) {
-                continue;
-            }
-            vaddr = pm_map_start(maps[i]) + j * pm_kernel_pagesize(ker);
-            off = lseek(fd, vaddr, SEEK_SET);
-            if (off == (off_t)-1) {
-                fprintf(stderr, "warning: could not lseek to 0x%08lx\n", vaddr);
-                continue;
-            }
-            ssize_t len = read(fd, data, pm_kernel_pagesize(ker));
-            if (len != pm_kernel_pagesize(ker)) {
-                fprintf(stderr, "warning: could not read page at 0x%08lx\n", vaddr);
-                continue;
-            }
+            pfns[j] = PM_PAGEMAP_PFN(pagemap[j]);
+        }
 
-            hash = hashword(data, pm_kernel_pagesize(ker) / sizeof(*data), 17);
+        error = pm_kernel_flags_batch(maps[i]->proc->ker, pfns, map_len, flags);
+        if (error) {
+            fprintf(stderr, "warning: could not read flags for the pages of %d\n",
+                    pm_process_pid(maps[i]->proc));
+            free(flags);
+            free(pfns);
+            free(pagemap);
+            continue;
+        }
 
-            for (k = 0; k < kp->len; k++) {
-                if (kp->pages[k].hash == hash) break;
+        /* coalesce consecutive KSM pages into runs and gather as many
+         * runs as fit the arena with a single process_vm_readv */
+        nr_runs = 0;
+        batch_pages = 0;
+        j = 0;
+        while (j < map_len) {
+            if (!(flags[j] & KPF_KSM)) {
+                j++;
+                continue;
             }
 
-            if (k == kp->len) {
-                if (kp->len == kp->size) {
-                    struct ksm_page *tmp = realloc(kp->pages,
-                            (kp->size + GROWTH_FACTOR) * sizeof(*kp->pages));
-                    if (tmp == NULL) {
-                        fprintf(stderr, "warning: not enough memory to realloc pages struct\n");
-                        free(pagemap);
-                        rc = -1;
-                        goto err_realloc;
-                    }
-                    memset(&tmp[k], 0, sizeof(tmp[k]) * GROWTH_FACTOR);
-                    kp->pages = tmp;
-                    kp->size += GROWTH_FACTOR;
-                }
-                rc = pm_kernel_count(ker, PM_PAGEMAP_PFN(pagemap[j]), &kp->pages[kp->len].count);
-                if (rc) {
-                    fprintf(stderr, "error reading page count\n");
-                    free(pagemap);
-                    goto err_count;
-                }
-                kp->pages[kp->len].hash = hash;
-                kp->pages[kp->len].pattern =
-                        is_pattern((uint8_t *)data, pm_kernel_pagesize(ker)) ?
-                        (data[0] & 0xFF) : NO_PATTERN;
-                kp->len++;
+            run_len = 1;
+            while (run_len < READ_BATCH_PAGES && j + run_len < map_len &&
+                    (flags[j + run_len] & KPF_KSM)) {
+                run_len++;
             }
 
-            cur_page = &kp->pages[k];
-
-            if (pr_flags & PR_VERBOSE) {
-                if (cur_page->vaddr_len > 0 &&
-                        cur_page->vaddr[cur_page->vaddr_len - 1].pid == pid &&
-                        cur_page->vaddr[cur_page->vaddr_len - 1].addr ==
-                        vaddr - (cur_page->vaddr[cur_page->vaddr_len - 1].num_pages *
-                        pm_kernel_pagesize(ker))) {
-                    cur_page->vaddr[cur_page->vaddr_len - 1].num_pages++;
-                } else {
-                    if (cur_page->vaddr_len == cur_page->vaddr_size) {
-                        struct vaddr *tmp = realloc(cur_page->vaddr,
-                                (cur_page->vaddr_size + GROWTH_FACTOR) * sizeof(*(cur_page->vaddr)));
-                        if (tmp == NULL) {
-                            fprintf(stderr, "warning: not enough memory to realloc vaddr array\n");
-                            free(pagemap);
-                            rc = -1;
-                            goto err_realloc;
-                        }
-                        memset(&tmp[cur_page->vaddr_len], 0, sizeof(tmp[cur_page->vaddr_len]) * GROWTH_FACTOR);
-                        cur_page->vaddr = tmp;
-                        cur_page->vaddr_size += GROWTH_FACTOR;
-                    }
-                    cur_page->vaddr[cur_page->vaddr_len].addr = vaddr;
-                    cur_page->vaddr[cur_page->vaddr_len].num_pages = 1;
-                    cur_page->vaddr[cur_page->vaddr_len].pid = pid;
-                    cur_page->vaddr_len++;
+            if (nr_runs == VM_READ_BATCH_IOVS ||
+                    batch_pages + run_len > VM_READ_BATCH_PAGES) {
+                if (read_batch(fd, pid, maps[i], pagemap, runs, nr_runs,
+                               data, pagesize, kp, pr_flags, lock)) {
+                    rc = -1;
+                    goto err_page;
                 }
+                nr_runs = 0;
+                batch_pages = 0;
             }
-            cur_page->vaddr_count++;
+
+            runs[nr_runs].first = j;
+            runs[nr_runs].len = run_len;
+            nr_runs++;
+            batch_pages += run_len;
+            j += run_len;
         }
-        free(pagemap);
-    }
-    goto no_err;
 
-err_realloc:
-err_count:
-    if (pr_flags & PR_VERBOSE) {
-        for (i = 0; i < kp->len; i++) {
-            free(kp->pages[i].vaddr);
+        if (nr_runs &&
+                read_batch(fd, pid, maps[i], pagemap, runs, nr_runs,
+                           data, pagesize, kp, pr_flags, lock)) {
+            rc = -1;
+            goto err_page;
         }
+
+        free(flags);
+        free(pfns);
+        free(pagemap);
     }
-    free(kp->pages);
+    goto err_map;
+
+err_page:
+    free(flags);
+    free(pfns);
+    free(pagemap);
 
-no_err:
+err_map:
     close(fd);
 err_open:
     free(data);
@@ -393,6 +675,7 @@ static void free_pages(struct ksm_pages *kp, uint8_t pr_flags) {
             free(kp->pages[i].vaddr);
         }
     }
+    free(kp->index);
     free(kp->pages);
 }
 
@@ -26,34 +26,48 @@
 #define MAX_LINE 512
 #define MAX_FILENAME 64
 
+#define LATENCY_HASH_SIZE 256
+
 const char *EXPECTED_VERSION = "Latency Top version : v0.1\n";
 const char *SYSCTL_FILE = "/proc/sys/kernel/latencytop";
 const char *GLOBAL_STATS_FILE = "/proc/latency_stats";
 const char *THREAD_STATS_FILE_FORMAT = "/proc/%d/task/%d/latency";
 
+/*
+ * Entries live in a hash table keyed by reason and persist across
+ * refresh intervals, so each parsed line is an O(1) lookup instead
+ * of a linear search over an ever-growing list. count/total/max are
+ * re-accumulated on every scan (the kernel files are cumulative),
+ * and shown_count/shown_total remember what the previous refresh
+ * displayed so we can emit per-interval deltas.
+ */
 struct latency_entry {
     struct latency_entry *next;
     unsigned long count;
     unsigned long max;
     unsigned long total;
+    unsigned long shown_count;
+    unsigned long shown_total;
+    unsigned long scan_gen;
     char reason[MAX_LINE];
 };
 
 static inline void check_latencytop() { }
 
-static struct latency_entry *read_global_stats(struct latency_entry *list, int erase);
-static struct latency_entry *read_process_stats(struct latency_entry *list, int erase, int pid);
-static struct latency_entry *read_thread_stats(struct latency_entry *list, int erase, int pid, int tid, int fatal);
+static void read_global_stats(int erase);
+static void read_process_stats(int erase, int pid);
+static int read_thread_stats(int erase, int pid, int tid, int fatal);
 
 static struct latency_entry *alloc_latency_entry(void);
 static void free_latency_entry(struct latency_entry *e);
 
 static void set_latencytop(int on);
-static struct latency_entry *read_latency_file(FILE *f, struct latency_entry *list);
+static void read_latency_file(FILE *f);
 static void erase_latency_file(FILE *f);
 
-static struct latency_entry *find_latency_entry(struct latency_entry *e, char *reason);
-static void print_latency_entries(struct latency_entry *head);
+static struct latency_entry *find_latency_entry(char *reason);
+static void expire_stale_entries(void);
+static void print_latency_entries(void);
 
 static void signal_handler(int sig);
 static void disable_latencytop(void);
@@ -65,9 +79,10 @@ static void clear_screen(void);
 static void usage(const char *cmd);
 
 struct latency_entry *free_entries;
+struct latency_entry *hash_table[LATENCY_HASH_SIZE];
+unsigned long scan_gen;
 
 int main(int argc, char *argv[]) {
-    struct latency_entry *e;
     int delay, iterations;
     int pid, tid;
     int count, erase;
@@ -142,17 +157,18 @@ int main(int argc, char *argv[]) {
 
         sleep(delay);
 
-        e = NULL;
+        scan_gen++;
         if (pid) {
             if (tid) {
-                e = read_thread_stats(e, erase, pid, tid, 1);
+                read_thread_stats(erase, pid, tid, 1);
             } else {
-                e = read_process_stats(e, erase, pid);
+                read_process_stats(erase, pid);
             }
         } else {
-            e = read_global_stats(e, erase);
+            read_global_stats(erase);
         }
         erase = 0;
+        expire_stale_entries();
 
         clear_screen();
         if (pid) {
@@ -164,7 +180,7 @@ int main(int argc, char *argv[]) {
         } else {
             printf("Latencies across all processes:\n");
         }
-        print_latency_entries(e);
+        print_latency_entries();
     }
 
     set_latencytop(0);
@@ -172,9 +188,8 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
-static struct latency_entry *read_global_stats(struct latency_entry *list, int erase) {
+static void read_global_stats(int erase) {
     FILE *f;
-    struct latency_entry *e;
 
     if (erase) {
         f = fopen(GLOBAL_STATS_FILE, "w");
@@ -185,25 +200,22 @@ static struct latency_entry *read_global_stats(struct latency_entry *list, int e
         fprintf(f, "erase\n");
         fclose(f);
     }
-    
+
     f = fopen(GLOBAL_STATS_FILE, "r");
     if (!f) {
         fprintf(stderr, "Could not open global latency stats file: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    e = read_latency_file(f, list);
+    read_latency_file(f);
 
     fclose(f);
-
-    return e;
 }
 
-static struct latency_entry *read_process_stats(struct latency_entry *list, int erase, int pid) {
+static void read_process_stats(int erase, int pid) {
     char dirname[MAX_FILENAME];
     DIR *dir;
     struct dirent *ent;
-    struct latency_entry *e;
     int tid;
 
     sprintf(dirname, "/proc/%d/task", pid);
@@ -214,25 +226,21 @@ static struct latency_entry *read_process_stats(struct latency_entry *list, int
         exit(EXIT_FAILURE);
     }
 
-    e = list;
     while ((ent = readdir(dir))) {
         if (!isdigit(ent->d_name[0]))
             continue;
 
         tid = atoi(ent->d_name);
 
-        e = read_thread_stats(e, erase, pid, tid, 0);
+        read_thread_stats(erase, pid, tid, 0);
     }
 
     closedir(dir);
-
-    return e;
 }
 
-static struct latency_entry *read_thread_stats(struct latency_entry *list, int erase, int pid, int tid, int fatal) {
+static int read_thread_stats(int erase, int pid, int tid, int fatal) {
     char filename[MAX_FILENAME];
     FILE *f;
-    struct latency_entry *e;
 
     sprintf(filename, THREAD_STATS_FILE_FORMAT, pid, tid);
 
@@ -244,29 +252,29 @@ static struct latency_entry *read_thread_stats(struct latency_entry *list, int e
                 fprintf(stderr, "Perhaps the process or thread has terminated?\n");
                 exit(EXIT_FAILURE);
             } else {
-                return list;
+                return -1;
             }
         }
         fprintf(f, "erase\n");
         fclose(f);
     }
-    
-    f = fopen(GLOBAL_STATS_FILE, "r");
+
+    f = fopen(filename, "r");
     if (!f) {
         if (fatal) {
             fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
             fprintf(stderr, "Perhaps the process or thread has terminated?\n");
             exit(EXIT_FAILURE);
         } else {
-            return list;
+            return -1;
         }
     }
 
-    e = read_latency_file(f, list);
+    read_latency_file(f);
 
     fclose(f);
 
-    return e;
+    return 0;
 }
 
 static struct latency_entry *alloc_latency_entry(void) {
@@ -291,18 +299,59 @@ static void free_latency_entry(struct latency_entry *e) {
     free_entries = e;
 }
 
-static struct latency_entry *find_latency_entry(struct latency_entry *head, char *reason) {
-    struct latency_entry *e;
+static unsigned int hash_reason(const char *reason) {
+    unsigned int hash = 5381;
+
+    while (*reason)
+        hash = hash * 33 + (unsigned char)*reason++;
+
+    return hash % LATENCY_HASH_SIZE;
+}
 
-    e = head;
+/*
+ * Look the reason up in the hash table, inserting a fresh entry if
+ * this is the first time we have seen it.
+ */
+static struct latency_entry *find_latency_entry(char *reason) {
+    unsigned int hash = hash_reason(reason);
+    struct latency_entry *e;
 
-    while (e) {
+    for (e = hash_table[hash]; e; e = e->next) {
         if (!strcmp(e->reason, reason))
             return e;
-        e = e->next;
     }
 
-    return NULL;
+    e = alloc_latency_entry();
+    e->count = e->max = e->total = 0;
+    e->shown_count = e->shown_total = 0;
+    e->scan_gen = 0;
+    strcpy(e->reason, reason);
+    e->next = hash_table[hash];
+    hash_table[hash] = e;
+
+    return e;
+}
+
+/*
+ * Drop entries that no scanned file mentioned this interval (e.g.
+ * threads that exited in -p mode), so the table doesn't grow without
+ * bound when running continuously.
+ */
+static void expire_stale_entries(void) {
+    struct latency_entry *e, **prev;
+    int i;
+
+    for (i = 0; i < LATENCY_HASH_SIZE; i++) {
+        prev = &hash_table[i];
+        while ((e = *prev)) {
+            if (e->scan_gen != scan_gen) {
+                *prev = e->next;
+                free_latency_entry(e);
+            } else {
+                prev = &e->next;
+            }
+        }
+    }
 }
 
 static void set_latencytop(int on) {
@@ -323,14 +372,12 @@ static void erase_latency_file(FILE *f) {
     fprintf(f, "erase\n");
 }
 
-static struct latency_entry *read_latency_file(FILE *f, struct latency_entry *list) {
-    struct latency_entry *e, *head;
+static void read_latency_file(FILE *f) {
+    struct latency_entry *e;
     char line[MAX_LINE];
     unsigned long count, max, total;
     char reason[MAX_LINE];
 
-    head = list;
-
     if (!fgets(line, MAX_LINE, f)) {
         fprintf(stderr, "Could not read latency file version: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
@@ -345,60 +392,75 @@ static struct latency_entry *read_latency_file(FILE *f, struct latency_entry *li
     while (fgets(line, MAX_LINE, f)) {
         sscanf(line, "%ld %ld %ld %s", &count, &total, &max, reason);
         if (max > 0 || total > 0) {
-            e = find_latency_entry(head, reason);
-            if (e) {
-                e->count += count;
-                if (max > e->max)
-                    e->max = max;
-                e->total += total;
-            } else {
-                e = alloc_latency_entry();
-                e->count = count;
-                e->max = max;
-                e->total = total;
-                strcpy(e->reason, reason);
-                e->next = head;
-                head = e;
+            e = find_latency_entry(reason);
+            if (e->scan_gen != scan_gen) {
+                /*
+                 * First file to mention this reason this interval,
+                 * restart the accumulators (the kernel files are
+                 * cumulative, carrying values over would double
+                 * count).
+                 */
+                e->scan_gen = scan_gen;
+                e->count = 0;
+                e->max = 0;
+                e->total = 0;
             }
+            e->count += count;
+            if (max > e->max)
+                e->max = max;
+            e->total += total;
         }
     }
-
-    return head;
 }
 
-static void print_latency_entries(struct latency_entry *head) {
+static void print_latency_entries(void) {
     struct latency_entry *e, **array;
-    unsigned long average;
+    unsigned long delta_count, delta_total, average;
     int i, count;
 
-    e = head;
     count = 0;
-    while (e) {
-        count++;
-        e = e->next;
+    for (i = 0; i < LATENCY_HASH_SIZE; i++) {
+        for (e = hash_table[i]; e; e = e->next)
+            count++;
     }
 
-    e = head;
     array = calloc(count, sizeof(struct latency_entry *));
     if (!array) {
         fprintf(stderr, "Error allocating array: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
-    for (i = 0; i < count; i++) {
-        array[i] = e;
-        e = e->next;
+    count = 0;
+    for (i = 0; i < LATENCY_HASH_SIZE; i++) {
+        for (e = hash_table[i]; e; e = e->next)
+            array[count++] = e;
     }
 
     qsort(array, count, sizeof(struct latency_entry *), &lat_cmp);
 
+    /*
+     * Count and Average are deltas for this refresh interval,
+     * Maximum is the worst case since the stats were last erased.
+     */
     printf("%10s  %10s  %7s  %s\n", "Maximum", "Average", "Count", "Reason");
     for (i = 0; i < count; i++) {
         e = array[i];
-        average = e->total / e->count;
+        if (e->count >= e->shown_count) {
+            delta_count = e->count - e->shown_count;
+            delta_total = e->total - e->shown_total;
+        } else {
+            /* accounting restarted (e.g. stats erased), show it all */
+            delta_count = e->count;
+            delta_total = e->total;
+        }
+        e->shown_count = e->count;
+        e->shown_total = e->total;
+        if (delta_count == 0)
+            continue;
+        average = delta_total / delta_count;
         printf("%4lu.%02lu ms  %4lu.%02lu ms  %7ld  %s\n",
             e->max / 1000, (e->max % 1000) / 10,
             average / 1000, (average % 1000) / 10,
-            e->count,
+            delta_count,
             e->reason);
     }
 
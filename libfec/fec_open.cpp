@@ -34,6 +34,10 @@ extern "C" {
 
 #include "fec_private.h"
 
+#ifndef O_DIRECT
+    #define O_DIRECT 0
+#endif
+
 /* used by `find_offset'; returns metadata size for a file size `size' and
    `roots' Reed-Solomon parity bytes */
 using size_func = uint64_t (*)(uint64_t size, int roots);
@@ -394,6 +398,8 @@ static int get_size(fec_handle *f)
 static void reset_handle(fec_handle *f)
 {
     f->fd = -1;
+    f->direct = false;
+    f->buffers.clear();
     f->flags = 0;
     f->mode = 0;
     f->errors = 0;
@@ -421,6 +427,12 @@ int fec_close(struct fec_handle *f)
     if (f->verity.hash) {
         delete[] f->verity.hash;
     }
+    if (f->verity.verified) {
+        delete[] f->verity.verified;
+    }
+    if (f->verity.corrupted) {
+        delete[] f->verity.corrupted;
+    }
     if (f->verity.salt) {
         delete[] f->verity.salt;
     }
@@ -428,7 +440,12 @@ int fec_close(struct fec_handle *f)
         delete[] f->verity.table;
     }
 
+    for (auto buffer : f->buffers) {
+        free(buffer);
+    }
+
     pthread_mutex_destroy(&f->mutex);
+    pthread_mutex_destroy(&f->buffer_mutex);
 
     reset_handle(f);
     delete f;
@@ -538,18 +555,40 @@ int fec_open(struct fec_handle **handle, const char *path, int mode, int flags,
     f->ecc.rsn = FEC_RSM - roots;
     f->flags = flags;
 
-    if (unlikely(pthread_mutex_init(&f->mutex, NULL) != 0)) {
+    if (unlikely(pthread_mutex_init(&f->mutex, NULL) != 0 ||
+            pthread_mutex_init(&f->buffer_mutex, NULL) != 0)) {
         error("failed to create a mutex: %s", strerror(errno));
         return -1;
     }
 
-    f->fd = TEMP_FAILURE_RETRY(open(path, mode | O_CLOEXEC));
+    int open_flags = mode | O_CLOEXEC;
+
+    if (flags & FEC_O_DIRECT) {
+        if (mode & O_RDWR) {
+            /* corrections are written back with unaligned sizes */
+            warn("ignoring FEC_O_DIRECT for a r/w handle");
+        } else {
+            open_flags |= O_DIRECT;
+        }
+    }
+
+    f->fd = TEMP_FAILURE_RETRY(open(path, open_flags));
+
+    if (f->fd == -1 && (open_flags & O_DIRECT)) {
+        /* not all file systems support O_DIRECT */
+        warn("failed to open '%s' with O_DIRECT: %s", path, strerror(errno));
+
+        open_flags &= ~O_DIRECT;
+        f->fd = TEMP_FAILURE_RETRY(open(path, open_flags));
+    }
 
     if (f->fd == -1) {
         error("failed to open '%s': %s", path, strerror(errno));
         return -1;
     }
 
+    f->direct = (open_flags & O_DIRECT) != 0;
+
     if (get_size(f.get()) == -1) {
         error("failed to get size for '%s': %s", path, strerror(errno));
         return -1;
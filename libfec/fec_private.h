@@ -38,10 +38,33 @@
 /* processing parameters */
 #define WORK_MIN_THREADS 1
 #define WORK_MAX_THREADS 64
+/* blocks per work queue chunk; small enough that a thread stuck in a
+   corruption-heavy region doesn't hold much of the request hostage */
+#define WORK_CHUNK_BLOCKS 16
+/* a clean read is I/O bound, so a few threads are enough to keep the device
+   busy; we only fan out to WORK_MAX_THREADS when earlier reads on the handle
+   have needed error correction, which is CPU bound */
+#define WORK_CLEAN_MAX_THREADS 4
 
 /* verity parameters */
-#define VERITY_CACHE_BLOCKS 4096
-#define VERITY_NO_CACHE UINT64_MAX
+#define VERITY_READAHEAD_BLOCKS 32
+
+/* O_DIRECT parameters */
+#define DIRECT_ALIGNMENT FEC_BLOCKSIZE
+#define DIRECT_BUFFER_BLOCKS 32
+
+/* block state cache files written by fec_block_cache_save */
+#define FEC_CACHE_MAGIC 0xFEC0CACE
+#define FEC_CACHE_VERSION 0
+
+struct fec_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_blocks;
+    /* SHA-256 of the verity table, which pins the root hash and salt the
+       cached state was gathered against */
+    uint8_t key[SHA256_DIGEST_LENGTH];
+} __attribute__ ((packed));
 
 /* verity definitions */
 #define VERITY_METADATA_SIZE (8 * FEC_BLOCKSIZE)
@@ -85,23 +108,28 @@ struct verity_info {
     uint32_t salt_size;
     uint8_t *salt;
     uint64_t data_blocks;
+    uint8_t *verified; /* bitmap of data blocks that have passed a hash
+                          check; the device is read-only, so the result
+                          remains valid for the lifetime of the handle */
+    uint8_t *corrupted; /* bitmap of data blocks that have failed a hash
+                           check; reads skip straight to error correction
+                           for these */
     uint64_t metadata_start; /* offset in file */
     uint8_t zero_hash[SHA256_DIGEST_LENGTH];
     verity_header header;
     verity_header ecc_header;
 };
 
-struct verity_block_info {
-    uint64_t index;
-    bool valid;
-};
-
 struct fec_handle {
     ecc_info ecc;
     int fd;
+    bool direct; /* fd is opened with O_DIRECT */
     int flags; /* additional flags passed to fec_open */
     int mode; /* mode for open(2) */
     pthread_mutex_t mutex;
+    pthread_mutex_t buffer_mutex; /* protects `buffers' */
+    std::vector<uint8_t *> buffers; /* pool of aligned bounce buffers for
+                                       O_DIRECT reads */
     uint64_t errors;
     uint64_t data_size;
     uint64_t pos;
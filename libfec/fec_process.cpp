@@ -16,26 +16,79 @@
 
 #include "fec_private.h"
 
-struct process_info {
-    int id;
+/* shared queue of block-aligned chunks; threads pull the next chunk as they
+   finish the previous one, so a thread stuck in a corruption-heavy region
+   (the expensive ecc_read path) doesn't leave the others idle */
+struct work_queue {
     fec_handle *f;
     uint8_t *buf;
-    size_t count;
-    uint64_t offset;
     read_func func;
+    uint64_t offset; /* start of the request */
+    uint64_t last; /* end of the request */
+    size_t chunk; /* max bytes per chunk */
+    pthread_mutex_t mutex;
+    uint64_t pos; /* next unclaimed position */
+    uint64_t end; /* end of the next chunk */
+};
+
+struct process_info {
+    int id;
+    work_queue *q;
     ssize_t rc;
     size_t errors;
 };
 
+/* grabs the next chunk from the queue; returns false when the queue is
+   drained */
+static bool __next_chunk(work_queue *q, uint64_t *pos, size_t *count)
+{
+    pthread_mutex_lock(&q->mutex);
+
+    if (q->pos >= q->last) {
+        pthread_mutex_unlock(&q->mutex);
+        return false;
+    }
+
+    *pos = q->pos;
+    *count = (size_t)(q->end - q->pos);
+
+    if (q->end > q->last) {
+        *count = (size_t)(q->last - q->pos);
+    }
+
+    q->pos = q->end;
+    q->end += q->chunk;
+
+    pthread_mutex_unlock(&q->mutex);
+    return true;
+}
+
 /* thread function  */
 static void * __process(void *cookie)
 {
     process_info *p = static_cast<process_info *>(cookie);
+    work_queue *q = p->q;
+
+    uint64_t pos = 0;
+    size_t count = 0;
+
+    p->rc = 0;
+
+    while (__next_chunk(q, &pos, &count)) {
+        debug("thread %d: [%" PRIu64 ", %" PRIu64 ")", p->id, pos,
+            pos + count);
 
-    debug("thread %d: [%" PRIu64 ", %" PRIu64 ")", p->id, p->offset,
-        p->offset + p->count);
+        ssize_t rc = q->func(q->f, &q->buf[pos - q->offset], count, pos,
+                &p->errors);
+
+        if (rc == -1) {
+            p->rc = -1;
+            return p;
+        }
+
+        p->rc += rc;
+    }
 
-    p->rc = p->func(p->f, p->buf, p->count, p->offset, &p->errors);
     return p;
 }
 
@@ -59,22 +112,40 @@ ssize_t process(fec_handle *f, uint8_t *buf, size_t count, uint64_t offset,
         threads = WORK_MAX_THREADS;
     }
 
-    uint64_t start = (offset / FEC_BLOCKSIZE) * FEC_BLOCKSIZE;
-    size_t blocks = fec_div_round_up(count, FEC_BLOCKSIZE);
+    /* a clean read is bound by the device, not the CPU; fan out wide only
+       when this handle has already had to correct errors */
+    if (f->errors == 0 && threads > WORK_CLEAN_MAX_THREADS) {
+        threads = WORK_CLEAN_MAX_THREADS;
+    }
 
-    size_t count_per_thread = fec_div_round_up(blocks, threads) * FEC_BLOCKSIZE;
-    size_t max_threads = fec_div_round_up(count, count_per_thread);
+    uint64_t start = (offset / FEC_BLOCKSIZE) * FEC_BLOCKSIZE;
+    size_t chunk = WORK_CHUNK_BLOCKS * FEC_BLOCKSIZE;
+    size_t chunks = fec_div_round_up(offset + count - start, chunk);
 
-    if ((size_t)threads > max_threads) {
-        threads = (int)max_threads;
+    if ((size_t)threads > chunks) {
+        threads = (int)chunks;
     }
 
-    size_t left = count;
-    uint64_t pos = offset;
-    uint64_t end = start + count_per_thread;
+    debug("%d threads, %zu chunks of at most %zu bytes (total %zu)", threads,
+        chunks, chunk, count);
+
+    work_queue q;
+
+    q.f = f;
+    q.buf = buf;
+    q.func = func;
+    q.offset = offset;
+    q.last = offset + count;
+    q.chunk = chunk;
+    q.pos = offset;
+    /* the first chunk is short so the rest stay aligned to the chunk grid */
+    q.end = start + chunk;
 
-    debug("%d threads, %zu bytes per thread (total %zu)", threads,
-        count_per_thread, count);
+    if (pthread_mutex_init(&q.mutex, NULL) != 0) {
+        error("failed to init mutex: %s", strerror(errno));
+        errno = EIO;
+        return -1;
+    }
 
     std::vector<pthread_t> handles;
     process_info info[threads];
@@ -82,21 +153,11 @@ ssize_t process(fec_handle *f, uint8_t *buf, size_t count, uint64_t offset,
 
     /* start threads to process queue */
     for (int i = 0; i < threads; ++i) {
-        check(left > 0);
-
         info[i].id = i;
-        info[i].f = f;
-        info[i].buf = &buf[pos - offset];
-        info[i].count = (size_t)(end - pos);
-        info[i].offset = pos;
-        info[i].func = func;
+        info[i].q = &q;
         info[i].rc = -1;
         info[i].errors = 0;
 
-        if (info[i].count > left) {
-            info[i].count = left;
-        }
-
         pthread_t thread;
 
         if (pthread_create(&thread, NULL, __process, &info[i]) != 0) {
@@ -105,14 +166,8 @@ ssize_t process(fec_handle *f, uint8_t *buf, size_t count, uint64_t offset,
         } else {
             handles.push_back(thread);
         }
-
-        pos = end;
-        end  += count_per_thread;
-        left -= info[i].count;
     }
 
-    check(left == 0);
-
     ssize_t nread = 0;
 
     /* wait for all threads to complete */
@@ -130,6 +185,8 @@ ssize_t process(fec_handle *f, uint8_t *buf, size_t count, uint64_t offset,
         }
     }
 
+    pthread_mutex_destroy(&q.mutex);
+
     if (rc == -1) {
         errno = EIO;
         return -1;
@@ -26,6 +26,26 @@ extern "C" {
 
 using rs_unique_ptr = std::unique_ptr<void, decltype(&free_rs_char)>;
 
+/* value of `cached_rsb' when no decoded stripe is cached */
+#define ECC_NO_CACHE UINT64_MAX
+
+/* RS decoder state shared by consecutive __ecc_read calls: the decoder,
+   the codeword matrix with staging room for bulk parity reads, and a cache
+   of the most recently decoded stripe; an RS stripe carries a byte column
+   for each of the rsn data blocks it protects, so repeated reads into the
+   same stripe can skip the gather and decode entirely */
+struct ecc_state {
+    rs_unique_ptr rs;
+    /* FEC_RSM x FEC_BLOCKSIZE codeword matrix, followed by
+       FEC_BLOCKSIZE x roots bytes of parity staging */
+    std::unique_ptr<uint8_t[]> ecc_data;
+    uint64_t cached_rsb;
+    bool cached_use_erasures;
+
+    ecc_state() : rs(NULL, free_rs_char), cached_rsb(ECC_NO_CACHE),
+            cached_use_erasures(false) {}
+};
+
 /* prints a hexdump of `data' using warn(...) */
 static void dump(const char *name, uint64_t value, const uint8_t *data,
         size_t size)
@@ -102,33 +122,75 @@ static inline bool is_zero(fec_handle *f, uint64_t offset)
     return !memcmp(v->zero_hash, &v->hash[hash_offset], SHA256_DIGEST_LENGTH);
 }
 
-/* reads and decodes a single block starting from `offset', returns the number
-   of bytes corrected in `errors' */
-static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
-        bool use_erasures, uint8_t *ecc_data, size_t *errors)
+/* checks if data block `n' has already passed a hash check through this
+   handle; see `set_verified' */
+static inline bool is_verified(fec_handle *f, uint64_t n)
 {
-    check(offset % FEC_BLOCKSIZE == 0);
-    ecc_info *e = &f->ecc;
+    verity_info *v = &f->verity;
 
-    /* reverse interleaving: calculate the RS block that includes the requested
-       offset */
-    uint64_t rsb = offset - (offset / (e->rounds * FEC_BLOCKSIZE)) *
-                        e->rounds * FEC_BLOCKSIZE;
-    int data_index = -1;
+    return v->verified && (v->verified[n >> 3] & (1 << (n & 7)));
+}
+
+/* marks data block `n' as verified; only called when the on-disk contents
+   of the block have passed a hash check, so later reads can skip hashing */
+static inline void set_verified(fec_handle *f, uint64_t n)
+{
+    verity_info *v = &f->verity;
+
+    if (v->verified) {
+        /* `process' may run readers concurrently; an atomic or ensures a
+           bit set by another thread in the same byte is not lost */
+        __sync_fetch_and_or(&v->verified[n >> 3], (uint8_t)(1 << (n & 7)));
+    }
+}
+
+/* checks if data block `n' has already failed a hash check through this
+   handle; see `set_corrupted' */
+static inline bool is_corrupted(fec_handle *f, uint64_t n)
+{
+    verity_info *v = &f->verity;
+
+    return v->corrupted && (v->corrupted[n >> 3] & (1 << (n & 7)));
+}
+
+/* marks data block `n' as corrupted on disk, so later reads can skip the
+   futile hash check and go straight to error correction */
+static inline void set_corrupted(fec_handle *f, uint64_t n)
+{
+    verity_info *v = &f->verity;
+
+    if (v->corrupted) {
+        __sync_fetch_and_or(&v->corrupted[n >> 3], (uint8_t)(1 << (n & 7)));
+    }
+}
+
+/* clears the corrupted bit for data block `n' after the corrected contents
+   have been written back to the file */
+static inline void clear_corrupted(fec_handle *f, uint64_t n)
+{
+    verity_info *v = &f->verity;
+
+    if (v->corrupted) {
+        __sync_fetch_and_and(&v->corrupted[n >> 3], (uint8_t)~(1 << (n & 7)));
+    }
+}
+
+/* gathers and decodes the entire RS stripe `rsb': the rsn interleaved data
+   blocks plus parity, leaving the corrected codewords in `s->ecc_data';
+   returns the number of bytes corrected in `errors' */
+static int __ecc_decode_stripe(fec_handle *f, ecc_state *s, uint64_t rsb,
+        bool use_erasures, size_t *errors)
+{
+    ecc_info *e = &f->ecc;
+    uint8_t *ecc_data = s->ecc_data.get();
+    uint8_t *parity = &ecc_data[FEC_RSM * FEC_BLOCKSIZE];
     int erasures[e->rsn];
     int neras = 0;
 
-    /* verity is required to check for erasures */
-    check(!use_erasures || f->verity.hash);
-
     for (int i = 0; i < e->rsn; ++i) {
         uint64_t interleaved = fec_ecc_interleave(rsb * e->rsn + i, e->rsn,
                                     e->rounds);
 
-        if (interleaved == offset) {
-            data_index = i;
-        }
-
         /* to improve our chances of correcting IO errors, initialize the
            buffer to zeros even if we are going to read to it later */
         uint8_t bbuf[FEC_BLOCKSIZE] = {0};
@@ -153,18 +215,21 @@ static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
         }
     }
 
-    check(data_index >= 0);
+    /* the parity bytes of the stripe's codewords are contiguous on disk, so
+       read them with one call instead of one per codeword */
+    if (!raw_pread(f, parity, FEC_BLOCKSIZE * e->roots,
+            e->start + rsb * e->roots)) {
+        error("failed to read ecc data: %s", strerror(errno));
+        return -1;
+    }
 
     size_t nerrs = 0;
     uint8_t copy[FEC_RSM];
 
     for (int i = 0; i < FEC_BLOCKSIZE; ++i) {
         /* copy parity data */
-        if (!raw_pread(f, &ecc_data[i * FEC_RSM + e->rsn], e->roots,
-                e->start + (i + rsb) * e->roots)) {
-            error("failed to read ecc data: %s", strerror(errno));
-            return -1;
-        }
+        memcpy(&ecc_data[i * FEC_RSM + e->rsn], &parity[i * e->roots],
+            e->roots);
 
         /* for debugging decoding failures, because decode_rs_char can mangle
            ecc_data */
@@ -173,7 +238,8 @@ static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
         }
 
         /* decode */
-        int rc = decode_rs_char(rs, &ecc_data[i * FEC_RSM], erasures, neras);
+        int rc = decode_rs_char(s->rs.get(), &ecc_data[i * FEC_RSM], erasures,
+                    neras);
 
         if (unlikely(rc < 0)) {
             if (use_erasures) {
@@ -192,8 +258,6 @@ static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
             check(rc <= (use_erasures ? e->roots : e->roots / 2));
             nerrs += rc;
         }
-
-        dest[i] = ecc_data[i * FEC_RSM + data_index];
     }
 
     if (nerrs) {
@@ -201,26 +265,69 @@ static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
         *errors += nerrs;
     }
 
+    return 0;
+}
+
+/* reads and decodes a single block starting from `offset', returns the number
+   of bytes corrected in `errors' */
+static int __ecc_read(fec_handle *f, ecc_state *s, uint8_t *dest,
+        uint64_t offset, bool use_erasures, size_t *errors)
+{
+    check(offset % FEC_BLOCKSIZE == 0);
+    ecc_info *e = &f->ecc;
+
+    /* reverse interleaving: calculate the RS block that includes the requested
+       offset */
+    uint64_t rsb = offset - (offset / (e->rounds * FEC_BLOCKSIZE)) *
+                        e->rounds * FEC_BLOCKSIZE;
+
+    /* the requested block is interleaved at rsb + i * rounds * FEC_BLOCKSIZE,
+       so its column in the codeword matrix follows directly */
+    int data_index = (int)((offset - rsb) / (e->rounds * FEC_BLOCKSIZE));
+    check(data_index >= 0 && data_index < e->rsn);
+
+    /* verity is required to check for erasures */
+    check(!use_erasures || f->verity.hash);
+
+    if (s->cached_rsb != rsb || s->cached_use_erasures != use_erasures) {
+        /* invalidate first, in case decoding fails partway */
+        s->cached_rsb = ECC_NO_CACHE;
+
+        if (__ecc_decode_stripe(f, s, rsb, use_erasures, errors) == -1) {
+            return -1;
+        }
+
+        s->cached_rsb = rsb;
+        s->cached_use_erasures = use_erasures;
+    }
+
+    uint8_t *ecc_data = s->ecc_data.get();
+
+    for (int i = 0; i < FEC_BLOCKSIZE; ++i) {
+        dest[i] = ecc_data[i * FEC_RSM + data_index];
+    }
+
     return FEC_BLOCKSIZE;
 }
 
 /* initializes RS decoder and allocates memory for interleaving */
-static int ecc_init(fec_handle *f, rs_unique_ptr& rs,
-        std::unique_ptr<uint8_t[]>& ecc_data)
+static int ecc_init(fec_handle *f, ecc_state *s)
 {
     check(f);
 
-    rs.reset(init_rs_char(FEC_PARAMS(f->ecc.roots)));
+    s->rs.reset(init_rs_char(FEC_PARAMS(f->ecc.roots)));
 
-    if (unlikely(!rs)) {
+    if (unlikely(!s->rs)) {
         error("failed to initialize RS");
         errno = ENOMEM;
         return -1;
     }
 
-    ecc_data.reset(new (std::nothrow) uint8_t[FEC_RSM * FEC_BLOCKSIZE]);
+    /* codeword matrix plus staging room for the bulk parity read */
+    s->ecc_data.reset(new (std::nothrow)
+            uint8_t[FEC_RSM * FEC_BLOCKSIZE + FEC_BLOCKSIZE * f->ecc.roots]);
 
-    if (unlikely(!ecc_data)) {
+    if (unlikely(!s->ecc_data)) {
         error("failed to allocate ecc buffer");
         errno = ENOMEM;
         return -1;
@@ -242,10 +349,9 @@ static ssize_t ecc_read(fec_handle *f, uint8_t *dest, size_t count,
 
     debug("[%" PRIu64 ", %" PRIu64 ")", offset, offset + count);
 
-    rs_unique_ptr rs(NULL, free_rs_char);
-    std::unique_ptr<uint8_t[]> ecc_data;
+    ecc_state state;
 
-    if (ecc_init(f, rs, ecc_data) == -1) {
+    if (ecc_init(f, &state) == -1) {
         return -1;
     }
 
@@ -257,8 +363,8 @@ static ssize_t ecc_read(fec_handle *f, uint8_t *dest, size_t count,
 
     while (left > 0) {
         /* there's no erasure detection without verity metadata */
-        if (__ecc_read(f, rs.get(), data, curr * FEC_BLOCKSIZE, false,
-                ecc_data.get(), errors) == -1) {
+        if (__ecc_read(f, &state, data, curr * FEC_BLOCKSIZE, false,
+                errors) == -1) {
             return -1;
         }
 
@@ -294,10 +400,9 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
 
     debug("[%" PRIu64 ", %" PRIu64 ")", offset, offset + count);
 
-    rs_unique_ptr rs(NULL, free_rs_char);
-    std::unique_ptr<uint8_t[]> ecc_data;
+    ecc_state state;
 
-    if (f->ecc.start && ecc_init(f, rs, ecc_data) == -1) {
+    if (f->ecc.start && ecc_init(f, &state) == -1) {
         return -1;
     }
 
@@ -309,6 +414,21 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
     uint64_t max_hash_block = (f->verity.hash_data_blocks * FEC_BLOCKSIZE -
                                 SHA256_DIGEST_LENGTH) / SHA256_DIGEST_LENGTH;
 
+    /* ask the kernel to start reading the blocks we will need next, so the
+       page cache is primed while we hash; data hashes are already in memory
+       and need no readahead; with O_DIRECT there is no cache to prime */
+    if (!f->direct) {
+        uint64_t readahead_end = offset + count +
+                                    VERITY_READAHEAD_BLOCKS * FEC_BLOCKSIZE;
+
+        if (readahead_end > f->data_size) {
+            readahead_end = f->data_size;
+        }
+
+        posix_fadvise(f->fd, offset, readahead_end - offset,
+            POSIX_FADV_WILLNEED);
+    }
+
     while (left > 0) {
         check(curr <= max_hash_block);
 
@@ -317,6 +437,19 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
 
         bool expect_zeros = is_zero(f, curr_offset);
 
+        /* a block that has already passed a hash check only needs to be
+           read again, not hashed; bits are set only for blocks whose
+           on-disk contents were valid, so the raw copy is the verified
+           data */
+        if (is_verified(f, curr)) {
+            if (!raw_pread(f, data, FEC_BLOCKSIZE, curr_offset)) {
+                error("failed to read: %s", strerror(errno));
+                return -1;
+            }
+
+            goto valid;
+        }
+
         /* if we are in read-only mode and expect to read a zero block,
            skip reading and just return zeros */
         if (f->mode & O_RDONLY && expect_zeros) {
@@ -330,10 +463,16 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
             return -1;
         }
 
-        if (likely(verity_check_block(f, hash, data))) {
+        /* skip the hash check for blocks that have already failed one; the
+           on-disk contents cannot have improved since */
+        if (likely(!is_corrupted(f, curr)) &&
+                likely(verity_check_block(f, hash, data))) {
+            set_verified(f, curr);
             goto valid;
         }
 
+        set_corrupted(f, curr);
+
         /* we know the block is supposed to contain zeros, so return zeros
            instead of trying to correct it */
         if (expect_zeros) {
@@ -353,14 +492,14 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
 
         /* try to correct without erasures first, because checking for
            erasure locations is slower */
-        if (__ecc_read(f, rs.get(), data, curr_offset, false, ecc_data.get(),
+        if (__ecc_read(f, &state, data, curr_offset, false,
                 errors) == FEC_BLOCKSIZE &&
             verity_check_block(f, hash, data)) {
             goto corrected;
         }
 
         /* try to correct with erasures */
-        if (__ecc_read(f, rs.get(), data, curr_offset, true, ecc_data.get(),
+        if (__ecc_read(f, &state, data, curr_offset, true,
                 errors) == FEC_BLOCKSIZE &&
             verity_check_block(f, hash, data)) {
             goto corrected;
@@ -376,10 +515,15 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
 
 corrected:
         /* update the corrected block to the file if we are in r/w mode */
-        if (f->mode & O_RDWR &&
-                !raw_pwrite(f, data, FEC_BLOCKSIZE, curr_offset)) {
-            error("failed to write: %s", strerror(errno));
-            return -1;
+        if (f->mode & O_RDWR) {
+            if (!raw_pwrite(f, data, FEC_BLOCKSIZE, curr_offset)) {
+                error("failed to write: %s", strerror(errno));
+                return -1;
+            }
+
+            /* the block on disk is now valid */
+            clear_corrupted(f, curr);
+            set_verified(f, curr);
         }
 
 valid:
@@ -467,6 +611,82 @@ static inline size_t get_max_count(uint64_t offset, size_t count, uint64_t max)
     return count;
 }
 
+/* returns an aligned bounce buffer of DIRECT_BUFFER_BLOCKS blocks from the
+   handle's pool, allocating a new one if the pool is empty */
+static uint8_t *direct_buffer_get(fec_handle *f)
+{
+    uint8_t *buffer = NULL;
+
+    pthread_mutex_lock(&f->buffer_mutex);
+
+    if (!f->buffers.empty()) {
+        buffer = f->buffers.back();
+        f->buffers.pop_back();
+    }
+
+    pthread_mutex_unlock(&f->buffer_mutex);
+
+    if (!buffer && posix_memalign((void **)&buffer, DIRECT_ALIGNMENT,
+            DIRECT_BUFFER_BLOCKS * FEC_BLOCKSIZE) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return buffer;
+}
+
+/* returns a buffer from `direct_buffer_get' to the pool for reuse */
+static void direct_buffer_put(fec_handle *f, uint8_t *buffer)
+{
+    pthread_mutex_lock(&f->buffer_mutex);
+    f->buffers.push_back(buffer);
+    pthread_mutex_unlock(&f->buffer_mutex);
+}
+
+/* reads `count' bytes from `f->fd' through an aligned bounce buffer to
+   satisfy O_DIRECT alignment requirements; `buf', `count', and `offset' do
+   not have to be aligned */
+static bool direct_pread(fec_handle *f, void *buf, size_t count,
+        uint64_t offset)
+{
+    uint8_t *buffer = direct_buffer_get(f);
+
+    if (unlikely(!buffer)) {
+        return false;
+    }
+
+    uint8_t *p = (uint8_t *)buf;
+    bool rc = true;
+
+    while (count > 0) {
+        uint64_t start = (offset / DIRECT_ALIGNMENT) * DIRECT_ALIGNMENT;
+        size_t coff = (size_t)(offset - start);
+
+        ssize_t n = TEMP_FAILURE_RETRY(pread64(f->fd, buffer,
+                        DIRECT_BUFFER_BLOCKS * FEC_BLOCKSIZE, start));
+
+        if (n <= (ssize_t)coff) {
+            rc = false;
+            break;
+        }
+
+        size_t copy = (size_t)n - coff;
+
+        if (copy > count) {
+            copy = count;
+        }
+
+        memcpy(p, &buffer[coff], copy);
+
+        p += copy;
+        offset += copy;
+        count -= copy;
+    }
+
+    direct_buffer_put(f, buffer);
+    return rc;
+}
+
 /* reads `count' bytes from `f->fd' starting from `offset', and copies the
    data to `buf' */
 bool raw_pread(fec_handle *f, void *buf, size_t count, uint64_t offset)
@@ -474,6 +694,10 @@ bool raw_pread(fec_handle *f, void *buf, size_t count, uint64_t offset)
     check(f);
     check(buf);
 
+    if (f->direct) {
+        return direct_pread(f, buf, count, offset);
+    }
+
     uint8_t *p = (uint8_t *)buf;
     size_t remaining = count;
 
@@ -179,13 +179,177 @@ static bool ecc_read_hashes(fec_handle *f, uint64_t hash_offset,
     return true;
 }
 
+/* validates block `j' of a hash tree level against its expected hash, and
+   attempts error correction if the block does not validate; if `out' is
+   non-NULL, copies the valid block to `out' */
+static int verify_tree_block(fec_handle *f, uint64_t hash_offset,
+        uint64_t data_offset, uint32_t j, uint8_t *out)
+{
+    uint8_t data[FEC_BLOCKSIZE];
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+
+    /* ecc reads are very I/O intensive, so read raw hash tree and do
+       error correcting only if it doesn't validate */
+    if (!raw_pread(f, hash, SHA256_DIGEST_LENGTH,
+            hash_offset + j * SHA256_DIGEST_LENGTH) ||
+        !raw_pread(f, data, FEC_BLOCKSIZE,
+            data_offset + j * FEC_BLOCKSIZE)) {
+        error("failed to read hashes: %s", strerror(errno));
+        return -1;
+    }
+
+    if (!verity_check_block(f, hash, data)) {
+        /* corrections are rare, spawn nested processing threads in
+           `fec_pread', and may rewrite blocks, so serialize them */
+        pthread_mutex_lock(&f->mutex);
+
+        /* try to correct */
+        bool corrected =
+            ecc_read_hashes(f, hash_offset + j * SHA256_DIGEST_LENGTH, hash,
+                data_offset + j * FEC_BLOCKSIZE, data) &&
+            verity_check_block(f, hash, data);
+
+        if (!corrected) {
+            pthread_mutex_unlock(&f->mutex);
+            error("invalid hash tree: hash_offset %" PRIu64 ", "
+                "data_offset %" PRIu64 ", block %u",
+                hash_offset, data_offset, j);
+            return -1;
+        }
+
+        /* update the corrected blocks to the file if we are in r/w mode */
+        if (f->mode & O_RDWR &&
+                (!raw_pwrite(f, hash, SHA256_DIGEST_LENGTH,
+                    hash_offset + j * SHA256_DIGEST_LENGTH) ||
+                 !raw_pwrite(f, data, FEC_BLOCKSIZE,
+                    data_offset + j * FEC_BLOCKSIZE))) {
+            pthread_mutex_unlock(&f->mutex);
+            error("failed to write hashes: %s", strerror(errno));
+            return -1;
+        }
+
+        pthread_mutex_unlock(&f->mutex);
+    }
+
+    if (out) {
+        memcpy(out + j * FEC_BLOCKSIZE, data, FEC_BLOCKSIZE);
+    }
+
+    return 0;
+}
+
+struct verify_info {
+    int id;
+    fec_handle *f;
+    uint64_t hash_offset;
+    uint64_t data_offset;
+    uint32_t start;
+    uint32_t count;
+    uint8_t *out;
+    int rc;
+};
+
+/* thread function for `verify_level'; each worker hashes its share of the
+   blocks with SHA contexts on its own stack */
+static void * __verify(void *cookie)
+{
+    verify_info *v = static_cast<verify_info *>(cookie);
+
+    debug("thread %d: [%u, %u)", v->id, v->start, v->start + v->count);
+
+    v->rc = 0;
+
+    for (uint32_t j = v->start; j < v->start + v->count; ++j) {
+        if (verify_tree_block(v->f, v->hash_offset, v->data_offset, j,
+                v->out) == -1) {
+            v->rc = -1;
+            break;
+        }
+    }
+
+    return v;
+}
+
+/* validates all `blocks' blocks of a hash tree level, splitting the work
+   across a maximum number of threads; if `out' is non-NULL, copies the
+   valid blocks there */
+static int verify_level(fec_handle *f, uint64_t hash_offset,
+        uint64_t data_offset, uint32_t blocks, uint8_t *out)
+{
+    check(f);
+
+    if (blocks == 0) {
+        return 0;
+    }
+
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads < WORK_MIN_THREADS) {
+        threads = WORK_MIN_THREADS;
+    } else if (threads > WORK_MAX_THREADS) {
+        threads = WORK_MAX_THREADS;
+    }
+
+    uint32_t blocks_per_thread = fec_div_round_up(blocks, threads);
+    threads = (int)fec_div_round_up(blocks, blocks_per_thread);
+
+    debug("%d threads, %u blocks per thread (total %u)", threads,
+        blocks_per_thread, blocks);
+
+    std::vector<pthread_t> handles;
+    verify_info info[threads];
+    int rc = 0;
+
+    uint32_t start = 0;
+
+    /* start threads to validate the level */
+    for (int i = 0; i < threads; ++i) {
+        info[i].id = i;
+        info[i].f = f;
+        info[i].hash_offset = hash_offset;
+        info[i].data_offset = data_offset;
+        info[i].start = start;
+        info[i].count = blocks_per_thread;
+        info[i].out = out;
+        info[i].rc = -1;
+
+        if (info[i].count > blocks - start) {
+            info[i].count = blocks - start;
+        }
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, __verify, &info[i]) != 0) {
+            error("failed to create thread: %s", strerror(errno));
+            rc = -1;
+        } else {
+            handles.push_back(thread);
+        }
+
+        start += info[i].count;
+    }
+
+    /* wait for all threads to complete */
+    for (auto thread : handles) {
+        verify_info *p = NULL;
+
+        if (pthread_join(thread, (void **)&p) != 0) {
+            error("failed to join thread: %s", strerror(errno));
+            rc = -1;
+        } else if (!p || p->rc == -1) {
+            rc = -1;
+        }
+    }
+
+    return rc;
+}
+
 /* reads the verity hash tree, validates it against the root hash in `root',
    corrects errors if necessary, and copies valid data blocks for later use
    to `f->verity.hash' */
 static int verify_tree(fec_handle *f, const uint8_t *root)
 {
     uint8_t data[FEC_BLOCKSIZE];
-    uint8_t hash[SHA256_DIGEST_LENGTH];
 
     check(f);
     check(root);
@@ -258,52 +422,17 @@ static int verify_tree(fec_handle *f, const uint8_t *root)
         return -1;
     }
 
-    /* validate the rest of the hash tree */
+    /* validate the rest of the hash tree; levels depend on each other, but
+       the blocks within a level are independent and checked in parallel */
     data_offset = hash_offset + FEC_BLOCKSIZE;
 
     for (uint32_t i = 1; i < levels; ++i) {
         uint32_t blocks = hashes[levels - i];
 
-        for (uint32_t j = 0; j < blocks; ++j) {
-            /* ecc reads are very I/O intensive, so read raw hash tree and do
-               error correcting only if it doesn't validate */
-            if (!raw_pread(f, hash, SHA256_DIGEST_LENGTH,
-                    hash_offset + j * SHA256_DIGEST_LENGTH) ||
-                !raw_pread(f, data, FEC_BLOCKSIZE,
-                    data_offset + j * FEC_BLOCKSIZE)) {
-                error("failed to read hashes: %s", strerror(errno));
-                return -1;
-            }
-
-            if (!verity_check_block(f, hash, data)) {
-                /* try to correct */
-                if (!ecc_read_hashes(f,
-                        hash_offset + j * SHA256_DIGEST_LENGTH, hash,
-                        data_offset + j * FEC_BLOCKSIZE, data) ||
-                    !verity_check_block(f, hash, data)) {
-                    error("invalid hash tree: hash_offset %" PRIu64 ", "
-                        "data_offset %" PRIu64 ", block %u",
-                        hash_offset, data_offset, j);
-                    return -1;
-                }
-
-                /* update the corrected blocks to the file if we are in r/w
-                   mode */
-                if (f->mode & O_RDWR) {
-                    if (!raw_pwrite(f, hash, SHA256_DIGEST_LENGTH,
-                            hash_offset + j * SHA256_DIGEST_LENGTH) ||
-                        !raw_pwrite(f, data, FEC_BLOCKSIZE,
-                            data_offset + j * FEC_BLOCKSIZE)) {
-                        error("failed to write hashes: %s", strerror(errno));
-                        return -1;
-                    }
-                }
-            }
-
-            if (blocks == v->hash_data_blocks) {
-                memcpy(data_hashes.get() + j * FEC_BLOCKSIZE, data,
-                    FEC_BLOCKSIZE);
-            }
+        if (verify_level(f, hash_offset, data_offset, blocks,
+                blocks == v->hash_data_blocks ? data_hashes.get() : NULL)
+                    == -1) {
+            return -1;
         }
 
         hash_offset = data_offset;
@@ -461,6 +590,31 @@ static int parse_table(fec_handle *f, uint64_t offset, uint32_t size, bool useec
 
         check(v->hash);
 
+        /* allocate bitmaps for caching verification results, so blocks
+           that have already passed or failed a hash check are not hashed
+           again */
+        uint64_t bitmap_size = fec_div_round_up(v->data_blocks, 8);
+
+        if (v->verified) {
+            delete[] v->verified;
+            v->verified = NULL;
+        }
+        if (v->corrupted) {
+            delete[] v->corrupted;
+            v->corrupted = NULL;
+        }
+
+        v->verified = new (std::nothrow) uint8_t[bitmap_size];
+        v->corrupted = new (std::nothrow) uint8_t[bitmap_size];
+
+        if (!v->verified || !v->corrupted) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        memset(v->verified, 0, bitmap_size);
+        memset(v->corrupted, 0, bitmap_size);
+
         uint8_t zero_block[FEC_BLOCKSIZE];
         memset(zero_block, 0, FEC_BLOCKSIZE);
 
@@ -669,3 +823,175 @@ int fec_verity_set_status(struct fec_handle *f, bool enabled)
 
     return 0;
 }
+
+/* writes `count' bytes from `buf' to `fd', retrying on short writes */
+static bool write_all(int fd, const void *buf, size_t count)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (count > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, p, count));
+
+        if (n <= 0) {
+            return false;
+        }
+
+        p += n;
+        count -= n;
+    }
+
+    return true;
+}
+
+/* reads `count' bytes from `fd' to `buf', retrying on short reads */
+static bool read_all(int fd, void *buf, size_t count)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (count > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, p, count));
+
+        if (n <= 0) {
+            return false;
+        }
+
+        p += n;
+        count -= n;
+    }
+
+    return true;
+}
+
+/* computes a key identifying the device the cached block state belongs to;
+   hashing the verity table pins the root hash and the salt, so a cache file
+   cannot be applied to different content */
+static int cache_key(fec_handle *f, uint8_t *key)
+{
+    check(f->verity.table);
+
+    SHA256((const uint8_t *)f->verity.table, strlen(f->verity.table), key);
+    return 0;
+}
+
+/* saves the per-block verification state gathered through handle `f' to a
+   cache file at `path', so a later open can load it with
+   `fec_block_cache_load' instead of rediscovering corrupted extents */
+int fec_block_cache_save(struct fec_handle *f, const char *path)
+{
+    check(f);
+    check(path);
+
+    verity_info *v = &f->verity;
+
+    if (!v->verified || !v->corrupted || !v->table) {
+        error("no block state to save; verity not loaded?");
+        errno = EINVAL;
+        return -1;
+    }
+
+    fec_cache_header header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = FEC_CACHE_MAGIC;
+    header.version = FEC_CACHE_VERSION;
+    header.data_blocks = v->data_blocks;
+
+    if (cache_key(f, header.key) == -1) {
+        return -1;
+    }
+
+    int fd = TEMP_FAILURE_RETRY(
+        open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+
+    if (fd == -1) {
+        error("failed to open '%s': %s", path, strerror(errno));
+        return -1;
+    }
+
+    uint64_t bitmap_size = fec_div_round_up(v->data_blocks, 8);
+
+    if (!write_all(fd, &header, sizeof(header)) ||
+            !write_all(fd, v->verified, bitmap_size) ||
+            !write_all(fd, v->corrupted, bitmap_size)) {
+        error("failed to write '%s': %s", path, strerror(errno));
+        TEMP_FAILURE_RETRY(close(fd));
+        return -1;
+    }
+
+    TEMP_FAILURE_RETRY(close(fd));
+    return 0;
+}
+
+/* loads per-block verification state saved by `fec_block_cache_save' from
+   `path' into handle `f'; the cache is rejected unless it was saved for the
+   same verity table, and cached bits are merged with any state already
+   gathered through `f' */
+int fec_block_cache_load(struct fec_handle *f, const char *path)
+{
+    check(f);
+    check(path);
+
+    verity_info *v = &f->verity;
+
+    if (!v->verified || !v->corrupted || !v->table) {
+        error("no verity metadata loaded");
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+
+    if (fd == -1) {
+        error("failed to open '%s': %s", path, strerror(errno));
+        return -1;
+    }
+
+    fec_cache_header header;
+    uint8_t key[SHA256_DIGEST_LENGTH];
+
+    if (!read_all(fd, &header, sizeof(header))) {
+        error("failed to read '%s': %s", path, strerror(errno));
+        TEMP_FAILURE_RETRY(close(fd));
+        return -1;
+    }
+
+    if (header.magic != FEC_CACHE_MAGIC ||
+            header.version != FEC_CACHE_VERSION ||
+            header.data_blocks != v->data_blocks ||
+            cache_key(f, key) == -1 ||
+            memcmp(header.key, key, sizeof(key))) {
+        warn("ignoring stale or mismatching block cache '%s'", path);
+        TEMP_FAILURE_RETRY(close(fd));
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t bitmap_size = fec_div_round_up(v->data_blocks, 8);
+    std::unique_ptr<uint8_t[]> verified(
+        new (std::nothrow) uint8_t[bitmap_size]);
+    std::unique_ptr<uint8_t[]> corrupted(
+        new (std::nothrow) uint8_t[bitmap_size]);
+
+    if (!verified || !corrupted) {
+        TEMP_FAILURE_RETRY(close(fd));
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (!read_all(fd, verified.get(), bitmap_size) ||
+            !read_all(fd, corrupted.get(), bitmap_size)) {
+        error("failed to read '%s': %s", path, strerror(errno));
+        TEMP_FAILURE_RETRY(close(fd));
+        return -1;
+    }
+
+    TEMP_FAILURE_RETRY(close(fd));
+
+    /* merge with state already gathered through this handle */
+    for (uint64_t i = 0; i < bitmap_size; ++i) {
+        v->verified[i] |= verified[i];
+        v->corrupted[i] |= corrupted[i];
+    }
+
+    return 0;
+}
@@ -81,7 +81,10 @@ struct fec_verity_metadata {
 enum {
     FEC_FS_EXT4 = 1 << 0,
     FEC_FS_SQUASH = 1 << 1,
-    FEC_VERITY_DISABLE = 1 << 8
+    FEC_VERITY_DISABLE = 1 << 8,
+    FEC_O_DIRECT = 1 << 9 /* bypass the page cache when reading; ignored
+                             for r/w handles and file systems that do not
+                             support O_DIRECT */
 };
 
 struct fec_handle;
@@ -94,6 +97,10 @@ extern int fec_close(struct fec_handle *f);
 
 extern int fec_verity_set_status(struct fec_handle *f, bool enabled);
 
+extern int fec_block_cache_save(struct fec_handle *f, const char *path);
+
+extern int fec_block_cache_load(struct fec_handle *f, const char *path);
+
 extern int fec_verity_get_metadata(struct fec_handle *f,
         struct fec_verity_metadata *data);
 
@@ -185,6 +192,14 @@ namespace fec {
             return !fec_verity_set_status(handle_.get(), enabled);
         }
 
+        bool save_block_cache(const std::string& fn) {
+            return !fec_block_cache_save(handle_.get(), fn.c_str());
+        }
+
+        bool load_block_cache(const std::string& fn) {
+            return !fec_block_cache_load(handle_.get(), fn.c_str());
+        }
+
     private:
         handle handle_;
     };
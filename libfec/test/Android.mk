@@ -19,6 +19,22 @@ LOCAL_STATIC_LIBRARIES := \
 LOCAL_CFLAGS := -Wall -Werror -D_GNU_SOURCE
 include $(BUILD_HOST_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_CLANG := true
+LOCAL_MODULE := fec_benchmark
+LOCAL_SRC_FILES := fec_benchmark.cpp
+LOCAL_MODULE_TAGS := optional
+LOCAL_STATIC_LIBRARIES := \
+    libfec \
+    libfec_rs \
+    libcrypto_utils \
+    libcrypto \
+    libext4_utils \
+    libsquashfs_utils \
+    libbase
+LOCAL_CFLAGS := -Wall -Werror -D_GNU_SOURCE
+include $(BUILD_HOST_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_CLANG := true
 LOCAL_SANITIZE := integer
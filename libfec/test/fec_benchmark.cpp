@@ -0,0 +1,793 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* fec_pread throughput benchmark
+ *
+ * Generates an image with verity metadata and RS parity, optionally
+ * corrupts a controlled fraction of the RS stripes, and reports MB/s for
+ * fec_pread over the clean, corruption (RS decode), and erasure (RS
+ * decode with erasure locations) paths, plus random 4 KiB reads across
+ * client thread counts. With -o the results are saved as a baseline, and
+ * with -b they are compared against a saved baseline so CI can fail on
+ * regressions.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fec/io.h>
+#include <fec/ecc.h>
+#include <openssl/sha.h>
+
+extern "C" {
+    #include <fec.h>
+}
+
+#define DEFAULT_SIZE_MB 64
+#define DEFAULT_CORRUPT_PERCENT 100
+#define DEFAULT_TOLERANCE_PERCENT 10
+
+#define SEQ_READ_SIZE (512 * FEC_BLOCKSIZE)
+
+/* layout of the generated image */
+struct image {
+    std::string path;
+    int fd;
+    int roots;
+    int rsn;
+    uint64_t data_blocks; /* payload blocks, before the hash tree */
+    uint64_t inp_blocks; /* payload + hash tree + verity metadata */
+    uint64_t rounds;
+    uint64_t fec_start; /* byte offset of the RS parity */
+
+    image() : fd(-1) {}
+    ~image() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+};
+
+/* one benchmark result */
+struct result {
+    std::string name;
+    double mbs;
+};
+
+/* deterministic pseudo-random stream, so generated images and access
+   patterns are reproducible across runs and hosts */
+static inline uint64_t xorshift(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void random_block(uint64_t *state, uint8_t *block)
+{
+    uint64_t *p = reinterpret_cast<uint64_t *>(block);
+
+    for (size_t i = 0; i < FEC_BLOCKSIZE / sizeof(uint64_t); ++i) {
+        p[i] = xorshift(state);
+    }
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool pwrite_all(int fd, const void *buf, size_t count, uint64_t offset)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(buf);
+
+    while (count > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(pwrite64(fd, p, count, offset));
+
+        if (n <= 0) {
+            fprintf(stderr, "write failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        p += n;
+        count -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+static bool pread_all(int fd, void *buf, size_t count, uint64_t offset)
+{
+    uint8_t *p = static_cast<uint8_t *>(buf);
+
+    while (count > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(pread64(fd, p, count, offset));
+
+        if (n <= 0) {
+            fprintf(stderr, "read failed: %s\n", strerror(errno));
+            return false;
+        }
+
+        p += n;
+        count -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+static const uint8_t salt[SHA256_DIGEST_LENGTH] = {
+    0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa
+};
+
+/* computes a verity hash (salted SHA-256) of a single block */
+static void hash_block(const uint8_t *block, uint8_t *hash)
+{
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, salt, sizeof(salt));
+    SHA256_Update(&ctx, block, FEC_BLOCKSIZE);
+    SHA256_Final(hash, &ctx);
+}
+
+/* hashes each block of `in' and packs the hashes into blocks, zero padded
+   to a block boundary; one level of the hash tree from the level below */
+static void hash_level(const std::vector<uint8_t>& in,
+        std::vector<uint8_t> *out)
+{
+    uint64_t blocks = in.size() / FEC_BLOCKSIZE;
+    uint64_t out_blocks = fec_div_round_up(blocks * SHA256_DIGEST_LENGTH,
+                                FEC_BLOCKSIZE);
+
+    out->assign(out_blocks * FEC_BLOCKSIZE, 0);
+
+    for (uint64_t i = 0; i < blocks; ++i) {
+        hash_block(&in[i * FEC_BLOCKSIZE],
+            &(*out)[i * SHA256_DIGEST_LENGTH]);
+    }
+}
+
+static void bin_to_hex(const uint8_t *in, size_t size, char *out)
+{
+    for (size_t i = 0; i < size; ++i) {
+        sprintf(&out[i * 2], "%02x", in[i]);
+    }
+}
+
+/* verity metadata layout; must match what libfec parses */
+#define VERITY_MAGIC 0xB001B001
+#define VERITY_METADATA_SIZE (8 * FEC_BLOCKSIZE)
+
+struct verity_header {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t signature[ANDROID_PUBKEY_MODULUS_SIZE];
+    uint32_t length;
+};
+
+/* generates an image with `data_blocks' blocks of pseudo-random payload,
+   followed by a verity hash tree, verity metadata, RS parity, and an ecc
+   header block */
+static bool generate_image(image *img, const char *path, uint64_t size_mb,
+        int roots)
+{
+    img->path = path;
+    img->roots = roots;
+    img->rsn = FEC_RSM - roots;
+    img->data_blocks = size_mb * 1024 * 1024 / FEC_BLOCKSIZE;
+
+    /* the hash tree needs at least two levels below the root */
+    if (img->data_blocks <= FEC_BLOCKSIZE / SHA256_DIGEST_LENGTH) {
+        fprintf(stderr, "image too small; use at least 1 MiB\n");
+        return false;
+    }
+
+    img->fd = TEMP_FAILURE_RETRY(
+        open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+
+    if (img->fd == -1) {
+        fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    /* payload, hashing each block as it is written */
+    std::vector<uint8_t> data_hashes;
+    data_hashes.assign(fec_div_round_up(img->data_blocks *
+        SHA256_DIGEST_LENGTH, FEC_BLOCKSIZE) * FEC_BLOCKSIZE, 0);
+
+    uint8_t block[FEC_BLOCKSIZE];
+    uint64_t prng = 0x6665635f62656e63; /* arbitrary nonzero seed */
+
+    for (uint64_t i = 0; i < img->data_blocks; ++i) {
+        random_block(&prng, block);
+
+        if (!pwrite_all(img->fd, block, FEC_BLOCKSIZE, i * FEC_BLOCKSIZE)) {
+            return false;
+        }
+
+        hash_block(block, &data_hashes[i * SHA256_DIGEST_LENGTH]);
+    }
+
+    /* hash tree levels, bottom up, until a level fits in one block; that
+       block is the root and the verity digest is its salted hash */
+    std::vector<std::vector<uint8_t>> levels;
+    levels.push_back(std::move(data_hashes));
+
+    while (levels.back().size() > FEC_BLOCKSIZE) {
+        std::vector<uint8_t> next;
+        hash_level(levels.back(), &next);
+        levels.push_back(std::move(next));
+    }
+
+    uint8_t root[SHA256_DIGEST_LENGTH];
+    hash_block(levels.back().data(), root);
+
+    /* the tree is stored root first */
+    uint64_t pos = img->data_blocks * FEC_BLOCKSIZE;
+    uint64_t hash_start_block = img->data_blocks;
+
+    for (auto it = levels.rbegin(); it != levels.rend(); ++it) {
+        if (!pwrite_all(img->fd, it->data(), it->size(), pos)) {
+            return false;
+        }
+
+        pos += it->size();
+    }
+
+    /* verity metadata: header and table */
+    char digest_hex[2 * SHA256_DIGEST_LENGTH + 1];
+    char salt_hex[2 * sizeof(salt) + 1];
+
+    bin_to_hex(root, sizeof(root), digest_hex);
+    bin_to_hex(salt, sizeof(salt), salt_hex);
+
+    char table[512];
+    int table_length = snprintf(table, sizeof(table),
+        "1 fec_bench fec_bench %u %u %" PRIu64 " %" PRIu64 " sha256 %s %s",
+        FEC_BLOCKSIZE, FEC_BLOCKSIZE, img->data_blocks, hash_start_block,
+        digest_hex, salt_hex);
+
+    std::vector<uint8_t> metadata(VERITY_METADATA_SIZE, 0);
+    verity_header *vh = reinterpret_cast<verity_header *>(metadata.data());
+
+    vh->magic = VERITY_MAGIC;
+    vh->version = 0;
+    vh->length = table_length;
+    memcpy(metadata.data() + sizeof(verity_header), table, table_length);
+
+    if (!pwrite_all(img->fd, metadata.data(), metadata.size(), pos)) {
+        return false;
+    }
+
+    pos += metadata.size();
+
+    img->fec_start = pos;
+    img->inp_blocks = pos / FEC_BLOCKSIZE;
+    img->rounds = fec_div_round_up(img->inp_blocks, img->rsn);
+
+    /* RS parity: one stripe at a time, gathering the interleaved blocks
+       of the stripe, encoding each of the FEC_BLOCKSIZE codewords, and
+       storing the parity bytes of consecutive codewords contiguously */
+    void *rs = init_rs_char(FEC_PARAMS(roots));
+
+    if (!rs) {
+        fprintf(stderr, "failed to initialize RS encoder\n");
+        return false;
+    }
+
+    std::vector<uint8_t> stripe(img->rsn * FEC_BLOCKSIZE);
+    std::vector<uint8_t> parity(roots * FEC_BLOCKSIZE);
+    uint8_t cw[FEC_RSM];
+
+    SHA256_CTX ecc_ctx;
+    SHA256_Init(&ecc_ctx);
+
+    for (uint64_t s = 0; s < img->rounds; ++s) {
+        uint64_t rsb = s * FEC_BLOCKSIZE;
+
+        for (int i = 0; i < img->rsn; ++i) {
+            uint64_t interleaved = fec_ecc_interleave(rsb * img->rsn + i,
+                                        img->rsn, img->rounds);
+            uint8_t *p = &stripe[i * FEC_BLOCKSIZE];
+
+            if (interleaved < img->fec_start) {
+                if (!pread_all(img->fd, p, FEC_BLOCKSIZE, interleaved)) {
+                    free_rs_char(rs);
+                    return false;
+                }
+            } else {
+                /* blocks past the input area are treated as zeros */
+                memset(p, 0, FEC_BLOCKSIZE);
+            }
+        }
+
+        for (int j = 0; j < FEC_BLOCKSIZE; ++j) {
+            for (int i = 0; i < img->rsn; ++i) {
+                cw[i] = stripe[i * FEC_BLOCKSIZE + j];
+            }
+
+            encode_rs_char(rs, cw, &parity[j * roots]);
+        }
+
+        if (!pwrite_all(img->fd, parity.data(), parity.size(),
+                img->fec_start + rsb * roots)) {
+            free_rs_char(rs);
+            return false;
+        }
+
+        SHA256_Update(&ecc_ctx, parity.data(), parity.size());
+    }
+
+    free_rs_char(rs);
+
+    /* ecc header block, with a backup copy at the end of the block */
+    uint64_t fec_size = img->rounds * roots * FEC_BLOCKSIZE;
+
+    fec_header header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = FEC_MAGIC;
+    header.version = FEC_VERSION;
+    header.size = sizeof(fec_header);
+    header.roots = roots;
+    header.fec_size = fec_size;
+    header.inp_size = img->fec_start;
+    SHA256_Final(header.hash, &ecc_ctx);
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, &header, sizeof(header));
+    memcpy(&block[FEC_BLOCKSIZE - sizeof(header)], &header, sizeof(header));
+
+    return pwrite_all(img->fd, block, FEC_BLOCKSIZE,
+                img->fec_start + fec_size);
+}
+
+/* a saved copy of a block overwritten by `corrupt_stripes' */
+struct saved_block {
+    uint64_t offset;
+    uint8_t data[FEC_BLOCKSIZE];
+};
+
+/* returns true for stripes that fall into an evenly spread `percent' of
+   all stripes */
+static inline bool stripe_selected(uint64_t s, unsigned percent)
+{
+    return (s * percent) / 100 != ((s + 1) * percent) / 100;
+}
+
+/* corrupts `blocks_per_stripe' payload blocks in an evenly spread
+   `percent' of the RS stripes, remembering the original contents in
+   `saved'; data block i belongs to stripe i % rounds, so candidates for
+   a stripe are found by stepping through the payload `rounds' blocks at
+   a time */
+static bool corrupt_stripes(image *img, unsigned percent,
+        int blocks_per_stripe, std::vector<saved_block> *saved)
+{
+    uint64_t stripes = 0;
+
+    for (uint64_t s = 0; s < img->rounds; ++s) {
+        if (!stripe_selected(s, percent)) {
+            continue;
+        }
+
+        /* only corrupt stripes with enough payload blocks, so the
+           requested number of errors per codeword is exact */
+        if (s + (uint64_t)(blocks_per_stripe - 1) * img->rounds >=
+                img->data_blocks) {
+            continue;
+        }
+
+        for (int m = 0; m < blocks_per_stripe; ++m) {
+            saved_block sb;
+            sb.offset = (s + (uint64_t)m * img->rounds) * FEC_BLOCKSIZE;
+
+            if (!pread_all(img->fd, sb.data, FEC_BLOCKSIZE, sb.offset)) {
+                return false;
+            }
+
+            uint8_t bad[FEC_BLOCKSIZE];
+
+            /* change every byte, so every codeword of the stripe sees an
+               error in this block */
+            for (int i = 0; i < FEC_BLOCKSIZE; ++i) {
+                bad[i] = sb.data[i] ^ 0x5a;
+            }
+
+            if (!pwrite_all(img->fd, bad, FEC_BLOCKSIZE, sb.offset)) {
+                return false;
+            }
+
+            saved->push_back(sb);
+        }
+
+        ++stripes;
+    }
+
+    if (!stripes) {
+        fprintf(stderr, "no stripes corrupted\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* restores the blocks saved by `corrupt_stripes' */
+static bool restore_blocks(image *img, const std::vector<saved_block>& saved)
+{
+    for (const auto& sb : saved) {
+        if (!pwrite_all(img->fd, sb.data, FEC_BLOCKSIZE, sb.offset)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* reads the whole payload sequentially through fec_pread and returns the
+   throughput in MB/s, or -1.0 on failure; large reads let `process' fan
+   the work out across its worker threads */
+static double bench_sequential(image *img)
+{
+    fec::io input(img->path, O_RDONLY, 0, img->roots);
+
+    if (!input) {
+        return -1.0;
+    }
+
+    std::unique_ptr<uint8_t[]> buffer(new (std::nothrow)
+                                        uint8_t[SEQ_READ_SIZE]);
+
+    if (!buffer) {
+        return -1.0;
+    }
+
+    uint64_t size = img->data_blocks * FEC_BLOCKSIZE;
+    uint64_t offset = 0;
+    double start = now();
+
+    while (offset < size) {
+        size_t count = SEQ_READ_SIZE;
+
+        if (count > size - offset) {
+            count = (size_t)(size - offset);
+        }
+
+        if (input.pread(buffer.get(), count, offset) != (ssize_t)count) {
+            fprintf(stderr, "fec_pread failed at %" PRIu64 "\n", offset);
+            return -1.0;
+        }
+
+        offset += count;
+    }
+
+    double elapsed = now() - start;
+    return size / (1024.0 * 1024.0) / elapsed;
+}
+
+struct random_read_info {
+    int id;
+    fec::io *input;
+    uint64_t data_blocks;
+    uint64_t reads;
+    int rc;
+};
+
+/* thread function for `bench_random'; block-aligned 4 KiB reads keep each
+   fec_pread on a single worker thread, so concurrency comes only from the
+   client threads */
+static void * __random_reads(void *cookie)
+{
+    random_read_info *r = static_cast<random_read_info *>(cookie);
+    uint8_t block[FEC_BLOCKSIZE];
+    uint64_t prng = 0xbeefcafe00000000ull | (r->id + 1);
+
+    r->rc = 0;
+
+    for (uint64_t i = 0; i < r->reads; ++i) {
+        uint64_t offset = (xorshift(&prng) % r->data_blocks) * FEC_BLOCKSIZE;
+
+        if (r->input->pread(block, FEC_BLOCKSIZE, offset) != FEC_BLOCKSIZE) {
+            fprintf(stderr, "fec_pread failed at %" PRIu64 "\n", offset);
+            r->rc = -1;
+            break;
+        }
+    }
+
+    return r;
+}
+
+/* reads the payload once in random 4 KiB blocks spread over `threads'
+   client threads sharing one handle, and returns the throughput in MB/s */
+static double bench_random(image *img, int threads)
+{
+    fec::io input(img->path, O_RDONLY, 0, img->roots);
+
+    if (!input) {
+        return -1.0;
+    }
+
+    std::vector<pthread_t> handles;
+    random_read_info info[threads];
+    uint64_t reads_per_thread = img->data_blocks / threads;
+
+    double start = now();
+
+    for (int i = 0; i < threads; ++i) {
+        info[i].id = i;
+        info[i].input = &input;
+        info[i].data_blocks = img->data_blocks;
+        info[i].reads = reads_per_thread;
+        info[i].rc = -1;
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, __random_reads, &info[i]) != 0) {
+            fprintf(stderr, "failed to create thread: %s\n", strerror(errno));
+            return -1.0;
+        }
+
+        handles.push_back(thread);
+    }
+
+    int rc = 0;
+
+    for (auto thread : handles) {
+        random_read_info *r = NULL;
+
+        if (pthread_join(thread, (void **)&r) != 0 || !r || r->rc == -1) {
+            rc = -1;
+        }
+    }
+
+    if (rc == -1) {
+        return -1.0;
+    }
+
+    double elapsed = now() - start;
+    uint64_t bytes = reads_per_thread * threads * FEC_BLOCKSIZE;
+
+    return bytes / (1024.0 * 1024.0) / elapsed;
+}
+
+/* loads "name value" lines written by a previous -o run */
+static bool load_baseline(const char *path, std::map<std::string,
+        double> *baseline)
+{
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char name[128];
+    double mbs;
+
+    while (fscanf(fp, "%127s %lf", name, &mbs) == 2) {
+        (*baseline)[name] = mbs;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+static bool save_baseline(const char *path, const std::vector<result>& results)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    for (const auto& r : results) {
+        fprintf(fp, "%s %.2f\n", r.name.c_str(), r.mbs);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/* compares results against a baseline; a result more than `tolerance'
+   percent below the baseline is a regression */
+static int compare_baseline(const std::map<std::string, double>& baseline,
+        const std::vector<result>& results, unsigned tolerance)
+{
+    int rc = 0;
+
+    for (const auto& r : results) {
+        auto it = baseline.find(r.name);
+
+        if (it == baseline.end()) {
+            printf("%-24s %8.2f MB/s  (no baseline)\n", r.name.c_str(),
+                r.mbs);
+            continue;
+        }
+
+        double limit = it->second * (100 - tolerance) / 100.0;
+        bool ok = r.mbs >= limit;
+
+        printf("%-24s %8.2f MB/s  baseline %8.2f  %s\n", r.name.c_str(),
+            r.mbs, it->second, ok ? "ok" : "REGRESSION");
+
+        if (!ok) {
+            rc = 1;
+        }
+    }
+
+    return rc;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "usage: %s [options] image_file\n"
+        "options:\n"
+        "  -s size    image payload size in MiB (default %u)\n"
+        "  -r roots   number of RS parity bytes (default %u)\n"
+        "  -p percent percent of stripes to corrupt (default %u)\n"
+        "  -b file    compare results against a baseline file\n"
+        "  -o file    save results as a baseline file\n"
+        "  -T percent allowed regression when comparing (default %u)\n",
+        argv0, DEFAULT_SIZE_MB, FEC_DEFAULT_ROOTS, DEFAULT_CORRUPT_PERCENT,
+        DEFAULT_TOLERANCE_PERCENT);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t size_mb = DEFAULT_SIZE_MB;
+    int roots = FEC_DEFAULT_ROOTS;
+    unsigned corrupt_percent = DEFAULT_CORRUPT_PERCENT;
+    unsigned tolerance = DEFAULT_TOLERANCE_PERCENT;
+    const char *baseline_file = NULL;
+    const char *output_file = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:r:p:b:o:T:h")) != -1) {
+        switch (c) {
+        case 's':
+            size_mb = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+            roots = atoi(optarg);
+            break;
+        case 'p':
+            corrupt_percent = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            baseline_file = optarg;
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        case 'T':
+            tolerance = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1 || !size_mb || roots <= 1 || roots >= FEC_RSM ||
+            corrupt_percent == 0 || corrupt_percent > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    image img;
+
+    printf("generating %" PRIu64 " MiB image with %d roots...\n", size_mb,
+        roots);
+
+    if (!generate_image(&img, path, size_mb, roots)) {
+        return 1;
+    }
+
+    printf("%" PRIu64 " data blocks, %" PRIu64 " stripes\n", img.data_blocks,
+        img.rounds);
+
+    std::vector<result> results;
+    const int thread_counts[] = { 1, 2, 4, 8 };
+
+    /* clean path: every block hash checked, no corrections */
+    results.push_back({ "clean_seq", bench_sequential(&img) });
+
+    for (int threads : thread_counts) {
+        char name[32];
+        snprintf(name, sizeof(name), "clean_rand4k_t%d", threads);
+        results.push_back({ name, bench_random(&img, threads) });
+    }
+
+    /* corruption path: one bad block per stripe, corrected by RS decoding
+       without erasure locations */
+    std::vector<saved_block> saved;
+
+    if (!corrupt_stripes(&img, corrupt_percent, 1, &saved)) {
+        return 1;
+    }
+
+    results.push_back({ "corrupt_seq", bench_sequential(&img) });
+
+    if (!restore_blocks(&img, saved)) {
+        return 1;
+    }
+
+    /* erasure path: `roots' bad blocks per stripe; plain decoding fails
+       and correction falls back to erasure locations from verity */
+    saved.clear();
+
+    if (!corrupt_stripes(&img, corrupt_percent, roots, &saved)) {
+        return 1;
+    }
+
+    results.push_back({ "erasure_seq", bench_sequential(&img) });
+
+    if (!restore_blocks(&img, saved)) {
+        return 1;
+    }
+
+    for (const auto& r : results) {
+        if (r.mbs < 0) {
+            fprintf(stderr, "benchmark '%s' failed\n", r.name.c_str());
+            return 1;
+        }
+    }
+
+    int rc = 0;
+
+    if (baseline_file) {
+        std::map<std::string, double> baseline;
+
+        if (!load_baseline(baseline_file, &baseline)) {
+            return 1;
+        }
+
+        rc = compare_baseline(baseline, results, tolerance);
+    } else {
+        for (const auto& r : results) {
+            printf("%-24s %8.2f MB/s\n", r.name.c_str(), r.mbs);
+        }
+    }
+
+    if (output_file && !save_baseline(output_file, results)) {
+        return 1;
+    }
+
+    return rc;
+}
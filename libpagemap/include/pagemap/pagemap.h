@@ -29,13 +29,6 @@ __BEGIN_DECLS
 
 typedef struct pm_proportional_swap pm_proportional_swap_t;
 
-typedef struct pm_swap_offset pm_swap_offset_t;
-
-struct pm_swap_offset {
-    unsigned int offset;
-    SIMPLEQ_ENTRY(pm_swap_offset) simpleqe;
-};
-
 typedef struct pm_memusage pm_memusage_t;
 
 /* Holds the various metrics for memory usage of a process or a mapping. */
@@ -45,9 +38,13 @@ struct pm_memusage {
     size_t pss;
     size_t uss;
     size_t swap;
-    /* if non NULL then use swap_offset_list to compute proportional swap */
+    /* if non NULL then use the collected swap offsets to compute
+     * proportional swap */
     pm_proportional_swap_t *p_swap;
-    SIMPLEQ_HEAD(simpleqhead, pm_swap_offset) swap_offset_list;
+    /* swap slots referenced by this usage, as a growable array */
+    unsigned int *swap_offsets;
+    size_t swap_offsets_count;
+    size_t swap_offsets_size;
 };
 
 typedef struct pm_swapusage pm_swapusage_t;
@@ -62,6 +59,10 @@ void pm_memusage_zero(pm_memusage_t *mu);
 void pm_memusage_add(pm_memusage_t *a, pm_memusage_t *b);
 /* Adds a swap offset */
 void pm_memusage_pswap_add_offset(pm_memusage_t *mu, unsigned int offset);
+/* Registers all collected swap offsets with the global slot counts, taking
+ * the handle lock once for the whole batch.  Called after a scan has
+ * finished adding offsets; pm_memusage_add does not re-register. */
+void pm_memusage_pswap_commit(pm_memusage_t *mu);
 /* Enable proportional swap computing. */
 void pm_memusage_pswap_init_handle(pm_memusage_t *mu, pm_proportional_swap_t *p_swap);
 /* Computes and return the proportional swap */
@@ -109,6 +110,11 @@ struct pm_map {
     int flags;
 
     char *name;
+
+    /* usage from the last scan, reused by pm_process_usage_cached while
+     * no page in the map has been written (soft-dirty tracking) */
+    pm_memusage_t usage_cache;
+    int usage_cached;
 };
 
 /* Create a pm_kernel_t. */
@@ -131,6 +137,18 @@ int pm_kernel_count(pm_kernel_t *ker, uint64_t pfn, uint64_t *count_out);
  */
 int pm_kernel_flags(pm_kernel_t *ker, uint64_t pfn, uint64_t *flags_out);
 
+/* Get the map counts of a batch of physical frames.  Adjacent PFNs are
+ * coalesced into a single read.  counts_out must have room for len
+ * entries, returned in the same order as pfns. */
+int pm_kernel_count_batch(pm_kernel_t *ker, const uint64_t *pfns, size_t len,
+                          uint64_t *counts_out);
+
+/* Get the page flags of a batch of physical frames.  Adjacent PFNs are
+ * coalesced into a single read.  flags_out must have room for len
+ * entries, returned in the same order as pfns. */
+int pm_kernel_flags_batch(pm_kernel_t *ker, const uint64_t *pfns, size_t len,
+                          uint64_t *flags_out);
+
 /* Destroy a pm_kernel_t. */
 int pm_kernel_destroy(pm_kernel_t *ker);
 
@@ -153,6 +171,22 @@ int pm_process_usage_flags(pm_process_t *proc, pm_memusage_t *usage_out,
  * (if reset != 0). */
 int pm_process_workingset(pm_process_t *proc, pm_memusage_t *ws_out, int reset);
 
+/* Re-read /proc/pid/maps.  Maps whose entry is unchanged keep their
+ * cached usage; added, moved or dropped maps are picked up. */
+int pm_process_refresh(pm_process_t *proc);
+
+/* Get the total memory usage of a process, reusing each map's cached
+ * usage when no page of the map has been written since the last call to
+ * pm_process_clear_soft_dirty.  Usage of shared pages may be stale until
+ * this process touches them; proportional swap is not computed.  For
+ * periodic sampling, call pm_process_refresh, then this, then
+ * pm_process_clear_soft_dirty. */
+int pm_process_usage_cached(pm_process_t *proc, pm_memusage_t *usage_out);
+
+/* Clear the kernel's soft-dirty bits for the process, starting a new
+ * interval for pm_process_usage_cached. */
+int pm_process_clear_soft_dirty(pm_process_t *proc);
+
 /* Get the PFNs corresponding to a range of virtual addresses.
  * The array of PFNs is returned through *range_out, and the caller has the
  * responsibility to free it. */
@@ -165,6 +199,7 @@ int pm_process_pagemap_range(pm_process_t *proc,
 #define PM_PAGEMAP_PRESENT(x)     (_BITS(x, 63, 1))
 #define PM_PAGEMAP_SWAPPED(x)     (_BITS(x, 62, 1))
 #define PM_PAGEMAP_SHIFT(x)       (_BITS(x, 55, 6))
+#define PM_PAGEMAP_SOFT_DIRTY(x)  (_BITS(x, 55, 1))
 #define PM_PAGEMAP_PFN(x)         (_BITS(x, 0, 55))
 #define PM_PAGEMAP_SWAP_OFFSET(x) (_BITS(x, 5, 50))
 #define PM_PAGEMAP_SWAP_TYPE(x)   (_BITS(x, 0,  5))
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Scan-rate benchmark for libpagemap.
+ *
+ * Spawns a synthetic target process with a controlled number of anonymous
+ * mappings, then measures the three operations procrank/librank/ksminfo
+ * spend their time in: parsing /proc/pid/maps, reading pagemap entries,
+ * and batched kpageflags queries.
+ *
+ * Results are printed as JSON on stdout.  A baseline can be recorded with
+ * -o and compared against with -b; any result more than the tolerance
+ * below the baseline fails the run, for use as a CI regression gate.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pagemap/pagemap.h>
+
+static double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Spawns a child with `nmaps` anonymous mappings of `pages_per_map`
+ * touched pages each.  A one-page hole is left after every mapping so
+ * the kernel cannot merge adjacent vmas and the mapping count stays
+ * exactly what was asked for.  The child signals readiness through a
+ * pipe and then sleeps until killed.
+ */
+static pid_t spawn_target(size_t nmaps, size_t pages_per_map,
+                          size_t pagesize) {
+  int ready[2];
+  pid_t pid;
+  char c;
+
+  if (pipe(ready)) {
+    perror("pipe");
+    return -1;
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+
+  if (pid == 0) {
+    close(ready[0]);
+    for (size_t i = 0; i < nmaps; i++) {
+      uint8_t* p = static_cast<uint8_t*>(
+          mmap(NULL, (pages_per_map + 1) * pagesize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (p == MAP_FAILED) _exit(1);
+      if (munmap(p + pages_per_map * pagesize, pagesize)) _exit(1);
+      for (size_t j = 0; j < pages_per_map; j++) {
+        p[j * pagesize] = static_cast<uint8_t>(i + j);
+      }
+    }
+    c = 1;
+    if (write(ready[1], &c, 1) != 1) _exit(1);
+    while (true) pause();
+    _exit(0);
+  }
+
+  close(ready[1]);
+  if (read(ready[0], &c, 1) != 1) {
+    fprintf(stderr, "target process failed to set up\n");
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(ready[0]);
+    return -1;
+  }
+  close(ready[0]);
+  return pid;
+}
+
+/* repeatedly create the process interface, which parses /proc/pid/maps */
+static double bench_maps_parse(pm_kernel_t* ker, pid_t pid, double min_time) {
+  size_t iters = 0;
+  double start = now_s();
+  double elapsed;
+
+  do {
+    pm_process_t* proc;
+    pm_map_t** maps;
+    size_t num_maps;
+
+    if (pm_process_create(ker, pid, &proc)) {
+      fprintf(stderr, "error parsing maps of %d\n", pid);
+      exit(EXIT_FAILURE);
+    }
+    if (pm_process_maps(proc, &maps, &num_maps)) {
+      fprintf(stderr, "error listing maps of %d\n", pid);
+      exit(EXIT_FAILURE);
+    }
+    free(maps);
+    pm_process_destroy(proc);
+    iters++;
+    elapsed = now_s() - start;
+  } while (elapsed < min_time);
+
+  return iters / elapsed;
+}
+
+/* read the pagemap entries of every mapping; returns pages per second */
+static double bench_pagemap(pm_process_t* proc, pm_map_t** maps,
+                            size_t num_maps, double min_time) {
+  size_t pages = 0;
+  double start = now_s();
+  double elapsed;
+
+  do {
+    for (size_t i = 0; i < num_maps; i++) {
+      uint64_t* pagemap;
+      size_t len;
+
+      if (pm_map_pagemap(maps[i], &pagemap, &len)) {
+        fprintf(stderr, "error reading pagemap\n");
+        exit(EXIT_FAILURE);
+      }
+      pages += len;
+      free(pagemap);
+    }
+    elapsed = now_s() - start;
+  } while (elapsed < min_time);
+
+  return pages / elapsed;
+}
+
+/* batched kpageflags lookups over the target's present pages */
+static double bench_kpageflags(pm_kernel_t* ker, pm_process_t* proc,
+                               pm_map_t** maps, size_t num_maps,
+                               double min_time) {
+  std::vector<uint64_t> pfns;
+  std::vector<uint64_t> flags;
+  size_t queried = 0;
+  double start, elapsed;
+
+  for (size_t i = 0; i < num_maps; i++) {
+    uint64_t* pagemap;
+    size_t len;
+
+    if (pm_map_pagemap(maps[i], &pagemap, &len)) {
+      fprintf(stderr, "error reading pagemap\n");
+      exit(EXIT_FAILURE);
+    }
+    for (size_t j = 0; j < len; j++) {
+      if (PM_PAGEMAP_PRESENT(pagemap[j])) {
+        pfns.push_back(PM_PAGEMAP_PFN(pagemap[j]));
+      }
+    }
+    free(pagemap);
+  }
+
+  if (pfns.empty()) {
+    fprintf(stderr, "target has no present pages?\n");
+    exit(EXIT_FAILURE);
+  }
+  flags.resize(pfns.size());
+
+  start = now_s();
+  do {
+    if (pm_kernel_flags_batch(ker, pfns.data(), pfns.size(), flags.data())) {
+      fprintf(stderr, "error reading kpageflags (root required)\n");
+      exit(EXIT_FAILURE);
+    }
+    queried += pfns.size();
+    elapsed = now_s() - start;
+  } while (elapsed < min_time);
+
+  return queried / elapsed;
+}
+
+static void usage(const char* myname) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "    -n N   number of mappings in the synthetic target (default 1000)\n"
+          "    -p N   pages per mapping (default 4)\n"
+          "    -t S   minimum measuring time per benchmark in seconds (default 0.5)\n"
+          "    -o F   write results to baseline file F\n"
+          "    -b F   compare results against baseline file F\n"
+          "    -T P   regression tolerance in percent for -b (default 10)\n"
+          "    -h     display this help screen\n",
+          myname);
+}
+
+int main(int argc, char** argv) {
+  size_t nmaps = 1000;
+  size_t pages_per_map = 4;
+  double min_time = 0.5;
+  const char* baseline_out = NULL;
+  const char* baseline_in = NULL;
+  double tolerance = 10.0;
+  int opt;
+  int rc = EXIT_SUCCESS;
+
+  while ((opt = getopt(argc, argv, "n:p:t:o:b:T:h")) != -1) {
+    switch (opt) {
+      case 'n':
+        nmaps = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        pages_per_map = strtoul(optarg, NULL, 0);
+        break;
+      case 't':
+        min_time = strtod(optarg, NULL);
+        break;
+      case 'o':
+        baseline_out = optarg;
+        break;
+      case 'b':
+        baseline_in = optarg;
+        break;
+      case 'T':
+        tolerance = strtod(optarg, NULL);
+        break;
+      case 'h':
+        usage(argv[0]);
+        exit(EXIT_SUCCESS);
+      default:
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (nmaps == 0 || pages_per_map == 0 || min_time <= 0) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  pm_kernel_t* ker;
+  if (pm_kernel_create(&ker)) {
+    fprintf(stderr,
+            "Error creating kernel interface -- "
+            "does this kernel have pagemap?\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pid_t target = spawn_target(nmaps, pages_per_map, pm_kernel_pagesize(ker));
+  if (target < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  std::map<std::string, double> results;
+  results["maps_parse_per_s"] = bench_maps_parse(ker, target, min_time);
+
+  pm_process_t* proc;
+  pm_map_t** maps;
+  size_t num_maps;
+  if (pm_process_create(ker, target, &proc) ||
+      pm_process_maps(proc, &maps, &num_maps)) {
+    fprintf(stderr, "error creating process interface for %d\n", target);
+    kill(target, SIGKILL);
+    waitpid(target, NULL, 0);
+    exit(EXIT_FAILURE);
+  }
+
+  results["pagemap_pages_per_s"] = bench_pagemap(proc, maps, num_maps, min_time);
+  results["kpageflags_pfns_per_s"] =
+      bench_kpageflags(ker, proc, maps, num_maps, min_time);
+
+  free(maps);
+  pm_process_destroy(proc);
+  kill(target, SIGKILL);
+  waitpid(target, NULL, 0);
+
+  printf("{\n");
+  printf("  \"nmaps\": %zu,\n", nmaps);
+  printf("  \"pages_per_map\": %zu,\n", pages_per_map);
+  printf("  \"results\": {\n");
+  size_t n = 0;
+  for (const auto& r : results) {
+    printf("    \"%s\": %.1f%s\n", r.first.c_str(), r.second,
+           ++n < results.size() ? "," : "");
+  }
+  printf("  }\n");
+  printf("}\n");
+
+  if (baseline_out) {
+    FILE* f = fopen(baseline_out, "w");
+    if (!f) {
+      perror("fopen");
+      exit(EXIT_FAILURE);
+    }
+    for (const auto& r : results) {
+      fprintf(f, "%s %.1f\n", r.first.c_str(), r.second);
+    }
+    fclose(f);
+  }
+
+  if (baseline_in) {
+    FILE* f = fopen(baseline_in, "r");
+    if (!f) {
+      perror("fopen");
+      exit(EXIT_FAILURE);
+    }
+    char name[64];
+    double value;
+    while (fscanf(f, "%63s %lf", name, &value) == 2) {
+      auto it = results.find(name);
+      if (it == results.end()) {
+        fprintf(stderr, "unknown baseline entry %s\n", name);
+        continue;
+      }
+      if (it->second < value * (1.0 - tolerance / 100.0)) {
+        fprintf(stderr, "REGRESSION %s: %.1f -> %.1f (-%.1f%%)\n", name,
+                value, it->second, 100.0 * (1.0 - it->second / value));
+        rc = EXIT_FAILURE;
+      }
+    }
+    fclose(f);
+  }
+
+  return rc;
+}
@@ -129,6 +129,98 @@ int pm_kernel_count(pm_kernel_t *ker, uint64_t pfn, uint64_t *count_out) {
     return 0;
 }
 
+/* Largest span of PFNs fetched with a single read (512KB buffer). */
+#define BATCH_MAX_RUN_PAGES 65536
+
+struct pfn_ref {
+    uint64_t pfn;
+    size_t idx;
+};
+
+static int compare_pfn_refs(const void *a, const void *b) {
+    const struct pfn_ref *ref_a = a;
+    const struct pfn_ref *ref_b = b;
+
+    if (ref_a->pfn < ref_b->pfn)
+        return -1;
+    if (ref_a->pfn > ref_b->pfn)
+        return 1;
+    return 0;
+}
+
+/* Read one 8-byte record per PFN from fd, coalescing sorted runs of
+ * adjacent PFNs into single preads.  Results are returned in the order
+ * the PFNs were passed in. */
+static int kernel_read_batch(int fd, const uint64_t *pfns, size_t len,
+                             uint64_t *out) {
+    struct pfn_ref *refs;
+    uint64_t *buf;
+    uint64_t first;
+    size_t start, end, span, i;
+    ssize_t bytes;
+    int error = 0;
+
+    if (len == 0)
+        return 0;
+
+    refs = malloc(len * sizeof(struct pfn_ref));
+    if (!refs)
+        return errno;
+
+    for (i = 0; i < len; i++) {
+        refs[i].pfn = pfns[i];
+        refs[i].idx = i;
+    }
+    qsort(refs, len, sizeof(struct pfn_ref), compare_pfn_refs);
+
+    buf = malloc(BATCH_MAX_RUN_PAGES * sizeof(uint64_t));
+    if (!buf) {
+        error = errno;
+        free(refs);
+        return error;
+    }
+
+    for (start = 0; start < len; start = end) {
+        first = refs[start].pfn;
+
+        end = start + 1;
+        while (end < len && refs[end].pfn - refs[end - 1].pfn <= 1 &&
+               refs[end].pfn - first < BATCH_MAX_RUN_PAGES)
+            end++;
+
+        span = refs[end - 1].pfn - first + 1;
+        bytes = span * sizeof(uint64_t);
+        if (pread64(fd, buf, bytes, first * sizeof(uint64_t)) != bytes) {
+            error = errno;
+            break;
+        }
+
+        for (i = start; i < end; i++)
+            out[refs[i].idx] = buf[refs[i].pfn - first];
+    }
+
+    free(buf);
+    free(refs);
+
+    return error;
+}
+
+int pm_kernel_count_batch(pm_kernel_t *ker, const uint64_t *pfns, size_t len,
+                          uint64_t *counts_out) {
+    if (!ker || (!pfns && len) || (!counts_out && len))
+        return -1;
+
+    return kernel_read_batch(ker->kpagecount_fd, pfns, len, counts_out);
+}
+
+int pm_kernel_flags_batch(pm_kernel_t *ker, const uint64_t *pfns, size_t len,
+                          uint64_t *flags_out) {
+    if (!ker || (!pfns && len) || (!flags_out && len))
+        return -1;
+
+    return kernel_read_batch(ker->kpageflags_fd, pfns, len, flags_out);
+}
+
 int pm_kernel_flags(pm_kernel_t *ker, uint64_t pfn, uint64_t *flags_out) {
     off64_t off;
 
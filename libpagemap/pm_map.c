@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,8 +31,8 @@ int pm_map_pagemap(pm_map_t *map, uint64_t **pagemap_out, size_t *len) {
 int pm_map_usage_flags(pm_map_t *map, pm_memusage_t *usage_out,
                         uint64_t flags_mask, uint64_t required_flags) {
     uint64_t *pagemap;
-    size_t len, i;
-    uint64_t count;
+    uint64_t *pfns = NULL, *flags = NULL, *counts = NULL;
+    size_t len, npfns, i;
     pm_memusage_t usage;
     int error;
 
@@ -44,6 +45,17 @@ int pm_map_usage_flags(pm_map_t *map, pm_memusage_t *usage_out,
     pm_memusage_zero(&usage);
     pm_memusage_pswap_init_handle(&usage, usage_out->p_swap);
 
+    if (len) {
+        pfns = malloc(len * sizeof(uint64_t));
+        if (!pfns) {
+            error = errno;
+            goto out;
+        }
+    }
+
+    /* account the entries that don't need the kernel files, and collect
+     * the PFNs of the present pages for batched lookups */
+    npfns = 0;
     for (i = 0; i < len; i++) {
         usage.vss += map->proc->ker->pagesize;
 
@@ -52,34 +64,61 @@ int pm_map_usage_flags(pm_map_t *map, pm_memusage_t *usage_out,
             continue;
 
         if (!PM_PAGEMAP_SWAPPED(pagemap[i])) {
-            if (flags_mask) {
-                uint64_t flags;
-                error = pm_kernel_flags(map->proc->ker, PM_PAGEMAP_PFN(pagemap[i]),
-                                        &flags);
-                if (error) goto out;
-
-                if ((flags & flags_mask) != required_flags)
-                    continue;
-            }
-
-            error = pm_kernel_count(map->proc->ker, PM_PAGEMAP_PFN(pagemap[i]),
-                                    &count);
-            if (error) goto out;
-
-            usage.rss += (count >= 1) ? map->proc->ker->pagesize : (0);
-            usage.pss += (count >= 1) ? (map->proc->ker->pagesize / count) : (0);
-            usage.uss += (count == 1) ? (map->proc->ker->pagesize) : (0);
+            pfns[npfns++] = PM_PAGEMAP_PFN(pagemap[i]);
         } else {
             usage.swap += map->proc->ker->pagesize;
             pm_memusage_pswap_add_offset(&usage, PM_PAGEMAP_SWAP_OFFSET(pagemap[i]));
         }
     }
 
+    if (flags_mask && npfns) {
+        size_t kept;
+
+        flags = malloc(npfns * sizeof(uint64_t));
+        if (!flags) {
+            error = errno;
+            goto out;
+        }
+
+        error = pm_kernel_flags_batch(map->proc->ker, pfns, npfns, flags);
+        if (error) goto out;
+
+        kept = 0;
+        for (i = 0; i < npfns; i++) {
+            if ((flags[i] & flags_mask) == required_flags)
+                pfns[kept++] = pfns[i];
+        }
+        npfns = kept;
+    }
+
+    if (npfns) {
+        counts = malloc(npfns * sizeof(uint64_t));
+        if (!counts) {
+            error = errno;
+            goto out;
+        }
+
+        error = pm_kernel_count_batch(map->proc->ker, pfns, npfns, counts);
+        if (error) goto out;
+
+        for (i = 0; i < npfns; i++) {
+            usage.rss += (counts[i] >= 1) ? map->proc->ker->pagesize : (0);
+            usage.pss += (counts[i] >= 1) ? (map->proc->ker->pagesize / counts[i]) : (0);
+            usage.uss += (counts[i] == 1) ? (map->proc->ker->pagesize) : (0);
+        }
+    }
+
+    /* register this map's swap slots with the global counts in one batch */
+    pm_memusage_pswap_commit(&usage);
+
     memcpy(usage_out, &usage, sizeof(usage));
 
     error = 0;
 
 out:
+    free(counts);
+    free(flags);
+    free(pfns);
     free(pagemap);
 
     return error;
@@ -91,8 +130,9 @@ int pm_map_usage(pm_map_t *map, pm_memusage_t *usage_out) {
 
 int pm_map_workingset(pm_map_t *map, pm_memusage_t *ws_out) {
     uint64_t *pagemap;
-    size_t len, i;
-    uint64_t count, flags;
+    uint64_t *pfns = NULL, *flags = NULL, *counts = NULL;
+    size_t *referenced = NULL;
+    size_t len, nref, i;
     pm_memusage_t ws;
     int error;
 
@@ -104,23 +144,48 @@ int pm_map_workingset(pm_map_t *map, pm_memusage_t *ws_out) {
 
     pm_memusage_zero(&ws);
 
+    if (len) {
+        pfns = malloc(len * sizeof(uint64_t));
+        flags = malloc(len * sizeof(uint64_t));
+        referenced = malloc(len * sizeof(size_t));
+        if (!pfns || !flags || !referenced) {
+            error = errno;
+            goto out;
+        }
+    }
+
+    for (i = 0; i < len; i++)
+        pfns[i] = PM_PAGEMAP_PFN(pagemap[i]);
+
+    error = pm_kernel_flags_batch(map->proc->ker, pfns, len, flags);
+    if (error) goto out;
+
+    nref = 0;
     for (i = 0; i < len; i++) {
-        error = pm_kernel_flags(map->proc->ker, PM_PAGEMAP_PFN(pagemap[i]),
-                                &flags);
-        if (error) goto out;
+        if (flags[i] & KPF_REFERENCED) {
+            referenced[nref] = i;
+            pfns[nref] = pfns[i];
+            nref++;
+        }
+    }
 
-        if (!(flags & KPF_REFERENCED))
-            continue;
+    if (nref) {
+        counts = malloc(nref * sizeof(uint64_t));
+        if (!counts) {
+            error = errno;
+            goto out;
+        }
 
-        error = pm_kernel_count(map->proc->ker, PM_PAGEMAP_PFN(pagemap[i]),
-                                &count);
+        error = pm_kernel_count_batch(map->proc->ker, pfns, nref, counts);
         if (error) goto out;
+    }
 
+    for (i = 0; i < nref; i++) {
         ws.vss += map->proc->ker->pagesize;
-        if( PM_PAGEMAP_SWAPPED(pagemap[i]) ) continue;
-        ws.rss += (count >= 1) ? (map->proc->ker->pagesize) : (0);
-        ws.pss += (count >= 1) ? (map->proc->ker->pagesize / count) : (0);
-        ws.uss += (count == 1) ? (map->proc->ker->pagesize) : (0);
+        if( PM_PAGEMAP_SWAPPED(pagemap[referenced[i]]) ) continue;
+        ws.rss += (counts[i] >= 1) ? (map->proc->ker->pagesize) : (0);
+        ws.pss += (counts[i] >= 1) ? (map->proc->ker->pagesize / counts[i]) : (0);
+        ws.uss += (counts[i] == 1) ? (map->proc->ker->pagesize) : (0);
     }
 
     memcpy(ws_out, &ws, sizeof(ws));
@@ -128,6 +193,10 @@ int pm_map_workingset(pm_map_t *map, pm_memusage_t *ws_out) {
     error = 0;
 
 out:
+    free(counts);
+    free(referenced);
+    free(flags);
+    free(pfns);
     free(pagemap);
 
     return 0;
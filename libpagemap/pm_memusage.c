@@ -14,46 +14,68 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include <pagemap/pagemap.h>
 
-#define SIMPLEQ_INSERT_SIMPLEQ_TAIL(head_a, head_b)             \
-    do {                                                        \
-        if (!SIMPLEQ_EMPTY(head_b)) {                           \
-            if ((head_a)->sqh_first == NULL)                    \
-                (head_a)->sqh_first = (head_b)->sqh_first;      \
-            *(head_a)->sqh_last = (head_b)->sqh_first;          \
-            (head_a)->sqh_last = (head_b)->sqh_last;            \
-        }                                                       \
-    } while (/*CONSTCOND*/0)
-
 /* We use an array of int to store the references to a given offset in the swap
    1 GiB swap means 512KiB size array: offset are the index */
 typedef unsigned short pm_pswap_refcount_t;
 struct pm_proportional_swap {
     unsigned int array_size;
     pm_pswap_refcount_t *offset_array;
+    /* the handle is shared between all sampled processes, which may be
+     * scanned from multiple threads */
+    pthread_mutex_t lock;
 };
 
 void pm_memusage_zero(pm_memusage_t *mu) {
     mu->vss = mu->rss = mu->pss = mu->uss = mu->swap = 0;
     mu->p_swap = NULL;
-    SIMPLEQ_INIT(&mu->swap_offset_list);
+    mu->swap_offsets = NULL;
+    mu->swap_offsets_count = mu->swap_offsets_size = 0;
 }
 
 void pm_memusage_pswap_init_handle(pm_memusage_t *mu, pm_proportional_swap_t *p_swap) {
     mu->p_swap = p_swap;
 }
 
+/* Appends an offset to the usage's growable array.  Returns 0 on success. */
+static int swap_offsets_append(pm_memusage_t *mu, unsigned int offset) {
+    if (mu->swap_offsets_count == mu->swap_offsets_size) {
+        size_t newsize = mu->swap_offsets_size ? 2 * mu->swap_offsets_size : 64;
+        unsigned int *newarray;
+
+        newarray = realloc(mu->swap_offsets, newsize * sizeof(unsigned int));
+        if (newarray == NULL) {
+            fprintf(stderr, "Error allocating swap offset array.\n");
+            return -1;
+        }
+        mu->swap_offsets = newarray;
+        mu->swap_offsets_size = newsize;
+    }
+    mu->swap_offsets[mu->swap_offsets_count++] = offset;
+    return 0;
+}
+
 void pm_memusage_add(pm_memusage_t *a, pm_memusage_t *b) {
+    size_t i;
+
     a->vss += b->vss;
     a->rss += b->rss;
     a->pss += b->pss;
     a->uss += b->uss;
     a->swap += b->swap;
-    SIMPLEQ_INSERT_SIMPLEQ_TAIL(&a->swap_offset_list, &b->swap_offset_list);
+    for (i = 0; i < b->swap_offsets_count; i++) {
+        if (swap_offsets_append(a, b->swap_offsets[i]))
+            break;
+    }
+    /* the offsets now belong to a; b commonly gets zeroed and reused */
+    free(b->swap_offsets);
+    b->swap_offsets = NULL;
+    b->swap_offsets_count = b->swap_offsets_size = 0;
 }
 
 pm_proportional_swap_t * pm_memusage_pswap_create(int swap_size)
@@ -70,6 +92,8 @@ pm_proportional_swap_t * pm_memusage_pswap_create(int swap_size)
             fprintf(stderr, "Error allocating proportional swap offset array.\n");
             free(p_swap);
             p_swap = NULL;
+        } else {
+            pthread_mutex_init(&p_swap->lock, NULL);
         }
     }
 
@@ -78,14 +102,13 @@ pm_proportional_swap_t * pm_memusage_pswap_create(int swap_size)
 
 void pm_memusage_pswap_destroy(pm_proportional_swap_t *p_swap) {
     if (p_swap) {
+        pthread_mutex_destroy(&p_swap->lock);
         free(p_swap->offset_array);
         free(p_swap);
     }
 }
 
 void pm_memusage_pswap_add_offset(pm_memusage_t *mu, unsigned int offset) {
-    pm_swap_offset_t *soff;
-
     if (mu->p_swap == NULL)
         return;
 
@@ -94,39 +117,49 @@ void pm_memusage_pswap_add_offset(pm_memusage_t *mu, unsigned int offset) {
         return;
     }
 
-    if (mu->p_swap->offset_array[offset] == USHRT_MAX) {
-        fprintf(stderr, "SWAP offset %d ref. count if overflowing ushort type.\n", offset);
-    } else {
-        mu->p_swap->offset_array[offset]++;
-    }
+    swap_offsets_append(mu, offset);
+}
+
+void pm_memusage_pswap_commit(pm_memusage_t *mu) {
+    size_t i;
+
+    if (mu->p_swap == NULL || mu->swap_offsets_count == 0)
+        return;
 
-    soff = malloc(sizeof(pm_swap_offset_t));
-    if (soff) {
-        soff->offset = offset;
-        SIMPLEQ_INSERT_TAIL(&mu->swap_offset_list, soff, simpleqe);
+    pthread_mutex_lock(&mu->p_swap->lock);
+    for (i = 0; i < mu->swap_offsets_count; i++) {
+        unsigned int offset = mu->swap_offsets[i];
+
+        if (mu->p_swap->offset_array[offset] == USHRT_MAX) {
+            fprintf(stderr, "SWAP offset %d ref. count if overflowing ushort type.\n", offset);
+        } else {
+            mu->p_swap->offset_array[offset]++;
+        }
     }
+    pthread_mutex_unlock(&mu->p_swap->lock);
 }
 
 void pm_memusage_pswap_get_usage(pm_memusage_t *mu, pm_swapusage_t *su) {
 
     int pagesize = getpagesize();
-    pm_swap_offset_t *elem;
+    size_t i;
 
     if (su == NULL)
         return;
 
     su->proportional = su->unique = 0;
-    SIMPLEQ_FOREACH(elem, &mu->swap_offset_list, simpleqe) {
-        su->proportional += pagesize / mu->p_swap->offset_array[elem->offset];
-        su->unique += mu->p_swap->offset_array[elem->offset] == 1 ? pagesize : 0;
+    for (i = 0; i < mu->swap_offsets_count; i++) {
+        pm_pswap_refcount_t count = mu->p_swap->offset_array[mu->swap_offsets[i]];
+
+        if (count == 0)
+            continue;
+        su->proportional += pagesize / count;
+        su->unique += count == 1 ? pagesize : 0;
     }
 }
 
 void pm_memusage_pswap_free(pm_memusage_t *mu) {
-    pm_swap_offset_t *elem = SIMPLEQ_FIRST(&mu->swap_offset_list);
-    while (elem) {
-        SIMPLEQ_REMOVE_HEAD(&mu->swap_offset_list, simpleqe);
-        free(elem);
-        elem = SIMPLEQ_FIRST(&mu->swap_offset_list);
-    }
+    free(mu->swap_offsets);
+    mu->swap_offsets = NULL;
+    mu->swap_offsets_count = mu->swap_offsets_size = 0;
 }
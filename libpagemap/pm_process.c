@@ -104,6 +104,150 @@ int pm_process_usage(pm_process_t *proc, pm_memusage_t *usage_out) {
     return pm_process_usage_flags(proc, usage_out, 0, 0);
 }
 
+/* Two maps entries describe the same mapping */
+static int map_matches(pm_map_t *a, pm_map_t *b) {
+    return a->start == b->start && a->end == b->end &&
+           a->offset == b->offset && a->flags == b->flags &&
+           !strcmp(a->name, b->name);
+}
+
+int pm_process_refresh(pm_process_t *proc) {
+    pm_map_t **old_maps;
+    int old_num_maps;
+    int i, j;
+    int error;
+
+    if (!proc)
+        return -1;
+
+    old_maps = proc->maps;
+    old_num_maps = proc->num_maps;
+    proc->maps = NULL;
+    proc->num_maps = 0;
+
+    error = read_maps(proc);
+    if (error) {
+        proc->maps = old_maps;
+        proc->num_maps = old_num_maps;
+        return error;
+    }
+
+    /* both lists are sorted by start address, so carry cached usage over
+     * from unchanged entries in a single merge pass */
+    j = 0;
+    for (i = 0; i < proc->num_maps; i++) {
+        while (j < old_num_maps && old_maps[j]->start < proc->maps[i]->start)
+            j++;
+
+        if (j < old_num_maps && map_matches(old_maps[j], proc->maps[i])) {
+            proc->maps[i]->usage_cache = old_maps[j]->usage_cache;
+            proc->maps[i]->usage_cached = old_maps[j]->usage_cached;
+            j++;
+        }
+    }
+
+    for (i = 0; i < old_num_maps; i++)
+        pm_map_destroy(old_maps[i]);
+    free(old_maps);
+
+    return 0;
+}
+
+/* Check whether any page of the map has its soft-dirty bit set */
+static int map_soft_dirty(pm_map_t *map, int *dirty_out) {
+    uint64_t *pagemap;
+    size_t len, i;
+    int error;
+
+    error = pm_map_pagemap(map, &pagemap, &len);
+    if (error)
+        return error;
+
+    *dirty_out = 0;
+    for (i = 0; i < len; i++) {
+        if (PM_PAGEMAP_SOFT_DIRTY(pagemap[i])) {
+            *dirty_out = 1;
+            break;
+        }
+    }
+
+    free(pagemap);
+
+    return 0;
+}
+
+int pm_process_usage_cached(pm_process_t *proc, pm_memusage_t *usage_out) {
+    pm_memusage_t usage, map_usage;
+    int error;
+    int i, dirty;
+
+    if (!proc || !usage_out)
+        return -1;
+
+    pm_memusage_zero(&usage);
+
+    for (i = 0; i < proc->num_maps; i++) {
+        pm_map_t *map = proc->maps[i];
+
+        if (map->usage_cached) {
+            error = map_soft_dirty(map, &dirty);
+            if (error) return error;
+
+            if (!dirty) {
+                pm_memusage_add(&usage, &map->usage_cache);
+                continue;
+            }
+        }
+
+        pm_memusage_zero(&map_usage);
+        error = pm_map_usage(map, &map_usage);
+        if (error) return error;
+
+        map->usage_cache = map_usage;
+        /* the copied array pointer would alias; no offsets are collected
+         * without a pswap handle, so just reset it */
+        map->usage_cache.swap_offsets = NULL;
+        map->usage_cache.swap_offsets_count = 0;
+        map->usage_cache.swap_offsets_size = 0;
+        map->usage_cached = 1;
+
+        pm_memusage_add(&usage, &map_usage);
+    }
+
+    memcpy(usage_out, &usage, sizeof(pm_memusage_t));
+
+    return 0;
+}
+
+int pm_process_clear_soft_dirty(pm_process_t *proc) {
+    char filename[MAX_FILENAME];
+    int fd;
+    int error;
+
+    if (!proc)
+        return -1;
+
+    error = snprintf(filename, MAX_FILENAME, "/proc/%d/clear_refs",
+                     proc->pid);
+    if (error < 0 || error >= MAX_FILENAME) {
+        return (error < 0) ? (errno) : (-1);
+    }
+
+    fd = open(filename, O_WRONLY);
+    if (fd < 0)
+        return errno;
+
+    if (write(fd, "4\n", strlen("4\n")) < 0) {
+        error = errno;
+        close(fd);
+        return error;
+    }
+
+    close(fd);
+
+    return 0;
+}
+
 int pm_process_pagemap_range(pm_process_t *proc,
                              uint64_t low, uint64_t high,
                              uint64_t **range_out, size_t *len) {
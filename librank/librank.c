@@ -36,6 +36,10 @@ struct process_info {
 struct mapping_info {
     struct process_info *proc;
     pm_memusage_t usage;
+    /* PFNs of the mapping's present pages, collected in the first pass
+       and resolved by the global kernel-count sweep */
+    uint64_t *pfns;
+    size_t num_pfns;
 };
 
 struct library_info {
@@ -171,6 +175,30 @@ struct process_info *get_process(pid_t pid) {
     return process;
 }
 
+static int compare_pfns(const void *a, const void *b) {
+    const uint64_t *pfn_a = a;
+    const uint64_t *pfn_b = b;
+
+    if (*pfn_a < *pfn_b) return -1;
+    if (*pfn_a > *pfn_b) return 1;
+    return 0;
+}
+
+/* Find a PFN in the sorted unique array.  The first pass put every
+   looked-up PFN there, so the search always succeeds. */
+static size_t find_pfn(const uint64_t *pfns, size_t len, uint64_t pfn) {
+    size_t lo = 0, hi = len, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (pfns[mid] < pfn)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 static int parse_perm(const char *perm)
 {
     int ret = 0;
@@ -209,13 +237,19 @@ int main(int argc, char *argv[]) {
 
     pm_map_t **maps;
     size_t num_maps;
-    pm_memusage_t map_usage;
+
+    uint64_t *pagemap;
+    size_t num_pages;
+
+    uint64_t *unique_pfns, *pfn_counts, *pfn_flags;
+    size_t total_pfns, num_unique, idx;
+    uint64_t count;
 
     struct library_info *li, **lis;
     struct mapping_info *mi, **mis;
     struct process_info *pi;
 
-    size_t i, j;
+    size_t i, j, k;
     int error;
     int perm;
     bool all;
@@ -316,7 +350,6 @@ int main(int argc, char *argv[]) {
 
     libraries = malloc(INIT_LIBRARIES * sizeof(struct library_info *));
     libraries_count = 0; libraries_size = INIT_LIBRARIES;
-    pm_memusage_zero(&map_usage);
 
     error = pm_kernel_create(&ker);
     if (error) {
@@ -359,24 +392,137 @@ int main(int argc, char *argv[]) {
 
             mi = get_mapping(li, pi);
 
-            error = pm_map_usage_flags(maps[j], &map_usage, flags_mask,
-                                       required_flags);
+            /* First pass: account what the pagemap alone can tell us and
+               remember the PFNs; the kernel counts and flags for all
+               libraries are fetched in one sweep afterwards. */
+            error = pm_map_pagemap(maps[j], &pagemap, &num_pages);
             if (error) {
-                fprintf(stderr, "Error getting map memory usage of "
+                fprintf(stderr, "Error getting pagemap of "
                                 "map %s in process %d.\n",
                         pm_map_name(maps[j]), proc->pid);
                 exit(EXIT_FAILURE);
             }
 
-            if (map_usage.swap) {
-                has_swap = true;
+            if (num_pages) {
+                mi->pfns = realloc(mi->pfns,
+                    (mi->num_pfns + num_pages) * sizeof(uint64_t));
+                if (!mi->pfns) {
+                    fprintf(stderr, "Couldn't allocate space for PFN list: %s\n", strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            for (k = 0; k < num_pages; k++) {
+                mi->usage.vss += ker->pagesize;
+
+                if (!PM_PAGEMAP_PRESENT(pagemap[k]) &&
+                        !PM_PAGEMAP_SWAPPED(pagemap[k]))
+                    continue;
+
+                if (PM_PAGEMAP_SWAPPED(pagemap[k])) {
+                    mi->usage.swap += ker->pagesize;
+                    has_swap = true;
+                } else {
+                    mi->pfns[mi->num_pfns++] = PM_PAGEMAP_PFN(pagemap[k]);
+                }
+            }
+
+            free(pagemap);
+        }
+    }
+
+    /* Second pass: one sorted kpagecount/kpageflags sweep over the
+       de-duplicated PFNs of every mapping, then distribute the results. */
+    total_pfns = 0;
+    for (i = 0; i < libraries_count; i++)
+        for (j = 0; j < libraries[i]->mappings_count; j++)
+            total_pfns += libraries[i]->mappings[j]->num_pfns;
+
+    unique_pfns = NULL;
+    pfn_counts = NULL;
+    pfn_flags = NULL;
+    num_unique = 0;
+    if (total_pfns) {
+        unique_pfns = malloc(total_pfns * sizeof(uint64_t));
+        if (!unique_pfns) {
+            fprintf(stderr, "Couldn't allocate space for PFN array: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < libraries_count; i++) {
+            for (j = 0; j < libraries[i]->mappings_count; j++) {
+                mi = libraries[i]->mappings[j];
+                memcpy(unique_pfns + num_unique, mi->pfns,
+                       mi->num_pfns * sizeof(uint64_t));
+                num_unique += mi->num_pfns;
+            }
+        }
+
+        qsort(unique_pfns, total_pfns, sizeof(uint64_t), compare_pfns);
+
+        num_unique = 0;
+        for (i = 0; i < total_pfns; i++) {
+            if (!num_unique || unique_pfns[num_unique - 1] != unique_pfns[i])
+                unique_pfns[num_unique++] = unique_pfns[i];
+        }
+
+        pfn_counts = malloc(num_unique * sizeof(uint64_t));
+        if (!pfn_counts) {
+            fprintf(stderr, "Couldn't allocate space for count array: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        error = pm_kernel_count_batch(ker, unique_pfns, num_unique, pfn_counts);
+        if (error) {
+            fprintf(stderr, "Error reading kernel page counts.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (flags_mask) {
+            pfn_flags = malloc(num_unique * sizeof(uint64_t));
+            if (!pfn_flags) {
+                fprintf(stderr, "Couldn't allocate space for flags array: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            error = pm_kernel_flags_batch(ker, unique_pfns, num_unique, pfn_flags);
+            if (error) {
+                fprintf(stderr, "Error reading kernel page flags.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    for (i = 0; i < libraries_count; i++) {
+        li = libraries[i];
+        for (j = 0; j < li->mappings_count; j++) {
+            mi = li->mappings[j];
+
+            for (k = 0; k < mi->num_pfns; k++) {
+                idx = find_pfn(unique_pfns, num_unique, mi->pfns[k]);
+
+                if (flags_mask &&
+                        (pfn_flags[idx] & flags_mask) != required_flags)
+                    continue;
+
+                count = pfn_counts[idx];
+                mi->usage.rss += (count >= 1) ? ker->pagesize : (0);
+                mi->usage.pss += (count >= 1) ? (ker->pagesize / count) : (0);
+                mi->usage.uss += (count == 1) ? ker->pagesize : (0);
             }
 
-            pm_memusage_add(&mi->usage, &map_usage);
-            pm_memusage_add(&li->total_usage, &map_usage);
+            free(mi->pfns);
+            mi->pfns = NULL;
+            mi->num_pfns = 0;
+
+            pm_memusage_add(&li->total_usage, &mi->usage);
         }
     }
 
+    free(pfn_flags);
+    free(pfn_counts);
+    free(unique_pfns);
+
     printf(" %6s   %7s   %6s   %6s   %6s  ", "RSStot", "VSS", "RSS", "PSS", "USS");
 
     if (has_swap) {
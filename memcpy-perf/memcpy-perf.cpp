@@ -21,6 +21,12 @@ size_t tot_sum = 0;
 size_t delay = 0;
 float speed = 0;
 bool dummy = false;
+string baseline_file;
+string write_baseline_file;
+double threshold_percent = 5.0;
+bool align_sweep = false;
+size_t align_step = 8;
+string align_csv_file;
 
 void __attribute__((noinline)) memcpy_noinline(void *dst, void *src, size_t size);
 void __attribute__((noinline)) memset_noinline(void *dst, int value, size_t size);
@@ -46,9 +52,254 @@ static void usage(char* p) {
            "  --start START_SIZE_MB\n"
            "    --end END_SIZE_MB (requires start, optional)\n"
            "  --samples NUM_SAMPLES\n"
+           "  --write_baseline FILE\n"
+           "    Write the per-size results to FILE for later comparison.\n"
+           "  --baseline FILE\n"
+           "    Compare this run against a baseline written by\n"
+           "    --write_baseline, bucketed by power-of-two size. Reports\n"
+           "    the crossover sizes where the faster of the two flips and\n"
+           "    exits non-zero if any bucket regresses beyond the\n"
+           "    threshold.\n"
+           "  --threshold PERCENT\n"
+           "    Regression threshold for --baseline, in percent.\n"
+           "    The default is 5.\n"
+           "  --align_sweep\n"
+           "    Instead of the size sweep, run the test at every src/dst\n"
+           "    offset within a cache line (0..63) for power-of-4 sizes\n"
+           "    between start and end, to expose alignment cliffs. memset\n"
+           "    only sweeps the destination and sum only the source.\n"
+           "  --align_step BYTES\n"
+           "    Offset increment for --align_sweep. Must divide 64.\n"
+           "    The default is 8.\n"
+           "  --align_csv FILE\n"
+           "    Write the --align_sweep results to FILE as one\n"
+           "    src-offset x dst-offset matrix of GB/s per size.\n"
            , p);
 }
 
+// Average the samples into power-of-two size buckets so runs with
+// different sample counts can be compared point-for-point.
+static vector<pair<size_t, double>> bucketResults(
+        const vector<pair<size_t, double>>& results) {
+    vector<pair<size_t, double>> buckets;
+    vector<size_t> counts;
+    for (auto& r : results) {
+        size_t bucket = (size_t)log2(r.first);
+        size_t i = 0;
+        for (; i < buckets.size(); i++) {
+            if (buckets[i].first == bucket)
+                break;
+        }
+        if (i == buckets.size()) {
+            buckets.push_back(make_pair(bucket, 0.0));
+            counts.push_back(0);
+        }
+        buckets[i].second += r.second;
+        counts[i]++;
+    }
+    for (size_t i = 0; i < buckets.size(); i++) {
+        buckets[i].second /= counts[i];
+    }
+    sort(buckets.begin(), buckets.end());
+    return buckets;
+}
+
+static int writeBaseline(const string& file,
+                         const vector<pair<size_t, double>>& results) {
+    FILE* fp = fopen(file.c_str(), "w");
+    if (fp == nullptr) {
+        printf("Cannot open %s for writing.\n", file.c_str());
+        return 1;
+    }
+    for (auto& r : results) {
+        fprintf(fp, "%zu %f\n", r.first, r.second);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Compare the bucketed results of this run against a baseline file.
+// Returns non-zero if any size bucket is more than threshold_percent
+// slower than the baseline.
+static int compareBaseline(const string& file,
+                           const vector<pair<size_t, double>>& results) {
+    FILE* fp = fopen(file.c_str(), "r");
+    if (fp == nullptr) {
+        printf("Cannot open baseline file %s.\n", file.c_str());
+        return 1;
+    }
+    vector<pair<size_t, double>> baseline_raw;
+    size_t size;
+    double perf;
+    while (fscanf(fp, "%zu %lf", &size, &perf) == 2) {
+        baseline_raw.push_back(make_pair(size, perf));
+    }
+    fclose(fp);
+    if (baseline_raw.empty()) {
+        printf("Baseline file %s contains no results.\n", file.c_str());
+        return 1;
+    }
+
+    vector<pair<size_t, double>> cur = bucketResults(results);
+    vector<pair<size_t, double>> base = bucketResults(baseline_raw);
+
+    int regressions = 0;
+    int last_sign = 0;
+    for (auto& c : cur) {
+        double base_perf = 0.0;
+        for (auto& b : base) {
+            if (b.first == c.first) {
+                base_perf = b.second;
+                break;
+            }
+        }
+        if (base_perf == 0.0)
+            continue;
+
+        double delta = (c.second - base_perf) / base_perf * 100.0;
+        bool regressed = delta < -threshold_percent;
+        printf("bucket %zu bytes: baseline %.3f GB/s, current %.3f GB/s, %+.1f%%%s\n",
+               (size_t)1 << c.first, base_perf, c.second, delta,
+               regressed ? " REGRESSION" : "");
+        if (regressed)
+            regressions++;
+
+        // A sign flip between adjacent buckets is a crossover: the size
+        // at which the faster of the two implementations changes.
+        int sign = (delta > 0.0) ? 1 : ((delta < 0.0) ? -1 : 0);
+        if (sign != 0 && last_sign != 0 && sign != last_sign) {
+            printf("crossover near %zu bytes: current becomes %s than baseline\n",
+                   (size_t)1 << c.first, (sign > 0) ? "faster" : "slower");
+        }
+        if (sign != 0)
+            last_sign = sign;
+    }
+
+    if (regressions > 0) {
+        printf("%d size bucket(s) regressed more than %.1f%%.\n",
+               regressions, threshold_percent);
+        return 1;
+    }
+    printf("No size bucket regressed more than %.1f%%.\n", threshold_percent);
+    return 0;
+}
+
+// Run the chosen test at every (src offset, dst offset) pair within a
+// cache line, for power-of-4 sizes between size_start and size_end.
+// Prints the aligned and worst cells per size, and optionally writes
+// the full matrices as CSV for heatmap plotting.
+static int runAlignmentSweep(BenchType type) {
+    // 64-byte aligned bases with a cache line of headroom for the
+    // offsets.
+    unique_ptr<uint8_t[]> src_buf(new uint8_t[size_end + 192]);
+    unique_ptr<uint8_t[]> dst_buf(new uint8_t[size_end + 192]);
+    uint8_t* src_base = (uint8_t*)(((uintptr_t)src_buf.get() + 63) & ~(uintptr_t)63);
+    uint8_t* dst_base = (uint8_t*)(((uintptr_t)dst_buf.get() + 63) & ~(uintptr_t)63);
+    memset(src_base, 1, size_end + 64);
+
+    FILE* csv = nullptr;
+    if (!align_csv_file.empty()) {
+        csv = fopen(align_csv_file.c_str(), "w");
+        if (csv == nullptr) {
+            printf("Cannot open %s for writing.\n", align_csv_file.c_str());
+            return 1;
+        }
+    }
+
+    size_t num_offsets = 64 / align_step;
+    // memset has no source to misalign and sum has no destination.
+    size_t src_span = (type == MemsetBench) ? 1 : num_offsets;
+    size_t dst_span = (type == SumBench) ? 1 : num_offsets;
+    vector<double> grid(src_span * dst_span);
+
+    for (size_t cur_size = size_start; cur_size <= size_end; cur_size *= 4) {
+        size_t iter_per_size = size_per_test / cur_size;
+        if (iter_per_size == 0)
+            iter_per_size = 1;
+
+        double worst = 0.0;
+        size_t worst_src = 0, worst_dst = 0;
+
+        for (size_t s = 0; s < src_span; s++) {
+            for (size_t d = 0; d < dst_span; d++) {
+                uint8_t* src_ptr = src_base + s * align_step;
+                uint8_t* dst_ptr = dst_base + d * align_step;
+
+                chrono::time_point<chrono::high_resolution_clock>
+                    copy_start, copy_end;
+
+                // one untimed pass to fault in the pages
+                switch (type) {
+                    case MemcpyBench:
+                        memcpy_noinline(dst_ptr, src_ptr, cur_size);
+                        break;
+                    case MemsetBench:
+                        memset_noinline(dst_ptr, 0xdeadbeef, cur_size);
+                        break;
+                    case SumBench:
+                        tot_sum += sum(src_ptr, cur_size);
+                        break;
+                }
+                copy_start = chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < iter_per_size; i++) {
+                    switch (type) {
+                        case MemcpyBench:
+                            memcpy_noinline(dst_ptr, src_ptr, cur_size);
+                            break;
+                        case MemsetBench:
+                            memset_noinline(dst_ptr, 0xdeadbeef, cur_size);
+                            break;
+                        case SumBench:
+                            tot_sum += sum(src_ptr, cur_size);
+                            break;
+                    }
+                }
+                copy_end = chrono::high_resolution_clock::now();
+
+                double ns_per_copy = chrono::duration_cast<chrono::nanoseconds>
+                    (copy_end - copy_start).count() / double(iter_per_size);
+                double gb_per_sec = ((double)cur_size / (1ull<<30)) / (ns_per_copy / 1.0E9);
+                if (type == MemcpyBench)
+                    gb_per_sec *= 2.0;
+
+                grid[s * dst_span + d] = gb_per_sec;
+                if (worst == 0.0 || gb_per_sec < worst) {
+                    worst = gb_per_sec;
+                    worst_src = s * align_step;
+                    worst_dst = d * align_step;
+                }
+            }
+        }
+
+        double aligned = grid[0];
+        cout << "size: " << cur_size << ", aligned: " << aligned
+             << "GB/s, worst: " << worst << "GB/s at src+" << worst_src
+             << "/dst+" << worst_dst << " ("
+             << (aligned - worst) / aligned * 100.0 << "% below aligned)"
+             << endl;
+
+        if (csv != nullptr) {
+            fprintf(csv, "size,%zu\nsrc\\dst", cur_size);
+            for (size_t d = 0; d < dst_span; d++) {
+                fprintf(csv, ",%zu", d * align_step);
+            }
+            fprintf(csv, "\n");
+            for (size_t s = 0; s < src_span; s++) {
+                fprintf(csv, "%zu", s * align_step);
+                for (size_t d = 0; d < dst_span; d++) {
+                    fprintf(csv, ",%.3f", grid[s * dst_span + d]);
+                }
+                fprintf(csv, "\n");
+            }
+            fprintf(csv, "\n");
+        }
+    }
+
+    if (csv != nullptr)
+        fclose(csv);
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     BenchType type = MemcpyBench;
@@ -65,6 +316,8 @@ int main(int argc, char *argv[])
          type = SumBench;
       } else if (string(argv[i]) == string("--dummy")) {
          dummy = true;
+      } else if (string(argv[i]) == string("--align_sweep")) {
+         align_sweep = true;
       } else if (i + 1 < argc) {
           if (string(argv[i]) == string("--delay")) {
              delay = atoi(argv[++i]);
@@ -82,6 +335,20 @@ int main(int argc, char *argv[])
              }
           } else if (string(argv[i]) == string("--samples")) {
              samples = atoi(argv[++i]);
+          } else if (string(argv[i]) == string("--write_baseline")) {
+             write_baseline_file = argv[++i];
+          } else if (string(argv[i]) == string("--baseline")) {
+             baseline_file = argv[++i];
+          } else if (string(argv[i]) == string("--threshold")) {
+             threshold_percent = atof(argv[++i]);
+          } else if (string(argv[i]) == string("--align_step")) {
+             align_step = atoi(argv[++i]);
+             if (align_step == 0 || 64 % align_step != 0) {
+                 printf("--align_step must divide 64.\n");
+                 return 0;
+             }
+          } else if (string(argv[i]) == string("--align_csv")) {
+             align_csv_file = argv[++i];
           } else {
              printf("Unknown argument %s\n", argv[i]);
              return 0;
@@ -92,6 +359,9 @@ int main(int argc, char *argv[])
        }
     }
 
+    if (align_sweep)
+        return runAlignmentSweep(type);
+
     unique_ptr<uint8_t[]> src(new uint8_t[size_end]);
     unique_ptr<uint8_t[]> dst(new uint8_t[size_end]);
     memset(src.get(), 1, size_end);
@@ -103,6 +373,8 @@ int main(int argc, char *argv[])
     //cout << "src: " << (uintptr_t)src.get() << endl;
     //cout << "dst: " <<  (uintptr_t)dst.get() << endl;
 
+    vector<pair<size_t, double>> results;
+
     for (double cur_pow = start_pow; cur_pow <= end_pow && samples > 0;
             cur_pow += pow_inc) {
         chrono::time_point<chrono::high_resolution_clock>
@@ -185,6 +457,15 @@ int main(int argc, char *argv[])
         cout << "size: " << cur_size << ", perf: " << gb_per_sec
              << "GB/s, iter: " << iter_per_size << ", \% time spent waiting: "
              << percent_waiting << endl;
+        results.push_back(make_pair(cur_size, gb_per_sec));
+    }
+
+    if (!write_baseline_file.empty()) {
+        int ret = writeBaseline(write_baseline_file, results);
+        if (ret != 0)
+            return ret;
     }
+    if (!baseline_file.empty())
+        return compareBaseline(baseline_file, results);
     return 0;
 }
@@ -26,6 +26,7 @@
 #include <new>
 
 #include "Action.h"
+#include "ReplayFile.h"
 #include "Threads.h"
 #include "Pointers.h"
 
@@ -62,6 +63,10 @@ class MallocAction : public AllocAction {
     }
   }
 
+  MallocAction(uintptr_t key_pointer, size_t size) : AllocAction(key_pointer) {
+    size_ = size;
+  }
+
   uint64_t Execute(Pointers* pointers) override {
     uint64_t time_nsecs = nanotime();
     void* memory = malloc(size_);
@@ -82,6 +87,11 @@ class CallocAction : public AllocAction {
     }
   }
 
+  CallocAction(uintptr_t key_pointer, size_t n_elements, size_t size)
+      : AllocAction(key_pointer), n_elements_(n_elements) {
+    size_ = size;
+  }
+
   uint64_t Execute(Pointers* pointers) override {
     uint64_t time_nsecs = nanotime();
     void* memory = calloc(n_elements_, size_);
@@ -105,6 +115,11 @@ class ReallocAction : public AllocAction {
     }
   }
 
+  ReallocAction(uintptr_t key_pointer, uintptr_t old_pointer, size_t size)
+      : AllocAction(key_pointer), old_pointer_(old_pointer) {
+    size_ = size;
+  }
+
   bool DoesFree() override { return old_pointer_ != 0; }
 
   uint64_t Execute(Pointers* pointers) override {
@@ -135,6 +150,11 @@ class MemalignAction : public AllocAction {
     }
   }
 
+  MemalignAction(uintptr_t key_pointer, size_t align, size_t size)
+      : AllocAction(key_pointer), align_(align) {
+    size_ = size;
+  }
+
   uint64_t Execute(Pointers* pointers) override {
     uint64_t time_nsecs = nanotime();
     void* memory = memalign(align_, size_);
@@ -198,3 +218,37 @@ Action* Action::CreateAction(uintptr_t key_pointer, const char* type,
   }
   return action;
 }
+
+Action* Action::CreateFromEntry(const ReplayEntry* entry, void* action_memory) {
+  uintptr_t key_pointer = static_cast<uintptr_t>(entry->key_pointer);
+  size_t size = static_cast<size_t>(entry->size);
+  Action* action = nullptr;
+  switch (entry->type) {
+  case REPLAY_MALLOC:
+    action = new (action_memory) MallocAction(key_pointer, size);
+    break;
+  case REPLAY_CALLOC:
+    action = new (action_memory) CallocAction(
+        key_pointer, static_cast<size_t>(entry->arg), size);
+    break;
+  case REPLAY_REALLOC:
+    action = new (action_memory) ReallocAction(
+        key_pointer, static_cast<uintptr_t>(entry->arg), size);
+    break;
+  case REPLAY_MEMALIGN:
+    action = new (action_memory) MemalignAction(
+        key_pointer, static_cast<size_t>(entry->arg), size);
+    break;
+  case REPLAY_FREE:
+    action = new (action_memory) FreeAction(key_pointer);
+    break;
+  case REPLAY_THREAD_DONE:
+    action = new (action_memory) EndThreadAction();
+    break;
+  }
+
+  if (action == nullptr || action->IsError()) {
+    return nullptr;
+  }
+  return action;
+}
@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 class Pointers;
+struct ReplayEntry;
 
 class Action {
  public:
@@ -37,6 +38,7 @@ class Action {
   static size_t MaxActionSize();
   static Action* CreateAction(uintptr_t key_pointer, const char* type,
                               const char* line, void* action_memory);
+  static Action* CreateFromEntry(const ReplayEntry* entry, void* action_memory);
 
  protected:
   bool is_error_ = false;
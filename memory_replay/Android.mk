@@ -2,11 +2,14 @@ LOCAL_PATH := $(call my-dir)
 
 memory_replay_src_files := \
 	Action.cpp \
+	Barrier.cpp \
 	LineBuffer.cpp \
 	NativeInfo.cpp \
 	Pointers.cpp \
+	ReplayFile.cpp \
 	Thread.cpp \
 	Threads.cpp \
+	Timeline.cpp \
 
 include $(CLEAR_VARS)
 
@@ -29,13 +32,33 @@ LOCAL_MODULE_HOST_OS := linux
 LOCAL_LDLIBS := -lrt
 include $(BUILD_HOST_EXECUTABLE)
 
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := alloc_compare.cpp
+LOCAL_CFLAGS := -Wall -Wextra -Werror
+LOCAL_MODULE_TAGS := debug
+LOCAL_MODULE := alloc_compare
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := alloc_compare.cpp
+LOCAL_CFLAGS := -Wall -Wextra -Werror
+LOCAL_MODULE_TAGS := debug
+LOCAL_MODULE := alloc_compare
+LOCAL_MODULE_HOST_OS := linux
+include $(BUILD_HOST_EXECUTABLE)
+
 memory_replay_test_src_files := \
 	tests/ActionTest.cpp \
+	tests/BarrierTest.cpp \
 	tests/LineBufferTest.cpp \
 	tests/NativeInfoTest.cpp \
 	tests/PointersTest.cpp \
+	tests/ReplayFileTest.cpp \
 	tests/ThreadTest.cpp \
 	tests/ThreadsTest.cpp \
+	tests/TimelineTest.cpp \
 
 include $(CLEAR_VARS)
 
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <pthread.h>
+
+#include "Barrier.h"
+
+void ProcessBarrier::Init(size_t count) {
+  pthread_mutexattr_t mutex_attr;
+  if (pthread_mutexattr_init(&mutex_attr) != 0 ||
+      pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED) != 0 ||
+      pthread_mutex_init(&mutex_, &mutex_attr) != 0) {
+    err(1, "Failed to initialize process-shared mutex");
+  }
+  pthread_mutexattr_destroy(&mutex_attr);
+
+  pthread_condattr_t cond_attr;
+  if (pthread_condattr_init(&cond_attr) != 0 ||
+      pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED) != 0 ||
+      pthread_cond_init(&cond_, &cond_attr) != 0) {
+    err(1, "Failed to initialize process-shared condition");
+  }
+  pthread_condattr_destroy(&cond_attr);
+
+  count_ = count;
+  waiting_ = 0;
+  generation_ = 0;
+}
+
+void ProcessBarrier::Destroy() {
+  pthread_cond_destroy(&cond_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+void ProcessBarrier::Wait() {
+  pthread_mutex_lock(&mutex_);
+  uint64_t generation = generation_;
+  if (++waiting_ == count_) {
+    // Last participant to arrive releases everyone and resets the
+    // barrier for the next round.
+    waiting_ = 0;
+    generation_++;
+    pthread_cond_broadcast(&cond_);
+  } else {
+    while (generation == generation_) {
+      pthread_cond_wait(&cond_, &mutex_);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
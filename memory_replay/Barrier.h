@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_BARRIER_H
+#define _MEMORY_REPLAY_BARRIER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+// A counted barrier that can be shared between processes when placed in
+// a MAP_SHARED mapping. This is the process-level analog of the
+// pending/ready handshake in Thread: every participant blocks in Wait()
+// until all count participants have arrived, then all are released
+// together. The barrier resets itself after each round and can be
+// reused.
+class ProcessBarrier {
+ public:
+  // Must be called exactly once, before any participant calls Wait().
+  void Init(size_t count);
+  void Destroy();
+
+  void Wait();
+
+ private:
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  size_t count_;
+  size_t waiting_;
+  uint64_t generation_;
+};
+
+#endif // _MEMORY_REPLAY_BARRIER_H
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "LineBuffer.h"
+#include "ReplayFile.h"
+
+// Number of entries buffered before they are written out.
+constexpr size_t ENTRY_BUFFER_SIZE = 4096;
+
+// Parse the optional trailing "start_nsecs end_nsecs" fields.
+static void ParseTimestamp(const char* args, ReplayEntry* entry) {
+  uint64_t start_nsecs;
+  uint64_t end_nsecs;
+  if (sscanf(args, "%" SCNu64 " %" SCNu64, &start_nsecs, &end_nsecs) == 2) {
+    entry->start_nsecs = start_nsecs;
+  }
+}
+
+static void WriteAll(int out_fd, const void* data, size_t bytes) {
+  if (write(out_fd, data, bytes) != static_cast<ssize_t>(bytes)) {
+    err(1, "Failed to write %zu bytes to output file", bytes);
+  }
+}
+
+void CompileDump(int fd, int out_fd) {
+  static char buffer[65535];
+  static ReplayEntry entries[ENTRY_BUFFER_SIZE];
+
+  lseek(fd, 0, SEEK_SET);
+  LineBuffer line_buf(fd, buffer, sizeof(buffer));
+
+  ReplayHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+  header.version = REPLAY_VERSION;
+
+  // Write a placeholder header, the counts are patched in at the end.
+  WriteAll(out_fd, &header, sizeof(header));
+
+  char* line;
+  size_t line_len;
+  size_t pending = 0;
+  uint64_t num_entries = 0;
+  uint64_t cur_allocs = 0;
+  uint64_t max_allocs = 0;
+  while (line_buf.GetLine(&line, &line_len)) {
+    pid_t tid;
+    int line_pos = 0;
+    char type[128];
+    uint64_t key_pointer;
+
+    if (sscanf(line, "%d: %s %" SCNx64 " %n", &tid, type, &key_pointer, &line_pos) != 3) {
+      err(1, "Unparseable line found: %s\n", line);
+    }
+
+    ReplayEntry* entry = &entries[pending];
+    memset(entry, 0, sizeof(*entry));
+    entry->tid = tid;
+    entry->key_pointer = key_pointer;
+
+    const char* args = line + line_pos;
+    int args_pos = 0;
+    if (strcmp(type, "malloc") == 0) {
+      entry->type = REPLAY_MALLOC;
+      if (sscanf(args, "%" SCNu64 " %n", &entry->size, &args_pos) != 1) {
+        err(1, "Unparseable line found: %s\n", line);
+      }
+      cur_allocs++;
+    } else if (strcmp(type, "calloc") == 0) {
+      entry->type = REPLAY_CALLOC;
+      if (sscanf(args, "%" SCNu64 " %" SCNu64 " %n", &entry->arg, &entry->size,
+                 &args_pos) != 2) {
+        err(1, "Unparseable line found: %s\n", line);
+      }
+      cur_allocs++;
+    } else if (strcmp(type, "realloc") == 0) {
+      entry->type = REPLAY_REALLOC;
+      if (sscanf(args, "%" SCNx64 " %" SCNu64 " %n", &entry->arg, &entry->size,
+                 &args_pos) != 2) {
+        err(1, "Unparseable line found: %s\n", line);
+      }
+      // This will treat a realloc as an allocation, even if it frees
+      // another allocation. Since reallocs are relatively rare, this
+      // shouldn't inflate the numbers that much.
+      cur_allocs++;
+    } else if (strcmp(type, "memalign") == 0) {
+      entry->type = REPLAY_MEMALIGN;
+      if (sscanf(args, "%" SCNu64 " %" SCNu64 " %n", &entry->arg, &entry->size,
+                 &args_pos) != 2) {
+        err(1, "Unparseable line found: %s\n", line);
+      }
+      cur_allocs++;
+    } else if (strcmp(type, "free") == 0) {
+      entry->type = REPLAY_FREE;
+      if (key_pointer != 0) {
+        cur_allocs--;
+      }
+    } else if (strcmp(type, "thread_done") == 0) {
+      entry->type = REPLAY_THREAD_DONE;
+    } else {
+      err(1, "Unknown type %s in line: %s\n", type, line);
+    }
+    ParseTimestamp(args + args_pos, entry);
+
+    if (cur_allocs > max_allocs) {
+      max_allocs = cur_allocs;
+    }
+
+    pending++;
+    num_entries++;
+    if (pending == ENTRY_BUFFER_SIZE) {
+      WriteAll(out_fd, entries, pending * sizeof(ReplayEntry));
+      pending = 0;
+    }
+  }
+  if (pending > 0) {
+    WriteAll(out_fd, entries, pending * sizeof(ReplayEntry));
+  }
+
+  header.num_entries = num_entries;
+  header.max_allocs = max_allocs;
+  if (lseek(out_fd, 0, SEEK_SET) == static_cast<off_t>(-1)) {
+    err(1, "Failed to seek to the start of the output file");
+  }
+  WriteAll(out_fd, &header, sizeof(header));
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_REPLAY_FILE_H
+#define _MEMORY_REPLAY_REPLAY_FILE_H
+
+#include <stdint.h>
+
+// A compiled dump is a ReplayHeader followed by num_entries fixed-size
+// ReplayEntry records. The whole file can be mmap-ed and executed
+// directly, skipping the text parsing passes entirely.
+
+constexpr char REPLAY_MAGIC[8] = {'M', 'E', 'M', '_', 'R', 'P', 'L', 'Y'};
+constexpr uint32_t REPLAY_VERSION = 1;
+
+enum ReplayType : uint8_t {
+  REPLAY_MALLOC = 0,
+  REPLAY_CALLOC,
+  REPLAY_REALLOC,
+  REPLAY_MEMALIGN,
+  REPLAY_FREE,
+  REPLAY_THREAD_DONE,
+};
+
+struct ReplayHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t pad;
+  uint64_t num_entries;
+  // Peak number of outstanding allocations in the dump, stored here so
+  // the replay can size its pointer table without an extra pass.
+  uint64_t max_allocs;
+};
+
+struct ReplayEntry {
+  int32_t tid;
+  uint8_t type;
+  uint8_t pad[3];
+  uint64_t key_pointer;
+  // Allocation size. Unused for free and thread_done.
+  uint64_t size;
+  // Second argument: n_elements for calloc, the old pointer for
+  // realloc, the alignment for memalign. Unused otherwise.
+  uint64_t arg;
+  // Time the action was recorded, taken from the optional trailing
+  // "start_nsecs end_nsecs" fields of a dump line. Zero when the dump
+  // carries no timing information.
+  uint64_t start_nsecs;
+};
+
+// Read a text dump from fd and write the compiled stream to out_fd.
+// Exits on malformed input or write failure.
+void CompileDump(int fd, int out_fd);
+
+#endif // _MEMORY_REPLAY_REPLAY_FILE_H
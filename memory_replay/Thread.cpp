@@ -60,3 +60,7 @@ void Thread::ClearPending() {
 Action* Thread::CreateAction(uintptr_t key_pointer, const char* type, const char* line) {
   return Action::CreateAction(key_pointer, type, line, action_memory_);
 }
+
+Action* Thread::CreateAction(const ReplayEntry* entry) {
+  return Action::CreateFromEntry(entry, action_memory_);
+}
@@ -23,6 +23,7 @@
 
 class Action;
 class Pointers;
+struct ReplayEntry;
 
 constexpr size_t ACTION_MEMORY_SIZE = 128;
 
@@ -37,6 +38,7 @@ class Thread {
   void ClearPending();
 
   Action* CreateAction(uintptr_t key_pointer, const char* type, const char* line);
+  Action* CreateAction(const ReplayEntry* entry);
   void AddTimeNsecs(uint64_t nsecs) { total_time_nsecs_ += nsecs; }
 
   void set_pointers(Pointers* pointers) { pointers_ = pointers; }
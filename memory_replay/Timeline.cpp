@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "NativeInfo.h"
+#include "Timeline.h"
+
+Timeline::Timeline(size_t interval, size_t capacity)
+    : interval_(interval), capacity_(capacity) {
+  if (interval_ == 0) {
+    interval_ = 1;
+  }
+  samples_ = new TimelineSample[capacity_];
+}
+
+Timeline::~Timeline() {
+  delete[] samples_;
+}
+
+void Timeline::Sample(uint64_t action_index, uint64_t allocated_bytes) {
+  int smaps_fd = open("/proc/self/smaps", O_RDONLY);
+  if (smaps_fd == -1) {
+    return;
+  }
+  size_t pss_bytes = 0;
+  size_t va_bytes = 0;
+  // GetNativeInfo closes the fd.
+  GetNativeInfo(smaps_fd, &pss_bytes, &va_bytes);
+
+  TimelineSample* sample = &samples_[next_ % capacity_];
+  sample->action_index = action_index;
+  sample->pss_bytes = pss_bytes;
+  sample->va_bytes = va_bytes;
+  sample->allocated_bytes = allocated_bytes;
+  next_++;
+}
+
+bool Timeline::Write(int fd) {
+  size_t num_samples = (next_ < capacity_) ? next_ : capacity_;
+
+  TimelineHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TIMELINE_MAGIC, sizeof(header.magic));
+  header.version = TIMELINE_VERSION;
+  header.interval = interval_;
+  header.num_samples = num_samples;
+  header.num_dropped = next_ - num_samples;
+  if (write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+    return false;
+  }
+
+  // Emit the samples in chronological order; when the ring wrapped the
+  // oldest remaining sample is at next_ % capacity_.
+  size_t start = (next_ < capacity_) ? 0 : next_ % capacity_;
+  for (size_t i = 0; i < num_samples; i++) {
+    TimelineSample* sample = &samples_[(start + i) % capacity_];
+    if (write(fd, sample, sizeof(*sample)) != static_cast<ssize_t>(sizeof(*sample))) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_TIMELINE_H
+#define _MEMORY_REPLAY_TIMELINE_H
+
+#include <stdint.h>
+
+// Samples the native memory state of the replay every interval actions
+// into a preallocated ring, and writes the result as a binary timeline:
+// a TimelineHeader followed by num_samples TimelineSample records in
+// chronological order. When the ring wraps, the oldest samples are
+// dropped and counted in num_dropped.
+
+constexpr char TIMELINE_MAGIC[8] = {'M', 'E', 'M', '_', 'S', 'M', 'P', 'L'};
+constexpr uint32_t TIMELINE_VERSION = 1;
+
+struct TimelineHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t pad;
+  uint64_t interval;
+  uint64_t num_samples;
+  uint64_t num_dropped;
+};
+
+struct TimelineSample {
+  // Index of the action about to be executed when the sample was taken.
+  uint64_t action_index;
+  // Native PSS and VA space as computed by GetNativeInfo.
+  uint64_t pss_bytes;
+  uint64_t va_bytes;
+  // Cumulative bytes requested from the allocator so far.
+  uint64_t allocated_bytes;
+};
+
+class Timeline {
+ public:
+  Timeline(size_t interval, size_t capacity);
+  ~Timeline();
+
+  bool SampleNeeded(uint64_t action_index) {
+    return (action_index % interval_) == 0;
+  }
+
+  // This function is not re-entrant, it uses GetNativeInfo.
+  void Sample(uint64_t action_index, uint64_t allocated_bytes);
+
+  bool Write(int fd);
+
+  size_t samples_taken() { return next_; }
+
+ private:
+  size_t interval_;
+  size_t capacity_;
+  size_t next_ = 0;
+  TimelineSample* samples_ = nullptr;
+};
+
+#endif // _MEMORY_REPLAY_TIMELINE_H
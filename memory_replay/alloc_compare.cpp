@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// alloc_compare: A/B compare allocator configurations by replaying the
+// same memory dump repeatedly under each one.
+//
+// Allocator tuning (e.g. jemalloc's MALLOC_CONF) has to be applied
+// through the environment before the process starts, so each run forks
+// and execs memory_replay with the configuration's environment
+// assignments applied, captures its output, and parses the total
+// allocation/free time and the peak native PSS/VA reported by the
+// periodic NativeInfo dumps.
+//
+// Iterations are interleaved across the configurations (A, B, A, B, ...)
+// so slow drift on the device (thermals, background work) biases every
+// configuration equally. The first -c configuration is the baseline;
+// every other configuration is compared against it per metric with
+// Welch's unequal-variance t-test at the 5% level, so the verdict table
+// separates real wins from run-to-run noise.
+//
+// Example:
+//   alloc_compare -i 20 -c "" -c MALLOC_CONF=tcache:false camera.txt
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+constexpr size_t DEFAULT_ITERATIONS = 10;
+
+struct RunResult {
+  uint64_t time_nsecs = 0;
+  uint64_t peak_pss_bytes = 0;
+  uint64_t peak_va_bytes = 0;
+};
+
+struct Config {
+  // The raw -c argument, e.g. "MALLOC_CONF=tcache:false,A=B".
+  std::string spec;
+  // The individual NAME=VALUE assignments from the spec.
+  std::vector<std::string> assignments;
+
+  std::vector<RunResult> results;
+};
+
+static const char* ConfigLabel(const Config& config) {
+  return config.spec.empty() ? "(default)" : config.spec.c_str();
+}
+
+// Run the replay binary once with the configuration's environment and
+// parse the metrics out of its output. Returns false if the replay
+// fails or the expected output is missing.
+static bool RunReplay(const char* replay_bin, const char* dump_file,
+                      const Config& config, RunResult* result) {
+  int pipefd[2];
+  if (pipe(pipefd) == -1) {
+    fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+    return false;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "fork failed: %s\n", strerror(errno));
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(pipefd[0]);
+    dup2(pipefd[1], STDOUT_FILENO);
+    close(pipefd[1]);
+    for (const std::string& assignment : config.assignments) {
+      // Valid lifetime: the exec either replaces the image or we exit.
+      putenv(const_cast<char*>(assignment.c_str()));
+    }
+    execlp(replay_bin, replay_bin, dump_file, nullptr);
+    fprintf(stderr, "exec of %s failed: %s\n", replay_bin, strerror(errno));
+    _exit(127);
+  }
+  close(pipefd[1]);
+
+  FILE* output = fdopen(pipefd[0], "r");
+  if (output == nullptr) {
+    fprintf(stderr, "fdopen failed: %s\n", strerror(errno));
+    close(pipefd[0]);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    return false;
+  }
+
+  bool found_time = false;
+  char line[512];
+  while (fgets(line, sizeof(line), output) != nullptr) {
+    const char* found;
+    uint64_t value;
+    if ((found = strstr(line, "Native PSS: ")) != nullptr) {
+      if (sscanf(found, "Native PSS: %" SCNu64, &value) == 1 &&
+          value > result->peak_pss_bytes) {
+        result->peak_pss_bytes = value;
+      }
+    } else if ((found = strstr(line, "Native VA Space: ")) != nullptr) {
+      if (sscanf(found, "Native VA Space: %" SCNu64, &value) == 1 &&
+          value > result->peak_va_bytes) {
+        result->peak_va_bytes = value;
+      }
+    } else if (sscanf(line, "Total Allocation/Free Time: %" SCNu64 "ns",
+                      &value) == 1) {
+      result->time_nsecs = value;
+      found_time = true;
+    }
+  }
+  fclose(output);
+
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "Replay under %s failed\n", ConfigLabel(config));
+    return false;
+  }
+  if (!found_time) {
+    fprintf(stderr, "Replay under %s produced no timing output\n",
+            ConfigLabel(config));
+    return false;
+  }
+  return true;
+}
+
+static double Mean(const std::vector<double>& values) {
+  double sum = 0.0;
+  for (double value : values) {
+    sum += value;
+  }
+  return sum / values.size();
+}
+
+// Sample variance (n-1 denominator).
+static double Variance(const std::vector<double>& values, double mean) {
+  if (values.size() < 2) {
+    return 0.0;
+  }
+  double sum = 0.0;
+  for (double value : values) {
+    sum += (value - mean) * (value - mean);
+  }
+  return sum / (values.size() - 1);
+}
+
+// Two-sided critical values of the t distribution at the 5% level for
+// 1 to 30 degrees of freedom; beyond that the normal value is close
+// enough.
+static double TCritical05(double df) {
+  static const double table[30] = {
+      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+      2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+  };
+  if (df < 1.0) {
+    return table[0];
+  }
+  if (df >= 30.0) {
+    return 1.960;
+  }
+  return table[static_cast<size_t>(df) - 1];
+}
+
+// Welch's unequal-variance t-test. Returns true if the difference of
+// means is significant at the 5% level and reports the statistic and
+// the Welch-Satterthwaite degrees of freedom.
+static bool WelchSignificant(const std::vector<double>& a,
+                             const std::vector<double>& b, double* t_out,
+                             double* df_out) {
+  double mean_a = Mean(a);
+  double mean_b = Mean(b);
+  double se_a = Variance(a, mean_a) / a.size();
+  double se_b = Variance(b, mean_b) / b.size();
+  double se = se_a + se_b;
+  if (se == 0.0) {
+    // No variance at all; any difference is exact.
+    *t_out = 0.0;
+    *df_out = a.size() + b.size() - 2;
+    return mean_a != mean_b;
+  }
+  *t_out = (mean_a - mean_b) / sqrt(se);
+  *df_out = se * se /
+            (se_a * se_a / (a.size() - 1) + se_b * se_b / (b.size() - 1));
+  return fabs(*t_out) > TCritical05(*df_out);
+}
+
+static void PrintMetric(const char* name, const char* unit,
+                        const std::vector<Config>& configs,
+                        uint64_t RunResult::*member) {
+  printf("%s:\n", name);
+  printf("  %-40s %15s %12s   %s\n", "config", "mean", "stddev",
+         "vs baseline");
+
+  std::vector<double> baseline;
+  for (size_t i = 0; i < configs.size(); i++) {
+    const Config& config = configs[i];
+    std::vector<double> values;
+    for (const RunResult& result : config.results) {
+      values.push_back(static_cast<double>(result.*member));
+    }
+    double mean = Mean(values);
+    double stddev = sqrt(Variance(values, mean));
+    printf("  %-40s %15.0f %12.0f", ConfigLabel(config), mean, stddev);
+
+    if (i == 0) {
+      baseline = values;
+      printf("   baseline\n");
+      continue;
+    }
+
+    double t, df;
+    bool significant = WelchSignificant(baseline, values, &t, &df);
+    double delta = (mean - Mean(baseline)) * 100.0 / Mean(baseline);
+    printf("   %+0.2f%% t=%0.2f ", delta, fabs(t));
+    if (!significant) {
+      printf("not significant\n");
+    } else if (delta < 0) {
+      printf("BETTER (p < 0.05)\n");
+    } else {
+      printf("WORSE (p < 0.05)\n");
+    }
+  }
+  printf("  (%s, lower is better)\n\n", unit);
+}
+
+static void Usage(const char* cmd) {
+  fprintf(stderr,
+          "Usage: %s [-i ITERATIONS] [-x MEMORY_REPLAY] -c CONFIG -c CONFIG "
+          "[-c CONFIG...] MEMORY_LOG_FILE\n"
+          "Replays the dump ITERATIONS times (default %zu) under each "
+          "configuration.\n"
+          "CONFIG is a comma separated list of NAME=VALUE environment\n"
+          "assignments applied to the replay process, e.g.\n"
+          "MALLOC_CONF=tcache:false. An empty CONFIG runs the allocator\n"
+          "defaults. The first -c is the baseline the others are tested\n"
+          "against (Welch's t-test, 5%% level).\n"
+          "-x names the replay binary to run (default memory_replay).\n",
+          cmd, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char** argv) {
+  size_t iterations = DEFAULT_ITERATIONS;
+  const char* replay_bin = "memory_replay";
+  std::vector<Config> configs;
+
+  int c;
+  while ((c = getopt(argc, argv, "i:x:c:h")) != -1) {
+    switch (c) {
+      case 'i':
+        iterations = atoi(optarg);
+        if (iterations < 2) {
+          fprintf(stderr, "Need at least 2 iterations per configuration.\n");
+          return 1;
+        }
+        break;
+      case 'x':
+        replay_bin = optarg;
+        break;
+      case 'c': {
+        Config config;
+        config.spec = optarg;
+        const char* p = optarg;
+        while (*p != '\0') {
+          const char* end = strchrnul(p, ',');
+          if (end != p) {
+            std::string assignment(p, end - p);
+            if (assignment.find('=') == std::string::npos) {
+              fprintf(stderr, "Invalid environment assignment: %s\n",
+                      assignment.c_str());
+              return 1;
+            }
+            config.assignments.push_back(assignment);
+          }
+          p = (*end == '\0') ? end : end + 1;
+        }
+        configs.push_back(config);
+        break;
+      }
+      case 'h':
+        Usage(argv[0]);
+        return 0;
+      default:
+        Usage(argv[0]);
+        return 1;
+    }
+  }
+  if (configs.size() < 2 || optind != argc - 1) {
+    Usage(argv[0]);
+    return 1;
+  }
+  const char* dump_file = argv[optind];
+
+  printf("Replaying %s %zu times under %zu configurations\n", dump_file,
+         iterations, configs.size());
+
+  // One warm-up run per configuration, discarded, so first-run effects
+  // (page cache, dump parsing artifacts) don't land in one sample set.
+  for (Config& config : configs) {
+    RunResult result;
+    if (!RunReplay(replay_bin, dump_file, config, &result)) {
+      return 1;
+    }
+  }
+
+  for (size_t i = 0; i < iterations; i++) {
+    for (Config& config : configs) {
+      RunResult result;
+      if (!RunReplay(replay_bin, dump_file, config, &result)) {
+        return 1;
+      }
+      config.results.push_back(result);
+      printf("  %s: iteration %zu: %" PRIu64 "ns, peak pss %" PRIu64
+             ", peak va %" PRIu64 "\n",
+             ConfigLabel(config), i + 1, result.time_nsecs,
+             result.peak_pss_bytes, result.peak_va_bytes);
+    }
+  }
+  printf("\n");
+
+  PrintMetric("Allocation/free time", "nsecs", configs,
+              &RunResult::time_nsecs);
+  PrintMetric("Peak native PSS", "bytes", configs,
+              &RunResult::peak_pss_bytes);
+  PrintMetric("Peak native VA space", "bytes", configs,
+              &RunResult::peak_va_bytes);
+
+  return 0;
+}
@@ -24,17 +24,31 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+#include <time.h>
+
 #include "Action.h"
+#include "Barrier.h"
 #include "LineBuffer.h"
 #include "NativeInfo.h"
 #include "Pointers.h"
+#include "ReplayFile.h"
 #include "Thread.h"
 #include "Threads.h"
+#include "Timeline.h"
 
 static char g_buffer[65535];
 
+static uint64_t nanotime() {
+  struct timespec t;
+  t.tv_sec = t.tv_nsec = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return static_cast<uint64_t>(t.tv_sec) * 1000000000LL + t.tv_nsec;
+}
+
 size_t GetMaxAllocs(int fd) {
   lseek(fd, 0, SEEK_SET);
   LineBuffer line_buf(fd, g_buffer, sizeof(g_buffer));
@@ -153,39 +167,382 @@ void ProcessDump(int fd, size_t max_allocs, size_t max_threads) {
          threads.total_time_nsecs(), threads.total_time_nsecs()/1000000000.0);
 }
 
-constexpr size_t DEFAULT_MAX_THREADS = 512;
+void ProcessReplay(const ReplayHeader* header, const ReplayEntry* entries,
+                   size_t max_threads, double time_scale, Timeline* timeline) {
+  Pointers pointers(header->max_allocs);
+  Threads threads(&pointers, max_threads);
 
-int main(int argc, char** argv) {
-  if (argc != 2 && argc != 3) {
-    if (argc > 3) {
-      fprintf(stderr, "Only two arguments are expected.\n");
-    } else {
-      fprintf(stderr, "Requires at least one argument.\n");
+  printf("Maximum threads available:   %zu\n", threads.max_threads());
+  printf("Maximum allocations in dump: %" PRIu64 "\n", header->max_allocs);
+  printf("Total pointers available:    %zu\n", pointers.max_pointers());
+  printf("\n");
+
+  PrintNativeInfo("Initial ");
+
+  // Base times for the timing-faithful mode, latched on the first
+  // entry that carries a timestamp.
+  uint64_t base_nsecs = 0;
+  uint64_t base_now = 0;
+
+  uint64_t allocated_bytes = 0;
+
+  for (uint64_t i = 0; i < header->num_entries; i++) {
+    const ReplayEntry* entry = &entries[i];
+
+    if (timeline != nullptr && timeline->SampleNeeded(i)) {
+      timeline->Sample(i, allocated_bytes);
+    }
+    switch (entry->type) {
+    case REPLAY_MALLOC:
+    case REPLAY_REALLOC:
+    case REPLAY_MEMALIGN:
+      allocated_bytes += entry->size;
+      break;
+    case REPLAY_CALLOC:
+      allocated_bytes += entry->arg * entry->size;
+      break;
+    }
+
+    if (time_scale != 0.0 && entry->start_nsecs != 0) {
+      if (base_nsecs == 0) {
+        base_nsecs = entry->start_nsecs;
+        base_now = nanotime();
+      } else {
+        // Busy-wait so short gaps are reproduced accurately; sleeping
+        // would round everything up to scheduler granularity.
+        uint64_t target = base_now +
+            static_cast<uint64_t>((entry->start_nsecs - base_nsecs) / time_scale);
+        while (nanotime() < target);
+      }
+    }
+
+    if (((i + 1) % 100000) == 0) {
+      printf("  At entry %" PRIu64 ":\n", i + 1);
+      PrintNativeInfo("    ");
+    }
+    Thread* thread = threads.FindThread(entry->tid);
+    if (thread == nullptr) {
+      thread = threads.CreateThread(entry->tid);
+    }
+
+    // Wait for the thread to complete any previous actions before handling
+    // the next action.
+    thread->WaitForReady();
+
+    Action* action = thread->CreateAction(entry);
+    if (action == nullptr) {
+      err(1, "Cannot create action from entry %" PRIu64 "\n", i);
+    }
+
+    bool does_free = action->DoesFree();
+    if (does_free) {
+      // Make sure that any other threads doing allocations are complete
+      // before triggering the action. Otherwise, another thread could
+      // be creating the allocation we are going to free.
+      threads.WaitForAllToQuiesce();
+    }
+
+    // Tell the thread to execute the action.
+    thread->SetPending();
+
+    if (action->EndThread()) {
+      // Wait for the thread to finish and clear the thread entry.
+      threads.Finish(thread);
+    }
+
+    // Wait for this action to complete. This avoids a race where
+    // another thread could be creating the same allocation where are
+    // trying to free.
+    if (does_free) {
+      thread->WaitForReady();
     }
-    fprintf(stderr, "Usage: %s MEMORY_LOG_FILE [MAX_THREADS]\n", basename(argv[0]));
-    return 1;
   }
+  // Wait for all threads to stop processing actions.
+  threads.WaitForAllToQuiesce();
 
-  size_t max_threads = DEFAULT_MAX_THREADS;
-  if (argc == 3) {
-    max_threads = atoi(argv[2]);
+  if (timeline != nullptr) {
+    timeline->Sample(header->num_entries, allocated_bytes);
   }
 
-  int dump_fd = open(argv[1], O_RDONLY);
+  PrintNativeInfo("Final ");
+
+  // Free any outstanding pointers.
+  // This allows us to run a tool like valgrind to verify that no memory
+  // is leaked and everything is accounted for during a run.
+  threads.FinishAll();
+  pointers.FreeAll();
+
+  // Print out the total time making all allocation calls.
+  printf("Total Allocation/Free Time: %" PRIu64 "ns %0.2fs\n",
+         threads.total_time_nsecs(), threads.total_time_nsecs()/1000000000.0);
+}
+
+constexpr size_t DEFAULT_MAX_THREADS = 512;
+
+// Maximum number of timeline samples held in memory; older samples are
+// dropped when a replay produces more.
+constexpr size_t TIMELINE_CAPACITY = 65536;
+
+// Open a dump (text or compiled), load it and replay it. When
+// start_barrier is non-null, wait there after loading and before the
+// first action so concurrent replayers start their allocation phases
+// together.
+static int ReplayDumpFile(const char* file, size_t max_threads,
+                          double time_scale, const char* timeline_file,
+                          size_t timeline_interval,
+                          ProcessBarrier* start_barrier) {
+  int dump_fd = open(file, O_RDONLY);
   if (dump_fd == -1) {
-    fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+    fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
     return 1;
   }
 
-  printf("Processing: %s\n", argv[1]);
+  printf("Processing: %s\n", file);
+
+  // Check for a compiled dump, which can be executed straight from the
+  // mapping without any parsing passes.
+  ReplayHeader header;
+  ssize_t bytes = read(dump_fd, &header, sizeof(header));
+  if (bytes == static_cast<ssize_t>(sizeof(header)) &&
+      memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) == 0) {
+    if (header.version != REPLAY_VERSION) {
+      fprintf(stderr, "Unsupported replay file version %u\n", header.version);
+      close(dump_fd);
+      return 1;
+    }
+    struct stat st;
+    if (fstat(dump_fd, &st) == -1 ||
+        static_cast<uint64_t>(st.st_size) <
+        sizeof(header) + header.num_entries * sizeof(ReplayEntry)) {
+      fprintf(stderr, "Truncated replay file %s\n", file);
+      close(dump_fd);
+      return 1;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, dump_fd, 0);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "Failed to map %s: %s\n", file, strerror(errno));
+      close(dump_fd);
+      return 1;
+    }
+
+    Timeline* timeline = nullptr;
+    if (timeline_file != nullptr) {
+      timeline = new Timeline(timeline_interval, TIMELINE_CAPACITY);
+    }
+
+    if (start_barrier != nullptr) {
+      start_barrier->Wait();
+    }
+
+    ProcessReplay(reinterpret_cast<ReplayHeader*>(map),
+                  reinterpret_cast<ReplayEntry*>(
+                      reinterpret_cast<char*>(map) + sizeof(ReplayHeader)),
+                  max_threads, time_scale, timeline);
+
+    if (timeline != nullptr) {
+      int timeline_fd = open(timeline_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (timeline_fd == -1 || !timeline->Write(timeline_fd)) {
+        fprintf(stderr, "Failed to write timeline to %s: %s\n", timeline_file,
+                strerror(errno));
+      }
+      if (timeline_fd != -1) {
+        close(timeline_fd);
+      }
+      delete timeline;
+    }
+
+    munmap(map, st.st_size);
+    close(dump_fd);
+    return 0;
+  }
+
+  if (time_scale != 0.0) {
+    fprintf(stderr, "Timing replay requires a compiled dump, replaying at full speed.\n");
+  }
+  if (timeline_file != nullptr) {
+    fprintf(stderr, "Timeline sampling requires a compiled dump, ignoring --samples.\n");
+  }
 
   // Do a first pass to get the total number of allocations used at one
   // time to allow a single mmap that can hold the maximum number of
   // pointers needed at once.
   size_t max_allocs = GetMaxAllocs(dump_fd);
+  if (start_barrier != nullptr) {
+    start_barrier->Wait();
+  }
   ProcessDump(dump_fd, max_allocs, max_threads);
 
   close(dump_fd);
 
   return 0;
 }
+
+// Fork one replayer per dump, release them together through a shared
+// barrier, and sample the children's native PSS while they run so the
+// peak reflects the processes' overlapping allocation phases.
+static int ProcessMulti(int num_dumps, char** dump_files, size_t max_threads,
+                        double time_scale) {
+  ProcessBarrier* barrier = reinterpret_cast<ProcessBarrier*>(
+      mmap(nullptr, sizeof(ProcessBarrier), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  if (barrier == MAP_FAILED) {
+    err(1, "Failed to map shared barrier");
+  }
+  // The parent participates so the monitor starts sampling only once
+  // every replayer has loaded its dump.
+  barrier->Init(num_dumps + 1);
+
+  pid_t* pids = new pid_t[num_dumps];
+  for (int i = 0; i < num_dumps; i++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      err(1, "Failed to fork replayer for %s", dump_files[i]);
+    }
+    if (pid == 0) {
+      _exit(ReplayDumpFile(dump_files[i], max_threads, time_scale, nullptr, 0,
+                           barrier));
+    }
+    pids[i] = pid;
+  }
+
+  barrier->Wait();
+
+  // Sum the children's native PSS at regular intervals; the largest sum
+  // seen is the system-wide peak of the replayed set.
+  uint64_t peak_pss_bytes = 0;
+  int alive = num_dumps;
+  int failures = 0;
+  while (alive > 0) {
+    uint64_t total_pss_bytes = 0;
+    for (int i = 0; i < num_dumps; i++) {
+      if (pids[i] == 0) {
+        continue;
+      }
+      int status;
+      if (waitpid(pids[i], &status, WNOHANG) == pids[i]) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+          fprintf(stderr, "Replay of %s failed\n", dump_files[i]);
+          failures++;
+        }
+        pids[i] = 0;
+        alive--;
+        continue;
+      }
+      char smaps_file[64];
+      snprintf(smaps_file, sizeof(smaps_file), "/proc/%d/smaps", pids[i]);
+      int smaps_fd = open(smaps_file, O_RDONLY);
+      if (smaps_fd == -1) {
+        continue;
+      }
+      size_t pss_bytes;
+      size_t va_bytes;
+      // GetNativeInfo closes the fd.
+      GetNativeInfo(smaps_fd, &pss_bytes, &va_bytes);
+      total_pss_bytes += pss_bytes;
+    }
+    if (total_pss_bytes > peak_pss_bytes) {
+      peak_pss_bytes = total_pss_bytes;
+    }
+    usleep(10000);
+  }
+  delete[] pids;
+  barrier->Destroy();
+  munmap(barrier, sizeof(ProcessBarrier));
+
+  printf("\nReplayed %d processes\n", num_dumps);
+  printf("System-wide peak native PSS: %" PRIu64 " bytes %0.2fMB\n",
+         peak_pss_bytes, peak_pss_bytes/(1024*1024.0));
+  return (failures != 0) ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  double time_scale = 0.0;
+
+  if (argc >= 2 && strcmp(argv[1], "--compile") == 0) {
+    if (argc != 4) {
+      fprintf(stderr, "Usage: %s --compile MEMORY_LOG_FILE OUTPUT_FILE\n",
+              basename(argv[0]));
+      return 1;
+    }
+
+    int dump_fd = open(argv[2], O_RDONLY);
+    if (dump_fd == -1) {
+      fprintf(stderr, "Failed to open %s: %s\n", argv[2], strerror(errno));
+      return 1;
+    }
+    int out_fd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd == -1) {
+      fprintf(stderr, "Failed to open %s: %s\n", argv[3], strerror(errno));
+      close(dump_fd);
+      return 1;
+    }
+
+    printf("Compiling: %s -> %s\n", argv[2], argv[3]);
+    CompileDump(dump_fd, out_fd);
+
+    close(out_fd);
+    close(dump_fd);
+    return 0;
+  }
+
+  const char* timeline_file = nullptr;
+  size_t timeline_interval = 0;
+
+  while (true) {
+    if (argc >= 3 && strcmp(argv[1], "--scale") == 0) {
+      time_scale = atof(argv[2]);
+      if (time_scale <= 0.0) {
+        fprintf(stderr, "Invalid time scale %s\n", argv[2]);
+        return 1;
+      }
+      argc -= 2;
+      argv += 2;
+    } else if (argc >= 4 && strcmp(argv[1], "--samples") == 0) {
+      timeline_file = argv[2];
+      timeline_interval = atoi(argv[3]);
+      if (timeline_interval == 0) {
+        fprintf(stderr, "Invalid sample interval %s\n", argv[3]);
+        return 1;
+      }
+      argc -= 3;
+      argv += 3;
+    } else {
+      break;
+    }
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--multi") == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "Usage: %s [--scale FACTOR] --multi MEMORY_LOG_FILE...\n",
+              basename(argv[0]));
+      return 1;
+    }
+    return ProcessMulti(argc - 2, argv + 2, DEFAULT_MAX_THREADS, time_scale);
+  }
+
+  if (argc != 2 && argc != 3) {
+    if (argc > 3) {
+      fprintf(stderr, "Only two arguments are expected.\n");
+    } else {
+      fprintf(stderr, "Requires at least one argument.\n");
+    }
+    fprintf(stderr, "Usage: %s [--scale FACTOR] [--samples FILE INTERVAL] MEMORY_LOG_FILE [MAX_THREADS]\n", basename(argv[0]));
+    fprintf(stderr, "       %s --compile MEMORY_LOG_FILE OUTPUT_FILE\n", basename(argv[0]));
+    fprintf(stderr, "       %s [--scale FACTOR] --multi MEMORY_LOG_FILE...\n", basename(argv[0]));
+    fprintf(stderr, "A FACTOR of 1.0 reproduces the recorded inter-action delays of a\n");
+    fprintf(stderr, "compiled dump; larger factors replay proportionally faster.\n");
+    fprintf(stderr, "--samples writes a binary timeline of native PSS/VA samples taken\n");
+    fprintf(stderr, "every INTERVAL actions of a compiled dump to FILE.\n");
+    fprintf(stderr, "--multi forks one replayer per dump, starts them together and\n");
+    fprintf(stderr, "reports the system-wide peak native PSS of the set.\n");
+    return 1;
+  }
+
+  size_t max_threads = DEFAULT_MAX_THREADS;
+  if (argc == 3) {
+    max_threads = atoi(argv[2]);
+  }
+
+  return ReplayDumpFile(argv[1], max_threads, time_scale, timeline_file,
+                        timeline_interval, nullptr);
+}
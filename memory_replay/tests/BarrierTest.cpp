@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Barrier.h"
+
+struct shared_state_t {
+  ProcessBarrier barrier;
+  int value;
+  int copied;
+};
+
+TEST(BarrierTest, single_participant) {
+  ProcessBarrier barrier;
+  barrier.Init(1);
+  // With a single participant Wait() must not block.
+  barrier.Wait();
+  barrier.Wait();
+  barrier.Destroy();
+}
+
+TEST(BarrierTest, two_processes) {
+  shared_state_t* shared = reinterpret_cast<shared_state_t*>(
+      mmap(nullptr, sizeof(shared_state_t), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  ASSERT_TRUE(shared != MAP_FAILED);
+  shared->barrier.Init(2);
+  shared->value = 0;
+  shared->copied = 0;
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    shared->value = 1;
+    shared->barrier.Wait();
+    shared->barrier.Wait();
+    shared->copied = shared->value;
+    _exit(0);
+  }
+
+  // The first round guarantees the child's write happened before the
+  // parent was released.
+  shared->barrier.Wait();
+  ASSERT_EQ(1, shared->value);
+
+  // The barrier resets after a round: the second round guarantees the
+  // child sees this write.
+  shared->value = 2;
+  shared->barrier.Wait();
+
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(0, WEXITSTATUS(status));
+  ASSERT_EQ(2, shared->copied);
+
+  shared->barrier.Destroy();
+  munmap(shared, sizeof(shared_state_t));
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/test_utils.h>
+
+#include "Action.h"
+#include "Pointers.h"
+#include "ReplayFile.h"
+
+class ReplayFileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dump_file_ = new TemporaryFile();
+    ASSERT_TRUE(dump_file_->fd != -1);
+    out_file_ = new TemporaryFile();
+    ASSERT_TRUE(out_file_->fd != -1);
+  }
+
+  void TearDown() override {
+    delete out_file_;
+    delete dump_file_;
+  }
+
+  void Compile(const std::string& dump_data) {
+    ASSERT_EQ(static_cast<ssize_t>(dump_data.size()),
+              write(dump_file_->fd, dump_data.c_str(), dump_data.size()));
+
+    CompileDump(dump_file_->fd, out_file_->fd);
+
+    lseek(out_file_->fd, 0, SEEK_SET);
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(header_)),
+              read(out_file_->fd, &header_, sizeof(header_)));
+    ASSERT_EQ(0, memcmp(header_.magic, REPLAY_MAGIC, sizeof(header_.magic)));
+    ASSERT_EQ(REPLAY_VERSION, header_.version);
+  }
+
+  void ReadEntry(ReplayEntry* entry) {
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(*entry)),
+              read(out_file_->fd, entry, sizeof(*entry)));
+  }
+
+  TemporaryFile* dump_file_ = nullptr;
+  TemporaryFile* out_file_ = nullptr;
+  ReplayHeader header_;
+};
+
+TEST_F(ReplayFileTest, compile) {
+  std::string dump_data =
+      "1234: malloc 0xabcd 100\n"
+      "1234: calloc 0x5000 20 8\n"
+      "1234: memalign 0x6000 16 300\n"
+      "1234: realloc 0x7000 0xabcd 500\n"
+      "1234: free 0x5000\n"
+      "1234: free 0x0\n"
+      "1234: thread_done 0x0\n";
+  ASSERT_NO_FATAL_FAILURE(Compile(dump_data));
+
+  ASSERT_EQ(7U, header_.num_entries);
+  // All four allocations are outstanding before the first free.
+  ASSERT_EQ(4U, header_.max_allocs);
+
+  ReplayEntry entry;
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(1234, entry.tid);
+  ASSERT_EQ(REPLAY_MALLOC, entry.type);
+  ASSERT_EQ(0xabcdU, entry.key_pointer);
+  ASSERT_EQ(100U, entry.size);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_CALLOC, entry.type);
+  ASSERT_EQ(0x5000U, entry.key_pointer);
+  ASSERT_EQ(20U, entry.arg);
+  ASSERT_EQ(8U, entry.size);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_MEMALIGN, entry.type);
+  ASSERT_EQ(16U, entry.arg);
+  ASSERT_EQ(300U, entry.size);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_REALLOC, entry.type);
+  ASSERT_EQ(0x7000U, entry.key_pointer);
+  ASSERT_EQ(0xabcdU, entry.arg);
+  ASSERT_EQ(500U, entry.size);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_FREE, entry.type);
+  ASSERT_EQ(0x5000U, entry.key_pointer);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_FREE, entry.type);
+  ASSERT_EQ(0U, entry.key_pointer);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_THREAD_DONE, entry.type);
+}
+
+TEST_F(ReplayFileTest, compile_with_timestamps) {
+  std::string dump_data =
+      "1234: malloc 0xabcd 100 1000 2000\n"
+      "1234: free 0xabcd 3000 4000\n"
+      "1234: thread_done 0x0 5000 5000\n";
+  ASSERT_NO_FATAL_FAILURE(Compile(dump_data));
+
+  ASSERT_EQ(3U, header_.num_entries);
+
+  ReplayEntry entry;
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_MALLOC, entry.type);
+  ASSERT_EQ(100U, entry.size);
+  ASSERT_EQ(1000U, entry.start_nsecs);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_FREE, entry.type);
+  ASSERT_EQ(3000U, entry.start_nsecs);
+
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_THREAD_DONE, entry.type);
+  ASSERT_EQ(5000U, entry.start_nsecs);
+}
+
+TEST_F(ReplayFileTest, compile_without_timestamps) {
+  std::string dump_data = "1234: malloc 0xabcd 100\n";
+  ASSERT_NO_FATAL_FAILURE(Compile(dump_data));
+
+  ReplayEntry entry;
+  ASSERT_NO_FATAL_FAILURE(ReadEntry(&entry));
+  ASSERT_EQ(REPLAY_MALLOC, entry.type);
+  ASSERT_EQ(0U, entry.start_nsecs);
+}
+
+TEST_F(ReplayFileTest, create_from_entry_malloc) {
+  ReplayEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.tid = 1;
+  entry.type = REPLAY_MALLOC;
+  entry.key_pointer = 0x1234;
+  entry.size = 1024;
+
+  uint8_t memory[Action::MaxActionSize()];
+  Action* action = Action::CreateFromEntry(&entry, memory);
+  ASSERT_TRUE(action != nullptr);
+  ASSERT_FALSE(action->DoesFree());
+  ASSERT_FALSE(action->EndThread());
+
+  Pointers pointers(1);
+  action->Execute(&pointers);
+  void* pointer = pointers.Remove(0x1234);
+  ASSERT_TRUE(pointer != nullptr);
+  free(pointer);
+}
+
+TEST_F(ReplayFileTest, create_from_entry_free_and_end) {
+  ReplayEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.tid = 1;
+  entry.type = REPLAY_FREE;
+  entry.key_pointer = 0x1234;
+
+  uint8_t memory[Action::MaxActionSize()];
+  Action* action = Action::CreateFromEntry(&entry, memory);
+  ASSERT_TRUE(action != nullptr);
+  ASSERT_TRUE(action->DoesFree());
+
+  Pointers pointers(1);
+  pointers.Add(0x1234, malloc(10));
+  action->Execute(&pointers);
+
+  entry.type = REPLAY_THREAD_DONE;
+  entry.key_pointer = 0;
+  action = Action::CreateFromEntry(&entry, memory);
+  ASSERT_TRUE(action != nullptr);
+  ASSERT_TRUE(action->EndThread());
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <android-base/test_utils.h>
+
+#include "Timeline.h"
+
+class TimelineTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    out_file_ = new TemporaryFile();
+    ASSERT_TRUE(out_file_->fd != -1);
+  }
+
+  void TearDown() override {
+    delete out_file_;
+  }
+
+  void ReadBack(TimelineHeader* header) {
+    lseek(out_file_->fd, 0, SEEK_SET);
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(*header)),
+              read(out_file_->fd, header, sizeof(*header)));
+    ASSERT_EQ(0, memcmp(header->magic, TIMELINE_MAGIC, sizeof(header->magic)));
+    ASSERT_EQ(TIMELINE_VERSION, header->version);
+  }
+
+  void ReadSample(TimelineSample* sample) {
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(*sample)),
+              read(out_file_->fd, sample, sizeof(*sample)));
+  }
+
+  TemporaryFile* out_file_ = nullptr;
+};
+
+TEST_F(TimelineTest, sample_needed) {
+  Timeline timeline(10, 4);
+  ASSERT_TRUE(timeline.SampleNeeded(0));
+  ASSERT_FALSE(timeline.SampleNeeded(1));
+  ASSERT_FALSE(timeline.SampleNeeded(9));
+  ASSERT_TRUE(timeline.SampleNeeded(10));
+  ASSERT_TRUE(timeline.SampleNeeded(200));
+}
+
+TEST_F(TimelineTest, sample_needed_zero_interval) {
+  // An interval of zero is coerced to one.
+  Timeline timeline(0, 4);
+  ASSERT_TRUE(timeline.SampleNeeded(0));
+  ASSERT_TRUE(timeline.SampleNeeded(1));
+  ASSERT_TRUE(timeline.SampleNeeded(2));
+}
+
+TEST_F(TimelineTest, write) {
+  Timeline timeline(5, 4);
+  timeline.Sample(0, 100);
+  timeline.Sample(5, 200);
+  timeline.Sample(10, 300);
+  ASSERT_EQ(3U, timeline.samples_taken());
+  ASSERT_TRUE(timeline.Write(out_file_->fd));
+
+  TimelineHeader header;
+  ASSERT_NO_FATAL_FAILURE(ReadBack(&header));
+  ASSERT_EQ(5U, header.interval);
+  ASSERT_EQ(3U, header.num_samples);
+  ASSERT_EQ(0U, header.num_dropped);
+
+  TimelineSample sample;
+  ASSERT_NO_FATAL_FAILURE(ReadSample(&sample));
+  ASSERT_EQ(0U, sample.action_index);
+  ASSERT_EQ(100U, sample.allocated_bytes);
+
+  ASSERT_NO_FATAL_FAILURE(ReadSample(&sample));
+  ASSERT_EQ(5U, sample.action_index);
+  ASSERT_EQ(200U, sample.allocated_bytes);
+
+  ASSERT_NO_FATAL_FAILURE(ReadSample(&sample));
+  ASSERT_EQ(10U, sample.action_index);
+  ASSERT_EQ(300U, sample.allocated_bytes);
+}
+
+TEST_F(TimelineTest, write_wrapped) {
+  Timeline timeline(1, 2);
+  timeline.Sample(0, 100);
+  timeline.Sample(1, 200);
+  timeline.Sample(2, 300);
+  ASSERT_TRUE(timeline.Write(out_file_->fd));
+
+  TimelineHeader header;
+  ASSERT_NO_FATAL_FAILURE(ReadBack(&header));
+  ASSERT_EQ(2U, header.num_samples);
+  ASSERT_EQ(1U, header.num_dropped);
+
+  // The oldest sample was dropped, the rest are in chronological order.
+  TimelineSample sample;
+  ASSERT_NO_FATAL_FAILURE(ReadSample(&sample));
+  ASSERT_EQ(1U, sample.action_index);
+  ASSERT_EQ(200U, sample.allocated_bytes);
+
+  ASSERT_NO_FATAL_FAILURE(ReadSample(&sample));
+  ASSERT_EQ(2U, sample.action_index);
+  ASSERT_EQ(300U, sample.allocated_bytes);
+}
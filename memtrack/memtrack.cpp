@@ -29,6 +29,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include <log/log.h>
@@ -113,50 +115,72 @@ const char *ProcessInfo::kProc = "/proc/";
 const char *ProcessInfo::kCmdline = "/cmdline";
 const char *ProcessInfo::kSmaps = "/smaps";
 
-ProcessInfo::ProcessInfo() {
+ProcessInfo::ProcessInfo() : num_scans_(0) {
   memcpy(proc_file_, kProc, kProcLen);
 }
 
 ProcessInfo::~ProcessInfo() {
 }
 
-bool ProcessInfo::getInformation(int pid, char *pid_str, size_t pid_str_len) {
+bool ProcessInfo::resolveProcess(int pid, char *pid_str, size_t pid_str_len,
+                                 const std::string **name) {
   memcpy(proc_file_ + kProcLen, pid_str, pid_str_len);
-  memcpy(proc_file_ + kProcLen + pid_str_len, kCmdline, kCmdlineLen);
+  proc_file_[kProcLen + pid_str_len] = '\0';
 
-  // Read the cmdline for the process.
-  int fd = open(proc_file_, O_RDONLY);
-  if (fd < 0) {
+  struct stat pid_stat;
+  if (stat(proc_file_, &pid_stat) != 0) {
     return false;
   }
 
-  ssize_t bytes = read(fd, cmd_name_, sizeof(cmd_name_));
-  close(fd);
-  if (bytes == -1 || bytes == 0) {
-    return false;
-  }
+  cmdline_cache_entry_t &cached = cmdline_cache_[pid];
+  if (cached.start_time != pid_stat.st_ctime) {
+    // New pid, or the pid has been reused since the last scan, so the
+    // cmdline has to be (re-)read.
+    memcpy(proc_file_ + kProcLen + pid_str_len, kCmdline, kCmdlineLen);
 
-  memcpy(proc_file_ + kProcLen + pid_str_len, kSmaps, kSmapsLen);
-  FileData smaps(proc_file_, buffer_, sizeof(buffer_));
+    int fd = open(proc_file_, O_RDONLY);
+    if (fd < 0) {
+      cmdline_cache_.erase(pid);
+      return false;
+    }
 
-  cur_process_info_t process_info;
-  size_t pss_kb;
-  process_info.pss_kb = 0;
-  while (smaps.getPss(&pss_kb)) {
-    process_info.pss_kb += pss_kb;
-  }
+    ssize_t bytes = read(fd, cmd_name_, sizeof(cmd_name_) - 1);
+    close(fd);
+    if (bytes == -1 || bytes == 0) {
+      cmdline_cache_.erase(pid);
+      return false;
+    }
+    cmd_name_[bytes] = '\0';
 
-  if (cur_.count(cmd_name_) == 0) {
-    cur_[cmd_name_] = process_info;
-  } else {
-    cur_[cmd_name_].pss_kb += process_info.pss_kb;
+    cached.name = cmd_name_;
+    cached.start_time = pid_stat.st_ctime;
   }
-  cur_[cmd_name_].pids.push_back(pid);
+  cached.last_scan = num_scans_;
+
+  *name = &cached.name;
 
   return true;
 }
 
+void ProcessInfo::scanSmaps(scan_target_t *target) {
+  char proc_file[PATH_MAX];
+  char buffer[kBufferLen];
+
+  memcpy(proc_file, kProc, kProcLen);
+  memcpy(proc_file + kProcLen, target->pid_str, target->pid_str_len);
+  memcpy(proc_file + kProcLen + target->pid_str_len, kSmaps, kSmapsLen);
+  FileData smaps(proc_file, buffer, sizeof(buffer));
+
+  size_t pss_kb;
+  target->pss_kb = 0;
+  while (smaps.getPss(&pss_kb)) {
+    target->pss_kb += pss_kb;
+  }
+}
+
 void ProcessInfo::scan() {
+  num_scans_++;
+
   DIR *proc_dir = opendir(kProc);
   if (proc_dir == NULL) {
     perror("Cannot open directory.\n");
@@ -173,6 +197,7 @@ void ProcessInfo::scan() {
   bool is_pid;
   size_t pid;
   cur_.clear();
+  targets_.clear();
   while ((dir_data = readdir(proc_dir))) {
     // Check if the directory entry represents a pid.
     len = strlen(dir_data->d_name);
@@ -185,12 +210,61 @@ void ProcessInfo::scan() {
       }
       pid = pid * 10 + dir_data->d_name[i] - '0';
     }
-    if (is_pid) {
-      getInformation(pid, dir_data->d_name, len);
+    if (is_pid && len < (int)sizeof(scan_target_t::pid_str)) {
+      scan_target_t target;
+      target.pid = pid;
+      memcpy(target.pid_str, dir_data->d_name, len);
+      target.pid_str_len = len;
+      target.pss_kb = 0;
+      if (resolveProcess(pid, dir_data->d_name, len, &target.name)) {
+        targets_.push_back(target);
+      }
     }
   }
   closedir(proc_dir);
 
+  // Reading and parsing the smaps files dominates the scan time and is
+  // independent per process, so spread the targets over a bounded pool of
+  // worker threads. A scan is then bounded by the slowest single process
+  // instead of the sum of all of them.
+  size_t num_threads = std::min(targets_.size(),
+                                static_cast<size_t>(kMaxScanThreads));
+  if (num_threads > 1) {
+    std::atomic<size_t> next_pos(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; i++) {
+      threads.push_back(std::thread([&]() {
+        size_t pos;
+        while ((pos = next_pos.fetch_add(1)) < targets_.size()) {
+          scanSmaps(&targets_[pos]);
+        }
+      }));
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+  } else if (num_threads == 1) {
+    scanSmaps(&targets_[0]);
+  }
+
+  // Merge the scanned targets, accumulating processes with the same name.
+  for (std::vector<scan_target_t>::const_iterator it = targets_.begin();
+       it != targets_.end(); ++it) {
+    cur_process_info_t &info = cur_[*it->name];
+    info.pss_kb += it->pss_kb;
+    info.pids.push_back(it->pid);
+  }
+
+  // Drop cache entries for pids that are no longer running.
+  for (cmdline_cache_t::iterator it = cmdline_cache_.begin();
+       it != cmdline_cache_.end();) {
+    if (it->second.last_scan != num_scans_) {
+      cmdline_cache_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+
   // Loop through the current processes and add them into our real list.
   for (cur_processes_t::const_iterator it = cur_.begin();
        it != cur_.end(); ++it) {
@@ -219,6 +293,7 @@ void ProcessInfo::scan() {
       all_[it->first].min_pss_kb = it->second.pss_kb;
     }
 
+    all_[it->first].prev_pss_kb = all_[it->first].last_pss_kb;
     all_[it->first].last_pss_kb = it->second.pss_kb;
 
     computeAvg(&all_[it->first].avg_pss_kb, it->second.pss_kb,
@@ -260,14 +335,38 @@ void ProcessInfo::dumpToLog() {
   }
 }
 
+void ProcessInfo::dumpDeltas() {
+  for (processes_t::iterator it = all_.begin(); it != all_.end(); ++it) {
+    process_info_t *proc = &it->second;
+    if (proc->pids.size() == 0) {
+      if (proc->last_pss_kb != 0) {
+        printf("%s exited, PSS was %0.4fM\n", proc->name.c_str(),
+               proc->last_pss_kb/1024.0);
+        proc->last_pss_kb = 0;
+        proc->prev_pss_kb = 0;
+      }
+    } else if (proc->prev_pss_kb == 0) {
+      printf("%s new, PSS %0.4fM\n", proc->name.c_str(),
+             proc->last_pss_kb/1024.0);
+    } else if (proc->last_pss_kb != proc->prev_pss_kb) {
+      printf("%s PSS %+0.4fM -> %0.4fM\n", proc->name.c_str(),
+             ((double)proc->last_pss_kb - (double)proc->prev_pss_kb)/1024.0,
+             proc->last_pss_kb/1024.0);
+    }
+  }
+  fflush(stdout);
+}
+
 void usage() {
-  printf("Usage: memtrack [--verbose | --quiet] [--scan_delay TIME_SECS]\n");
+  printf("Usage: memtrack [--verbose | --quiet] [--delta] [--scan_delay TIME_SECS]\n");
   printf("  --scan_delay TIME_SECS\n");
   printf("    The amount of delay in seconds between scans.\n");
   printf("  --verbose\n");
   printf("    Print information about the scans to stdout only.\n");
   printf("  --quiet\n");
   printf("    Nothing will be printed to stdout.\n");
+  printf("  --delta\n");
+  printf("    After each scan, print the processes whose pss changed.\n");
   printf("  All scan data is dumped to the android log using the tag %s\n",
          LOG_TAG);
 }
@@ -296,12 +395,15 @@ int main(int argc, char **argv) {
 
   bool verbose = false;
   bool quiet = false;
+  bool delta = false;
   unsigned int scan_delay_sec = DEFAULT_SLEEP_DELAY_SECONDS;
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--verbose") == 0) {
       verbose = true;
     } else if (strcmp(argv[i], "--quiet") == 0) {
       quiet = true;
+    } else if (strcmp(argv[i], "--delta") == 0) {
+      delta = true;
     } else if (strcmp(argv[i], "--scan_delay") == 0) {
       if (i+1 == argc) {
         printf("The %s options requires a single argument.\n", argv[i]);
@@ -320,6 +422,11 @@ int main(int argc, char **argv) {
     usage();
     exit(1);
   }
+  if (quiet && delta) {
+    printf("Both --quiet and --delta cannot be specified.\n");
+    usage();
+    exit(1);
+  }
 
   // Set up the signal handlers.
   for (size_t i = 0; i < sizeof(SignalsToHandle)/sizeof(int); i++) {
@@ -353,6 +460,9 @@ int main(int argc, char **argv) {
       nsecs = ((unsigned long long)t.tv_sec*NS_PER_SEC + t.tv_nsec) - nsecs;
       printf("Scan Time %0.4f\n", ((double)nsecs)/NS_PER_SEC);
     }
+    if (delta) {
+      proc_info.dumpDeltas();
+    }
 
     if (SignalReceived != 0) {
       proc_info.dumpToLog();
@@ -57,6 +57,7 @@ typedef struct {
   size_t min_pss_kb;
   size_t max_pss_kb;
   size_t last_pss_kb;
+  size_t prev_pss_kb;
 
   std::vector<int> pids;
 } process_info_t;
@@ -69,13 +70,35 @@ typedef struct {
 } cur_process_info_t;
 typedef std::map<std::string, cur_process_info_t> cur_processes_t;
 
+typedef struct {
+  std::string name;
+  // Creation time of the /proc/<pid> directory, used to detect pid reuse.
+  time_t start_time;
+  size_t last_scan;
+} cmdline_cache_entry_t;
+typedef std::map<int, cmdline_cache_entry_t> cmdline_cache_t;
+
+typedef struct {
+  int pid;
+  char pid_str[32];
+  size_t pid_str_len;
+  // Points at the name in the cmdline cache entry for the pid.
+  const std::string *name;
+  size_t pss_kb;
+} scan_target_t;
+
 class ProcessInfo {
 public:
   ProcessInfo();
   ~ProcessInfo();
 
-  // Get the information about a single process.
-  bool getInformation(int pid, char *pid_str, size_t pid_str_len);
+  // Look up the cmdline of a single process, validating the cmdline cache.
+  bool resolveProcess(int pid, char *pid_str, size_t pid_str_len,
+                      const std::string **name);
+
+  // Sum the PSS of a single process from its smaps file. Only touches the
+  // target, so scan targets can be processed on concurrent threads.
+  static void scanSmaps(scan_target_t *target);
 
   // Scan all of the running processes.
   void scan();
@@ -83,6 +106,9 @@ public:
   // Dump the information about all of the processes in the system to the log.
   void dumpToLog();
 
+  // Print the processes whose pss changed since the previous scan.
+  void dumpDeltas();
+
 private:
   static const size_t kBufferLen = 4096;
   static const size_t kCmdNameLen = 1024;
@@ -101,6 +127,8 @@ private:
 
   static const size_t kInitialEntries = 1000;
 
+  static const size_t kMaxScanThreads = 4;
+
   char proc_file_[PATH_MAX];
   char buffer_[kBufferLen];
 
@@ -111,6 +139,13 @@ private:
   processes_t all_;
   cur_processes_t cur_;
   std::vector<const process_info_t *> list_;
+  std::vector<scan_target_t> targets_;
+
+  // Cache of the cmdline for each pid so repeated scans do not have to
+  // re-read it. /proc does not generate inotify events, so entries are
+  // validated by the creation time of the pid directory instead.
+  cmdline_cache_t cmdline_cache_;
+  size_t num_scans_;
 
   // Compute a running average.
   static inline void computeAvg(double *running_avg, size_t cur_avg,
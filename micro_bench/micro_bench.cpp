@@ -15,7 +15,8 @@
 */
 
 /*
- * Micro-benchmarking of sleep/cpu speed/memcpy/memset/memory reads/strcmp.
+ * Micro-benchmarking of sleep/cpu speed/memcpy/memset/memory reads/strcmp
+ * and synchronization primitives (futex wake, contended mutexes, condvars).
  */
 
 #include <stdio.h>
@@ -23,8 +24,12 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <pthread.h>
 #include <sched.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -47,10 +52,26 @@
 // Default memory alignment of malloc.
 #define DEFAULT_MALLOC_MEMORY_ALIGNMENT   8
 
+// The default distance, in bytes, between the nodes of the memlatency
+// pointer chain. One cache line keeps every load a miss once the
+// working set outgrows a cache level; page-sized strides add TLB
+// pressure on top.
+#define DEFAULT_CHASE_STRIDE    64
+
 // Contains information about benchmark options.
 typedef struct {
     bool print_average;
     bool print_each_iter;
+    bool print_json;
+
+    int warmup_iters;
+    int outlier_mad_limit;
+
+    int num_threads;
+
+    int chase_stride;
+    bool hugepage;
+    bool lock_freq;
 
     int dst_align;
     int dst_or_mask;
@@ -82,6 +103,19 @@ typedef struct {
     void_func_t func;
 } function_t;
 
+// Full barrier that also serializes instruction execution, so work
+// from the timed region cannot drift past the clock reads around it.
+static inline void serializeExecution() {
+#if defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("isb" ::: "memory");
+#elif defined(__i386__) || defined(__x86_64__)
+    int eax = 0;
+    __asm__ __volatile__("cpuid" : "+a"(eax) :: "%ebx", "%ecx", "%edx", "memory");
+#else
+    __sync_synchronize();
+#endif
+}
+
 // Get the current time in nanoseconds.
 uint64_t nanoTime() {
   struct timespec t;
@@ -91,6 +125,79 @@ uint64_t nanoTime() {
   return static_cast<uint64_t>(t.tv_sec) * NS_PER_SEC + t.tv_nsec;
 }
 
+// The cpu the main thread was locked to, for cpufreq control and the
+// frequency fields in the results.
+static int locked_cpu = -1;
+
+static int readCpufreqStr(int cpu, const char *file, char *buf, size_t len) {
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/%s",
+             cpu, file);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    if (!fgets(buf, len, f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int writeCpufreqStr(int cpu, const char *file, const char *value) {
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/%s",
+             cpu, file);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+    int bad = (fputs(value, f) == EOF);
+    if (fclose(f) != 0) {
+        bad = 1;
+    }
+    return bad ? -1 : 0;
+}
+
+// The frequency the locked cpu is actually running at, in kHz, or -1
+// if cpufreq is not available.
+long getCpuFreqKhz(int cpu) {
+    char buf[64];
+    if (cpu < 0 || readCpufreqStr(cpu, "scaling_cur_freq", buf, sizeof(buf))) {
+        return -1;
+    }
+    return strtol(buf, NULL, 10);
+}
+
+static char saved_governor[64];
+static int freq_locked_cpu = -1;
+
+void restoreCpufreq() {
+    if (freq_locked_cpu >= 0) {
+        writeCpufreqStr(freq_locked_cpu, "scaling_governor", saved_governor);
+    }
+}
+
+// Pin the cpu's frequency to its maximum by switching it to the
+// performance governor. The previous governor is restored on exit.
+bool lockCpufreq(int cpu) {
+    if (readCpufreqStr(cpu, "scaling_governor", saved_governor,
+                       sizeof(saved_governor))) {
+        printf("Unable to read the cpufreq governor of cpu %d.\n", cpu);
+        return false;
+    }
+    if (writeCpufreqStr(cpu, "scaling_governor", "performance")) {
+        printf("Unable to set the performance governor on cpu %d (not root?).\n",
+               cpu);
+        return false;
+    }
+    freq_locked_cpu = cpu;
+    atexit(restoreCpufreq);
+    return true;
+}
+
 // Static analyzer warns about potential memory leak of orig_ptr
 // in getAlignedMemory. That is true and the callers in this program
 // do not free orig_ptr. But, we don't care about that in this
@@ -159,6 +266,145 @@ static inline void printSummary(uint64_t /*time_ns*/, const char *name, size_t s
            max/1024.0);
 }
 
+// Holds the per-iteration averages for the structured results backend
+// so the summary statistics are computed over the full distribution
+// instead of a running mean.
+typedef struct {
+    double *values;
+    size_t num_values;
+    size_t max_values;
+    size_t num_warmup;
+} sample_data_t;
+
+void recordSample(sample_data_t *samples, double value) {
+    if (samples->num_values == samples->max_values) {
+        samples->max_values = (samples->max_values == 0) ? 64 : samples->max_values * 2;
+        samples->values = reinterpret_cast<double*>(
+            realloc(samples->values, samples->max_values * sizeof(double)));
+        if (!samples->values) {
+            perror("Unable to allocate sample buffer.\n");
+            exit(1);
+        }
+    }
+    samples->values[samples->num_values++] = value;
+}
+
+int compareDouble(const void *a, const void *b) {
+    double diff = *reinterpret_cast<const double*>(a) - *reinterpret_cast<const double*>(b);
+    if (diff < 0.0) {
+        return -1;
+    } else if (diff > 0.0) {
+        return 1;
+    }
+    return 0;
+}
+
+// Nearest-rank percentile of an already sorted array.
+double computePercentile(const double *sorted, size_t num, double percentile) {
+    size_t rank = static_cast<size_t>(ceil((percentile / 100.0) * num));
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+// Reject samples more than mad_limit scaled median-absolute-deviations
+// away from the median. The sorted array is compacted to the retained
+// samples and the number rejected is returned.
+size_t rejectOutliers(double *sorted, size_t *num, int mad_limit) {
+    size_t n = *num;
+    double median = computePercentile(sorted, n, 50.0);
+    double *devs = reinterpret_cast<double*>(malloc(n * sizeof(double)));
+    if (!devs) {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        devs[i] = fabs(sorted[i] - median);
+    }
+    qsort(devs, n, sizeof(double), compareDouble);
+    double mad = computePercentile(devs, n, 50.0);
+    free(devs);
+    if (mad == 0.0) {
+        return 0;
+    }
+
+    // 1.4826 scales the MAD to the standard deviation of a normal
+    // distribution.
+    double limit = mad_limit * 1.4826 * mad;
+    size_t start = 0;
+    size_t end = n;
+    while (start < end && sorted[start] < median - limit) {
+        start++;
+    }
+    while (end > start && sorted[end - 1] > median + limit) {
+        end--;
+    }
+    if (start > 0) {
+        memmove(sorted, sorted + start, (end - start) * sizeof(double));
+    }
+    *num = end - start;
+    return n - *num;
+}
+
+// Emit one benchmark result as a single JSON object on its own line.
+// The warmup iterations were never recorded; rejected outliers are
+// excluded from the statistics but still listed in "samples".
+void printJsonResult(const char *name, const command_data_t &cmd_data,
+                     size_t size, size_t copies, size_t num_buffers,
+                     const char *unit, double scale, sample_data_t *samples) {
+    size_t num = samples->num_values;
+    double *sorted = reinterpret_cast<double*>(malloc(num * sizeof(double)));
+    if (!sorted) {
+        perror("Unable to allocate sample buffer.\n");
+        exit(1);
+    }
+    memcpy(sorted, samples->values, num * sizeof(double));
+    qsort(sorted, num, sizeof(double), compareDouble);
+
+    size_t rejected = 0;
+    if (cmd_data.outlier_mad_limit > 0 && num > 2) {
+        rejected = rejectOutliers(sorted, &num, cmd_data.outlier_mad_limit);
+    }
+
+    double mean = 0.0;
+    double std_dev = 0.0;
+    if (num > 0) {
+        for (size_t i = 0; i < num; i++) {
+            mean += sorted[i];
+        }
+        mean /= num;
+        for (size_t i = 0; i < num; i++) {
+            std_dev += (sorted[i] - mean) * (sorted[i] - mean);
+        }
+        std_dev = sqrt(std_dev / num);
+    }
+
+    printf("{\"benchmark\":\"%s\",\"size\":%zu,\"copies\":%zu,\"num_buffers\":%zu,"
+           "\"unit\":\"%s\",\"iterations\":%zu,\"warmup_discarded\":%zu,"
+           "\"outliers_rejected\":%zu",
+           name, size, copies, num_buffers, unit,
+           samples->num_values + samples->num_warmup, samples->num_warmup,
+           rejected);
+    long freq = getCpuFreqKhz(locked_cpu);
+    if (freq > 0) {
+        printf(",\"cpu\":%d,\"cpu_freq_khz\":%ld", locked_cpu, freq);
+    }
+    if (num > 0) {
+        printf(",\"mean\":%f,\"std_dev\":%f,\"min\":%f,\"max\":%f,"
+               "\"p50\":%f,\"p95\":%f,\"p99\":%f",
+               mean/scale, std_dev/scale, sorted[0]/scale, sorted[num-1]/scale,
+               computePercentile(sorted, num, 50.0)/scale,
+               computePercentile(sorted, num, 95.0)/scale,
+               computePercentile(sorted, num, 99.0)/scale);
+    }
+    printf(",\"samples\":[");
+    for (size_t i = 0; i < samples->num_values; i++) {
+        printf("%s%f", (i == 0) ? "" : ",", samples->values[i]/scale);
+    }
+    printf("]}\n");
+    free(sorted);
+}
+
 // For the cold benchmarks, a large buffer will be created which
 // contains many "size" buffers. This function will figure out the increment
 // needed between each buffer so that each one is aligned to "alignment".
@@ -195,16 +441,21 @@ static void inline printColdSummary(
            computeStdDev(running_avg, square_avg)/1024.0, min/1024.0, max/1024.0);
 }
 
-#define MAINLOOP(cmd_data, BENCH, COMPUTE_AVG, PRINT_ITER, PRINT_AVG) \
+#define MAINLOOP(cmd_data, BENCH, COMPUTE_AVG, PRINT_ITER, PRINT_AVG, PRINT_JSON) \
     uint64_t time_ns;                                                 \
     int iters = (cmd_data).args[1];                                   \
     bool print_average = (cmd_data).print_average;                    \
     bool print_each_iter = (cmd_data).print_each_iter;                \
+    bool print_json = (cmd_data).print_json;                          \
+    int warmup_iters = (cmd_data).warmup_iters;                       \
+    sample_data_t samples = { NULL, 0, 0, 0 };                        \
     double min = 0.0, max = 0.0, running_avg = 0.0, square_avg = 0.0; \
     double avg;                                                       \
     for (int i = 0; iters == -1 || i < iters; i++) {                  \
+        serializeExecution();                                         \
         time_ns = nanoTime();                                         \
         BENCH;                                                        \
+        serializeExecution();                                         \
         time_ns = nanoTime() - time_ns;                               \
         avg = COMPUTE_AVG;                                            \
         if (print_average) {                                          \
@@ -217,12 +468,23 @@ static void inline printColdSummary(
                 max = avg;                                            \
             }                                                         \
         }                                                             \
+        if (print_json) {                                             \
+            if (i < warmup_iters) {                                   \
+                samples.num_warmup++;                                 \
+            } else {                                                  \
+                recordSample(&samples, avg);                          \
+            }                                                         \
+        }                                                             \
         if (print_each_iter) {                                        \
             PRINT_ITER;                                               \
         }                                                             \
     }                                                                 \
     if (print_average) {                                              \
         PRINT_AVG;                                                    \
+    }                                                                 \
+    if (print_json) {                                                 \
+        PRINT_JSON;                                                   \
+        free(samples.values);                                         \
     }
 
 #define MAINLOOP_DATA(name, cmd_data, size, BENCH)                    \
@@ -236,7 +498,9 @@ static void inline printColdSummary(
              printIter(time_ns, name, size, copies, avg),             \
              double std_dev = computeStdDev(square_avg, running_avg); \
              printSummary(time_ns, name, size, copies, running_avg,   \
-                          std_dev, min, max));
+                          std_dev, min, max),                         \
+             printJsonResult(name, cmd_data, size, copies, 0,         \
+                             "MB/s", 1024.0, &samples));
 
 #define MAINLOOP_COLD(name, cmd_data, size, num_incrs, BENCH)                 \
     size_t num_strides = num_buffers / (num_incrs);                           \
@@ -262,7 +526,9 @@ static void inline printColdSummary(
             computeColdAverage(time_ns, size, copies, num_buffers),           \
             printColdIter(time_ns, name, size, copies, num_buffers, avg),     \
             printColdSummary(time_ns, name, size, copies, num_buffers,        \
-                             running_avg, square_avg, min, max));
+                             running_avg, square_avg, min, max),              \
+            printJsonResult(name, cmd_data, size, copies, num_buffers,        \
+                            "MB/s", 1024.0, &samples));
 
 // This version of the macro creates a single buffer of the given size and
 // alignment. The variable "buf" will be a pointer to the buffer and should
@@ -378,19 +644,620 @@ static void inline printColdSummary(
                       buf2 += buf2_stride_incr;                               \
                   });
 
-int benchmarkSleep(const char* /*name*/, const command_data_t &cmd_data, void_func_t /*func*/) {
+// Per-thread state for the --threads scaling mode. Each worker owns its
+// buffers (allocated and touched on the worker after it pins itself, so
+// first-touch places them local to that cpu) and records the time of
+// its most recent iteration.
+typedef struct {
+    pthread_t thread;
+    int idx;
+    int cpu;
+    bool memset_op;
+    bool cold;
+    memcpy_func_t memcpy_func;
+    memset_func_t memset_func;
+    const command_data_t *cmd_data;
+
+    size_t size;
+    size_t copies;
+    uint8_t *buf1;
+    uint8_t *buf2;
+
+    // Cold-mode walk state, precomputed to match MAINLOOP_COLD.
+    size_t num_buffers;
+    size_t buf1_incr;
+    size_t buf2_incr;
+    size_t num_incrs;
+    size_t num_strides;
+
+    uint64_t time_ns;
+    pthread_barrier_t *start_barrier;
+    pthread_barrier_t *end_barrier;
+    volatile bool *done;
+} bench_thread_t;
+
+void *benchThreadWorker(void *data) {
+    bench_thread_t *state = reinterpret_cast<bench_thread_t*>(data);
+    const command_data_t *cmd_data = state->cmd_data;
+
+    if (state->cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(state->cpu, &cpuset);
+        if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+            perror("sched_setaffinity failed");
+        }
+    }
+
+    size_t size = state->size;
+    if (!state->cold) {
+        if (state->memset_op) {
+            state->buf1 = allocateAlignedMemory(size, cmd_data->dst_align, cmd_data->dst_or_mask);
+        } else {
+            state->buf1 = allocateAlignedMemory(size, cmd_data->src_align, cmd_data->src_or_mask);
+            state->buf2 = allocateAlignedMemory(size, cmd_data->dst_align, cmd_data->dst_or_mask);
+        }
+    } else {
+        if (state->memset_op) {
+            state->buf1 = getColdBuffer(state->num_buffers, state->buf1_incr,
+                                        cmd_data->dst_align, cmd_data->dst_or_mask);
+        } else {
+            state->buf1 = getColdBuffer(state->num_buffers, state->buf1_incr,
+                                        cmd_data->src_align, cmd_data->src_or_mask);
+            state->buf2 = getColdBuffer(state->num_buffers, state->buf2_incr,
+                                        cmd_data->dst_align, cmd_data->dst_or_mask);
+        }
+    }
+    if (!state->buf1 || (!state->memset_op && !state->buf2)) {
+        printf("Thread %d failed to allocate buffers.\n", state->idx);
+        exit(1);
+    }
+    if (state->cold) {
+        memset(state->buf1, 0xff, state->num_buffers * state->buf1_incr);
+        if (!state->memset_op) {
+            memset(state->buf2, 0, state->num_buffers * state->buf2_incr);
+        }
+    } else {
+        memset(state->buf1, 0xff, size);
+        if (!state->memset_op) {
+            memset(state->buf2, 0, size);
+        }
+    }
+
+    // Rendezvous once after setup so the first timed iteration does not
+    // include buffer allocation and initialization.
+    pthread_barrier_wait(state->end_barrier);
+
+    size_t copies = state->copies;
+    size_t j, k, l;
+    while (true) {
+        pthread_barrier_wait(state->start_barrier);
+        if (*state->done) {
+            break;
+        }
+        serializeExecution();
+        uint64_t time_ns = nanoTime();
+        if (!state->cold) {
+            if (state->memset_op) {
+                for (j = 0; j < copies; j++) {
+                    state->memset_func(state->buf1, j, size);
+                }
+            } else {
+                for (j = 0; j < copies; j++) {
+                    state->memcpy_func(state->buf2, state->buf1, size);
+                }
+            }
+        } else {
+            size_t buf1_stride_incr = state->buf1_incr * state->num_incrs;
+            size_t buf2_stride_incr = state->buf2_incr * state->num_incrs;
+            for (j = 0; j < copies; j++) {
+                for (k = 0; k < state->num_incrs; k++) {
+                    uint8_t *buf1 = state->buf1 + k * state->buf1_incr;
+                    uint8_t *buf2 = state->buf2 + k * state->buf2_incr;
+                    for (l = 0; l < state->num_strides; l++) {
+                        if (state->memset_op) {
+                            state->memset_func(buf1, l, size);
+                        } else {
+                            state->memcpy_func(buf2, buf1, size);
+                        }
+                        buf1 += buf1_stride_incr;
+                        buf2 += buf2_stride_incr;
+                    }
+                }
+            }
+        }
+        serializeExecution();
+        state->time_ns = nanoTime() - time_ns;
+        pthread_barrier_wait(state->end_barrier);
+    }
+
+    return NULL;
+}
+
+void printThreadsIter(uint64_t time_ns, const char *name, bench_thread_t *threads,
+                      int num_threads, size_t size, size_t copies,
+                      size_t num_buffers, double avg) {
+    printf("%s %d threads %zux%zu bytes took %.06f seconds (aggregate %f MB/s)\n",
+           name, num_threads, copies, size, (double)time_ns/NS_PER_SEC, avg/1024.0);
+    for (int t = 0; t < num_threads; t++) {
+        double thread_avg;
+        if (num_buffers > 0) {
+            thread_avg = computeColdAverage(threads[t].time_ns, size, copies, num_buffers);
+        } else {
+            thread_avg = computeAverage(threads[t].time_ns, size, copies);
+        }
+        printf("  thread %d (cpu %d) %f MB/s\n", t, threads[t].cpu, thread_avg/1024.0);
+    }
+}
+
+// Run the memcpy/memset benchmark on num_threads worker threads pinned
+// to consecutive cpus. Every iteration the workers are released
+// together through a barrier, each walking its own buffers, and the
+// aggregate is computed from the wall time of the whole parallel phase.
+int benchmarkThreads(const char *name, const command_data_t &cmd_data,
+                     void_func_t func, bool memset_op, bool cold) {
+    int num_threads = cmd_data.num_threads;
+    size_t size = cmd_data.args[0];
+    size_t copies;
+    size_t num_buffers = 0;
+    size_t buf1_incr = 0;
+    size_t buf2_incr = 0;
+    size_t num_incrs = 0;
+    size_t num_strides = 0;
+
+    if (!cold) {
+        copies = cmd_data.data_size/size;
+    } else {
+        // Mirror the geometry of MAINLOOP_COLD, with the cold buffer
+        // split between the threads so the total footprint still
+        // exceeds the caches.
+        buf1_incr = getAlignmentIncrement(size, memset_op ? cmd_data.dst_align : cmd_data.src_align);
+        size_t max_incr = buf1_incr;
+        size_t min_incr = buf1_incr;
+        if (!memset_op) {
+            buf2_incr = getAlignmentIncrement(size, cmd_data.dst_align);
+            if (buf2_incr > max_incr) max_incr = buf2_incr;
+            if (buf2_incr < min_incr) min_incr = buf2_incr;
+        }
+        num_buffers = (cmd_data.cold_data_size / num_threads) / max_incr;
+        num_incrs = cmd_data.cold_stride_size / min_incr + 1;
+        num_strides = num_buffers / num_incrs;
+        if ((num_buffers % num_incrs) != 0) {
+            num_strides--;
+        }
+        if (num_strides == 0) {
+            printf("%s: Chosen options lead to no copies, aborting.\n", name);
+            return -1;
+        }
+        num_buffers = num_incrs * num_strides;
+        copies = 1;
+        if (num_buffers * size < static_cast<size_t>(cmd_data.data_size)) {
+            copies = cmd_data.data_size / (num_buffers * size);
+        }
+    }
+
+    pthread_barrier_t start_barrier;
+    pthread_barrier_t end_barrier;
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    pthread_barrier_init(&end_barrier, NULL, num_threads + 1);
+    volatile bool done = false;
+
+    int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int base_cpu = (cmd_data.cpu_to_lock >= 0) ? cmd_data.cpu_to_lock : 0;
+
+    bench_thread_t *threads = reinterpret_cast<bench_thread_t*>(
+        calloc(num_threads, sizeof(bench_thread_t)));
+    if (!threads) {
+        return -1;
+    }
+    for (int t = 0; t < num_threads; t++) {
+        threads[t].idx = t;
+        threads[t].cpu = (num_cpus > 0) ? (base_cpu + t) % num_cpus : -1;
+        threads[t].memset_op = memset_op;
+        threads[t].cold = cold;
+        threads[t].memcpy_func = reinterpret_cast<memcpy_func_t>(func);
+        threads[t].memset_func = reinterpret_cast<memset_func_t>(func);
+        threads[t].cmd_data = &cmd_data;
+        threads[t].size = size;
+        threads[t].copies = copies;
+        threads[t].num_buffers = num_buffers;
+        threads[t].buf1_incr = buf1_incr;
+        threads[t].buf2_incr = buf2_incr;
+        threads[t].num_incrs = num_incrs;
+        threads[t].num_strides = num_strides;
+        threads[t].start_barrier = &start_barrier;
+        threads[t].end_barrier = &end_barrier;
+        threads[t].done = &done;
+        if (pthread_create(&threads[t].thread, NULL, benchThreadWorker, &threads[t]) != 0) {
+            perror("pthread_create failed");
+            exit(1);
+        }
+    }
+
+    // Wait for every worker to finish setting up its buffers.
+    pthread_barrier_wait(&end_barrier);
+
+    size_t total_copies = copies * num_threads;
+    MAINLOOP(cmd_data,
+             pthread_barrier_wait(&start_barrier);
+             pthread_barrier_wait(&end_barrier),
+             (num_buffers > 0) ?
+                 computeColdAverage(time_ns, size, total_copies, num_buffers) :
+                 computeAverage(time_ns, size, total_copies),
+             printThreadsIter(time_ns, name, threads, num_threads, size,
+                              copies, num_buffers, avg),
+             double std_dev = computeStdDev(square_avg, running_avg); \
+             printSummary(time_ns, name, size, total_copies, running_avg, \
+                          std_dev, min, max),
+             printJsonResult(name, cmd_data, size, total_copies, num_buffers,
+                             "MB/s", 1024.0, &samples));
+
+    done = true;
+    pthread_barrier_wait(&start_barrier);
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+    pthread_barrier_destroy(&end_barrier);
+    free(threads);
+
+    return 0;
+}
+
+int benchmarkSleep(const char *name, const command_data_t &cmd_data, void_func_t /*func*/) {
     int delay = cmd_data.args[0];
     MAINLOOP(cmd_data, sleep(delay),
              (double)time_ns/NS_PER_SEC,
              printf("sleep(%d) took %.06f seconds\n", delay, avg);,
              printf("  sleep(%d) average %.06f seconds std dev %f min %.06f seconds max %0.6f seconds\n", \
                     delay, running_avg, computeStdDev(square_avg, running_avg), \
-                    min, max));
+                    min, max),
+             printJsonResult(name, cmd_data, delay, 1, 0, "seconds", 1.0, &samples));
+
+    return 0;
+}
+
+// Futex wrapper. Going through the raw syscall keeps the pthread
+// layer out of the futex_wake numbers.
+static int futexOp(volatile int *addr, int op, int val) {
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+// Pin the calling thread to the given cpu, or leave it alone if the
+// cpu is negative.
+static void pinToCpu(int cpu) {
+    cpu_set_t cpuset;
+
+    if (cpu < 0)
+        return;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+        perror("sched_setaffinity failed");
+    }
+}
+
+// One waiter for the futex_wake benchmark. The waker stamps
+// wake_time_ns just before issuing the wake and the waiter stamps
+// again as soon as it is back on a cpu, so latency_ns is the full
+// wake-to-run cost including the scheduler.
+typedef struct {
+    pthread_t thread;
+    int idx;
+    int cpu;
+
+    volatile int futex_word;
+    volatile int ack;
+    volatile uint64_t wake_time_ns;
+    volatile uint64_t latency_ns;
+    volatile bool *done;
+} futex_waiter_t;
+
+void *futexWaiterWorker(void *data) {
+    futex_waiter_t *state = reinterpret_cast<futex_waiter_t*>(data);
+    int seen = 0;
+
+    pinToCpu(state->cpu);
+
+    while (true) {
+        while (state->futex_word == seen && !*state->done) {
+            futexOp(&state->futex_word, FUTEX_WAIT_PRIVATE, seen);
+        }
+        if (*state->done) {
+            break;
+        }
+        seen = state->futex_word;
+        state->latency_ns = nanoTime() - state->wake_time_ns;
+        state->ack = 1;
+    }
+
+    return NULL;
+}
+
+int benchmarkFutexWake(const char *name, const command_data_t &cmd_data, void_func_t /*func*/) {
+    int num_threads = cmd_data.num_threads;
+    size_t wakes = cmd_data.args[0];
+    volatile bool done = false;
+
+    int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int base_cpu = (cmd_data.cpu_to_lock >= 0) ? cmd_data.cpu_to_lock : 0;
+
+    futex_waiter_t *waiters = reinterpret_cast<futex_waiter_t*>(
+        calloc(num_threads, sizeof(futex_waiter_t)));
+    if (!waiters) {
+        return -1;
+    }
+    for (int t = 0; t < num_threads; t++) {
+        waiters[t].idx = t;
+        waiters[t].cpu = (num_cpus > 0) ? (base_cpu + t) % num_cpus : -1;
+        waiters[t].done = &done;
+        if (pthread_create(&waiters[t].thread, NULL, futexWaiterWorker, &waiters[t]) != 0) {
+            perror("pthread_create failed");
+            exit(1);
+        }
+    }
+
+    // The waker spins on the ack instead of sleeping so the waiter's
+    // latency stamp is consumed before its futex word moves again.
+    uint64_t total_latency;
+    size_t j;
+    MAINLOOP(cmd_data,
+             total_latency = 0;                                       \
+             for (j = 0; j < wakes; j++) {                            \
+                 futex_waiter_t *w = &waiters[j % num_threads];       \
+                 w->ack = 0;                                          \
+                 w->wake_time_ns = nanoTime();                        \
+                 w->futex_word++;                                     \
+                 futexOp(&w->futex_word, FUTEX_WAKE_PRIVATE, 1);      \
+                 while (!w->ack) {}                                   \
+                 total_latency += w->latency_ns;                      \
+             },
+             (double)total_latency/wakes,
+             printf("%s %d threads %zu wakes took %.06f seconds (%f ns/wake)\n", \
+                    name, num_threads, wakes, (double)time_ns/NS_PER_SEC, avg),
+             printf("  %s %d threads %zu wakes average %f ns/wake std dev %f min %f ns/wake max %f ns/wake\n", \
+                    name, num_threads, wakes, running_avg, \
+                    computeStdDev(square_avg, running_avg), min, max),
+             printJsonResult(name, cmd_data, num_threads, wakes, 0,
+                             "ns/wake", 1.0, &samples));
+
+    done = true;
+    for (int t = 0; t < num_threads; t++) {
+        waiters[t].futex_word++;
+        futexOp(&waiters[t].futex_word, FUTEX_WAKE_PRIVATE, 1);
+        pthread_join(waiters[t].thread, NULL);
+    }
+    free(waiters);
+
+    return 0;
+}
+
+// One worker for mutex_contended. Every worker hammers the same mutex
+// and the critical section is a single counter increment, so the
+// numbers are dominated by lock handoff rather than work done under
+// the lock.
+typedef struct {
+    pthread_t thread;
+    int idx;
+    int cpu;
+    size_t locks;
+    pthread_mutex_t *mutex;
+    uint64_t *counter;
+    pthread_barrier_t *start_barrier;
+    pthread_barrier_t *end_barrier;
+    volatile bool *done;
+} mutex_thread_t;
+
+void *mutexWorker(void *data) {
+    mutex_thread_t *state = reinterpret_cast<mutex_thread_t*>(data);
+    size_t j;
+
+    pinToCpu(state->cpu);
+
+    while (true) {
+        pthread_barrier_wait(state->start_barrier);
+        if (*state->done) {
+            break;
+        }
+        for (j = 0; j < state->locks; j++) {
+            pthread_mutex_lock(state->mutex);
+            (*state->counter)++;
+            pthread_mutex_unlock(state->mutex);
+        }
+        pthread_barrier_wait(state->end_barrier);
+    }
+
+    return NULL;
+}
+
+int benchmarkMutexContended(const char *name, const command_data_t &cmd_data, void_func_t /*func*/) {
+    int num_threads = cmd_data.num_threads;
+    size_t locks = cmd_data.args[0];
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    uint64_t counter = 0;
+    volatile bool done = false;
+
+    pthread_barrier_t start_barrier;
+    pthread_barrier_t end_barrier;
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    pthread_barrier_init(&end_barrier, NULL, num_threads + 1);
+
+    int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int base_cpu = (cmd_data.cpu_to_lock >= 0) ? cmd_data.cpu_to_lock : 0;
+
+    mutex_thread_t *threads = reinterpret_cast<mutex_thread_t*>(
+        calloc(num_threads, sizeof(mutex_thread_t)));
+    if (!threads) {
+        return -1;
+    }
+    for (int t = 0; t < num_threads; t++) {
+        threads[t].idx = t;
+        threads[t].cpu = (num_cpus > 0) ? (base_cpu + t) % num_cpus : -1;
+        threads[t].locks = locks;
+        threads[t].mutex = &mutex;
+        threads[t].counter = &counter;
+        threads[t].start_barrier = &start_barrier;
+        threads[t].end_barrier = &end_barrier;
+        threads[t].done = &done;
+        if (pthread_create(&threads[t].thread, NULL, mutexWorker, &threads[t]) != 0) {
+            perror("pthread_create failed");
+            exit(1);
+        }
+    }
+
+    size_t total_locks = locks * num_threads;
+    MAINLOOP(cmd_data,
+             pthread_barrier_wait(&start_barrier);                    \
+             pthread_barrier_wait(&end_barrier),
+             (double)time_ns/total_locks,
+             printf("%s %d threads %zu locks took %.06f seconds (%f ns/lock)\n", \
+                    name, num_threads, total_locks, (double)time_ns/NS_PER_SEC, avg),
+             printf("  %s %d threads %zu locks average %f ns/lock std dev %f min %f ns/lock max %f ns/lock\n", \
+                    name, num_threads, total_locks, running_avg, \
+                    computeStdDev(square_avg, running_avg), min, max),
+             printJsonResult(name, cmd_data, num_threads, total_locks, 0,
+                             "ns/lock", 1.0, &samples));
+
+    done = true;
+    pthread_barrier_wait(&start_barrier);
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+    pthread_barrier_destroy(&start_barrier);
+    pthread_barrier_destroy(&end_barrier);
+    free(threads);
+
+    if (counter == 0) {
+        printf("%s failed, no locks were taken.\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Shared state for the condvar benchmark. The waker signals cond and
+// then sleeps on ack_cond until whichever waiter won the race has
+// recorded its latency. Since the woken waiter must reacquire the
+// mutex before it can run, that cost is part of the reported
+// wake-to-run latency, as it is for every real condvar user.
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_cond_t ack_cond;
+    int generation;
+    int ack;
+    uint64_t wake_time_ns;
+    uint64_t latency_ns;
+    bool done;
+} condvar_state_t;
+
+typedef struct {
+    pthread_t thread;
+    int idx;
+    int cpu;
+    condvar_state_t *state;
+} condvar_waiter_t;
+
+void *condvarWaiterWorker(void *data) {
+    condvar_waiter_t *waiter = reinterpret_cast<condvar_waiter_t*>(data);
+    condvar_state_t *state = waiter->state;
+
+    pinToCpu(waiter->cpu);
+
+    pthread_mutex_lock(&state->mutex);
+    int gen = state->generation;
+    while (!state->done) {
+        while (state->generation == gen && !state->done) {
+            pthread_cond_wait(&state->cond, &state->mutex);
+        }
+        if (state->done) {
+            break;
+        }
+        gen = state->generation;
+        state->latency_ns = nanoTime() - state->wake_time_ns;
+        state->ack = 1;
+        pthread_cond_signal(&state->ack_cond);
+    }
+    pthread_mutex_unlock(&state->mutex);
+
+    return NULL;
+}
+
+int benchmarkCondvar(const char *name, const command_data_t &cmd_data, void_func_t /*func*/) {
+    int num_threads = cmd_data.num_threads;
+    size_t wakes = cmd_data.args[0];
+
+    condvar_state_t state;
+    pthread_mutex_init(&state.mutex, NULL);
+    pthread_cond_init(&state.cond, NULL);
+    pthread_cond_init(&state.ack_cond, NULL);
+    state.generation = 0;
+    state.ack = 0;
+    state.done = false;
+
+    int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int base_cpu = (cmd_data.cpu_to_lock >= 0) ? cmd_data.cpu_to_lock : 0;
+
+    condvar_waiter_t *waiters = reinterpret_cast<condvar_waiter_t*>(
+        calloc(num_threads, sizeof(condvar_waiter_t)));
+    if (!waiters) {
+        return -1;
+    }
+    for (int t = 0; t < num_threads; t++) {
+        waiters[t].idx = t;
+        waiters[t].cpu = (num_cpus > 0) ? (base_cpu + t) % num_cpus : -1;
+        waiters[t].state = &state;
+        if (pthread_create(&waiters[t].thread, NULL, condvarWaiterWorker, &waiters[t]) != 0) {
+            perror("pthread_create failed");
+            exit(1);
+        }
+    }
+
+    uint64_t total_latency;
+    size_t j;
+    MAINLOOP(cmd_data,
+             total_latency = 0;                                       \
+             for (j = 0; j < wakes; j++) {                            \
+                 pthread_mutex_lock(&state.mutex);                    \
+                 state.ack = 0;                                       \
+                 state.wake_time_ns = nanoTime();                     \
+                 state.generation++;                                  \
+                 pthread_cond_signal(&state.cond);                    \
+                 while (!state.ack) {                                 \
+                     pthread_cond_wait(&state.ack_cond, &state.mutex); \
+                 }                                                    \
+                 total_latency += state.latency_ns;                   \
+                 pthread_mutex_unlock(&state.mutex);                  \
+             },
+             (double)total_latency/wakes,
+             printf("%s %d threads %zu wakes took %.06f seconds (%f ns/wake)\n", \
+                    name, num_threads, wakes, (double)time_ns/NS_PER_SEC, avg),
+             printf("  %s %d threads %zu wakes average %f ns/wake std dev %f min %f ns/wake max %f ns/wake\n", \
+                    name, num_threads, wakes, running_avg, \
+                    computeStdDev(square_avg, running_avg), min, max),
+             printJsonResult(name, cmd_data, num_threads, wakes, 0,
+                             "ns/wake", 1.0, &samples));
+
+    pthread_mutex_lock(&state.mutex);
+    state.done = true;
+    pthread_cond_broadcast(&state.cond);
+    pthread_mutex_unlock(&state.mutex);
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(waiters[t].thread, NULL);
+    }
+    pthread_mutex_destroy(&state.mutex);
+    pthread_cond_destroy(&state.cond);
+    pthread_cond_destroy(&state.ack_cond);
+    free(waiters);
 
     return 0;
 }
 
 int benchmarkMemset(const char *name, const command_data_t &cmd_data, void_func_t func) {
+    if (cmd_data.num_threads > 1) {
+        return benchmarkThreads(name, cmd_data, func, true, false);
+    }
+
     memset_func_t memset_func = reinterpret_cast<memset_func_t>(func);
     BENCH_ONE_BUF(name, cmd_data, ;, memset_func(buf, i, size));
 
@@ -398,6 +1265,10 @@ int benchmarkMemset(const char *name, const command_data_t &cmd_data, void_func_
 }
 
 int benchmarkMemsetCold(const char *name, const command_data_t &cmd_data, void_func_t func) {
+    if (cmd_data.num_threads > 1) {
+        return benchmarkThreads(name, cmd_data, func, true, true);
+    }
+
     memset_func_t memset_func = reinterpret_cast<memset_func_t>(func);
     COLD_ONE_BUF(name, cmd_data, ;, memset_func(buf, l, size));
 
@@ -405,6 +1276,10 @@ int benchmarkMemsetCold(const char *name, const command_data_t &cmd_data, void_f
 }
 
 int benchmarkMemcpy(const char *name, const command_data_t &cmd_data, void_func_t func) {
+    if (cmd_data.num_threads > 1) {
+        return benchmarkThreads(name, cmd_data, func, false, false);
+    }
+
     memcpy_func_t memcpy_func = reinterpret_cast<memcpy_func_t>(func);
 
     BENCH_TWO_BUFS(name, cmd_data,
@@ -416,6 +1291,10 @@ int benchmarkMemcpy(const char *name, const command_data_t &cmd_data, void_func_
 }
 
 int benchmarkMemcpyCold(const char *name, const command_data_t &cmd_data, void_func_t func) {
+    if (cmd_data.num_threads > 1) {
+        return benchmarkThreads(name, cmd_data, func, false, true);
+    }
+
     memcpy_func_t memcpy_func = reinterpret_cast<memcpy_func_t>(func);
 
     COLD_TWO_BUFS(name, cmd_data,
@@ -460,6 +1339,91 @@ int benchmarkMemread(const char *name, const command_data_t &cmd_data, void_func
     return 0;
 }
 
+// Keeps the final chain pointer live so the compiler cannot remove the
+// dependent loads.
+static void *saved_chain_ptr;
+
+// Link the buffer into a single random cycle of pointers, one node
+// every stride bytes, so each load depends on the previous one and the
+// hardware prefetchers cannot follow the access pattern.
+void buildPointerChain(uint8_t *buf, size_t num_nodes, size_t stride) {
+    size_t *order = reinterpret_cast<size_t*>(malloc(num_nodes * sizeof(size_t)));
+    if (!order) {
+        perror("Unable to allocate chain order buffer.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < num_nodes; i++) {
+        order[i] = i;
+    }
+    // Sattolo's algorithm generates a permutation that is a single
+    // cycle, so the chain visits every node before wrapping around.
+    // Use a fixed seed so every run chases the same chain.
+    srand(1);
+    for (size_t i = num_nodes - 1; i > 0; i--) {
+        size_t j = rand() % i;
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (size_t i = 0; i < num_nodes; i++) {
+        size_t from = order[i];
+        size_t to = order[(i + 1) % num_nodes];
+        *reinterpret_cast<void**>(buf + from * stride) = buf + to * stride;
+    }
+    free(order);
+}
+
+int benchmarkMemlatency(const char *name, const command_data_t &cmd_data, void_func_t /*func*/) {
+    size_t size = cmd_data.args[0];
+    size_t stride = cmd_data.chase_stride;
+    size_t num_nodes = size / stride;
+    if (num_nodes < 2) {
+        printf("%s: the working set must contain at least two stride-sized nodes.\n",
+               name);
+        return -1;
+    }
+
+    uint8_t *buf;
+    if (cmd_data.hugepage) {
+        buf = reinterpret_cast<uint8_t*>(mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (buf == MAP_FAILED) {
+            perror("Unable to map hugepage buffer.\n");
+            return -1;
+        }
+        if (madvise(buf, size, MADV_HUGEPAGE) != 0) {
+            perror("madvise(MADV_HUGEPAGE) failed");
+        }
+    } else {
+        buf = allocateAlignedMemory(size, cmd_data.dst_align, cmd_data.dst_or_mask);
+        if (!buf) {
+            return -1;
+        }
+    }
+    buildPointerChain(buf, num_nodes, stride);
+
+    // Walk roughly data_size bytes of chain per iteration so the run
+    // time is comparable to the bandwidth benchmarks.
+    size_t num_loads = cmd_data.data_size / stride;
+    void **p = reinterpret_cast<void**>(buf);
+    size_t j;
+    MAINLOOP(cmd_data,
+             for (j = 0; j < num_loads; j++) { \
+                 p = reinterpret_cast<void**>(*p); \
+             },
+             (double)time_ns/num_loads,
+             printf("%s %zu bytes stride %zu %zu loads took %.06f seconds (%f ns/load)\n", \
+                    name, size, stride, num_loads, (double)time_ns/NS_PER_SEC, avg),
+             printf("  %s %zu bytes stride %zu average %f ns/load std dev %f min %f ns/load max %f ns/load\n", \
+                    name, size, stride, running_avg, \
+                    computeStdDev(square_avg, running_avg), min, max),
+             printJsonResult(name, cmd_data, size, num_loads, 0,
+                             "ns/load", 1.0, &samples));
+    saved_chain_ptr = p;
+
+    return 0;
+}
+
 int benchmarkStrcmp(const char *name, const command_data_t &cmd_data, void_func_t func) {
     strcmp_func_t strcmp_func = reinterpret_cast<strcmp_func_t>(func);
 
@@ -586,13 +1550,17 @@ int benchmarkStrcpyCold(const char *name, const command_data_t &cmd_data, void_f
 
 // Create the mapping structure.
 function_t function_table[] = {
+    { "condvar", benchmarkCondvar, NULL },
+    { "futex_wake", benchmarkFutexWake, NULL },
     { "memcpy", benchmarkMemcpy, reinterpret_cast<void_func_t>(memcpy) },
     { "memcpy_cold", benchmarkMemcpyCold, reinterpret_cast<void_func_t>(memcpy) },
     { "memmove_forward", benchmarkMemcpy, reinterpret_cast<void_func_t>(memmove) },
     { "memmove_backward", benchmarkMemmoveBackwards, reinterpret_cast<void_func_t>(memmove) },
+    { "memlatency", benchmarkMemlatency, NULL },
     { "memread", benchmarkMemread, NULL },
     { "memset", benchmarkMemset, reinterpret_cast<void_func_t>(memset) },
     { "memset_cold", benchmarkMemsetCold, reinterpret_cast<void_func_t>(memset) },
+    { "mutex_contended", benchmarkMutexContended, NULL },
     { "sleep", benchmarkSleep, NULL },
     { "strcat", benchmarkStrcat, reinterpret_cast<void_func_t>(strcat) },
     { "strcat_cold", benchmarkStrcatCold, reinterpret_cast<void_func_t>(strcat) },
@@ -619,8 +1587,41 @@ void usage() {
     printf("      Print the average and standard deviation of all iterations.\n");
     printf("    --no_print_each_iter\n");
     printf("      Do not print any values in each iteration.\n");
+    printf("    --json\n");
+    printf("      Print the results as a single JSON object per benchmark with the\n");
+    printf("      per-iteration samples and p50/p95/p99 percentiles. Implies\n");
+    printf("      --no_print_each_iter.\n");
+    printf("    --warmup ITERS\n");
+    printf("      For --json, discard the first ITERS iterations from the statistics.\n");
+    printf("      The default is 0.\n");
+    printf("    --outlier_mad_limit LIMIT\n");
+    printf("      For --json, reject samples more than LIMIT scaled median-absolute-\n");
+    printf("      deviations from the median. The default is 0, which disables\n");
+    printf("      outlier rejection.\n");
+    printf("    --stride SIZE\n");
+    printf("      For memlatency, the distance in bytes between the nodes of the\n");
+    printf("      pointer chain. The default is 64. Use the page size (4096/65536)\n");
+    printf("      to make every load a TLB miss as well as a cache miss.\n");
+    printf("    --hugepage\n");
+    printf("      For memlatency, back the working set with transparent hugepages\n");
+    printf("      (madvise MADV_HUGEPAGE) instead of malloc.\n");
+    printf("    --threads N\n");
+    printf("      For memcpy/memset and their _cold versions, run N copies of the\n");
+    printf("      benchmark on N threads pinned to consecutive cores, each with its\n");
+    printf("      own buffers, started together each iteration. Every thread\n");
+    printf("      manipulates data_size bytes (the cold buffer is split between the\n");
+    printf("      threads), and both the aggregate and per-thread throughput are\n");
+    printf("      reported. For the synchronization benchmarks (condvar/futex_wake/\n");
+    printf("      mutex_contended), the number of waiter or contender threads, pinned\n");
+    printf("      to consecutive cores starting at --lock_to_cpu. The default is 1.\n");
     printf("    --lock_to_cpu CORE\n");
     printf("      Lock to the specified CORE. The default is to use the last core found.\n");
+    printf("    --lock_freq\n");
+    printf("      Switch the locked core to the performance cpufreq governor for the\n");
+    printf("      duration of the run, so the results are not at the mercy of the\n");
+    printf("      frequency scaler. Requires root; the previous governor is restored\n");
+    printf("      on exit. The achieved frequency is reported alongside the results\n");
+    printf("      whether or not the frequency is locked.\n");
     printf("    --dst_align ALIGN\n");
     printf("      If the command supports it, align the destination pointer to ALIGN.\n");
     printf("      The default is to use the value returned by malloc.\n");
@@ -651,9 +1652,19 @@ void usage() {
     printf("      The number of iterations to execute each benchmark. If not\n");
     printf("      passed in then run forever.\n");
     printf("  micro_bench cpu UNUSED [ITERS]\n");
+    printf("  micro_bench [--threads N] condvar WAKES [ITERS]\n");
+    printf("    WAKES\n");
+    printf("      The number of signal/wake round trips per iteration. The reported\n");
+    printf("      value is the average wake-to-run latency of one wake.\n");
+    printf("  micro_bench [--threads N] futex_wake WAKES [ITERS]\n");
     printf("  micro_bench [--dst_align ALIGN] [--dst_or_mask OR_MASK] memcpy NUM_BYTES [ITERS]\n");
+    printf("  micro_bench [--stride SIZE] [--hugepage] memlatency WORKING_SET_BYTES [ITERS]\n");
     printf("  micro_bench memread NUM_BYTES [ITERS]\n");
     printf("  micro_bench [--dst_align ALIGN] [--dst_or_mask OR_MASK] memset NUM_BYTES [ITERS]\n");
+    printf("  micro_bench [--threads N] mutex_contended LOCKS_PER_THREAD [ITERS]\n");
+    printf("    LOCKS_PER_THREAD\n");
+    printf("      The number of lock/unlock pairs each thread performs per iteration.\n");
+    printf("      The reported value is the average cost of one acquisition.\n");
     printf("  micro_bench sleep TIME_TO_SLEEP [ITERS]\n");
     printf("    TIME_TO_SLEEP\n");
     printf("      The time in seconds to sleep.\n");
@@ -672,6 +1683,13 @@ function_t *processOptions(int argc, char **argv, command_data_t *cmd_data) {
     // Initialize the command_flags.
     cmd_data->print_average = false;
     cmd_data->print_each_iter = true;
+    cmd_data->print_json = false;
+    cmd_data->warmup_iters = 0;
+    cmd_data->outlier_mad_limit = 0;
+    cmd_data->num_threads = 1;
+    cmd_data->chase_stride = DEFAULT_CHASE_STRIDE;
+    cmd_data->hugepage = false;
+    cmd_data->lock_freq = false;
     cmd_data->dst_align = 0;
     cmd_data->src_align = 0;
     cmd_data->src_or_mask = 0;
@@ -693,6 +1711,20 @@ function_t *processOptions(int argc, char **argv, command_data_t *cmd_data) {
                 cmd_data->print_average = true;
             } else if (strcmp(argv[i], "--no_print_each_iter") == 0) {
                 cmd_data->print_each_iter = false;
+            } else if (strcmp(argv[i], "--json") == 0) {
+                cmd_data->print_json = true;
+            } else if (strcmp(argv[i], "--warmup") == 0) {
+                save_value = &cmd_data->warmup_iters;
+            } else if (strcmp(argv[i], "--outlier_mad_limit") == 0) {
+                save_value = &cmd_data->outlier_mad_limit;
+            } else if (strcmp(argv[i], "--threads") == 0) {
+                save_value = &cmd_data->num_threads;
+            } else if (strcmp(argv[i], "--stride") == 0) {
+                save_value = &cmd_data->chase_stride;
+            } else if (strcmp(argv[i], "--hugepage") == 0) {
+                cmd_data->hugepage = true;
+            } else if (strcmp(argv[i], "--lock_freq") == 0) {
+                cmd_data->lock_freq = true;
             } else if (strcmp(argv[i], "--dst_align") == 0) {
                 save_value = &cmd_data->dst_align;
             } else if (strcmp(argv[i], "--src_align") == 0) {
@@ -759,6 +1791,19 @@ function_t *processOptions(int argc, char **argv, command_data_t *cmd_data) {
     } else if (cmd_data->data_size <= 0) {
         printf("The --data_size option must be a positive number.\n");
         return NULL;
+    } else if (cmd_data->warmup_iters < 0) {
+        printf("The --warmup option must be greater than or equal to 0.\n");
+        return NULL;
+    } else if (cmd_data->outlier_mad_limit < 0) {
+        printf("The --outlier_mad_limit option must be greater than or equal to 0.\n");
+        return NULL;
+    } else if (cmd_data->num_threads < 1) {
+        printf("The --threads option must be greater than or equal to 1.\n");
+        return NULL;
+    } else if (cmd_data->chase_stride < static_cast<int>(sizeof(void*)) ||
+               (cmd_data->chase_stride % sizeof(void*)) != 0) {
+        printf("The --stride option must be a multiple of the pointer size.\n");
+        return NULL;
     } else if ((cmd_data->dst_align & (cmd_data->dst_align - 1))) {
         printf("The --dst_align option must be a power of 2.\n");
         return NULL;
@@ -779,21 +1824,28 @@ function_t *processOptions(int argc, char **argv, command_data_t *cmd_data) {
         return NULL;
     }
 
+    // JSON output is consumed by machines, so keep the stream free of
+    // the free-form per-iteration lines.
+    if (cmd_data->print_json) {
+        cmd_data->print_each_iter = false;
+    }
+
     return command;
 }
 
-bool raisePriorityAndLock(int cpu_to_lock) {
+// Returns the cpu that was locked to, or -1 on failure.
+int raisePriorityAndLock(int cpu_to_lock) {
     cpu_set_t cpuset;
 
     if (setpriority(PRIO_PROCESS, 0, -20)) {
         perror("Unable to raise priority of process.\n");
-        return false;
+        return -1;
     }
 
     CPU_ZERO(&cpuset);
     if (sched_getaffinity(0, sizeof(cpuset), &cpuset) != 0) {
         perror("sched_getaffinity failed");
-        return false;
+        return -1;
     }
 
     if (cpu_to_lock < 0) {
@@ -805,22 +1857,22 @@ bool raisePriorityAndLock(int cpu_to_lock) {
         }
     } else if (!CPU_ISSET(cpu_to_lock, &cpuset)) {
         printf("Cpu %d does not exist.\n", cpu_to_lock);
-        return false;
+        return -1;
     }
 
     if (cpu_to_lock < 0) {
         printf("Cannot find any valid cpu to lock.\n");
-        return false;
+        return -1;
     }
 
     CPU_ZERO(&cpuset);
     CPU_SET(cpu_to_lock, &cpuset);
     if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
         perror("sched_setaffinity failed");
-        return false;
+        return -1;
     }
 
-    return true;
+    return cpu_to_lock;
 }
 
 int main(int argc, char **argv) {
@@ -832,10 +1884,28 @@ int main(int argc, char **argv) {
       return -1;
     }
 
-    if (!raisePriorityAndLock(cmd_data.cpu_to_lock)) {
+    locked_cpu = raisePriorityAndLock(cmd_data.cpu_to_lock);
+    if (locked_cpu < 0) {
       return -1;
     }
 
-    printf("%s\n", command->name);
-    return (*command->ptr)(command->name, cmd_data, command->func);
+    if (cmd_data.lock_freq && !lockCpufreq(locked_cpu)) {
+      return -1;
+    }
+
+    if (!cmd_data.print_json) {
+        printf("%s\n", command->name);
+        long freq = getCpuFreqKhz(locked_cpu);
+        if (freq > 0) {
+            printf("cpu %d running at %ld kHz\n", locked_cpu, freq);
+        }
+    }
+    int ret = (*command->ptr)(command->name, cmd_data, command->func);
+    if (!cmd_data.print_json) {
+        long freq = getCpuFreqKhz(locked_cpu);
+        if (freq > 0) {
+            printf("cpu %d finished at %ld kHz\n", locked_cpu, freq);
+        }
+    }
+    return ret;
 }
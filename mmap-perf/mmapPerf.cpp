@@ -6,9 +6,18 @@
 #include <iostream>
 #include <vector>
 #include <tuple>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
 
 #include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 
@@ -152,4 +161,308 @@ static void benchLinearWrite(benchmark::State& state) {
 }
 BENCHMARK(benchLinearWrite);
 
-BENCHMARK_MAIN()
+// Start/stop flags shared between the storm workers, placed in a
+// MAP_SHARED mapping so all processes begin faulting together.
+struct StormControl {
+    atomic<int> ready;
+    atomic<bool> go;
+};
+
+// Fault every page of the worker's mapping in random order, recording
+// the latency of each access. With a shared mapping the workers race
+// over the same file pages; with distinct mappings they only compete
+// for the LRU and the fault path itself.
+static void runStormWorker(FileMap *sharedMap, int workerIdx, size_t mapSize,
+                           StormControl *control, uint64_t *samples) {
+    unique_ptr<FileMap> ownMap;
+    FileMap *map = sharedMap;
+    if (map == nullptr) {
+        ownMap.reset(new FileMap{"/data/local/tmp/mmap_storm_" + to_string(workerIdx),
+                                 mapSize});
+        ownMap->dropCache();
+        map = ownMap.get();
+    }
+
+    size_t numPages = mapSize / pageSize;
+    vector<unsigned int> order(numPages);
+    for (size_t i = 0; i < numPages; i++)
+        order[i] = i;
+    minstd_rand rng{(unsigned int)workerIdx + 1};
+    shuffle(order.begin(), order.end(), rng);
+
+    control->ready.fetch_add(1);
+    while (!control->go.load())
+        ;
+
+    for (size_t i = 0; i < numPages; i++) {
+        auto start = chrono::steady_clock::now();
+        map->benchRandomRead(order[i]);
+        auto end = chrono::steady_clock::now();
+        samples[i] = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    }
+}
+
+static void printPercentiles(const string &label, uint64_t *samples, size_t num) {
+    sort(samples, samples + num);
+    printf("%s: faults: %zu, p50: %.2fus, p90: %.2fus, p99: %.2fus, max: %.2fus\n",
+           label.c_str(), num,
+           samples[num / 2] / 1000.0,
+           samples[(size_t)(num * 0.90)] / 1000.0,
+           samples[(size_t)(num * 0.99)] / 1000.0,
+           samples[num - 1] / 1000.0);
+}
+
+static int runFaultStorm(int numWorkers, bool sharedMapping, size_t mapSizeMb) {
+    size_t mapSize = mapSizeMb << 20;
+    size_t numPages = mapSize / pageSize;
+
+    StormControl *control = (StormControl*)mmap(nullptr, sizeof(StormControl),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    uint64_t *samples = (uint64_t*)mmap(nullptr,
+            numWorkers * numPages * sizeof(uint64_t),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if ((void*)control == MAP_FAILED || (void*)samples == MAP_FAILED) {
+        cout << "Error: mmap of storm state failed: " << strerror(errno) << endl;
+        return 1;
+    }
+    new (control) StormControl{};
+
+    // With --storm_shared every worker faults the same mapping, so the
+    // pages must exist (and be dropped) before the fork.
+    unique_ptr<FileMap> sharedMap;
+    if (sharedMapping) {
+        sharedMap.reset(new FileMap{"/data/local/tmp/mmap_storm_shared", mapSize});
+        sharedMap->dropCache();
+    }
+
+    vector<pid_t> pids;
+    for (int w = 0; w < numWorkers; w++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            cout << "Error: fork failed: " << strerror(errno) << endl;
+            return 1;
+        }
+        if (pid == 0) {
+            runStormWorker(sharedMap.get(), w, mapSize, control,
+                           samples + (size_t)w * numPages);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+
+    while (control->ready.load() < numWorkers)
+        ;
+    control->go.store(true);
+
+    int failures = 0;
+    for (pid_t pid : pids) {
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+                WEXITSTATUS(status) != 0)
+            failures++;
+    }
+    if (failures > 0) {
+        cout << "Error: " << failures << " worker(s) failed" << endl;
+        return 1;
+    }
+
+    printf("Fault storm: %d workers, %s mappings, %zu MB each\n",
+           numWorkers, sharedMapping ? "shared" : "distinct", mapSizeMb);
+    for (int w = 0; w < numWorkers; w++)
+        printPercentiles("worker " + to_string(w),
+                         samples + (size_t)w * numPages, numPages);
+    // Per-worker arrays are already sorted in place, so sorting the
+    // whole region again gives the aggregate distribution.
+    printPercentiles("aggregate", samples, (size_t)numWorkers * numPages);
+
+    munmap(samples, numWorkers * numPages * sizeof(uint64_t));
+    munmap(control, sizeof(StormControl));
+    return 0;
+}
+
+// One hardware or software event counted over the touch loop. Not
+// every kernel or core exposes every event; an unavailable counter is
+// reported as such instead of failing the run.
+class PerfCounter {
+    int m_fd = -1;
+public:
+    PerfCounter(uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        m_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    void start() {
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    // Returns the count, or -1 if the event could not be opened.
+    long long stop() {
+        if (m_fd < 0)
+            return -1;
+        ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long value;
+        if (read(m_fd, &value, sizeof(value)) != sizeof(value))
+            return -1;
+        return value;
+    }
+    ~PerfCounter() {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+};
+
+enum TouchVariant {
+    TOUCH_BASE,
+    TOUCH_THP,
+    TOUCH_POPULATE,
+    TOUCH_MLOCK,
+};
+
+static const char *touchVariantName(TouchVariant variant) {
+    switch (variant) {
+    case TOUCH_BASE: return "base";
+    case TOUCH_THP: return "thp";
+    case TOUCH_POPULATE: return "populate";
+    case TOUCH_MLOCK: return "mlock";
+    }
+    return "?";
+}
+
+// Map an anonymous region the way the variant prescribes, then touch
+// every page in the chosen order with per-page latency samples and
+// fault/dTLB-miss counters around the loop. For MAP_POPULATE and
+// mlock the faults are paid during setup, which is timed separately,
+// so the two costs can be weighed against each other.
+static int runTouchVariant(TouchVariant variant, size_t mapSizeMb, bool randomOrder) {
+    size_t mapSize = mapSizeMb << 20;
+    size_t numPages = mapSize / pageSize;
+    vector<uint64_t> samples(numPages);
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (variant == TOUCH_POPULATE)
+        flags |= MAP_POPULATE;
+
+    auto setupStart = chrono::steady_clock::now();
+    uint8_t *ptr = (uint8_t*)mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+                                  flags, -1, 0);
+    if ((void*)ptr == MAP_FAILED) {
+        cout << "Error: mmap failed: " << strerror(errno) << endl;
+        return 1;
+    }
+    if (variant == TOUCH_THP) {
+        if (madvise(ptr, mapSize, MADV_HUGEPAGE) != 0)
+            cout << "Warning: madvise(MADV_HUGEPAGE) failed: "
+                 << strerror(errno) << endl;
+    }
+    if (variant == TOUCH_MLOCK) {
+        if (mlock(ptr, mapSize) != 0) {
+            cout << "Error: mlock failed: " << strerror(errno) << endl;
+            munmap(ptr, mapSize);
+            return 1;
+        }
+    }
+    auto setupEnd = chrono::steady_clock::now();
+
+    vector<unsigned int> order(numPages);
+    for (size_t i = 0; i < numPages; i++)
+        order[i] = i;
+    if (randomOrder) {
+        minstd_rand rng{42};
+        shuffle(order.begin(), order.end(), rng);
+    }
+
+    PerfCounter faults{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS};
+    PerfCounter tlbMisses{PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_DTLB |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+
+    faults.start();
+    tlbMisses.start();
+    auto touchStart = chrono::steady_clock::now();
+    for (size_t i = 0; i < numPages; i++) {
+        uint8_t *targetPtr = ptr + (size_t)order[i] * pageSize;
+        auto start = chrono::steady_clock::now();
+        *targetPtr = 1;
+        auto end = chrono::steady_clock::now();
+        samples[i] = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    }
+    auto touchEnd = chrono::steady_clock::now();
+    long long numFaults = faults.stop();
+    long long numTlbMisses = tlbMisses.stop();
+
+    double setupMs = chrono::duration_cast<chrono::microseconds>
+        (setupEnd - setupStart).count() / 1000.0;
+    double touchMs = chrono::duration_cast<chrono::microseconds>
+        (touchEnd - touchStart).count() / 1000.0;
+
+    printf("%-8s setup: %8.2fms, touch: %8.2fms", touchVariantName(variant),
+           setupMs, touchMs);
+    if (numFaults >= 0)
+        printf(", faults: %lld (%.0f faults/s)", numFaults,
+               numFaults / (touchMs / 1000.0));
+    else
+        printf(", faults: unavailable");
+    if (numTlbMisses >= 0)
+        printf(", dTLB misses: %lld", numTlbMisses);
+    else
+        printf(", dTLB misses: unavailable");
+    printf("\n");
+    printPercentiles("  first-touch", samples.data(), numPages);
+
+    munmap(ptr, mapSize);
+    return 0;
+}
+
+static int runTouchCompare(size_t mapSizeMb, bool randomOrder) {
+    static const TouchVariant variants[] = {
+        TOUCH_BASE, TOUCH_THP, TOUCH_POPULATE, TOUCH_MLOCK,
+    };
+    printf("First-touch comparison: %zu MB anonymous mapping, %s order\n",
+           mapSizeMb, randomOrder ? "random" : "linear");
+    for (TouchVariant variant : variants) {
+        int ret = runTouchVariant(variant, mapSizeMb, randomOrder);
+        if (ret != 0)
+            return ret;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int stormWorkers = 0;
+    bool stormShared = false;
+    size_t stormSizeMb = 64;
+    bool touchCompare = false;
+    size_t touchSizeMb = 256;
+    bool touchRandom = false;
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == string("--storm") && i + 1 < argc) {
+            stormWorkers = atoi(argv[++i]);
+        } else if (string(argv[i]) == string("--storm_shared")) {
+            stormShared = true;
+        } else if (string(argv[i]) == string("--storm_size_mb") && i + 1 < argc) {
+            stormSizeMb = atoi(argv[++i]);
+        } else if (string(argv[i]) == string("--touch_compare")) {
+            touchCompare = true;
+        } else if (string(argv[i]) == string("--touch_size_mb") && i + 1 < argc) {
+            touchSizeMb = atoi(argv[++i]);
+        } else if (string(argv[i]) == string("--touch_random")) {
+            touchRandom = true;
+        }
+    }
+    if (stormWorkers > 0)
+        return runFaultStorm(stormWorkers, stormShared, stormSizeMb);
+    if (touchCompare)
+        return runTouchCompare(touchSizeMb, touchRandom);
+
+    ::benchmark::Initialize(&argc, argv);
+    ::benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
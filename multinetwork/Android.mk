@@ -28,4 +28,16 @@ LOCAL_SHARED_LIBRARIES := libandroid libbase libc++
 LOCAL_SRC_FILES := httpurl.cpp common.cpp
 include $(BUILD_EXECUTABLE)
 
+include $(CLEAR_VARS)
+LOCAL_MODULE := netbench
+
+LOCAL_C_INCLUDES += frameworks/native/include external/libcxx/include
+LOCAL_MODULE_PATH := $(TARGET_OUT_OPTIONAL_EXECUTABLES)
+ifndef BRILLO
+    LOCAL_MODULE_TAGS := debug
+endif  #!BRILLO
+LOCAL_SHARED_LIBRARIES := libandroid libbase libc++
+LOCAL_SRC_FILES := netbench.cpp common.cpp
+include $(BUILD_EXECUTABLE)
+
 endif  # ifneq ($(TARGET_BUILD_PDK), true)
@@ -33,7 +33,9 @@ bool strEqual(const char *a, const char *b) {
     return strcmp(a, b) == 0;
 }
 
-// Allow specifying network handles in decimal and hexadecimal.
+}  // namespace
+
+
 bool parseNetworkHandle(const char *arg, net_handle_t *nethandle) {
     if (arg == nullptr || !isdigit(arg[0]) || nethandle == nullptr) {
         return false;
@@ -50,7 +52,28 @@ bool parseNetworkHandle(const char *arg, net_handle_t *nethandle) {
     return false;
 }
 
-}  // namespace
+
+int bindSocketToNetwork(const struct Arguments& args, int fd) {
+    switch (args.api_mode) {
+        case ApiMode::EXPLICIT:
+            if (args.nethandle == NETWORK_UNSPECIFIED) { return 0; }
+            if (android_setsocknetwork(args.nethandle, fd) != 0) {
+                int errnum = errno;
+                std::cerr << "android_setsocknetwork() failed;"
+                          << " errno: " << errnum
+                          << " [" << strerror(errnum) << "]"
+                          << std::endl;
+                return -1;
+            }
+            return 0;
+        case ApiMode::PROCESS:
+            // The caller is expected to have called android_setprocnetwork()
+            // already; every socket is implicitly bound.
+            return 0;
+    }
+    // Unreachable.
+    return -1;
+}
 
 
 void printUsage(const char *progname) {
@@ -48,6 +48,14 @@ struct Arguments {
 
 void printUsage(const char *progname);
 
+// Allow specifying network handles in decimal and hexadecimal.
+bool parseNetworkHandle(const char *arg, net_handle_t *nethandle);
+
+// Bind |fd| to the network selected in |args|, honoring the chosen api
+// mode (socket-level vs process-level binding). A NETWORK_UNSPECIFIED
+// handle leaves the socket on the default network. Returns 0 on success.
+int bindSocketToNetwork(const struct Arguments& args, int fd);
+
 // If port is non-zero returns strings of the form "192.0.2.1:port" or
 // "[2001:db8::1]:port", else it returns the bare IP string literal.
 std::string inetSockaddrToString(const sockaddr* sa);
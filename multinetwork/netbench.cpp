@@ -0,0 +1,562 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// netbench: throughput benchmark over a bound network.
+//
+// dnschk and httpurl only answer "does this network work?"; this answers
+// "how fast is it, and at what syscall cost?". The sender drives
+// MSG_ZEROCOPY sends (falling back to ordinary sends on kernels without
+// SO_ZEROCOPY) and the receiver drains with batched recvmmsg, both over
+// the network selected with the usual --nethandle/--mode flags. One
+// summary line of counters is printed for the QA scripts to diff across
+// networks.
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <linux/errqueue.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <android/multinetwork.h>
+#include "common.h"
+
+// Not yet in all the sysroots we build against (linux 4.14).
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+
+namespace {
+
+struct Parameters {
+    Parameters() : sending(true), tcp(false), zerocopy(true),
+                   seconds(10), size(0), batch(32),
+                   host(), port() {}
+
+    bool sending;
+    bool tcp;
+    bool zerocopy;
+    int seconds;
+    size_t size;
+    int batch;
+    std::string host;
+    std::string port;
+};
+
+struct Counters {
+    Counters() : bytes(0), send_calls(0), recv_calls(0), errqueue_calls(0),
+                 messages(0), completions(0), copied(0) {}
+
+    uint64_t bytes;
+    uint64_t send_calls;
+    uint64_t recv_calls;
+    uint64_t errqueue_calls;
+    uint64_t messages;
+    uint64_t completions;
+    uint64_t copied;
+};
+
+
+void benchUsage(const char *progname) {
+    std::cerr << "Usage: " << progname
+              << " [--nethandle <nethandle>]"
+              << " [--mode explicit|process]"
+              << " [--family unspec|ipv4|ipv6]"
+              << std::endl
+              << "       "
+              << " [--tcp|--udp]"
+              << " [--seconds <n>]"
+              << " [--size <bytes>]"
+              << " [--batch <msgs>]"
+              << " [--no-zerocopy]"
+              << std::endl
+              << "       "
+              << " send <host> <port> | recv <port>"
+              << std::endl;
+    std::cerr << std::endl;
+    std::cerr << "Learn nethandle values from 'dumpsys connectivity --short' "
+              << "or 'dumpsys connectivity --diag'"
+              << std::endl;
+}
+
+bool parseBenchArguments(int argc, const char* argv[],
+                         struct Arguments* args,
+                         struct Parameters* parameters) {
+    int positional = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--nethandle") == 0) {
+            i++;
+            if (argc == i) { return false; }
+            if (!parseNetworkHandle(argv[i], &(args->nethandle))) {
+                std::cerr << "Failed to parse nethandle: '" << argv[i] << "'"
+                          << std::endl;
+                return false;
+            }
+        } else if (strcmp(argv[i], "--mode") == 0) {
+            i++;
+            if (argc == i) { return false; }
+            if (strcmp(argv[i], "explicit") == 0) {
+                args->api_mode = ApiMode::EXPLICIT;
+            } else if (strcmp(argv[i], "process") == 0) {
+                args->api_mode = ApiMode::PROCESS;
+            } else {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--family") == 0) {
+            i++;
+            if (argc == i) { return false; }
+            if (strcmp(argv[i], "unspec") == 0) {
+                args->family = AF_UNSPEC;
+            } else if (strcmp(argv[i], "ipv4") == 0) {
+                args->family = AF_INET;
+            } else if (strcmp(argv[i], "ipv6") == 0) {
+                args->family = AF_INET6;
+            } else {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--tcp") == 0) {
+            parameters->tcp = true;
+        } else if (strcmp(argv[i], "--udp") == 0) {
+            parameters->tcp = false;
+        } else if (strcmp(argv[i], "--no-zerocopy") == 0) {
+            parameters->zerocopy = false;
+        } else if (strcmp(argv[i], "--seconds") == 0) {
+            i++;
+            if (argc == i) { return false; }
+            parameters->seconds = atoi(argv[i]);
+            if (parameters->seconds <= 0) { return false; }
+        } else if (strcmp(argv[i], "--size") == 0) {
+            i++;
+            if (argc == i) { return false; }
+            parameters->size = strtoul(argv[i], nullptr, 0);
+            if (parameters->size == 0) { return false; }
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            i++;
+            if (argc == i) { return false; }
+            parameters->batch = atoi(argv[i]);
+            if (parameters->batch <= 0) { return false; }
+        } else {
+            switch (positional++) {
+                case 0:
+                    if (strcmp(argv[i], "send") == 0) {
+                        parameters->sending = true;
+                    } else if (strcmp(argv[i], "recv") == 0) {
+                        parameters->sending = false;
+                    } else {
+                        return false;
+                    }
+                    break;
+                case 1:
+                    if (parameters->sending) {
+                        parameters->host = argv[i];
+                    } else {
+                        parameters->port = argv[i];
+                    }
+                    break;
+                case 2:
+                    if (!parameters->sending) { return false; }
+                    parameters->port = argv[i];
+                    break;
+                default:
+                    return false;
+            }
+        }
+    }
+
+    if (positional != (parameters->sending ? 3 : 2)) { return false; }
+
+    if (parameters->size == 0) {
+        // Below a typical MTU for UDP so no datagram gets fragmented.
+        parameters->size = parameters->tcp ? 65536 : 1400;
+    }
+    return true;
+}
+
+double monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// Reap zerocopy completion notifications from the error queue so the
+// kernel can release the pinned pages. Returns the number of
+// notifications consumed, or -1 when the queue was empty.
+int drainErrqueue(int fd, struct Counters* counters) {
+    int drained = 0;
+
+    for (;;) {
+        struct msghdr msg = {};
+        char control[128];
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        counters->errqueue_calls++;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            const struct sock_extended_err *serr =
+                    reinterpret_cast<const struct sock_extended_err *>(
+                            CMSG_DATA(cmsg));
+            if (serr->ee_errno != 0 ||
+                serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // One notification covers the range [ee_info, ee_data].
+            counters->completions += serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                counters->copied += serr->ee_data - serr->ee_info + 1;
+            }
+            drained++;
+        }
+    }
+    return drained > 0 ? drained : -1;
+}
+
+void printReport(const struct Parameters& parameters,
+                 const struct Counters& counters,
+                 double seconds, bool zerocopy) {
+    std::cout << "netbench"
+              << "," << (parameters.tcp ? "tcp" : "udp")
+              << "," << (parameters.sending ? "send" : "recv")
+              << ",bytes=" << counters.bytes
+              << ",seconds=" << seconds
+              << ",Mbps=" << ((seconds > 0)
+                      ? (counters.bytes * 8) / (seconds * 1e6) : 0)
+              << ",msgs=" << counters.messages
+              << ",send_calls=" << counters.send_calls
+              << ",recv_calls=" << counters.recv_calls
+              << ",errqueue_calls=" << counters.errqueue_calls
+              << ",zerocopy=" << (zerocopy ? 1 : 0)
+              << ",zerocopy_completions=" << counters.completions
+              << ",zerocopy_copied=" << counters.copied
+              << std::endl;
+}
+
+
+int doSend(const struct Arguments& args, struct Parameters* parameters) {
+    struct addrinfo hints = {};
+    hints.ai_family = args.family;
+    hints.ai_socktype = parameters->tcp ? SOCK_STREAM : SOCK_DGRAM;
+    struct addrinfo *result = nullptr;
+
+    int rval = -1;
+    switch (args.api_mode) {
+        case ApiMode::EXPLICIT:
+            rval = android_getaddrinfofornetwork(args.nethandle,
+                                                 parameters->host.c_str(),
+                                                 parameters->port.c_str(),
+                                                 &hints, &result);
+            break;
+        case ApiMode::PROCESS:
+            rval = getaddrinfo(parameters->host.c_str(),
+                               parameters->port.c_str(),
+                               &hints, &result);
+            break;
+    }
+    if (rval != 0) {
+        std::cerr << "DNS resolution failure; gaierror=" << rval
+                  << " [" << gai_strerror(rval) << "]"
+                  << std::endl;
+        return -1;
+    }
+
+    struct FdAutoCloser closer = socket(result[0].ai_family,
+                                        result[0].ai_socktype,
+                                        result[0].ai_protocol);
+    if (closer.fd < 0) {
+        std::cerr << "failed to create socket" << std::endl;
+        freeaddrinfo(result);
+        return -1;
+    }
+
+    if (bindSocketToNetwork(args, closer.fd) != 0) {
+        freeaddrinfo(result);
+        return -1;
+    }
+
+    bool zerocopy = parameters->zerocopy;
+    if (zerocopy) {
+        const int one = 1;
+        if (setsockopt(closer.fd, SOL_SOCKET, SO_ZEROCOPY,
+                       &one, sizeof(one)) != 0) {
+            std::cerr << "SO_ZEROCOPY not supported by this kernel;"
+                      << " falling back to copying sends"
+                      << std::endl;
+            zerocopy = false;
+        }
+    }
+
+    std::cerr << "Sending to: "
+              << inetSockaddrToString(result[0].ai_addr)
+              << std::endl;
+    if (connect(closer.fd, result[0].ai_addr, result[0].ai_addrlen) != 0) {
+        int errnum = errno;
+        std::cerr << "Failed to connect; errno=" << errnum
+                  << " [" << strerror(errnum) << "]"
+                  << std::endl;
+        freeaddrinfo(result);
+        return -1;
+    }
+    freeaddrinfo(result);
+
+    std::vector<char> buf(parameters->size, 'A');
+    struct Counters counters;
+    const int flags = zerocopy ? MSG_ZEROCOPY : 0;
+    const double start = monotonicNow();
+    const double deadline = start + parameters->seconds;
+    double now = start;
+
+    while ((now = monotonicNow()) < deadline) {
+        const ssize_t sent = send(closer.fd, buf.data(), buf.size(), flags);
+        counters.send_calls++;
+        if (sent < 0) {
+            if (errno == ENOBUFS && zerocopy) {
+                // All outstanding pages are pinned; reap completions.
+                if (drainErrqueue(closer.fd, &counters) < 0) {
+                    struct pollfd pfd = { closer.fd, 0, 0 };
+                    poll(&pfd, 1, 10);  // notifications arrive as POLLERR
+                }
+                continue;
+            }
+            int errnum = errno;
+            std::cerr << "Failed to send; errno=" << errnum
+                      << " [" << strerror(errnum) << "]"
+                      << std::endl;
+            break;
+        }
+        counters.bytes += sent;
+        counters.messages++;
+        if (zerocopy && (counters.messages % 64) == 0) {
+            drainErrqueue(closer.fd, &counters);
+        }
+    }
+
+    // Give the last notifications a moment to arrive before reporting.
+    if (zerocopy) {
+        while (counters.completions < counters.messages) {
+            struct pollfd pfd = { closer.fd, 0, 0 };
+            if (poll(&pfd, 1, 100) <= 0) { break; }
+            if (drainErrqueue(closer.fd, &counters) < 0) { break; }
+        }
+    }
+
+    printReport(*parameters, counters, now - start, zerocopy);
+    return 0;
+}
+
+
+int doReceiveUdp(int fd, struct Parameters* parameters,
+                 struct Counters* counters, double* elapsed) {
+    const int batch = parameters->batch;
+    std::vector<char> storage(batch * parameters->size);
+    std::vector<struct mmsghdr> msgs(batch);
+    std::vector<struct iovec> iovs(batch);
+
+    for (int i = 0; i < batch; i++) {
+        iovs[i].iov_base = &storage[i * parameters->size];
+        iovs[i].iov_len = parameters->size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    double start = 0, last = 0;
+    for (;;) {
+        const int n = recvmmsg(fd, msgs.data(), batch, MSG_WAITFORONE,
+                               nullptr);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Idle after traffic: the sender is done.
+                if (start > 0) { break; }
+                continue;
+            }
+            int errnum = errno;
+            std::cerr << "Failed to recvmmsg; errno=" << errnum
+                      << " [" << strerror(errnum) << "]"
+                      << std::endl;
+            return -1;
+        }
+        counters->recv_calls++;
+        last = monotonicNow();
+        if (start == 0) { start = last; }
+        for (int i = 0; i < n; i++) {
+            counters->bytes += msgs[i].msg_len;
+        }
+        counters->messages += n;
+    }
+    *elapsed = last - start;
+    return 0;
+}
+
+int doReceiveTcp(int fd, struct Parameters* parameters,
+                 struct Counters* counters, double* elapsed) {
+    struct sockaddr_storage ss;
+    socklen_t sslen = sizeof(ss);
+    struct FdAutoCloser conn = accept(
+            fd, reinterpret_cast<struct sockaddr *>(&ss), &sslen);
+    if (conn.fd < 0) {
+        int errnum = errno;
+        std::cerr << "Failed to accept; errno=" << errnum
+                  << " [" << strerror(errnum) << "]"
+                  << std::endl;
+        return -1;
+    }
+    std::cerr << "Accepted connection from: "
+              << inetSockaddrToString(reinterpret_cast<struct sockaddr *>(&ss))
+              << std::endl;
+
+    std::vector<char> buf(parameters->size);
+    const double start = monotonicNow();
+    for (;;) {
+        const ssize_t n = recv(conn.fd, buf.data(), buf.size(), 0);
+        if (n < 0) {
+            int errnum = errno;
+            std::cerr << "Failed to recv; errno=" << errnum
+                      << " [" << strerror(errnum) << "]"
+                      << std::endl;
+            return -1;
+        }
+        counters->recv_calls++;
+        if (n == 0) { break; }
+        counters->bytes += n;
+        counters->messages++;
+    }
+    *elapsed = monotonicNow() - start;
+    return 0;
+}
+
+int doReceive(const struct Arguments& args, struct Parameters* parameters) {
+    // With no --family we listen on a v6 wildcard socket that accepts
+    // v4-mapped traffic too.
+    const sa_family_t family =
+            (args.family == AF_UNSPEC) ? AF_INET6 : args.family;
+    struct sockaddr_storage ss = {};
+    socklen_t sslen;
+    const int port = atoi(parameters->port.c_str());
+
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *sin6 =
+                reinterpret_cast<struct sockaddr_in6 *>(&ss);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_addr = in6addr_any;
+        sin6->sin6_port = htons(port);
+        sslen = sizeof(*sin6);
+    } else {
+        struct sockaddr_in *sin = reinterpret_cast<struct sockaddr_in *>(&ss);
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(INADDR_ANY);
+        sin->sin_port = htons(port);
+        sslen = sizeof(*sin);
+    }
+
+    struct FdAutoCloser closer = socket(
+            family, parameters->tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (closer.fd < 0) {
+        std::cerr << "failed to create socket" << std::endl;
+        return -1;
+    }
+
+    if (bindSocketToNetwork(args, closer.fd) != 0) { return -1; }
+
+    const int one = 1;
+    setsockopt(closer.fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (args.family == AF_UNSPEC && family == AF_INET6) {
+        const int zero = 0;
+        setsockopt(closer.fd, IPPROTO_IPV6, IPV6_V6ONLY,
+                   &zero, sizeof(zero));
+    }
+    // Stop once the sender has been idle for a while.
+    const struct timeval timeo = { 2, 0 };
+    setsockopt(closer.fd, SOL_SOCKET, SO_RCVTIMEO, &timeo, sizeof(timeo));
+
+    if (bind(closer.fd, reinterpret_cast<struct sockaddr *>(&ss),
+             sslen) != 0) {
+        int errnum = errno;
+        std::cerr << "Failed to bind; errno=" << errnum
+                  << " [" << strerror(errnum) << "]"
+                  << std::endl;
+        return -1;
+    }
+    if (parameters->tcp && listen(closer.fd, 1) != 0) {
+        int errnum = errno;
+        std::cerr << "Failed to listen; errno=" << errnum
+                  << " [" << strerror(errnum) << "]"
+                  << std::endl;
+        return -1;
+    }
+
+    struct Counters counters;
+    double elapsed = 0;
+    int rval;
+    if (parameters->tcp) {
+        rval = doReceiveTcp(closer.fd, parameters, &counters, &elapsed);
+    } else {
+        rval = doReceiveUdp(closer.fd, parameters, &counters, &elapsed);
+    }
+    if (rval != 0) { return rval; }
+
+    printReport(*parameters, counters, elapsed, false);
+    return 0;
+}
+
+}  // namespace
+
+
+int main(int argc, const char* argv[]) {
+    struct Arguments args;
+    struct Parameters parameters;
+    if (!parseBenchArguments(argc, argv, &args, &parameters)) {
+        benchUsage(argv[0]);
+        return -1;
+    }
+
+    if (args.api_mode == ApiMode::PROCESS) {
+        int rval = android_setprocnetwork(args.nethandle);
+        if (rval != 0) {
+            int errnum = errno;
+            std::cerr << "android_setprocnetwork(" << args.nethandle
+                      << ") failed;"
+                      << " errno: " << errnum << " [" << strerror(errnum) << "]"
+                      << std::endl;
+            return rval;
+        }
+    }
+
+    return parameters.sending ? doSend(args, &parameters)
+                              : doReceive(args, &parameters);
+}
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 
 #include <ctype.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <mntent.h>
 #include <sys/mman.h>
@@ -40,6 +41,22 @@ static struct file_info **g_files;
 // Current size of files array
 size_t g_files_size;
 
+// Stream one JSON object per file instead of the sorted report
+static int g_stream_json = 0;
+
+// Mount points left to walk; each walker thread claims the next index
+static char **g_mount_dirs;
+static size_t g_num_mounts;
+static size_t g_next_mount;
+
+// Guards the files array, the totals, the mount index and stdout
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Per-walker mincore buffer, reused and grown as needed so each file
+// doesn't pay for an allocation
+static __thread unsigned char *t_mincore_data;
+static __thread size_t t_mincore_size;
+
 static struct file_info *get_file_info(const char* fpath, size_t file_size) {
     struct file_info *info;
     if (g_num_files >= g_files_size) {
@@ -72,6 +89,21 @@ static struct file_info *get_file_info(const char* fpath, size_t file_size) {
     return info;
 }
 
+static void print_json_name(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+            fputc(*s, f);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", *s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
 static int store_num_cached(const char* fpath, const struct stat *sb) {
     int fd, ret = -1;
     fd = open (fpath, O_RDONLY);
@@ -86,18 +118,36 @@ static int store_num_cached(const char* fpath, const struct stat *sb) {
     if (mapped_addr != MAP_FAILED) {
         // Calculate bit-vector size
         size_t num_file_pages = (sb->st_size + g_page_size - 1) / g_page_size;
-        unsigned char* mincore_data = calloc(1, num_file_pages);
-        ret = mincore(mapped_addr, sb->st_size, mincore_data);
+        if (num_file_pages > t_mincore_size) {
+            unsigned char *tmp = realloc(t_mincore_data, num_file_pages);
+            if (!tmp) {
+                fprintf(stderr, "Couldn't allocate space for mincore buffer: %s\n",
+                        strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            t_mincore_data = tmp;
+            t_mincore_size = num_file_pages;
+        }
+        ret = mincore(mapped_addr, sb->st_size, t_mincore_data);
         if (!ret) {
             int num_cached = 0;
             unsigned int page = 0;
             for (page = 0; page < num_file_pages; page++) {
-                if (mincore_data[page]) num_cached++;
+                if (t_mincore_data[page]) num_cached++;
             }
             if (num_cached > 0) {
-                struct file_info *info = get_file_info(fpath, sb->st_size);
-                info->num_cached_pages += num_cached;
+                pthread_mutex_lock(&g_lock);
+                if (g_stream_json) {
+                    fputs("{\"name\":", stdout);
+                    print_json_name(stdout, fpath);
+                    fprintf(stdout, ",\"file_size\":%zu,\"cached_pages\":%d}\n",
+                            (size_t)sb->st_size, num_cached);
+                } else {
+                    struct file_info *info = get_file_info(fpath, sb->st_size);
+                    info->num_cached_pages += num_cached;
+                }
                 g_total_cached += num_cached;
+                pthread_mutex_unlock(&g_lock);
             }
         }
         munmap(mapped_addr, sb->st_size);
@@ -126,31 +176,125 @@ static int cmpfiles(const void *a, const void *b) {
             (*((struct file_info**)b))->num_cached_pages);
 }
 
-int main()
-{
+static void *walk_worker(void * __attribute__((unused))arg) {
     size_t i;
+
+    while (1) {
+        pthread_mutex_lock(&g_lock);
+        i = g_next_mount++;
+        pthread_mutex_unlock(&g_lock);
+        if (i >= g_num_mounts)
+            break;
+
+        nftw(g_mount_dirs[i], &scan_entry, MAX_NUM_FD, FTW_MOUNT | FTW_PHYS | FTW_DEPTH);
+    }
+
+    free(t_mincore_data);
+    return NULL;
+}
+
+static void usage(const char *cmd) {
+    fprintf(stderr, "Usage: %s [ -j ]\n"
+                    "    -j  Stream one JSON object per cached file as it is found,\n"
+                    "        instead of the sorted report.\n",
+            cmd);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t i, mounts_size;
+    pthread_t *threads = NULL;
+    long num_threads;
+    size_t spawned, t;
+    int c;
+
+    while ((c = getopt(argc, argv, "jh")) != -1) {
+        switch (c) {
+            case 'j':
+                g_stream_json = 1;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
     g_page_size = getpagesize();
 
     g_files = malloc(INITIAL_NUM_FILES * sizeof(struct file_info*));
     g_files_size = INITIAL_NUM_FILES;
 
-    // Walk filesystem trees through procfs except rootfs/devfs/sysfs/procfs
+    // Collect filesystem trees through procfs except rootfs/devfs/sysfs/procfs
     FILE* fp = setmntent("/proc/mounts", "r");
     if (fp == NULL) {
         fprintf(stderr, "Error opening /proc/mounts\n");
         return -errno;
     }
     struct mntent* mentry;
+    mounts_size = 0;
     while ((mentry = getmntent(fp)) != NULL) {
         if (strcmp(mentry->mnt_type, "rootfs") != 0 &&
             strncmp("/dev", mentry->mnt_dir, strlen("/dev")) != 0 &&
             strncmp("/sys", mentry->mnt_dir, strlen("/sys")) != 0 &&
             strncmp("/proc", mentry->mnt_dir, strlen("/proc")) != 0) {
-            nftw(mentry->mnt_dir, &scan_entry, MAX_NUM_FD, FTW_MOUNT | FTW_PHYS | FTW_DEPTH);
+            if (g_num_mounts >= mounts_size) {
+                mounts_size = mounts_size ? 2 * mounts_size : 16;
+                g_mount_dirs = realloc(g_mount_dirs, mounts_size * sizeof(char *));
+                if (!g_mount_dirs) {
+                    fprintf(stderr, "Couldn't allocate space for mount array: %s\n",
+                            strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+            }
+            g_mount_dirs[g_num_mounts] = strdup(mentry->mnt_dir);
+            if (!g_mount_dirs[g_num_mounts]) {
+                fprintf(stderr, "Couldn't allocate space for mount dir: %s\n",
+                        strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            g_num_mounts++;
         }
     }
     endmntent(fp);
 
+    // Walk the mounts in parallel; FTW_MOUNT keeps the walkers from
+    // crossing into each other's trees
+    num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads < 1)
+        num_threads = 1;
+    if ((size_t)num_threads > g_num_mounts)
+        num_threads = g_num_mounts;
+
+    spawned = 0;
+    if (num_threads > 1) {
+        threads = malloc((num_threads - 1) * sizeof(*threads));
+        if (threads) {
+            for (t = 0; t < (size_t)(num_threads - 1); t++) {
+                if (pthread_create(&threads[t], NULL, walk_worker, NULL))
+                    break;
+                spawned++;
+            }
+        }
+    }
+    walk_worker(NULL);
+    for (t = 0; t < spawned; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    for (i = 0; i < g_num_mounts; i++) {
+        free(g_mount_dirs[i]);
+    }
+    free(g_mount_dirs);
+
+    if (g_stream_json) {
+        fprintf(stdout, "{\"total_cached_pages\":%zu}\n", g_total_cached);
+        return 0;
+    }
+
     // Sort entries
     qsort(g_files, g_num_files, sizeof(g_files[0]), &cmpfiles);
 
@@ -103,6 +103,28 @@ void ConfigReader::addDefaultEntries()
   addUnsignedEntry("hardwire_cpus", 1, 0, 1);
   addUnsignedEntry("hardwire_cpus_max_duration", 5, 1, UINT32_MAX);
 
+  // If set to 1, confine the conversion of recorded profiles to the
+  // little cores (via the system-background cpuset, or cpu affinity if
+  // no cpuset is mounted), so that encoding doesn't compete with the
+  // foreground app for the big cores.
+  addUnsignedEntry("conversion_little_cores_only", 1, 0, 1);
+
+  // Maximum percent of one cpu the conversion worker may use. When its
+  // utilization exceeds the budget, the worker is demoted to SCHED_IDLE
+  // (consuming otherwise idle cpu time only) until its utilization
+  // drops again. Zero disables the budget watchdog.
+  addUnsignedEntry("conversion_cpu_budget_percent", 0, 0, 100);
+
+  // If set to 1, gzip-compress the encoded profile when writing it,
+  // trading a little conversion cpu for much smaller flash writes.
+  addUnsignedEntry("compress_encoded_profile", 0, 0, 1);
+
+  // When compressing, split the encoded profile into chunk files
+  // ("<path>.<N>") covering at most this many KB of profile data each.
+  // Every chunk is a complete gzip member, so concatenating the chunks
+  // yields one valid gzip stream. Zero writes a single file.
+  addUnsignedEntry("encoded_profile_chunk_kb", 0, 0, UINT32_MAX);
+
   // Maximum number of unprocessed profiles we can accumulate in the
   // destination directory. Once we reach this limit, we continue
   // to collect, but we just overwrite the most recent profile.
@@ -15,6 +15,7 @@
 ** limitations under the License.
 */
 
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -103,3 +104,166 @@ void HardwireCpuHelper::RestartMpdecision()
     W_ALOGE("setprop ctl.start mpdecision failed");
   }
 }
+
+//
+// Move the task into the system-background cpuset, which Android
+// restricts to the little cores.
+//
+static bool MoveTaskToBackgroundCpuset(int tid)
+{
+  FILE *fp = fopen("/dev/cpuset/system-background/tasks", "we");
+  if (!fp) {
+    return false;
+  }
+  fprintf(fp, "%d\n", tid);
+  return fclose(fp) == 0;
+}
+
+//
+// Collect the cpus whose cpuinfo_max_freq is the lowest on the system.
+// On big.LITTLE devices these are the little cores; on symmetric
+// systems the mask ends up containing all cpus.
+//
+static bool GetLittleCoreMask(cpu_set_t *mask)
+{
+  int ncores = -1;
+  FILE *fp = fopen(SYSFSCPU "/possible", "re");
+  if (fp) {
+    unsigned lo = 0, hi = 0;
+    if (fscanf(fp, "%u-%u", &lo, &hi) == 2) {
+      ncores = hi - lo + 1;
+    }
+    fclose(fp);
+  }
+  if (ncores <= 0) {
+    return false;
+  }
+  unsigned min_freq = 0;
+  CPU_ZERO(mask);
+  for (int i = 0; i < ncores; ++i) {
+    std::stringstream ss;
+    ss << SYSFSCPU "/cpu" << i << "/cpufreq/cpuinfo_max_freq";
+    fp = fopen(ss.str().c_str(), "re");
+    if (!fp) {
+      continue;
+    }
+    unsigned freq = 0;
+    int rc = fscanf(fp, "%u", &freq);
+    fclose(fp);
+    if (rc != 1) {
+      continue;
+    }
+    if (min_freq == 0 || freq < min_freq) {
+      min_freq = freq;
+      CPU_ZERO(mask);
+    }
+    if (freq == min_freq) {
+      CPU_SET(i, mask);
+    }
+  }
+  return CPU_COUNT(mask) > 0;
+}
+
+bool ConfineTaskToLittleCores(int tid)
+{
+  if (MoveTaskToBackgroundCpuset(tid)) {
+    return true;
+  }
+  cpu_set_t mask;
+  if (!GetLittleCoreMask(&mask)) {
+    W_ALOGW("unable to determine little core set");
+    return false;
+  }
+  if (sched_setaffinity(tid, sizeof(mask), &mask)) {
+    W_ALOGW("sched_setaffinity failed for task %d", tid);
+    return false;
+  }
+  return true;
+}
+
+CpuBudgetWatchdog::CpuBudgetWatchdog(int tid, unsigned budget_percent)
+    : tid_(tid)
+    , budget_percent_(budget_percent)
+    , throttled_(false)
+    , done_(false)
+{
+  if (budget_percent_ != 0) {
+    monitor_ = std::thread(&CpuBudgetWatchdog::WatchLoop, this);
+  }
+}
+
+CpuBudgetWatchdog::~CpuBudgetWatchdog()
+{
+  done_ = true;
+  if (monitor_.joinable()) {
+    monitor_.join();
+  }
+  if (throttled_) {
+    SetTaskPolicy(SCHED_OTHER);
+  }
+}
+
+bool CpuBudgetWatchdog::GetTaskCpuTicks(unsigned long *ticks)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid_);
+  FILE *fp = fopen(path, "re");
+  if (!fp) {
+    return false;
+  }
+  char buf[512];
+  bool ok = (fgets(buf, sizeof(buf), fp) != nullptr);
+  fclose(fp);
+  if (!ok) {
+    return false;
+  }
+  // The comm field may contain spaces, so scan from the closing paren.
+  // utime and stime are the 14th and 15th fields.
+  char *p = strrchr(buf, ')');
+  if (!p) {
+    return false;
+  }
+  unsigned long utime, stime;
+  if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &utime, &stime) != 2) {
+    return false;
+  }
+  *ticks = utime + stime;
+  return true;
+}
+
+void CpuBudgetWatchdog::SetTaskPolicy(int policy)
+{
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  if (sched_setscheduler(tid_, policy, &param)) {
+    W_ALOGW("sched_setscheduler(%d) failed for task %d", policy, tid_);
+  }
+}
+
+void CpuBudgetWatchdog::WatchLoop()
+{
+  const unsigned interval_ms = 100;
+  const double ticks_per_sec = sysconf(_SC_CLK_TCK);
+  unsigned long last_ticks = 0;
+  if (!GetTaskCpuTicks(&last_ticks)) {
+    return;
+  }
+  while (!done_) {
+    usleep(interval_ms * 1000);
+    unsigned long ticks;
+    if (!GetTaskCpuTicks(&ticks)) {
+      return; // the monitored task is gone
+    }
+    double used_sec = (ticks - last_ticks) / ticks_per_sec;
+    last_ticks = ticks;
+    double percent = 100.0 * used_sec / (interval_ms / 1000.0);
+    if (!throttled_ && percent > budget_percent_) {
+      SetTaskPolicy(SCHED_IDLE);
+      throttled_ = true;
+    } else if (throttled_ && percent < budget_percent_ / 2.0) {
+      SetTaskPolicy(SCHED_OTHER);
+      throttled_ = false;
+    }
+  }
+}
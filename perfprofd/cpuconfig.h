@@ -15,6 +15,9 @@
 ** limitations under the License.
 */
 
+#include <atomic>
+#include <thread>
+
 //
 // Helper class to perform cpu setup (if needed) prior to a profile collection.
 //
@@ -48,3 +51,44 @@ class HardwireCpuHelper {
   void StopMpdecision();
   void RestartMpdecision();
 };
+
+// Confine the given task (thread id) to the little cores, so that work
+// done on it does not compete with the foreground app for the big
+// cores. The task is moved into the system-background cpuset, which
+// Android restricts to the little cores; if no cpuset is mounted, fall
+// back to pinning the task to the cluster with the lowest maximum cpu
+// frequency. Returns TRUE on success.
+bool ConfineTaskToLittleCores(int tid);
+
+//
+// Watchdog enforcing a cpu overhead budget on a task (thread id). A
+// monitor thread samples the task's cpu time periodically; when the
+// task's utilization exceeds 'budget_percent' of one cpu, the task is
+// demoted to SCHED_IDLE so that it only consumes otherwise idle cpu
+// time, and it is promoted back to its normal priority once its
+// utilization drops below half of the budget. A budget of zero
+// disables the watchdog. The destructor stops the monitor thread and
+// restores the normal scheduling policy.
+//
+class CpuBudgetWatchdog {
+ public:
+  CpuBudgetWatchdog(int tid, unsigned budget_percent);
+  ~CpuBudgetWatchdog();
+
+ private:
+  void WatchLoop();
+
+  // Collect the total cpu time in clock ticks used so far by the
+  // monitored task, from /proc/self/task/<tid>/stat.
+  bool GetTaskCpuTicks(unsigned long *ticks);
+
+  // Switch the monitored task to the specified scheduling policy
+  // (SCHED_IDLE to throttle, SCHED_OTHER to restore).
+  void SetTaskPolicy(int policy);
+
+  int tid_;
+  unsigned budget_percent_;
+  bool throttled_;
+  std::atomic<bool> done_;
+  std::thread monitor_;
+};
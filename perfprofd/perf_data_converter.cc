@@ -2,6 +2,7 @@
 #include "perf_data_converter.h"
 #include "quipper/perf_parser.h"
 #include <map>
+#include <set>
 
 using std::map;
 
@@ -11,13 +12,13 @@ typedef quipper::ParsedEvent::DSOAndOffset DSOAndOffset;
 typedef std::vector<DSOAndOffset> callchain;
 
 struct callchain_lt {
-  bool operator()(const callchain *c1, const callchain *c2) const {
-    if (c1->size() != c2->size()) {
-      return c1->size() < c2->size();
+  bool operator()(const callchain &c1, const callchain &c2) const {
+    if (c1.size() != c2.size()) {
+      return c1.size() < c2.size();
     }
-    for (unsigned idx = 0; idx < c1->size(); ++idx) {
-      const DSOAndOffset *do1 = &(*c1)[idx];
-      const DSOAndOffset *do2 = &(*c2)[idx];
+    for (unsigned idx = 0; idx < c1.size(); ++idx) {
+      const DSOAndOffset *do1 = &c1[idx];
+      const DSOAndOffset *do2 = &c2[idx];
       if (do1->offset() != do2->offset()) {
         return do1->offset() < do2->offset();
       }
@@ -51,34 +52,25 @@ struct RangeTarget {
 struct BinaryProfile {
   map<uint64, uint64> address_count_map;
   map<RangeTarget, uint64> range_count_map;
-  map<const callchain *, uint64, callchain_lt> callchain_count_map;
+  map<callchain, uint64, callchain_lt> callchain_count_map;
 };
 
-wireless_android_play_playlog::AndroidPerfProfile
-RawPerfDataToAndroidPerfProfile(const string &perf_file) {
-  wireless_android_play_playlog::AndroidPerfProfile ret;
-  quipper::PerfParser parser;
-  if (!parser.ReadFile(perf_file) || !parser.ParseRawEvents()) {
-    return ret;
-  }
+typedef map<string, BinaryProfile> ModuleProfileMap;
+typedef map<string, ModuleProfileMap> ProgramProfileMap;
 
-  typedef map<string, BinaryProfile> ModuleProfileMap;
-  typedef map<string, ModuleProfileMap> ProgramProfileMap;
+// Consumes mapped sample events as the parser streams them, updating the
+// histogram maps. Only the histograms and the deduplicated callchains are
+// kept, so memory stays bounded no matter how many samples the profile has.
+//
+// Note: the DSOAndOffset values stored in the callchain keys point at
+// DSOInfo objects owned by the parser, so the maps must not outlive it
+// (e.g. keep these two together in the same region).
+class PerfProfileBuilder : public quipper::SampleEventHandler {
+ public:
+  PerfProfileBuilder()
+      : total_samples(0), seen_branch_stack_(false), seen_callchain_(false) {}
 
-  // Note: the callchain_count_map member in BinaryProfile contains
-  // pointers into callchains owned by "parser" above, meaning
-  // that once the parser is destroyed, callchain pointers in
-  // name_profile_map will become stale (e.g. keep these two
-  // together in the same region).
-  ProgramProfileMap name_profile_map;
-  uint64 total_samples = 0;
-  bool seen_branch_stack = false;
-  bool seen_callchain = false;
-  for (const auto &event : parser.parsed_events()) {
-    if (!event.raw_event ||
-        event.raw_event->header.type != PERF_RECORD_SAMPLE) {
-      continue;
-    }
+  bool HandleSample(const quipper::ParsedEvent &event) {
     string dso_name = event.dso_and_offset.dso_name();
     string program_name = event.command();
     const string kernel_name = "[kernel.kallsyms]";
@@ -97,13 +89,13 @@ RawPerfDataToAndroidPerfProfile(const string &perf_file) {
     // are mappable, in which case the parsed/mapped chain will appear
     // empty (appearing as a flat sample).
     if (!event.callchain.empty()) {
-      CHECK(!seen_branch_stack && "examining callchain");
-      seen_callchain = true;
-      const callchain *cc = &event.callchain;
-      name_profile_map[program_name][dso_name].callchain_count_map[cc]++;
+      CHECK(!seen_branch_stack_ && "examining callchain");
+      seen_callchain_ = true;
+      name_profile_map[program_name][dso_name].callchain_count_map[
+          event.callchain]++;
     } else if (!event.branch_stack.empty()) {
-      CHECK(!seen_callchain && "examining branch stack");
-      seen_branch_stack = true;
+      CHECK(!seen_callchain_ && "examining branch stack");
+      seen_branch_stack_ = true;
       name_profile_map[program_name][dso_name].address_count_map[
           event.dso_and_offset.offset()]++;
     } else {
@@ -124,7 +116,42 @@ RawPerfDataToAndroidPerfProfile(const string &perf_file) {
             RangeTarget(start, end, to)]++;
       }
     }
+    return true;
+  }
+
+  ProgramProfileMap name_profile_map;
+  uint64 total_samples;
+
+ private:
+  bool seen_branch_stack_;
+  bool seen_callchain_;
+};
+
+// Returns the index of |str| in |profile|'s string table, adding it if it
+// has not been seen before.
+static int32 InternString(const string &str,
+                          map<string, int32> *string_index_map,
+                          wireless_android_play_playlog::AndroidPerfProfile
+                              *profile) {
+  auto iter = string_index_map->find(str);
+  if (iter != string_index_map->end()) {
+    return iter->second;
   }
+  int32 index = profile->string_table_size();
+  profile->add_string_table(str);
+  (*string_index_map)[str] = index;
+  return index;
+}
+
+wireless_android_play_playlog::AndroidPerfProfile
+RawPerfDataToAndroidPerfProfile(const string &perf_file) {
+  wireless_android_play_playlog::AndroidPerfProfile ret;
+  quipper::PerfParser parser;
+  PerfProfileBuilder builder;
+  if (!parser.ParseFileStreaming(perf_file, &builder)) {
+    return ret;
+  }
+  ProgramProfileMap &name_profile_map = builder.name_profile_map;
 
   map<string, int> name_id_map;
   for (const auto &program_profile : name_profile_map) {
@@ -137,12 +164,24 @@ RawPerfDataToAndroidPerfProfile(const string &perf_file) {
     iter->second = current_index++;
   }
 
+  // Perf records a build id for every module mapped on the system, but only
+  // the modules in name_id_map show up in the profile. Drop the rest before
+  // building name_buildid_map, so it doesn't carry build ids for binaries no
+  // sample referenced.
+  std::set<string> used_module_names;
+  for (const auto &name_id : name_id_map) {
+    used_module_names.insert(name_id.first);
+  }
+  parser.DropUnusedBuildIDs(used_module_names);
+
   map<string, string> name_buildid_map;
   parser.GetFilenamesToBuildIDs(&name_buildid_map);
-  ret.set_total_samples(total_samples);
+  ret.set_total_samples(builder.total_samples);
+  map<string, int32> string_index_map;
   for (const auto &name_id : name_id_map) {
     auto load_module = ret.add_load_modules();
-    load_module->set_name(name_id.first);
+    load_module->set_name_index(
+        InternString(name_id.first, &string_index_map, &ret));
     auto nbmi = name_buildid_map.find(name_id.first);
     if (nbmi != name_buildid_map.end()) {
       const std::string &build_id = nbmi->second;
@@ -155,15 +194,19 @@ RawPerfDataToAndroidPerfProfile(const string &perf_file) {
   }
   for (const auto &program_profile : name_profile_map) {
     auto program = ret.add_programs();
-    program->set_name(program_profile.first);
+    program->set_name_index(
+        InternString(program_profile.first, &string_index_map, &ret));
     for (const auto &module_profile : program_profile.second) {
       int32 module_id = name_id_map[module_profile.first];
       auto module = program->add_modules();
       module->set_load_module_id(module_id);
+      // address_count_map is sorted by address, so successive addresses can
+      // be stored as small deltas.
+      uint64 prev_addr = 0;
       for (const auto &addr_count : module_profile.second.address_count_map) {
-        auto address_samples = module->add_address_samples();
-        address_samples->add_address(addr_count.first);
-        address_samples->set_count(addr_count.second);
+        module->add_address_delta(addr_count.first - prev_addr);
+        module->add_address_delta_count(addr_count.second);
+        prev_addr = addr_count.first;
       }
       for (const auto &range_count : module_profile.second.range_count_map) {
         auto range_samples = module->add_range_samples();
@@ -176,7 +219,7 @@ RawPerfDataToAndroidPerfProfile(const string &perf_file) {
                module_profile.second.callchain_count_map) {
         auto address_samples = module->add_address_samples();
         address_samples->set_count(callchain_count.second);
-        for (const auto &d_o : *callchain_count.first) {
+        for (const auto &d_o : callchain_count.first) {
           int32 module_id = name_id_map[d_o.dso_name()];
           address_samples->add_load_module_id(module_id);
           address_samples->add_address(d_o.offset());
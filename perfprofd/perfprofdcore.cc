@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -31,12 +32,15 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <memory>
 #include <set>
+#include <thread>
 #include <cctype>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
 #include <cutils/properties.h>
+#include <zlib.h>
 
 #include "perfprofdcore.h"
 #include "perfprofdutils.h"
@@ -481,6 +485,101 @@ inline char* string_as_array(std::string* str) {
   return str->empty() ? NULL : &*str->begin();
 }
 
+//
+// Gzip-compress the 'size' bytes at 'data' into 'compressed'. The
+// result is a complete gzip member, so compressed chunks written one
+// after another form a single valid gzip stream when concatenated.
+//
+static bool gzip_compress(const uint8_t *data, size_t size,
+                          std::string *compressed)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  // windowBits of 15+16 selects the gzip wrapper.
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  compressed->resize(deflateBound(&zs, size));
+  zs.next_in = const_cast<Bytef*>(data);
+  zs.avail_in = size;
+  zs.next_out = reinterpret_cast<Bytef*>(string_as_array(compressed));
+  zs.avail_out = compressed->size();
+  int rc = deflate(&zs, Z_FINISH);
+  compressed->resize(zs.total_out);
+  deflateEnd(&zs);
+  return rc == Z_STREAM_END;
+}
+
+//
+// Write one output file for the encoded profile, with the permissions
+// the uploader expects.
+//
+static PROFILE_RESULT write_profile_file(const void *data, size_t size,
+                                         const char *path)
+{
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    return ERR_OPEN_ENCODED_FILE_FAILED;
+  }
+  if (size != 0 && fwrite(data, size, 1, fp) != 1) {
+    fclose(fp);
+    return ERR_WRITE_ENCODED_FILE_FAILED;
+  }
+  fclose(fp);
+  chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  return OK_PROFILE_COLLECTION;
+}
+
+//
+// Emit the serialized profile. By default it is written uncompressed
+// to the single file 'encoded_file_path' (the format the uploader has
+// always consumed). If 'compress_encoded_profile' is set, the bytes
+// are gzip-compressed first, shrinking flash writes considerably; if
+// 'encoded_profile_chunk_kb' is also nonzero, the compressed output is
+// split into bounded-size chunk files "<path>.<N>", each one a
+// complete gzip member, so the uploader can ship finished chunks while
+// later ones are still being written and concatenate them to recover
+// the profile.
+//
+static PROFILE_RESULT write_encoded_profile(const uint8_t *data,
+                                            size_t size,
+                                            const char *encoded_file_path,
+                                            const ConfigReader &config)
+{
+  if (config.getUnsignedValue("compress_encoded_profile") == 0) {
+    return write_profile_file(data, size, encoded_file_path);
+  }
+
+  unsigned chunk_kb = config.getUnsignedValue("encoded_profile_chunk_kb");
+  size_t chunk_size = (chunk_kb != 0 ? (size_t) chunk_kb * 1024 : size);
+  size_t offset = 0;
+  int chunk_number = 0;
+  std::string compressed;
+  do {
+    size_t n = size - offset;
+    if (n > chunk_size) {
+      n = chunk_size;
+    }
+    if (!gzip_compress(data + offset, n, &compressed)) {
+      return ERR_WRITE_ENCODED_FILE_FAILED;
+    }
+    std::string path(encoded_file_path);
+    if (chunk_kb != 0) {
+      path = android::base::StringPrintf("%s.%d", encoded_file_path,
+                                         chunk_number);
+    }
+    PROFILE_RESULT result =
+        write_profile_file(compressed.data(), compressed.size(), path.c_str());
+    if (result != OK_PROFILE_COLLECTION) {
+      return result;
+    }
+    offset += n;
+    chunk_number += 1;
+  } while (offset < size);
+  return OK_PROFILE_COLLECTION;
+}
+
 PROFILE_RESULT encode_to_proto(const std::string &data_file_path,
                                const char *encoded_file_path,
                                const ConfigReader &config,
@@ -517,21 +616,9 @@ PROFILE_RESULT encode_to_proto(const std::string &data_file_path,
   encodedProfile.SerializeWithCachedSizesToArray(dtarget);
 
   //
-  // Open file and write encoded data to it
+  // Write the encoded data out, optionally compressed and chunked
   //
-  FILE *fp = fopen(encoded_file_path, "w");
-  if (!fp) {
-    return ERR_OPEN_ENCODED_FILE_FAILED;
-  }
-  size_t fsiz = size;
-  if (fwrite(dtarget, fsiz, 1, fp) != 1) {
-    fclose(fp);
-    return ERR_WRITE_ENCODED_FILE_FAILED;
-  }
-  fclose(fp);
-  chmod(encoded_file_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-
-  return OK_PROFILE_COLLECTION;
+  return write_encoded_profile(dtarget, size, encoded_file_path, config);
 }
 
 //
@@ -715,27 +802,33 @@ static bool post_process(const ConfigReader &config, int current_seq)
 }
 
 //
-// Collect a perf profile. Steps for this operation are:
-// - kick off 'perf record'
-// - read perf.data, convert to protocol buf
+// Collect a perf profile: kick off 'perf record' and return the path of
+// the resulting perf.data file via |data_file_path|. Conversion of the
+// raw file to protocol buffer form is handled separately (see
+// start_conversion below) so that it can overlap the next collection.
 //
-static PROFILE_RESULT collect_profile(const ConfigReader &config, int seq)
+static PROFILE_RESULT collect_profile(const ConfigReader &config,
+                                      std::string *data_file_path,
+                                      unsigned *cpu_utilization)
 {
   //
   // Collect cpu utilization if enabled
   //
-  unsigned cpu_utilization = 0;
+  *cpu_utilization = 0;
   if (config.getUnsignedValue("collect_cpu_utilization")) {
-    cpu_utilization = collect_cpu_utilization();
+    *cpu_utilization = collect_cpu_utilization();
   }
 
   //
-  // Form perf.data file name, perf error output file name
+  // Form perf.data file name, perf error output file name. Each
+  // collection writes to its own numbered perf.data file, since the
+  // previous file may still be feeding the conversion thread while
+  // this collection runs.
   //
+  static unsigned collection_number;
   std::string destdir = config.getStringValue("destination_directory");
-  std::string data_file_path(destdir);
-  data_file_path += "/";
-  data_file_path += PERF_OUTPUT;
+  *data_file_path = android::base::StringPrintf(
+      "%s/%s.%u", destdir.c_str(), PERF_OUTPUT, collection_number++);
   std::string perf_stderr_path(destdir);
   perf_stderr_path += "/perferr.txt";
 
@@ -744,8 +837,8 @@ static PROFILE_RESULT collect_profile(const ConfigReader &config, int seq)
   // will rename the old file and we'll have extra cruft lying around.
   //
   struct stat statb;
-  if (stat(data_file_path.c_str(), &statb) == 0) { // if file exists...
-    if (unlink(data_file_path.c_str())) {          // then try to remove
+  if (stat(data_file_path->c_str(), &statb) == 0) { // if file exists...
+    if (unlink(data_file_path->c_str())) {          // then try to remove
       W_ALOGW("unable to unlink previous perf.data file");
     }
   }
@@ -776,23 +869,104 @@ static PROFILE_RESULT collect_profile(const ConfigReader &config, int seq)
   std::string perf_path = config.getStringValue("perf_path");
   unsigned period = config.getUnsignedValue("sampling_period");
 
-  PROFILE_RESULT ret = invoke_perf(perf_path.c_str(),
-                                  period,
-                                  stack_profile_opt,
-                                  duration,
-                                  data_file_path,
-                                  perf_stderr_path);
-  if (ret != OK_PROFILE_COLLECTION) {
-    return ret;
-  }
+  return invoke_perf(perf_path.c_str(),
+                     period,
+                     stack_profile_opt,
+                     duration,
+                     *data_file_path,
+                     perf_stderr_path);
+}
 
+//
+// Handle to a profile conversion running on the worker thread. The
+// conversion of one profile can run here while the main loop sleeps and
+// records the next one; at most one conversion is in flight at a time.
+// The worker gets its own copy of the config taken at collection time,
+// so that the main loop can reread the config file without racing
+// against it.
+//
+struct ConversionRequest {
+  ConfigReader config;
+  std::string data_file_path;
+  std::string encoded_file_path;
+  unsigned cpu_utilization;
+  int seq;
+  PROFILE_RESULT result;
+  std::thread worker;
+};
+
+static std::unique_ptr<ConversionRequest> conversion_in_flight;
+
+//
+// Body of the conversion worker thread: encode the recorded perf.data
+// file into protocol buffer form, then discard the raw file.
+//
+static void run_conversion(ConversionRequest *req)
+{
   //
-  // Read the resulting perf.data file, encode into protocol buffer, then write
-  // the result to the file perf.data.encoded
+  // Confine the conversion work to the little cores and keep its cpu
+  // overhead within the configured budget, so that encoding a large
+  // profile never steals big-core time from the foreground app.
   //
-  std::string path = android::base::StringPrintf(
-      "%s.encoded.%d", data_file_path.c_str(), seq);
-  return encode_to_proto(data_file_path, path.c_str(), config, cpu_utilization);
+  int tid = syscall(__NR_gettid);
+  if (req->config.getUnsignedValue("conversion_little_cores_only") != 0) {
+    ConfineTaskToLittleCores(tid);
+  }
+  CpuBudgetWatchdog watchdog(
+      tid, req->config.getUnsignedValue("conversion_cpu_budget_percent"));
+
+  req->result = encode_to_proto(req->data_file_path,
+                                req->encoded_file_path.c_str(),
+                                req->config,
+                                req->cpu_utilization);
+  unlink(req->data_file_path.c_str());
+}
+
+//
+// Kick off conversion of a freshly recorded perf.data file on the
+// worker thread.
+//
+static void start_conversion(const ConfigReader &config,
+                             const std::string &data_file_path,
+                             unsigned cpu_utilization,
+                             int seq)
+{
+  assert(!conversion_in_flight);
+  ConversionRequest *req = new ConversionRequest;
+  req->config = config;
+  req->data_file_path = data_file_path;
+  req->encoded_file_path = android::base::StringPrintf(
+      "%s/%s.encoded.%d",
+      config.getStringValue("destination_directory").c_str(),
+      PERF_OUTPUT, seq);
+  req->cpu_utilization = cpu_utilization;
+  req->seq = seq;
+  conversion_in_flight.reset(req);
+  req->worker = std::thread(run_conversion, req);
+}
+
+//
+// Wait for the in-flight conversion (if there is one) to finish, then
+// post-process its result, bumping |seq| if the profile was recorded in
+// the produced-file list.
+//
+static void finish_conversion(int *seq)
+{
+  if (!conversion_in_flight) {
+    return;
+  }
+  conversion_in_flight->worker.join();
+  if (conversion_in_flight->result != OK_PROFILE_COLLECTION) {
+    W_ALOGI("profile collection failed (%s)",
+            profile_result_to_string(conversion_in_flight->result));
+  } else {
+    if (post_process(conversion_in_flight->config,
+                     conversion_in_flight->seq)) {
+      *seq = conversion_in_flight->seq + 1;
+    }
+    W_ALOGI("profile collection complete");
+  }
+  conversion_in_flight.reset();
 }
 
 //
@@ -924,21 +1098,29 @@ int perfprofd_main(int argc, char** argv)
     } else {
       // Kick off the profiling run...
       W_ALOGI("initiating profile collection");
-      PROFILE_RESULT result = collect_profile(config, seq);
+      std::string data_file_path;
+      unsigned cpu_utilization = 0;
+      PROFILE_RESULT result =
+          collect_profile(config, &data_file_path, &cpu_utilization);
+      // The conversion of the previous profile (if any) has been
+      // running on the worker thread while 'perf record' ran; reap it
+      // now so that its sequence number is settled before the next
+      // conversion starts.
+      finish_conversion(&seq);
       if (result != OK_PROFILE_COLLECTION) {
         W_ALOGI("profile collection failed (%s)",
                 profile_result_to_string(result));
       } else {
-        if (post_process(config, seq)) {
-          seq++;
-        }
-        W_ALOGI("profile collection complete");
+        start_conversion(config, data_file_path, cpu_utilization, seq);
       }
     }
     perfprofd_sleep(sleep_after_collect);
     iterations += 1;
   }
 
+  // Drain the conversion of the final profile.
+  finish_conversion(&seq);
+
   W_ALOGI("finishing Android Wide Profiling daemon");
   return 0;
 }
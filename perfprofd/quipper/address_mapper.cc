@@ -10,6 +10,36 @@ namespace quipper {
 
 AddressMapper::AddressMapper(const AddressMapper& source) {
   mappings_ = source.mappings_;
+  RebuildIndices();
+}
+
+void AddressMapper::RebuildIndices() {
+  real_addr_index_.clear();
+  gap_index_.clear();
+  for (MappingList::iterator iter = mappings_.begin();
+       iter != mappings_.end(); ++iter) {
+    real_addr_index_[iter->real_addr] = iter;
+    if (iter->unmapped_space_after > 0)
+      gap_index_[iter->mapped_addr] = iter;
+  }
+}
+
+void AddressMapper::IndexInsertedRange(MappingList::iterator iter) {
+  real_addr_index_[iter->real_addr] = iter;
+  if (iter->unmapped_space_after > 0)
+    gap_index_[iter->mapped_addr] = iter;
+}
+
+AddressMapper::MappingList::const_iterator AddressMapper::FindContainingRange(
+    const uint64_t real_addr) const {
+  RealAddrIndex::const_iterator idx = real_addr_index_.upper_bound(real_addr);
+  if (idx == real_addr_index_.begin())
+    return mappings_.end();
+  --idx;
+  MappingList::const_iterator iter = idx->second;
+  if (!iter->ContainsAddress(real_addr))
+    return mappings_.end();
+  return iter;
 }
 
 bool AddressMapper::Map(const uint64_t real_addr,
@@ -44,12 +74,20 @@ bool AddressMapper::MapWithID(const uint64_t real_addr,
   }
 
   // Check for collision with an existing mapping.  This must be an overlap that
-  // does not result in one range being completely covered by another
-  MappingList::iterator iter;
+  // does not result in one range being completely covered by another.
+  // Only mappings whose real ranges intersect [real_addr, real_addr + size)
+  // can collide; find them through the real address index instead of
+  // scanning every mapping. The range preceding real_addr may extend into
+  // the new range, so start one entry early.
   MappingList mappings_to_delete;
   bool old_range_found = false;
   MappedRange old_range;
-  for (iter = mappings_.begin(); iter != mappings_.end(); ++iter) {
+  RealAddrIndex::iterator idx = real_addr_index_.upper_bound(real_addr);
+  if (idx != real_addr_index_.begin())
+    --idx;
+  for (; idx != real_addr_index_.end() && idx->first <= real_addr + size - 1;
+       ++idx) {
+    MappingList::iterator iter = idx->second;
     if (!iter->Intersects(range))
       continue;
     // Quit if existing ranges that collide aren't supposed to be removed.
@@ -107,6 +145,7 @@ bool AddressMapper::MapWithID(const uint64_t real_addr,
     range.mapped_addr = 0;
     range.unmapped_space_after = kuint64max - range.size;
     mappings_.push_back(range);
+    IndexInsertedRange(mappings_.begin());
     return true;
   }
 
@@ -115,20 +154,28 @@ bool AddressMapper::MapWithID(const uint64_t real_addr,
     range.mapped_addr = 0;
     range.unmapped_space_after = mappings_.begin()->mapped_addr - range.size;
     mappings_.push_front(range);
+    IndexInsertedRange(mappings_.begin());
     return true;
   }
 
-  // Otherwise, search through the existing mappings for a free block after one
-  // of them.
-  for (iter = mappings_.begin(); iter != mappings_.end(); ++iter) {
+  // Otherwise, search for a free block after one of the existing mappings.
+  // The gap index visits them in mapped order, giving the same first-fit
+  // placement as walking every mapping, without visiting ranges that have no
+  // space after them.
+  for (GapIndex::iterator gap = gap_index_.begin(); gap != gap_index_.end();
+       ++gap) {
+    MappingList::iterator iter = gap->second;
     if (iter->unmapped_space_after < range.size)
       continue;
 
     range.mapped_addr = iter->mapped_addr + iter->size;
     range.unmapped_space_after = iter->unmapped_space_after - range.size;
     iter->unmapped_space_after = 0;
+    gap_index_.erase(gap);
 
-    mappings_.insert(++iter, range);
+    MappingList::iterator pos = iter;
+    ++pos;
+    IndexInsertedRange(mappings_.insert(pos, range));
     return true;
   }
 
@@ -153,14 +200,11 @@ void AddressMapper::DumpToLog() const {
 bool AddressMapper::GetMappedAddress(const uint64_t real_addr,
                                      uint64_t* mapped_addr) const {
   CHECK(mapped_addr);
-  MappingList::const_iterator iter;
-  for (iter = mappings_.begin(); iter != mappings_.end(); ++iter) {
-    if (!iter->ContainsAddress(real_addr))
-      continue;
-    *mapped_addr = iter->mapped_addr + real_addr - iter->real_addr;
-    return true;
-  }
-  return false;
+  MappingList::const_iterator iter = FindContainingRange(real_addr);
+  if (iter == mappings_.end())
+    return false;
+  *mapped_addr = iter->mapped_addr + real_addr - iter->real_addr;
+  return true;
 }
 
 bool AddressMapper::GetMappedIDAndOffset(const uint64_t real_addr,
@@ -168,15 +212,12 @@ bool AddressMapper::GetMappedIDAndOffset(const uint64_t real_addr,
                                          uint64_t* offset) const {
   CHECK(id);
   CHECK(offset);
-  MappingList::const_iterator iter;
-  for (iter = mappings_.begin(); iter != mappings_.end(); ++iter) {
-    if (!iter->ContainsAddress(real_addr))
-      continue;
-    *id = iter->id;
-    *offset = real_addr - iter->real_addr + iter->offset_base;
-    return true;
-  }
-  return false;
+  MappingList::const_iterator iter = FindContainingRange(real_addr);
+  if (iter == mappings_.end())
+    return false;
+  *id = iter->id;
+  *offset = real_addr - iter->real_addr + iter->offset_base;
+  return true;
 }
 
 uint64_t AddressMapper::GetMaxMappedLength() const {
@@ -193,25 +234,25 @@ uint64_t AddressMapper::GetMaxMappedLength() const {
 }
 
 bool AddressMapper::Unmap(const MappedRange& range) {
-  MappingList::iterator iter;
-  // TODO(sque): this is highly inefficient since Unmap() is called from a
-  // function that has already iterated to the right place within |mappings_|.
-  // For a first revision, I am sacrificing efficiency for of clarity, due to
-  // the trickiness of removing elements using iterators.
-  for (iter = mappings_.begin(); iter != mappings_.end(); ++iter) {
-    if (range.real_addr == iter->real_addr && range.size == iter->size) {
-      // Add the freed up space to the free space counter of the previous
-      // mapped region, if it exists.
-      if (iter != mappings_.begin()) {
-        --iter;
-        iter->unmapped_space_after += range.size + range.unmapped_space_after;
-        ++iter;
-      }
-      mappings_.erase(iter);
-      return true;
-    }
+  RealAddrIndex::iterator idx = real_addr_index_.find(range.real_addr);
+  if (idx == real_addr_index_.end())
+    return false;
+  MappingList::iterator iter = idx->second;
+  if (range.size != iter->size)
+    return false;
+  // Add the freed up space to the free space counter of the previous mapped
+  // region, if it exists.
+  if (iter != mappings_.begin()) {
+    MappingList::iterator prev = iter;
+    --prev;
+    prev->unmapped_space_after += range.size + range.unmapped_space_after;
+    gap_index_[prev->mapped_addr] = prev;
   }
-  return false;
+  if (iter->unmapped_space_after > 0)
+    gap_index_.erase(iter->mapped_addr);
+  real_addr_index_.erase(idx);
+  mappings_.erase(iter);
+  return true;
 }
 
 }  // namespace quipper
@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include <list>
+#include <map>
 
 namespace quipper {
 
@@ -110,16 +111,40 @@ class AddressMapper {
     }
   };
 
-  // TODO(sque): implement with set or map to improve searching.
   typedef std::list<MappedRange> MappingList;
 
+  // Index of mappings_ nodes keyed by real_addr. Ranges don't overlap in
+  // real space, so the entry with the greatest real_addr <= addr is the only
+  // candidate for containing addr, making lookups O(log n) instead of a walk
+  // over every mapping.
+  typedef std::map<uint64_t, MappingList::iterator> RealAddrIndex;
+
+  // Index of mappings_ nodes with unmapped space after them, keyed by
+  // mapped_addr. Iterating it visits free gaps in mapped order, so first-fit
+  // placement in MapWithID() only scans gaps instead of every mapping.
+  typedef std::map<uint64_t, MappingList::iterator> GapIndex;
+
   // Removes an existing address mapping.
   // Returns true if successful, false if no mapped address range was found.
   bool Unmap(const MappedRange& range);
 
-  // Container for all the existing mappings.
+  // Returns an iterator to the mapping containing |real_addr|, or
+  // mappings_.end() if there is none.
+  MappingList::const_iterator FindContainingRange(uint64_t real_addr) const;
+
+  // Adds a newly inserted mappings_ node to the indices.
+  void IndexInsertedRange(MappingList::iterator iter);
+
+  // Rebuilds the indices from mappings_, e.g. after copying the list, which
+  // invalidates the stored iterators.
+  void RebuildIndices();
+
+  // Container for all the existing mappings, ordered by mapped address.
   MappingList mappings_;
 
+  RealAddrIndex real_addr_index_;
+  GapIndex gap_index_;
+
   bool CheckMappings() const;
 };
 
@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <cstdio>
 #include <set>
+#include <thread>
 
 #include "base/logging.h"
 
@@ -42,6 +43,19 @@ bool IsNullBranchStackEntry(const struct branch_entry& entry) {
   return (!entry.from && !entry.to);
 }
 
+// Returns the representative pid of |pid|'s group in |groups|, adding a
+// singleton group if the pid has not been seen yet. Compresses paths
+// along the way.
+uint32_t FindPidGroup(std::map<uint32_t, uint32_t>* groups, uint32_t pid) {
+  std::map<uint32_t, uint32_t>::iterator iter =
+      groups->insert(std::make_pair(pid, pid)).first;
+  if (iter->second == pid)
+    return pid;
+  uint32_t root = FindPidGroup(groups, iter->second);
+  iter->second = root;
+  return root;
+}
+
 }  // namespace
 
 PerfParser::PerfParser()
@@ -63,7 +77,7 @@ bool PerfParser::ParseRawEvents() {
   parsed_events_.resize(events_.size());
   for (size_t i = 0; i < events_.size(); ++i) {
     ParsedEvent& parsed_event = parsed_events_[i];
-    parsed_event.raw_event = events_[i].get();
+    parsed_event.raw_event = events_[i];
   }
   MaybeSortParsedEvents();
   if (!ProcessEvents()) {
@@ -99,6 +113,129 @@ bool PerfParser::ParseRawEvents() {
   return true;
 }
 
+bool PerfParser::ParseFileStreaming(const string& filename,
+                                    SampleEventHandler* handler) {
+  process_mappers_.clear();
+  mmap_id_to_dso_.clear();
+  streaming_num_mmap_events_ = 0;
+  memset(&stats_, 0, sizeof(stats_));
+  stats_.did_remap = false;
+
+  // Pid 0 is the swapper process. Act like we received a COMM event for it,
+  // just like ProcessEvents() does.
+  commands_.insert(kSwapperCommandName);
+  pidtid_to_comm_map_[std::make_pair(kSwapperPid, kSwapperPid)] =
+      &(*commands_.find(kSwapperCommandName));
+
+  sample_handler_ = handler;
+  bool result = ReadFile(filename);
+  sample_handler_ = NULL;
+  if (!result)
+    return false;
+
+  DLOG(INFO) << "Parser streamed: "
+            << stats_.num_mmap_events << " MMAP/MMAP2 events, "
+            << stats_.num_comm_events << " COMM events, "
+            << stats_.num_fork_events << " FORK events, "
+            << stats_.num_exit_events << " EXIT events, "
+            << stats_.num_sample_events << " SAMPLE events, "
+            << stats_.num_sample_events_mapped << " of these were mapped";
+
+  float sample_mapping_percentage =
+      static_cast<float>(stats_.num_sample_events_mapped) /
+      stats_.num_sample_events * 100.;
+  float threshold = options_.sample_mapping_percentage_threshold;
+  if (sample_mapping_percentage < threshold) {
+    LOG(WARNING) << "Mapped " << static_cast<int>(sample_mapping_percentage)
+               << "% of samples, expected at least "
+               << static_cast<int>(threshold) << "%";
+    return false;
+  }
+  stats_.did_remap = options_.do_remap;
+  return true;
+}
+
+bool PerfParser::OnPerfEventRead(event_t* event_p, size_t alloc_size) {
+  if (sample_handler_ == NULL) {
+    return PerfReader::OnPerfEventRead(event_p, alloc_size);
+  }
+  event_t& event = *event_p;
+  bool result = true;
+  switch (event.header.type) {
+    case PERF_RECORD_SAMPLE: {
+      VLOG(1) << "SAMPLE";
+      ++stats_.num_sample_events;
+      ParsedEvent parsed_event;
+      parsed_event.raw_event = &event;
+      if (MapSampleEvent(&parsed_event)) {
+        ++stats_.num_sample_events_mapped;
+      }
+      result = sample_handler_->HandleSample(parsed_event);
+      break;
+    }
+    case PERF_RECORD_MMAP: {
+      VLOG(1) << "MMAP: " << event.mmap.filename;
+      ++stats_.num_mmap_events;
+      uint64_t id = streaming_num_mmap_events_++;
+      CHECK(MapMmapEvent(&event.mmap, id)) << "Unable to map MMAP event!";
+      DSOInfo dso_info;
+      dso_info.name = event.mmap.filename;
+      mmap_id_to_dso_[id] = &(*dso_set_.insert(dso_info).first);
+      break;
+    }
+    case PERF_RECORD_MMAP2: {
+      VLOG(1) << "MMAP2: " << event.mmap2.filename;
+      ++stats_.num_mmap_events;
+      uint64_t id = streaming_num_mmap_events_++;
+      CHECK(MapMmapEvent(&event.mmap2, id)) << "Unable to map MMAP2 event!";
+      DSOInfo dso_info;
+      dso_info.name = event.mmap2.filename;
+      mmap_id_to_dso_[id] = &(*dso_set_.insert(dso_info).first);
+      break;
+    }
+    case PERF_RECORD_FORK:
+      VLOG(1) << "FORK: " << event.fork.ppid << ":" << event.fork.ptid
+              << " -> " << event.fork.pid << ":" << event.fork.tid;
+      ++stats_.num_fork_events;
+      CHECK(MapForkEvent(event.fork)) << "Unable to map FORK event!";
+      break;
+    case PERF_RECORD_EXIT:
+      // EXIT events have the same structure as FORK events.
+      VLOG(1) << "EXIT: " << event.fork.ppid << ":" << event.fork.ptid;
+      ++stats_.num_exit_events;
+      break;
+    case PERF_RECORD_COMM:
+      VLOG(1) << "COMM: " << event.comm.pid << ":" << event.comm.tid << ": "
+              << event.comm.comm;
+      ++stats_.num_comm_events;
+      CHECK(MapCommEvent(event.comm));
+      commands_.insert(event.comm.comm);
+      pidtid_to_comm_map_[std::make_pair(event.comm.pid, event.comm.tid)] =
+          &(*commands_.find(event.comm.comm));
+      break;
+    case PERF_RECORD_LOST:
+    case PERF_RECORD_THROTTLE:
+    case PERF_RECORD_UNTHROTTLE:
+    case PERF_RECORD_READ:
+    case PERF_RECORD_MAX:
+      VLOG(1) << "Parsed event type: " << event.header.type
+              << ". Doing nothing.";
+      break;
+    case SIMPLE_PERF_RECORD_KERNEL_SYMBOL:
+    case SIMPLE_PERF_RECORD_DSO:
+    case SIMPLE_PERF_RECORD_SYMBOL:
+    case SIMPLE_PERF_RECORD_SPLIT:
+    case SIMPLE_PERF_RECORD_SPLIT_END:
+      break;
+    default:
+      LOG(ERROR) << "Unknown event type: " << event.header.type;
+      result = false;
+      break;
+  }
+  event_arena_.Recycle(event_p, alloc_size);
+  return result;
+}
+
 void PerfParser::MaybeSortParsedEvents() {
   if (!(sample_type_ & PERF_SAMPLE_TIME)) {
     parsed_events_sorted_by_time_.resize(parsed_events_.size());
@@ -146,6 +283,9 @@ bool PerfParser::ProcessEvents() {
   pidtid_to_comm_map_[std::make_pair(kSwapperPid, kSwapperPid)] =
       &(*commands_.find(kSwapperCommandName));
 
+  if (options_.num_processing_threads > 1)
+    return ProcessEventsSharded();
+
   // NB: Not necessarily actually sorted by time.
   for (unsigned int i = 0; i < parsed_events_sorted_by_time_.size(); ++i) {
     ParsedEvent& parsed_event = *parsed_events_sorted_by_time_[i];
@@ -250,6 +390,233 @@ bool PerfParser::ProcessEvents() {
   return true;
 }
 
+bool PerfParser::ProcessEventsSharded() {
+  const size_t num_events = parsed_events_sorted_by_time_.size();
+
+  // Sequential pre-pass. Everything the shards share must be fully built
+  // here so that the worker threads only read it:
+  // - kernel mmaps are applied up front, since the kernel mapper backs
+  //   samples from every process;
+  // - command and DSO strings are interned, so shards only do lookups;
+  // - comm-map and process-mapper slots are reserved, so shards fill in
+  //   existing nodes and never reshape the maps;
+  // - pids are grouped, with a forked child joined to its parent's group
+  //   so that the mapping copy at fork time happens in event order.
+  std::map<uint32_t, uint32_t> pid_groups;
+  std::vector<uint32_t> event_pids(num_events, kKernelPid);
+  for (size_t i = 0; i < num_events; ++i) {
+    ParsedEvent& parsed_event = *parsed_events_sorted_by_time_[i];
+    event_t& event = *parsed_event.raw_event;
+    switch (event.header.type) {
+      case PERF_RECORD_SAMPLE: {
+        uint32_t pid = 0;
+        if (sample_type_ & PERF_SAMPLE_TID) {
+          perf_sample sample_info;
+          PerfSampleCustodian custodian(sample_info);
+          if (ReadPerfSampleInfo(event, &sample_info))
+            pid = sample_info.pid;
+        }
+        event_pids[i] = pid;
+        FindPidGroup(&pid_groups, pid);
+        break;
+      }
+      case PERF_RECORD_MMAP:
+      case PERF_RECORD_MMAP2: {
+        bool is_mmap2 = (event.header.type == PERF_RECORD_MMAP2);
+        uint32_t pid = is_mmap2 ? event.mmap2.pid : event.mmap.pid;
+        DSOInfo dso_info;
+        dso_info.name = is_mmap2 ? event.mmap2.filename : event.mmap.filename;
+        dso_set_.insert(dso_info);
+        if (pid == kKernelPid) {
+          ++stats_.num_mmap_events;
+          parsed_event.num_samples_in_mmap_region = 0;
+          if (is_mmap2)
+            CHECK(MapMmapEvent(&event.mmap2, i)) << "Unable to map MMAP2 event!";
+          else
+            CHECK(MapMmapEvent(&event.mmap, i)) << "Unable to map MMAP event!";
+        } else {
+          event_pids[i] = pid;
+          FindPidGroup(&pid_groups, pid);
+        }
+        break;
+      }
+      case PERF_RECORD_FORK:
+      case PERF_RECORD_EXIT: {
+        event_pids[i] = event.fork.pid;
+        uint32_t pid_root = FindPidGroup(&pid_groups, event.fork.pid);
+        if (event.header.type == PERF_RECORD_FORK) {
+          uint32_t parent_root = FindPidGroup(&pid_groups, event.fork.ppid);
+          if (parent_root != pid_root)
+            pid_groups[pid_root] = parent_root;
+          pidtid_to_comm_map_.insert(std::make_pair(
+              std::make_pair(event.fork.pid, event.fork.tid), nullptr));
+        }
+        break;
+      }
+      case PERF_RECORD_COMM:
+        event_pids[i] = event.comm.pid;
+        FindPidGroup(&pid_groups, event.comm.pid);
+        commands_.insert(event.comm.comm);
+        pidtid_to_comm_map_.insert(std::make_pair(
+            std::make_pair(event.comm.pid, event.comm.tid), nullptr));
+        break;
+      case PERF_RECORD_LOST:
+      case PERF_RECORD_THROTTLE:
+      case PERF_RECORD_UNTHROTTLE:
+      case PERF_RECORD_READ:
+      case PERF_RECORD_MAX:
+        VLOG(1) << "Parsed event type: " << event.header.type
+                << ". Doing nothing.";
+        break;
+      case SIMPLE_PERF_RECORD_KERNEL_SYMBOL:
+      case SIMPLE_PERF_RECORD_DSO:
+      case SIMPLE_PERF_RECORD_SYMBOL:
+      case SIMPLE_PERF_RECORD_SPLIT:
+      case SIMPLE_PERF_RECORD_SPLIT_END:
+        break;
+      default:
+        LOG(ERROR) << "Unknown event type: " << event.header.type;
+        return false;
+    }
+  }
+
+  // Reserve a mapper slot for every pid, so that the shards never change
+  // the shape of |process_mappers_|. GetOrCreateProcessMapper() fills
+  // the slots in lazily, preserving the copy-from-parent behavior on
+  // fork.
+  for (std::map<uint32_t, uint32_t>::const_iterator iter = pid_groups.begin();
+       iter != pid_groups.end(); ++iter) {
+    process_mappers_.insert(
+        std::make_pair(iter->first, std::unique_ptr<AddressMapper>()));
+  }
+
+  // Assign each pid group to the least-loaded shard.
+  std::map<uint32_t, size_t> group_sizes;
+  for (size_t i = 0; i < num_events; ++i) {
+    if (event_pids[i] != kKernelPid)
+      ++group_sizes[FindPidGroup(&pid_groups, event_pids[i])];
+  }
+  size_t num_shards = options_.num_processing_threads;
+  if (group_sizes.size() > 0 && group_sizes.size() < num_shards)
+    num_shards = group_sizes.size();
+  std::vector<size_t> shard_loads(num_shards, 0);
+  std::map<uint32_t, size_t> group_to_shard;
+  for (std::map<uint32_t, size_t>::const_iterator iter = group_sizes.begin();
+       iter != group_sizes.end(); ++iter) {
+    size_t shard = 0;
+    for (size_t s = 1; s < num_shards; ++s) {
+      if (shard_loads[s] < shard_loads[shard])
+        shard = s;
+    }
+    group_to_shard[iter->first] = shard;
+    shard_loads[shard] += iter->second;
+  }
+
+  // Partition the events, keeping each shard's slice in global (sorted)
+  // order. |parsed_events_| is updated in place, so the combined result
+  // keeps the original event order no matter how the work was split.
+  std::vector<std::vector<size_t>> shard_indices(num_shards);
+  for (size_t i = 0; i < num_events; ++i) {
+    if (event_pids[i] != kKernelPid) {
+      size_t shard = group_to_shard[FindPidGroup(&pid_groups, event_pids[i])];
+      shard_indices[shard].push_back(i);
+    }
+  }
+
+  std::vector<PerfEventStats> shard_stats(num_shards);
+  sharded_processing_ = true;
+  std::vector<std::thread> workers;
+  for (size_t s = 0; s < num_shards; ++s) {
+    workers.push_back(std::thread(&PerfParser::ProcessShardEvents, this,
+                                  &shard_indices[s], &shard_stats[s]));
+  }
+  for (size_t s = 0; s < workers.size(); ++s)
+    workers[s].join();
+  sharded_processing_ = false;
+
+  for (size_t s = 0; s < num_shards; ++s) {
+    stats_.num_sample_events += shard_stats[s].num_sample_events;
+    stats_.num_mmap_events += shard_stats[s].num_mmap_events;
+    stats_.num_comm_events += shard_stats[s].num_comm_events;
+    stats_.num_fork_events += shard_stats[s].num_fork_events;
+    stats_.num_exit_events += shard_stats[s].num_exit_events;
+    stats_.num_sample_events_mapped += shard_stats[s].num_sample_events_mapped;
+  }
+
+  // Print stats collected from parsing.
+  DLOG(INFO) << "Parser processed (" << num_shards << " shards): "
+            << stats_.num_mmap_events << " MMAP/MMAP2 events, "
+            << stats_.num_comm_events << " COMM events, "
+            << stats_.num_fork_events << " FORK events, "
+            << stats_.num_exit_events << " EXIT events, "
+            << stats_.num_sample_events << " SAMPLE events, "
+            << stats_.num_sample_events_mapped << " of these were mapped";
+
+  float sample_mapping_percentage =
+      static_cast<float>(stats_.num_sample_events_mapped) /
+      stats_.num_sample_events * 100.;
+  float threshold = options_.sample_mapping_percentage_threshold;
+  if (sample_mapping_percentage < threshold) {
+    LOG(WARNING) << "Mapped " << static_cast<int>(sample_mapping_percentage)
+               << "% of samples, expected at least "
+               << static_cast<int>(threshold) << "%";
+    return false;
+  }
+  stats_.did_remap = options_.do_remap;
+  return true;
+}
+
+void PerfParser::ProcessShardEvents(const std::vector<size_t>* indices,
+                                    PerfEventStats* stats) {
+  for (size_t n = 0; n < indices->size(); ++n) {
+    size_t i = (*indices)[n];
+    ParsedEvent& parsed_event = *parsed_events_sorted_by_time_[i];
+    event_t& event = *parsed_event.raw_event;
+    switch (event.header.type) {
+      case PERF_RECORD_SAMPLE:
+        VLOG(1) << "SAMPLE";
+        ++stats->num_sample_events;
+        if (MapSampleEvent(&parsed_event)) {
+          ++stats->num_sample_events_mapped;
+        }
+        break;
+      case PERF_RECORD_MMAP:
+        VLOG(1) << "MMAP: " << event.mmap.filename;
+        ++stats->num_mmap_events;
+        CHECK(MapMmapEvent(&event.mmap, i)) << "Unable to map MMAP event!";
+        parsed_event.num_samples_in_mmap_region = 0;
+        break;
+      case PERF_RECORD_MMAP2:
+        VLOG(1) << "MMAP2: " << event.mmap2.filename;
+        ++stats->num_mmap_events;
+        CHECK(MapMmapEvent(&event.mmap2, i)) << "Unable to map MMAP2 event!";
+        parsed_event.num_samples_in_mmap_region = 0;
+        break;
+      case PERF_RECORD_FORK:
+        VLOG(1) << "FORK: " << event.fork.ppid << ":" << event.fork.ptid
+                << " -> " << event.fork.pid << ":" << event.fork.tid;
+        ++stats->num_fork_events;
+        CHECK(MapForkEvent(event.fork)) << "Unable to map FORK event!";
+        break;
+      case PERF_RECORD_EXIT:
+        VLOG(1) << "EXIT: " << event.fork.ppid << ":" << event.fork.ptid;
+        ++stats->num_exit_events;
+        break;
+      case PERF_RECORD_COMM:
+        VLOG(1) << "COMM: " << event.comm.pid << ":" << event.comm.tid << ": "
+                << event.comm.comm;
+        ++stats->num_comm_events;
+        CHECK(MapCommEvent(event.comm));
+        pidtid_to_comm_map_[std::make_pair(event.comm.pid, event.comm.tid)] =
+            &(*commands_.find(event.comm.comm));
+        break;
+      default:
+        // Filtered out by the pre-pass.
+        break;
+    }
+  }
+}
+
 bool PerfParser::MapSampleEvent(ParsedEvent* parsed_event) {
   bool mapping_failed = false;
 
@@ -436,27 +803,44 @@ bool PerfParser::MapIPAndPidAndGetNameAndOffset(
     if (dso_and_offset) {
       uint64_t id = kuint64max;
       CHECK(mapper->GetMappedIDAndOffset(ip, &id, &dso_and_offset->offset_));
-      // Make sure the ID points to a valid event.
-      CHECK_LE(id, parsed_events_sorted_by_time_.size());
-      ParsedEvent* parsed_event = parsed_events_sorted_by_time_[id];
-      const event_t* raw_event = parsed_event->raw_event;
-
-      DSOInfo dso_info;
-      if (raw_event->header.type == PERF_RECORD_MMAP) {
-        dso_info.name = raw_event->mmap.filename;
-      } else if (raw_event->header.type == PERF_RECORD_MMAP2) {
-        dso_info.name = raw_event->mmap2.filename;
+      if (sample_handler_ != NULL) {
+        // In streaming mode the mmap events are not kept around; the DSO was
+        // recorded by id when the mmap event was mapped.
+        std::map<uint64_t, const DSOInfo*>::const_iterator dso_iter =
+            mmap_id_to_dso_.find(id);
+        CHECK(dso_iter != mmap_id_to_dso_.end());
+        dso_and_offset->dso_info_ = dso_iter->second;
       } else {
-        LOG(FATAL) << "Expected MMAP or MMAP2 event";
-      }
+        // Make sure the ID points to a valid event.
+        CHECK_LE(id, parsed_events_sorted_by_time_.size());
+        ParsedEvent* parsed_event = parsed_events_sorted_by_time_[id];
+        const event_t* raw_event = parsed_event->raw_event;
 
-      // Find the mmap DSO filename in the set of known DSO names.
-      // TODO(sque): take build IDs into account.
-      std::set<DSOInfo>::const_iterator dso_iter = dso_set_.find(dso_info);
-      CHECK(dso_iter != dso_set_.end());
-      dso_and_offset->dso_info_ = &(*dso_iter);
+        DSOInfo dso_info;
+        if (raw_event->header.type == PERF_RECORD_MMAP) {
+          dso_info.name = raw_event->mmap.filename;
+        } else if (raw_event->header.type == PERF_RECORD_MMAP2) {
+          dso_info.name = raw_event->mmap2.filename;
+        } else {
+          LOG(FATAL) << "Expected MMAP or MMAP2 event";
+        }
 
-      ++parsed_event->num_samples_in_mmap_region;
+        // Find the mmap DSO filename in the set of known DSO names.
+        // TODO(sque): take build IDs into account.
+        std::set<DSOInfo>::const_iterator dso_iter = dso_set_.find(dso_info);
+        CHECK(dso_iter != dso_set_.end());
+        dso_and_offset->dso_info_ = &(*dso_iter);
+
+        if (sharded_processing_ && mapper == kernel_mapper_.get()) {
+          // Kernel regions collect samples from every shard, so guard
+          // the counter; process regions are only touched by their own
+          // shard.
+          std::lock_guard<std::mutex> lock(kernel_region_count_mutex_);
+          ++parsed_event->num_samples_in_mmap_region;
+        } else {
+          ++parsed_event->num_samples_in_mmap_region;
+        }
+      }
     }
     if (options_.do_remap)
       *new_ip = mapped_addr;
@@ -537,17 +921,23 @@ bool PerfParser::MapMmapEvent(uint64_t id,
 std::pair<AddressMapper*, bool> PerfParser::GetOrCreateProcessMapper(
     uint32_t pid, uint32_t *ppid) {
   const auto& search = process_mappers_.find(pid);
-  if (search != process_mappers_.end()) {
+  if (search != process_mappers_.end() && search->second) {
     return std::make_pair(search->second.get(), false);
   }
 
   std::unique_ptr<AddressMapper> mapper;
   const auto& parent_mapper = (ppid ? process_mappers_.find(*ppid) : process_mappers_.end());
-  if (parent_mapper != process_mappers_.end())
+  if (parent_mapper != process_mappers_.end() && parent_mapper->second)
       mapper.reset(new AddressMapper(*parent_mapper->second));
   else
     mapper.reset(new AddressMapper());
 
+  if (search != process_mappers_.end()) {
+    // Fill in a slot reserved by the sharded pre-pass. The node is only
+    // ever touched by the shard that owns this pid.
+    search->second = std::move(mapper);
+    return std::make_pair(search->second.get(), true);
+  }
   const auto inserted =
       process_mappers_.insert(search, std::make_pair(pid, std::move(mapper)));
   return std::make_pair(inserted->second.get(), true);
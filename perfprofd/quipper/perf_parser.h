@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <utility>
@@ -97,6 +98,16 @@ struct ParsedEvent {
   std::vector<BranchEntry> branch_stack;
 };
 
+// Receives mapped sample events during PerfParser::ParseFileStreaming().
+// The ParsedEvent passed to HandleSample() is only valid during the call.
+// The DSOInfo objects it points to live as long as the parser, so handlers
+// keeping DSOAndOffset values must not outlive it.
+class SampleEventHandler {
+ public:
+  virtual ~SampleEventHandler() {}
+  virtual bool HandleSample(const ParsedEvent& event) = 0;
+};
+
 struct PerfEventStats {
   // Number of each type of event.
   uint32_t num_sample_events;
@@ -131,6 +142,14 @@ class PerfParser : public PerfReader {
     // By default, most samples must be properly mapped in order for sample
     // mapping to be considered successful.
     float sample_mapping_percentage_threshold = 95.0f;
+    // Number of threads used by ProcessEvents(). When greater than 1,
+    // events are partitioned by pid across worker threads after a
+    // sequential pre-pass; events for different processes touch
+    // independent address mapper state, so they can be mapped in
+    // parallel. Kernel mmaps are applied before the workers start, so a
+    // sample that precedes a kernel mmap in the file may be mapped in
+    // sharded mode where it would not have been sequentially.
+    int num_processing_threads = 1;
   };
 
   // Constructor that takes in options at PerfParser creation time.
@@ -142,6 +161,13 @@ class PerfParser : public PerfReader {
   // Gets parsed event/sample info from raw event data.
   bool ParseRawEvents();
 
+  // Reads a perf data file, mapping each sample event as it is read and
+  // passing it to |handler| instead of storing it, so memory stays bounded
+  // on large profiles. Only the mmap/comm/fork bookkeeping needed for
+  // mapping samples is kept. Events are processed in file order, as they
+  // can't be sorted by time without materializing them first.
+  bool ParseFileStreaming(const string& filename, SampleEventHandler* handler);
+
   const std::vector<ParsedEvent>& parsed_events() const {
     return parsed_events_;
   }
@@ -170,6 +196,19 @@ class PerfParser : public PerfReader {
 
   // Used for processing events.  e.g. remapping with synthetic addresses.
   bool ProcessEvents();
+
+  // Sharded counterpart of ProcessEvents(), used when
+  // options_.num_processing_threads > 1. A sequential pre-pass applies
+  // kernel mmaps, interns command/DSO strings, reserves map slots and
+  // groups pids (a forked child must be processed by the same shard as
+  // its parent); the per-pid work then runs on worker threads.
+  bool ProcessEventsSharded();
+
+  // Processes the events at |indices| (indices into
+  // |parsed_events_sorted_by_time_|) on a worker thread, accumulating
+  // event counts into |stats|.
+  void ProcessShardEvents(const std::vector<size_t>* indices,
+                          PerfEventStats* stats);
   template <typename MMapEventT>
   bool MapMmapEvent(MMapEventT* event, uint64_t id) {
     return MapMmapEvent(id,
@@ -189,6 +228,12 @@ class PerfParser : public PerfReader {
   // Does a sample event remap and then returns DSO name and offset of sample.
   bool MapSampleEvent(ParsedEvent* parsed_event);
 
+  // Consumes events one at a time when a streaming handler is set, updating
+  // the address mappers, passing mapped samples to |sample_handler_| and
+  // recycling the event afterwards. Otherwise falls back to storing the
+  // event like PerfReader does.
+  virtual bool OnPerfEventRead(event_t* event, size_t alloc_size);
+
   std::vector<ParsedEvent> parsed_events_;
   // See MaybeSortParsedEvents to see why this might not actually be sorted
   // by time:
@@ -241,6 +286,22 @@ class PerfParser : public PerfReader {
   std::unique_ptr<AddressMapper> kernel_mapper_;
   std::map<uint32_t, std::unique_ptr<AddressMapper>> process_mappers_;
 
+  // Streaming mode state for ParseFileStreaming(). |sample_handler_| is only
+  // non-NULL while a streaming parse is in progress.
+  SampleEventHandler* sample_handler_ = nullptr;
+  // Number of mmap events seen so far, used as the unique id passed to
+  // MapMmapEvent() in streaming mode.
+  uint64_t streaming_num_mmap_events_ = 0;
+  // Maps the id given to MapMmapEvent() to the DSO of the mmap event, taking
+  // the place of the parsed event lookup in non-streaming mode.
+  std::map<uint64_t, const DSOInfo*> mmap_id_to_dso_;
+
+  // True while ProcessEventsSharded() worker threads are running.
+  bool sharded_processing_ = false;
+  // In sharded mode, serializes sample counting on kernel mmap regions,
+  // which are shared between shards.
+  std::mutex kernel_region_count_mutex_;
+
   DISALLOW_COPY_AND_ASSIGN(PerfParser);
 };
 
@@ -22,14 +22,9 @@
 
 namespace quipper {
 
-struct BufferWithSize {
-  char* ptr;
-  size_t size;
-};
-
-// If the buffer is read-only, it is not sufficient to mark the previous struct
-// as const, as this only means that the pointer cannot be changed, and says
-// nothing about the contents of the buffer.  So, we need another struct.
+// A read-only input buffer. Marking a char* member const only means the
+// pointer cannot be changed, and says nothing about the contents of the
+// buffer, so the pointer itself is a const char*.
 struct ConstBufferWithSize {
   const char* ptr;
   size_t size;
@@ -348,21 +343,12 @@ const uint64_t* ReadBranchStack(const uint64_t* array,
   return array;
 }
 
-size_t ReadPerfSampleFromData(const perf_event_type event_type,
-                              const uint64_t* array,
-                              const uint64_t sample_fields,
-                              const uint64_t read_format,
-                              bool swap_bytes,
-                              const perf_event_attr &attr0,
-                              size_t n_attrs,
-                              struct perf_sample* sample) {
-  const uint64_t* initial_array_ptr = array;
-
-  union {
-    uint32_t val32[sizeof(uint64_t) / sizeof(uint32_t)];
-    uint64_t val64;
-  };
-
+// Computes the layout of the fixed-size sample info fields selected by
+// |sample_fields|. |is_sample_event| tells whether the layout describes a
+// PERF_RECORD_SAMPLE event or the sample_id struct trailing another event,
+// which store PERF_SAMPLE_IDENTIFIER in different locations.
+SampleInfoLayout ComputeSampleInfoLayout(const uint64_t sample_fields,
+                                         bool is_sample_event) {
   // See structure for PERF_RECORD_SAMPLE in kernel/perf_event.h
   // and compare sample_id when sample_id_all is set.
 
@@ -370,72 +356,116 @@ size_t ReadPerfSampleFromData(const perf_event_type event_type,
   // of fields in that struct by GetSampleFieldsForEventType. That set
   // of fields is mostly in the same order as PERF_RECORD_SAMPLE, with
   // the exception of PERF_SAMPLE_IDENTIFIER.
-
-  // PERF_SAMPLE_IDENTIFIER is in a different location depending on
-  // if this is a SAMPLE event or the sample_id of another event.
-  if (event_type == PERF_RECORD_SAMPLE) {
-    // { u64                   id;       } && PERF_SAMPLE_IDENTIFIER
-    if (sample_fields & PERF_SAMPLE_IDENTIFIER) {
-      sample->id = MaybeSwap(*array++, swap_bytes);
-    }
+  SampleInfoLayout layout;
+  int pos = 0;
+  if (is_sample_event && (sample_fields & PERF_SAMPLE_IDENTIFIER)) {
+    layout.identifier = pos++;
   }
-
-  // { u64                   ip;       } && PERF_SAMPLE_IP
   if (sample_fields & PERF_SAMPLE_IP) {
-    sample->ip = MaybeSwap(*array++, swap_bytes);
+    layout.ip = pos++;
+  }
+  if (sample_fields & PERF_SAMPLE_TID) {
+    layout.tid = pos++;
+  }
+  if (sample_fields & PERF_SAMPLE_TIME) {
+    layout.time = pos++;
+  }
+  if (sample_fields & PERF_SAMPLE_ADDR) {
+    layout.addr = pos++;
+  }
+  if (sample_fields & PERF_SAMPLE_ID) {
+    layout.id = pos++;
+  }
+  if (sample_fields & PERF_SAMPLE_STREAM_ID) {
+    layout.stream_id = pos++;
   }
+  if (sample_fields & PERF_SAMPLE_CPU) {
+    layout.cpu = pos++;
+  }
+  // This is the location of PERF_SAMPLE_IDENTIFIER in struct sample_id.
+  if (!is_sample_event && (sample_fields & PERF_SAMPLE_IDENTIFIER)) {
+    layout.identifier = pos++;
+  }
+  if (sample_fields & PERF_SAMPLE_PERIOD) {
+    layout.period = pos++;
+  }
+  layout.num_fixed_words = pos;
+  return layout;
+}
+
+// Reads the fixed-size sample info fields from |array| into |sample|, using
+// the offsets precomputed in |layout|.
+void ReadFixedSampleInfoFields(const SampleInfoLayout& layout,
+                               const uint64_t* array,
+                               bool swap_bytes,
+                               struct perf_sample* sample) {
+  union {
+    uint32_t val32[sizeof(uint64_t) / sizeof(uint32_t)];
+    uint64_t val64;
+  };
 
+  // { u64                   id;       } && PERF_SAMPLE_IDENTIFIER
+  if (layout.identifier != -1) {
+    sample->id = MaybeSwap(array[layout.identifier], swap_bytes);
+  }
+  // { u64                   ip;       } && PERF_SAMPLE_IP
+  if (layout.ip != -1) {
+    sample->ip = MaybeSwap(array[layout.ip], swap_bytes);
+  }
   // { u32                   pid, tid; } && PERF_SAMPLE_TID
-  if (sample_fields & PERF_SAMPLE_TID) {
-    val64 = *array++;
+  if (layout.tid != -1) {
+    val64 = array[layout.tid];
     sample->pid = MaybeSwap(val32[0], swap_bytes);
     sample->tid = MaybeSwap(val32[1], swap_bytes);
   }
-
   // { u64                   time;     } && PERF_SAMPLE_TIME
-  if (sample_fields & PERF_SAMPLE_TIME) {
-    sample->time = MaybeSwap(*array++, swap_bytes);
+  if (layout.time != -1) {
+    sample->time = MaybeSwap(array[layout.time], swap_bytes);
   }
-
   // { u64                   addr;     } && PERF_SAMPLE_ADDR
-  if (sample_fields & PERF_SAMPLE_ADDR) {
-    sample->addr = MaybeSwap(*array++, swap_bytes);
+  if (layout.addr != -1) {
+    sample->addr = MaybeSwap(array[layout.addr], swap_bytes);
   }
-
   // { u64                   id;       } && PERF_SAMPLE_ID
-  if (sample_fields & PERF_SAMPLE_ID) {
-    sample->id = MaybeSwap(*array++, swap_bytes);
+  if (layout.id != -1) {
+    sample->id = MaybeSwap(array[layout.id], swap_bytes);
   }
-
   // { u64                   stream_id;} && PERF_SAMPLE_STREAM_ID
-  if (sample_fields & PERF_SAMPLE_STREAM_ID) {
-    sample->stream_id = MaybeSwap(*array++, swap_bytes);
+  if (layout.stream_id != -1) {
+    sample->stream_id = MaybeSwap(array[layout.stream_id], swap_bytes);
   }
-
   // { u32                   cpu, res; } && PERF_SAMPLE_CPU
-  if (sample_fields & PERF_SAMPLE_CPU) {
-    val64 = *array++;
+  if (layout.cpu != -1) {
+    val64 = array[layout.cpu];
     sample->cpu = MaybeSwap(val32[0], swap_bytes);
     // sample->res = MaybeSwap(*val32[1], swap_bytes);  // not implemented?
   }
-
-  // This is the location of PERF_SAMPLE_IDENTIFIER in struct sample_id.
-  if (event_type != PERF_RECORD_SAMPLE) {
-    // { u64                   id;       } && PERF_SAMPLE_IDENTIFIER
-    if (sample_fields & PERF_SAMPLE_IDENTIFIER) {
-      sample->id = MaybeSwap(*array++, swap_bytes);
-    }
+  // { u64                   period;   } && PERF_SAMPLE_PERIOD
+  if (layout.period != -1) {
+    sample->period = MaybeSwap(array[layout.period], swap_bytes);
   }
+}
+
+size_t ReadPerfSampleFromData(const uint64_t* array,
+                              const uint64_t sample_fields,
+                              const uint64_t read_format,
+                              bool swap_bytes,
+                              const perf_event_attr &attr0,
+                              size_t n_attrs,
+                              const SampleInfoLayout& layout,
+                              struct perf_sample* sample) {
+  const uint64_t* initial_array_ptr = array;
+
+  // The fixed-size fields are read from offsets precomputed when the attrs
+  // were read, instead of re-interpreting sample_fields bit by bit for every
+  // event.
+  ReadFixedSampleInfoFields(layout, array, swap_bytes, sample);
+  array += layout.num_fixed_words;
 
   //
-  // The remaining fields are only in PERF_RECORD_SAMPLE
+  // The remaining fields are variable-size and only in PERF_RECORD_SAMPLE
   //
 
-  // { u64                   period;   } && PERF_SAMPLE_PERIOD
-  if (sample_fields & PERF_SAMPLE_PERIOD) {
-    sample->period = MaybeSwap(*array++, swap_bytes);
-  }
-
   // { struct read_format    values;   } && PERF_SAMPLE_READ
   if (sample_fields & PERF_SAMPLE_READ) {
     // TODO(cwp-team): support grouped read info.
@@ -677,6 +707,15 @@ void PerfReader::UnperfizeBuildIDString(string* build_id) {
 }
 
 bool PerfReader::ReadFile(const string& filename) {
+  // Map the file rather than slurping it into a vector, so that peak
+  // memory stays at one copy of the data and the kernel can stream the
+  // pages in.
+  MmappedFile mapped_file(filename);
+  if (mapped_file.IsOpen())
+    return ReadFromPointer(mapped_file.data(), mapped_file.size());
+
+  // mmap can fail for inputs that are not regular files, e.g. reading
+  // from a pipe; fall back to reading the whole file.
   std::vector<char> data;
   if (!ReadFileToData(filename, &data))
     return false;
@@ -790,6 +829,19 @@ void PerfReader::GetFilenamesToBuildIDs(
   }
 }
 
+void PerfReader::DropUnusedBuildIDs(const std::set<string>& used_filenames) {
+  size_t num_kept = 0;
+  for (size_t i = 0; i < build_id_events_.size(); ++i) {
+    build_id_event* event = build_id_events_[i];
+    if (used_filenames.find(event->filename) != used_filenames.end()) {
+      build_id_events_[num_kept++] = event;
+    } else {
+      free(event);
+    }
+  }
+  build_id_events_.resize(num_kept);
+}
+
 bool PerfReader::IsSupportedEventType(uint32_t type) {
   switch (type) {
   case PERF_RECORD_SAMPLE:
@@ -836,14 +888,17 @@ bool PerfReader::ReadPerfSampleInfo(const event_t& event,
   uint64_t sample_format = GetSampleFieldsForEventType(event.header.type,
                                                        sample_type_);
   uint64_t offset = GetPerfSampleDataOffset(event);
+  const SampleInfoLayout& layout = (event.header.type == PERF_RECORD_SAMPLE)
+                                       ? sample_layout_
+                                       : sample_id_layout_;
   size_t size_read = ReadPerfSampleFromData(
-      static_cast<perf_event_type>(event.header.type),
       reinterpret_cast<const uint64_t*>(&event) + offset / sizeof(uint64_t),
       sample_format,
       read_format_,
       is_cross_endian_,
       attrs_[0].attr,
       attrs_.size(),
+      layout,
       sample);
 
   size_t expected_size = event.header.size - offset;
@@ -1022,6 +1077,13 @@ bool PerfReader::ReadEventAttr(const ConstBufferWithSize& data, size_t* offset,
   // subsequent attributes have the same sample type bits set.
   if (sample_type_ == 0) {
     sample_type_ = attr->sample_type;
+    // With a fixed sample type the layout of the fixed-size sample info
+    // fields is static; compute it once here so decoding doesn't re-walk the
+    // sample type bits for every event. All non-SAMPLE event types share one
+    // sample_id field mask, so any of them works as the representative.
+    sample_layout_ = ComputeSampleInfoLayout(sample_type_, true);
+    sample_id_layout_ = ComputeSampleInfoLayout(
+        GetSampleFieldsForEventType(PERF_RECORD_MMAP, sample_type_), false);
   } else {
     CHECK_EQ(sample_type_, attr->sample_type)
         << "Event type sample format does not match sample format of other "
@@ -1460,8 +1522,8 @@ bool PerfReader::ReadPerfEventBlock(const event_t& event) {
   }
 
   // Copy only the part of the event that is needed.
-  malloced_unique_ptr<event_t> event_copy(CallocMemoryForEvent(size));
-  memcpy(event_copy.get(), &event, size);
+  event_t* event_copy = event_arena_.Alloc(size);
+  memcpy(event_copy, &event, size);
   if (is_cross_endian_) {
     ByteSwap(&event_copy->header.type);
     ByteSwap(&event_copy->header.misc);
@@ -1521,8 +1583,11 @@ bool PerfReader::ReadPerfEventBlock(const event_t& event) {
     }
   }
 
-  events_.push_back(std::move(event_copy));
+  return OnPerfEventRead(event_copy, size);
+}
 
+bool PerfReader::OnPerfEventRead(event_t* event, size_t) {
+  events_.push_back(event);
   return true;
 }
 
@@ -1639,7 +1704,7 @@ bool PerfReader::LocalizeMMapFilenames(
   for (size_t i = 0; i < events_.size(); ++i) {
     string filename;
     size_t size_of_fixed_event_parts;
-    event_t* event = events_[i].get();
+    event_t* event = events_[i];
     if (event->header.type == PERF_RECORD_MMAP) {
       filename = string(event->mmap.filename);
       size_of_fixed_event_parts =
@@ -1669,18 +1734,20 @@ bool PerfReader::LocalizeMMapFilenames(
     if (size_change > 0) {
       // Allocate memory for a new event.
       event_t* old_event = event;
-      malloced_unique_ptr<event_t> new_event(CallocMemoryForEvent(new_size));
+      size_t old_alloc_size = old_event->header.size;
+      event_t* new_event = event_arena_.Alloc(new_size);
 
       // Copy over everything except filename and sample info.
-      memcpy(new_event.get(), old_event, size_of_fixed_event_parts);
+      memcpy(new_event, old_event, size_of_fixed_event_parts);
 
       // Copy over the sample info to the correct location.
       char* old_addr = reinterpret_cast<char*>(old_event);
-      char* new_addr = reinterpret_cast<char*>(new_event.get());
+      char* new_addr = reinterpret_cast<char*>(new_event);
       memcpy(new_addr + new_offset, old_addr + old_offset, sample_size);
 
-      events_[i] = std::move(new_event);
-      event = events_[i].get();
+      events_[i] = new_event;
+      event = events_[i];
+      event_arena_.Recycle(old_event, old_alloc_size);
     } else if (size_change < 0) {
       // Move the perf sample data to its new location.
       // Since source and dest could overlap, use memmove instead of memcpy.
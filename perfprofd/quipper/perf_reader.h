@@ -67,15 +67,47 @@ struct PerfNodeTopologyMetadata {
   CStringWithLength cpu_list;
 };
 
-struct BufferWithSize;
 struct ConstBufferWithSize;
 
+// Precomputed layout of the fixed-size sample info fields selected by a
+// sample type. Offsets are in u64 words from the start of the sample data of
+// an event, and -1 when a field is absent. With a fixed attr set the layout
+// is static, so it is computed once when the attrs are read and per-event
+// decoding becomes loads from known offsets instead of re-walking the sample
+// type bits.
+struct SampleInfoLayout {
+  SampleInfoLayout()
+      : identifier(-1),
+        ip(-1),
+        tid(-1),
+        time(-1),
+        addr(-1),
+        id(-1),
+        stream_id(-1),
+        cpu(-1),
+        period(-1),
+        num_fixed_words(0) {}
+
+  int identifier;
+  int ip;
+  int tid;
+  int time;
+  int addr;
+  int id;
+  int stream_id;
+  int cpu;
+  int period;
+  // The number of words covered by the fixed-size fields. Variable-size
+  // sample fields start behind them.
+  int num_fixed_words;
+};
+
 class PerfReader {
  public:
   PerfReader() : sample_type_(0),
                  read_format_(0),
                  is_cross_endian_(0) {}
-  ~PerfReader();
+  virtual ~PerfReader();
 
   // Makes |build_id| fit the perf format, by either truncating it or adding
   // zeros to the end so that it has length kBuildIDStringLength.
@@ -92,29 +124,9 @@ class PerfReader {
   bool ReadFromString(const string& str);
   bool ReadFromPointer(const char* perf_data, size_t size);
 
-  // TODO(rohinmshah): GetSize should not use RegenerateHeader (so that it can
-  // be const).  Ideally, RegenerateHeader would be deleted and instead of
-  // having out_header_ as an instance variable, it would be computed
-  // dynamically whenever needed.
-
-  // Returns the size in bytes that would be written by any of the methods that
-  // write the entire perf data file (WriteFile, WriteToPointer, etc).
-  size_t GetSize();
-
-  bool WriteFile(const string& filename);
-  bool WriteToVector(std::vector<char>* data);
-  bool WriteToString(string* str);
-  bool WriteToPointer(char* buffer, size_t size);
-
-  bool RegenerateHeader();
-
-  // Stores the mapping from filenames to build ids in build_id_events_.
-  // Returns true on success.
-  // Note: If |filenames_to_build_ids| contains a mapping for a filename for
-  // which there is already a build_id_event in build_id_events_, a duplicate
-  // build_id_event will be created, and the old build_id_event will NOT be
-  // deleted.
-  bool InjectBuildIDs(const std::map<string, string>& filenames_to_build_ids);
+  // This copy of quipper only reads perf data: perfprofd converts profiles
+  // to its own format instead of rewriting perf.data files. The upstream
+  // write path (WriteFile() and friends) is not included.
 
   // Replaces existing filenames with filenames from |build_ids_to_filenames|
   // by joining on build ids.  If a build id in |build_ids_to_filenames| is not
@@ -136,6 +148,13 @@ class PerfReader {
   void GetFilenamesToBuildIDs(
       std::map<string, string>* filenames_to_build_ids) const;
 
+  // Discards build id events whose filename is not in |used_filenames|,
+  // freeing their storage. Perf records a build id for every module mapped
+  // anywhere on the system, so on a typical device most of them belong to
+  // binaries no sample ever touched; callers that know which modules they
+  // care about can trim the rest before querying GetFilenamesToBuildIDs().
+  void DropUnusedBuildIDs(const std::set<string>& used_filenames);
+
   static bool IsSupportedEventType(uint32_t type);
 
   // If a program using PerfReader calls events(), it could work with the
@@ -157,7 +176,7 @@ class PerfReader {
     return attrs_;
   }
 
-  const std::vector<malloced_unique_ptr<event_t>>& events() const {
+  const std::vector<event_t*>& events() const {
     return events_;
   }
 
@@ -209,36 +228,19 @@ class PerfReader {
   bool ReadPipedData(const ConstBufferWithSize& data);
   bool ReadTracingMetadataEvent(const ConstBufferWithSize& data, size_t offset);
 
-  // Like WriteToPointer, but does not check if the buffer is large enough.
-  bool WriteToPointerWithoutCheckingSize(char* buffer, size_t size);
-
-  bool WriteHeader(const BufferWithSize& data) const;
-  bool WriteAttrs(const BufferWithSize& data) const;
-  bool WriteEventTypes(const BufferWithSize& data) const;
-  bool WriteData(const BufferWithSize& data) const;
-  bool WriteMetadata(const BufferWithSize& data) const;
-
-  // For writing the various types of metadata.
-  bool WriteBuildIDMetadata(u32 type, size_t* offset,
-                            const BufferWithSize& data) const;
-  bool WriteStringMetadata(u32 type, size_t* offset,
-                           const BufferWithSize& data) const;
-  bool WriteUint32Metadata(u32 type, size_t* offset,
-                           const BufferWithSize& data) const;
-  bool WriteUint64Metadata(u32 type, size_t* offset,
-                           const BufferWithSize& data) const;
-  bool WriteEventDescMetadata(u32 type, size_t* offset,
-                              const BufferWithSize& data) const;
-  bool WriteCPUTopologyMetadata(u32 type, size_t* offset,
-                                const BufferWithSize& data) const;
-  bool WriteNUMATopologyMetadata(u32 type, size_t* offset,
-                                 const BufferWithSize& data) const;
-
   // For reading event blocks within piped perf data.
   bool ReadAttrEventBlock(const ConstBufferWithSize& data, size_t offset,
                           size_t size);
   bool ReadPerfEventBlock(const event_t& event);
 
+  // Handles an event read from the data section. The event was allocated
+  // from |event_arena_| with |alloc_size| bytes. The default implementation
+  // stores the event in |events_|. Derived classes can override this to
+  // consume events one at a time without buffering the whole data section in
+  // memory; overriders not keeping the event should return it with
+  // event_arena_.Recycle() so it can be reused.
+  virtual bool OnPerfEventRead(event_t* event, size_t alloc_size);
+
   // Returns the number of types of metadata stored.
   size_t GetNumMetadata() const;
 
@@ -261,7 +263,11 @@ class PerfReader {
 
   std::vector<PerfFileAttr> attrs_;
   std::vector<perf_trace_event_type> event_types_;
-  std::vector<malloced_unique_ptr<event_t>> events_;
+  // Backing storage for the events in |events_|. Allocating events from slabs
+  // instead of malloc keeps event iteration cache-linear and avoids per-event
+  // allocator overhead on traces with millions of events.
+  EventArena event_arena_;
+  std::vector<event_t*> events_;
   std::vector<build_id_event*> build_id_events_;
   std::vector<PerfStringMetadata> string_metadata_;
   std::vector<PerfUint32Metadata> uint32_metadata_;
@@ -273,6 +279,13 @@ class PerfReader {
   uint64_t read_format_;
   uint64_t metadata_mask_;
 
+  // Layouts of the fixed-size sample info fields implied by sample_type_,
+  // computed once when the first attr is read. PERF_RECORD_SAMPLE events and
+  // the sample_id struct trailing other events place PERF_SAMPLE_IDENTIFIER
+  // differently, so they need separate layouts.
+  SampleInfoLayout sample_layout_;
+  SampleInfoLayout sample_id_layout_;
+
   // Indicates that the perf data being read is from machine with a different
   // endianness than the current machine.
   bool is_cross_endian_;
@@ -286,7 +299,6 @@ class PerfReader {
     struct perf_file_header header_;
     struct perf_pipe_file_header piped_header_;
   };
-  struct perf_file_header out_header_;
 
   DISALLOW_COPY_AND_ASSIGN(PerfReader);
 };
@@ -6,7 +6,10 @@
 
 #include "perf_utils.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <cctype>
 #include <cstddef>
@@ -34,6 +37,53 @@ event_t* CallocMemoryForEvent(size_t size) {
   return event;
 }
 
+const size_t EventArena::kSlabSize;
+const size_t EventArena::kMinAllocSize;
+const size_t EventArena::kNumSizeClasses;
+
+EventArena::EventArena() : slab_used_(0) {
+  memset(free_lists_, 0, sizeof(free_lists_));
+}
+
+size_t EventArena::SizeClass(size_t size) const {
+  size_t size_class = 0;
+  while ((kMinAllocSize << size_class) < size) {
+    ++size_class;
+  }
+  CHECK_LT(size_class, kNumSizeClasses);
+  return size_class;
+}
+
+event_t* EventArena::Alloc(size_t size) {
+  size_t size_class = SizeClass(size);
+  size_t alloc_size = kMinAllocSize << size_class;
+  FreeNode* node = free_lists_[size_class];
+  if (node != NULL) {
+    free_lists_[size_class] = node->next;
+    memset(node, 0, alloc_size);
+    return reinterpret_cast<event_t*>(node);
+  }
+  if (slabs_.empty() || slab_used_ + alloc_size > kSlabSize) {
+    // Records never span slabs; a record larger than kSlabSize gets a slab of
+    // its own.
+    size_t slab_size = alloc_size > kSlabSize ? alloc_size : kSlabSize;
+    char* slab = static_cast<char*>(calloc(1, slab_size));
+    CHECK(slab);
+    slabs_.emplace_back(slab);
+    slab_used_ = 0;
+  }
+  char* p = slabs_.back().get() + slab_used_;
+  slab_used_ += alloc_size;
+  return reinterpret_cast<event_t*>(p);
+}
+
+void EventArena::Recycle(event_t* event, size_t size) {
+  size_t size_class = SizeClass(size);
+  FreeNode* node = reinterpret_cast<FreeNode*>(event);
+  node->next = free_lists_[size_class];
+  free_lists_[size_class] = node;
+}
+
 build_id_event* CallocMemoryForBuildID(size_t size) {
   build_id_event* event = reinterpret_cast<build_id_event*>(calloc(1, size));
   CHECK(event);
@@ -174,6 +224,37 @@ bool ReadFileToData(const string& filename, std::vector<char>* data) {
   return true;
 }
 
+MmappedFile::MmappedFile(const string& filename) : data_(NULL), size_(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Failed to open file " << filename;
+    return;
+  }
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) != 0 || statbuf.st_size <= 0 ||
+      !S_ISREG(statbuf.st_mode)) {
+    close(fd);
+    return;
+  }
+  void* mapped = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping outlives the descriptor.
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    LOG(ERROR) << "Failed to mmap file " << filename;
+    return;
+  }
+  data_ = static_cast<char*>(mapped);
+  size_ = statbuf.st_size;
+  // The reader walks the file front to back; let the kernel read ahead
+  // and drop the pages behind it.
+  madvise(mapped, size_, MADV_SEQUENTIAL);
+}
+
+MmappedFile::~MmappedFile() {
+  if (data_ != NULL)
+    munmap(data_, size_);
+}
+
 bool WriteDataToFile(const std::vector<char>& data, const string& filename) {
   std::ofstream out(filename.c_str(), std::ios::binary);
   out.seekp(0, std::ios::beg);
@@ -268,10 +268,11 @@ static void readEncodedProfile(const char *testpoint,
   encodedProfile.ParseFromString(encoded);
 }
 
-static std::string encodedLoadModuleToString(const wireless_android_play_playlog::LoadModule &lm)
+static std::string encodedLoadModuleToString(const wireless_android_play_playlog::AndroidPerfProfile &profile,
+                                             const wireless_android_play_playlog::LoadModule &lm)
 {
   std::stringstream ss;
-  ss << "name: \"" << lm.name() << "\"\n";
+  ss << "name: \"" << profile.string_table(lm.name_index()) << "\"\n";
   if (lm.build_id() != "") {
     ss << "build_id: \"" << lm.build_id() << "\"\n";
   }
@@ -283,6 +284,15 @@ static std::string encodedModuleSamplesToString(const wireless_android_play_play
   std::stringstream ss;
 
   ss << "load_module_id: " << mod.load_module_id() << "\n";
+  // Reconstruct flat samples from the delta-encoded arrays.
+  uint64_t address = 0;
+  for (size_t k = 0; k < mod.address_delta_size(); k++) {
+    address += mod.address_delta(k);
+    ss << "  address_samples {\n";
+    ss << "    address: " << address << "\n";
+    ss << "    count: " << mod.address_delta_count(k) << "\n";
+    ss << "  }\n";
+  }
   for (size_t k = 0; k < mod.address_samples_size(); k++) {
     const auto &sample = mod.address_samples(k);
     ss << "  address_samples {\n";
@@ -569,7 +579,7 @@ TEST_F(PerfProfdTest, BasicRunWithCannedPerf)
 
   // Check a couple of load modules
   { const auto &lm0 = encodedProfile.load_modules(0);
-    std::string act_lm0 = encodedLoadModuleToString(lm0);
+    std::string act_lm0 = encodedLoadModuleToString(encodedProfile, lm0);
     std::string sqact0 = squeezeWhite(act_lm0, "actual for lm 0");
     const std::string expected_lm0 = RAW_RESULT(
         name: "/data/app/com.google.android.apps.plus-1/lib/arm/libcronet.so"
@@ -578,7 +588,7 @@ TEST_F(PerfProfdTest, BasicRunWithCannedPerf)
     EXPECT_STREQ(sqexp0.c_str(), sqact0.c_str());
   }
   { const auto &lm9 = encodedProfile.load_modules(9);
-    std::string act_lm9 = encodedLoadModuleToString(lm9);
+    std::string act_lm9 = encodedLoadModuleToString(encodedProfile, lm9);
     std::string sqact9 = squeezeWhite(act_lm9, "actual for lm 9");
     const std::string expected_lm9 = RAW_RESULT(
         name: "/system/lib/libandroid_runtime.so" build_id: "8164ed7b3a8b8f5a220d027788922510"
@@ -643,7 +653,7 @@ TEST_F(PerfProfdTest, CallchainRunWithCannedPerf)
 
   // Check a couple of load modules
   { const auto &lm0 = encodedProfile.load_modules(0);
-    std::string act_lm0 = encodedLoadModuleToString(lm0);
+    std::string act_lm0 = encodedLoadModuleToString(encodedProfile, lm0);
     std::string sqact0 = squeezeWhite(act_lm0, "actual for lm 0");
     const std::string expected_lm0 = RAW_RESULT(
         name: "/system/bin/dex2oat"
@@ -653,7 +663,7 @@ TEST_F(PerfProfdTest, CallchainRunWithCannedPerf)
     EXPECT_STREQ(sqexp0.c_str(), sqact0.c_str());
   }
   { const auto &lm1 = encodedProfile.load_modules(1);
-    std::string act_lm1 = encodedLoadModuleToString(lm1);
+    std::string act_lm1 = encodedLoadModuleToString(encodedProfile, lm1);
     std::string sqact1 = squeezeWhite(act_lm1, "actual for lm 1");
     const std::string expected_lm1 = RAW_RESULT(
         name: "/system/bin/linker"
@@ -729,8 +739,8 @@ TEST_F(PerfProfdTest, BasicRunWithLivePerf)
       I: random seed set to 12345678
       I: sleep 674 seconds
       I: initiating profile collection
-      I: profile collection complete
       I: sleep 9325 seconds
+      I: profile collection complete
       I: finishing Android Wide Profiling daemon
                                           );
   // check to make sure log excerpt matches
@@ -785,7 +795,6 @@ TEST_F(PerfProfdTest, MultipleRunWithLivePerf)
       I: random seed set to 12345678
       I: sleep 674 seconds
       I: initiating profile collection
-      I: profile collection complete
       I: sleep 9325 seconds
       I: sleep 4974 seconds
       I: initiating profile collection
@@ -795,6 +804,7 @@ TEST_F(PerfProfdTest, MultipleRunWithLivePerf)
       I: initiating profile collection
       I: profile collection complete
       I: sleep 9498 seconds
+      I: profile collection complete
       I: finishing Android Wide Profiling daemon
                                           );
   // check to make sure log excerpt matches
@@ -855,8 +865,8 @@ TEST_F(PerfProfdTest, CallChainRunWithLivePerf)
       I: random seed set to 12345678
       I: sleep 674 seconds
       I: initiating profile collection
-      I: profile collection complete
       I: sleep 9325 seconds
+      I: profile collection complete
       I: finishing Android Wide Profiling daemon
                                           );
   // check to make sure log excerpt matches
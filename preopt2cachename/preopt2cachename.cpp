@@ -112,16 +112,42 @@ static bool SystemBFileToCacheFile(const std::string& file_location,
   return SystemBFilenameToCacheFile(file_location, output_file_location);
 }
 
+// Batch mode: read one preopt-location per line from stdin and write
+// "<preopt-location> <cache-location>" lines to stdout. This lets a caller with
+// many files to translate pay the exec and linker cost once instead of once
+// per file. Files that fail to translate are logged and left out of the
+// output; we still translate the rest and report failure at exit.
+static int TranslateFromStdin() {
+  int result = 0;
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::string file_location = android::base::Trim(line);
+    if (file_location.empty()) {
+      continue;
+    }
+    std::string output_file_location(kDalvikCacheDir);
+    if (!SystemBFileToCacheFile(file_location, output_file_location)) {
+      result = 1;
+      continue;
+    }
+    std::cout << file_location << ' ' << output_file_location << '\n';
+  }
+  return result;
+}
+
 // This program is used to determine where in the /data directory the runtime will search for an
 // odex file if it is unable to find one at the given 'preopt-name' location. This is used to allow
 // us to store these preopted files in the unused system_b partition and copy them out on first
 // boot of the device.
 int main(int argc, char *argv[]) {
   if (argc != 2) {
-    LOG(ERROR) << "usage: preopt2cachename preopt-location";
+    LOG(ERROR) << "usage: preopt2cachename (preopt-location|-)";
     return 2;
   }
   std::string file_location(argv[1]);
+  if (file_location == "-") {
+    return TranslateFromStdin();
+  }
   std::string output_file_location(kDalvikCacheDir);
   if (!SystemBFileToCacheFile(file_location, output_file_location)) {
     return 1;
@@ -26,6 +26,9 @@
 struct map_info {
     pm_map_t *map;
     pm_memusage_t usage;
+    /* pagemap slice for this mapping, freed once the PFNs are collected */
+    uint64_t *pagemap;
+    size_t num_pages;
     /* page counts */
     unsigned long shared_clean;
     unsigned long shared_dirty;
@@ -53,10 +56,12 @@ int main(int argc, char *argv[]) {
     struct map_info **mis = NULL;
     struct map_info *mi;
 
-    /* pagemap information */
-    uint64_t *pagemap; size_t num_pages;
+    /* pagemap information, collected across all maps for batched lookups */
     uint64_t mapentry;
     uint64_t count, flags;
+    uint64_t *pfns = NULL, *entries = NULL, *counts = NULL, *flagsv = NULL;
+    struct map_info **pfn_mis = NULL;
+    size_t total_pages, npfns, kept;
 
     /* totals */
     unsigned long total_shared_clean, total_shared_dirty, total_private_clean, total_private_dirty;
@@ -155,6 +160,8 @@ int main(int argc, char *argv[]) {
     pm_memusage_zero(&total_usage);
     total_shared_clean = total_shared_dirty = total_private_clean = total_private_dirty = 0;
 
+    /* read each map's pagemap slice exactly once */
+    total_pages = 0;
     for (i = 0; i < num_maps; i++) {
         mi = (struct map_info *)calloc(1, sizeof(struct map_info));
         if (!mi) {
@@ -163,72 +170,152 @@ int main(int argc, char *argv[]) {
         }
 
         mi->map = maps[i];
+        pm_memusage_zero(&mi->usage);
 
-        /* get, and sum, memory usage */
-
-        if (ws == WS_ONLY)
-            error = pm_map_workingset(mi->map, &mi->usage);
-        else
-            error = pm_map_usage(mi->map, &mi->usage);
+        error = pm_map_pagemap(mi->map, &mi->pagemap, &mi->num_pages);
         if (error) {
             fflush(stdout);
-            fprintf(stderr, "error getting usage for map.\n");
+            fprintf(stderr, "error getting pagemap for map.\n");
+            free(mi);
             continue;
         }
 
-        pm_memusage_add(&total_usage, &mi->usage);
+        total_pages += mi->num_pages;
 
-        /* get, and sum, individual page counts */
+        /* add to array */
+        mis[i] = mi;
+    }
 
-        error = pm_map_pagemap(mi->map, &pagemap, &num_pages);
-        if (error) {
-            fflush(stdout);
-            fprintf(stderr, "error getting pagemap for map.\n");
+    /* collect the PFNs that need the kernel files, remembering which map
+     * each one came from, and account the entries that don't need them */
+    if (total_pages) {
+        pfns = (uint64_t *)malloc(total_pages * sizeof(uint64_t));
+        entries = (uint64_t *)malloc(total_pages * sizeof(uint64_t));
+        pfn_mis = (struct map_info **)malloc(total_pages * sizeof(struct map_info *));
+        if (!pfns || !entries || !pfn_mis) {
+            fprintf(stderr, "error allocating pfn arrays: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    npfns = 0;
+    for (i = 0; i < num_maps; i++) {
+        mi = mis[i];
+        if (!mi)
             continue;
+
+        for (j = 0; j < mi->num_pages; j++) {
+            mapentry = mi->pagemap[j];
+
+            if (ws == WS_ONLY) {
+                /* the working set filter needs the flags of every entry */
+                pfns[npfns] = PM_PAGEMAP_PFN(mapentry);
+                entries[npfns] = mapentry;
+                pfn_mis[npfns] = mi;
+                npfns++;
+            } else {
+                mi->usage.vss += pagesize;
+                if (PM_PAGEMAP_SWAPPED(mapentry)) {
+                    mi->usage.swap += pagesize;
+                } else if (PM_PAGEMAP_PRESENT(mapentry)) {
+                    pfns[npfns] = PM_PAGEMAP_PFN(mapentry);
+                    entries[npfns] = mapentry;
+                    pfn_mis[npfns] = mi;
+                    npfns++;
+                }
+            }
+        }
+
+        free(mi->pagemap);
+        mi->pagemap = NULL;
+    }
+
+    /* one flags sweep and one count sweep over the whole process */
+    if (npfns) {
+        flagsv = (uint64_t *)malloc(npfns * sizeof(uint64_t));
+        counts = (uint64_t *)malloc(npfns * sizeof(uint64_t));
+        if (!flagsv || !counts) {
+            fprintf(stderr, "error allocating count arrays: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
         }
+    }
+
+    error = pm_kernel_flags_batch(ker, pfns, npfns, flagsv);
+    if (error) {
+        fprintf(stderr, "error getting flags for frames.\n");
+        exit(EXIT_FAILURE);
+    }
 
-        mi->shared_clean = mi->shared_dirty = mi->private_clean = mi->private_dirty = 0;
+    if (ws == WS_ONLY) {
+        /* keep only the referenced entries; swapped entries count toward
+         * VSS but carry no PFN worth looking up */
+        kept = 0;
+        for (i = 0; i < npfns; i++) {
+            if (!(flagsv[i] & KPF_REFERENCED))
+                continue;
+
+            pfn_mis[i]->usage.vss += pagesize;
+            if (PM_PAGEMAP_SWAPPED(entries[i]))
+                continue;
+
+            pfns[kept] = pfns[i];
+            entries[kept] = entries[i];
+            flagsv[kept] = flagsv[i];
+            pfn_mis[kept] = pfn_mis[i];
+            kept++;
+        }
+        npfns = kept;
+    }
 
-        for (j = 0; j < num_pages; j++) {
-            mapentry = pagemap[j];
+    error = pm_kernel_count_batch(ker, pfns, npfns, counts);
+    if (error) {
+        fprintf(stderr, "error getting counts for frames.\n");
+        exit(EXIT_FAILURE);
+    }
 
-            if (PM_PAGEMAP_PRESENT(mapentry) && !PM_PAGEMAP_SWAPPED(mapentry)) {
+    /* bin the results back into the map each page belongs to */
+    for (i = 0; i < npfns; i++) {
+        mi = pfn_mis[i];
+        count = counts[i];
+        flags = flagsv[i];
 
-                error = pm_kernel_count(ker, PM_PAGEMAP_PFN(mapentry), &count);
-                if (error) {
-                    fflush(stdout);
-                    fprintf(stderr, "error getting count for frame.\n");
-                }
+        mi->usage.rss += (count >= 1) ? pagesize : 0;
+        mi->usage.pss += (count >= 1) ? pagesize / count : 0;
+        mi->usage.uss += (count == 1) ? pagesize : 0;
 
-                error = pm_kernel_flags(ker, PM_PAGEMAP_PFN(mapentry), &flags);
-                if (error) {
-                    fflush(stdout);
-                    fprintf(stderr, "error getting flags for frame.\n");
-                }
+        if ((ws == WS_ONLY) && !PM_PAGEMAP_PRESENT(entries[i]))
+            continue;
 
-                if ((ws != WS_ONLY) || (flags & KPF_REFERENCED)) {
-                    if (count > 1) {
-                        if (flags & KPF_DIRTY)
-                            mi->shared_dirty++;
-                        else
-                            mi->shared_clean++;
-                    } else {
-                        if (flags & KPF_DIRTY)
-                            mi->private_dirty++;
-                        else
-                            mi->private_clean++;
-                    }
-                }
-            }
+        if (count > 1) {
+            if (flags & KPF_DIRTY)
+                mi->shared_dirty++;
+            else
+                mi->shared_clean++;
+        } else {
+            if (flags & KPF_DIRTY)
+                mi->private_dirty++;
+            else
+                mi->private_clean++;
         }
+    }
+
+    free(counts);
+    free(flagsv);
+    free(pfn_mis);
+    free(entries);
+    free(pfns);
+
+    /* sum per-map results into the totals */
+    for (i = 0; i < num_maps; i++) {
+        mi = mis[i];
+        if (!mi)
+            continue;
 
+        pm_memusage_add(&total_usage, &mi->usage);
         total_shared_clean += mi->shared_clean;
         total_shared_dirty += mi->shared_dirty;
         total_private_clean += mi->private_clean;
         total_private_dirty += mi->private_dirty;
-
-        /* add to array */
-        mis[i] = mi;
     }
 
     /* sort the array, if requested (compfn == NULL for original order) */
@@ -24,6 +24,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -184,7 +186,6 @@ static uint64_t get_zram_mem_used() {
 
 int main(int argc, char *argv[]) {
     pm_kernel_t *ker;
-    pm_process_t *proc;
     pid_t *pids;
     size_t num_procs;
     uint64_t total_pss;
@@ -199,13 +200,14 @@ int main(int argc, char *argv[]) {
     uint64_t flags_mask = 0;
 
     int arg;
-    size_t i;
 
     enum {
         WS_OFF,
         WS_ONLY,
         WS_RESET,
+        WS_INTERVAL,
     } ws;
+    int ws_window = 0;
 
     uint64_t mem[MEMINFO_COUNT] = { };
     pm_proportional_swap_t *p_swap;
@@ -229,6 +231,15 @@ int main(int argc, char *argv[]) {
         if (!strcmp(argv[arg], "-k")) { required_flags = flags_mask = KPF_KSM; continue; }
         if (!strcmp(argv[arg], "-w")) { ws = WS_ONLY; continue; }
         if (!strcmp(argv[arg], "-W")) { ws = WS_RESET; continue; }
+        if (!strcmp(argv[arg], "-i")) {
+            if (arg + 1 >= argc || (ws_window = atoi(argv[++arg])) <= 0) {
+                fprintf(stderr, "-i requires a window in seconds.\n");
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            ws = WS_INTERVAL;
+            continue;
+        }
         if (!strcmp(argv[arg], "-R")) { order *= -1; continue; }
         if (!strcmp(argv[arg], "-h")) { usage(argv[0]); exit(0); }
         fprintf(stderr, "Invalid argument \"%s\".\n", argv[arg]);
@@ -253,41 +264,96 @@ int main(int argc, char *argv[]) {
     }
 
     std::vector<proc_info> procs(num_procs);
-    for (i = 0; i < num_procs; i++) {
-        procs[i].pid = pids[i];
-        procs[i].oomadj = getoomadj(pids[i]);
-        pm_memusage_zero(&procs[i].usage);
-        pm_memusage_pswap_init_handle(&procs[i].usage, p_swap);
-        error = pm_process_create(ker, pids[i], &proc);
-        if (error) {
-            fprintf(stderr, "warning: could not create process interface for %d\n", pids[i]);
-            continue;
-        }
+    std::atomic<size_t> next_proc(0);
+    std::atomic<bool> saw_swap(false);
+
+    /* Processes are scanned concurrently: each worker claims the next
+     * unscanned pid and fills in its slot of procs.  Per-process pagemap
+     * state is independent, and the shared kpagecount/kpageflags reads
+     * and the pswap handle are thread-safe in libpagemap. */
+    auto scan_worker = [&]() {
+        pm_process_t *proc;
+        int scan_error;
+
+        for (size_t n = next_proc.fetch_add(1); n < num_procs;
+                n = next_proc.fetch_add(1)) {
+            procs[n].pid = pids[n];
+            procs[n].oomadj = getoomadj(pids[n]);
+            pm_memusage_zero(&procs[n].usage);
+            pm_memusage_pswap_init_handle(&procs[n].usage, p_swap);
+            scan_error = pm_process_create(ker, pids[n], &proc);
+            if (scan_error) {
+                fprintf(stderr, "warning: could not create process interface for %d\n", pids[n]);
+                continue;
+            }
 
-        switch (ws) {
-        case WS_OFF:
-            error = pm_process_usage_flags(proc, &procs[i].usage, flags_mask,
-                                           required_flags);
-            break;
-        case WS_ONLY:
-            error = pm_process_workingset(proc, &procs[i].usage, 0);
-            break;
-        case WS_RESET:
-            error = pm_process_workingset(proc, NULL, 1);
-            break;
+            switch (ws) {
+            case WS_OFF:
+                scan_error = pm_process_usage_flags(proc, &procs[n].usage, flags_mask,
+                                                    required_flags);
+                break;
+            case WS_ONLY:
+            case WS_INTERVAL:
+                scan_error = pm_process_workingset(proc, &procs[n].usage, 0);
+                break;
+            case WS_RESET:
+                scan_error = pm_process_workingset(proc, NULL, 1);
+                break;
+            }
+
+            if (scan_error) {
+                fprintf(stderr, "warning: could not read usage for %d\n", pids[n]);
+            }
+
+            if (ws != WS_RESET && procs[n].usage.swap) {
+                saw_swap = true;
+            }
+
+            pm_process_destroy(proc);
         }
+    };
 
-        if (error) {
-            fprintf(stderr, "warning: could not read usage for %d\n", pids[i]);
+    auto run_scan = [&]() {
+        size_t num_threads = std::thread::hardware_concurrency();
+        if (num_threads < 1) {
+            num_threads = 1;
+        }
+        if (num_threads > num_procs) {
+            num_threads = num_procs;
         }
 
-        if (ws != WS_RESET && procs[i].usage.swap) {
-            has_swap = true;
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < num_threads; t++) {
+            workers.emplace_back(scan_worker);
         }
+        scan_worker();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    };
+
+    if (ws == WS_INTERVAL) {
+        /* Clear everyone's referenced bits, let the window elapse, then
+         * report what was touched in between, as if -W, a sleep and -w
+         * had been run as one command. */
+        ws = WS_RESET;
+        run_scan();
+        sleep(ws_window);
 
-        pm_process_destroy(proc);
+        free(pids);
+        error = pm_kernel_pids(ker, &pids, &num_procs);
+        if (error) {
+            fprintf(stderr, "Error listing processes.\n");
+            exit(EXIT_FAILURE);
+        }
+        procs.resize(num_procs);
+        next_proc = 0;
+        ws = WS_ONLY;
     }
 
+    run_scan();
+    has_swap = saw_swap;
+
     free(pids);
 
     if (ws == WS_RESET) exit(0);
@@ -515,6 +581,8 @@ static void usage(char *myname) {
                     "    -k  Only show pages collapsed by KSM\n"
                     "    -w  Display statistics for working set only.\n"
                     "    -W  Reset working set of all processes.\n"
+                    "    -i N  Reset working sets, wait N seconds, then display\n"
+                    "          the working set touched during the window.\n"
                     "    -o  Show and sort by oom score against lowmemorykiller thresholds.\n"
                     "    -h  Display this help screen.\n",
     myname);
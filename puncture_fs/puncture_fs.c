@@ -18,6 +18,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <linux/falloc.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,8 +42,10 @@ typedef unsigned long u64;
 
 static void usage(const char * const progname) {
     fprintf(stderr,
-            "Usage: %s [-s <seed>] -h <hole size in bytes> -t <total hole size in bytes> "
-            "path\n",
+            "Usage: %s [-s <seed>] [-j <threads>] -h <hole size in bytes> "
+            "-t <total hole size in bytes> path\n"
+            "    -j punches precomputed holes with FALLOC_FL_PUNCH_HOLE in "
+            "parallel\n    instead of interleaving and deleting filler files\n",
             progname);
 }
 
@@ -199,22 +203,186 @@ static bool puncture_fs (const char * const path, const u64 total_size,
     return true;
 }
 
+/*
+ * Batch engine: instead of interleaving filler files and deleting half of
+ * them (two O_SYNC writes per hole), each worker thread writes one large
+ * file and then punches its share of the holes with
+ * FALLOC_FL_PUNCH_HOLE. The hole layout is precomputed up front on the
+ * main thread (random() is not thread safe) with one randomized hole per
+ * stride, so offsets are naturally sorted and the punches walk each file
+ * front to back.
+ */
+static void batch_file_path(char * const out, const char * const dir_path,
+                            const u64 id) {
+    sprintf(out, "%s/file_%lu", dir_path, id);
+}
+
+typedef struct {
+    char file_path[FILENAME_MAX];
+    u64 size;
+    u64 hole_size;
+    u64 *holes;
+    u64 nr_holes;
+    const char *base;
+    bool ok;
+} batch_file_t;
+
+static u64 batch_files_done;
+static u64 batch_nr_files;
+
+static void *batch_worker(void *arg) {
+    batch_file_t *bf = (batch_file_t *)arg;
+    u64 length = 0;
+    u64 i;
+    int fd;
+
+    bf->ok = true;
+    fd = open(bf->file_path, O_WRONLY | O_CREAT, 0777);
+    if (fd < 0) {
+        if (errno != ENOSPC) {
+            fprintf(stderr, "\nerrno: %d. Failed to create %s\n", errno,
+                    bf->file_path);
+        }
+        bf->ok = false;
+        return NULL;
+    }
+    while (length < bf->size) {
+        u64 chunk = min(bf->size - length, (u64)MAX_IO_WRITE_CHUNK_SIZE);
+        if (write(fd, bf->base, chunk) < 0) {
+            if (errno != ENOSPC) {
+                fprintf(stderr, "\nerrno: %d. Failed to write %lu bytes to %s\n",
+                        errno, chunk, bf->file_path);
+            }
+            bf->ok = false;
+            goto done;
+        }
+        length += chunk;
+    }
+    // One flush instead of O_SYNC on every write.
+    if (fsync(fd) < 0) {
+        fprintf(stderr, "\nerrno: %d. Failed to sync %s\n", errno,
+                bf->file_path);
+        bf->ok = false;
+        goto done;
+    }
+    for (i = 0; i < bf->nr_holes; ++i) {
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      bf->holes[i], bf->hole_size) < 0) {
+            fprintf(stderr, "\nerrno: %d. Failed to punch hole at %lu in %s\n",
+                    errno, bf->holes[i], bf->file_path);
+            bf->ok = false;
+            goto done;
+        }
+    }
+done:
+    if (close(fd) < 0) {
+        fprintf(stderr, "\nFailed to close %s\n", bf->file_path);
+        bf->ok = false;
+    }
+    fprintf(stderr, "\rSTAGE 1/1: %d%% Complete",
+            (int) (100 * __sync_add_and_fetch(&batch_files_done, 1) /
+                   batch_nr_files));
+    return NULL;
+}
+
+static bool puncture_fs_batch(const char * const path, const u64 total_size,
+                              const u64 hole_size, const u64 total_hole_size,
+                              const int nr_threads) {
+    char batch_dir[FILENAME_MAX];
+    char *base_file_data;
+    pthread_t *threads;
+    batch_file_t *files;
+    u64 nr_holes = total_hole_size / hole_size;
+    u64 file_size = total_size / nr_threads;
+    u64 i, k;
+    bool ret = true;
+
+    if (!create_unique_dir(batch_dir, path)) {
+        return false;
+    }
+
+    base_file_data = (char*) malloc(MAX_IO_WRITE_CHUNK_SIZE);
+    for (i = 0; i < MAX_IO_WRITE_CHUNK_SIZE; ++i) {
+        base_file_data[i] = get_random_char();
+    }
+    files = (batch_file_t*) calloc(nr_threads, sizeof(batch_file_t));
+    threads = (pthread_t*) calloc(nr_threads, sizeof(pthread_t));
+
+    for (i = 0; i < (u64)nr_threads; ++i) {
+        batch_file_t *bf = &files[i];
+        u64 stride;
+
+        batch_file_path(bf->file_path, batch_dir, i + 1);
+        bf->size = file_size;
+        bf->hole_size = hole_size;
+        bf->base = base_file_data;
+        // Spread the remainder over the first files.
+        bf->nr_holes = nr_holes / nr_threads +
+                (i < nr_holes % nr_threads ? 1 : 0);
+        if (bf->nr_holes == 0) {
+            continue;
+        }
+        bf->holes = (u64*) calloc(bf->nr_holes, sizeof(u64));
+        // One hole at a random offset inside each stride keeps the holes
+        // disjoint and already sorted.
+        stride = bf->size / bf->nr_holes;
+        for (k = 0; k < bf->nr_holes; ++k) {
+            bf->holes[k] = k * stride +
+                    get_random_num(0, stride - hole_size + 1);
+        }
+    }
+
+    batch_files_done = 0;
+    batch_nr_files = nr_threads;
+    fprintf(stderr, "\n\rSTAGE 1/1: 0%% Complete");
+    for (i = 0; i < (u64)nr_threads; ++i) {
+        if (pthread_create(&threads[i], NULL, batch_worker, &files[i]) != 0) {
+            fprintf(stderr, "\nerrno: %d. Failed to create worker %lu\n",
+                    errno, i);
+            files[i].ok = false;
+            threads[i] = 0;
+            ret = false;
+        }
+    }
+    for (i = 0; i < (u64)nr_threads; ++i) {
+        if (threads[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        ret = ret && files[i].ok;
+        free(files[i].holes);
+    }
+    fprintf(stderr, "\n");
+
+    free(threads);
+    free(files);
+    free(base_file_data);
+    return ret;
+}
+
 int main (const int argc, char ** const argv) {
     int opt;
     int mandatory_opt;
     char *path = NULL;
     int seed = time(NULL);
+    int nr_threads = 0;
 
     u64 total_size = 0;
     u64 hole_size = 0;
     u64 total_hole_size = 0;
 
     mandatory_opt = 2;
-    while ((opt = getopt(argc, argv, "s:h:t:")) != -1) {
+    while ((opt = getopt(argc, argv, "s:j:h:t:")) != -1) {
         switch(opt) {
             case 's':
                 seed = atoi(optarg);
                 break;
+            case 'j':
+                nr_threads = atoi(optarg);
+                if (nr_threads <= 0) {
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'h':
                 hole_size = atoll(optarg);
                 mandatory_opt--;
@@ -259,7 +427,12 @@ int main (const int argc, char ** const argv) {
         exit(EXIT_FAILURE);
     }
 
-    if (!puncture_fs(path, total_size, hole_size, total_hole_size)) {
+    if (nr_threads > 0) {
+        if (!puncture_fs_batch(path, total_size, hole_size, total_hole_size,
+                               nr_threads)) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (!puncture_fs(path, total_size, hole_size, total_hole_size)) {
         exit(EXIT_FAILURE);
     }
     return 0;
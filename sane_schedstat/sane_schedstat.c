@@ -23,12 +23,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <fcntl.h>
 
-#define MAX_CPU 2
+#define MAX_CPU 8
+#define MAX_DOMAIN 4
+/* log2 buckets: [0], [1], [2,4), [4,8), ... */
+#define HIST_BUCKETS 16
+#define DEFAULT_RING_SIZE 128
+#define DEFAULT_INTERVAL_MS 1000
 
 struct cpu_stat {
     /* sched_yield() stats */
@@ -51,10 +58,60 @@ struct cpu_stat {
     unsigned long pcount;  /* number of tasks (not necessarily unique) given */
 };
 
+/* sched-domain load balancer counters, summed over the three idle types */
+struct domain_stat {
+    unsigned int lb_count;
+    unsigned int lb_balanced;
+    unsigned int lb_failed;
+    unsigned int lb_imbalance;
+};
+
+enum {
+    HIST_LB_COUNT,
+    HIST_LB_BALANCED,
+    HIST_LB_FAILED,
+    HIST_LB_IMBALANCE,
+    HIST_KINDS
+};
+
+static const char *hist_kind_name[HIST_KINDS] = {
+    "lb_count", "lb_balanced", "lb_failed", "lb_imbalance"
+};
+
+struct sample {
+    struct timeval tv;
+    struct cpu_stat delta[MAX_CPU];
+};
+
 struct cpu_stat cpu_prev[MAX_CPU];
 struct cpu_stat cpu_delta[MAX_CPU];
 struct cpu_stat tmp;
 
+struct domain_stat domain_prev[MAX_CPU][MAX_DOMAIN];
+unsigned int domain_hist[MAX_CPU][MAX_DOMAIN][HIST_KINDS][HIST_BUCKETS];
+
+static int daemon_mode;
+static int first_sample = 1;
+static int num_cpus;
+static int num_domains;
+static unsigned int interval_ms = DEFAULT_INTERVAL_MS;
+static unsigned int sample_count;
+
+static struct sample *ring;
+static unsigned int ring_size = DEFAULT_RING_SIZE;
+static unsigned int ring_next;
+
+static volatile sig_atomic_t dump_requested;
+static volatile sig_atomic_t quit_requested;
+
+static void sig_dump(int sig) {
+    dump_requested = 1;
+}
+
+static void sig_quit(int sig) {
+    quit_requested = 1;
+}
+
 static const char *next_line(const char *b) {
     while (1) {
         switch (*b) {
@@ -70,7 +127,7 @@ static int print() {
     int i;
 
     printf("CPU  yield() schedule() switch idle   ttwu() local  cpu_time wait_time timeslices\n");
-    for (i=0; i<MAX_CPU; i++) {
+    for (i=0; i<num_cpus; i++) {
         printf(" %2d  %7u %10u %6u %4u %8u %5u %9llu %9llu %10lu\n",
             i,
             cpu_delta[i].yld_count,
@@ -81,6 +138,65 @@ static int print() {
     return 0;
 }
 
+static int hist_bucket(unsigned int delta) {
+    int bucket = 0;
+
+    while (delta) {
+        bucket++;
+        delta >>= 1;
+    }
+    if (bucket >= HIST_BUCKETS)
+        bucket = HIST_BUCKETS - 1;
+    return bucket;
+}
+
+/* Parse a "domainN <cpumask> ..." line belonging to cpu and bucket the
+   per-interval deltas of its balance counters into the histograms.
+   v15 has 8 load_balance() counters for each of the three idle types,
+   of which we keep the first four, followed by active balance and
+   wakeup counters we ignore. */
+static int parse_domain_v15(const char *b, int cpu) {
+    struct domain_stat cur, *prev;
+    unsigned int f[8];
+    char mask[64];
+    const char *p;
+    int domain, it, i, pos;
+
+    if (sscanf(b, "domain%d %63s%n", &domain, mask, &pos) != 2) {
+        printf("Could not parse %s\n", b);
+        return -1;
+    }
+    if (domain < 0 || domain >= MAX_DOMAIN || cpu < 0 || cpu >= MAX_CPU)
+        return 0;
+    if (domain >= num_domains)
+        num_domains = domain + 1;
+
+    memset(&cur, 0, sizeof(cur));
+    p = b + pos;
+    for (it = 0; it < 3; it++) {
+        for (i = 0; i < 8; i++)
+            f[i] = strtoul(p, (char **)&p, 10);
+        cur.lb_count += f[0];
+        cur.lb_balanced += f[1];
+        cur.lb_failed += f[2];
+        cur.lb_imbalance += f[3];
+    }
+
+    prev = &domain_prev[cpu][domain];
+    if (!first_sample) {
+        domain_hist[cpu][domain][HIST_LB_COUNT]
+            [hist_bucket(cur.lb_count - prev->lb_count)]++;
+        domain_hist[cpu][domain][HIST_LB_BALANCED]
+            [hist_bucket(cur.lb_balanced - prev->lb_balanced)]++;
+        domain_hist[cpu][domain][HIST_LB_FAILED]
+            [hist_bucket(cur.lb_failed - prev->lb_failed)]++;
+        domain_hist[cpu][domain][HIST_LB_IMBALANCE]
+            [hist_bucket(cur.lb_imbalance - prev->lb_imbalance)]++;
+    }
+    *prev = cur;
+    return 0;
+}
+
 static int parse_cpu_v15(const char *b) {
     int cpu;
 
@@ -92,6 +208,10 @@ static int parse_cpu_v15(const char *b) {
         printf("Could not parse %s\n", b);
         return -1;
     }
+    if (cpu < 0 || cpu >= MAX_CPU)
+        return cpu;
+    if (cpu >= num_cpus)
+        num_cpus = cpu + 1;
 
     cpu_delta[cpu].yld_count = tmp.yld_count - cpu_prev[cpu].yld_count;
     cpu_delta[cpu].sched_switch = tmp.sched_switch - cpu_prev[cpu].sched_switch;
@@ -104,13 +224,14 @@ static int parse_cpu_v15(const char *b) {
     cpu_delta[cpu].pcount = tmp.pcount - cpu_prev[cpu].pcount;
 
     cpu_prev[cpu] = tmp;
-    return 0;
+    return cpu;
 }
 
 
 static int parse(const char *b) {
     unsigned int version;
     unsigned long long ts;
+    int cur_cpu = -1;
 
     if (sscanf(b, "version %u\n", &version) != 1) {
         printf("Could not parse version\n");
@@ -127,7 +248,10 @@ static int parse(const char *b) {
             b = next_line(b);
             if (!b) break;
             if (b[0] == 'c') {
-                if (parse_cpu_v15(b)) return -1;
+                cur_cpu = parse_cpu_v15(b);
+                if (cur_cpu < 0) return -1;
+            } else if (b[0] == 'd' && daemon_mode) {
+                if (parse_domain_v15(b, cur_cpu)) return -1;
             }
         }
         break;
@@ -138,20 +262,129 @@ static int parse(const char *b) {
     return 0;
 }
 
+/* Store the current deltas in the ring so a dump can show the recent
+   per-cpu history leading up to it. */
+static void ring_store(void) {
+    struct sample *s = &ring[ring_next];
+
+    gettimeofday(&s->tv, NULL);
+    memcpy(s->delta, cpu_delta, sizeof(s->delta));
+    ring_next = (ring_next + 1) % ring_size;
+    if (sample_count < (unsigned int)-1)
+        sample_count++;
+}
+
+static void dump_state(void) {
+    unsigned int n, idx, start;
+    int cpu, domain, kind, b;
+
+    printf("=== sane_schedstat: %u samples at %u ms ===\n",
+        sample_count, interval_ms);
+
+    printf("\nPer-domain balance counter deltas per interval "
+        "(log2 buckets: 0 1 2 4 8 ...)\n");
+    for (cpu = 0; cpu < num_cpus; cpu++) {
+        for (domain = 0; domain < num_domains; domain++) {
+            for (kind = 0; kind < HIST_KINDS; kind++) {
+                printf("cpu%d domain%d %-12s", cpu, domain,
+                    hist_kind_name[kind]);
+                for (b = 0; b < HIST_BUCKETS; b++)
+                    printf(" %u", domain_hist[cpu][domain][kind][b]);
+                printf("\n");
+            }
+        }
+    }
+
+    n = sample_count < ring_size ? sample_count : ring_size;
+    start = (ring_next + ring_size - n) % ring_size;
+    printf("\nLast %u samples\n", n);
+    for (idx = 0; idx < n; idx++) {
+        struct sample *s = &ring[(start + idx) % ring_size];
+
+        printf("%ld.%06ld\n", (long)s->tv.tv_sec, (long)s->tv.tv_usec);
+        memcpy(cpu_delta, s->delta, sizeof(cpu_delta));
+        print();
+    }
+    fflush(stdout);
+}
+
+static void usage(void) {
+    printf("Usage: sane_schedstat [-D] [-i interval_ms] [-r ring_size]\n"
+        "    -D    Daemon mode: sample quietly, dump the sched-domain\n"
+        "          histograms and recent samples on SIGUSR1 or exit\n"
+        "    -i ms Sampling interval in milliseconds (default %u)\n"
+        "    -r n  Samples kept for the dump (default %u)\n",
+        DEFAULT_INTERVAL_MS, DEFAULT_RING_SIZE);
+}
+
 int main(int argc, char **argv) {
     int i;
     int fd;
+    int opt;
     char buf[4096];
 
+    while ((opt = getopt(argc, argv, "Di:r:h")) != -1) {
+        switch (opt) {
+        case 'D':
+            daemon_mode = 1;
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            if (!interval_ms) {
+                usage();
+                return -1;
+            }
+            break;
+        case 'r':
+            ring_size = atoi(optarg);
+            if (!ring_size) {
+                usage();
+                return -1;
+            }
+            break;
+        case 'h':
+        default:
+            usage();
+            return opt != 'h';
+        }
+    }
+
+    if (daemon_mode) {
+        /* Everything is allocated up front; the sampling loop itself
+           does no allocation or logging. */
+        ring = calloc(ring_size, sizeof(struct sample));
+        if (!ring) return -1;
+        signal(SIGUSR1, sig_dump);
+        signal(SIGINT, sig_quit);
+        signal(SIGTERM, sig_quit);
+    }
+
     while (1) {
         fd = open("/proc/schedstat", O_RDONLY);
         if (fd < 0) return -1;
         i = read(fd, buf, sizeof(buf) - 1);
         close(fd);
+        if (i < 0) return -1;
         buf[i] = '\0';
         if (parse(buf)) return -1;
-        print();
-        sleep(1);
+        if (daemon_mode) {
+            if (!first_sample)
+                ring_store();
+            first_sample = 0;
+            if (dump_requested) {
+                dump_requested = 0;
+                dump_state();
+            }
+            if (quit_requested) {
+                dump_state();
+                break;
+            }
+            usleep(interval_ms * 1000);
+        } else {
+            print();
+            sleep(1);
+        }
     }
+    free(ring);
     return 0;
 }
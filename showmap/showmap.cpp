@@ -30,6 +30,128 @@ static bool terse = false;
 static bool addresses = false;
 static bool quiet = false;
 
+// mapinfo records live in a chain of reusable fixed-size blocks, so
+// repeat mode parses without a single allocation once the blocks exist
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arena_block {
+    arena_block *next;
+    size_t used;
+    char data[ARENA_BLOCK_SIZE];
+};
+
+static arena_block *arena_head = NULL;
+static arena_block *arena_tail = NULL;
+static arena_block *arena_current = NULL;
+
+static void arena_reset() {
+    for (arena_block *block = arena_head; block; block = block->next) {
+        block->used = 0;
+    }
+    arena_current = arena_head;
+}
+
+static void *arena_alloc(size_t len) {
+    len = (len + 7) & ~(size_t)7;
+
+    while (arena_current && arena_current->used + len > ARENA_BLOCK_SIZE) {
+        arena_current = arena_current->next;
+    }
+    if (!arena_current) {
+        arena_block *block = reinterpret_cast<arena_block*>(malloc(sizeof(arena_block)));
+        if (block == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        block->next = NULL;
+        block->used = 0;
+        if (arena_tail) {
+            arena_tail->next = block;
+        } else {
+            arena_head = block;
+        }
+        arena_tail = block;
+        arena_current = block;
+    }
+
+    void *p = arena_current->data + arena_current->used;
+    arena_current->used += len;
+    return p;
+}
+
+// Buffered smaps reader: lines are handed out in place from one fixed
+// buffer, with no stdio locking or per-line copies.
+struct line_reader {
+    int fd;
+    size_t len;
+    size_t pos;
+    bool eof;
+    char buf[64 * 1024];
+};
+
+static char *next_line(line_reader *lr) {
+    for (;;) {
+        char *nl = reinterpret_cast<char*>(
+                memchr(lr->buf + lr->pos, '\n', lr->len - lr->pos));
+        if (nl) {
+            char *line = lr->buf + lr->pos;
+            *nl = 0;
+            lr->pos = nl + 1 - lr->buf;
+            return line;
+        }
+
+        // move the partial line to the front and refill
+        memmove(lr->buf, lr->buf + lr->pos, lr->len - lr->pos);
+        lr->len -= lr->pos;
+        lr->pos = 0;
+
+        if (lr->eof || lr->len >= sizeof(lr->buf) - 1) {
+            // final line without a newline, or a line longer than the
+            // whole buffer; hand out what we have
+            if (lr->len == 0) {
+                return NULL;
+            }
+            lr->buf[lr->len] = 0;
+            lr->pos = lr->len;
+            return lr->buf;
+        }
+
+        ssize_t r = TEMP_FAILURE_RETRY(
+                read(lr->fd, lr->buf + lr->len, sizeof(lr->buf) - 1 - lr->len));
+        if (r < 0) {
+            return NULL;
+        } else if (r == 0) {
+            lr->eof = true;
+        } else {
+            lr->len += r;
+        }
+    }
+}
+
+// scan an unsigned hex number; returns the first unconsumed character,
+// or NULL if there were no hex digits
+static const char *scan_hex(const char *p, unsigned long *out) {
+    const char *start = p;
+    unsigned long v = 0;
+
+    for (;; p++) {
+        if (*p >= '0' && *p <= '9') {
+            v = v * 16 + (*p - '0');
+        } else if (*p >= 'a' && *p <= 'f') {
+            v = v * 16 + (*p - 'a' + 10);
+        } else if (*p >= 'A' && *p <= 'F') {
+            v = v * 16 + (*p - 'A' + 10);
+        } else {
+            break;
+        }
+    }
+    if (p == start) {
+        return NULL;
+    }
+    *out = v;
+    return p;
+}
+
 static int is_library(const char *name) {
     int len = strlen(name);
     return len >= 4 && name[0] == '/'
@@ -43,39 +165,51 @@ static int is_library(const char *name) {
 static int parse_header(const char* line, const mapinfo* prev, mapinfo** mi) {
     unsigned long start;
     unsigned long end;
-    char name[128];
-    int name_pos;
+    const char *name;
+    const char *p = line;
     int is_bss = 0;
 
-    if (sscanf(line, "%lx-%lx %*s %*x %*x:%*x %*d%n", &start, &end, &name_pos) != 2) {
+    p = scan_hex(p, &start);
+    if (!p || *p != '-') {
+        *mi = NULL;
+        return -1;
+    }
+    p = scan_hex(p + 1, &end);
+    if (!p || *p != ' ') {
         *mi = NULL;
         return -1;
     }
 
-    while (isspace(line[name_pos])) {
-        name_pos += 1;
+    // skip the perms, offset, dev and inode fields
+    for (int field = 0; field < 4; field++) {
+        while (*p == ' ') p++;
+        if (!*p) {
+            *mi = NULL;
+            return -1;
+        }
+        while (*p && *p != ' ') p++;
+    }
+    while (isspace(*p)) {
+        p++;
     }
 
-    if (line[name_pos]) {
-        strlcpy(name, line + name_pos, sizeof(name));
+    if (*p) {
+        name = p;
     } else {
         if (prev && start == prev->end && is_library(prev->name)) {
             // anonymous mappings immediately adjacent to shared libraries
             // usually correspond to the library BSS segment, so we use the
             // library's own name
-            strlcpy(name, prev->name, sizeof(name));
+            name = prev->name;
             is_bss = 1;
         } else {
-            strlcpy(name, "[anon]", sizeof(name));
+            name = "[anon]";
         }
     }
 
     const int name_size = strlen(name) + 1;
-    struct mapinfo* info = reinterpret_cast<mapinfo*>(calloc(1, sizeof(mapinfo) + name_size));
-    if (info == NULL) {
-        fprintf(stderr, "out of memory\n");
-        exit(1);
-    }
+    struct mapinfo* info = reinterpret_cast<mapinfo*>(arena_alloc(sizeof(mapinfo) + name_size));
+    memset(info, 0, sizeof(mapinfo));
 
     info->start = start;
     info->end = end;
@@ -88,34 +222,54 @@ static int parse_header(const char* line, const mapinfo* prev, mapinfo** mi) {
 }
 
 static int parse_field(mapinfo* mi, const char* line) {
-    char field[64];
-    int len;
-
-    if (sscanf(line, "%63s %n", field, &len) == 1
-            && *field && field[strlen(field) - 1] == ':') {
-        int size;
-        if (sscanf(line + len, "%d kB", &size) == 1) {
-            if (!strcmp(field, "Size:")) {
-                mi->size = size;
-            } else if (!strcmp(field, "Rss:")) {
-                mi->rss = size;
-            } else if (!strcmp(field, "Pss:")) {
-                mi->pss = size;
-            } else if (!strcmp(field, "Shared_Clean:")) {
-                mi->shared_clean = size;
-            } else if (!strcmp(field, "Shared_Dirty:")) {
-                mi->shared_dirty = size;
-            } else if (!strcmp(field, "Private_Clean:")) {
-                mi->private_clean = size;
-            } else if (!strcmp(field, "Private_Dirty:")) {
-                mi->private_dirty = size;
-            } else if (!strcmp(field, "Swap:")) {
-                mi->swap = size;
-            }
+    const char *p = line;
+    unsigned *target = NULL;
+
+    while (*p && *p != ' ' && *p != '\t') {
+        p++;
+    }
+    if (p == line || p[-1] != ':') {
+        return -1;
+    }
+
+    switch (p - line) {
+    case 4:
+        if (!memcmp(line, "Rss:", 4)) target = &mi->rss;
+        else if (!memcmp(line, "Pss:", 4)) target = &mi->pss;
+        break;
+    case 5:
+        if (!memcmp(line, "Size:", 5)) target = &mi->size;
+        else if (!memcmp(line, "Swap:", 5)) target = &mi->swap;
+        break;
+    case 13:
+        if (!memcmp(line, "Shared_Clean:", 13)) target = &mi->shared_clean;
+        else if (!memcmp(line, "Shared_Dirty:", 13)) target = &mi->shared_dirty;
+        break;
+    case 14:
+        if (!memcmp(line, "Private_Clean:", 14)) target = &mi->private_clean;
+        else if (!memcmp(line, "Private_Dirty:", 14)) target = &mi->private_dirty;
+        break;
+    }
+
+    if (target) {
+        unsigned size = 0;
+        bool have_digits = false;
+
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            size = size * 10 + (*p - '0');
+            have_digits = true;
+            p++;
+        }
+        if (have_digits) {
+            *target = size;
         }
-        return 0;
     }
-    return -1;
+
+    // any "Field:" line is consumed, known or not
+    return 0;
 }
 
 static int order_before(const mapinfo *a, const mapinfo *b, int sort_by_address) {
@@ -147,7 +301,7 @@ static void enqueue_map(mapinfo **head, mapinfo *map, int sort_by_address, int c
             current->swap += map->swap;
             current->is_bss &= map->is_bss;
             current->count++;
-            free(map);
+            // map stays in the arena until the next reset
             break;
         }
 
@@ -169,25 +323,24 @@ static void enqueue_map(mapinfo **head, mapinfo *map, int sort_by_address, int c
 static mapinfo *load_maps(int pid, int sort_by_address, int coalesce_by_name)
 {
     char fn[128];
-    FILE *fp;
-    char line[1024];
     mapinfo *head = NULL;
     mapinfo *current = NULL;
-    int len;
+    char *line;
+    static line_reader reader;
+
+    arena_reset();
 
     snprintf(fn, sizeof(fn), "/proc/%d/smaps", pid);
-    fp = fopen(fn, "r");
-    if (fp == 0) {
+    reader.fd = open(fn, O_RDONLY | O_CLOEXEC);
+    if (reader.fd < 0) {
         if (!quiet) fprintf(stderr, "cannot open /proc/%d/smaps: %s\n", pid, strerror(errno));
         return NULL;
     }
+    reader.len = 0;
+    reader.pos = 0;
+    reader.eof = false;
 
-    while (fgets(line, sizeof(line), fp) != 0) {
-        len = strlen(line);
-        if (line[len - 1] == '\n') {
-            line[--len] = 0;
-        }
-
+    while ((line = next_line(&reader)) != NULL) {
         if (current != NULL && !parse_field(current, line)) {
             continue;
         }
@@ -204,7 +357,7 @@ static mapinfo *load_maps(int pid, int sort_by_address, int coalesce_by_name)
 
     enqueue_map(&head, current, sort_by_address, coalesce_by_name);
 
-    fclose(fp);
+    close(reader.fd);
 
     if (!head) {
         if (!quiet) fprintf(stderr, "could not read /proc/%d/smaps\n", pid);
@@ -272,8 +425,6 @@ static int show_map(int pid)
     print_divider();
 
     for (mapinfo *mi = milist; mi;) {
-        mapinfo* last = mi;
-
         total.shared_clean += mi->shared_clean;
         total.shared_dirty += mi->shared_dirty;
         total.private_clean += mi->private_clean;
@@ -293,7 +444,6 @@ static int show_map(int pid)
 
 out:
         mi = mi->next;
-        free(last);
     }
 
     print_divider();
@@ -311,6 +461,7 @@ int main(int argc, char *argv[])
     int usage = 1;
     int result = 0;
     int pid;
+    int repeat = 1;
     char *arg;
     char *argend;
 
@@ -333,6 +484,19 @@ int main(int argc, char *argv[])
             quiet = true;
             continue;
         }
+        if (!strcmp(arg,"-r")) {
+            if (argc < 2) {
+                fprintf(stderr, "missing argument to -r\n");
+                break;
+            }
+            argc--, argv++;
+            repeat = strtol(argv[0], &argend, 10);
+            if (!*argv[0] || *argend || repeat < 1) {
+                fprintf(stderr, "invalid repeat count: %s\n", argv[0]);
+                break;
+            }
+            continue;
+        }
         if (argc != 1) {
             fprintf(stderr, "too many arguments\n");
             break;
@@ -340,8 +504,14 @@ int main(int argc, char *argv[])
         pid = strtol(arg, &argend, 10);
         if (*arg && !*argend) {
             usage = 0;
-            if (show_map(pid)) {
-                result = 1;
+            for (int iter = 0; iter < repeat; iter++) {
+                if (iter) {
+                    sleep(1);
+                    printf("\n");
+                }
+                if (show_map(pid)) {
+                    result = 1;
+                }
             }
             break;
         }
@@ -356,6 +526,8 @@ int main(int argc, char *argv[])
                 "        -v = verbose (don't coalesce maps with the same name)\n"
                 "        -a = addresses (show virtual memory map)\n"
                 "        -q = quiet (don't show error if map could not be read)\n"
+                "        -r N = repeat the dump N times, one second apart,\n"
+                "               reusing parse buffers across iterations\n"
                 );
         result = 1;
     }
@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <limits.h>
+#include <time.h>
 
 #define STRINGIFY_ARG(a)        #a
 #define STRINGIFY(a)            STRINGIFY_ARG(a)
@@ -267,30 +268,243 @@ static sort_t set_sort_func(char key)
 	}
 }
 
+/*
+ * Delta-monitoring mode: caches are tracked in a hash-indexed table that
+ * is allocated as caches are first seen, so the steady-state sampling
+ * loop does no allocation at all.  Each sample updates the per-cache
+ * deltas and reports the fastest growing caches.
+ */
+
+#define SLAB_HASH_SIZE	128
+
+struct slab_track {
+	char name[SLABINFO_NAME_LEN + 1];	/* name of this cache */
+	struct slab_track *hnext;	/* hash chain */
+	unsigned long nr_objs;		/* objects at the last sample */
+	unsigned long nr_pages;		/* cache size in pages */
+	long d_objs;			/* change since the previous sample */
+	long d_pages;
+	unsigned int last_seen;		/* sample the cache last appeared in */
+};
+
+static struct slab_track *slab_hash[SLAB_HASH_SIZE];
+static struct slab_track **track_table;	/* all entries, for sorting */
+static unsigned int nr_tracked;
+
+/* sample records appended to the binary log: one header, then one entry
+ * per cache present in the sample */
+struct slab_log_header {
+	unsigned long ts;		/* seconds since the epoch */
+	unsigned int nr_caches;
+};
+
+struct slab_log_entry {
+	char name[SLABINFO_NAME_LEN + 1];
+	unsigned long nr_objs;
+	unsigned long nr_pages;
+};
+
+static unsigned int hash_name(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char) *name++;
+	return hash % SLAB_HASH_SIZE;
+}
+
+static struct slab_track *track_lookup(const char *name)
+{
+	unsigned int hash = hash_name(name);
+	struct slab_track *t;
+
+	for (t = slab_hash[hash]; t; t = t->hnext)
+		if (strcmp(t->name, name) == 0)
+			return t;
+
+	t = calloc(1, sizeof (struct slab_track));
+	if (!t) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(t->name, name);
+	t->hnext = slab_hash[hash];
+	slab_hash[hash] = t;
+
+	nr_tracked++;
+	track_table = realloc(track_table,
+			      nr_tracked * sizeof (struct slab_track *));
+	if (!track_table) {
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+	track_table[nr_tracked - 1] = t;
+	return t;
+}
+
+/*
+ * monitor_sample - parse slabinfo into the track table, updating the
+ * per-cache deltas, and append the raw values to the binary log if one
+ * was requested.  Returns zero on success.
+ */
+static int monitor_sample(unsigned int sample, FILE *logfile)
+{
+	FILE *slabfile;
+	char line[SLABINFO_LINE_LEN];
+	char name[SLABINFO_NAME_LEN + 1];
+	unsigned int major, minor, i;
+
+	slabfile = fopen(SLABINFO_FILE, "r");
+	if (!slabfile) {
+		perror("fopen");
+		return -1;
+	}
+
+	if (!fgets(line, SLABINFO_LINE_LEN, slabfile) ||
+	    sscanf(line, "slabinfo - version: %u.%u", &major, &minor) != 2 ||
+	    major != 2 || minor > 1) {
+		fprintf(stderr, "we only support slabinfo 2.0 and 2.1!\n");
+		fclose(slabfile);
+		return -1;
+	}
+
+	while (fgets(line, SLABINFO_LINE_LEN, slabfile)) {
+		unsigned long nr_active_objs, nr_objs, obj_size;
+		unsigned long objs_per_slab, pages_per_slab;
+		unsigned long nr_active_slabs, nr_slabs;
+		struct slab_track *t;
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%" STRINGIFY(SLABINFO_NAME_LEN) "s"
+			   " %lu %lu %lu %lu %lu : tunables %*d %*d %*d : \
+			   slabdata %lu %lu %*d", name,
+			   &nr_active_objs, &nr_objs,
+			   &obj_size, &objs_per_slab,
+			   &pages_per_slab,
+			   &nr_active_slabs,
+			   &nr_slabs) != 8) {
+			fprintf(stderr, "unrecognizable data in slabinfo!\n");
+			fclose(slabfile);
+			return -1;
+		}
+
+		t = track_lookup(name);
+		t->d_objs = (long) nr_objs - (long) t->nr_objs;
+		t->d_pages = (long) (nr_slabs * pages_per_slab) -
+			     (long) t->nr_pages;
+		t->nr_objs = nr_objs;
+		t->nr_pages = nr_slabs * pages_per_slab;
+		t->last_seen = sample;
+	}
+
+	if (fclose(slabfile))
+		perror("fclose");
+
+	if (logfile) {
+		struct slab_log_header hdr;
+		struct slab_log_entry entry;
+
+		hdr.ts = (unsigned long) time(NULL);
+		hdr.nr_caches = 0;
+		for (i = 0; i < nr_tracked; i++)
+			if (track_table[i]->last_seen == sample)
+				hdr.nr_caches++;
+		if (fwrite(&hdr, sizeof (hdr), 1, logfile) != 1) {
+			perror("fwrite");
+			return -1;
+		}
+		for (i = 0; i < nr_tracked; i++) {
+			struct slab_track *t = track_table[i];
+
+			if (t->last_seen != sample)
+				continue;
+			memset(&entry, 0, sizeof (entry));
+			strcpy(entry.name, t->name);
+			entry.nr_objs = t->nr_objs;
+			entry.nr_pages = t->nr_pages;
+			if (fwrite(&entry, sizeof (entry), 1, logfile) != 1) {
+				perror("fwrite");
+				return -1;
+			}
+		}
+		fflush(logfile);
+	}
+
+	return 0;
+}
+
+/* growth-rate sort: fastest growing cache (by pages, then objects) first */
+static int delta_cmp(const void *pa, const void *pb)
+{
+	const struct slab_track *a = *(const struct slab_track * const *) pa;
+	const struct slab_track *b = *(const struct slab_track * const *) pb;
+
+	if (a->d_pages != b->d_pages)
+		return (b->d_pages > a->d_pages) ? 1 : -1;
+	if (a->d_objs != b->d_objs)
+		return (b->d_objs > a->d_objs) ? 1 : -1;
+	return strcmp(a->name, b->name);
+}
+
+static void monitor_report(unsigned int sample, unsigned int nr_rows,
+			   unsigned int page_size, unsigned int interval)
+{
+	unsigned int i, rows = 0;
+
+	qsort(track_table, nr_tracked, sizeof (struct slab_track *),
+	      delta_cmp);
+
+	printf("%10s %10s %10s %8s %-23s\n",
+	       "OBJS", "dOBJS", "dCACHE", "K/s", "NAME");
+	for (i = 0; i < nr_tracked && rows < nr_rows; i++) {
+		struct slab_track *t = track_table[i];
+
+		if (t->last_seen != sample)
+			continue;
+		printf("%10lu %+10ld %+9ldK %8.1f %-23s\n",
+		       t->nr_objs, t->d_objs,
+		       t->d_pages * (long) page_size,
+		       (double) (t->d_pages * (long) page_size) / interval,
+		       t->name);
+		rows++;
+	}
+	printf("\n");
+}
+
 int main(int argc, char *argv[])
 {
 	struct slab_info *list, *p;
 	struct slab_stat stats = { .nr_objs = 0 };
 	unsigned int page_size = getpagesize() / 1024, nr_rows = DEF_NR_ROWS, i;
+	unsigned int interval = 0, count = 0;
+	const char *logname = NULL;
+	int arg;
 
 	sort_func = DEF_SORT_FUNC;
 
-	if (argc > 1) {
-		/* FIXME: Ugh. */
-		if (argc == 3 && !strcmp(argv[1], "-n")) {
-			errno = 0;
-			nr_rows = (unsigned int) strtoul(argv[2], NULL, 0);
-			if (errno) {
-				perror("strtoul");
-				exit(EXIT_FAILURE);
-			}
-		}
-		else if (argc == 3 && !strcmp(argv[1], "-s"))
-			sort_func = set_sort_func(argv[2][0]) ? : DEF_SORT_FUNC;
+	for (arg = 1; arg < argc; arg++) {
+		errno = 0;
+		if (!strcmp(argv[arg], "-n") && arg + 1 < argc)
+			nr_rows = (unsigned int) strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-s") && arg + 1 < argc)
+			sort_func = set_sort_func(argv[++arg][0]) ? : DEF_SORT_FUNC;
+		else if (!strcmp(argv[arg], "-d") && arg + 1 < argc)
+			interval = (unsigned int) strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-c") && arg + 1 < argc)
+			count = (unsigned int) strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-o") && arg + 1 < argc)
+			logname = argv[++arg];
 		else {
 			fprintf(stderr, "usage: %s [options]\n\n", argv[0]);
 			fprintf(stderr, "options:\n");
 			fprintf(stderr, "  -s S   specify sort criteria S\n");
+			fprintf(stderr, "  -n N   show N rows\n");
+			fprintf(stderr, "  -d I   monitor mode: sample every I seconds and\n");
+			fprintf(stderr, "         show growth-rate-sorted deltas\n");
+			fprintf(stderr, "  -c N   stop monitoring after N samples\n");
+			fprintf(stderr, "  -o F   append raw monitor samples to binary log F\n");
 			fprintf(stderr, "  -h     display this help\n\n");
 			fprintf(stderr, "Valid sort criteria:\n");
 			fprintf(stderr, "  a: number of Active objects\n");
@@ -303,6 +517,34 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "  u: cache Utilization\n");
 			exit(EXIT_FAILURE);
 		}
+		if (errno) {
+			perror("strtoul");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (interval) {
+		FILE *logfile = NULL;
+
+		if (logname) {
+			logfile = fopen(logname, "w");
+			if (!logfile) {
+				perror("fopen");
+				exit(EXIT_FAILURE);
+			}
+		}
+		for (i = 0; count == 0 || i < count; i++) {
+			if (i)
+				sleep(interval);
+			if (monitor_sample(i, logfile))
+				exit(EXIT_FAILURE);
+			/* the first sample only establishes the baseline */
+			if (i)
+				monitor_report(i, nr_rows, page_size, interval);
+		}
+		if (logfile)
+			fclose(logfile);
+		return 0;
 	}
 
 	list = get_slabinfo (&stats);
@@ -52,7 +52,6 @@ simpleperf_static_libraries_target := \
   libLLVMCore \
   libLLVMSupport \
   libprotobuf-cpp-lite \
-  libevent \
   libc \
 
 simpleperf_static_libraries_host := \
@@ -76,7 +75,6 @@ simpleperf_static_libraries_host_linux := \
   libbacktrace \
   libunwind \
   libcutils \
-  libevent \
 
 simpleperf_ldlibs_host_linux := -lrt
 
@@ -114,6 +112,7 @@ libsimpleperf_src_files_linux := \
   IOEventLoop.cpp \
   perf_clock.cpp \
   record_file_writer.cpp \
+  record_write_queue.cpp \
   UnixSocket.cpp \
   workload.cpp \
 
@@ -16,55 +16,107 @@
 
 #include "IOEventLoop.h"
 
-#include <event2/event.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include <android-base/logging.h>
 
+enum IOEventType {
+  IOEVENT_FD,
+  IOEVENT_SIGNAL,
+  IOEVENT_TIMER,
+};
+
+struct IOEvent;
+
+// Signal handlers need to find the Event registered for a signal.
+static IOEvent* g_signal_events[NSIG];
+
 struct IOEvent {
   IOEventLoop* loop;
-  event* e;
+  IOEventType type;
+  // fd monitored by epoll. For signal events it is the read end of the
+  // signal pipe, for timer events a timerfd. It is a dup() when the same fd
+  // is registered twice (like both read and write events on a socket), so
+  // each Event has its own fd in the epoll set.
+  int fd;
+  uint32_t events;  // EPOLLIN or EPOLLOUT
   std::function<bool()> callback;
   bool enabled;
+  bool deleted;
+  bool owns_fd;
+  int sig;         // signal number for signal events
+  int signal_wfd;  // write end of the signal pipe
+  struct sigaction old_action;
 
-  IOEvent(IOEventLoop* loop, const std::function<bool()>& callback)
-      : loop(loop), e(nullptr), callback(callback), enabled(false) {}
+  IOEvent(IOEventLoop* loop, IOEventType type,
+          const std::function<bool()>& callback)
+      : loop(loop),
+        type(type),
+        fd(-1),
+        events(0),
+        callback(callback),
+        enabled(false),
+        deleted(false),
+        owns_fd(false),
+        sig(-1),
+        signal_wfd(-1) {
+    memset(&old_action, 0, sizeof(old_action));
+  }
 
   ~IOEvent() {
-    if (e != nullptr) {
-      event_free(e);
+    if (type == IOEVENT_SIGNAL && g_signal_events[sig] == this) {
+      sigaction(sig, &old_action, nullptr);
+      g_signal_events[sig] = nullptr;
+    }
+    if (signal_wfd != -1) {
+      close(signal_wfd);
+    }
+    if (owns_fd && fd != -1) {
+      close(fd);
     }
   }
 };
 
-IOEventLoop::IOEventLoop() : ebase_(nullptr), has_error_(false) {}
+static void SignalHandlerFn(int sig) {
+  int saved_errno = errno;
+  IOEvent* e = g_signal_events[sig];
+  if (e != nullptr) {
+    char c = 0;
+    TEMP_FAILURE_RETRY(write(e->signal_wfd, &c, 1));
+  }
+  errno = saved_errno;
+}
+
+IOEventLoop::IOEventLoop()
+    : epoll_fd_(-1),
+      has_error_(false),
+      exit_loop_(false),
+      in_callbacks_(false),
+      has_deleted_events_(false) {}
 
 IOEventLoop::~IOEventLoop() {
   events_.clear();
-  if (ebase_ != nullptr) {
-    event_base_free(ebase_);
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
   }
 }
 
 bool IOEventLoop::EnsureInit() {
-  if (ebase_ == nullptr) {
-    ebase_ = event_base_new();
-    if (ebase_ == nullptr) {
-      LOG(ERROR) << "failed to call event_base_new()";
+  if (epoll_fd_ == -1) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1) {
+      PLOG(ERROR) << "epoll_create1() failed";
       return false;
     }
   }
   return true;
 }
 
-void IOEventLoop::EventCallbackFn(int, short, void* arg) {
-  IOEvent* e = static_cast<IOEvent*>(arg);
-  if (!e->callback()) {
-    e->loop->has_error_ = true;
-    e->loop->ExitLoop();
-  }
-}
-
 static bool MakeFdNonBlocking(int fd) {
   int flags = fcntl(fd, F_GETFL, 0);
   if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
@@ -79,7 +131,10 @@ IOEventRef IOEventLoop::AddReadEvent(int fd,
   if (!MakeFdNonBlocking(fd)) {
     return nullptr;
   }
-  return AddEvent(fd, EV_READ | EV_PERSIST, nullptr, callback);
+  std::unique_ptr<IOEvent> e(new IOEvent(this, IOEVENT_FD, callback));
+  e->fd = fd;
+  e->events = EPOLLIN;
+  return AddEvent(std::move(e));
 }
 
 IOEventRef IOEventLoop::AddWriteEvent(int fd,
@@ -87,12 +142,47 @@ IOEventRef IOEventLoop::AddWriteEvent(int fd,
   if (!MakeFdNonBlocking(fd)) {
     return nullptr;
   }
-  return AddEvent(fd, EV_WRITE | EV_PERSIST, nullptr, callback);
+  std::unique_ptr<IOEvent> e(new IOEvent(this, IOEVENT_FD, callback));
+  e->fd = fd;
+  e->events = EPOLLOUT;
+  return AddEvent(std::move(e));
 }
 
 bool IOEventLoop::AddSignalEvent(int sig,
                                  const std::function<bool()>& callback) {
-  return AddEvent(sig, EV_SIGNAL | EV_PERSIST, nullptr, callback) != nullptr;
+  if (sig <= 0 || sig >= NSIG) {
+    LOG(ERROR) << "can't add event for signal " << sig;
+    return false;
+  }
+  if (g_signal_events[sig] != nullptr) {
+    LOG(ERROR) << "signal " << sig << " has already been registered";
+    return false;
+  }
+  // The signal handler writes one byte to the pipe for each signal delivery,
+  // and the loop reads the pipe. It works no matter which thread receives
+  // the signal.
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC | O_NONBLOCK) != 0) {
+    PLOG(ERROR) << "pipe2() failed";
+    return false;
+  }
+  std::unique_ptr<IOEvent> e(new IOEvent(this, IOEVENT_SIGNAL, callback));
+  e->fd = pipefd[0];
+  e->events = EPOLLIN;
+  e->owns_fd = true;
+  e->sig = sig;
+  e->signal_wfd = pipefd[1];
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = SignalHandlerFn;
+  act.sa_flags = SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  if (sigaction(sig, &act, &e->old_action) != 0) {
+    PLOG(ERROR) << "sigaction() failed";
+    return false;
+  }
+  g_signal_events[sig] = e.get();
+  return AddEvent(std::move(e)) != nullptr;
 }
 
 bool IOEventLoop::AddSignalEvents(std::vector<int> sigs,
@@ -107,23 +197,50 @@ bool IOEventLoop::AddSignalEvents(std::vector<int> sigs,
 
 bool IOEventLoop::AddPeriodicEvent(timeval duration,
                                    const std::function<bool()>& callback) {
-  return AddEvent(-1, EV_PERSIST, &duration, callback) != nullptr;
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd == -1) {
+    PLOG(ERROR) << "timerfd_create() failed";
+    return false;
+  }
+  std::unique_ptr<IOEvent> e(new IOEvent(this, IOEVENT_TIMER, callback));
+  e->fd = fd;
+  e->events = EPOLLIN;
+  e->owns_fd = true;
+  itimerspec ts;
+  ts.it_interval.tv_sec = duration.tv_sec;
+  ts.it_interval.tv_nsec = duration.tv_usec * 1000;
+  ts.it_value = ts.it_interval;
+  if (timerfd_settime(fd, 0, &ts, nullptr) != 0) {
+    PLOG(ERROR) << "timerfd_settime() failed";
+    return false;
+  }
+  return AddEvent(std::move(e)) != nullptr;
 }
 
-IOEventRef IOEventLoop::AddEvent(int fd_or_sig, short events, timeval* timeout,
-                                 const std::function<bool()>& callback) {
+IOEventRef IOEventLoop::AddEvent(std::unique_ptr<IOEvent> e) {
   if (!EnsureInit()) {
     return nullptr;
   }
-  std::unique_ptr<IOEvent> e(new IOEvent(this, callback));
-  e->e = event_new(ebase_, fd_or_sig, events, EventCallbackFn, e.get());
-  if (e->e == nullptr) {
-    LOG(ERROR) << "event_new() failed";
-    return nullptr;
-  }
-  if (event_add(e->e, timeout) != 0) {
-    LOG(ERROR) << "event_add() failed";
-    return nullptr;
+  epoll_event ev = {};
+  ev.events = e->events;
+  ev.data.ptr = e.get();
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, e->fd, &ev) != 0) {
+    if (errno != EEXIST) {
+      PLOG(ERROR) << "epoll_ctl() failed";
+      return nullptr;
+    }
+    // The fd has been registered for another Event, monitor a dup of it.
+    int fd = dup(e->fd);
+    if (fd == -1) {
+      PLOG(ERROR) << "dup() failed";
+      return nullptr;
+    }
+    e->fd = fd;
+    e->owns_fd = true;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, e->fd, &ev) != 0) {
+      PLOG(ERROR) << "epoll_ctl() failed";
+      return nullptr;
+    }
   }
   e->enabled = true;
   events_.push_back(std::move(e));
@@ -131,28 +248,98 @@ IOEventRef IOEventLoop::AddEvent(int fd_or_sig, short events, timeval* timeout,
 }
 
 bool IOEventLoop::RunLoop() {
-  if (event_base_dispatch(ebase_) == -1) {
-    LOG(ERROR) << "event_base_dispatch() failed";
-    return false;
+  exit_loop_ = false;
+  std::vector<epoll_event> ready_events(64);
+  while (!exit_loop_) {
+    bool has_enabled_events = false;
+    for (auto& e : events_) {
+      if (e->enabled) {
+        has_enabled_events = true;
+        break;
+      }
+    }
+    if (!has_enabled_events) {
+      // Exit when no registered event can happen, as libevent did.
+      break;
+    }
+    int ready = epoll_wait(epoll_fd_, ready_events.data(),
+                           static_cast<int>(ready_events.size()), -1);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "epoll_wait() failed";
+      return false;
+    }
+    // Handle all ready events of one wakeup before polling again, so all
+    // ready fds are drained in one pass.
+    in_callbacks_ = true;
+    for (int i = 0; i < ready && !exit_loop_; ++i) {
+      IOEvent* e = static_cast<IOEvent*>(ready_events[i].data.ptr);
+      if (e->deleted || !e->enabled) {
+        continue;
+      }
+      if (!HandleEvent(e)) {
+        has_error_ = true;
+        exit_loop_ = true;
+      }
+    }
+    in_callbacks_ = false;
+    if (has_deleted_events_) {
+      RemoveDeletedEvents();
+    }
+    if (ready == static_cast<int>(ready_events.size())) {
+      ready_events.resize(ready_events.size() * 2);
+    }
   }
-  if (has_error_) {
-    return false;
+  return !has_error_;
+}
+
+bool IOEventLoop::HandleEvent(IOEvent* e) {
+  if (e->type == IOEVENT_SIGNAL) {
+    // Each byte in the pipe stands for one signal delivery.
+    char buf[64];
+    ssize_t n;
+    while ((n = read(e->fd, buf, sizeof(buf))) > 0) {
+      for (ssize_t i = 0; i < n; ++i) {
+        if (!e->callback()) {
+          return false;
+        }
+        if (e->deleted || !e->enabled || exit_loop_) {
+          return true;
+        }
+      }
+    }
+    if (n == -1 && errno != EAGAIN) {
+      PLOG(ERROR) << "failed to read signal pipe";
+      return false;
+    }
+    return true;
   }
-  return true;
+  if (e->type == IOEVENT_TIMER) {
+    uint64_t expirations;
+    ssize_t n = read(e->fd, &expirations, sizeof(expirations));
+    if (n != sizeof(expirations)) {
+      if (n == -1 && errno == EAGAIN) {
+        return true;
+      }
+      PLOG(ERROR) << "failed to read timerfd";
+      return false;
+    }
+    return e->callback();
+  }
+  return e->callback();
 }
 
 bool IOEventLoop::ExitLoop() {
-  if (event_base_loopbreak(ebase_) == -1) {
-    LOG(ERROR) << "event_base_loopbreak() failed";
-    return false;
-  }
+  exit_loop_ = true;
   return true;
 }
 
 bool IOEventLoop::DisableEvent(IOEventRef ref) {
   if (ref->enabled) {
-    if (event_del(ref->e) != 0) {
-      LOG(ERROR) << "event_del() failed";
+    if (epoll_ctl(ref->loop->epoll_fd_, EPOLL_CTL_DEL, ref->fd, nullptr) != 0) {
+      PLOG(ERROR) << "epoll_ctl() failed";
       return false;
     }
     ref->enabled = false;
@@ -162,8 +349,11 @@ bool IOEventLoop::DisableEvent(IOEventRef ref) {
 
 bool IOEventLoop::EnableEvent(IOEventRef ref) {
   if (!ref->enabled) {
-    if (event_add(ref->e, nullptr) != 0) {
-      LOG(ERROR) << "event_add() failed";
+    epoll_event ev = {};
+    ev.events = ref->events;
+    ev.data.ptr = ref;
+    if (epoll_ctl(ref->loop->epoll_fd_, EPOLL_CTL_ADD, ref->fd, &ev) != 0) {
+      PLOG(ERROR) << "epoll_ctl() failed";
       return false;
     }
     ref->enabled = true;
@@ -174,11 +364,24 @@ bool IOEventLoop::EnableEvent(IOEventRef ref) {
 bool IOEventLoop::DelEvent(IOEventRef ref) {
   DisableEvent(ref);
   IOEventLoop* loop = ref->loop;
-  for (auto it = loop->events_.begin(); it != loop->events_.end(); ++it) {
-    if (it->get() == ref) {
-      loop->events_.erase(it);
-      break;
-    }
+  ref->deleted = true;
+  if (loop->in_callbacks_) {
+    // The current batch of ready events may still refer to ref, free it
+    // after the batch is handled.
+    loop->has_deleted_events_ = true;
+  } else {
+    loop->RemoveDeletedEvents();
   }
   return true;
 }
+
+void IOEventLoop::RemoveDeletedEvents() {
+  for (auto it = events_.begin(); it != events_.end();) {
+    if ((*it)->deleted) {
+      it = events_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  has_deleted_events_ = false;
+}
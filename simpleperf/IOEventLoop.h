@@ -25,11 +25,12 @@
 
 struct IOEvent;
 typedef IOEvent* IOEventRef;
-struct event_base;
 
-// IOEventLoop is a class wrapper of libevent, it monitors events happened,
+// IOEventLoop is an epoll based event loop, it monitors events happened,
 // and calls the corresponding callbacks. Possible events are: file ready to
 // read, file ready to write, signal happens, periodic timer timeout.
+// All fds reported ready by one epoll_wait() call are handled before polling
+// again, so one wakeup drains every ready fd.
 class IOEventLoop {
  public:
   IOEventLoop();
@@ -74,13 +75,18 @@ class IOEventLoop {
 
  private:
   bool EnsureInit();
-  IOEventRef AddEvent(int fd_or_sig, short events, timeval* timeout,
-                      const std::function<bool()>& callback);
-  static void EventCallbackFn(int, short, void*);
+  IOEventRef AddEvent(std::unique_ptr<IOEvent> e);
+  bool HandleEvent(IOEvent* e);
+  void RemoveDeletedEvents();
 
-  event_base* ebase_;
+  int epoll_fd_;
   std::vector<std::unique_ptr<IOEvent>> events_;
   bool has_error_;
+  bool exit_loop_;
+  // True while callbacks of a batch of ready events are running, so
+  // DelEvent() defers freeing an Event the batch may still refer to.
+  bool in_callbacks_;
+  bool has_deleted_events_;
 };
 
 #endif  // SIMPLE_PERF_IOEVENT_LOOP_H_
@@ -16,6 +16,9 @@
 
 #include "InplaceSamplerClient.h"
 
+#include <string.h>
+#include <sys/mman.h>
+
 #include <algorithm>
 
 #include "environment.h"
@@ -23,6 +26,9 @@
 #include "utils.h"
 
 static constexpr uint64_t EVENT_ID_FOR_INPLACE_SAMPLER = ULONG_MAX;
+// Interval of reading samples from the shared ring buffer. The profiled
+// process doesn't notify us of new samples, so poll it.
+static constexpr int DRAIN_SAMPLE_BUFFER_INTERVAL_IN_MS = 25;
 
 std::unique_ptr<InplaceSamplerClient> InplaceSamplerClient::Create(const perf_event_attr& attr,
                                                                    pid_t pid,
@@ -40,7 +46,8 @@ std::unique_ptr<InplaceSamplerClient> InplaceSamplerClient::Create(const perf_ev
 
 InplaceSamplerClient::InplaceSamplerClient(const perf_event_attr& attr, pid_t pid,
                                            const std::set<pid_t>& tids)
-    : attr_(attr), pid_(pid), tids_(tids), got_start_profiling_reply_msg_(false) {
+    : attr_(attr), pid_(pid), tids_(tids), got_start_profiling_reply_msg_(false),
+      sample_buffer_(nullptr) {
   if (attr_.freq) {
     sample_freq_ = attr_.sample_freq;
   } else {
@@ -48,6 +55,12 @@ InplaceSamplerClient::InplaceSamplerClient(const perf_event_attr& attr, pid_t pi
   }
 }
 
+InplaceSamplerClient::~InplaceSamplerClient() {
+  if (sample_buffer_ != nullptr) {
+    munmap(sample_buffer_, sizeof(SampleRingBuffer) + sample_buffer_->size);
+  }
+}
+
 uint64_t InplaceSamplerClient::Id() const {
   return EVENT_ID_FOR_INPLACE_SAMPLER;
 }
@@ -75,12 +88,25 @@ bool InplaceSamplerClient::StartPolling(IOEventLoop& loop,
   auto read_callback = [&](const UnixSocketMessage& msg) {
     return HandleMessage(msg);
   };
-  if (!conn_->PrepareForIO(loop, read_callback, close_callback)) {
+  auto drain_and_close_callback = [this, close_callback]() {
+    // Pick up samples published after the last periodic drain.
+    if (!DrainSampleBuffer()) {
+      return false;
+    }
+    return close_callback();
+  };
+  if (!conn_->PrepareForIO(loop, read_callback, drain_and_close_callback)) {
     return false;
   }
   if (!SendStartProfilingMessage()) {
     return false;
   }
+  timeval drain_tv;
+  drain_tv.tv_sec = DRAIN_SAMPLE_BUFFER_INTERVAL_IN_MS / 1000;
+  drain_tv.tv_usec = DRAIN_SAMPLE_BUFFER_INTERVAL_IN_MS % 1000 * 1000;
+  if (!loop.AddPeriodicEvent(drain_tv, [this]() { return DrainSampleBuffer(); })) {
+    return false;
+  }
   // If the inplace sampler doesn't reply in 3 seconds, report the error.
   timeval tv;
   tv.tv_sec = 3;
@@ -127,7 +153,14 @@ bool InplaceSamplerClient::StopProfiling(IOEventLoop& loop,
   auto read_callback = [&](const UnixSocketMessage& msg) {
     return HandleMessage(msg);
   };
-  if (!conn_->PrepareForIO(loop, read_callback, close_callback)) {
+  auto drain_and_close_callback = [this, close_callback]() {
+    // Pick up samples published after the last periodic drain.
+    if (!DrainSampleBuffer()) {
+      return false;
+    }
+    return close_callback();
+  };
+  if (!conn_->PrepareForIO(loop, read_callback, drain_and_close_callback)) {
     return false;
   }
   // Notify inplace sampler to send buffered data and close the connection.
@@ -183,9 +216,88 @@ bool InplaceSamplerClient::HandleMessage(const UnixSocketMessage& msg) {
     if (!record_callback_(&r)) {
       return false;
     }
+  } else if (msg.type == SAMPLE_BUFFER_INFO) {
+    return HandleSampleBufferMessage(p);
   } else {
     LOG(ERROR) << "Unexpected msg type: " << msg.type;
     return false;
   }
   return true;
 }
+
+bool InplaceSamplerClient::HandleSampleBufferMessage(const char* p) {
+  uint32_t size;
+  MoveFromBinaryFormat(size, p);
+  int fd = conn_->GetReceivedFd();
+  if (fd == -1) {
+    LOG(ERROR) << "SAMPLE_BUFFER_INFO from process " << pid_
+               << " has no fd attached";
+    return false;
+  }
+  void* addr = mmap(nullptr, sizeof(SampleRingBuffer) + size,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    PLOG(ERROR) << "failed to map sample buffer of process " << pid_;
+    return false;
+  }
+  sample_buffer_ = reinterpret_cast<SampleRingBuffer*>(addr);
+  return true;
+}
+
+bool InplaceSamplerClient::DrainSampleBuffer() {
+  if (sample_buffer_ == nullptr) {
+    return true;
+  }
+  SampleRingBuffer* b = sample_buffer_;
+  uint64_t commit_head = __atomic_load_n(&b->commit_head, __ATOMIC_ACQUIRE);
+  uint64_t read_head = b->read_head;  // Only advanced here.
+  if (commit_head == read_head) {
+    return true;
+  }
+  // Copy published records out before advancing read_head, so the profiled
+  // process can't overwrite them while we parse.
+  size_t size = commit_head - read_head;
+  sample_record_buf_.resize(size);
+  size_t pos = read_head & (b->size - 1);
+  if (size <= b->size - pos) {
+    memcpy(sample_record_buf_.data(), b->data + pos, size);
+  } else {
+    size_t len1 = b->size - pos;
+    memcpy(sample_record_buf_.data(), b->data + pos, len1);
+    memcpy(sample_record_buf_.data() + len1, b->data, size - len1);
+  }
+  __atomic_store_n(&b->read_head, commit_head, __ATOMIC_RELEASE);
+  const char* p = sample_record_buf_.data();
+  const char* end = p + size;
+  const uint32_t header_len = sizeof(uint32_t) * 4 + sizeof(uint64_t);
+  while (p < end) {
+    const char* record_start = p;
+    uint32_t len;
+    MoveFromBinaryFormat(len, p);
+    if (len < header_len + sizeof(uint64_t) || record_start + len > end) {
+      LOG(ERROR) << "broken sample record from process " << pid_;
+      return false;
+    }
+    uint64_t time;
+    uint32_t tid;
+    uint32_t period;
+    uint32_t ip_nr;
+    MoveFromBinaryFormat(time, p);
+    MoveFromBinaryFormat(tid, p);
+    MoveFromBinaryFormat(period, p);
+    MoveFromBinaryFormat(ip_nr, p);
+    if (len != header_len + ip_nr * sizeof(uint64_t)) {
+      LOG(ERROR) << "broken sample record from process " << pid_;
+      return false;
+    }
+    std::vector<uint64_t> ips(ip_nr);
+    MoveFromBinaryFormat(ips.data(), ip_nr, p);
+    // Don't know which cpu tid is running on, use cpu 0.
+    SampleRecord r(attr_, Id(), ips[0], pid_, tid, time, 0, period, ips);
+    if (!record_callback_(&r)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -25,10 +25,13 @@
 #include "record.h"
 #include "UnixSocket.h"
 
+struct SampleRingBuffer;
+
 class InplaceSamplerClient {
  public:
   static std::unique_ptr<InplaceSamplerClient> Create(const perf_event_attr& attr, pid_t pid,
                                                       const std::set<pid_t>& tids);
+  ~InplaceSamplerClient();
   uint64_t Id() const;
   bool IsClosed() {
     return conn_->IsClosed();
@@ -42,6 +45,10 @@ class InplaceSamplerClient {
   bool ConnectServer();
   bool SendStartProfilingMessage();
   bool HandleMessage(const UnixSocketMessage& msg);
+  bool HandleSampleBufferMessage(const char* p);
+  // Read samples published in the shared ring buffer, and pass them to
+  // record_callback_.
+  bool DrainSampleBuffer();
 
   const perf_event_attr attr_;
   const pid_t pid_;
@@ -50,6 +57,11 @@ class InplaceSamplerClient {
   std::unique_ptr<UnixSocketConnection> conn_;
   std::function<bool(Record*)> record_callback_;
   bool got_start_profiling_reply_msg_;
+  // Shared ring buffer mapped from the profiled process, used to receive
+  // samples without per-sample socket messages. nullptr if the profiled
+  // process doesn't send one.
+  SampleRingBuffer* sample_buffer_;
+  std::vector<char> sample_record_buf_;
 };
 
 #endif  // SIMPLE_PERF_INPLACE_SAMPLER_CLIENT_H_
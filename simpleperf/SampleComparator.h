@@ -44,12 +44,38 @@ int Compare(const T& a, const T& b) {
     return Compare(sample2->compare_part, sample1->compare_part);         \
   }
 
+// As interned strings (like thread comms) share storage, compare pointers
+// first to skip strcmp() for equal strings.
 #define BUILD_COMPARE_STRING_FUNCTION(function_name, compare_part)  \
   template <typename EntryT>                                        \
   int function_name(const EntryT* sample1, const EntryT* sample2) { \
+    if (sample1->compare_part == sample2->compare_part) {           \
+      return 0;                                                     \
+    }                                                               \
     return strcmp(sample1->compare_part, sample2->compare_part);    \
   }
 
+// The hash functions below hash the same items the compare functions above
+// compare, so samples in a hash container keyed by them can be confirmed
+// equal with IsSameSample(). They hash by value, not by pointer: different
+// symbols may return the same DemangledName(), so pointer hashes would break
+// the hash/compare contract.
+
+#define BUILD_HASH_VALUE_FUNCTION(function_name, hash_part) \
+  template <typename EntryT>                                \
+  size_t function_name(const EntryT* sample) {              \
+    return static_cast<size_t>(sample->hash_part);          \
+  }
+
+#define BUILD_HASH_STRING_FUNCTION(function_name, hash_part) \
+  template <typename EntryT>                                 \
+  size_t function_name(const EntryT* sample) {               \
+    size_t hash = 0;                                         \
+    for (const char* p = sample->hash_part; *p != '\0'; ++p) \
+      hash = hash * 131 + *p;                                \
+    return hash;                                             \
+  }
+
 BUILD_COMPARE_VALUE_FUNCTION(ComparePid, thread->pid);
 BUILD_COMPARE_VALUE_FUNCTION(CompareTid, thread->tid);
 BUILD_COMPARE_VALUE_FUNCTION_REVERSE(CompareSampleCount, sample_count);
@@ -61,6 +87,15 @@ BUILD_COMPARE_STRING_FUNCTION(CompareDsoFrom,
 BUILD_COMPARE_STRING_FUNCTION(CompareSymbolFrom,
                               branch_from.symbol->DemangledName());
 
+BUILD_HASH_VALUE_FUNCTION(HashPid, thread->pid);
+BUILD_HASH_VALUE_FUNCTION(HashTid, thread->tid);
+BUILD_HASH_STRING_FUNCTION(HashComm, thread_comm);
+BUILD_HASH_STRING_FUNCTION(HashDso, map->dso->Path().c_str());
+BUILD_HASH_STRING_FUNCTION(HashSymbol, symbol->DemangledName());
+BUILD_HASH_STRING_FUNCTION(HashDsoFrom, branch_from.map->dso->Path().c_str());
+BUILD_HASH_STRING_FUNCTION(HashSymbolFrom,
+                           branch_from.symbol->DemangledName());
+
 template <typename EntryT>
 int CompareTotalPeriod(const EntryT* sample1, const EntryT* sample2) {
   uint64_t period1 = sample1->period + sample1->accumulated_period;
@@ -75,14 +110,25 @@ template <typename EntryT>
 class SampleComparator {
  public:
   typedef int (*compare_sample_func_t)(const EntryT*, const EntryT*);
+  typedef size_t (*hash_sample_func_t)(const EntryT*);
 
   void AddCompareFunction(compare_sample_func_t func) {
     compare_v_.push_back(func);
   }
 
+  // [hash_func] should hash an item compared by [func], so samples hashing
+  // differently are never the same sample. Hashing only some of the compared
+  // items is fine; it only costs more IsSameSample() calls on collisions.
+  void AddCompareFunction(compare_sample_func_t func,
+                          hash_sample_func_t hash_func) {
+    compare_v_.push_back(func);
+    hash_v_.push_back(hash_func);
+  }
+
   void AddComparator(const SampleComparator<EntryT>& other) {
     compare_v_.insert(compare_v_.end(), other.compare_v_.begin(),
                       other.compare_v_.end());
+    hash_v_.insert(hash_v_.end(), other.hash_v_.begin(), other.hash_v_.end());
   }
 
   bool operator()(const EntryT* sample1, const EntryT* sample2) const {
@@ -104,10 +150,20 @@ class SampleComparator {
     return true;
   }
 
+  size_t Hash(const EntryT* sample) const {
+    size_t hash = 0;
+    for (const auto& func : hash_v_) {
+      size_t h = func(sample);
+      hash ^= h + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+  }
+
   bool empty() const { return compare_v_.empty(); }
 
  private:
   std::vector<compare_sample_func_t> compare_v_;
+  std::vector<hash_sample_func_t> hash_v_;
 };
 
 #endif  // SIMPLE_PERF_SAMPLE_COMPARATOR_H_
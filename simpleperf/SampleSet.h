@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIMPLE_PERF_SAMPLE_SET_H_
+#define SIMPLE_PERF_SAMPLE_SET_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "SampleComparator.h"
+
+// SampleSet is a set of samples merged by a SampleComparator. It is an open
+// addressing hash table keyed by SampleComparator::Hash(), calling the
+// comparator's compare functions only when two samples hash to the same
+// bucket. A std::set keyed by the comparator walks the compare functions on
+// every node of the search path instead, which dominates sample tree building
+// time for reports with many samples. Unlike std::set, iteration order is
+// unspecified; users wanting comparator order should sort GetEntries().
+
+template <typename EntryT>
+class SampleSet {
+ public:
+  explicit SampleSet(const SampleComparator<EntryT>& comparator)
+      : comparator_(comparator), size_(0), buckets_(kInitialBucketCount) {}
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  // Return the sample in the set merged with [sample] by the comparator, or
+  // nullptr if there is none.
+  EntryT* Find(const EntryT* sample) const {
+    size_t hash = comparator_.Hash(sample);
+    for (size_t i = BucketOf(hash);; i = (i + 1) & (buckets_.size() - 1)) {
+      const Bucket& bucket = buckets_[i];
+      if (bucket.sample == nullptr) {
+        return nullptr;
+      }
+      if (bucket.hash == hash && comparator_.IsSameSample(bucket.sample, sample)) {
+        return bucket.sample;
+      }
+    }
+  }
+
+  // Insert [sample] into the set. The caller should make sure Find(sample)
+  // returns nullptr, as SampleSet doesn't merge samples itself.
+  void Insert(EntryT* sample) {
+    if (size_ + 1 > buckets_.size() / 4 * 3) {
+      Rehash(buckets_.size() * 2);
+    }
+    InsertInto(buckets_, sample, comparator_.Hash(sample));
+    ++size_;
+  }
+
+  std::vector<EntryT*> GetEntries() const {
+    std::vector<EntryT*> result;
+    result.reserve(size_);
+    for (const Bucket& bucket : buckets_) {
+      if (bucket.sample != nullptr) {
+        result.push_back(bucket.sample);
+      }
+    }
+    return result;
+  }
+
+  void clear() {
+    size_ = 0;
+    buckets_.assign(kInitialBucketCount, Bucket());
+  }
+
+ private:
+  struct Bucket {
+    EntryT* sample = nullptr;
+    size_t hash = 0;
+  };
+
+  // Bucket counts are powers of two, so BucketOf() can mask instead of
+  // dividing.
+  static constexpr size_t kInitialBucketCount = 16;
+
+  size_t BucketOf(size_t hash) const { return hash & (buckets_.size() - 1); }
+
+  static void InsertInto(std::vector<Bucket>& buckets, EntryT* sample,
+                         size_t hash) {
+    for (size_t i = hash & (buckets.size() - 1);;
+         i = (i + 1) & (buckets.size() - 1)) {
+      if (buckets[i].sample == nullptr) {
+        buckets[i].sample = sample;
+        buckets[i].hash = hash;
+        return;
+      }
+    }
+  }
+
+  void Rehash(size_t new_bucket_count) {
+    std::vector<Bucket> new_buckets(new_bucket_count);
+    for (const Bucket& bucket : buckets_) {
+      if (bucket.sample != nullptr) {
+        InsertInto(new_buckets, bucket.sample, bucket.hash);
+      }
+    }
+    buckets_ = std::move(new_buckets);
+  }
+
+  const SampleComparator<EntryT> comparator_;
+  size_t size_;
+  std::vector<Bucket> buckets_;
+};
+
+#endif  // SIMPLE_PERF_SAMPLE_SET_H_
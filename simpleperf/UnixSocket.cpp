@@ -121,33 +121,37 @@ bool UnixSocketConnection::PrepareForIO(
 }
 
 bool UnixSocketConnection::WriteData() {
-  const char* write_data;
-  size_t write_data_size;
-  if (!GetDataFromSendBuffer(&write_data, &write_data_size)) {
+  iovec iov[2];
+  size_t iov_count;
+  if (!GetDataFromSendBuffer(iov, &iov_count)) {
     return false;
   }
-  if (write_data_size == 0u) {
+  if (iov_count == 0u) {
     return true;
   }
-  // Use MSG_NOSIGNAL to prevent receiving SIGPIPE.
-  ssize_t result =
-      TEMP_FAILURE_RETRY(send(fd_, write_data, write_data_size, MSG_NOSIGNAL));
+  // Send both halves of a wrapped send buffer with one syscall. Use
+  // MSG_NOSIGNAL to prevent receiving SIGPIPE.
+  msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_iov = iov;
+  hdr.msg_iovlen = iov_count;
+  ssize_t result = TEMP_FAILURE_RETRY(sendmsg(fd_, &hdr, MSG_NOSIGNAL));
   if (result >= 0) {
     std::lock_guard<std::mutex> lock(send_buffer_and_write_event_mtx_);
     send_buffer_.CommitData(result);
   } else if (errno != EAGAIN) {
-    PLOG(ERROR) << "send() failed";
+    PLOG(ERROR) << "sendmsg() failed";
     return false;
   }
   return true;
 }
 
-bool UnixSocketConnection::GetDataFromSendBuffer(const char** pdata,
-                                                 size_t* pdata_size) {
+bool UnixSocketConnection::GetDataFromSendBuffer(iovec iov[2],
+                                                 size_t* iov_count) {
   {
     std::lock_guard<std::mutex> lock(send_buffer_and_write_event_mtx_);
-    *pdata_size = send_buffer_.PeekData(pdata);
-    if (*pdata_size != 0u) {
+    *iov_count = send_buffer_.PeekIoVec(iov);
+    if (*iov_count != 0u) {
       return true;
     }
     // The send buffer is empty. If we can receive more messages, just disable
@@ -159,15 +163,76 @@ bool UnixSocketConnection::GetDataFromSendBuffer(const char** pdata,
   return CloseConnection();
 }
 
+bool UnixSocketConnection::SendMessageWithFd(const UnixSocketMessage& message,
+                                             int fd) {
+  uint32_t aligned_len = Align(message.len, UnixSocketMessageAlignment);
+  std::vector<char> data(aligned_len, '\0');
+  memcpy(data.data(), &message, message.len);
+  size_t sent_bytes = 0;
+  while (sent_bytes < aligned_len) {
+    msghdr hdr;
+    iovec iov;
+    char cmsg_buf[CMSG_SPACE(sizeof(int))] = {};
+    memset(&hdr, 0, sizeof(hdr));
+    iov.iov_base = data.data() + sent_bytes;
+    iov.iov_len = aligned_len - sent_bytes;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (sent_bytes == 0) {
+      // Attach the fd to the first byte of the message, so the receiver gets
+      // it before handling the message.
+      hdr.msg_control = cmsg_buf;
+      hdr.msg_controllen = CMSG_LEN(sizeof(int));
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    ssize_t result = TEMP_FAILURE_RETRY(sendmsg(fd_, &hdr, MSG_NOSIGNAL));
+    if (result < 0) {
+      if (errno == EAGAIN) {
+        continue;
+      }
+      PLOG(ERROR) << "sendmsg() failed";
+      return false;
+    }
+    sent_bytes += result;
+  }
+  return true;
+}
+
 bool UnixSocketConnection::ReadData() {
-  ssize_t result =
-      TEMP_FAILURE_RETRY(read(fd_, &read_buffer_[read_buffer_size_],
-                              read_buffer_.size() - read_buffer_size_));
+  msghdr hdr;
+  iovec iov;
+  char cmsg_buf[CMSG_SPACE(sizeof(int))];
+  memset(&hdr, 0, sizeof(hdr));
+  iov.iov_base = &read_buffer_[read_buffer_size_];
+  iov.iov_len = read_buffer_.size() - read_buffer_size_;
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = cmsg_buf;
+  hdr.msg_controllen = sizeof(cmsg_buf);
+  ssize_t result = TEMP_FAILURE_RETRY(recvmsg(fd_, &hdr, 0));
+  if (result > 0) {
+    // Collect fds sent as ancillary data.
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        size_t fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < fd_count; ++i) {
+          int fd;
+          memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+          received_fds_.push(fd);
+        }
+      }
+    }
+  }
   if (result < 0) {
     if (errno == EAGAIN) {
       return true;
     }
-    PLOG(ERROR) << "read() failed";
+    PLOG(ERROR) << "recvmsg() failed";
     return false;
   } else if (result == 0) {
     // The connection is closed, and no need to write pending messages.
@@ -206,17 +271,20 @@ bool UnixSocketConnection::ConsumeDataInReadBuffer() {
 }
 
 bool UnixSocketConnection::CloseConnection() {
-  // Disable read_event and write_event here, so ReadData() and WriteData()
-  // won't be called in the future.
-  if (!IOEventLoop::DisableEvent(read_event_)) {
+  // Delete read_event and write_event here, so ReadData() and WriteData()
+  // won't be called in the future. Deleting instead of disabling also closes
+  // the dup of fd_ that the write event monitors (see IOEventLoop::AddEvent()),
+  // so the other end sees EOF once fd_ is closed below.
+  if (!IOEventLoop::DelEvent(read_event_)) {
     return false;
   }
   {
     std::lock_guard<std::mutex> lock(send_buffer_and_write_event_mtx_);
     no_more_message_ = true;
-    if (!DisableWriteEventWithLock()) {
+    if (!IOEventLoop::DelEvent(write_event_)) {
       return false;
     }
+    write_event_enabled_ = false;
   }
   close(fd_);
   fd_ = -1;
@@ -224,6 +292,10 @@ bool UnixSocketConnection::CloseConnection() {
 }
 
 UnixSocketConnection::~UnixSocketConnection() {
+  while (!received_fds_.empty()) {
+    close(received_fds_.front());
+    received_fds_.pop();
+  }
   if (fd_ != -1) {
     // It only happens when IO operations are not finished properly by
     // CloseConnection(). Don't call CloseConnection() here as the
@@ -17,11 +17,13 @@
 #ifndef SIMPLE_PERF_UNIX_SOCKET_H_
 #define SIMPLE_PERF_UNIX_SOCKET_H_
 
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <queue>
 #include <string>
 #include <vector>
 
@@ -87,6 +89,25 @@ class UnixSocketMessageBuffer {
     return data_.size() - read_head_;
   }
 
+  // Fill [iov] with up to two iovecs covering all valid bytes, two when the
+  // data wraps around the end of the circular buffer. Return the number of
+  // iovecs filled. Unlike PeekData(), this exposes the whole buffer content,
+  // so a wrapped buffer can be drained with one sendmsg() call.
+  size_t PeekIoVec(iovec iov[2]) {
+    if (valid_bytes_ == 0) {
+      return 0;
+    }
+    iov[0].iov_base = &data_[read_head_];
+    if (read_head_ + valid_bytes_ <= data_.size()) {
+      iov[0].iov_len = valid_bytes_;
+      return 1;
+    }
+    iov[0].iov_len = data_.size() - read_head_;
+    iov[1].iov_base = data_.data();
+    iov[1].iov_len = valid_bytes_ - iov[0].iov_len;
+    return 2;
+  }
+
   void CommitData(size_t size) {
     CHECK_GE(valid_bytes_, size);
     read_head_ = (read_head_ + size) % data_.size();
@@ -175,6 +196,24 @@ class UnixSocketConnection {
     return true;
   }
 
+  // Send [message] with [fd] attached as SCM_RIGHTS ancillary data. Unlike
+  // SendMessage(), the message is written to the socket directly, so it can
+  // only be called on the thread running IOEventLoop::RunLoop(), where it
+  // can't interleave with a partially sent message from the send buffer.
+  bool SendMessageWithFd(const UnixSocketMessage& message, int fd);
+
+  // Return a file descriptor received as SCM_RIGHTS ancillary data, or -1 if
+  // there is none. Received fds are returned in the order they were sent, and
+  // the caller becomes responsible for closing them.
+  int GetReceivedFd() {
+    if (received_fds_.empty()) {
+      return -1;
+    }
+    int fd = received_fds_.front();
+    received_fds_.pop();
+    return fd;
+  }
+
   // Thread-safe function.
   // After NoMoreMessage(), the connection will not accept more messages
   // in SendMessage(), and it will be closed after sending existing messages
@@ -212,7 +251,7 @@ class UnixSocketConnection {
 
   // Below functions are only called in the thread running IO operations.
   bool WriteData();
-  bool GetDataFromSendBuffer(const char** pdata, size_t* pdata_size);
+  bool GetDataFromSendBuffer(iovec iov[2], size_t* iov_count);
   bool ReadData();
   bool ConsumeDataInReadBuffer();
   bool CloseConnection();
@@ -225,6 +264,8 @@ class UnixSocketConnection {
   // read_buffer_size_ is the number of valid bytes in read_buffer_.
   std::vector<char> read_buffer_;
   size_t read_buffer_size_;
+  // fds received as ancillary data, not yet claimed by GetReceivedFd().
+  std::queue<int> received_fds_;
   IOEventRef read_event_;
 
   // send_buffer_and_write_event_mtx_ protects following members, which can be
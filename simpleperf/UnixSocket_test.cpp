@@ -205,3 +205,62 @@ TEST(UnixSocket, buffered_message) {
   thread.join();
   ASSERT_TRUE(client_success);
 }
+
+static void ClientToTestFdMessage(const std::string& path, int fd_to_send,
+                                  bool& client_success) {
+  std::unique_ptr<UnixSocketConnection> client =
+      UnixSocketConnection::Connect(path, true);
+  ASSERT_TRUE(client != nullptr);
+  IOEventLoop loop;
+  auto receive_message_callback = [&](const UnixSocketMessage&) {
+    return false;
+  };
+  auto close_connection_callback = [&]() { return loop.ExitLoop(); };
+  ASSERT_TRUE(client->PrepareForIO(loop, receive_message_callback,
+                                   close_connection_callback));
+  UnixSocketMessage msg;
+  msg.len = sizeof(UnixSocketMessage);
+  msg.type = 1;
+  ASSERT_TRUE(client->SendMessageWithFd(msg, fd_to_send));
+  ASSERT_TRUE(client->NoMoreMessage());
+  ASSERT_TRUE(loop.RunLoop());
+  client_success = true;
+}
+
+TEST(UnixSocket, send_message_with_fd) {
+  std::string path = "unix_socket_test_" + std::to_string(getpid());
+  std::unique_ptr<UnixSocketServer> server =
+      UnixSocketServer::Create(path, true);
+  ASSERT_TRUE(server != nullptr);
+  int pipefd[2];
+  ASSERT_EQ(0, pipe(pipefd));
+  ASSERT_EQ(5, write(pipefd[1], "hello", 5));
+  bool client_success = false;
+  std::thread thread(
+      [&]() { ClientToTestFdMessage(path, pipefd[0], client_success); });
+  std::unique_ptr<UnixSocketConnection> conn = server->AcceptConnection();
+  ASSERT_TRUE(conn != nullptr);
+  IOEventLoop loop;
+  int received_fd = -1;
+  auto receive_message_callback = [&](const UnixSocketMessage& msg) {
+    if (msg.len != sizeof(UnixSocketMessage) || msg.type != 1) {
+      return false;
+    }
+    received_fd = conn->GetReceivedFd();
+    return conn->NoMoreMessage();
+  };
+  auto close_connection_callback = [&]() { return loop.ExitLoop(); };
+  ASSERT_TRUE(conn->PrepareForIO(loop, receive_message_callback,
+                                 close_connection_callback));
+  ASSERT_TRUE(loop.RunLoop());
+  thread.join();
+  ASSERT_TRUE(client_success);
+  // The fd received with the message refers to the same pipe.
+  ASSERT_NE(-1, received_fd);
+  char buf[6] = {};
+  ASSERT_EQ(5, read(received_fd, buf, 5));
+  ASSERT_STREQ("hello", buf);
+  close(received_fd);
+  close(pipefd[0]);
+  close(pipefd[1]);
+}
@@ -27,21 +27,119 @@
 
 #include <android-base/logging.h>
 
+// A bump pointer arena backing the nodes and chain arrays of one
+// CallChainRoot. Callgraph trees of big traces have tens of millions of
+// nodes; allocating them from slabs instead of one heap allocation per node
+// and per chain avoids the allocator overhead and the fragmentation, and
+// returns all the memory at once when the tree dies.
+class CallChainArena {
+ public:
+  CallChainArena() : slab_pos_(nullptr), slab_left_(0) {}
+
+  void* Allocate(size_t size) {
+    size = (size + 7) & ~static_cast<size_t>(7);
+    if (size > slab_left_) {
+      size_t slab_size = std::max(static_cast<size_t>(kSlabSize), size);
+      slabs_.emplace_back(new char[slab_size]);
+      slab_pos_ = slabs_.back().get();
+      slab_left_ = slab_size;
+    }
+    void* result = slab_pos_;
+    slab_pos_ += size;
+    slab_left_ -= size;
+    return result;
+  }
+
+ private:
+  static const size_t kSlabSize = 64 * 1024;
+
+  std::vector<std::unique_ptr<char[]>> slabs_;
+  char* slab_pos_;
+  size_t slab_left_;
+};
+
 template <typename EntryT>
 struct CallChainNode {
+  // How many chain entries are stored inline in the node. After splitting,
+  // most nodes hold only one or two entries, so this keeps their chains out
+  // of the arena without growing the node much.
+  static const size_t kInlineChainEntries = 2;
+
+  // The chain of the node. It is filled once when the node is created and
+  // only ever shrunk afterwards, so it needs no growing logic: short chains
+  // live in the node itself, longer ones in an array from the root's arena.
+  class Chain {
+   public:
+    Chain() : data_(inline_entries_), size_(0), capacity_(kInlineChainEntries) {}
+
+    size_t size() const { return size_; }
+    EntryT* front() const { return data_[0]; }
+    EntryT* const* begin() const { return data_; }
+    EntryT* const* end() const { return data_ + size_; }
+    EntryT* operator[](size_t i) const { return data_[i]; }
+
+    void resize(size_t size) {
+      CHECK_LE(size, static_cast<size_t>(size_));
+      size_ = size;
+    }
+
+    // Copy chain[chain_start, chain.size()) into this chain. When the node
+    // is recycled after an eviction, its old array is reused if big enough.
+    template <typename ChainT>
+    void Set(const ChainT& chain, size_t chain_start, CallChainArena* arena) {
+      size_ = chain.size() - chain_start;
+      if (size_ > capacity_) {
+        data_ = static_cast<EntryT**>(arena->Allocate(size_ * sizeof(EntryT*)));
+        capacity_ = size_;
+      }
+      for (uint32_t i = 0; i < size_; ++i) {
+        data_[i] = chain[chain_start + i];
+      }
+    }
+
+   private:
+    EntryT** data_;
+    uint32_t size_;
+    uint32_t capacity_;
+    EntryT* inline_entries_[kInlineChainEntries];
+  };
+
   uint64_t period;
   uint64_t children_period;
-  std::vector<EntryT*> chain;
-  std::vector<std::unique_ptr<CallChainNode>> children;
+  Chain chain;
+  std::vector<CallChainNode*> children;
 };
 
 template <typename EntryT>
 struct CallChainRoot {
   typedef CallChainNode<EntryT> NodeT;
   uint64_t children_period;
-  std::vector<std::unique_ptr<NodeT>> children;
+  std::vector<NodeT*> children;
+
+  CallChainRoot()
+      : children_period(0),
+        node_count_(0),
+        max_node_count_(0),
+        evict_period_threshold_(0) {}
 
-  CallChainRoot() : children_period(0) {}
+  CallChainRoot(CallChainRoot&&) = default;
+
+  ~CallChainRoot() {
+    // The arena releases the storage of the nodes, but their destructors
+    // still must run to free the children vectors they hold.
+    DestroyNodes(children);
+    for (auto* node : free_nodes_) {
+      node->~NodeT();
+    }
+  }
+
+  // Bound the number of nodes kept in the tree. When the limit is exceeded,
+  // cold subtrees with total period below an adaptive threshold are evicted,
+  // and their period is folded into the period of their parent node. It trades
+  // exactness of rarely taken call chains for bounded memory.
+  void SetNodeLimit(size_t max_node_count) {
+    max_node_count_ = max_node_count;
+  }
 
   void AddCallChain(
       const std::vector<EntryT*>& callchain, uint64_t period,
@@ -49,8 +147,8 @@ struct CallChainRoot {
     children_period += period;
     NodeT* p = FindMatchingNode(children, callchain[0], is_same_sample);
     if (p == nullptr) {
-      std::unique_ptr<NodeT> new_node = AllocateNode(callchain, 0, period, 0);
-      children.push_back(std::move(new_node));
+      children.push_back(AllocateNode(callchain, 0, period, 0));
+      CheckNodeLimit();
       return;
     }
     size_t callchain_pos = 0;
@@ -66,6 +164,7 @@ struct CallChainRoot {
       }
       if (callchain_pos == callchain.size()) {
         p->period += period;
+        CheckNodeLimit();
         return;
       }
       p->children_period += period;
@@ -77,18 +176,28 @@ struct CallChainRoot {
           continue;
         }
       }
-      std::unique_ptr<NodeT> new_node =
-          AllocateNode(callchain, callchain_pos, period, 0);
-      p->children.push_back(std::move(new_node));
+      p->children.push_back(AllocateNode(callchain, callchain_pos, period, 0));
       break;
     }
+    CheckNodeLimit();
+  }
+
+  // Add all callchains in [other] into this tree. It is used to combine
+  // callchain trees built separately, like when sample trees are built by
+  // different worker threads.
+  void Merge(const CallChainRoot& other,
+             std::function<bool(const EntryT*, const EntryT*)> is_same_sample) {
+    std::vector<EntryT*> chain;
+    for (auto& child : other.children) {
+      MergeNode(*child, chain, is_same_sample);
+    }
   }
 
   void SortByPeriod() {
-    std::queue<std::vector<std::unique_ptr<NodeT>>*> queue;
+    std::queue<std::vector<NodeT*>*> queue;
     queue.push(&children);
     while (!queue.empty()) {
-      std::vector<std::unique_ptr<NodeT>>* v = queue.front();
+      std::vector<NodeT*>* v = queue.front();
       queue.pop();
       std::sort(v->begin(), v->end(), CallChainRoot::CompareNodeByPeriod);
       for (auto& node : *v) {
@@ -100,12 +209,25 @@ struct CallChainRoot {
   }
 
  private:
+  void MergeNode(
+      const NodeT& node, std::vector<EntryT*>& prefix,
+      std::function<bool(const EntryT*, const EntryT*)> is_same_sample) {
+    prefix.insert(prefix.end(), node.chain.begin(), node.chain.end());
+    if (node.period > 0) {
+      AddCallChain(prefix, node.period, is_same_sample);
+    }
+    for (auto& child : node.children) {
+      MergeNode(*child, prefix, is_same_sample);
+    }
+    prefix.resize(prefix.size() - node.chain.size());
+  }
+
   NodeT* FindMatchingNode(
-      const std::vector<std::unique_ptr<NodeT>>& nodes, const EntryT* sample,
+      const std::vector<NodeT*>& nodes, const EntryT* sample,
       std::function<bool(const EntryT*, const EntryT*)> is_same_sample) {
     for (auto& node : nodes) {
       if (is_same_sample(node->chain.front(), sample)) {
-        return node.get();
+        return node;
       }
     }
     return nullptr;
@@ -125,34 +247,102 @@ struct CallChainRoot {
   }
 
   void SplitNode(NodeT* parent, size_t parent_length) {
-    std::unique_ptr<NodeT> child = AllocateNode(
-        parent->chain, parent_length, parent->period, parent->children_period);
+    NodeT* child = AllocateNode(parent->chain, parent_length, parent->period,
+                                parent->children_period);
     child->children = std::move(parent->children);
     parent->period = 0;
     parent->children_period = child->period + child->children_period;
     parent->chain.resize(parent_length);
     parent->children.clear();
-    parent->children.push_back(std::move(child));
+    parent->children.push_back(child);
   }
 
-  std::unique_ptr<NodeT> AllocateNode(const std::vector<EntryT*>& chain,
-                                      size_t chain_start, uint64_t period,
-                                      uint64_t children_period) {
-    std::unique_ptr<NodeT> node(new NodeT);
-    for (size_t i = chain_start; i < chain.size(); ++i) {
-      node->chain.push_back(chain[i]);
+  template <typename ChainT>
+  NodeT* AllocateNode(const ChainT& chain, size_t chain_start, uint64_t period,
+                      uint64_t children_period) {
+    NodeT* node;
+    if (!free_nodes_.empty()) {
+      node = free_nodes_.back();
+      free_nodes_.pop_back();
+    } else {
+      node = new (arena_.Allocate(sizeof(NodeT))) NodeT;
     }
+    node->chain.Set(chain, chain_start, &arena_);
     node->period = period;
     node->children_period = children_period;
+    node_count_++;
     return node;
   }
 
-  static bool CompareNodeByPeriod(const std::unique_ptr<NodeT>& n1,
-                                  const std::unique_ptr<NodeT>& n2) {
+  void CheckNodeLimit() {
+    if (max_node_count_ == 0 || node_count_ <= max_node_count_) {
+      return;
+    }
+    // Raise the period threshold until enough cold subtrees are evicted, so
+    // eviction doesn't run again for every following call chain.
+    while (node_count_ > max_node_count_ * 3 / 4) {
+      evict_period_threshold_ =
+          std::max(evict_period_threshold_ * 2, static_cast<uint64_t>(1));
+      EvictNodes(children, evict_period_threshold_);
+      if (children.empty()) {
+        break;
+      }
+    }
+  }
+
+  // Remove subtrees in [nodes] whose total period is below [period_threshold],
+  // and return the sum of their periods. The period of a removed subtree is
+  // folded into the period of its parent node, so the total period of the
+  // tree is unchanged. Periods of subtrees removed directly below the root are
+  // dropped, and the root's children_period still reports them, so percentages
+  // of the remaining chains keep their exact values.
+  uint64_t EvictNodes(std::vector<NodeT*>& nodes, uint64_t period_threshold) {
+    uint64_t evicted_period = 0;
+    for (auto it = nodes.begin(); it != nodes.end();) {
+      NodeT* node = *it;
+      if (node->period + node->children_period < period_threshold) {
+        evicted_period += node->period + node->children_period;
+        RecycleNode(node);
+        it = nodes.erase(it);
+      } else {
+        uint64_t folded_period = EvictNodes(node->children, period_threshold);
+        node->period += folded_period;
+        node->children_period -= folded_period;
+        ++it;
+      }
+    }
+    return evicted_period;
+  }
+
+  // Put the nodes of the subtree at [node] on the free list for reuse by
+  // AllocateNode(), as bump allocation can't return them to the arena.
+  void RecycleNode(NodeT* node) {
+    for (auto* child : node->children) {
+      RecycleNode(child);
+    }
+    node->children.clear();
+    free_nodes_.push_back(node);
+    node_count_--;
+  }
+
+  void DestroyNodes(std::vector<NodeT*>& nodes) {
+    for (auto* node : nodes) {
+      DestroyNodes(node->children);
+      node->~NodeT();
+    }
+  }
+
+  static bool CompareNodeByPeriod(const NodeT* n1, const NodeT* n2) {
     uint64_t period1 = n1->period + n1->children_period;
     uint64_t period2 = n2->period + n2->children_period;
     return period1 > period2;
   }
+
+  CallChainArena arena_;
+  std::vector<NodeT*> free_nodes_;
+  size_t node_count_;
+  size_t max_node_count_;
+  uint64_t evict_period_threshold_;
 };
 
 #endif  // SIMPLE_PERF_CALLCHAIN_H_
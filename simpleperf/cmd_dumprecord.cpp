@@ -16,8 +16,10 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <map>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -38,14 +40,25 @@ class DumpRecordCommand : public Command {
   DumpRecordCommand()
       : Command("dump", "dump perf record file",
                 "Usage: simpleperf dumprecord [options] [perf_record_file]\n"
-                "    Dump different parts of a perf record file. Default file is perf.data.\n"),
-        record_filename_("perf.data"), record_file_arch_(GetBuildArch()) {
+                "    Dump different parts of a perf record file. Default file is perf.data.\n"
+                "    --raw            Dump the bytes of records in hex instead of decoding\n"
+                "                     them.\n"
+                "    --time begin,end Only dump records with timestamps in [begin, end) ns.\n"
+                "                     Records without a timestamp are treated as time 0.\n"
+                "    --type type1,type2,...\n"
+                "                     Only dump records of the given types. A type is a name\n"
+                "                     like sample, mmap, lost, comm, or a numeric type value.\n"
+                "                     Other records are skipped using only their headers,\n"
+                "                     without being decoded.\n"),
+        record_filename_("perf.data"), record_file_arch_(GetBuildArch()),
+        dump_raw_(false), time_filter_begin_(0), time_filter_end_(UINT64_MAX) {
   }
 
   bool Run(const std::vector<std::string>& args);
 
  private:
   bool ParseOptions(const std::vector<std::string>& args);
+  bool ParseRecordTypes(const std::string& s);
   void DumpFileHeader();
   void DumpAttrSection();
   void DumpDataSection();
@@ -54,6 +67,10 @@ class DumpRecordCommand : public Command {
   std::string record_filename_;
   std::unique_ptr<RecordFileReader> record_file_reader_;
   ArchType record_file_arch_;
+  bool dump_raw_;
+  uint64_t time_filter_begin_;
+  uint64_t time_filter_end_;
+  std::unordered_set<uint32_t> record_type_filter_;
 };
 
 bool DumpRecordCommand::Run(const std::vector<std::string>& args) {
@@ -81,15 +98,82 @@ bool DumpRecordCommand::Run(const std::vector<std::string>& args) {
 }
 
 bool DumpRecordCommand::ParseOptions(const std::vector<std::string>& args) {
-  if (args.size() == 1) {
-    record_filename_ = args[0];
-  } else if (args.size() > 1) {
-    ReportUnknownOption(args, 1);
+  size_t i;
+  for (i = 0; i < args.size() && !args[i].empty() && args[i][0] == '-'; ++i) {
+    if (args[i] == "--raw") {
+      dump_raw_ = true;
+    } else if (args[i] == "--time") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      char* endptr;
+      time_filter_begin_ = strtoull(args[i].c_str(), &endptr, 0);
+      if (*endptr != ',') {
+        LOG(ERROR) << "Invalid time range: '" << args[i] << "'";
+        return false;
+      }
+      time_filter_end_ = strtoull(endptr + 1, &endptr, 0);
+      if (*endptr != '\0' || time_filter_begin_ >= time_filter_end_) {
+        LOG(ERROR) << "Invalid time range: '" << args[i] << "'";
+        return false;
+      }
+    } else if (args[i] == "--type") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!ParseRecordTypes(args[i])) {
+        return false;
+      }
+    } else {
+      ReportUnknownOption(args, i);
+      return false;
+    }
+  }
+  if (i + 1 == args.size()) {
+    record_filename_ = args[i];
+  } else if (i < args.size()) {
+    ReportUnknownOption(args, i + 1);
     return false;
   }
   return true;
 }
 
+bool DumpRecordCommand::ParseRecordTypes(const std::string& s) {
+  static const std::map<std::string, uint32_t> record_type_map = {
+      {"mmap", PERF_RECORD_MMAP},
+      {"lost", PERF_RECORD_LOST},
+      {"comm", PERF_RECORD_COMM},
+      {"exit", PERF_RECORD_EXIT},
+      {"throttle", PERF_RECORD_THROTTLE},
+      {"unthrottle", PERF_RECORD_UNTHROTTLE},
+      {"fork", PERF_RECORD_FORK},
+      {"read", PERF_RECORD_READ},
+      {"sample", PERF_RECORD_SAMPLE},
+      {"build_id", PERF_RECORD_BUILD_ID},
+      {"mmap2", PERF_RECORD_MMAP2},
+      {"tracing_data", PERF_RECORD_TRACING_DATA},
+      {"kernel_symbol", SIMPLE_PERF_RECORD_KERNEL_SYMBOL},
+      {"dso", SIMPLE_PERF_RECORD_DSO},
+      {"symbol", SIMPLE_PERF_RECORD_SYMBOL},
+      {"event_id", SIMPLE_PERF_RECORD_EVENT_ID},
+  };
+  for (const auto& name : android::base::Split(s, ",")) {
+    auto it = record_type_map.find(name);
+    if (it != record_type_map.end()) {
+      record_type_filter_.insert(it->second);
+      continue;
+    }
+    char* endptr;
+    uint64_t type = strtoull(name.c_str(), &endptr, 0);
+    if (name.empty() || *endptr != '\0' || type > UINT32_MAX) {
+      LOG(ERROR) << "Unknown record type: '" << name << "'";
+      return false;
+    }
+    record_type_filter_.insert(static_cast<uint32_t>(type));
+  }
+  return true;
+}
+
 static const std::string GetFeatureName(int feature);
 
 void DumpRecordCommand::DumpFileHeader() {
@@ -149,6 +233,9 @@ static const std::string GetFeatureName(int feature) {
       {FEAT_PMU_MAPPINGS, "pmu_mappings"},
       {FEAT_GROUP_DESC, "group_desc"},
       {FEAT_FILE, "file"},
+      {FEAT_TRACING_FORMAT_CACHE, "tracing_format_cache"},
+      {FEAT_RECORD_TYPE_INDEX, "record_type_index"},
+      {FEAT_RECORD_TIME_INDEX, "record_time_index"},
   };
   auto it = feature_name_map.find(feature);
   if (it != feature_name_map.end()) {
@@ -174,10 +261,48 @@ void DumpRecordCommand::DumpAttrSection() {
 }
 
 void DumpRecordCommand::DumpDataSection() {
-  record_file_reader_->ReadDataSection([](std::unique_ptr<Record> record) {
-    record->Dump();
-    return true;
-  }, false);
+  if (record_type_filter_.empty() && !dump_raw_ && time_filter_begin_ == 0 &&
+      time_filter_end_ == UINT64_MAX) {
+    record_file_reader_->ReadDataSection([](std::unique_ptr<Record> record) {
+      record->Dump();
+      return true;
+    }, false);
+    return;
+  }
+  auto type_filter = [this](uint32_t type) {
+    return record_type_filter_.empty() ||
+           record_type_filter_.find(type) != record_type_filter_.end();
+  };
+  if (dump_raw_) {
+    record_file_reader_->ReadDataSectionRaw(
+        type_filter, [](uint32_t type, const char* data, size_t size) {
+          printf("record type %u, size %zu:\n", type, size);
+          for (size_t i = 0; i < size; i += 16) {
+            printf(" ");
+            for (size_t j = i; j < std::min(i + 16, size); ++j) {
+              printf(" %02x", static_cast<unsigned char>(data[j]));
+            }
+            printf("\n");
+          }
+          return true;
+        });
+  } else {
+    auto dump_callback = [this](std::unique_ptr<Record> record) {
+      uint64_t time = record->Timestamp();
+      if (time >= time_filter_begin_ && time < time_filter_end_) {
+        record->Dump();
+      }
+      return true;
+    };
+    if (!record_type_filter_.empty()) {
+      // Seeks straight to the filtered types when the file has a record
+      // type index, instead of scanning the whole data section.
+      record_file_reader_->ReadRecordsOfTypes(record_type_filter_,
+                                              dump_callback);
+    } else {
+      record_file_reader_->ReadDataSectionFiltered(type_filter, dump_callback);
+    }
+  }
 }
 
 void DumpRecordCommand::DumpFeatureSection() {
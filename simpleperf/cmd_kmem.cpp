@@ -16,9 +16,12 @@
 
 #include "command.h"
 
+#include <algorithm>
+#include <functional>
 #include <unordered_map>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 
 #include "callchain.h"
@@ -70,6 +73,9 @@ BUILD_COMPARE_VALUE_FUNCTION(CompareGfpFlags, gfp_flags);
 BUILD_COMPARE_VALUE_FUNCTION_REVERSE(CompareCrossCpuAllocations,
                                      cross_cpu_allocations);
 
+BUILD_HASH_VALUE_FUNCTION(HashPtr, ptr);
+BUILD_HASH_VALUE_FUNCTION(HashGfpFlags, gfp_flags);
+
 BUILD_DISPLAY_HEX64_FUNCTION(DisplayPtr, ptr);
 BUILD_DISPLAY_UINT64_FUNCTION(DisplayBytesReq, bytes_req);
 BUILD_DISPLAY_UINT64_FUNCTION(DisplayBytesAlloc, bytes_alloc);
@@ -110,13 +116,135 @@ struct SlabFormat {
   TracingFieldPlace gfp_flags;
 };
 
+// SlabSampleSpiller writes sorted runs of slab samples to files under
+// [path_prefix], and merges the runs back in [comparator] order. It is used
+// to bound report memory when processing long traces. Sample symbols are
+// stored as raw pointers, which is fine because the spill files are only
+// read back in the same process, where the symbols stay alive.
+class SlabSampleSpiller {
+ public:
+  SlabSampleSpiller(const std::string& path_prefix,
+                    const SampleComparator<SlabSample>& comparator)
+      : path_prefix_(path_prefix), comparator_(comparator) {}
+
+  ~SlabSampleSpiller() {
+    for (const auto& path : run_paths_) {
+      remove(path.c_str());
+    }
+  }
+
+  size_t run_count() const { return run_paths_.size(); }
+
+  // Write a run of samples sorted by the comparator.
+  bool WriteRun(const std::vector<SlabSample*>& samples) {
+    std::string path = path_prefix_ + "." + std::to_string(run_paths_.size());
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+      PLOG(ERROR) << "failed to open " << path;
+      return false;
+    }
+    bool result = true;
+    for (auto& sample : samples) {
+      uint64_t buf[7] = {reinterpret_cast<uintptr_t>(sample->symbol),
+                         sample->ptr,
+                         sample->bytes_req,
+                         sample->bytes_alloc,
+                         sample->sample_count,
+                         sample->gfp_flags,
+                         sample->cross_cpu_allocations};
+      if (fwrite(buf, sizeof(buf), 1, fp) != 1) {
+        PLOG(ERROR) << "failed to write " << path;
+        result = false;
+        break;
+      }
+    }
+    if (fclose(fp) != 0 && result) {
+      PLOG(ERROR) << "failed to close " << path;
+      result = false;
+    }
+    if (result) {
+      run_paths_.push_back(path);
+    } else {
+      remove(path.c_str());
+    }
+    return result;
+  }
+
+  // Merge all runs in comparator order, calling [callback] for each sample.
+  // It can be called several times, and reads the runs from the start each
+  // time.
+  bool MergeRuns(
+      const std::function<void(std::unique_ptr<SlabSample>)>& callback) {
+    std::vector<std::unique_ptr<FILE, decltype(&fclose)>> files;
+    std::vector<std::unique_ptr<SlabSample>> heads;
+    for (const auto& path : run_paths_) {
+      FILE* fp = fopen(path.c_str(), "rb");
+      if (fp == nullptr) {
+        PLOG(ERROR) << "failed to open " << path;
+        return false;
+      }
+      files.emplace_back(fp, fclose);
+      std::unique_ptr<SlabSample> sample;
+      if (!ReadSample(fp, path, &sample)) {
+        return false;
+      }
+      heads.push_back(std::move(sample));
+    }
+    while (true) {
+      size_t min_index = heads.size();
+      for (size_t i = 0; i < heads.size(); ++i) {
+        if (heads[i] != nullptr &&
+            (min_index == heads.size() ||
+             comparator_(heads[i].get(), heads[min_index].get()))) {
+          min_index = i;
+        }
+      }
+      if (min_index == heads.size()) {
+        break;
+      }
+      callback(std::move(heads[min_index]));
+      if (!ReadSample(files[min_index].get(), run_paths_[min_index],
+                      &heads[min_index])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  // Read the next sample in a run file. Set [sample] to nullptr at the end
+  // of the run.
+  bool ReadSample(FILE* fp, const std::string& path,
+                  std::unique_ptr<SlabSample>* sample) {
+    uint64_t buf[7];
+    if (fread(buf, sizeof(buf), 1, fp) != 1) {
+      if (feof(fp)) {
+        sample->reset(nullptr);
+        return true;
+      }
+      PLOG(ERROR) << "failed to read " << path;
+      return false;
+    }
+    sample->reset(new SlabSample(
+        reinterpret_cast<const Symbol*>(static_cast<uintptr_t>(buf[0])),
+        buf[1], buf[2], buf[3], buf[4], buf[5], buf[6]));
+    return true;
+  }
+
+  const std::string path_prefix_;
+  const SampleComparator<SlabSample> comparator_;
+  std::vector<std::string> run_paths_;
+};
+
 class SlabSampleTreeBuilder
     : public SampleTreeBuilder<SlabSample, SlabAccumulateInfo> {
  public:
   SlabSampleTreeBuilder(SampleComparator<SlabSample> sample_comparator,
                         ThreadTree* thread_tree)
       : SampleTreeBuilder(sample_comparator),
+        comparator_(sample_comparator),
         thread_tree_(thread_tree),
+        spill_limit_(0),
         total_requested_bytes_(0),
         total_allocated_bytes_(0),
         nr_allocations_(0),
@@ -142,6 +270,62 @@ class SlabSampleTreeBuilder
     formats_.push_back(std::move(p));
   }
 
+  // Spill samples to files under [path_prefix] whenever the sample tree
+  // holds [spill_limit] samples, keeping report memory bounded for long
+  // traces.
+  void SetSpillOptions(size_t spill_limit, const std::string& path_prefix) {
+    spill_limit_ = spill_limit;
+    spiller_.reset(new SlabSampleSpiller(path_prefix, comparator_));
+  }
+
+  bool HasSpilledSamples() const {
+    return spiller_ != nullptr && spiller_->run_count() > 0;
+  }
+
+  bool SpillIfNeeded() {
+    if (spill_limit_ == 0 || sample_set_.size() < spill_limit_) {
+      return true;
+    }
+    return SpillSamples();
+  }
+
+  // Spill samples still in memory, so all samples can be read back by
+  // StreamMergedSamples().
+  bool SpillRemainingSamples() {
+    if (sample_set_.empty()) {
+      return true;
+    }
+    return SpillSamples();
+  }
+
+  // Merge the spilled runs in comparator order, combining samples of the
+  // same entry spilled in different runs, and pass each merged sample to
+  // [callback].
+  bool StreamMergedSamples(
+      const std::function<void(std::unique_ptr<SlabSample>)>& callback) {
+    std::unique_ptr<SlabSample> current;
+    if (!spiller_->MergeRuns([&](std::unique_ptr<SlabSample> sample) {
+          if (current != nullptr &&
+              comparator_.IsSameSample(current.get(), sample.get())) {
+            MergeSample(current.get(), sample.get());
+            // MergeSample() doesn't merge pingpong counts, as they are
+            // normally added to the merged sample directly.
+            current->cross_cpu_allocations += sample->cross_cpu_allocations;
+          } else {
+            if (current != nullptr) {
+              callback(std::move(current));
+            }
+            current = std::move(sample);
+          }
+        })) {
+      return false;
+    }
+    if (current != nullptr) {
+      callback(std::move(current));
+    }
+    return true;
+  }
+
  protected:
   SlabSample* CreateSample(const SampleRecord& r, bool in_kernel,
                            SlabAccumulateInfo* acc_info) override {
@@ -228,6 +412,9 @@ class SlabSampleTreeBuilder
 
   const ThreadEntry* GetThreadOfSample(SlabSample*) override { return nullptr; }
 
+  // Slab samples have no thread, so user stacks are never unwound.
+  void ResolveThreadMaps(const ThreadEntry*) override {}
+
   uint64_t GetPeriodForCallChain(const SlabAccumulateInfo&) override {
     // Decide the percentage of callchain by the sample_count, so use 1 as the
     // period when calling AddCallChain().
@@ -247,7 +434,25 @@ class SlabSampleTreeBuilder
   }
 
  private:
+  bool SpillSamples() {
+    std::vector<SlabSample*> samples = GetSamples();
+    // GetSamples() doesn't return samples in comparator order, but runs must
+    // be sorted by the comparator to be merged by MergeRuns().
+    std::sort(samples.begin(), samples.end(), comparator_);
+    if (!spiller_->WriteRun(samples)) {
+      return false;
+    }
+    ClearSamples();
+    // Frees can't match allocation samples already spilled to disk, so
+    // pingpong counts may be underestimated when spilling.
+    alloc_cpu_record_map_.clear();
+    return true;
+  }
+
+  const SampleComparator<SlabSample> comparator_;
   ThreadTree* thread_tree_;
+  size_t spill_limit_;
+  std::unique_ptr<SlabSampleSpiller> spiller_;
   uint64_t total_requested_bytes_;
   uint64_t total_allocated_bytes_;
   uint64_t nr_allocations_;
@@ -309,10 +514,17 @@ class KmemCommand : public Command {
 "                             the cpu allocating them.\n"
 "            The default slab sort keys are:\n"
 "              hit,caller,bytes_req,bytes_alloc,fragment,pingpong.\n"
+"--spill-limit count  Limit the count of samples kept in memory. When\n"
+"                     reached, samples are spilled to temporary files next to\n"
+"                     the report file, and merged back when printing the\n"
+"                     report. It can't be used with --children or -g option.\n"
+"                     Frees can't match allocation samples already spilled,\n"
+"                     so pingpong counts may be underestimated.\n"
             // clang-format on
             ),
         is_record_(false),
         use_slab_(false),
+        spill_limit_(0),
         accumulate_callchain_(false),
         print_callgraph_(false),
         callgraph_show_callee_(false),
@@ -332,12 +544,15 @@ class KmemCommand : public Command {
   bool ReadSampleTreeFromRecordFile();
   bool ProcessRecord(std::unique_ptr<Record> record);
   void ProcessTracingData(const std::vector<char>& data);
+  bool SortSpilledSamples();
+  bool PrintSpilledSlabSamples(FILE* fp);
   bool PrintReport();
   void PrintReportContext(FILE* fp);
   void PrintSlabReportContext(FILE* fp);
 
   bool is_record_;
   bool use_slab_;
+  size_t spill_limit_;
   std::vector<std::string> slab_sort_keys_;
   bool accumulate_callchain_;
   bool print_callgraph_;
@@ -354,6 +569,12 @@ class KmemCommand : public Command {
   std::unique_ptr<SlabSampleTreeBuilder> slab_sample_tree_builder_;
   std::unique_ptr<SlabSampleTreeSorter> slab_sample_tree_sorter_;
   std::unique_ptr<SlabSampleTreeDisplayer> slab_sample_tree_displayer_;
+  // Used when samples are spilled to disk.
+  std::string spill_path_prefix_;
+  SampleComparator<SlabSample> slab_sort_comparator_;
+  std::unique_ptr<SampleDisplayer<SlabSample, SlabSampleTree>>
+      slab_sample_displayer_;
+  std::unique_ptr<SlabSampleSpiller> sorted_sample_spiller_;
 
   std::string report_filename_;
 };
@@ -433,11 +654,24 @@ bool KmemCommand::ParseOptions(const std::vector<std::string>& args,
           return false;
         }
         slab_sort_keys_ = android::base::Split(args[i], ",");
+      } else if (args[i] == "--spill-limit") {
+        if (!NextArgumentOrError(args, &i)) {
+          return false;
+        }
+        if (!android::base::ParseUint(args[i].c_str(), &spill_limit_) ||
+            spill_limit_ == 0) {
+          LOG(ERROR) << "Invalid spill limit: " << args[i];
+          return false;
+        }
       } else {
         ReportUnknownOption(args, i);
         return false;
       }
     }
+    if (spill_limit_ != 0 && accumulate_callchain_) {
+      LOG(ERROR) << "--spill-limit can't be used with --children or -g option.";
+      return false;
+    }
   } else {
     LOG(ERROR) << "Unknown subcommand for " << Name() << ": " << args[0]
                << ". Try `simpleperf help " << Name() << "`";
@@ -515,10 +749,10 @@ bool KmemCommand::PrepareToBuildSampleTree() {
         displayer.AddDisplayFunction(accumulated_name + "Hit",
                                      DisplaySampleCount);
       } else if (key == "caller") {
-        comparator.AddCompareFunction(CompareSymbol);
+        comparator.AddCompareFunction(CompareSymbol, HashSymbol);
         displayer.AddDisplayFunction("Caller", DisplaySymbol);
       } else if (key == "ptr") {
-        comparator.AddCompareFunction(ComparePtr);
+        comparator.AddCompareFunction(ComparePtr, HashPtr);
         displayer.AddDisplayFunction("Ptr", DisplayPtr);
       } else if (key == "bytes_req") {
         sort_comparator.AddCompareFunction(CompareBytesReq);
@@ -533,7 +767,7 @@ bool KmemCommand::PrepareToBuildSampleTree() {
         displayer.AddDisplayFunction(accumulated_name + "Fragment",
                                      DisplayFragment);
       } else if (key == "gfp_flags") {
-        comparator.AddCompareFunction(CompareGfpFlags);
+        comparator.AddCompareFunction(CompareGfpFlags, HashGfpFlags);
         displayer.AddDisplayFunction("GfpFlags", DisplayGfpFlags);
       } else if (key == "pingpong") {
         sort_comparator.AddCompareFunction(CompareCrossCpuAllocations);
@@ -551,6 +785,17 @@ bool KmemCommand::PrepareToBuildSampleTree() {
       slab_sample_tree_sorter_.reset(new SlabSampleTreeSorter(sort_comparator));
       slab_sample_tree_displayer_.reset(new SlabSampleTreeDisplayer(displayer));
     }
+    if (spill_limit_ != 0) {
+      // Put spill files next to the report file when -o is used, as the
+      // record file may be in a read-only directory.
+      spill_path_prefix_ =
+          report_filename_.empty() ? record_filename_ : report_filename_;
+      slab_sample_tree_builder_->SetSpillOptions(
+          spill_limit_, spill_path_prefix_ + ".kmem_spill");
+      slab_sort_comparator_ = sort_comparator;
+      slab_sample_displayer_.reset(
+          new SampleDisplayer<SlabSample, SlabSampleTree>(displayer));
+    }
   }
   return true;
 }
@@ -599,8 +844,21 @@ bool KmemCommand::ReadSampleTreeFromRecordFile() {
     return false;
   }
   if (use_slab_) {
-    slab_sample_tree_ = slab_sample_tree_builder_->GetSampleTree();
-    slab_sample_tree_sorter_->Sort(slab_sample_tree_.samples, print_callgraph_);
+    if (slab_sample_tree_builder_->HasSpilledSamples()) {
+      if (!slab_sample_tree_builder_->SpillRemainingSamples()) {
+        return false;
+      }
+      // Only summary information is left in the builder. The samples are
+      // read back from the spilled runs when printing the report.
+      slab_sample_tree_ = slab_sample_tree_builder_->GetSampleTree();
+      if (!SortSpilledSamples()) {
+        return false;
+      }
+    } else {
+      slab_sample_tree_ = slab_sample_tree_builder_->GetSampleTree();
+      slab_sample_tree_sorter_->Sort(slab_sample_tree_.samples,
+                                     print_callgraph_);
+    }
   }
   return true;
 }
@@ -611,6 +869,9 @@ bool KmemCommand::ProcessRecord(std::unique_ptr<Record> record) {
     if (use_slab_) {
       slab_sample_tree_builder_->ProcessSampleRecord(
           *static_cast<const SampleRecord*>(record.get()));
+      if (!slab_sample_tree_builder_->SpillIfNeeded()) {
+        return false;
+      }
     }
   } else if (record->type() == PERF_RECORD_TRACING_DATA) {
     const auto& r = *static_cast<TracingDataRecord*>(record.get());
@@ -621,6 +882,16 @@ bool KmemCommand::ProcessRecord(std::unique_ptr<Record> record) {
 
 void KmemCommand::ProcessTracingData(const std::vector<char>& data) {
   Tracing tracing(data);
+  // Use preparsed formats if the record file carries them, skipping the parse
+  // of the event format files.
+  if (record_file_reader_->HasFeature(
+          PerfFileFormat::FEAT_TRACING_FORMAT_CACHE)) {
+    std::vector<char> cache;
+    if (record_file_reader_->ReadFeatureSection(
+            PerfFileFormat::FEAT_TRACING_FORMAT_CACHE, &cache)) {
+      tracing.LoadTracingFormatCache(cache);
+    }
+  }
   for (auto& attr : event_attrs_) {
     if (attr.attr.type == PERF_TYPE_TRACEPOINT) {
       uint64_t trace_event_id = attr.attr.config;
@@ -650,6 +921,63 @@ void KmemCommand::ProcessTracingData(const std::vector<char>& data) {
   }
 }
 
+// Merge the spilled sample runs, and write the merged samples into new runs
+// sorted by the report sort keys. The report is then printed by streaming a
+// merge of the sorted runs, so the count of samples in memory never exceeds
+// the spill limit.
+bool KmemCommand::SortSpilledSamples() {
+  sorted_sample_spiller_.reset(new SlabSampleSpiller(
+      spill_path_prefix_ + ".kmem_sorted_spill", slab_sort_comparator_));
+  std::vector<std::unique_ptr<SlabSample>> buffer;
+  bool failed = false;
+  auto write_run = [&]() {
+    std::vector<SlabSample*> samples;
+    for (auto& sample : buffer) {
+      samples.push_back(sample.get());
+    }
+    std::sort(samples.begin(), samples.end(), slab_sort_comparator_);
+    if (!sorted_sample_spiller_->WriteRun(samples)) {
+      failed = true;
+    }
+    buffer.clear();
+  };
+  if (!slab_sample_tree_builder_->StreamMergedSamples(
+          [&](std::unique_ptr<SlabSample> sample) {
+            if (failed) {
+              return;
+            }
+            buffer.push_back(std::move(sample));
+            if (buffer.size() >= spill_limit_) {
+              write_run();
+            }
+          })) {
+    return false;
+  }
+  if (!failed && !buffer.empty()) {
+    write_run();
+  }
+  return !failed;
+}
+
+bool KmemCommand::PrintSpilledSlabSamples(FILE* fp) {
+  SampleDisplayer<SlabSample, SlabSampleTree>& displayer =
+      *slab_sample_displayer_;
+  displayer.SetInfo(&slab_sample_tree_);
+  // The displayer needs two passes over the samples, one to adjust column
+  // widths and one to print, so merge the sorted runs twice.
+  if (!sorted_sample_spiller_->MergeRuns(
+          [&](std::unique_ptr<SlabSample> sample) {
+            displayer.AdjustWidth(sample.get());
+          })) {
+    return false;
+  }
+  displayer.PrintNames(fp);
+  return sorted_sample_spiller_->MergeRuns(
+      [&](std::unique_ptr<SlabSample> sample) {
+        displayer.PrintSample(fp, sample.get());
+      });
+}
+
 bool KmemCommand::PrintReport() {
   std::unique_ptr<FILE, decltype(&fclose)> file_handler(nullptr, fclose);
   FILE* report_fp = stdout;
@@ -665,8 +993,14 @@ bool KmemCommand::PrintReport() {
   if (use_slab_) {
     fprintf(report_fp, "\n\n");
     PrintSlabReportContext(report_fp);
-    slab_sample_tree_displayer_->DisplaySamples(
-        report_fp, slab_sample_tree_.samples, &slab_sample_tree_);
+    if (sorted_sample_spiller_ != nullptr) {
+      if (!PrintSpilledSlabSamples(report_fp)) {
+        return false;
+      }
+    } else {
+      slab_sample_tree_displayer_->DisplaySamples(
+          report_fp, slab_sample_tree_.samples, &slab_sample_tree_);
+    }
   }
   return true;
 }
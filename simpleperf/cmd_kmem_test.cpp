@@ -137,6 +137,15 @@ TEST(kmem_cmd, report_all_sort_options) {
   ASSERT_NE(result.content.find("GfpFlags"), std::string::npos);
 }
 
+TEST(kmem_cmd, report_spill_limit_option) {
+  ReportResult result;
+  KmemReportFile(PERF_DATA_WITH_KMEM_SLAB_CALLGRAPH_RECORD,
+                 {"--spill-limit", "32"}, &result);
+  ASSERT_TRUE(result.success);
+  ASSERT_NE(result.content.find("kmem:kmalloc"), std::string::npos);
+  ASSERT_NE(result.content.find("__alloc_skb"), std::string::npos);
+}
+
 TEST(kmem_cmd, report_callgraph) {
   ReportResult result;
   KmemReportFile(PERF_DATA_WITH_KMEM_SLAB_CALLGRAPH_RECORD, {"-g"}, &result);
@@ -19,9 +19,16 @@
 #include <sys/prctl.h>
 #include <sys/utsname.h>
 #include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -41,6 +48,7 @@
 #include "read_elf.h"
 #include "record.h"
 #include "record_file.h"
+#include "record_write_queue.h"
 #include "thread_tree.h"
 #include "tracing.h"
 #include "utils.h"
@@ -66,6 +74,165 @@ constexpr uint32_t MAX_DUMP_STACK_SIZE = 65528;
 // successfully, the buffer size = 1024 * 4K (page size) = 4M.
 constexpr size_t DESIRED_PAGES_IN_MAPPED_BUFFER = 1024;
 
+// PostUnwindThreadPool unwinds the stacks of queued sample records on a pool
+// of worker threads, and writes finished records in record order. The caller
+// should flush the pool before updating the thread tree, so workers only read
+// it while unwinding.
+class PostUnwindThreadPool {
+ public:
+  PostUnwindThreadPool(
+      size_t thread_count,
+      const std::function<bool(std::unique_ptr<Record>)>& write_callback)
+      : write_callback_(write_callback), stop_(false) {
+    for (size_t i = 0; i < thread_count; ++i) {
+      threads_.push_back(std::thread([this]() { Run(); }));
+    }
+  }
+
+  ~PostUnwindThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    task_cond_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Queue [record] for unwinding. [thread] should have resolved maps, as
+  // workers read them without locking.
+  bool PushSampleRecord(std::unique_ptr<Record> record,
+                        const ThreadEntry* thread, const RegSet& regs,
+                        bool strict_arch_check) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      WaitForQueueSpace(&lock);
+      tasks_.emplace_back(
+          new Task(std::move(record), thread, regs, strict_arch_check));
+      todo_.push_back(tasks_.back().get());
+    }
+    task_cond_.notify_one();
+    return WriteFinishedRecords(false);
+  }
+
+  // Queue [record] for writing without unwinding, keeping the record order.
+  bool PushRecord(std::unique_ptr<Record> record) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      WaitForQueueSpace(&lock);
+      tasks_.emplace_back(new Task(std::move(record)));
+    }
+    return WriteFinishedRecords(false);
+  }
+
+  // Write all queued records, waiting for unfinished unwinding.
+  bool Flush() { return WriteFinishedRecords(true); }
+
+ private:
+  struct Task {
+    std::unique_ptr<Record> record;
+    const ThreadEntry* thread;  // nullptr when no unwinding is needed
+    RegSet regs;
+    bool strict_arch_check;
+    bool done;
+    std::vector<uint64_t> unwind_ips;
+
+    Task(std::unique_ptr<Record> record, const ThreadEntry* thread,
+         const RegSet& regs, bool strict_arch_check)
+        : record(std::move(record)),
+          thread(thread),
+          regs(regs),
+          strict_arch_check(strict_arch_check),
+          done(false) {}
+    explicit Task(std::unique_ptr<Record> record)
+        : record(std::move(record)),
+          thread(nullptr),
+          strict_arch_check(false),
+          done(true) {}
+  };
+
+  void Run() {
+    // One cache per worker, so workers don't need to synchronize on it.
+    UnwindMapCache map_cache;
+    while (true) {
+      Task* task = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (todo_.empty() && !stop_) {
+          task_cond_.wait(lock);
+        }
+        if (todo_.empty()) {
+          break;
+        }
+        task = todo_.front();
+        todo_.pop_front();
+      }
+      SampleRecord& r = *static_cast<SampleRecord*>(task->record.get());
+      std::vector<uint64_t> unwind_ips = UnwindCallChain(
+          r.regs_user_data.abi, *task->thread, task->regs,
+          r.stack_user_data.data, r.GetValidStackSize(),
+          task->strict_arch_check, &map_cache);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task->unwind_ips = std::move(unwind_ips);
+        task->done = true;
+      }
+      done_cond_.notify_all();
+    }
+  }
+
+  // Queued records hold dumped stacks, so bound the queue to bound memory.
+  void WaitForQueueSpace(std::unique_lock<std::mutex>* lock) {
+    while (tasks_.size() >= MAX_QUEUED_TASKS && !tasks_.front()->done) {
+      done_cond_.wait(*lock);
+    }
+  }
+
+  bool WriteFinishedRecords(bool wait_all) {
+    while (true) {
+      std::unique_ptr<Task> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (tasks_.empty()) {
+          break;
+        }
+        if (!tasks_.front()->done) {
+          if (!wait_all) {
+            break;
+          }
+          done_cond_.wait(lock);
+          continue;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      if (task->thread != nullptr) {
+        static_cast<SampleRecord*>(task->record.get())
+            ->ReplaceRegAndStackWithCallChain(task->unwind_ips);
+      }
+      if (!write_callback_(std::move(task->record))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static constexpr size_t MAX_QUEUED_TASKS = 1024;
+
+  const std::function<bool(std::unique_ptr<Record>)> write_callback_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable task_cond_;
+  std::condition_variable done_cond_;
+  // Queued records in record order.
+  std::deque<std::unique_ptr<Task>> tasks_;
+  // Tasks not picked by a worker yet. The pointers stay valid, as the tasks
+  // are owned by tasks_.
+  std::deque<Task*> todo_;
+  bool stop_;
+};
+
 class RecordCommand : public Command {
  public:
   RecordCommand()
@@ -76,6 +243,9 @@ class RecordCommand : public Command {
 "       Gather sampling information of running [command]. And -a/-p/-t option\n"
 "       can be used to change target of sampling information.\n"
 "-a     System-wide collection.\n"
+"--async-write  Serialize and write records on a dedicated writer thread, so\n"
+"               reading records from the kernel buffers doesn't wait for file\n"
+"               I/O. It reduces lost samples when the disk stalls.\n"
 "-b     Enable take branch stack sampling. Same as '-j any'\n"
 "-c count     Set event sample period. It means recording one sample when\n"
 "             [count] events happen. Can't be used with -f/-F option.\n"
@@ -84,6 +254,16 @@ class RecordCommand : public Command {
 "             Enable call graph recording. Use frame pointer or dwarf debug\n"
 "             frame as the method to parse call graph in stack.\n"
 "             Default is dwarf,65528.\n"
+"--cgroup cgroup_name\n"
+"             Profile all threads in the cgroup. cgroup_name is relative to\n"
+"             the root of the perf_event cgroup hierarchy. One event fd is\n"
+"             opened per cpu for the whole cgroup, instead of one per thread\n"
+"             per cpu, so profiling processes with many threads doesn't run\n"
+"             into fd limits. Needs root privilege.\n"
+"--compress   Compress records in the output file. It reduces the size of\n"
+"             perf.data, and the reader decompresses it transparently. Use\n"
+"             with --async-write to keep compression off the record reading\n"
+"             thread.\n"
 "--cpu cpu_item1,cpu_item2,...\n"
 "             Collect samples only on the selected cpus. cpu_item can be cpu\n"
 "             number like 1, or cpu range like 0-3.\n"
@@ -104,6 +284,12 @@ class RecordCommand : public Command {
 "             samples every second. For non-tracepoint events, the default\n"
 "             option is -f 4000.\n"
 "-F freq      Same as '-f freq'.\n"
+"--filter-dso dso1,dso2,...\n"
+"             Only keep samples whose ip falls in one of the named dsos,\n"
+"             given as full paths or just file names. Samples are dropped\n"
+"             while recording, before they are written, so perf.data only\n"
+"             grows with the library under investigation. Map, comm and\n"
+"             fork records are kept, and reports resolve symbols normally.\n"
 "-g           Same as '--call-graph dwarf'.\n"
 "--group event1[:modifier],event2[:modifier2],...\n"
 "             Similar to -e option. But events specified in the same --group\n"
@@ -124,6 +310,8 @@ class RecordCommand : public Command {
 "-m mmap_pages   Set the size of the buffer used to receiving sample data from\n"
 "                the kernel. It should be a power of 2. If not set, the max\n"
 "                possible value <= 1024 will be used.\n"
+"--max-files N   Keep at most N finished chunks when --split-size is used,\n"
+"                deleting the oldest chunk when a new one is finished.\n"
 "--no-dump-kernel-symbols  Don't dump kernel symbols in perf.data. By default\n"
 "                          kernel symbols will be dumped when needed.\n"
 "--no-inherit  Don't record created child threads/processes.\n"
@@ -137,10 +325,27 @@ class RecordCommand : public Command {
 "               will be unwound while recording by default. But it may lose\n"
 "               records as stacking unwinding can be time consuming. Use this\n"
 "               option to unwind the user's stack after recording.\n"
+"--post-unwind-threads nthreads\n"
+"               Unwind the user's stack with nthreads worker threads when\n"
+"               --post-unwind option is used. Default is 1.\n"
+"--split-size SIZE_IN_MB\n"
+"               Rotate the output file when its data section exceeds\n"
+"               SIZE_IN_MB megabytes. Chunks are written as <file>.1,\n"
+"               <file>.2, ..., each a self-contained record file finalized\n"
+"               on a background thread, and reports stitch a chunk sequence\n"
+"               back together transparently. Use with --max-files to bound\n"
+"               disk use in unbounded monitoring sessions. It can't be used\n"
+"               with --post-unwind.\n"
 "--symfs <dir>    Look for files with symbols relative to this directory.\n"
 "                 This option is used to provide files with symbol table and\n"
 "                 debug information, which are used by --dump-symbols and -g.\n"
 "-t tid1,tid2,... Record events on existing threads. Mutually exclusive with -a.\n"
+"--trace-offcpu   Trace how long threads are blocked off cpu, by monitoring\n"
+"                 sched:sched_switch and sched:sched_wakeup tracepoints. The\n"
+"                 raw sched samples are consumed while recording, and each\n"
+"                 blocked interval is written as one synthesized sample of\n"
+"                 sched:sched_switch, whose period is the blocked time in\n"
+"                 nanoseconds. It can't be used with --post-unwind option.\n"
             // clang-format on
             ),
         use_sample_freq_(false),
@@ -148,22 +353,35 @@ class RecordCommand : public Command {
         use_sample_period_(false),
         sample_period_(0),
         system_wide_collection_(false),
+        async_write_(false),
+        compress_records_(false),
         branch_sampling_(0),
         fp_callchain_sampling_(false),
         dwarf_callchain_sampling_(false),
         dump_stack_size_in_dwarf_sampling_(MAX_DUMP_STACK_SIZE),
         unwind_dwarf_callchain_(true),
         post_unwind_(false),
+        post_unwind_thread_count_(1),
         child_inherit_(true),
         duration_in_sec_(0),
         can_dump_kernel_symbols_(true),
         dump_symbols_(false),
+        trace_offcpu_(false),
         event_selection_set_(false),
         mmap_page_range_(std::make_pair(1, DESIRED_PAGES_IN_MAPPED_BUFFER)),
         record_filename_("perf.data"),
+        split_size_in_bytes_(0),
+        max_record_files_(0),
+        split_file_index_(0),
+        split_data_bytes_(0),
+        dumping_process_state_(false),
+        split_finalize_failed_(false),
         start_sampling_time_in_ns_(0),
         sample_record_count_(0),
-        lost_record_count_(0) {
+        lost_record_count_(0),
+        filtered_sample_count_(0),
+        switch_attr_(nullptr),
+        switch_event_id_(0) {
     // Stop profiling if parent exits.
     prctl(PR_SET_PDEATHSIG, SIGHUP, 0, 0, 0);
   }
@@ -175,20 +393,32 @@ class RecordCommand : public Command {
                     std::vector<std::string>* non_option_args);
   bool SetEventSelectionFlags();
   bool CreateAndInitRecordFile();
+  bool StartRecordFile();
+  bool SplitRecordFile();
+  bool FinishSplitFile();
+  bool JoinSplitFinalizer();
   std::unique_ptr<RecordFileWriter> CreateRecordFile(
       const std::string& filename);
   bool DumpKernelSymbol();
   bool DumpTracingData();
   bool DumpKernelAndModuleMmaps(const perf_event_attr& attr, uint64_t event_id);
   bool DumpThreadCommAndMmaps(const perf_event_attr& attr, uint64_t event_id);
+  bool PrepareOffCpuSampleSynthesis();
   bool ProcessRecord(Record* record);
+  bool SampleHitsFilterDso(SampleRecord* record);
+  bool ProcessOffCpuSample(SampleRecord* record, bool* omit);
+  bool SynthesizeOffCpuSample(pid_t tid, uint64_t end_time);
   void UpdateRecordForEmbeddedElfPath(Record* record);
   bool UnwindRecord(Record* record);
   bool PostUnwind(const std::vector<std::string>& args);
-  bool DumpAdditionalFeatures(const std::vector<std::string>& args);
-  bool DumpBuildIdFeature();
-  bool DumpFileFeature();
-  void CollectHitFileInfo(const SampleRecord& r);
+  bool PostUnwindRecord(PostUnwindThreadPool* pool,
+                        std::unique_ptr<Record> record);
+  bool DumpAdditionalFeatures(RecordFileWriter* writer,
+                              ThreadTree* thread_tree,
+                              const std::vector<std::string>& args);
+  bool DumpBuildIdFeature(RecordFileWriter* writer, ThreadTree* thread_tree);
+  bool DumpFileFeature(RecordFileWriter* writer, ThreadTree* thread_tree);
+  void CollectHitFileInfo(ThreadTree* thread_tree, const SampleRecord& r);
 
   bool use_sample_freq_;
   uint64_t sample_freq_;  // Sample 'sample_freq_' times per second.
@@ -196,32 +426,87 @@ class RecordCommand : public Command {
   uint64_t sample_period_;  // Sample once when 'sample_period_' events occur.
 
   bool system_wide_collection_;
+  bool async_write_;
+  bool compress_records_;
   uint64_t branch_sampling_;
   bool fp_callchain_sampling_;
   bool dwarf_callchain_sampling_;
   uint32_t dump_stack_size_in_dwarf_sampling_;
   bool unwind_dwarf_callchain_;
   bool post_unwind_;
+  size_t post_unwind_thread_count_;
   bool child_inherit_;
   double duration_in_sec_;
   bool can_dump_kernel_symbols_;
   bool dump_symbols_;
+  bool trace_offcpu_;
+  // Sample ips must fall in one of these dsos (full path or file name)
+  // to be written out. Empty means no filtering.
+  std::unordered_set<std::string> filter_dso_paths_;
   std::vector<int> cpus_;
   EventSelectionSet event_selection_set_;
 
   std::pair<size_t, size_t> mmap_page_range_;
 
   ThreadTree thread_tree_;
+  // Caches parsed map state across UnwindRecord() calls.
+  UnwindMapCache unwind_map_cache_;
   std::string record_filename_;
   std::unique_ptr<RecordFileWriter> record_file_writer_;
+  std::unique_ptr<RecordWriteQueue> record_write_queue_;
+  // Rotation state for --split-size. The active chunk's name is
+  // record_filename_ + "." + split_file_index_.
+  uint64_t split_size_in_bytes_;  // 0 means no rotation.
+  size_t max_record_files_;       // 0 means keep all finished chunks.
+  size_t split_file_index_;
+  // Data section bytes written to the active chunk so far.
+  uint64_t split_data_bytes_;
+  // Set while dumping process state into a new chunk, so those writes don't
+  // trigger another rotation.
+  bool dumping_process_state_;
+  // Finished chunks not deleted yet, oldest first.
+  std::vector<std::string> split_filenames_;
+  // Finalizes the last finished chunk. Only one chunk is finalized at a
+  // time; the thread is joined before the next chunk is finished.
+  std::thread split_finalizer_;
+  std::atomic<bool> split_finalize_failed_;
+  // Copy of the command args, used to write the cmdline feature of chunks
+  // finalized while recording.
+  std::vector<std::string> record_args_;
+  // Parsed tracing formats serialized in DumpTracingData(), written as a
+  // feature section so reports don't parse the event format files again.
+  std::vector<char> tracing_format_cache_;
 
   uint64_t start_sampling_time_in_ns_;  // nanoseconds from machine starting
 
   uint64_t sample_record_count_;
   uint64_t lost_record_count_;
+  uint64_t filtered_sample_count_;
+
+  // State of a thread switched out off cpu, kept until the thread is known
+  // to be back on cpu, when an off-cpu sample is synthesized from it.
+  struct OffCpuState {
+    uint64_t switch_out_time;
+    uint64_t wakeup_time;  // 0 until a sched_wakeup of the thread is seen
+    uint32_t pid;
+    uint64_t ip;
+    uint32_t cpu;
+    std::vector<uint64_t> ips;
+  };
+  // Used by --trace-offcpu to recognize and parse sched tracepoint samples.
+  const perf_event_attr* switch_attr_;
+  uint64_t switch_event_id_;
+  std::unordered_set<uint64_t> switch_event_ids_;
+  std::unordered_set<uint64_t> wakeup_event_ids_;
+  TracingFieldPlace switch_prev_pid_place_;
+  TracingFieldPlace switch_prev_state_place_;
+  TracingFieldPlace switch_next_pid_place_;
+  TracingFieldPlace wakeup_pid_place_;
+  std::unordered_map<pid_t, OffCpuState> offcpu_threads_;
 };
 
 bool RecordCommand::Run(const std::vector<std::string>& args) {
+  record_args_ = args;
   if (!CheckPerfEventLimit()) {
     return false;
   }
@@ -239,9 +524,21 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
       return false;
     }
   }
+  if (trace_offcpu_) {
+    if (!event_selection_set_.AddEventGroup(
+            {"sched:sched_switch", "sched:sched_wakeup"})) {
+      LOG(ERROR) << "--trace-offcpu needs kernel support of sched tracepoints.";
+      return false;
+    }
+  }
   if (!SetEventSelectionFlags()) {
     return false;
   }
+  if (trace_offcpu_) {
+    // Sample every sched event, no matter what sample freq/period the user
+    // sets for the measured events.
+    event_selection_set_.SetSamplePeriodForLastGroup(1);
+  }
   ScopedCurrentArch scoped_arch(GetMachineArch());
 
   // 2. Create workload.
@@ -283,11 +580,23 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
                                            mmap_page_range_.second)) {
     return false;
   }
+  // The events are counting from here on, and any process state change from
+  // now on comes as kernel COMM/MMAP/FORK records, so samples taken while we
+  // snapshot /proc below are mappable and worth keeping. Taking the start
+  // time after the snapshot instead would throw away the first moments of
+  // system wide profiles, which on a busy device is about a second - often
+  // exactly the part the user started simpleperf to see.
+  start_sampling_time_in_ns_ = GetPerfClock();
+  LOG(VERBOSE) << "start_sampling_time is " << start_sampling_time_in_ns_
+               << " ns";
 
   // 4. Create perf.data.
   if (!CreateAndInitRecordFile()) {
     return false;
   }
+  if (trace_offcpu_ && !PrepareOffCpuSampleSynthesis()) {
+    return false;
+  }
 
   // 5. Add read/signal/periodic Events.
   auto callback =
@@ -315,9 +624,6 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
 
   // 6. Write records in mapped buffers of perf_event_files to output file while
   //    workload is running.
-  start_sampling_time_in_ns_ = GetPerfClock();
-  LOG(VERBOSE) << "start_sampling_time is " << start_sampling_time_in_ns_
-               << " ns";
   if (workload != nullptr && !workload->IsStarted() && !workload->Start()) {
     return false;
   }
@@ -327,13 +633,30 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
   if (!event_selection_set_.FinishReadMmapEventData()) {
     return false;
   }
+  if (record_write_queue_ != nullptr) {
+    // Flush records pushed to the writer thread before reading the data
+    // section in DumpAdditionalFeatures().
+    bool write_result = record_write_queue_->Stop();
+    record_write_queue_.reset();
+    if (!write_result) {
+      return false;
+    }
+  }
 
   // 7. Dump additional features, and close record file.
-  if (!DumpAdditionalFeatures(args)) {
-    return false;
-  }
-  if (!record_file_writer_->Close()) {
-    return false;
+  if (split_size_in_bytes_ != 0) {
+    // Finalize the last chunk like the earlier ones, and wait for it.
+    if (!FinishSplitFile() || !JoinSplitFinalizer()) {
+      return false;
+    }
+  } else {
+    if (!DumpAdditionalFeatures(record_file_writer_.get(), &thread_tree_,
+                                args)) {
+      return false;
+    }
+    if (!record_file_writer_->Close()) {
+      return false;
+    }
   }
 
   // 8. Unwind dwarf callchain.
@@ -346,6 +669,10 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
   // 9. Show brief record result.
   LOG(INFO) << "Samples recorded: " << sample_record_count_
             << ". Samples lost: " << lost_record_count_ << ".";
+  if (!filter_dso_paths_.empty()) {
+    LOG(INFO) << "Samples dropped by --filter-dso: " << filtered_sample_count_
+              << ".";
+  }
   if (sample_record_count_ + lost_record_count_ != 0) {
     double lost_percent = static_cast<double>(lost_record_count_) /
                           (lost_record_count_ + sample_record_count_);
@@ -366,6 +693,8 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
   for (i = 0; i < args.size() && !args[i].empty() && args[i][0] == '-'; ++i) {
     if (args[i] == "-a") {
       system_wide_collection_ = true;
+    } else if (args[i] == "--async-write") {
+      async_write_ = true;
     } else if (args[i] == "-b") {
       branch_sampling_ = branch_sampling_type_map["any"];
     } else if (args[i] == "-c") {
@@ -416,6 +745,15 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
                    << args[i];
         return false;
       }
+    } else if (args[i] == "--cgroup") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!event_selection_set_.AddMonitoredCgroup(args[i])) {
+        return false;
+      }
+    } else if (args[i] == "--compress") {
+      compress_records_ = true;
     } else if (args[i] == "--cpu") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -454,6 +792,12 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         return false;
       }
       use_sample_freq_ = true;
+    } else if (args[i] == "--filter-dso") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      std::vector<std::string> dsos = android::base::Split(args[i], ",");
+      filter_dso_paths_.insert(dsos.begin(), dsos.end());
     } else if (args[i] == "-g") {
       fp_callchain_sampling_ = false;
       dwarf_callchain_sampling_ = true;
@@ -490,6 +834,15 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         return false;
       }
       mmap_page_range_.first = mmap_page_range_.second = pages;
+    } else if (args[i] == "--max-files") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!android::base::ParseUint(args[i].c_str(), &max_record_files_) ||
+          max_record_files_ == 0) {
+        LOG(ERROR) << "invalid arg for --max-files: " << args[i];
+        return false;
+      }
     } else if (args[i] == "--no-dump-kernel-symbols") {
       can_dump_kernel_symbols_ = false;
     } else if (args[i] == "--no-inherit") {
@@ -512,6 +865,27 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       event_selection_set_.AddMonitoredProcesses(pids);
     } else if (args[i] == "--post-unwind") {
       post_unwind_ = true;
+    } else if (args[i] == "--post-unwind-threads") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!android::base::ParseUint(args[i].c_str(),
+                                    &post_unwind_thread_count_) ||
+          post_unwind_thread_count_ == 0) {
+        LOG(ERROR) << "invalid arg for --post-unwind-threads: " << args[i];
+        return false;
+      }
+    } else if (args[i] == "--split-size") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      uint64_t size_in_mb;
+      if (!android::base::ParseUint(args[i].c_str(), &size_in_mb) ||
+          size_in_mb == 0) {
+        LOG(ERROR) << "invalid arg for --split-size: " << args[i];
+        return false;
+      }
+      split_size_in_bytes_ = size_in_mb * 1024 * 1024;
     } else if (args[i] == "--symfs") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -528,6 +902,8 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         return false;
       }
       event_selection_set_.AddMonitoredThreads(tids);
+    } else if (args[i] == "--trace-offcpu") {
+      trace_offcpu_ = true;
     } else {
       ReportUnknownOption(args, i);
       return false;
@@ -558,6 +934,32 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       return false;
     }
   }
+  if (post_unwind_thread_count_ > 1 && !post_unwind_) {
+    LOG(ERROR)
+        << "--post-unwind-threads is only used with `--post-unwind` option.";
+    return false;
+  }
+  if (trace_offcpu_ && post_unwind_) {
+    // Synthesized off-cpu samples copy the callchain of the sched_switch
+    // sample, which only exists when unwinding while recording.
+    LOG(ERROR) << "--trace-offcpu can't be used with `--post-unwind` option.";
+    return false;
+  }
+  if (trace_offcpu_ && branch_sampling_ != 0) {
+    // Synthesized off-cpu samples can't carry branch stacks.
+    LOG(ERROR) << "--trace-offcpu can't be used with -b/-j option.";
+    return false;
+  }
+  if (max_record_files_ != 0 && split_size_in_bytes_ == 0) {
+    LOG(ERROR) << "--max-files is only used with `--split-size` option.";
+    return false;
+  }
+  if (split_size_in_bytes_ != 0 && post_unwind_) {
+    // Post unwinding rewrites the whole record file after recording, but
+    // rotated chunks are finalized (and possibly deleted) while recording.
+    LOG(ERROR) << "--split-size can't be used with `--post-unwind` option.";
+    return false;
+  }
 
   if (system_wide_collection_ && event_selection_set_.HasMonitoredTarget()) {
     LOG(ERROR) << "Record system wide and existing processes/threads can't be "
@@ -570,6 +972,19 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
     return false;
   }
 
+  if (event_selection_set_.HasMonitoredCgroup()) {
+    if (!event_selection_set_.GetMonitoredProcesses().empty() ||
+        !event_selection_set_.GetMonitoredThreads().empty()) {
+      LOG(ERROR) << "--cgroup and existing processes/threads can't be used "
+                    "at the same time.";
+      return false;
+    }
+    if (!IsRoot()) {
+      LOG(ERROR) << "Profiling a cgroup needs root privilege.";
+      return false;
+    }
+  }
+
   if (dump_symbols_ && can_dump_kernel_symbols_) {
     // No need to dump kernel symbols as we will dump all required symbols.
     can_dump_kernel_symbols_ = false;
@@ -603,26 +1018,112 @@ bool RecordCommand::SetEventSelectionFlags() {
     }
   }
   event_selection_set_.SetInherit(child_inherit_);
+  if (PerfClockUsesClockId()) {
+    event_selection_set_.SetClockId(CLOCK_MONOTONIC);
+  }
+  // Wake up the read loop when half of the smallest buffer we may map is
+  // filled, instead of per event. This batches buffer drains during long
+  // low-frequency profiling, and can't lose records as MmapEventFiles()
+  // never maps less than mmap_page_range_.first pages per cpu.
+  event_selection_set_.SetWakeupWatermark(
+      mmap_page_range_.first * GetPageSize() / 2);
   return true;
 }
 
 bool RecordCommand::CreateAndInitRecordFile() {
-  record_file_writer_ = CreateRecordFile(record_filename_);
+  if (split_size_in_bytes_ != 0) {
+    // Chunks are numbered from 1 and record_filename_ itself is left unused,
+    // so the reader can tell a chunk sequence from a plain record file.
+    split_file_index_ = 1;
+  }
+  return StartRecordFile();
+}
+
+bool RecordCommand::StartRecordFile() {
+  std::string filename = record_filename_;
+  if (split_size_in_bytes_ != 0) {
+    filename += "." + std::to_string(split_file_index_);
+  }
+  record_file_writer_ = CreateRecordFile(filename);
   if (record_file_writer_ == nullptr) {
     return false;
   }
+  if (compress_records_) {
+    record_file_writer_->SetCompressRecords(true);
+  }
+  if (async_write_) {
+    record_write_queue_.reset(new RecordWriteQueue(record_file_writer_.get()));
+    if (!record_write_queue_->Start()) {
+      return false;
+    }
+  }
+  // Dump current process state, so each file is self-contained for reporting.
   // Use first perf_event_attr and first event id to dump mmap and comm records.
   EventAttrWithId attr_id = event_selection_set_.GetEventAttrWithId()[0];
-  if (!DumpKernelSymbol()) {
-    return false;
+  dumping_process_state_ = true;
+  bool result = DumpKernelSymbol() && DumpTracingData() &&
+                DumpKernelAndModuleMmaps(*attr_id.attr, attr_id.ids[0]) &&
+                DumpThreadCommAndMmaps(*attr_id.attr, attr_id.ids[0]);
+  dumping_process_state_ = false;
+  return result;
+}
+
+bool RecordCommand::SplitRecordFile() {
+  // Flush in-flight records, so the chunk on disk is complete.
+  if (record_write_queue_ != nullptr) {
+    bool write_result = record_write_queue_->Stop();
+    record_write_queue_.reset();
+    if (!write_result) {
+      return false;
+    }
   }
-  if (!DumpTracingData()) {
+  if (!FinishSplitFile()) {
     return false;
   }
-  if (!DumpKernelAndModuleMmaps(*attr_id.attr, attr_id.ids[0])) {
+  split_file_index_++;
+  split_data_bytes_ = 0;
+  return StartRecordFile();
+}
+
+bool RecordCommand::FinishSplitFile() {
+  // One chunk is finalized at a time. Joining the previous finalizer here
+  // bounds memory use and makes deleting the oldest finished chunks below
+  // safe, as a deleted chunk can't still be getting finalized.
+  if (!JoinSplitFinalizer()) {
     return false;
   }
-  if (!DumpThreadCommAndMmaps(*attr_id.attr, attr_id.ids[0])) {
+  while (max_record_files_ != 0 &&
+         split_filenames_.size() >= max_record_files_) {
+    if (unlink(split_filenames_[0].c_str()) != 0) {
+      PLOG(WARNING) << "failed to remove " << split_filenames_[0];
+    }
+    split_filenames_.erase(split_filenames_.begin());
+  }
+  split_filenames_.push_back(record_filename_ + "." +
+                             std::to_string(split_file_index_));
+  // Finalize the chunk (write its feature sections and close it) on a
+  // background thread, so draining mapped buffers doesn't stall behind
+  // reading the chunk back. The features are rebuilt from the chunk alone
+  // with a private ThreadTree. The recording thread doesn't read dso files
+  // while running, so the build id reads here don't race with it.
+  RecordFileWriter* writer = record_file_writer_.release();
+  split_finalizer_ = std::thread([this, writer]() {
+    std::unique_ptr<RecordFileWriter> w(writer);
+    ThreadTree thread_tree;
+    if (!DumpAdditionalFeatures(w.get(), &thread_tree, record_args_) ||
+        !w->Close()) {
+      split_finalize_failed_ = true;
+    }
+  });
+  return true;
+}
+
+bool RecordCommand::JoinSplitFinalizer() {
+  if (split_finalizer_.joinable()) {
+    split_finalizer_.join();
+  }
+  if (split_finalize_failed_) {
+    LOG(ERROR) << "failed to finalize a split record file chunk";
     return false;
   }
   return true;
@@ -670,6 +1171,8 @@ bool RecordCommand::DumpTracingData() {
   if (!GetTracingData(tracepoint_event_types, &tracing_data)) {
     return false;
   }
+  Tracing tracing(tracing_data);
+  tracing_format_cache_ = tracing.DumpTracingFormatCache();
   TracingDataRecord record(tracing_data);
   if (!ProcessRecord(&record)) {
     return false;
@@ -677,6 +1180,41 @@ bool RecordCommand::DumpTracingData() {
   return true;
 }
 
+// Find the event ids and raw field places of the sched tracepoints, so
+// ProcessOffCpuSample() can recognize their samples and parse the raw data.
+bool RecordCommand::PrepareOffCpuSampleSynthesis() {
+  std::vector<TracingFormat> formats;
+  if (!DeserializeTracingFormats(tracing_format_cache_, &formats)) {
+    return false;
+  }
+  for (const auto& attr_id : event_selection_set_.GetEventAttrWithId()) {
+    if (attr_id.attr->type != PERF_TYPE_TRACEPOINT) {
+      continue;
+    }
+    for (auto& format : formats) {
+      if (format.id != attr_id.attr->config || format.system_name != "sched") {
+        continue;
+      }
+      if (format.name == "sched_switch") {
+        switch_attr_ = attr_id.attr;
+        switch_event_id_ = attr_id.ids[0];
+        switch_event_ids_.insert(attr_id.ids.begin(), attr_id.ids.end());
+        format.GetField("prev_pid", switch_prev_pid_place_);
+        format.GetField("prev_state", switch_prev_state_place_);
+        format.GetField("next_pid", switch_next_pid_place_);
+      } else if (format.name == "sched_wakeup") {
+        wakeup_event_ids_.insert(attr_id.ids.begin(), attr_id.ids.end());
+        format.GetField("pid", wakeup_pid_place_);
+      }
+    }
+  }
+  if (switch_event_ids_.empty() || wakeup_event_ids_.empty()) {
+    LOG(ERROR) << "failed to find sched tracepoint events for --trace-offcpu";
+    return false;
+  }
+  return true;
+}
+
 bool RecordCommand::DumpKernelAndModuleMmaps(const perf_event_attr& attr,
                                              uint64_t event_id) {
   KernelMmap kernel_mmap;
@@ -701,9 +1239,11 @@ bool RecordCommand::DumpKernelAndModuleMmaps(const perf_event_attr& attr,
 bool RecordCommand::DumpThreadCommAndMmaps(const perf_event_attr& attr,
                                            uint64_t event_id) {
   // Decide which processes and threads to dump.
-  // For system_wide profiling, dump all threads.
+  // For system_wide profiling, dump all threads. Samples of a monitored
+  // cgroup can come from any of its threads, so dump all threads then too.
   // For non system wide profiling, build dump_threads.
-  bool all_threads = system_wide_collection_;
+  bool all_threads =
+      system_wide_collection_ || event_selection_set_.HasMonitoredCgroup();
   std::set<pid_t> dump_threads = event_selection_set_.GetMonitoredThreads();
   for (const auto& pid : event_selection_set_.GetMonitoredProcesses()) {
     std::vector<pid_t> tids = GetThreadsInProcess(pid);
@@ -726,15 +1266,20 @@ bool RecordCommand::DumpThreadCommAndMmaps(const perf_event_attr& attr,
     processes.insert(processes.end(), process_set.begin(), process_set.end());
   }
 
+  // Snapshot the state of all processes with worker threads up front, so
+  // dumping below emits records straight from the snapshot instead of
+  // waiting on /proc reads process by process.
+  std::vector<ProcessSnapshot> snapshots = SnapshotProcesses(processes);
+
   // Dump each process and its threads.
-  for (auto& pid : processes) {
-    // Dump mmap records.
-    std::vector<ThreadMmap> thread_mmaps;
-    if (!GetThreadMmapsInProcess(pid, &thread_mmaps)) {
+  for (const auto& snapshot : snapshots) {
+    pid_t pid = snapshot.pid;
+    if (snapshot.mmaps.empty()) {
       // The process may exit before we get its info.
       continue;
     }
-    for (const auto& map : thread_mmaps) {
+    // Dump mmap records.
+    for (const auto& map : snapshot.mmaps) {
       if (map.executable == 0) {
         continue;  // No need to dump non-executable mmap info.
       }
@@ -745,29 +1290,23 @@ bool RecordCommand::DumpThreadCommAndMmaps(const perf_event_attr& attr,
       }
     }
     // Dump process name.
-    std::string name;
-    if (GetThreadName(pid, &name)) {
-      CommRecord record(attr, pid, pid, name, event_id, 0);
+    if (!snapshot.name.empty()) {
+      CommRecord record(attr, pid, pid, snapshot.name, event_id, 0);
       if (!ProcessRecord(&record)) {
         return false;
       }
     }
     // Dump thread info.
-    std::vector<pid_t> threads = GetThreadsInProcess(pid);
-    for (const auto& tid : threads) {
-      if (tid == pid) {
-        continue;
-      }
+    for (const auto& thread : snapshot.threads) {
+      pid_t tid = thread.first;
       if (all_threads || dump_threads.find(tid) != dump_threads.end()) {
         ForkRecord fork_record(attr, pid, tid, pid, pid, event_id);
         if (!ProcessRecord(&fork_record)) {
           return false;
         }
-        if (GetThreadName(tid, &name)) {
-          CommRecord comm_record(attr, pid, tid, name, event_id, 0);
-          if (!ProcessRecord(&comm_record)) {
-            return false;
-          }
+        CommRecord comm_record(attr, pid, tid, thread.second, event_id, 0);
+        if (!ProcessRecord(&comm_record)) {
+          return false;
         }
       }
     }
@@ -789,14 +1328,134 @@ bool RecordCommand::ProcessRecord(Record* record) {
     if (!UnwindRecord(record)) {
       return false;
     }
+  } else if (!filter_dso_paths_.empty()) {
+    // The filter needs the map tracking normally only kept up to date for
+    // inline dwarf unwinding.
+    thread_tree_.Update(*record);
+  }
+  if (dwarf_callchain_sampling_ && (!unwind_dwarf_callchain_ || post_unwind_) &&
+      record->type() == PERF_RECORD_SAMPLE) {
+    // Raw stack dumps are written to the file with --no-unwind and
+    // --post-unwind. Drop the padding after the valid stack data, which is
+    // most of the max dump size when stacks are shallow. Unwinding only uses
+    // the valid part, so nothing is lost.
+    static_cast<SampleRecord*>(record)->TruncateUserStack();
+  }
+  if (trace_offcpu_ && record->type() == PERF_RECORD_SAMPLE) {
+    bool omit;
+    if (!ProcessOffCpuSample(static_cast<SampleRecord*>(record), &omit)) {
+      return false;
+    }
+    if (omit) {
+      return true;
+    }
+  }
+  if (!filter_dso_paths_.empty() && record->type() == PERF_RECORD_SAMPLE &&
+      !SampleHitsFilterDso(static_cast<SampleRecord*>(record))) {
+    filtered_sample_count_++;
+    return true;
   }
   if (record->type() == PERF_RECORD_SAMPLE) {
     sample_record_count_++;
   } else if (record->type() == PERF_RECORD_LOST) {
     lost_record_count_ += static_cast<LostRecord*>(record)->lost;
   }
-  bool result = record_file_writer_->WriteRecord(*record);
-  return result;
+  if (record_write_queue_ != nullptr) {
+    if (!record_write_queue_->PushRecord(*record)) {
+      return false;
+    }
+  } else if (!record_file_writer_->WriteRecord(*record)) {
+    return false;
+  }
+  if (split_size_in_bytes_ != 0 && !dumping_process_state_) {
+    split_data_bytes_ += record->size();
+    if (split_data_bytes_ >= split_size_in_bytes_) {
+      return SplitRecordFile();
+    }
+  }
+  return true;
+}
+
+bool RecordCommand::SampleHitsFilterDso(SampleRecord* record) {
+  SampleRecord& r = *record;
+  ThreadEntry* thread =
+      thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+  const MapEntry* map = thread_tree_.FindMap(thread, r.ip_data.ip, r.InKernel());
+  return filter_dso_paths_.count(map->dso->Path()) > 0 ||
+         filter_dso_paths_.count(map->dso->FileName()) > 0;
+}
+
+bool RecordCommand::ProcessOffCpuSample(SampleRecord* record, bool* omit) {
+  *omit = false;
+  SampleRecord& r = *record;
+  // Any sample of a thread means it is back on cpu, so close its pending
+  // blocked interval. Per thread perf event files don't receive switch in
+  // events (sched_switch only samples the thread being switched out), so the
+  // next sample of the thread is the best proxy for the switch in time.
+  if (!SynthesizeOffCpuSample(r.tid_data.tid, r.time_data.time)) {
+    return false;
+  }
+  if (switch_event_ids_.count(r.id_data.id) > 0) {
+    // Raw sched samples are consumed here instead of written to perf.data.
+    *omit = true;
+    uint32_t prev_pid = switch_prev_pid_place_.ReadFromData(r.raw_data.data);
+    uint64_t prev_state =
+        switch_prev_state_place_.ReadFromData(r.raw_data.data);
+    uint32_t next_pid = switch_next_pid_place_.ReadFromData(r.raw_data.data);
+    // In system wide collection the switched in thread is visible in the raw
+    // data, so its blocked interval can be closed precisely.
+    if (!SynthesizeOffCpuSample(next_pid, r.time_data.time)) {
+      return false;
+    }
+    if (prev_state != 0 && prev_pid == r.tid_data.tid) {
+      // The thread blocks voluntarily, remember its switch out state. A
+      // preempted thread (prev_state == 0) is still runnable, and its time
+      // waiting for cpu isn't off-cpu time.
+      OffCpuState& state = offcpu_threads_[prev_pid];
+      state.switch_out_time = r.time_data.time;
+      state.wakeup_time = 0;
+      state.pid = r.tid_data.pid;
+      state.ip = r.ip_data.ip;
+      state.cpu = r.cpu_data.cpu;
+      state.ips.clear();
+      if (r.sample_type & PERF_SAMPLE_CALLCHAIN) {
+        state.ips.assign(r.callchain_data.ips,
+                         r.callchain_data.ips + r.callchain_data.ip_nr);
+      }
+    }
+  } else if (wakeup_event_ids_.count(r.id_data.id) > 0) {
+    *omit = true;
+    uint32_t pid = wakeup_pid_place_.ReadFromData(r.raw_data.data);
+    auto it = offcpu_threads_.find(pid);
+    if (it != offcpu_threads_.end() && it->second.wakeup_time == 0) {
+      it->second.wakeup_time = r.time_data.time;
+    }
+  }
+  return true;
+}
+
+bool RecordCommand::SynthesizeOffCpuSample(pid_t tid, uint64_t end_time) {
+  auto it = offcpu_threads_.find(tid);
+  if (it == offcpu_threads_.end()) {
+    return true;
+  }
+  OffCpuState state = std::move(it->second);
+  offcpu_threads_.erase(it);
+  // Count blocked time up to the wakeup when one is seen, so time spent
+  // waiting on the run queue isn't attributed to the blocking callchain.
+  uint64_t end = (state.wakeup_time != 0) ? state.wakeup_time : end_time;
+  if (end <= state.switch_out_time) {
+    return true;
+  }
+  SampleRecord r(*switch_attr_, switch_event_id_, state.ip, state.pid, tid,
+                 state.switch_out_time, state.cpu, end - state.switch_out_time,
+                 state.ips);
+  sample_record_count_++;
+  split_data_bytes_ += r.size();
+  if (record_write_queue_ != nullptr) {
+    return record_write_queue_->PushRecord(r);
+  }
+  return record_file_writer_->WriteRecord(r);
 }
 
 template <class RecordType>
@@ -848,10 +1507,12 @@ bool RecordCommand::UnwindRecord(Record* record) {
       // Normally do strict arch check when unwinding stack. But allow unwinding
       // 32-bit processes on 64-bit devices for system wide profiling.
       bool strict_arch_check = !system_wide_collection_;
+      thread_tree_.ResolveMaps(thread);
       std::vector<uint64_t> unwind_ips =
           UnwindCallChain(r.regs_user_data.abi, *thread, regs,
                           r.stack_user_data.data,
-                          r.GetValidStackSize(), strict_arch_check);
+                          r.GetValidStackSize(), strict_arch_check,
+                          &unwind_map_cache_);
       r.ReplaceRegAndStackWithCallChain(unwind_ips);
     }
   }
@@ -870,19 +1531,40 @@ bool RecordCommand::PostUnwind(const std::vector<std::string>& args) {
   if (record_file_writer_ == nullptr) {
     return false;
   }
-  bool result = reader->ReadDataSection(
-      [this](std::unique_ptr<Record> record) {
-        thread_tree_.Update(*record);
-        if (!UnwindRecord(record.get())) {
-          return false;
-        }
-        return record_file_writer_->WriteRecord(*record);
-      },
-      false);
+  if (compress_records_) {
+    record_file_writer_->SetCompressRecords(true);
+  }
+  bool result;
+  if (post_unwind_thread_count_ > 1) {
+    PostUnwindThreadPool pool(post_unwind_thread_count_,
+                              [this](std::unique_ptr<Record> record) {
+                                return record_file_writer_->WriteRecord(
+                                    *record);
+                              });
+    result = reader->ReadDataSection(
+        [this, &pool](std::unique_ptr<Record> record) {
+          return PostUnwindRecord(&pool, std::move(record));
+        },
+        false);
+    if (result) {
+      result = pool.Flush();
+    }
+  } else {
+    result = reader->ReadDataSection(
+        [this](std::unique_ptr<Record> record) {
+          thread_tree_.Update(*record);
+          if (!UnwindRecord(record.get())) {
+            return false;
+          }
+          return record_file_writer_->WriteRecord(*record);
+        },
+        false);
+  }
   if (!result) {
     return false;
   }
-  if (!DumpAdditionalFeatures(args)) {
+  if (!DumpAdditionalFeatures(record_file_writer_.get(), &thread_tree_,
+                              args)) {
     return false;
   }
   if (!record_file_writer_->Close()) {
@@ -901,18 +1583,52 @@ bool RecordCommand::PostUnwind(const std::vector<std::string>& args) {
   return true;
 }
 
+// Queue records for the post-unwind thread pool. Records updating the thread
+// tree act as a barrier: all queued samples are unwound and written first, so
+// the pool workers only read the thread tree.
+bool RecordCommand::PostUnwindRecord(PostUnwindThreadPool* pool,
+                                     std::unique_ptr<Record> record) {
+  if (record->type() == PERF_RECORD_SAMPLE) {
+    SampleRecord& r = *static_cast<SampleRecord*>(record.get());
+    if ((r.sample_type & PERF_SAMPLE_CALLCHAIN) &&
+        (r.sample_type & PERF_SAMPLE_REGS_USER) &&
+        (r.regs_user_data.reg_mask != 0) &&
+        (r.sample_type & PERF_SAMPLE_STACK_USER) &&
+        (r.GetValidStackSize() > 0)) {
+      ThreadEntry* thread =
+          thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+      RegSet regs = CreateRegSet(r.regs_user_data.abi,
+                                 r.regs_user_data.reg_mask,
+                                 r.regs_user_data.regs);
+      bool strict_arch_check = !system_wide_collection_;
+      // Resolve maps now, so pool workers never mutate the thread tree.
+      thread_tree_.ResolveMaps(thread);
+      return pool->PushSampleRecord(std::move(record), thread, regs,
+                                    strict_arch_check);
+    }
+    return pool->PushRecord(std::move(record));
+  }
+  if (!pool->Flush()) {
+    return false;
+  }
+  thread_tree_.Update(*record);
+  return record_file_writer_->WriteRecord(*record);
+}
+
 bool RecordCommand::DumpAdditionalFeatures(
+    RecordFileWriter* writer, ThreadTree* thread_tree,
     const std::vector<std::string>& args) {
   // Read data section of perf.data to collect hit file information.
-  thread_tree_.ClearThreadAndMap();
+  thread_tree->ClearThreadAndMap();
   Dso::ReadKernelSymbolsFromProc();
   auto callback = [&](const Record* r) {
-    thread_tree_.Update(*r);
+    thread_tree->Update(*r);
     if (r->type() == PERF_RECORD_SAMPLE) {
-      CollectHitFileInfo(*reinterpret_cast<const SampleRecord*>(r));
+      CollectHitFileInfo(thread_tree,
+                         *reinterpret_cast<const SampleRecord*>(r));
     }
   };
-  if (!record_file_writer_->ReadDataSection(callback)) {
+  if (!writer->ReadDataSection(callback)) {
     return false;
   }
 
@@ -923,13 +1639,21 @@ bool RecordCommand::DumpAdditionalFeatures(
   if (dump_symbols_) {
     feature_count++;
   }
-  if (!record_file_writer_->BeginWriteFeatures(feature_count)) {
+  if (!tracing_format_cache_.empty()) {
+    feature_count++;
+  }
+  // Compressed records have no seekable offsets to index, so neither the
+  // record type index nor the record time index is written.
+  if (!compress_records_) {
+    feature_count += 2;
+  }
+  if (!writer->BeginWriteFeatures(feature_count)) {
     return false;
   }
-  if (!DumpBuildIdFeature()) {
+  if (!DumpBuildIdFeature(writer, thread_tree)) {
     return false;
   }
-  if (dump_symbols_ && !DumpFileFeature()) {
+  if (dump_symbols_ && !DumpFileFeature(writer, thread_tree)) {
     return false;
   }
   utsname uname_buf;
@@ -937,12 +1661,12 @@ bool RecordCommand::DumpAdditionalFeatures(
     PLOG(ERROR) << "uname() failed";
     return false;
   }
-  if (!record_file_writer_->WriteFeatureString(PerfFileFormat::FEAT_OSRELEASE,
-                                               uname_buf.release)) {
+  if (!writer->WriteFeatureString(PerfFileFormat::FEAT_OSRELEASE,
+                                  uname_buf.release)) {
     return false;
   }
-  if (!record_file_writer_->WriteFeatureString(PerfFileFormat::FEAT_ARCH,
-                                               uname_buf.machine)) {
+  if (!writer->WriteFeatureString(PerfFileFormat::FEAT_ARCH,
+                                  uname_buf.machine)) {
     return false;
   }
 
@@ -952,23 +1676,34 @@ bool RecordCommand::DumpAdditionalFeatures(
   cmdline.push_back(exec_path);
   cmdline.push_back("record");
   cmdline.insert(cmdline.end(), args.begin(), args.end());
-  if (!record_file_writer_->WriteCmdlineFeature(cmdline)) {
+  if (!writer->WriteCmdlineFeature(cmdline)) {
     return false;
   }
   if (branch_sampling_ != 0 &&
-      !record_file_writer_->WriteBranchStackFeature()) {
+      !writer->WriteBranchStackFeature()) {
     return false;
   }
-  if (!record_file_writer_->EndWriteFeatures()) {
+  if (!tracing_format_cache_.empty() &&
+      !writer->WriteTracingFormatCacheFeature(tracing_format_cache_)) {
+    return false;
+  }
+  if (!compress_records_ && !writer->WriteRecordTypeIndexFeature()) {
+    return false;
+  }
+  if (!compress_records_ && !writer->WriteRecordTimeIndexFeature()) {
+    return false;
+  }
+  if (!writer->EndWriteFeatures()) {
     return false;
   }
   return true;
 }
 
-bool RecordCommand::DumpBuildIdFeature() {
+bool RecordCommand::DumpBuildIdFeature(RecordFileWriter* writer,
+                                       ThreadTree* thread_tree) {
   std::vector<BuildIdRecord> build_id_records;
   BuildId build_id;
-  std::vector<Dso*> dso_v = thread_tree_.GetAllDsos();
+  std::vector<Dso*> dso_v = thread_tree->GetAllDsos();
   for (Dso* dso : dso_v) {
     if (!dso->HasDumpId()) {
       continue;
@@ -1015,14 +1750,15 @@ bool RecordCommand::DumpBuildIdFeature() {
           BuildIdRecord(false, UINT_MAX, build_id, dso->Path()));
     }
   }
-  if (!record_file_writer_->WriteBuildIdFeature(build_id_records)) {
+  if (!writer->WriteBuildIdFeature(build_id_records)) {
     return false;
   }
   return true;
 }
 
-bool RecordCommand::DumpFileFeature() {
-  std::vector<Dso*> dso_v = thread_tree_.GetAllDsos();
+bool RecordCommand::DumpFileFeature(RecordFileWriter* writer,
+                                    ThreadTree* thread_tree) {
+  std::vector<Dso*> dso_v = thread_tree->GetAllDsos();
   for (Dso* dso : dso_v) {
     if (!dso->HasDumpId()) {
       continue;
@@ -1041,23 +1777,24 @@ bool RecordCommand::DumpFileFeature() {
     }
     std::sort(dump_symbols.begin(), dump_symbols.end(), Symbol::CompareByAddr);
 
-    if (!record_file_writer_->WriteFileFeature(dso->Path(), dso_type, min_vaddr,
-                                               dump_symbols)) {
+    if (!writer->WriteFileFeature(dso->Path(), dso_type, min_vaddr,
+                                  dump_symbols)) {
       return false;
     }
   }
   return true;
 }
 
-void RecordCommand::CollectHitFileInfo(const SampleRecord& r) {
+void RecordCommand::CollectHitFileInfo(ThreadTree* thread_tree,
+                                       const SampleRecord& r) {
   const ThreadEntry* thread =
-      thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+      thread_tree->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
   const MapEntry* map =
-      thread_tree_.FindMap(thread, r.ip_data.ip, r.InKernel());
+      thread_tree->FindMap(thread, r.ip_data.ip, r.InKernel());
   Dso* dso = map->dso;
   const Symbol* symbol;
   if (dump_symbols_) {
-    symbol = thread_tree_.FindSymbol(map, r.ip_data.ip, nullptr, &dso);
+    symbol = thread_tree->FindSymbol(map, r.ip_data.ip, nullptr, &dso);
     if (!symbol->HasDumpId()) {
       dso->CreateSymbolDumpId(symbol);
     }
@@ -1090,10 +1827,10 @@ void RecordCommand::CollectHitFileInfo(const SampleRecord& r) {
             continue;
           }
         }
-        map = thread_tree_.FindMap(thread, ip, in_kernel);
+        map = thread_tree->FindMap(thread, ip, in_kernel);
         dso = map->dso;
         if (dump_symbols_) {
-          symbol = thread_tree_.FindSymbol(map, ip, nullptr, &dso);
+          symbol = thread_tree->FindSymbol(map, ip, nullptr, &dso);
           if (!symbol->HasDumpId()) {
             dso->CreateSymbolDumpId(symbol);
           }
@@ -58,6 +58,15 @@ TEST(record_cmd, system_wide_option) {
   TEST_IN_ROOT(ASSERT_TRUE(RunRecordCmd({"-a"})));
 }
 
+TEST(record_cmd, async_write_option) {
+  ASSERT_TRUE(RunRecordCmd({"--async-write"}));
+}
+
+TEST(record_cmd, compress_option) {
+  ASSERT_TRUE(RunRecordCmd({"--compress"}));
+  ASSERT_TRUE(RunRecordCmd({"--compress", "--async-write"}));
+}
+
 TEST(record_cmd, sample_period_option) {
   ASSERT_TRUE(RunRecordCmd({"-c", "100000"}));
 }
@@ -115,6 +124,10 @@ TEST(record_cmd, tracepoint_event) {
   TEST_IN_ROOT(ASSERT_TRUE(RunRecordCmd({"-a", "-e", "sched:sched_switch"})));
 }
 
+TEST(record_cmd, trace_offcpu_option) {
+  TEST_IN_ROOT(ASSERT_TRUE(RunRecordCmd({"--trace-offcpu"})));
+}
+
 TEST(record_cmd, branch_sampling) {
   if (IsBranchSamplingSupported()) {
     ASSERT_TRUE(RunRecordCmd({"-b"}));
@@ -180,11 +193,14 @@ TEST(record_cmd, post_unwind_option) {
     CreateProcesses(1, &workloads);
     std::string pid = std::to_string(workloads[0]->GetPid());
     ASSERT_TRUE(RunRecordCmd({"-p", pid, "--call-graph", "dwarf", "--post-unwind"}));
+    ASSERT_TRUE(RunRecordCmd({"-p", pid, "--call-graph", "dwarf",
+                              "--post-unwind", "--post-unwind-threads", "2"}));
   } else {
     GTEST_LOG_(INFO) << "This test does nothing as dwarf callchain sampling is "
                         "not supported on this device.";
   }
   ASSERT_FALSE(RunRecordCmd({"--post-unwind"}));
+  ASSERT_FALSE(RunRecordCmd({"--post-unwind-threads", "2"}));
   ASSERT_FALSE(
       RunRecordCmd({"--call-graph", "dwarf", "--no-unwind", "--post-unwind"}));
 }
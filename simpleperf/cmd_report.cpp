@@ -15,11 +15,16 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <map>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -102,8 +107,28 @@ struct SampleTree {
 };
 
 BUILD_COMPARE_VALUE_FUNCTION(CompareVaddrInFile, vaddr_in_file);
+BUILD_HASH_VALUE_FUNCTION(HashVaddrInFile, vaddr_in_file);
 BUILD_DISPLAY_HEX64_FUNCTION(DisplayVaddrInFile, vaddr_in_file);
 
+// Locks a mutex if it is not null. Sample tree builders running on worker
+// threads use it to serialize accesses to the shared ThreadTree.
+class ScopedThreadTreeLock {
+ public:
+  explicit ScopedThreadTreeLock(std::mutex* mutex) : mutex_(mutex) {
+    if (mutex_ != nullptr) {
+      mutex_->lock();
+    }
+  }
+  ~ScopedThreadTreeLock() {
+    if (mutex_ != nullptr) {
+      mutex_->unlock();
+    }
+  }
+
+ private:
+  std::mutex* mutex_;
+};
+
 class ReportCmdSampleTreeBuilder
     : public SampleTreeBuilder<SampleEntry, uint64_t> {
  public:
@@ -111,9 +136,20 @@ class ReportCmdSampleTreeBuilder
                              ThreadTree* thread_tree)
       : SampleTreeBuilder(sample_comparator),
         thread_tree_(thread_tree),
+        thread_tree_lock_(nullptr),
         total_samples_(0),
         total_period_(0) {}
 
+  // Serialize accesses to the shared thread tree when the builder runs on a
+  // worker thread.
+  void SetThreadTreeLock(std::mutex* lock) { thread_tree_lock_ = lock; }
+
+  void Merge(ReportCmdSampleTreeBuilder& other) {
+    SampleTreeBuilder::Merge(other);
+    total_samples_ += other.total_samples_;
+    total_period_ += other.total_period_;
+  }
+
   void SetFilters(const std::unordered_set<int>& pid_filter,
                   const std::unordered_set<int>& tid_filter,
                   const std::unordered_set<std::string>& comm_filter,
@@ -137,13 +173,16 @@ class ReportCmdSampleTreeBuilder
  protected:
   SampleEntry* CreateSample(const SampleRecord& r, bool in_kernel,
                             uint64_t* acc_info) override {
-    const ThreadEntry* thread =
-        thread_tree_->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
-    const MapEntry* map =
-        thread_tree_->FindMap(thread, r.ip_data.ip, in_kernel);
+    const ThreadEntry* thread;
+    const MapEntry* map;
+    const Symbol* symbol;
     uint64_t vaddr_in_file;
-    const Symbol* symbol =
-        thread_tree_->FindSymbol(map, r.ip_data.ip, &vaddr_in_file);
+    {
+      ScopedThreadTreeLock lock(thread_tree_lock_);
+      thread = thread_tree_->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+      map = thread_tree_->FindMap(thread, r.ip_data.ip, in_kernel);
+      symbol = thread_tree_->FindSymbol(map, r.ip_data.ip, &vaddr_in_file);
+    }
     *acc_info = r.period_data.period;
     return InsertSample(std::unique_ptr<SampleEntry>(
         new SampleEntry(r.time_data.time, r.period_data.period, 0, 1, thread,
@@ -152,16 +191,22 @@ class ReportCmdSampleTreeBuilder
 
   SampleEntry* CreateBranchSample(const SampleRecord& r,
                                   const BranchStackItemType& item) override {
-    const ThreadEntry* thread =
-        thread_tree_->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
-    const MapEntry* from_map = thread_tree_->FindMap(thread, item.from);
+    const ThreadEntry* thread;
+    const MapEntry* from_map;
+    const Symbol* from_symbol;
     uint64_t from_vaddr_in_file;
-    const Symbol* from_symbol =
-        thread_tree_->FindSymbol(from_map, item.from, &from_vaddr_in_file);
-    const MapEntry* to_map = thread_tree_->FindMap(thread, item.to);
+    const MapEntry* to_map;
+    const Symbol* to_symbol;
     uint64_t to_vaddr_in_file;
-    const Symbol* to_symbol =
-        thread_tree_->FindSymbol(to_map, item.to, &to_vaddr_in_file);
+    {
+      ScopedThreadTreeLock lock(thread_tree_lock_);
+      thread = thread_tree_->FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+      from_map = thread_tree_->FindMap(thread, item.from);
+      from_symbol =
+          thread_tree_->FindSymbol(from_map, item.from, &from_vaddr_in_file);
+      to_map = thread_tree_->FindMap(thread, item.to);
+      to_symbol = thread_tree_->FindSymbol(to_map, item.to, &to_vaddr_in_file);
+    }
     std::unique_ptr<SampleEntry> sample(
         new SampleEntry(r.time_data.time, r.period_data.period, 0, 1, thread,
                         to_map, to_symbol, to_vaddr_in_file));
@@ -177,9 +222,14 @@ class ReportCmdSampleTreeBuilder
                                      const std::vector<SampleEntry*>& callchain,
                                      const uint64_t& acc_info) override {
     const ThreadEntry* thread = sample->thread;
-    const MapEntry* map = thread_tree_->FindMap(thread, ip, in_kernel);
+    const MapEntry* map;
+    const Symbol* symbol;
     uint64_t vaddr_in_file;
-    const Symbol* symbol = thread_tree_->FindSymbol(map, ip, &vaddr_in_file);
+    {
+      ScopedThreadTreeLock lock(thread_tree_lock_);
+      map = thread_tree_->FindMap(thread, ip, in_kernel);
+      symbol = thread_tree_->FindSymbol(map, ip, &vaddr_in_file);
+    }
     std::unique_ptr<SampleEntry> callchain_sample(new SampleEntry(
         sample->time, 0, acc_info, 0, thread, map, symbol, vaddr_in_file));
     callchain_sample->thread_comm = sample->thread_comm;
@@ -190,6 +240,11 @@ class ReportCmdSampleTreeBuilder
     return sample->thread;
   }
 
+  void ResolveThreadMaps(const ThreadEntry* thread) override {
+    ScopedThreadTreeLock lock(thread_tree_lock_);
+    thread_tree_->ResolveMaps(thread);
+  }
+
   uint64_t GetPeriodForCallChain(const uint64_t& acc_info) override {
     return acc_info;
   }
@@ -211,10 +266,13 @@ class ReportCmdSampleTreeBuilder
         dso_filter_.find(sample->map->dso->Path()) == dso_filter_.end()) {
       return false;
     }
-    if (!symbol_filter_.empty() &&
-        symbol_filter_.find(sample->symbol->DemangledName()) ==
-            symbol_filter_.end()) {
-      return false;
+    if (!symbol_filter_.empty()) {
+      // DemangledName() lazily demangles and caches the name in the symbol.
+      ScopedThreadTreeLock lock(thread_tree_lock_);
+      if (symbol_filter_.find(sample->symbol->DemangledName()) ==
+          symbol_filter_.end()) {
+        return false;
+      }
     }
     return true;
   }
@@ -232,6 +290,7 @@ class ReportCmdSampleTreeBuilder
 
  private:
   ThreadTree* thread_tree_;
+  std::mutex* thread_tree_lock_;
 
   std::unordered_set<int> pid_filter_;
   std::unordered_set<int> tid_filter_;
@@ -255,7 +314,9 @@ struct SampleTreeBuilderOptions {
   bool accumulate_callchain;
   bool build_callchain;
   bool use_caller_as_callchain_root;
+  bool insert_callchain_for_leaf_only;
   bool strict_unwind_arch_check;
+  size_t callchain_node_limit;
 
   std::unique_ptr<ReportCmdSampleTreeBuilder> CreateSampleTreeBuilder() {
     std::unique_ptr<ReportCmdSampleTreeBuilder> builder(
@@ -264,6 +325,10 @@ struct SampleTreeBuilderOptions {
     builder->SetBranchSampleOption(use_branch_address);
     builder->SetCallChainSampleOptions(accumulate_callchain, build_callchain,
                                        use_caller_as_callchain_root, strict_unwind_arch_check);
+    if (insert_callchain_for_leaf_only) {
+      builder->SetInsertCallChainForLeafOnly();
+    }
+    builder->SetCallChainNodeLimit(callchain_node_limit);
     return builder;
   }
 };
@@ -300,20 +365,42 @@ class ReportCommand : public Command {
 "-b    Use the branch-to addresses in sampled take branches instead of the\n"
 "      instruction addresses. Only valid for perf.data recorded with -b/-j\n"
 "      option.\n"
+"--checkpoint <file>  Save the fully symbolized flat sample list in <file>\n"
+"                     when it doesn't exist, and rebuild the report from it\n"
+"                     when it does, instead of reading the record file again.\n"
+"                     Sort keys and filter options can change between runs.\n"
+"                     It can't be used with -b/-g/--children, which need\n"
+"                     information not kept in the checkpoint.\n"
 "--children    Print the overhead accumulated by appearing in the callchain.\n"
 "--comms comm1,comm2,...   Report only for selected comms.\n"
 "--dsos dso1,dso2,...      Report only for selected dsos.\n"
+"--folded    Print folded stack lines instead of the normal report: one line\n"
+"            per distinct call stack, containing the thread name and the\n"
+"            symbols from the outermost caller to the sampled function,\n"
+"            separated by ';' and followed by the event count of the stack.\n"
+"            The output can be fed directly to flame graph renderers. It\n"
+"            can't be used with -b/-g options.\n"
 "-g [callee|caller]    Print call graph. If callee mode is used, the graph\n"
 "                      shows how functions are called from others. Otherwise,\n"
 "                      the graph shows how functions call others.\n"
 "                      Default is caller mode.\n"
 "-i <file>  Specify path of record file, default is perf.data.\n"
 "--kallsyms <file>     Set the file to read kernel symbols.\n"
+"--max-callchain-nodes <count>  Bound the number of nodes kept in the\n"
+"                      callchain tree of each sample. When the limit is\n"
+"                      exceeded, call chains with small periods are folded\n"
+"                      into their prefix. It bounds report memory on records\n"
+"                      with many distinct call chains, at the cost of\n"
+"                      dropping cold chains from the call graph.\n"
 "--max-stack <frames>  Set max stack frames shown when printing call graph.\n"
 "-n         Print the sample count for each item.\n"
 "--no-demangle         Don't demangle symbol names.\n"
 "--no-show-ip          Don't show vaddr in file for unknown symbols.\n"
 "-o report_file_name   Set report file name, default is stdout.\n"
+"--parallel nthreads   Build the sample tree with nthreads worker threads.\n"
+"                      Sample records are sharded by thread id, and the\n"
+"                      per worker sample trees are merged after reading the\n"
+"                      record file.\n"
 "--percent-limit <percent>  Set min percentage shown when printing call graph.\n"
 "--pids pid1,pid2,...  Report only for selected pids.\n"
 "--raw-period          Report period count instead of period percentage.\n"
@@ -336,9 +423,17 @@ class ReportCommand : public Command {
 "                        symbol_to       -- name of function branched to\n"
 "                      The default sort keys are:\n"
 "                        comm,pid,tid,dso,symbol\n"
+"--symbol-cache <dir>  Cache symbol tables in <dir>, keyed by build id. Later\n"
+"                      report invocations load symbols from the cache instead\n"
+"                      of re-parsing ELF files.\n"
 "--symbols symbol1;symbol2;...    Report only for selected symbols.\n"
 "--symfs <dir>         Look for files with symbols relative to this directory.\n"
 "--tids tid1,tid2,...  Report only for selected tids.\n"
+"--time begin,end      Report only samples with timestamps in [begin, end).\n"
+"                      Times are in nanoseconds, as shown for the records by\n"
+"                      `simpleperf dump`. Record files with a record time\n"
+"                      index (written by default) are read from near begin\n"
+"                      instead of being parsed from the start.\n"
 "--vmlinux <file>      Parse kernel symbols from <file>.\n"
             // clang-format on
             ),
@@ -348,10 +443,16 @@ class ReportCommand : public Command {
         system_wide_collection_(false),
         accumulate_callchain_(false),
         print_callgraph_(false),
+        print_folded_stacks_(false),
         callgraph_show_callee_(false),
         callgraph_max_stack_(UINT32_MAX),
         callgraph_percent_limit_(0),
-        raw_period_(false) {}
+        max_callchain_nodes_(0),
+        raw_period_(false),
+        parallel_thread_count_(0),
+        time_filter_(false),
+        begin_time_(0),
+        end_time_(0) {}
 
   bool Run(const std::vector<std::string>& args);
 
@@ -360,10 +461,23 @@ class ReportCommand : public Command {
   bool ReadEventAttrFromRecordFile();
   bool ReadFeaturesFromRecordFile();
   bool ReadSampleTreeFromRecordFile();
+  bool ReadSampleTreeInParallel();
+  // Pass the data section records to [callback], restricted to the --time
+  // range when one is set.
+  bool ReadRecordFileData(
+      const std::function<bool(std::unique_ptr<Record>)>& callback);
   bool ProcessRecord(std::unique_ptr<Record> record);
   bool ProcessTracingData(const std::vector<char>& data);
+  bool UseCheckpoint() const { return !checkpoint_filename_.empty(); }
+  bool SaveCheckpoint();
+  bool LoadCheckpoint();
+  void AggregateCheckpointTrees();
+  SampleTree AggregateCheckpointSamples(
+      const std::vector<SampleEntry*>& samples);
+  bool FilterCheckpointSample(const SampleEntry* sample);
   bool PrintReport();
   void PrintReportContext(FILE* fp);
+  void PrintFoldedStacks(FILE* fp, const SampleTree& sample_tree);
 
   std::string record_filename_;
   ArchType record_file_arch_;
@@ -382,10 +496,47 @@ class ReportCommand : public Command {
   bool system_wide_collection_;
   bool accumulate_callchain_;
   bool print_callgraph_;
+  bool print_folded_stacks_;
   bool callgraph_show_callee_;
   uint32_t callgraph_max_stack_;
   double callgraph_percent_limit_;
+  size_t max_callchain_nodes_;
   bool raw_period_;
+  size_t parallel_thread_count_;
+  // When time_filter_ is set, report only samples with timestamps in
+  // [begin_time_, end_time_).
+  bool time_filter_;
+  uint64_t begin_time_;
+  uint64_t end_time_;
+
+  // When not empty, save the symbolized flat sample list in this file, or
+  // rebuild the report from it if it already exists.
+  std::string checkpoint_filename_;
+  // The comparator built from the sort keys. Checkpointed sample trees are
+  // built under the full key set and re-aggregated with this comparator.
+  SampleComparator<SampleEntry> report_comparator_;
+  // Filters applied when aggregating checkpointed samples. The checkpoint
+  // file itself keeps all samples, so later runs can filter differently.
+  std::unordered_set<int> checkpoint_pid_filter_;
+  std::unordered_set<int> checkpoint_tid_filter_;
+  std::unordered_set<std::string> checkpoint_comm_filter_;
+  std::unordered_set<std::string> checkpoint_dso_filter_;
+  std::unordered_set<std::string> checkpoint_symbol_filter_;
+  // Objects backing the sample entries loaded from a checkpoint file, taking
+  // the place of the thread tree.
+  struct CheckpointStorage {
+    std::set<std::string> comms;
+    std::vector<std::unique_ptr<Dso>> dsos;
+    // One map covering the whole address space per dso.
+    std::deque<MapEntry> maps;
+    std::map<std::string, const MapEntry*> map_index;  // keyed by dso path
+    std::deque<Symbol> symbols;
+    std::map<std::string, const Symbol*> symbol_index;
+    std::deque<ThreadEntry> threads;
+    std::map<std::pair<int, int>, const ThreadEntry*> thread_index;
+    std::vector<std::unique_ptr<SampleEntry>> samples;
+  };
+  CheckpointStorage checkpoint_storage_;
 
   std::string report_filename_;
 };
@@ -396,7 +547,21 @@ bool ReportCommand::Run(const std::vector<std::string>& args) {
     return false;
   }
 
-  // 2. Read record file and build SampleTree.
+  // 2. Rebuild the report from the checkpoint file when there is one.
+  if (UseCheckpoint() && IsRegularFile(checkpoint_filename_)) {
+    if (LoadCheckpoint()) {
+      return PrintReport();
+    }
+    LOG(WARNING) << "failed to load checkpoint " << checkpoint_filename_
+                 << ", rebuilding it from " << record_filename_;
+    event_attrs_.clear();
+    sample_tree_.clear();
+    record_cmdline_.clear();
+    record_file_arch_ = GetBuildArch();
+    checkpoint_storage_ = CheckpointStorage();
+  }
+
+  // 3. Read record file and build SampleTree.
   record_file_reader_ = RecordFileReader::CreateInstance(record_filename_);
   if (record_file_reader_ == nullptr) {
     return false;
@@ -412,8 +577,15 @@ bool ReportCommand::Run(const std::vector<std::string>& args) {
   if (!ReadSampleTreeFromRecordFile()) {
     return false;
   }
+  if (UseCheckpoint()) {
+    // Save before aggregating, as aggregation merges entries in place.
+    if (!SaveCheckpoint()) {
+      return false;
+    }
+    AggregateCheckpointTrees();
+  }
 
-  // 3. Show collected information.
+  // 4. Show collected information.
   if (!PrintReport()) {
     return false;
   }
@@ -432,6 +604,11 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
   for (size_t i = 0; i < args.size(); ++i) {
     if (args[i] == "-b") {
       use_branch_address_ = true;
+    } else if (args[i] == "--checkpoint") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      checkpoint_filename_ = args[i];
     } else if (args[i] == "--children") {
       accumulate_callchain_ = true;
     } else if (args[i] == "--comms" || args[i] == "--dsos") {
@@ -444,6 +621,9 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       std::vector<std::string> strs = android::base::Split(args[i], ",");
       filter.insert(strs.begin(), strs.end());
 
+    } else if (args[i] == "--folded") {
+      print_folded_stacks_ = true;
+      accumulate_callchain_ = true;
     } else if (args[i] == "-g") {
       print_callgraph_ = true;
       accumulate_callchain_ = true;
@@ -474,6 +654,15 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
         return false;
       }
       Dso::SetKallsyms(kallsyms);
+    } else if (args[i] == "--max-callchain-nodes") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!android::base::ParseUint(args[i].c_str(), &max_callchain_nodes_) ||
+          max_callchain_nodes_ == 0) {
+        LOG(ERROR) << "invalid arg for --max-callchain-nodes: " << args[i];
+        return false;
+      }
     } else if (args[i] == "--max-stack") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -494,6 +683,15 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
         return false;
       }
       report_filename_ = args[i];
+    } else if (args[i] == "--parallel") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!android::base::ParseUint(args[i].c_str(), &parallel_thread_count_) ||
+          parallel_thread_count_ == 0) {
+        LOG(ERROR) << "invalid arg for --parallel: " << args[i];
+        return false;
+      }
     } else if (args[i] == "--percent-limit") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -526,6 +724,13 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
         return false;
       }
       sort_keys = android::base::Split(args[i], ",");
+    } else if (args[i] == "--symbol-cache") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!Dso::SetSymbolCacheDir(args[i])) {
+        return false;
+      }
     } else if (args[i] == "--symbols") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -538,6 +743,19 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       }
       symfs_dir = args[i];
 
+    } else if (args[i] == "--time") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      std::vector<std::string> strs = android::base::Split(args[i], ",");
+      if (strs.size() != 2 ||
+          !android::base::ParseUint(strs[0].c_str(), &begin_time_) ||
+          !android::base::ParseUint(strs[1].c_str(), &end_time_) ||
+          begin_time_ >= end_time_) {
+        LOG(ERROR) << "invalid arg for --time: " << args[i];
+        return false;
+      }
+      time_filter_ = true;
     } else if (args[i] == "--vmlinux") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -549,6 +767,11 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
     }
   }
 
+  if (print_folded_stacks_ && (use_branch_address_ || print_callgraph_)) {
+    LOG(ERROR) << "--folded can't be used with -b/-g options.";
+    return false;
+  }
+
   Dso::SetDemangle(demangle);
   if (!Dso::SetSymFsDir(symfs_dir)) {
     return false;
@@ -590,34 +813,34 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       return false;
     }
     if (key == "pid") {
-      comparator.AddCompareFunction(ComparePid);
+      comparator.AddCompareFunction(ComparePid, HashPid);
       displayer.AddDisplayFunction("Pid", DisplayPid);
     } else if (key == "tid") {
-      comparator.AddCompareFunction(CompareTid);
+      comparator.AddCompareFunction(CompareTid, HashTid);
       displayer.AddDisplayFunction("Tid", DisplayTid);
     } else if (key == "comm") {
-      comparator.AddCompareFunction(CompareComm);
+      comparator.AddCompareFunction(CompareComm, HashComm);
       displayer.AddDisplayFunction("Command", DisplayComm);
     } else if (key == "dso") {
-      comparator.AddCompareFunction(CompareDso);
+      comparator.AddCompareFunction(CompareDso, HashDso);
       displayer.AddDisplayFunction("Shared Object", DisplayDso);
     } else if (key == "symbol") {
-      comparator.AddCompareFunction(CompareSymbol);
+      comparator.AddCompareFunction(CompareSymbol, HashSymbol);
       displayer.AddDisplayFunction("Symbol", DisplaySymbol);
     } else if (key == "vaddr_in_file") {
-      comparator.AddCompareFunction(CompareVaddrInFile);
+      comparator.AddCompareFunction(CompareVaddrInFile, HashVaddrInFile);
       displayer.AddDisplayFunction("VaddrInFile", DisplayVaddrInFile);
     } else if (key == "dso_from") {
-      comparator.AddCompareFunction(CompareDsoFrom);
+      comparator.AddCompareFunction(CompareDsoFrom, HashDsoFrom);
       displayer.AddDisplayFunction("Source Shared Object", DisplayDsoFrom);
     } else if (key == "dso_to") {
-      comparator.AddCompareFunction(CompareDso);
+      comparator.AddCompareFunction(CompareDso, HashDso);
       displayer.AddDisplayFunction("Target Shared Object", DisplayDso);
     } else if (key == "symbol_from") {
-      comparator.AddCompareFunction(CompareSymbolFrom);
+      comparator.AddCompareFunction(CompareSymbolFrom, HashSymbolFrom);
       displayer.AddDisplayFunction("Source Symbol", DisplaySymbolFrom);
     } else if (key == "symbol_to") {
-      comparator.AddCompareFunction(CompareSymbol);
+      comparator.AddCompareFunction(CompareSymbol, HashSymbol);
       displayer.AddDisplayFunction("Target Symbol", DisplaySymbol);
     } else {
       LOG(ERROR) << "Unknown sort key: " << key;
@@ -645,7 +868,47 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
     }
   }
 
-  sample_tree_builder_options_.comparator = comparator;
+  if (UseCheckpoint()) {
+    if (use_branch_address_ || accumulate_callchain_) {
+      LOG(ERROR) << "--checkpoint can't be used with -b/-g/--children/--folded "
+                    "options.";
+      return false;
+    }
+    if (time_filter_) {
+      // The flat sample list keeps no timestamps, so a time filter baked
+      // into a checkpoint would silently apply to later runs.
+      LOG(ERROR) << "--checkpoint can't be used with --time.";
+      return false;
+    }
+    report_comparator_ = comparator;
+    // Build checkpointed sample trees under the full key set, so the entries
+    // can be re-aggregated under whatever sort keys later runs select.
+    SampleComparator<SampleEntry> checkpoint_comparator;
+    checkpoint_comparator.AddCompareFunction(ComparePid, HashPid);
+    checkpoint_comparator.AddCompareFunction(CompareTid, HashTid);
+    checkpoint_comparator.AddCompareFunction(CompareComm, HashComm);
+    checkpoint_comparator.AddCompareFunction(CompareDso, HashDso);
+    checkpoint_comparator.AddCompareFunction(CompareSymbol, HashSymbol);
+    checkpoint_comparator.AddCompareFunction(CompareVaddrInFile,
+                                             HashVaddrInFile);
+    sample_tree_builder_options_.comparator = checkpoint_comparator;
+    // Apply filters when aggregating instead of when building the trees,
+    // keeping all samples in the checkpoint.
+    checkpoint_pid_filter_ = std::move(sample_tree_builder_options_.pid_filter);
+    checkpoint_tid_filter_ = std::move(sample_tree_builder_options_.tid_filter);
+    checkpoint_comm_filter_ =
+        std::move(sample_tree_builder_options_.comm_filter);
+    checkpoint_dso_filter_ = std::move(sample_tree_builder_options_.dso_filter);
+    checkpoint_symbol_filter_ =
+        std::move(sample_tree_builder_options_.symbol_filter);
+    sample_tree_builder_options_.pid_filter.clear();
+    sample_tree_builder_options_.tid_filter.clear();
+    sample_tree_builder_options_.comm_filter.clear();
+    sample_tree_builder_options_.dso_filter.clear();
+    sample_tree_builder_options_.symbol_filter.clear();
+  } else {
+    sample_tree_builder_options_.comparator = comparator;
+  }
   sample_tree_builder_options_.thread_tree = &thread_tree_;
 
   SampleComparator<SampleEntry> sort_comparator;
@@ -725,28 +988,163 @@ bool ReportCommand::ReadFeaturesFromRecordFile() {
   return true;
 }
 
+bool ReportCommand::ReadRecordFileData(
+    const std::function<bool(std::unique_ptr<Record>)>& callback) {
+  if (time_filter_) {
+    return record_file_reader_->ReadDataSectionTimeRange(begin_time_,
+                                                         end_time_, callback);
+  }
+  return record_file_reader_->ReadDataSection(callback);
+}
+
 bool ReportCommand::ReadSampleTreeFromRecordFile() {
   sample_tree_builder_options_.use_branch_address = use_branch_address_;
   // Normally do strict arch check when unwinding stack. But allow unwinding
   // 32-bit processes on 64-bit devices for system wide profiling.
   sample_tree_builder_options_.strict_unwind_arch_check = !system_wide_collection_;
   sample_tree_builder_options_.accumulate_callchain = accumulate_callchain_;
-  sample_tree_builder_options_.build_callchain = print_callgraph_;
-  sample_tree_builder_options_.use_caller_as_callchain_root = !callgraph_show_callee_;
+  sample_tree_builder_options_.build_callchain =
+      print_callgraph_ || print_folded_stacks_;
+  // Folded output collects whole stacks from the trees of their leaf entries,
+  // so the chains must grow from the leaf towards its callers.
+  sample_tree_builder_options_.use_caller_as_callchain_root =
+      print_folded_stacks_ ? false : !callgraph_show_callee_;
+  sample_tree_builder_options_.insert_callchain_for_leaf_only =
+      print_folded_stacks_;
+  sample_tree_builder_options_.callchain_node_limit = max_callchain_nodes_;
 
   for (size_t i = 0; i < event_attrs_.size(); ++i) {
     sample_tree_builder_.push_back(sample_tree_builder_options_.CreateSampleTreeBuilder());
   }
 
-  if (!record_file_reader_->ReadDataSection(
-          [this](std::unique_ptr<Record> record) {
-            return ProcessRecord(std::move(record));
-          })) {
+  if (parallel_thread_count_ > 1) {
+    if (!ReadSampleTreeInParallel()) {
+      return false;
+    }
+  } else if (!ReadRecordFileData([this](std::unique_ptr<Record> record) {
+               return ProcessRecord(std::move(record));
+             })) {
     return false;
   }
   for (size_t i = 0; i < sample_tree_builder_.size(); ++i) {
     sample_tree_.push_back(sample_tree_builder_[i]->GetSampleTree());
-    sample_tree_sorter_->Sort(sample_tree_.back().samples, print_callgraph_);
+    if (!UseCheckpoint()) {
+      // Checkpointed trees are sorted after being aggregated.
+      sample_tree_sorter_->Sort(sample_tree_.back().samples, print_callgraph_);
+    }
+  }
+  return true;
+}
+
+// State of a worker thread building sample trees from sample records sharded
+// to it by thread id.
+struct SampleTreeWorker {
+  std::mutex mutex;
+  std::condition_variable cond;
+  // Pairs of (attr index, sample record) waiting to be processed.
+  std::deque<std::pair<size_t, std::unique_ptr<Record>>> queue;
+  bool processing_record;
+  bool no_more_records;
+  // One sample tree builder per event attr, like sample_tree_builder_.
+  std::vector<std::unique_ptr<ReportCmdSampleTreeBuilder>> builders;
+  std::thread thread;
+
+  SampleTreeWorker() : processing_record(false), no_more_records(false) {}
+
+  void Run() {
+    while (true) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (queue.empty()) {
+        if (no_more_records) {
+          break;
+        }
+        cond.wait(lock);
+        continue;
+      }
+      auto pair = std::move(queue.front());
+      queue.pop_front();
+      processing_record = true;
+      lock.unlock();
+      cond.notify_all();
+      builders[pair.first]->ProcessSampleRecord(
+          *static_cast<const SampleRecord*>(pair.second.get()));
+      lock.lock();
+      processing_record = false;
+      lock.unlock();
+      cond.notify_all();
+    }
+  }
+
+  void WaitUntilIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!queue.empty() || processing_record) {
+      cond.wait(lock);
+    }
+  }
+};
+
+bool ReportCommand::ReadSampleTreeInParallel() {
+  // Shard sample records by thread id to worker threads, each building sample
+  // trees of its own, and merge the trees after reading the record file. All
+  // workers symbolize samples against the shared thread tree, serialized by
+  // thread_tree_lock, so merged samples compare equal across workers. Records
+  // updating the thread tree can't be applied while workers are using it, so
+  // they act as a barrier: wait until all workers are idle, then apply. Such
+  // records are almost all dumped at the start of the record file, so
+  // barriers are rare once sample records arrive.
+  constexpr size_t MAX_QUEUED_RECORDS_PER_WORKER = 4096;
+  std::mutex thread_tree_lock;
+  std::vector<std::unique_ptr<SampleTreeWorker>> workers(
+      parallel_thread_count_);
+  for (auto& worker : workers) {
+    worker.reset(new SampleTreeWorker);
+    for (size_t i = 0; i < event_attrs_.size(); ++i) {
+      worker->builders.push_back(
+          sample_tree_builder_options_.CreateSampleTreeBuilder());
+      worker->builders.back()->SetThreadTreeLock(&thread_tree_lock);
+    }
+    SampleTreeWorker* w = worker.get();
+    worker->thread = std::thread([w]() { w->Run(); });
+  }
+
+  bool result = ReadRecordFileData(
+      [&](std::unique_ptr<Record> record) {
+        if (record->type() == PERF_RECORD_SAMPLE) {
+          size_t attr_id =
+              record_file_reader_->GetAttrIndexOfRecord(record.get());
+          const auto& r = *static_cast<const SampleRecord*>(record.get());
+          SampleTreeWorker* worker =
+              workers[r.tid_data.tid % workers.size()].get();
+          std::unique_lock<std::mutex> lock(worker->mutex);
+          while (worker->queue.size() >= MAX_QUEUED_RECORDS_PER_WORKER) {
+            worker->cond.wait(lock);
+          }
+          worker->queue.emplace_back(attr_id, std::move(record));
+          lock.unlock();
+          worker->cond.notify_all();
+          return true;
+        }
+        for (auto& worker : workers) {
+          worker->WaitUntilIdle();
+        }
+        return ProcessRecord(std::move(record));
+      });
+
+  for (auto& worker : workers) {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      worker->no_more_records = true;
+    }
+    worker->cond.notify_all();
+    worker->thread.join();
+  }
+  if (!result) {
+    return false;
+  }
+  for (auto& worker : workers) {
+    for (size_t i = 0; i < event_attrs_.size(); ++i) {
+      sample_tree_builder_[i]->Merge(*worker->builders[i]);
+    }
   }
   return true;
 }
@@ -768,6 +1166,16 @@ bool ReportCommand::ProcessRecord(std::unique_ptr<Record> record) {
 
 bool ReportCommand::ProcessTracingData(const std::vector<char>& data) {
   Tracing tracing(data);
+  // Use preparsed formats if the record file carries them, skipping the parse
+  // of the event format files.
+  if (record_file_reader_->HasFeature(
+          PerfFileFormat::FEAT_TRACING_FORMAT_CACHE)) {
+    std::vector<char> cache;
+    if (record_file_reader_->ReadFeatureSection(
+            PerfFileFormat::FEAT_TRACING_FORMAT_CACHE, &cache)) {
+      tracing.LoadTracingFormatCache(cache);
+    }
+  }
   for (auto& attr : event_attrs_) {
     if (attr.attr.type == PERF_TYPE_TRACEPOINT) {
       uint64_t trace_event_id = attr.attr.config;
@@ -777,6 +1185,237 @@ bool ReportCommand::ProcessTracingData(const std::vector<char>& data) {
   return true;
 }
 
+// Serialized checkpoint files begin with this magic string. Bump the version
+// when the format changes, so stale checkpoints are rebuilt instead of
+// misparsed.
+const char CHECKPOINT_MAGIC[] = "simpleperf_report_checkpoint_v1";
+
+template <class T>
+void AppendData(std::vector<char>& data, const T& s) {
+  const char* p = reinterpret_cast<const char*>(&s);
+  data.insert(data.end(), p, p + sizeof(T));
+}
+
+void AppendData(std::vector<char>& data, const std::string& s) {
+  data.insert(data.end(), s.c_str(), s.c_str() + s.size() + 1);
+}
+
+bool ReadCheckpointString(const char*& p, const char* end, std::string* s) {
+  const char* string_end = static_cast<const char*>(memchr(p, '\0', end - p));
+  if (string_end == nullptr) {
+    return false;
+  }
+  s->assign(p, string_end);
+  p = string_end + 1;
+  return true;
+}
+
+bool ReportCommand::SaveCheckpoint() {
+  std::vector<char> data;
+  AppendData(data, std::string(CHECKPOINT_MAGIC));
+  AppendData(data, record_cmdline_);
+  AppendData(data, GetArchString(record_file_arch_));
+  AppendData(data, static_cast<uint32_t>(event_attrs_.size()));
+  for (size_t i = 0; i < event_attrs_.size(); ++i) {
+    AppendData(data, event_attrs_[i].name);
+    AppendData(data, event_attrs_[i].attr);
+    const std::vector<SampleEntry*>& samples = sample_tree_[i].samples;
+    AppendData(data, static_cast<uint64_t>(samples.size()));
+    for (const SampleEntry* s : samples) {
+      AppendData(data, static_cast<uint32_t>(s->thread->pid));
+      AppendData(data, static_cast<uint32_t>(s->thread->tid));
+      AppendData(data, std::string(s->thread_comm));
+      AppendData(data, s->map->dso->Path());
+      AppendData(data, std::string(s->symbol->Name()));
+      AppendData(data, s->vaddr_in_file);
+      AppendData(data, s->time);
+      AppendData(data, s->period);
+      AppendData(data, s->sample_count);
+    }
+  }
+  if (!android::base::WriteStringToFile(std::string(data.data(), data.size()),
+                                        checkpoint_filename_)) {
+    PLOG(ERROR) << "failed to write checkpoint file " << checkpoint_filename_;
+    return false;
+  }
+  return true;
+}
+
+bool ReportCommand::LoadCheckpoint() {
+  std::string content;
+  if (!android::base::ReadFileToString(checkpoint_filename_, &content)) {
+    PLOG(ERROR) << "failed to read checkpoint file " << checkpoint_filename_;
+    return false;
+  }
+  const char* p = content.data();
+  const char* end = p + content.size();
+  auto has_bytes = [&](size_t size) {
+    return static_cast<size_t>(end - p) >= size;
+  };
+  std::string magic;
+  if (!ReadCheckpointString(p, end, &magic) || magic != CHECKPOINT_MAGIC) {
+    LOG(ERROR) << "unrecognized checkpoint file " << checkpoint_filename_;
+    return false;
+  }
+  std::string arch;
+  if (!ReadCheckpointString(p, end, &record_cmdline_) ||
+      !ReadCheckpointString(p, end, &arch) || !has_bytes(sizeof(uint32_t))) {
+    LOG(ERROR) << "broken checkpoint file " << checkpoint_filename_;
+    return false;
+  }
+  record_file_arch_ = GetArchType(arch);
+  if (record_file_arch_ == ARCH_UNSUPPORTED) {
+    return false;
+  }
+  uint32_t attr_count;
+  MoveFromBinaryFormat(attr_count, p);
+  CheckpointStorage& storage = checkpoint_storage_;
+  for (uint32_t i = 0; i < attr_count; ++i) {
+    EventAttrWithName attr;
+    if (!ReadCheckpointString(p, end, &attr.name) ||
+        !has_bytes(sizeof(attr.attr) + sizeof(uint64_t))) {
+      LOG(ERROR) << "broken checkpoint file " << checkpoint_filename_;
+      return false;
+    }
+    MoveFromBinaryFormat(attr.attr, p);
+    event_attrs_.push_back(attr);
+    uint64_t sample_count;
+    MoveFromBinaryFormat(sample_count, p);
+    std::vector<SampleEntry*> samples;
+    for (uint64_t j = 0; j < sample_count; ++j) {
+      uint32_t pid;
+      uint32_t tid;
+      std::string comm;
+      std::string dso_path;
+      std::string symbol_name;
+      uint64_t vaddr_in_file;
+      uint64_t time;
+      uint64_t period;
+      uint64_t entry_sample_count;
+      if (!has_bytes(sizeof(uint32_t) * 2)) {
+        LOG(ERROR) << "broken checkpoint file " << checkpoint_filename_;
+        return false;
+      }
+      MoveFromBinaryFormat(pid, p);
+      MoveFromBinaryFormat(tid, p);
+      if (!ReadCheckpointString(p, end, &comm) ||
+          !ReadCheckpointString(p, end, &dso_path) ||
+          !ReadCheckpointString(p, end, &symbol_name) ||
+          !has_bytes(sizeof(uint64_t) * 4)) {
+        LOG(ERROR) << "broken checkpoint file " << checkpoint_filename_;
+        return false;
+      }
+      MoveFromBinaryFormat(vaddr_in_file, p);
+      MoveFromBinaryFormat(time, p);
+      MoveFromBinaryFormat(period, p);
+      MoveFromBinaryFormat(entry_sample_count, p);
+
+      const char* comm_str = storage.comms.insert(comm).first->c_str();
+      auto map_it = storage.map_index.find(dso_path);
+      if (map_it == storage.map_index.end()) {
+        storage.dsos.push_back(Dso::CreateDso(DSO_ELF_FILE, dso_path));
+        storage.maps.emplace_back(0, UINT64_MAX, 0, 0,
+                                  storage.dsos.back().get(), false);
+        map_it =
+            storage.map_index.emplace(dso_path, &storage.maps.back()).first;
+      }
+      auto symbol_it = storage.symbol_index.find(symbol_name);
+      if (symbol_it == storage.symbol_index.end()) {
+        storage.symbols.emplace_back(symbol_name, 0, 0);
+        symbol_it =
+            storage.symbol_index.emplace(symbol_name, &storage.symbols.back())
+                .first;
+      }
+      auto thread_key =
+          std::make_pair(static_cast<int>(pid), static_cast<int>(tid));
+      auto thread_it = storage.thread_index.find(thread_key);
+      if (thread_it == storage.thread_index.end()) {
+        storage.threads.push_back(ThreadEntry{static_cast<int>(pid),
+                                              static_cast<int>(tid), comm_str,
+                                              nullptr});
+        thread_it =
+            storage.thread_index.emplace(thread_key, &storage.threads.back())
+                .first;
+      }
+      std::unique_ptr<SampleEntry> sample(new SampleEntry(
+          time, period, 0, entry_sample_count, thread_it->second,
+          map_it->second, symbol_it->second, vaddr_in_file));
+      // A thread can change comm during its lifetime, so the comm stored in
+      // the entry can differ from the latest comm of the thread.
+      sample->thread_comm = comm_str;
+      samples.push_back(sample.get());
+      storage.samples.push_back(std::move(sample));
+    }
+    sample_tree_.push_back(AggregateCheckpointSamples(samples));
+  }
+  if (p != end) {
+    LOG(ERROR) << "broken checkpoint file " << checkpoint_filename_;
+    return false;
+  }
+  return true;
+}
+
+void ReportCommand::AggregateCheckpointTrees() {
+  for (size_t i = 0; i < sample_tree_.size(); ++i) {
+    sample_tree_[i] = AggregateCheckpointSamples(sample_tree_[i].samples);
+  }
+}
+
+SampleTree ReportCommand::AggregateCheckpointSamples(
+    const std::vector<SampleEntry*>& samples) {
+  SampleTree tree;
+  tree.total_samples = 0;
+  tree.total_period = 0;
+  SampleSet<SampleEntry> sample_set(report_comparator_);
+  for (SampleEntry* sample : samples) {
+    if (!FilterCheckpointSample(sample)) {
+      continue;
+    }
+    tree.total_samples += sample->sample_count;
+    tree.total_period += sample->period;
+    SampleEntry* found = sample_set.Find(sample);
+    if (found == nullptr) {
+      sample_set.Insert(sample);
+    } else {
+      found->period += sample->period;
+      found->accumulated_period += sample->accumulated_period;
+      found->sample_count += sample->sample_count;
+    }
+  }
+  tree.samples = sample_set.GetEntries();
+  sample_tree_sorter_->Sort(tree.samples, false);
+  return tree;
+}
+
+bool ReportCommand::FilterCheckpointSample(const SampleEntry* sample) {
+  if (!checkpoint_pid_filter_.empty() &&
+      checkpoint_pid_filter_.find(sample->thread->pid) ==
+          checkpoint_pid_filter_.end()) {
+    return false;
+  }
+  if (!checkpoint_tid_filter_.empty() &&
+      checkpoint_tid_filter_.find(sample->thread->tid) ==
+          checkpoint_tid_filter_.end()) {
+    return false;
+  }
+  if (!checkpoint_comm_filter_.empty() &&
+      checkpoint_comm_filter_.find(sample->thread_comm) ==
+          checkpoint_comm_filter_.end()) {
+    return false;
+  }
+  if (!checkpoint_dso_filter_.empty() &&
+      checkpoint_dso_filter_.find(sample->map->dso->Path()) ==
+          checkpoint_dso_filter_.end()) {
+    return false;
+  }
+  if (!checkpoint_symbol_filter_.empty() &&
+      checkpoint_symbol_filter_.find(sample->symbol->DemangledName()) ==
+          checkpoint_symbol_filter_.end()) {
+    return false;
+  }
+  return true;
+}
+
 bool ReportCommand::PrintReport() {
   std::unique_ptr<FILE, decltype(&fclose)> file_handler(nullptr, fclose);
   FILE* report_fp = stdout;
@@ -788,8 +1427,19 @@ bool ReportCommand::PrintReport() {
     }
     file_handler.reset(report_fp);
   }
-  PrintReportContext(report_fp);
+  if (!print_folded_stacks_) {
+    PrintReportContext(report_fp);
+  }
   for (size_t i = 0; i < event_attrs_.size(); ++i) {
+    if (print_folded_stacks_) {
+      // Keep the output parsable by flame graph renderers: folded stack
+      // lines only, with an event name line between multiple events.
+      if (event_attrs_.size() > 1) {
+        fprintf(report_fp, "Event: %s\n", event_attrs_[i].name.c_str());
+      }
+      PrintFoldedStacks(report_fp, sample_tree_[i]);
+      continue;
+    }
     if (i != 0) {
       fprintf(report_fp, "\n");
     }
@@ -809,6 +1459,47 @@ bool ReportCommand::PrintReport() {
   return true;
 }
 
+static void PrintFoldedCallChainNodes(
+    FILE* fp, const char* comm,
+    const std::vector<CallChainNode<SampleEntry>*>& nodes,
+    std::vector<const char*>* stack) {
+  for (auto& node : nodes) {
+    size_t stack_size = stack->size();
+    for (SampleEntry* entry : node->chain) {
+      stack->push_back(entry->symbol->DemangledName());
+    }
+    if (node->period > 0) {
+      // [stack] grows from the sampled function towards its callers, while
+      // folded lines start from the outermost caller.
+      fprintf(fp, "%s", comm);
+      for (auto it = stack->rbegin(); it != stack->rend(); ++it) {
+        fprintf(fp, ";%s", *it);
+      }
+      fprintf(fp, " %" PRIu64 "\n", node->period);
+    }
+    PrintFoldedCallChainNodes(fp, comm, node->children, stack);
+    stack->resize(stack_size);
+  }
+}
+
+void ReportCommand::PrintFoldedStacks(FILE* fp, const SampleTree& sample_tree) {
+  std::vector<const char*> stack;
+  for (SampleEntry* sample : sample_tree.samples) {
+    // Entries only appearing as callers of other entries have no period and
+    // no callchain tree, and print nothing.
+    uint64_t self_period = sample->period - sample->callchain.children_period;
+    if (self_period > 0) {
+      // Samples whose whole call stack is the sampled function itself.
+      fprintf(fp, "%s;%s %" PRIu64 "\n", sample->thread_comm,
+              sample->symbol->DemangledName(), self_period);
+    }
+    stack.clear();
+    stack.push_back(sample->symbol->DemangledName());
+    PrintFoldedCallChainNodes(fp, sample->thread_comm,
+                              sample->callchain.children, &stack);
+  }
+}
+
 void ReportCommand::PrintReportContext(FILE* report_fp) {
   if (!record_cmdline_.empty()) {
     fprintf(report_fp, "Cmdline: %s\n", record_cmdline_.c_str());
@@ -16,10 +16,19 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "system/extras/simpleperf/report_sample.pb.h"
 
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 
@@ -32,16 +41,106 @@ namespace proto = simpleperf_report_proto;
 
 namespace {
 
-class ProtobufFileWriter : public google::protobuf::io::CopyingOutputStream {
+// Writes protobuf output on a background thread. Write() copies data into the
+// current buffer, and full buffers are handed to the write thread, so
+// serializing the next samples isn't blocked on writing the previous ones to
+// disk. Two buffers are rotated between the two threads.
+class AsyncProtobufFileWriter : public google::protobuf::io::CopyingOutputStream {
  public:
-  explicit ProtobufFileWriter(FILE* out_fp) : out_fp_(out_fp) {}
+  explicit AsyncProtobufFileWriter(FILE* out_fp)
+      : out_fp_(out_fp), write_error_(false), exit_(false) {
+    buffer_.reserve(BUFFER_SIZE);
+    write_buffer_.reserve(BUFFER_SIZE);
+    write_thread_ = std::thread([this]() { WriteThread(); });
+  }
+
+  ~AsyncProtobufFileWriter() override {
+    Join();
+  }
 
   bool Write(const void* buffer, int size) override {
-    return fwrite(buffer, size, 1, out_fp_) == 1;
+    if (write_error_) {
+      return false;
+    }
+    const char* p = static_cast<const char*>(buffer);
+    while (size > 0) {
+      size_t n = std::min(static_cast<size_t>(size), BUFFER_SIZE - buffer_.size());
+      buffer_.insert(buffer_.end(), p, p + n);
+      p += n;
+      size -= n;
+      if (buffer_.size() == BUFFER_SIZE && !FlushBuffer()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Wait until all buffered data is written to out_fp_. Return false if any
+  // write failed. Should be called before checking errors on out_fp_.
+  bool Join() {
+    if (write_thread_.joinable()) {
+      if (!buffer_.empty()) {
+        FlushBuffer();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exit_ = true;
+      }
+      cond_.notify_one();
+      write_thread_.join();
+    }
+    return !write_error_;
   }
 
  private:
+  bool FlushBuffer() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Wait until the write thread has taken the previously flushed buffer.
+    cond_.wait(lock, [this]() { return write_buffer_.empty() || write_error_; });
+    if (write_error_) {
+      return false;
+    }
+    std::swap(buffer_, write_buffer_);
+    buffer_.clear();
+    lock.unlock();
+    cond_.notify_one();
+    return true;
+  }
+
+  void WriteThread() {
+    std::vector<char> data;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return !write_buffer_.empty() || exit_; });
+        if (write_buffer_.empty()) {
+          break;
+        }
+        // Swapping keeps the buffer storage alive, so both buffers are only
+        // allocated once.
+        std::swap(data, write_buffer_);
+        write_buffer_.clear();
+      }
+      cond_.notify_one();
+      if (!write_error_ && fwrite(data.data(), data.size(), 1, out_fp_) != 1) {
+        write_error_ = true;
+      }
+      data.clear();
+    }
+  }
+
+  static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
   FILE* out_fp_;
+  std::vector<char> buffer_;
+  // Protected by mutex_, and only non-empty while waiting for the write
+  // thread to take it.
+  std::vector<char> write_buffer_;
+  std::atomic<bool> write_error_;
+  bool exit_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread write_thread_;
 };
 
 class ProtobufFileReader : public google::protobuf::io::CopyingInputStream {
@@ -71,6 +170,9 @@ class ReportSampleCommand : public Command {
 "--protobuf  Use protobuf format in report_sample.proto to output samples.\n"
 "            Need to set a report_file_name when using this option.\n"
 "--show-callchain  Print callchain samples.\n"
+"--time begin,end  Report only samples with timestamps in [begin, end).\n"
+"                  Times are in nanoseconds, as shown for the records by\n"
+"                  `simpleperf dump`.\n"
             // clang-format on
             ),
         record_filename_("perf.data"),
@@ -79,7 +181,10 @@ class ReportSampleCommand : public Command {
         report_fp_(nullptr),
         coded_os_(nullptr),
         sample_count_(0),
-        lost_count_(0) {}
+        lost_count_(0),
+        time_filter_(false),
+        begin_time_(0),
+        end_time_(0) {}
 
   bool Run(const std::vector<std::string>& args) override;
 
@@ -108,8 +213,16 @@ class ReportSampleCommand : public Command {
   std::string report_filename_;
   FILE* report_fp_;
   google::protobuf::io::CodedOutputStream* coded_os_;
+  // Reused by PrintSampleRecordInProtobuf(), so the memory allocated for
+  // callchain entries of previous samples is reused instead of reallocated.
+  proto::Record sample_proto_record_;
   size_t sample_count_;
   size_t lost_count_;
+  // When time_filter_ is set, report only samples with timestamps in
+  // [begin_time_, end_time_).
+  bool time_filter_;
+  uint64_t begin_time_;
+  uint64_t end_time_;
 };
 
 bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
@@ -153,11 +266,11 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
   }
 
   // 5. Prepare protobuf output stream.
-  std::unique_ptr<ProtobufFileWriter> protobuf_writer;
+  std::unique_ptr<AsyncProtobufFileWriter> protobuf_writer;
   std::unique_ptr<google::protobuf::io::CopyingOutputStreamAdaptor> protobuf_os;
   std::unique_ptr<google::protobuf::io::CodedOutputStream> protobuf_coded_os;
   if (use_protobuf_) {
-    protobuf_writer.reset(new ProtobufFileWriter(report_fp_));
+    protobuf_writer.reset(new AsyncProtobufFileWriter(report_fp_));
     protobuf_os.reset(new google::protobuf::io::CopyingOutputStreamAdaptor(
         protobuf_writer.get()));
     protobuf_coded_os.reset(
@@ -166,10 +279,14 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
   }
 
   // 6. Read record file, and print samples online.
-  if (!record_file_reader_->ReadDataSection(
-          [this](std::unique_ptr<Record> record) {
-            return ProcessRecord(std::move(record));
-          })) {
+  auto record_callback = [this](std::unique_ptr<Record> record) {
+    return ProcessRecord(std::move(record));
+  };
+  bool read_result =
+      time_filter_ ? record_file_reader_->ReadDataSectionTimeRange(
+                         begin_time_, end_time_, record_callback)
+                   : record_file_reader_->ReadDataSection(record_callback);
+  if (!read_result) {
     return false;
   }
 
@@ -186,6 +303,11 @@ bool ReportSampleCommand::Run(const std::vector<std::string>& args) {
       return false;
     }
     protobuf_coded_os.reset(nullptr);
+    protobuf_os.reset(nullptr);
+    if (!protobuf_writer->Join()) {
+      LOG(ERROR) << "failed to write protobuf report";
+      return false;
+    }
     google::protobuf::ShutdownProtobufLibrary();
   } else {
     PrintLostSituation();
@@ -219,6 +341,19 @@ bool ReportSampleCommand::ParseOptions(const std::vector<std::string>& args) {
       use_protobuf_ = true;
     } else if (args[i] == "--show-callchain") {
       show_callchain_ = true;
+    } else if (args[i] == "--time") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      std::vector<std::string> strs = android::base::Split(args[i], ",");
+      if (strs.size() != 2 ||
+          !android::base::ParseUint(strs[0].c_str(), &begin_time_) ||
+          !android::base::ParseUint(strs[1].c_str(), &end_time_) ||
+          begin_time_ >= end_time_) {
+        LOG(ERROR) << "invalid arg for --time: " << args[i];
+        return false;
+      }
+      time_filter_ = true;
     } else {
       ReportUnknownOption(args, i);
       return false;
@@ -356,8 +491,10 @@ bool ReportSampleCommand::PrintSampleRecordInProtobuf(const SampleRecord& r) {
   uint64_t vaddr_in_file;
   uint32_t file_id;
   int32_t symbol_id;
-  proto::Record proto_record;
-  proto::Sample* sample = proto_record.mutable_sample();
+  // Clear the Sample message instead of the whole Record, as clearing the
+  // oneof in Record would free the Sample message.
+  proto::Sample* sample = sample_proto_record_.mutable_sample();
+  sample->Clear();
   sample->set_time(r.time_data.time);
   sample->set_thread_id(r.tid_data.tid);
 
@@ -404,8 +541,8 @@ bool ReportSampleCommand::PrintSampleRecordInProtobuf(const SampleRecord& r) {
       }
     }
   }
-  coded_os_->WriteLittleEndian32(proto_record.ByteSize());
-  if (!proto_record.SerializeToCodedStream(coded_os_)) {
+  coded_os_->WriteLittleEndian32(sample_proto_record_.ByteSize());
+  if (!sample_proto_record_.SerializeToCodedStream(coded_os_)) {
     LOG(ERROR) << "failed to write sample to protobuf";
     return false;
   }
@@ -81,6 +81,35 @@ TEST_F(ReportCommandTest, report_symbol_from_elf_file_with_mini_debug_info) {
   ASSERT_NE(content.find("GlobalFunc"), std::string::npos);
 }
 
+TEST_F(ReportCommandTest, parallel_option) {
+  Report(PERF_DATA, {"--parallel", "4"});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("GlobalFunc"), std::string::npos);
+}
+
+TEST_F(ReportCommandTest, symbol_cache_option) {
+  TemporaryDir tmpdir;
+  Report(PERF_DATA, {"--symbol-cache", tmpdir.path});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("GlobalFunc"), std::string::npos);
+  // Report again with symbols loaded from the populated cache.
+  Report(PERF_DATA, {"--symbol-cache", tmpdir.path});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("GlobalFunc"), std::string::npos);
+}
+
+TEST_F(ReportCommandTest, checkpoint_option) {
+  TemporaryDir tmpdir;
+  std::string checkpoint = std::string(tmpdir.path) + "/checkpoint";
+  Report(PERF_DATA, {"--checkpoint", checkpoint});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("GlobalFunc"), std::string::npos);
+  // Report again from the saved checkpoint, with different sort keys.
+  Report(PERF_DATA, {"--checkpoint", checkpoint, "--sort", "pid,symbol"});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("GlobalFunc"), std::string::npos);
+}
+
 TEST_F(ReportCommandTest, sort_option_pid) {
   Report(PERF_DATA, {"--sort", "pid"});
   ASSERT_TRUE(success);
@@ -167,6 +196,18 @@ TEST_F(ReportCommandTest, callgraph_option) {
   ASSERT_TRUE(CheckCallerMode(lines));
 }
 
+TEST_F(ReportCommandTest, max_callchain_nodes_option) {
+  // A large limit doesn't evict any call chain.
+  Report(CALLGRAPH_FP_PERF_DATA, {"-g", "--max-callchain-nodes", "1000000"});
+  ASSERT_TRUE(success);
+  ASSERT_TRUE(CheckCallerMode(lines));
+  // A small limit folds cold call chains, but the sample entries themselves
+  // are not affected.
+  Report(CALLGRAPH_FP_PERF_DATA, {"-g", "--max-callchain-nodes", "4"});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("main"), std::string::npos);
+}
+
 static bool AllItemsWithString(std::vector<std::string>& lines,
                                const std::vector<std::string>& strs) {
   size_t line_index = 0;
@@ -265,6 +265,11 @@ class StatCommand : public Command {
 "       Gather performance counter information of running [command].\n"
 "       And -a/-p/-t option can be used to change target of counter information.\n"
 "-a           Collect system-wide information.\n"
+"--cgroup cgroup_name\n"
+"                 Count events for all threads in the cgroup. cgroup_name is\n"
+"                 relative to the root of the perf_event cgroup hierarchy.\n"
+"                 One event fd is opened per cpu for the whole cgroup,\n"
+"                 instead of one per thread per cpu. Needs root privilege.\n"
 "--cpu cpu_item1,cpu_item2,...\n"
 "                 Collect information only on the selected cpus. cpu_item can\n"
 "                 be a cpu number like 1, or a cpu range like 0-3.\n"
@@ -275,6 +280,8 @@ class StatCommand : public Command {
 "--interval time_in_ms   Print stat for every time_in_ms milliseconds.\n"
 "                        Here time_in_ms may be any positive floating point\n"
 "                        number.\n"
+"--interval-only-values  Print the values of event counters per interval,\n"
+"                        instead of the accumulated values.\n"
 "-e event1[:modifier1],event2[:modifier2],...\n"
 "                 Select the event list to count. Use `simpleperf list` to find\n"
 "                 all possible event names. Modifiers can be added to define\n"
@@ -289,6 +296,10 @@ class StatCommand : public Command {
 "-o output_filename  Write report to output_filename instead of standard output.\n"
 "-p pid1,pid2,... Stat events on existing processes. Mutually exclusive with -a.\n"
 "-t tid1,tid2,... Stat events on existing threads. Mutually exclusive with -a.\n"
+"--use-group-read  Read counters of events in the same group with one syscall\n"
+"                  instead of one syscall per event. It reduces the overhead\n"
+"                  of reading counters periodically with --interval, and is\n"
+"                  most effective when events are grouped with --group.\n"
 "--verbose        Show result in verbose mode.\n"
                 // clang-format on
                 ),
@@ -297,7 +308,9 @@ class StatCommand : public Command {
         child_inherit_(true),
         duration_in_sec_(0),
         interval_in_ms_(0),
+        interval_only_values_(false),
         event_selection_set_(true),
+        use_group_read_(false),
         csv_(false) {
     // Die if parent exits.
     prctl(PR_SET_PDEATHSIG, SIGHUP, 0, 0, 0);
@@ -318,8 +331,10 @@ class StatCommand : public Command {
   bool child_inherit_;
   double duration_in_sec_;
   double interval_in_ms_;
+  bool interval_only_values_;
   std::vector<int> cpus_;
   EventSelectionSet event_selection_set_;
+  bool use_group_read_;
   std::string output_filename_;
   bool csv_;
 };
@@ -405,6 +420,11 @@ bool StatCommand::Run(const std::vector<std::string>& args) {
       return false;
     }
   }
+  // With --interval-only-values, last_counters keeps the cumulative values of
+  // the previous interval. Both vectors are reused across intervals, so after
+  // the first tick reading counters doesn't allocate counter storage.
+  std::vector<CountersInfo> last_counters;
+  std::chrono::time_point<std::chrono::steady_clock> last_print_time;
   auto print_counters = [&]() {
       auto end_time = std::chrono::steady_clock::now();
       if (!event_selection_set_.ReadCounters(&counters)) {
@@ -414,6 +434,28 @@ bool StatCommand::Run(const std::vector<std::string>& args) {
       std::chrono::duration_cast<std::chrono::duration<double>>(end_time -
                                                                 start_time)
       .count();
+      if (interval_only_values_) {
+        // Turn cumulative values into values since the last print, and
+        // remember the cumulative values for the next interval. Counters
+        // appearing later (like on cpu hotplug) start from zero.
+        duration_in_sec =
+            std::chrono::duration_cast<std::chrono::duration<double>>(
+                end_time - last_print_time).count();
+        last_print_time = end_time;
+        last_counters.resize(counters.size());
+        for (size_t i = 0; i < counters.size(); ++i) {
+          auto& cur = counters[i].counters;
+          auto& last = last_counters[i].counters;
+          last.resize(cur.size());
+          for (size_t j = 0; j < cur.size(); ++j) {
+            PerfCounter prev = last[j].counter;
+            last[j].counter = cur[j].counter;
+            cur[j].counter.value -= prev.value;
+            cur[j].counter.time_enabled -= prev.time_enabled;
+            cur[j].counter.time_running -= prev.time_running;
+          }
+        }
+      }
       if (!ShowCounters(counters, duration_in_sec, fp)) {
         return false;
       }
@@ -429,6 +471,7 @@ bool StatCommand::Run(const std::vector<std::string>& args) {
 
   // 5. Count events while workload running.
   start_time = std::chrono::steady_clock::now();
+  last_print_time = start_time;
   if (workload != nullptr && !workload->Start()) {
     return false;
   }
@@ -448,6 +491,13 @@ bool StatCommand::ParseOptions(const std::vector<std::string>& args,
   for (i = 0; i < args.size() && args[i].size() > 0 && args[i][0] == '-'; ++i) {
     if (args[i] == "-a") {
       system_wide_collection_ = true;
+    } else if (args[i] == "--cgroup") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      if (!event_selection_set_.AddMonitoredCgroup(args[i])) {
+        return false;
+      }
     } else if (args[i] == "--cpu") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -473,6 +523,8 @@ bool StatCommand::ParseOptions(const std::vector<std::string>& args,
         LOG(ERROR) << "Invalid interval: " << args[i].c_str();
         return false;
       }
+    } else if (args[i] == "--interval-only-values") {
+      interval_only_values_ = true;
     } else if (args[i] == "-e") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -516,6 +568,8 @@ bool StatCommand::ParseOptions(const std::vector<std::string>& args,
         return false;
       }
       event_selection_set_.AddMonitoredThreads(tids);
+    } else if (args[i] == "--use-group-read") {
+      use_group_read_ = true;
     } else if (args[i] == "--verbose") {
       verbose_mode_ = true;
     } else {
@@ -534,6 +588,19 @@ bool StatCommand::ParseOptions(const std::vector<std::string>& args,
     return false;
   }
 
+  if (event_selection_set_.HasMonitoredCgroup()) {
+    if (!event_selection_set_.GetMonitoredProcesses().empty() ||
+        !event_selection_set_.GetMonitoredThreads().empty()) {
+      LOG(ERROR) << "--cgroup and existing processes/threads can't be used "
+                    "at the same time.";
+      return false;
+    }
+    if (!IsRoot()) {
+      LOG(ERROR) << "Counting a cgroup needs root privilege.";
+      return false;
+    }
+  }
+
   non_option_args->clear();
   for (; i < args.size(); ++i) {
     non_option_args->push_back(args[i]);
@@ -562,6 +629,9 @@ bool StatCommand::AddDefaultMeasuredEventTypes() {
 
 void StatCommand::SetEventSelectionFlags() {
   event_selection_set_.SetInherit(child_inherit_);
+  if (use_group_read_) {
+    event_selection_set_.SetGroupReadMode();
+  }
 }
 
 bool StatCommand::ShowCounters(const std::vector<CountersInfo>& counters,
@@ -100,6 +100,12 @@ TEST(stat_cmd, group_option) {
                               "cpu-cycles:k,instructions:k", "sleep", "1"}));
 }
 
+TEST(stat_cmd, use_group_read_option) {
+  ASSERT_TRUE(StatCmd()->Run({"--use-group-read", "sleep", "1"}));
+  ASSERT_TRUE(StatCmd()->Run({"--group", "cpu-clock,page-faults",
+                              "--use-group-read", "sleep", "1"}));
+}
+
 TEST(stat_cmd, auto_generated_summary) {
   TemporaryFile tmp_file;
   ASSERT_TRUE(StatCmd()->Run({"--group", "instructions:u,instructions:k", "-o",
@@ -16,8 +16,12 @@
 
 #include "dso.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <limits>
@@ -31,12 +35,10 @@
 #include "read_elf.h"
 #include "utils.h"
 
-static OneTimeFreeAllocator symbol_name_allocator;
-
 Symbol::Symbol(const std::string& name, uint64_t addr, uint64_t len)
     : addr(addr),
       len(len),
-      name_(symbol_name_allocator.AllocateString(name)),
+      name_(GlobalStringInterner().Intern(name)),
       demangled_name_(nullptr),
       dump_id_(UINT_MAX) {}
 
@@ -46,7 +48,7 @@ const char* Symbol::DemangledName() const {
     if (s == name_) {
       demangled_name_ = name_;
     } else {
-      demangled_name_ = symbol_name_allocator.AllocateString(s);
+      demangled_name_ = GlobalStringInterner().Intern(s);
     }
   }
   return demangled_name_;
@@ -54,11 +56,12 @@ const char* Symbol::DemangledName() const {
 
 bool Dso::demangle_ = true;
 std::string Dso::symfs_dir_;
+std::string Dso::symbol_cache_dir_;
 std::string Dso::vmlinux_;
 std::string Dso::kallsyms_;
 bool Dso::read_kernel_symbols_from_proc_;
 std::unordered_map<std::string, BuildId> Dso::build_id_map_;
-size_t Dso::dso_count_;
+std::atomic<size_t> Dso::dso_count_;
 uint32_t Dso::g_dump_id_;
 
 void Dso::SetDemangle(bool demangle) { demangle_ = demangle; }
@@ -77,15 +80,23 @@ std::string Dso::Demangle(const std::string& name) {
     mangled_str += linker_prefix.size();
   }
   std::string result = name;
-  char* demangled_name = __cxa_demangle(mangled_str, nullptr, nullptr, &status);
-  if (status == 0) {
-    if (is_linker_symbol) {
-      result = std::string("[linker]") + demangled_name;
-    } else {
-      result = demangled_name;
+  // __cxa_demangle() only accepts mangled names starting with "_Z", and is
+  // expensive to call. Skip it for names it can't demangle anyway, like C
+  // and kernel symbols.
+  if (strncmp(mangled_str, "_Z", 2) == 0) {
+    char* demangled_name =
+        __cxa_demangle(mangled_str, nullptr, nullptr, &status);
+    if (status == 0) {
+      if (is_linker_symbol) {
+        result = std::string("[linker]") + demangled_name;
+      } else {
+        result = demangled_name;
+      }
+      free(demangled_name);
+      return result;
     }
-    free(demangled_name);
-  } else if (is_linker_symbol) {
+  }
+  if (is_linker_symbol) {
     result = std::string("[linker]") + mangled_str;
   }
   return result;
@@ -106,6 +117,25 @@ bool Dso::SetSymFsDir(const std::string& symfs_dir) {
   return true;
 }
 
+bool Dso::SetSymbolCacheDir(const std::string& cache_dir) {
+  std::string dirname = cache_dir;
+  if (dirname.empty()) {
+    LOG(ERROR) << "Invalid symbol cache dir ''";
+    return false;
+  }
+  if (dirname.back() != '/') {
+    dirname.push_back('/');
+  }
+  if (!IsDir(cache_dir)) {
+    if (mkdir(cache_dir.c_str(), 0755) != 0) {
+      PLOG(ERROR) << "failed to create symbol cache dir '" << cache_dir << "'";
+      return false;
+    }
+  }
+  symbol_cache_dir_ = dirname;
+  return true;
+}
+
 void Dso::SetVmlinux(const std::string& vmlinux) { vmlinux_ = vmlinux; }
 
 void Dso::SetBuildIds(
@@ -171,9 +201,10 @@ Dso::Dso(DsoType type, const std::string& path)
 Dso::~Dso() {
   if (--dso_count_ == 0) {
     // Clean up global variables when no longer used.
-    symbol_name_allocator.Clear();
+    GlobalStringInterner().Clear();
     demangle_ = true;
     symfs_dir_.clear();
+    symbol_cache_dir_.clear();
     vmlinux_.clear();
     kallsyms_.clear();
     read_kernel_symbols_from_proc_ = false;
@@ -194,6 +225,10 @@ uint32_t Dso::CreateSymbolDumpId(const Symbol* symbol) {
 }
 
 const Symbol* Dso::FindSymbol(uint64_t vaddr_in_dso) {
+  std::unique_lock<std::recursive_mutex> guard;
+  if (lock_) {
+    guard = std::unique_lock<std::recursive_mutex>(*lock_);
+  }
   if (!is_loaded_) {
     Load();
   }
@@ -218,6 +253,10 @@ const Symbol* Dso::FindSymbol(uint64_t vaddr_in_dso) {
 }
 
 const std::vector<Symbol>& Dso::GetSymbols() {
+  std::unique_lock<std::recursive_mutex> guard;
+  if (lock_) {
+    guard = std::unique_lock<std::recursive_mutex>(*lock_);
+  }
   if (!is_loaded_) {
     Load();
   }
@@ -225,15 +264,39 @@ const std::vector<Symbol>& Dso::GetSymbols() {
 }
 
 void Dso::SetSymbols(std::vector<Symbol>* symbols) {
+  std::unique_lock<std::recursive_mutex> guard;
+  if (lock_) {
+    guard = std::unique_lock<std::recursive_mutex>(*lock_);
+    if (is_loaded_ || !symbols_.empty()) {
+      // The dso is shared, and another user has already provided symbols.
+      // Keep the first copy: pointers into it may have been handed out.
+      symbols->clear();
+      return;
+    }
+  }
   symbols_ = std::move(*symbols);
   symbols->clear();
 }
 
 void Dso::AddUnknownSymbol(uint64_t vaddr_in_dso, const std::string& name) {
+  std::unique_lock<std::recursive_mutex> guard;
+  if (lock_) {
+    guard = std::unique_lock<std::recursive_mutex>(*lock_);
+  }
   unknown_symbols_.insert(std::make_pair(vaddr_in_dso, Symbol(name, vaddr_in_dso, 1)));
 }
 
+void Dso::MakeThreadSafe() {
+  if (!lock_) {
+    lock_.reset(new std::recursive_mutex);
+  }
+}
+
 uint64_t Dso::MinVirtualAddress() {
+  std::unique_lock<std::recursive_mutex> guard;
+  if (lock_) {
+    guard = std::unique_lock<std::recursive_mutex>(*lock_);
+  }
   if (min_vaddr_ == std::numeric_limits<uint64_t>::max()) {
     min_vaddr_ = 0;
     if (type_ == DSO_ELF_FILE) {
@@ -270,27 +333,47 @@ void Dso::Load() {
     dumped_symbols = std::move(symbols_);
     symbols_.clear();
   }
+  // Symbol cache files are keyed by build id, so they never go stale: a
+  // changed file has a different build id and misses the cache. The kernel
+  // entry is additionally keyed by boot time, since kaslr moves the
+  // /proc/kallsyms addresses on every boot.
+  BuildId build_id = GetExpectedBuildId();
+  std::string cache_path;
+  if (!symbol_cache_dir_.empty()) {
+    if (type_ == DSO_KERNEL) {
+      cache_path = GetKernelSymbolCachePath();
+    } else if (!build_id.IsEmpty()) {
+      cache_path = GetSymbolCachePath(build_id);
+    }
+  }
+  bool use_symbol_cache = !cache_path.empty();
+  bool loaded_from_cache = use_symbol_cache && LoadFromSymbolCache(cache_path);
   bool result = false;
-  switch (type_) {
-    case DSO_KERNEL:
-      result = LoadKernel();
-      break;
-    case DSO_KERNEL_MODULE:
-      result = LoadKernelModule();
-      break;
-    case DSO_ELF_FILE: {
-      if (std::get<0>(SplitUrlInApk(path_))) {
-        result = LoadEmbeddedElfFile();
-      } else {
-        result = LoadElfFile();
+  if (!loaded_from_cache) {
+    switch (type_) {
+      case DSO_KERNEL:
+        result = LoadKernel();
+        break;
+      case DSO_KERNEL_MODULE:
+        result = LoadKernelModule();
+        break;
+      case DSO_ELF_FILE: {
+        if (std::get<0>(SplitUrlInApk(path_))) {
+          result = LoadEmbeddedElfFile();
+        } else {
+          result = LoadElfFile();
+        }
+        break;
       }
-      break;
     }
   }
   if (result) {
     std::sort(symbols_.begin(), symbols_.end(), Symbol::CompareValueByAddr);
     FixupSymbolLength();
-  } else {
+    if (use_symbol_cache && !symbols_.empty()) {
+      SaveToSymbolCache(cache_path);
+    }
+  } else if (!loaded_from_cache) {
     symbols_.clear();
   }
 
@@ -305,6 +388,134 @@ void Dso::Load() {
   }
 }
 
+// Layout of a symbol cache file:
+// char magic[8] = "SPERFSC1";
+// uint64_t min_vaddr;
+// uint32_t symbol_count;
+// symbol_count entries of:
+//   uint64_t addr;
+//   uint64_t len;
+//   char name[];  // null-terminated
+static const char SYMBOL_CACHE_MAGIC[8] = {'S', 'P', 'E', 'R',
+                                           'F', 'S', 'C', '1'};
+
+std::string Dso::GetSymbolCachePath(const BuildId& build_id) {
+  return symbol_cache_dir_ + build_id.ToString() + ".symcache";
+}
+
+std::string Dso::GetKernelSymbolCachePath() {
+  // Only the live /proc/kallsyms path is cacheable: a vmlinux is keyed by
+  // its own build id already, and a kallsyms copy recorded in perf.data may
+  // come from another boot.
+  if (!vmlinux_.empty() || !kallsyms_.empty()) {
+    return "";
+  }
+  // Mirror the conditions under which LoadKernel() reads /proc/kallsyms, so
+  // a cache hit never returns symbols LoadKernel() would have refused.
+  BuildId expected_build_id = GetExpectedBuildId();
+  if (expected_build_id.IsEmpty() && !read_kernel_symbols_from_proc_) {
+    return "";
+  }
+  BuildId build_id;
+  if (!GetKernelBuildId(&build_id)) {
+    return "";
+  }
+  if (!expected_build_id.IsEmpty() && expected_build_id != build_id) {
+    return "";
+  }
+  uint64_t boot_time = 0;
+  std::string stat;
+  if (android::base::ReadFileToString("/proc/stat", &stat)) {
+    size_t pos = stat.find("btime ");
+    if (pos != std::string::npos) {
+      boot_time = strtoull(&stat[pos + strlen("btime ")], nullptr, 10);
+    }
+  }
+  if (boot_time == 0) {
+    return "";
+  }
+  return symbol_cache_dir_ + "kallsyms-" + build_id.ToString() + "-" +
+         std::to_string(boot_time) + ".symcache";
+}
+
+bool Dso::LoadFromSymbolCache(const std::string& cache_path) {
+  std::string data;
+  if (!android::base::ReadFileToString(cache_path, &data)) {
+    return false;
+  }
+  if (data.size() < sizeof(SYMBOL_CACHE_MAGIC) + sizeof(uint64_t) +
+                        sizeof(uint32_t) ||
+      memcmp(data.data(), SYMBOL_CACHE_MAGIC, sizeof(SYMBOL_CACHE_MAGIC)) !=
+          0) {
+    LOG(WARNING) << "ignoring malformed symbol cache file " << cache_path;
+    return false;
+  }
+  const char* p = data.data() + sizeof(SYMBOL_CACHE_MAGIC);
+  const char* end = data.data() + data.size();
+  uint64_t min_vaddr;
+  MoveFromBinaryFormat(min_vaddr, p);
+  uint32_t symbol_count;
+  MoveFromBinaryFormat(symbol_count, p);
+  std::vector<Symbol> symbols;
+  symbols.reserve(symbol_count);
+  for (uint32_t i = 0; i < symbol_count; ++i) {
+    if (p + 2 * sizeof(uint64_t) >= end) {
+      LOG(WARNING) << "ignoring truncated symbol cache file " << cache_path;
+      return false;
+    }
+    uint64_t addr;
+    uint64_t len;
+    MoveFromBinaryFormat(addr, p);
+    MoveFromBinaryFormat(len, p);
+    std::string name = p;
+    p += name.size() + 1;
+    if (p > end) {
+      LOG(WARNING) << "ignoring truncated symbol cache file " << cache_path;
+      return false;
+    }
+    symbols.emplace_back(name, addr, len);
+  }
+  symbols_ = std::move(symbols);
+  if (min_vaddr_ == std::numeric_limits<uint64_t>::max()) {
+    min_vaddr_ = min_vaddr;
+  }
+  LOG(VERBOSE) << "Read symbols of " << path_ << " from symbol cache";
+  return true;
+}
+
+void Dso::SaveToSymbolCache(const std::string& cache_path) {
+  size_t size = sizeof(SYMBOL_CACHE_MAGIC) + sizeof(uint64_t) +
+                sizeof(uint32_t) +
+                symbols_.size() * 2 * sizeof(uint64_t);
+  for (const auto& symbol : symbols_) {
+    size += strlen(symbol.Name()) + 1;
+  }
+  std::vector<char> data(size);
+  char* p = data.data();
+  MoveToBinaryFormat(SYMBOL_CACHE_MAGIC, sizeof(SYMBOL_CACHE_MAGIC), p);
+  MoveToBinaryFormat(MinVirtualAddress(), p);
+  MoveToBinaryFormat(static_cast<uint32_t>(symbols_.size()), p);
+  for (const auto& symbol : symbols_) {
+    MoveToBinaryFormat(symbol.addr, p);
+    MoveToBinaryFormat(symbol.len, p);
+    MoveToBinaryFormat(symbol.Name(), strlen(symbol.Name()) + 1, p);
+  }
+  CHECK_EQ(data.size(), static_cast<size_t>(p - data.data()));
+  const std::string& path = cache_path;
+  // Write to a temporary file and rename it, so a concurrent report process
+  // never sees a half-written cache file.
+  std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+  if (!android::base::WriteStringToFile(std::string(data.data(), data.size()),
+                                        tmp_path)) {
+    PLOG(WARNING) << "failed to write symbol cache file " << tmp_path;
+    return;
+  }
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    PLOG(WARNING) << "failed to rename symbol cache file to " << path;
+    unlink(tmp_path.c_str());
+  }
+}
+
 static bool IsKernelFunctionSymbol(const KernelSymbol& symbol) {
   return (symbol.type == 'T' || symbol.type == 't' || symbol.type == 'W' ||
           symbol.type == 'w');
@@ -476,6 +687,26 @@ void Dso::FixupSymbolLength() {
   }
 }
 
+DsoCache& DsoCache::Instance() {
+  static DsoCache cache;
+  return cache;
+}
+
+std::shared_ptr<Dso> DsoCache::FindUserDsoOrNew(const std::string& dso_path) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = dsos_.find(dso_path);
+  if (it != dsos_.end()) {
+    std::shared_ptr<Dso> dso = it->second.lock();
+    if (dso != nullptr) {
+      return dso;
+    }
+  }
+  std::shared_ptr<Dso> dso(Dso::CreateDso(DSO_ELF_FILE, dso_path).release());
+  dso->MakeThreadSafe();
+  dsos_[dso_path] = dso;
+  return dso;
+}
+
 const char* DsoTypeToString(DsoType dso_type) {
   switch (dso_type) {
     case DSO_KERNEL:
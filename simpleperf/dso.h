@@ -17,7 +17,9 @@
 #ifndef SIMPLE_PERF_DSO_H_
 #define SIMPLE_PERF_DSO_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -84,6 +86,12 @@ class Dso {
   static void SetDemangle(bool demangle);
   static std::string Demangle(const std::string& name);
   static bool SetSymFsDir(const std::string& symfs_dir);
+  // Enable an on-disk symbol cache in [cache_dir]. Loaded symbol tables are
+  // saved in files keyed by build id, and reused in later invocations instead
+  // of re-parsing ELF files. Kernel symbols read from /proc/kallsyms are
+  // cached too, keyed by kernel build id and boot time (kaslr changes the
+  // addresses on every boot). The directory is created if it doesn't exist.
+  static bool SetSymbolCacheDir(const std::string& cache_dir);
   static void SetVmlinux(const std::string& vmlinux);
   static void SetKallsyms(std::string kallsyms) {
     if (!kallsyms.empty()) {
@@ -139,14 +147,21 @@ class Dso {
   // symbol in symbol table.
   void AddUnknownSymbol(uint64_t vaddr_in_dso, const std::string& name);
 
+  // Serialize lazy loading and symbol lookups on this dso, so threads can
+  // symbolize against it concurrently. Called by DsoCache before a dso is
+  // handed out to multiple users.
+  void MakeThreadSafe();
+  bool IsThreadSafe() const { return lock_ != nullptr; }
+
  private:
   static bool demangle_;
   static std::string symfs_dir_;
+  static std::string symbol_cache_dir_;
   static std::string vmlinux_;
   static std::string kallsyms_;
   static bool read_kernel_symbols_from_proc_;
   static std::unordered_map<std::string, BuildId> build_id_map_;
-  static size_t dso_count_;
+  static std::atomic<size_t> dso_count_;
   static uint32_t g_dump_id_;
 
   Dso(DsoType type, const std::string& path);
@@ -157,6 +172,10 @@ class Dso {
   bool LoadEmbeddedElfFile();
   void FixupSymbolLength();
   BuildId GetExpectedBuildId();
+  std::string GetSymbolCachePath(const BuildId& build_id);
+  std::string GetKernelSymbolCachePath();
+  bool LoadFromSymbolCache(const std::string& cache_path);
+  void SaveToSymbolCache(const std::string& cache_path);
 
   const DsoType type_;
   // path of the shared library used by the profiled program
@@ -175,6 +194,28 @@ class Dso {
   uint32_t dump_id_;
   // Used to assign dump_id for symbols in current dso.
   uint32_t symbol_dump_id_;
+  // Serializes lazy loading and lookups when the dso is shared between
+  // threads (see MakeThreadSafe). Recursive because the loaders call other
+  // locked methods, like SaveToSymbolCache calling MinVirtualAddress.
+  std::unique_ptr<std::recursive_mutex> lock_;
+};
+
+// A process-wide cache of user (elf file) dsos for report instances that opt
+// in (see ThreadTree::UseSharedDsos). Lookups are thread-safe, and the
+// returned dsos serialize their lazy symbol loading internally, so report
+// instances running in different threads symbolize against one loaded copy.
+// Entries are refcounted: a dso stays cached while at least one user holds a
+// reference, making later opens of the same dso instant, and is freed with
+// the last reference.
+class DsoCache {
+ public:
+  static DsoCache& Instance();
+
+  std::shared_ptr<Dso> FindUserDsoOrNew(const std::string& dso_path);
+
+ private:
+  std::mutex lock_;
+  std::unordered_map<std::string, std::weak_ptr<Dso>> dsos_;
 };
 
 const char* DsoTypeToString(DsoType dso_type);
@@ -94,9 +94,41 @@ static ucontext_t BuildUContextFromRegs(const RegSet& regs __attribute__((unused
   return ucontext;
 }
 
+static BacktraceMap* BuildBacktraceMap(const ThreadEntry& thread) {
+  // The caller should have called ThreadTree::ResolveMaps() for [thread].
+  CHECK(thread.maps->pending().empty());
+  std::vector<backtrace_map_t> bt_maps(thread.maps->maps().size());
+  size_t map_index = 0;
+  for (auto& map : thread.maps->maps()) {
+    backtrace_map_t& bt_map = bt_maps[map_index++];
+    bt_map.start = map->start_addr;
+    bt_map.end = map->start_addr + map->len;
+    bt_map.offset = map->pgoff;
+    bt_map.name = map->dso->GetDebugFilePath();
+  }
+  return BacktraceMap::Create(thread.pid, bt_maps);
+}
+
+UnwindMapCache::UnwindMapCache() {}
+
+UnwindMapCache::~UnwindMapCache() {}
+
+BacktraceMap* UnwindMapCache::GetBacktraceMap(const ThreadEntry& thread) {
+  // Threads in a thread group share one MapSet, so their samples hit the same
+  // entry. MapSet versions are globally unique, so an entry can't be wrongly
+  // revalidated after its MapSet is freed and the address reused.
+  Entry& entry = cache_[thread.maps];
+  if (entry.backtrace_map == nullptr || entry.version != thread.maps->version) {
+    entry.backtrace_map.reset(BuildBacktraceMap(thread));
+    entry.version = thread.maps->version;
+  }
+  return entry.backtrace_map.get();
+}
+
 std::vector<uint64_t> UnwindCallChain(int abi, const ThreadEntry& thread,
                                       const RegSet& regs, const char* stack,
-                                      size_t stack_size, bool strict_arch_check) {
+                                      size_t stack_size, bool strict_arch_check,
+                                      UnwindMapCache* map_cache) {
   std::vector<uint64_t> result;
   ArchType arch = (abi != PERF_SAMPLE_REGS_ABI_32) ?
                       ScopedCurrentArch::GetCurrentArch() :
@@ -113,16 +145,14 @@ std::vector<uint64_t> UnwindCallChain(int abi, const ThreadEntry& thread,
   }
   uint64_t stack_addr = sp_reg_value;
 
-  std::vector<backtrace_map_t> bt_maps(thread.maps->size());
-  size_t map_index = 0;
-  for (auto& map : *thread.maps) {
-    backtrace_map_t& bt_map = bt_maps[map_index++];
-    bt_map.start = map->start_addr;
-    bt_map.end = map->start_addr + map->len;
-    bt_map.offset = map->pgoff;
-    bt_map.name = map->dso->GetDebugFilePath();
+  BacktraceMap* map;
+  std::unique_ptr<BacktraceMap> owned_map;
+  if (map_cache != nullptr) {
+    map = map_cache->GetBacktraceMap(thread);
+  } else {
+    owned_map.reset(BuildBacktraceMap(thread));
+    map = owned_map.get();
   }
-  std::unique_ptr<BacktraceMap> backtrace_map(BacktraceMap::Create(thread.pid, bt_maps));
 
   backtrace_stackinfo_t stack_info;
   stack_info.start = stack_addr;
@@ -130,7 +160,7 @@ std::vector<uint64_t> UnwindCallChain(int abi, const ThreadEntry& thread,
   stack_info.data = reinterpret_cast<const uint8_t*>(stack);
 
   std::unique_ptr<Backtrace> backtrace(
-      Backtrace::CreateOffline(thread.pid, thread.tid, backtrace_map.get(), stack_info, true));
+      Backtrace::CreateOffline(thread.pid, thread.tid, map, stack_info, true));
   ucontext_t ucontext = BuildUContextFromRegs(regs);
   if (backtrace->Unwind(0, &ucontext)) {
     for (auto it = backtrace->begin(); it != backtrace->end(); ++it) {
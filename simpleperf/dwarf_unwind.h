@@ -17,17 +17,47 @@
 #ifndef SIMPLE_PERF_DWARF_UNWIND_H_
 #define SIMPLE_PERF_DWARF_UNWIND_H_
 
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "perf_regs.h"
 
+class BacktraceMap;
+
 namespace simpleperf {
+struct MapSet;
 struct ThreadEntry;
 }
 
+using MapSet = simpleperf::MapSet;
 using ThreadEntry = simpleperf::ThreadEntry;
 
+// UnwindMapCache caches the BacktraceMap built from a thread's maps, so
+// consecutive samples of a thread whose maps haven't changed reuse the parsed
+// map state instead of rebuilding it. Entries are keyed by the thread's MapSet
+// and invalidated by its version, which ThreadTree bumps whenever the maps
+// change. It is not thread safe; use one cache per unwinding thread.
+class UnwindMapCache {
+ public:
+  UnwindMapCache();
+  ~UnwindMapCache();
+
+  // Return the cached BacktraceMap for [thread], rebuilding it if the thread's
+  // maps have changed since the last call.
+  BacktraceMap* GetBacktraceMap(const ThreadEntry& thread);
+
+ private:
+  struct Entry {
+    uint64_t version = 0;
+    std::unique_ptr<BacktraceMap> backtrace_map;
+  };
+
+  std::unordered_map<const MapSet*, Entry> cache_;
+};
+
 std::vector<uint64_t> UnwindCallChain(int abi, const ThreadEntry& thread, const RegSet& regs,
-                                      const char* stack, size_t stack_size, bool strict_arch_check);
+                                      const char* stack, size_t stack_size, bool strict_arch_check,
+                                      UnwindMapCache* map_cache = nullptr);
 
 #endif  // SIMPLE_PERF_DWARF_UNWIND_H_
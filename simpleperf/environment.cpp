@@ -21,8 +21,11 @@
 #include <stdlib.h>
 #include <sys/utsname.h>
 
+#include <algorithm>
+#include <atomic>
 #include <limits>
 #include <set>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -297,6 +300,51 @@ bool GetThreadMmapsInProcess(pid_t pid, std::vector<ThreadMmap>* thread_mmaps) {
   return true;
 }
 
+static void SnapshotProcess(pid_t pid, ProcessSnapshot* snapshot) {
+  snapshot->pid = pid;
+  if (!GetThreadMmapsInProcess(pid, &snapshot->mmaps)) {
+    // The process may exit before we read its map file.
+    snapshot->mmaps.clear();
+    return;
+  }
+  GetThreadName(pid, &snapshot->name);
+  for (const auto& tid : GetThreadsInProcess(pid)) {
+    if (tid == pid) {
+      continue;
+    }
+    std::string name;
+    if (GetThreadName(tid, &name)) {
+      snapshot->threads.push_back(std::make_pair(tid, name));
+    }
+  }
+}
+
+std::vector<ProcessSnapshot> SnapshotProcesses(const std::vector<pid_t>& pids) {
+  std::vector<ProcessSnapshot> result(pids.size());
+  std::atomic<size_t> next_pos(0);
+  auto snapshot_processes = [&]() {
+    size_t pos;
+    while ((pos = next_pos.fetch_add(1)) < pids.size()) {
+      SnapshotProcess(pids[pos], &result[pos]);
+    }
+  };
+  // Reading /proc files is dominated by the kernel generating their content,
+  // so a few threads are enough to hide the latency.
+  size_t thread_count = std::min<size_t>(4, pids.size());
+  if (thread_count <= 1) {
+    snapshot_processes();
+    return result;
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back(snapshot_processes);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return result;
+}
+
 bool GetKernelBuildId(BuildId* build_id) {
   ElfStatus result = GetBuildIdFromNoteFile("/sys/kernel/notes", build_id);
   if (result != ElfStatus::NO_ERROR) {
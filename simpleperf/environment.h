@@ -28,6 +28,7 @@
 #include <functional>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "build_id.h"
@@ -55,6 +56,22 @@ struct ThreadMmap {
 
 bool GetThreadMmapsInProcess(pid_t pid, std::vector<ThreadMmap>* thread_mmaps);
 
+// State of one process needed to synthesize its COMM/MMAP/FORK records.
+struct ProcessSnapshot {
+  pid_t pid;
+  std::string name;
+  std::vector<ThreadMmap> mmaps;
+  // Threads of the process other than the main thread, as (tid, name) pairs.
+  std::vector<std::pair<pid_t, std::string>> threads;
+};
+
+// Snapshot the name, map file and threads of all processes in [pids] with a
+// small pool of worker threads, instead of reading /proc entry by entry while
+// emitting records. The returned vector is parallel to [pids]; the entry of a
+// process whose map file can't be read (like when the process has exited) has
+// an empty [mmaps].
+std::vector<ProcessSnapshot> SnapshotProcesses(const std::vector<pid_t>& pids);
+
 constexpr char DEFAULT_KERNEL_FILENAME_FOR_BUILD_ID[] = "[kernel.kallsyms]";
 
 bool GetKernelBuildId(BuildId* build_id);
@@ -46,7 +46,8 @@ static int perf_event_open(const perf_event_attr& attr, pid_t pid, int cpu,
 std::unique_ptr<EventFd> EventFd::OpenEventFile(const perf_event_attr& attr,
                                                 pid_t tid, int cpu,
                                                 EventFd* group_event_fd,
-                                                bool report_error) {
+                                                bool report_error,
+                                                unsigned long flags) {  // NOLINT
   std::string event_name = GetEventNameByAttr(attr);
   int group_fd = -1;
   if (group_event_fd != nullptr) {
@@ -60,7 +61,7 @@ std::unique_ptr<EventFd> EventFd::OpenEventFile(const perf_event_attr& attr,
       real_attr.sample_freq = max_sample_freq;
     }
   }
-  int perf_event_fd = perf_event_open(real_attr, tid, cpu, group_fd, 0);
+  int perf_event_fd = perf_event_open(real_attr, tid, cpu, group_fd, flags);
   if (perf_event_fd == -1) {
     if (report_error) {
       PLOG(ERROR) << "open perf_event_file (event " << event_name << ", tid "
@@ -139,6 +140,37 @@ bool EventFd::ReadCounter(PerfCounter* counter) const {
   return true;
 }
 
+bool EventFd::ReadGroupCounters(size_t event_count,
+                                std::vector<PerfCounter>* counters) const {
+  CHECK(attr_.read_format & PERF_FORMAT_GROUP);
+  // The layout of a group read with read_format PERF_FORMAT_TOTAL_TIME_ENABLED
+  // | PERF_FORMAT_TOTAL_TIME_RUNNING | PERF_FORMAT_ID | PERF_FORMAT_GROUP is:
+  //   u64 nr;
+  //   u64 time_enabled;
+  //   u64 time_running;
+  //   { u64 value; u64 id; } values[nr];
+  std::vector<uint64_t> buf(3 + 2 * event_count);
+  if (!android::base::ReadFully(perf_event_fd_, buf.data(),
+                                buf.size() * sizeof(uint64_t))) {
+    PLOG(ERROR) << "ReadGroupCounters from " << Name() << " failed";
+    return false;
+  }
+  if (buf[0] != event_count) {
+    LOG(ERROR) << "ReadGroupCounters from " << Name() << " returned " << buf[0]
+               << " counters, expected " << event_count;
+    return false;
+  }
+  counters->resize(event_count);
+  for (size_t i = 0; i < event_count; ++i) {
+    PerfCounter& counter = (*counters)[i];
+    counter.value = buf[3 + 2 * i];
+    counter.time_enabled = buf[1];
+    counter.time_running = buf[2];
+    counter.id = buf[4 + 2 * i];
+  }
+  return true;
+}
+
 bool EventFd::CreateMappedBuffer(size_t mmap_pages, bool report_error) {
   CHECK(IsPowerOfTwo(mmap_pages));
   size_t page_size = sysconf(_SC_PAGE_SIZE);
@@ -193,6 +225,10 @@ void EventFd::DestroyMappedBuffer() {
   }
 }
 
+size_t EventFd::MmapPageCount() const {
+  return mmap_data_buffer_size_ / sysconf(_SC_PAGE_SIZE);
+}
+
 size_t EventFd::GetAvailableMmapData(std::vector<char>& buffer, size_t& buffer_pos) {
   if (!HasMappedBuffer()) {
     return 0;
@@ -250,11 +286,34 @@ size_t EventFd::GetAvailableMmapData(std::vector<char>& buffer, size_t& buffer_p
     n = write_head;
     memcpy(to, from, n);
   }
+  CountLostRecords(&buffer[buffer_pos], read_bytes);
   buffer_pos += read_bytes;
   DiscardMmapData(read_bytes);
   return read_bytes;
 }
 
+void EventFd::CountLostRecords(const char* data, size_t size) {
+  // [data, data + size) contains complete records, as the kernel only
+  // publishes whole records and GetAvailableMmapData() consumes all of them.
+  // The layout of a lost record is:
+  //   struct { perf_event_header header; u64 id; u64 lost; };
+  const char* end = data + size;
+  while (data + sizeof(perf_event_header) <= end) {
+    perf_event_header header;
+    memcpy(&header, data, sizeof(header));
+    if (header.size < sizeof(header) ||
+        header.size > static_cast<size_t>(end - data)) {
+      break;
+    }
+    if (header.type == PERF_RECORD_LOST) {
+      uint64_t lost;
+      memcpy(&lost, data + sizeof(header) + sizeof(uint64_t), sizeof(lost));
+      lost_record_count_ += lost;
+    }
+    data += header.size;
+  }
+}
+
 void EventFd::DiscardMmapData(size_t discard_size) {
   // mb() used to ensure finish reading data before writing data_tail.
   __sync_synchronize();
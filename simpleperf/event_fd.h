@@ -28,6 +28,11 @@
 #include "IOEventLoop.h"
 #include "perf_event.h"
 
+// perf_event_open() flags are not carried by the copied perf_event.h.
+#ifndef PERF_FLAG_PID_CGROUP
+#define PERF_FLAG_PID_CGROUP (1U << 2)
+#endif
+
 struct PerfCounter {
   uint64_t value;  // The value of the event specified by the perf_event_file.
   uint64_t time_enabled;  // The enabled time.
@@ -38,10 +43,14 @@ struct PerfCounter {
 // EventFd represents an opened perf_event_file.
 class EventFd {
  public:
+  // [flags] is passed to perf_event_open(). With PERF_FLAG_PID_CGROUP,
+  // [tid] is an open fd of a cgroup directory in the perf_event hierarchy,
+  // and the event counts all threads in that cgroup on [cpu].
   static std::unique_ptr<EventFd> OpenEventFile(const perf_event_attr& attr,
                                                 pid_t tid, int cpu,
                                                 EventFd* group_event_fd,
-                                                bool report_error = true);
+                                                bool report_error = true,
+                                                unsigned long flags = 0);  // NOLINT
 
   ~EventFd();
 
@@ -62,6 +71,13 @@ class EventFd {
 
   bool ReadCounter(PerfCounter* counter) const;
 
+  // Read counters of all [event_count] events in the group led by this event
+  // file with one read() syscall. It is only valid when PERF_FORMAT_GROUP is
+  // set in attr.read_format. Counters are returned in the order the events
+  // were added to the group.
+  bool ReadGroupCounters(size_t event_count,
+                         std::vector<PerfCounter>* counters) const;
+
   // Create mapped buffer used to receive records sent by the kernel.
   // mmap_pages should be power of 2.
   bool CreateMappedBuffer(size_t mmap_pages, bool report_error);
@@ -74,10 +90,22 @@ class EventFd {
 
   void DestroyMappedBuffer();
 
+  // Number of pages in the mapped buffer.
+  size_t MmapPageCount() const;
+
   // When the kernel writes new sampled records to the mapped area, we can get
   // them by returning the start address and size of the data.
   size_t GetAvailableMmapData(std::vector<char>& buffer, size_t& buffer_pos);
 
+  // Return the number of records the kernel reported as lost since the last
+  // call, counted from PERF_RECORD_LOST records seen by
+  // GetAvailableMmapData(). Lost records mean the mapped buffer overflowed.
+  uint64_t GetAndResetLostRecordCount() {
+    uint64_t count = lost_record_count_;
+    lost_record_count_ = 0;
+    return count;
+  }
+
   // [callback] is called when there is data available in the mapped buffer.
   bool StartPolling(IOEventLoop& loop, const std::function<bool()>& callback);
   bool StopPolling();
@@ -96,12 +124,16 @@ class EventFd {
         mmap_metadata_page_(nullptr),
         mmap_data_buffer_(nullptr),
         mmap_data_buffer_size_(0),
+        lost_record_count_(0),
         ioevent_ref_(nullptr) {}
 
   // Discard how much data we have read, so the kernel can reuse this part of
   // mapped area to store new data.
   void DiscardMmapData(size_t discard_size);
 
+  // Count lost records in the records stored in [data, data + size).
+  void CountLostRecords(const char* data, size_t size);
+
   const perf_event_attr attr_;
   int perf_event_fd_;
   mutable uint64_t id_;
@@ -115,6 +147,7 @@ class EventFd {
   char* mmap_data_buffer_;  // Starting from the second page of mmap_area,
                             // containing records written by then kernel.
   size_t mmap_data_buffer_size_;
+  uint64_t lost_record_count_;
 
   // As mmap_data_buffer is a ring buffer, it is possible that one record is
   // wrapped at the end of the buffer. So we need to copy records from
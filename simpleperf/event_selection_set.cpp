@@ -16,7 +16,14 @@
 
 #include "event_selection_set.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 
 #include "environment.h"
 #include "event_attr.h"
@@ -97,6 +104,59 @@ bool EventSelectionSet::BuildAndCheckEventSelection(
   return true;
 }
 
+EventSelectionSet::~EventSelectionSet() {
+  if (cgroup_fd_ != -1) {
+    close(cgroup_fd_);
+  }
+}
+
+// Find where the perf_event cgroup hierarchy is mounted, like
+// /sys/fs/cgroup/perf_event.
+static std::string FindPerfEventCgroupDir() {
+  std::string data;
+  if (!android::base::ReadFileToString("/proc/mounts", &data)) {
+    return "";
+  }
+  // Mount entries look like:
+  //   cgroup /sys/fs/cgroup/perf_event cgroup rw,relatime,perf_event 0 0
+  for (const auto& line : android::base::Split(data, "\n")) {
+    std::vector<std::string> fields = android::base::Split(line, " ");
+    if (fields.size() >= 4 && fields[2] == "cgroup") {
+      std::vector<std::string> options = android::base::Split(fields[3], ",");
+      if (std::find(options.begin(), options.end(), "perf_event") !=
+          options.end()) {
+        return fields[1];
+      }
+    }
+  }
+  return "";
+}
+
+bool EventSelectionSet::AddMonitoredCgroup(const std::string& cgroup) {
+  if (cgroup_fd_ != -1) {
+    LOG(ERROR) << "only one cgroup can be monitored";
+    return false;
+  }
+  std::string dir = FindPerfEventCgroupDir();
+  if (dir.empty()) {
+    LOG(ERROR) << "can't find a mounted perf_event cgroup hierarchy";
+    return false;
+  }
+  if (!cgroup.empty() && cgroup[0] != '/') {
+    dir += '/';
+  }
+  dir += cgroup;
+  int fd = TEMP_FAILURE_RETRY(
+      open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (fd == -1) {
+    PLOG(ERROR) << "failed to open cgroup directory " << dir;
+    return false;
+  }
+  cgroup_fd_ = fd;
+  cgroup_name_ = cgroup;
+  return true;
+}
+
 bool EventSelectionSet::AddEventType(const std::string& event_name) {
   return AddEventGroup(std::vector<std::string>(1, event_name));
 }
@@ -231,6 +291,14 @@ void EventSelectionSet::SetSamplePeriod(uint64_t sample_period) {
   }
 }
 
+void EventSelectionSet::SetSamplePeriodForLastGroup(uint64_t sample_period) {
+  CHECK(!groups_.empty());
+  for (auto& selection : groups_.back()) {
+    selection.event_attr.freq = 0;
+    selection.event_attr.sample_period = sample_period;
+  }
+}
+
 void EventSelectionSet::UseDefaultSampleFreq() {
   for (auto& group : groups_) {
     for (auto& selection : group) {
@@ -310,6 +378,38 @@ void EventSelectionSet::SetInherit(bool enable) {
   }
 }
 
+void EventSelectionSet::SetClockId(int clock_id) {
+  for (auto& group : groups_) {
+    for (auto& selection : group) {
+      selection.event_attr.use_clockid = 1;
+      selection.event_attr.clockid = clock_id;
+    }
+  }
+}
+
+// Wake up readers of the mapped buffers when [wakeup_watermark] bytes are
+// ready, instead of on every event. The kernel clamps the watermark to half
+// of the mapped buffer size. It must be called before opening event files.
+void EventSelectionSet::SetWakeupWatermark(uint32_t wakeup_watermark) {
+  for (auto& group : groups_) {
+    for (auto& selection : group) {
+      selection.event_attr.watermark = 1;
+      selection.event_attr.wakeup_watermark = wakeup_watermark;
+    }
+  }
+}
+
+void EventSelectionSet::SetGroupReadMode() {
+  // Set PERF_FORMAT_GROUP only on group leaders, so one read() syscall on a
+  // leader returns the counters of all events in its group, while the other
+  // events can still be read individually with the default format (needed by
+  // EventFd::Id()).
+  for (auto& group : groups_) {
+    group[0].event_attr.read_format |= PERF_FORMAT_GROUP;
+  }
+  group_read_mode_ = true;
+}
+
 bool EventSelectionSet::NeedKernelSymbol() const {
   for (const auto& group : groups_) {
     for (const auto& selection : group) {
@@ -335,14 +435,15 @@ static bool CheckIfCpusOnline(const std::vector<int>& cpus) {
 
 bool EventSelectionSet::OpenEventFilesOnGroup(EventSelectionGroup& group,
                                               pid_t tid, int cpu,
-                                              std::string* failed_event_type) {
+                                              std::string* failed_event_type,
+                                              unsigned long flags) {  // NOLINT
   std::vector<std::unique_ptr<EventFd>> event_fds;
   // Given a tid and cpu, events on the same group should be all opened
   // successfully or all failed to open.
   EventFd* group_fd = nullptr;
   for (auto& selection : group) {
-    std::unique_ptr<EventFd> event_fd =
-        EventFd::OpenEventFile(selection.event_attr, tid, cpu, group_fd);
+    std::unique_ptr<EventFd> event_fd = EventFd::OpenEventFile(
+        selection.event_attr, tid, cpu, group_fd, true, flags);
     if (event_fd != nullptr) {
       LOG(VERBOSE) << "OpenEventFile for " << event_fd->Name();
       event_fds.push_back(std::move(event_fd));
@@ -394,6 +495,9 @@ bool EventSelectionSet::OpenEventFiles(const std::vector<int>& on_cpus) {
   } else {
     cpus = GetOnlineCpus();
   }
+  if (cgroup_fd_ != -1) {
+    return OpenEventFilesForCgroup(cpus);
+  }
   std::map<pid_t, std::set<pid_t>> process_map = PrepareThreads(processes_, threads_);
   for (auto& group : groups_) {
     if (IsUserSpaceSamplerGroup(group)) {
@@ -427,6 +531,36 @@ bool EventSelectionSet::OpenEventFiles(const std::vector<int>& on_cpus) {
   return true;
 }
 
+bool EventSelectionSet::OpenEventFilesForCgroup(const std::vector<int>& on_cpus) {
+  std::vector<int> cpus = on_cpus;
+  // A cgroup event only counts while the cgroup runs on the event's cpu, so
+  // cpu == -1 isn't accepted by the kernel; an event file is needed per cpu.
+  if (cpus.size() == 1 && cpus[0] == -1) {
+    cpus = GetOnlineCpus();
+  }
+  for (auto& group : groups_) {
+    if (IsUserSpaceSamplerGroup(group)) {
+      LOG(ERROR) << "inplace-sampler can't be used with a cgroup";
+      return false;
+    }
+    size_t success_cpu_count = 0;
+    std::string failed_event_type;
+    for (const auto& cpu : cpus) {
+      if (OpenEventFilesOnGroup(group, cgroup_fd_, cpu, &failed_event_type,
+                                PERF_FLAG_PID_CGROUP)) {
+        success_cpu_count++;
+      }
+    }
+    if (success_cpu_count == 0) {
+      PLOG(ERROR) << "failed to open perf event file for event_type "
+                  << failed_event_type << " for cgroup " << cgroup_name_
+                  << " on all cpus";
+      return false;
+    }
+  }
+  return true;
+}
+
 bool EventSelectionSet::IsUserSpaceSamplerGroup(EventSelectionGroup& group) {
   return group.size() == 1 && group[0].event_attr.type == SIMPLEPERF_TYPE_USER_SPACE_SAMPLERS;
 }
@@ -460,6 +594,9 @@ static bool ReadCounter(const EventFd* event_fd, CounterInfo* counter) {
 }
 
 bool EventSelectionSet::ReadCounters(std::vector<CountersInfo>* counters) {
+  if (group_read_mode_) {
+    return ReadGroupedCounters(counters);
+  }
   counters->clear();
   for (size_t i = 0; i < groups_.size(); ++i) {
     for (auto& selection : groups_[i]) {
@@ -481,9 +618,52 @@ bool EventSelectionSet::ReadCounters(std::vector<CountersInfo>* counters) {
   return true;
 }
 
+bool EventSelectionSet::ReadGroupedCounters(
+    std::vector<CountersInfo>* counters) {
+  counters->clear();
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    EventSelectionGroup& group = groups_[i];
+    size_t counters_info_base = counters->size();
+    for (auto& selection : group) {
+      CountersInfo counters_info;
+      counters_info.group_id = i;
+      counters_info.event_name = selection.event_type_modifier.event_type.name;
+      counters_info.event_modifier = selection.event_type_modifier.modifier;
+      counters_info.counters = selection.hotplugged_counters;
+      counters->push_back(counters_info);
+    }
+    // Each event file of the group leader returns the counters of all events
+    // in the group opened for the same (tid, cpu). The event files of the
+    // members are opened in the same order as the leader's, so member fds with
+    // the same index have the same (tid, cpu).
+    for (auto& event_fd : group[0].event_fds) {
+      std::vector<PerfCounter> group_counters;
+      if (!event_fd->ReadGroupCounters(group.size(), &group_counters)) {
+        return false;
+      }
+      for (size_t j = 0; j < group.size(); ++j) {
+        CounterInfo counter;
+        counter.tid = event_fd->ThreadId();
+        counter.cpu = event_fd->Cpu();
+        counter.counter = group_counters[j];
+        (*counters)[counters_info_base + j].counters.push_back(counter);
+      }
+    }
+  }
+  return true;
+}
+
+// Number of pages to map per cpu initially when the caller allows a range of
+// buffer sizes. Buffers of cpus losing records are regrown on demand, so
+// starting small keeps the locked memory used for idle cpus low.
+static constexpr size_t INITIAL_ADAPTIVE_MMAP_PAGES = 16;
+
 bool EventSelectionSet::MmapEventFiles(size_t min_mmap_pages,
                                        size_t max_mmap_pages) {
-  for (size_t i = max_mmap_pages; i >= min_mmap_pages; i >>= 1) {
+  max_mmap_pages_ = max_mmap_pages;
+  size_t start_pages = std::max(
+      min_mmap_pages, std::min(max_mmap_pages, INITIAL_ADAPTIVE_MMAP_PAGES));
+  for (size_t i = start_pages; i >= min_mmap_pages; i >>= 1) {
     if (MmapEventFiles(i, i == min_mmap_pages)) {
       LOG(VERBOSE) << "Mapped buffer size is " << i << " pages.";
       mmap_pages_ = i;
@@ -625,9 +805,81 @@ bool EventSelectionSet::ReadMmapEventData() {
       }
     }
   }
+  return GrowMappedBuffers();
+}
+
+// Grow the mapped buffers of cpus whose rings overflowed, so hot cpus get a
+// bigger share of the locked memory budget than idle cpus.
+bool EventSelectionSet::GrowMappedBuffers() {
+  if (mmap_grow_failed_) {
+    return true;
+  }
+  // Collect the fds owning buffers first, as growing remaps buffers.
+  std::vector<EventFd*> fds_with_buffer;
+  for (auto& group : groups_) {
+    for (auto& selection : group) {
+      for (auto& event_fd : selection.event_fds) {
+        if (event_fd->HasMappedBuffer()) {
+          fds_with_buffer.push_back(event_fd.get());
+        }
+      }
+    }
+  }
+  for (auto& event_fd : fds_with_buffer) {
+    uint64_t lost = event_fd->GetAndResetLostRecordCount();
+    size_t pages = event_fd->MmapPageCount();
+    if (lost == 0 || pages >= max_mmap_pages_) {
+      continue;
+    }
+    if (!GrowMappedBuffer(event_fd, pages * 2)) {
+      return false;
+    }
+    if (mmap_grow_failed_) {
+      break;
+    }
+  }
   return true;
 }
 
+bool EventSelectionSet::GrowMappedBuffer(EventFd* fd_with_buffer,
+                                         size_t new_pages) {
+  int cpu = fd_with_buffer->Cpu();
+  size_t old_pages = fd_with_buffer->MmapPageCount();
+  // The caller has read the pending records, so no record is lost by
+  // remapping the buffer.
+  if (!fd_with_buffer->StopPolling()) {
+    return false;
+  }
+  fd_with_buffer->DestroyMappedBuffer();
+  if (fd_with_buffer->CreateMappedBuffer(new_pages, false)) {
+    LOG(VERBOSE) << "grew mapped buffer of cpu " << cpu << " to " << new_pages
+                 << " pages";
+  } else {
+    // Likely the locked memory budget is used up. Restore the old size and
+    // stop trying to grow buffers.
+    LOG(DEBUG) << "failed to grow mapped buffer of cpu " << cpu << " to "
+               << new_pages << " pages";
+    mmap_grow_failed_ = true;
+    if (!fd_with_buffer->CreateMappedBuffer(old_pages, true)) {
+      return false;
+    }
+  }
+  // Reattach the event fds sharing the remapped buffer.
+  for (auto& group : groups_) {
+    for (auto& selection : group) {
+      for (auto& event_fd : selection.event_fds) {
+        if (event_fd->Cpu() == cpu && event_fd.get() != fd_with_buffer) {
+          if (!event_fd->ShareMappedBuffer(*fd_with_buffer, true)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return fd_with_buffer->StartPolling(*loop_,
+                                      [this]() { return ReadMmapEventData(); });
+}
+
 bool EventSelectionSet::FinishReadMmapEventData() {
   if (!ReadMmapEventData()) {
     return false;
@@ -720,16 +972,38 @@ bool EventSelectionSet::HandleCpuOfflineEvent(int cpu) {
     }
   }
   for (auto& group : groups_) {
+    if (for_stat_cmd_ && group_read_mode_) {
+      // Save the counters of all events in the group by reading the group
+      // leader, before the event files of the offlined cpu are closed.
+      for (auto& event_fd : group[0].event_fds) {
+        if (event_fd->Cpu() != cpu) {
+          continue;
+        }
+        std::vector<PerfCounter> group_counters;
+        if (!event_fd->ReadGroupCounters(group.size(), &group_counters)) {
+          return false;
+        }
+        for (size_t j = 0; j < group.size(); ++j) {
+          CounterInfo counter;
+          counter.tid = event_fd->ThreadId();
+          counter.cpu = event_fd->Cpu();
+          counter.counter = group_counters[j];
+          group[j].hotplugged_counters.push_back(counter);
+        }
+      }
+    }
     for (auto& selection : group) {
       for (auto it = selection.event_fds.begin();
            it != selection.event_fds.end();) {
         if ((*it)->Cpu() == cpu) {
           if (for_stat_cmd_) {
-            CounterInfo counter;
-            if (!ReadCounter(it->get(), &counter)) {
-              return false;
+            if (!group_read_mode_) {
+              CounterInfo counter;
+              if (!ReadCounter(it->get(), &counter)) {
+                return false;
+              }
+              selection.hotplugged_counters.push_back(counter);
             }
-            selection.hotplugged_counters.push_back(counter);
           } else {
             if ((*it)->HasMappedBuffer()) {
               if (!(*it)->StopPolling()) {
@@ -750,7 +1024,14 @@ bool EventSelectionSet::HandleCpuOfflineEvent(int cpu) {
 bool EventSelectionSet::HandleCpuOnlineEvent(int cpu) {
   // We need to start profiling when opening new event files.
   SetEnableOnExec(false);
-  std::map<pid_t, std::set<pid_t>> process_map = PrepareThreads(processes_, threads_);
+  std::map<pid_t, std::set<pid_t>> process_map;
+  if (cgroup_fd_ != -1) {
+    // Cgroup events are opened per cpu with the cgroup fd as the pid.
+    process_map[cgroup_fd_].insert(cgroup_fd_);
+  } else {
+    process_map = PrepareThreads(processes_, threads_);
+  }
+  unsigned long flags = cgroup_fd_ != -1 ? PERF_FLAG_PID_CGROUP : 0;  // NOLINT
   for (auto& group : groups_) {
     if (IsUserSpaceSamplerGroup(group)) {
       continue;
@@ -758,7 +1039,8 @@ bool EventSelectionSet::HandleCpuOnlineEvent(int cpu) {
     for (const auto& pair : process_map) {
       for (const auto& tid : pair.second) {
         std::string failed_event_type;
-        if (!OpenEventFilesOnGroup(group, tid, cpu, &failed_event_type)) {
+        if (!OpenEventFilesOnGroup(group, tid, cpu, &failed_event_type,
+                                   flags)) {
           // If failed to open event files, maybe the cpu has been offlined.
           PLOG(WARNING) << "failed to open perf event file for event_type "
                         << failed_event_type << " for "
@@ -835,6 +1117,10 @@ bool EventSelectionSet::CheckMonitoredTargets() {
   if (!HasSampler()) {
     return loop_->ExitLoop();
   }
+  // A cgroup has no liveness to check; monitoring runs until stopped.
+  if (cgroup_fd_ != -1) {
+    return true;
+  }
   for (const auto& tid : threads_) {
     if (IsThreadAlive(tid)) {
       return true;
@@ -67,7 +67,15 @@ struct CountersInfo {
 class EventSelectionSet {
  public:
   EventSelectionSet(bool for_stat_cmd)
-      : for_stat_cmd_(for_stat_cmd), mmap_pages_(0), loop_(new IOEventLoop) {}
+      : for_stat_cmd_(for_stat_cmd),
+        group_read_mode_(false),
+        cgroup_fd_(-1),
+        mmap_pages_(0),
+        max_mmap_pages_(0),
+        mmap_grow_failed_(false),
+        loop_(new IOEventLoop) {}
+
+  ~EventSelectionSet();
 
   bool empty() const { return groups_.empty(); }
 
@@ -82,11 +90,21 @@ class EventSelectionSet {
   void SampleIdAll();
   void SetSampleFreq(uint64_t sample_freq);
   void SetSamplePeriod(uint64_t sample_period);
+  // Set the sample period of the last added event group, overriding
+  // SetSampleFreq()/SetSamplePeriod() for that group. Used for tracepoint
+  // groups needing one sample per event no matter what the user sets.
+  void SetSamplePeriodForLastGroup(uint64_t sample_period);
   void UseDefaultSampleFreq();
   bool SetBranchSampling(uint64_t branch_sample_type);
   void EnableFpCallChainSampling();
   bool EnableDwarfCallChainSampling(uint32_t dump_stack_size);
   void SetInherit(bool enable);
+  void SetClockId(int clock_id);
+  void SetWakeupWatermark(uint32_t wakeup_watermark);
+  // Read the counters of all events in a group with one read() syscall on the
+  // group leader, instead of one syscall per event. It should be called after
+  // all events are added, and before opening event files.
+  void SetGroupReadMode();
   bool NeedKernelSymbol() const;
 
   void AddMonitoredProcesses(const std::set<pid_t>& processes) {
@@ -97,12 +115,21 @@ class EventSelectionSet {
     threads_.insert(threads.begin(), threads.end());
   }
 
+  // Monitor all threads in [cgroup], a path relative to the root of the
+  // perf_event cgroup hierarchy. One event file is opened per cpu per event
+  // for the whole cgroup, instead of one per thread per cpu, so monitoring a
+  // process with hundreds of threads doesn't run into fd limits or add
+  // per-task event scheduling cost.
+  bool AddMonitoredCgroup(const std::string& cgroup);
+
   const std::set<pid_t>& GetMonitoredProcesses() const { return processes_; }
 
   const std::set<pid_t>& GetMonitoredThreads() const { return threads_; }
 
+  bool HasMonitoredCgroup() const { return cgroup_fd_ != -1; }
+
   bool HasMonitoredTarget() const {
-    return !processes_.empty() || !threads_.empty();
+    return !processes_.empty() || !threads_.empty() || cgroup_fd_ != -1;
   }
 
   IOEventLoop* GetIOEventLoop() {
@@ -142,10 +169,16 @@ class EventSelectionSet {
   bool OpenUserSpaceSamplersOnGroup(EventSelectionGroup& group,
                                     const std::map<pid_t, std::set<pid_t>>& process_map);
   bool OpenEventFilesOnGroup(EventSelectionGroup& group, pid_t tid, int cpu,
-                             std::string* failed_event_type);
+                             std::string* failed_event_type,
+                             unsigned long flags = 0);  // NOLINT
+  bool OpenEventFilesForCgroup(const std::vector<int>& cpus);
+
+  bool ReadGroupedCounters(std::vector<CountersInfo>* counters);
 
   bool MmapEventFiles(size_t mmap_pages, bool report_error);
   bool ReadMmapEventData();
+  bool GrowMappedBuffers();
+  bool GrowMappedBuffer(EventFd* fd_with_buffer, size_t new_pages);
 
   bool DetectCpuHotplugEvents();
   bool HandleCpuOnlineEvent(int cpu);
@@ -155,11 +188,20 @@ class EventSelectionSet {
   bool HasSampler();
 
   const bool for_stat_cmd_;
+  bool group_read_mode_;
 
   std::vector<EventSelectionGroup> groups_;
   std::set<pid_t> processes_;
   std::set<pid_t> threads_;
+  // Open fd of the monitored cgroup directory, or -1. Passed as the pid to
+  // perf_event_open() with PERF_FLAG_PID_CGROUP.
+  int cgroup_fd_;
+  std::string cgroup_name_;
   size_t mmap_pages_;
+  // Mapped buffers of cpus losing records are grown up to max_mmap_pages_,
+  // until one grow fails, which means the locked memory budget is used up.
+  size_t max_mmap_pages_;
+  bool mmap_grow_failed_;
 
   std::unique_ptr<IOEventLoop> loop_;
   std::function<bool(Record*)> record_callback_;
@@ -33,6 +33,18 @@ static const std::vector<EventType> static_event_type_array = {
 #include "event_type_table.h"
 };
 
+#include "event_type_hash_table.h"
+
+// FNV-1a with a seed, matching event_type_hash() in
+// generate_event_type_table.py.
+static uint32_t EventTypeHash(uint32_t seed, const std::string& s) {
+  uint32_t h = (seed == 0) ? 0x01000193u : seed;
+  for (char c : s) {
+    h = (h * 0x01000193u) ^ static_cast<uint8_t>(c);
+  }
+  return h;
+}
+
 static const std::vector<EventType> GetTracepointEventTypes() {
   std::vector<EventType> result;
   if (!IsRoot()) {
@@ -75,11 +87,30 @@ const std::vector<EventType>& GetAllEventTypes() {
 }
 
 const EventType* FindEventTypeByName(const std::string& name) {
+  const std::vector<EventType>& event_types = GetAllEventTypes();
   const EventType* result = nullptr;
-  for (auto& event_type : GetAllEventTypes()) {
-    if (event_type.name == name) {
-      result = &event_type;
-      break;
+  // The first kEventTypeTableHashSize entries are the static event types, in
+  // the same order as the generated perfect hash. Look the name up in O(1)
+  // instead of scanning the table.
+  int32_t d = kEventTypeTableHashG[EventTypeHash(0, name) %
+                                   kEventTypeTableHashSize];
+  size_t slot = (d < 0) ? static_cast<size_t>(-d - 1)
+                        : EventTypeHash(static_cast<uint32_t>(d), name) %
+                              kEventTypeTableHashSize;
+  size_t index = kEventTypeTableHashIndex[slot];
+  // A perfect hash maps unknown names to arbitrary slots, so check the name.
+  if (event_types[index].name == name) {
+    result = &event_types[index];
+  } else {
+    // Tracepoint event types follow the static ones, sorted by name.
+    auto begin = event_types.begin() + kEventTypeTableHashSize;
+    auto it = std::lower_bound(
+        begin, event_types.end(), name,
+        [](const EventType& type, const std::string& name) {
+          return type.name < name;
+        });
+    if (it != event_types.end() && it->name == name) {
+      result = &*it;
     }
   }
   if (result == nullptr) {
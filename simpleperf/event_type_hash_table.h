@@ -0,0 +1,134 @@
+// This file is auto-generated by generate_event_type_table.py.
+// A perfect hash of the static event type names in event_type_table.h,
+// mapping each name to its index in the table. See FindEventTypeByName()
+// in event_type.cpp for the lookup.
+
+static constexpr size_t kEventTypeTableHashSize = 61;
+
+static constexpr int32_t kEventTypeTableHashG[] = {
+  0,
+  0,
+  3,
+  -57,
+  -55,
+  -54,
+  -52,
+  1,
+  0,
+  1,
+  -47,
+  -41,
+  -40,
+  -39,
+  0,
+  2,
+  -38,
+  1,
+  0,
+  -35,
+  -31,
+  -28,
+  0,
+  0,
+  0,
+  1,
+  2,
+  1,
+  2,
+  -27,
+  -26,
+  -21,
+  1,
+  1,
+  0,
+  0,
+  0,
+  0,
+  -20,
+  -17,
+  0,
+  0,
+  4,
+  -14,
+  -13,
+  0,
+  0,
+  -12,
+  5,
+  0,
+  3,
+  -10,
+  0,
+  0,
+  3,
+  0,
+  -9,
+  3,
+  -8,
+  -7,
+  -1,
+};
+
+static constexpr uint32_t kEventTypeTableHashIndex[] = {
+  10,
+  41,
+  52,
+  44,
+  59,
+  57,
+  3,
+  4,
+  47,
+  14,
+  48,
+  55,
+  21,
+  16,
+  31,
+  13,
+  58,
+  36,
+  39,
+  45,
+  8,
+  15,
+  32,
+  23,
+  11,
+  2,
+  30,
+  53,
+  5,
+  1,
+  24,
+  19,
+  6,
+  54,
+  50,
+  49,
+  43,
+  56,
+  22,
+  38,
+  46,
+  28,
+  18,
+  25,
+  37,
+  9,
+  17,
+  7,
+  20,
+  60,
+  12,
+  51,
+  35,
+  0,
+  42,
+  26,
+  27,
+  34,
+  40,
+  29,
+  33,
+};
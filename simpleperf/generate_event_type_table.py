@@ -16,11 +16,17 @@
 #
 
 
+# Names of the generated event types, in table order. Used to generate the
+# perfect hash in event_type_hash_table.h.
+event_type_names = []
+
+
 def gen_event_type_entry_str(event_type_name, event_type, event_config):
   """
   return string like:
   {"cpu-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
   """
+  event_type_names.append(event_type_name)
   return '{"%s", %s, %s},\n' % (event_type_name, event_type, event_config)
 
 
@@ -120,7 +126,78 @@ def gen_events():
   generated_str += gen_user_space_events() + '\n'
   return generated_str
 
+def event_type_hash(seed, name):
+  """ FNV-1a hash with a seed, matching EventTypeHash() in event_type.cpp. """
+  h = 0x01000193 if seed == 0 else seed
+  for c in name:
+    h = ((h * 0x01000193) ^ ord(c)) & 0xffffffff
+  return h
+
+
+def gen_perfect_hash(names):
+  """ Map each name to its index in names with no collisions, using two hash
+      arrays g and slot_index:
+        d = g[event_type_hash(0, name) % n]
+        slot = -d - 1 if d < 0 else event_type_hash(d, name) % n
+        index = slot_index[slot]
+      Names hashing to the same bucket share a seed d chosen so their second
+      hashes are collision free. Names alone in their bucket store their slot
+      directly as -slot - 1.
+  """
+  n = len(names)
+  buckets = [[] for _ in range(n)]
+  for i in range(n):
+    buckets[event_type_hash(0, names[i]) % n].append(i)
+  g = [0] * n
+  slot_index = [-1] * n
+  for b in sorted(range(n), key=lambda b: len(buckets[b]), reverse=True):
+    items = buckets[b]
+    if len(items) <= 1:
+      continue
+    d = 1
+    while True:
+      slots = []
+      for i in items:
+        slot = event_type_hash(d, names[i]) % n
+        if slot_index[slot] != -1 or slot in slots:
+          break
+        slots.append(slot)
+      if len(slots) == len(items):
+        break
+      d += 1
+    g[b] = d
+    for i, slot in zip(items, slots):
+      slot_index[slot] = i
+  free_slots = [slot for slot in range(n) if slot_index[slot] == -1]
+  for b in range(n):
+    items = buckets[b]
+    if len(items) == 1:
+      slot = free_slots.pop()
+      g[b] = -slot - 1
+      slot_index[slot] = items[0]
+  return g, slot_index
+
+
+def gen_hash_table(names):
+  g, slot_index = gen_perfect_hash(names)
+  generated_str = "// This file is auto-generated by generate_event_type_table.py.\n"
+  generated_str += "// A perfect hash of the static event type names in event_type_table.h,\n"
+  generated_str += "// mapping each name to its index in the table. See FindEventTypeByName()\n"
+  generated_str += "// in event_type.cpp for the lookup.\n\n"
+  generated_str += "static constexpr size_t kEventTypeTableHashSize = %d;\n\n" % len(names)
+  generated_str += "static constexpr int32_t kEventTypeTableHashG[] = {\n  %s,\n};\n\n" % (
+      ',\n  '.join(str(d) for d in g))
+  generated_str += "static constexpr uint32_t kEventTypeTableHashIndex[] = {\n  %s,\n};\n" % (
+      ',\n  '.join(str(i) for i in slot_index))
+  return generated_str
+
+
 generated_str = gen_events()
 fh = open('event_type_table.h', 'w')
 fh.write(generated_str)
 fh.close()
+
+generated_str = gen_hash_table(event_type_names)
+fh = open('event_type_hash_table.h', 'w')
+fh.write(generated_str)
+fh.close()
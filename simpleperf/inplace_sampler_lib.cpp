@@ -16,16 +16,23 @@
 
 #include "inplace_sampler_lib.h"
 
+#include <fcntl.h>
 #include <inttypes.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/ucontext.h>
 #include <unistd.h>
 
+#if defined(__ANDROID__)
+#include <linux/ashmem.h>
+#endif
+
 #include <map>
 #include <memory>
 #include <queue>
@@ -46,6 +53,8 @@
 #define DEFAULT_SIGNO  SIGRTMAX
 static constexpr int DEFAULT_SAMPLE_FREQ = 4000;
 static constexpr int CHECK_THREADS_INTERVAL_IN_MS = 200;
+// Size of the shared ring buffer used to send samples, a power of two.
+static constexpr uint32_t SAMPLE_BUFFER_SIZE = 256 * 1024;
 
 namespace {
 
@@ -61,8 +70,16 @@ class SampleManager {
  public:
   SampleManager(std::unique_ptr<UnixSocketConnection> conn) : conn_(std::move(conn)),
       tid_(gettid()), signo_(DEFAULT_SIGNO), sample_freq_(DEFAULT_SAMPLE_FREQ),
-      sample_period_in_ns_(0), dump_callchain_(false), monitor_all_threads_(true) {
+      sample_period_in_ns_(0), dump_callchain_(false), monitor_all_threads_(true),
+      sample_buffer_(nullptr) {
+  }
+
+  ~SampleManager() {
+    if (sample_buffer_ != nullptr) {
+      munmap(sample_buffer_, sizeof(SampleRingBuffer) + sample_buffer_->size);
+    }
   }
+
   void Run();
 
  private:
@@ -71,6 +88,11 @@ class SampleManager {
   bool SendStartProfilingReplyMessage(bool ok);
   bool StartProfiling();
   bool InstallSignalHandler();
+  bool CreateSampleBuffer();
+  bool SendSampleBufferFdMessage(int fd);
+  void WriteSampleToBuffer(uint64_t time, uint32_t tid, uint32_t period,
+                           const uint64_t* ips, uint32_t ip_nr);
+  void CopyToSampleBuffer(uint64_t offset, const void* data, size_t size);
   bool CheckThreads();
   bool CheckThreadNameChange(uint64_t timestamp);
   bool CheckMapChange(uint64_t timestamp);
@@ -89,6 +111,9 @@ class SampleManager {
   std::map<int, ThreadInfo> threads_;
   std::map<uint64_t, ThreadMmap> maps_;
   std::queue<std::unique_ptr<char[]>> thread_map_info_q_;
+  // Shared ring buffer used to send samples to simpleperf. If it can't be
+  // created, samples are sent as SAMPLE_INFO messages instead.
+  SampleRingBuffer* sample_buffer_;
 
   IOEventLoop loop_;
 };
@@ -185,6 +210,9 @@ bool SampleManager::StartProfiling() {
   if (!InstallSignalHandler()) {
     return false;
   }
+  // Not being able to create the shared buffer isn't fatal, samples are then
+  // sent as SAMPLE_INFO messages.
+  CreateSampleBuffer();
   if (!CheckThreads()) {
     return false;
   }
@@ -200,6 +228,124 @@ bool SampleManager::InstallSignalHandler() {
   return true;
 }
 
+static int CreateSampleBufferFd(size_t size) {
+#if defined(__ANDROID__)
+  int fd = TEMP_FAILURE_RETRY(open("/dev/ashmem", O_RDWR | O_CLOEXEC));
+  if (fd == -1) {
+    PLOG(ERROR) << "failed to open /dev/ashmem";
+    return -1;
+  }
+  if (ioctl(fd, ASHMEM_SET_SIZE, size) == -1) {
+    PLOG(ERROR) << "ASHMEM_SET_SIZE failed";
+    close(fd);
+    return -1;
+  }
+  return fd;
+#elif defined(__NR_memfd_create)
+  int fd = syscall(__NR_memfd_create, "inplace_sampler", 0);
+  if (fd == -1) {
+    PLOG(ERROR) << "memfd_create failed";
+    return -1;
+  }
+  if (ftruncate(fd, size) == -1) {
+    PLOG(ERROR) << "ftruncate failed";
+    close(fd);
+    return -1;
+  }
+  return fd;
+#else
+  (void)size;
+  return -1;
+#endif
+}
+
+bool SampleManager::CreateSampleBuffer() {
+  size_t total_size = sizeof(SampleRingBuffer) + SAMPLE_BUFFER_SIZE;
+  int fd = CreateSampleBufferFd(total_size);
+  if (fd == -1) {
+    return false;
+  }
+  void* p = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    PLOG(ERROR) << "failed to map sample buffer";
+    close(fd);
+    return false;
+  }
+  sample_buffer_ = reinterpret_cast<SampleRingBuffer*>(p);
+  sample_buffer_->size = SAMPLE_BUFFER_SIZE;
+  if (!SendSampleBufferFdMessage(fd)) {
+    munmap(sample_buffer_, total_size);
+    sample_buffer_ = nullptr;
+    close(fd);
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+bool SampleManager::SendSampleBufferFdMessage(int fd) {
+  size_t size = sizeof(UnixSocketMessage) + sizeof(uint32_t);
+  std::unique_ptr<char[]> data(new char[size]);
+  UnixSocketMessage* msg = reinterpret_cast<UnixSocketMessage*>(data.get());
+  msg->len = size;
+  msg->type = SAMPLE_BUFFER_INFO;
+  char* p = msg->data;
+  MoveToBinaryFormat(sample_buffer_->size, p);
+  // SendMessageWithFd() writes to the socket directly. It is called on the
+  // loop thread, where buffered messages are only flushed after HandleMessage()
+  // returns, so it can't cut a buffered message in half.
+  return conn_->SendMessageWithFd(*msg, fd);
+}
+
+void SampleManager::WriteSampleToBuffer(uint64_t time, uint32_t tid,
+                                        uint32_t period, const uint64_t* ips,
+                                        uint32_t ip_nr) {
+  SampleRingBuffer* b = sample_buffer_;
+  uint32_t len = sizeof(uint32_t) * 4 + sizeof(uint64_t) * (1 + ip_nr);
+  uint64_t start;
+  while (true) {
+    start = __atomic_load_n(&b->reserve_head, __ATOMIC_RELAXED);
+    uint64_t read_head = __atomic_load_n(&b->read_head, __ATOMIC_ACQUIRE);
+    if (start + len - read_head > b->size) {
+      __atomic_fetch_add(&b->lost_samples, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    uint64_t expected = start;
+    if (__atomic_compare_exchange_n(&b->reserve_head, &expected, start + len,
+                                    false, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  char header[sizeof(uint32_t) * 4 + sizeof(uint64_t)];
+  char* p = header;
+  MoveToBinaryFormat(len, p);
+  MoveToBinaryFormat(time, p);
+  MoveToBinaryFormat(tid, p);
+  MoveToBinaryFormat(period, p);
+  MoveToBinaryFormat(ip_nr, p);
+  CopyToSampleBuffer(start, header, sizeof(header));
+  CopyToSampleBuffer(start + sizeof(header), ips, ip_nr * sizeof(uint64_t));
+  // Publish in reservation order, so commit_head never covers bytes another
+  // thread is still filling.
+  while (__atomic_load_n(&b->commit_head, __ATOMIC_RELAXED) != start) {
+  }
+  __atomic_store_n(&b->commit_head, start + len, __ATOMIC_RELEASE);
+}
+
+void SampleManager::CopyToSampleBuffer(uint64_t offset, const void* data,
+                                       size_t size) {
+  SampleRingBuffer* b = sample_buffer_;
+  size_t pos = offset & (b->size - 1);
+  if (size <= b->size - pos) {
+    memcpy(b->data + pos, data, size);
+  } else {
+    size_t len1 = b->size - pos;
+    memcpy(b->data + pos, data, len1);
+    memcpy(b->data, reinterpret_cast<const char*>(data) + len1, size - len1);
+  }
+}
+
 bool SampleManager::CheckThreads() {
   uint64_t timestamp = GetSystemClock();
   if (!CheckMapChange(timestamp)) {
@@ -306,10 +452,15 @@ static void FakeFunction() {
 }
 
 void SampleManager::SendFakeSampleRecord() {
+  uint64_t ip = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&FakeFunction));
+  if (sample_buffer_ != nullptr) {
+    WriteSampleToBuffer(GetSystemClock(), static_cast<uint32_t>(tid_), 1u, &ip,
+                        1u);
+    return;
+  }
   size_t size = sizeof(UnixSocketMessage) + sizeof(uint64_t) * 2 + sizeof(uint32_t) *  3;
   std::unique_ptr<char[]> data(new char[size]);
   UnixSocketMessage* msg = reinterpret_cast<UnixSocketMessage*>(data.get());
-  uint64_t ip = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&FakeFunction));
   msg->len = size;
   msg->type = SAMPLE_INFO;
   char* p = msg->data;
@@ -17,6 +17,8 @@
 #ifndef SIMPLE_PERF_INPLACE_SAMPLER_LIB_H_
 #define SIMPLE_PERF_INPLACE_SAMPLER_LIB_H_
 
+#include <stdint.h>
+
 enum InplaceSamplerMessageType {
   START_PROFILING,
   START_PROFILING_REPLY,
@@ -25,8 +27,39 @@ enum InplaceSamplerMessageType {
   SAMPLE_INFO,
   END_PROFILING,
   END_PROFILING_REPLY,
+  SAMPLE_BUFFER_INFO,
+};
+
+// SampleRingBuffer is a ring buffer in shared memory, used to move sample
+// data from inplace_sampler to simpleperf without going through the socket.
+// Sending samples as socket messages drops samples above ~1kHz, as each
+// sample pays for a send() and a wakeup of the reading thread.
+// reserve_head, commit_head and read_head are byte offsets in data[], and
+// only increase. A thread taking a sample reserves space by atomically
+// advancing reserve_head, fills it, then publishes it by advancing
+// commit_head in reservation order, so no lock is taken in the sampled
+// process. simpleperf reads records up to commit_head and advances read_head
+// when it has copied them out.
+struct SampleRingBuffer {
+  volatile uint64_t reserve_head;
+  volatile uint64_t commit_head;
+  volatile uint64_t read_head;
+  // Samples dropped because the ring was full.
+  volatile uint64_t lost_samples;
+  uint32_t size;  // size of data[] in bytes, a power of two
+  uint32_t reserved;
+  char data[0];
 };
 
+// Each record in SampleRingBuffer::data[] is a SAMPLE_INFO payload prefixed
+// with its total length:
+//   uint32_t len;  // length of the record in bytes, including len itself
+//   uint64_t time;
+//   uint32_t tid;
+//   uint32_t period;
+//   uint32_t ip_nr;
+//   uint64_t ip[ip_nr];
+
 // Type: START_PROFILING
 // Direction: simpleperf to inplace_sampler
 // Data:
@@ -80,5 +113,16 @@ enum InplaceSamplerMessageType {
 //   uint64_t used_cpu_time;
 //   uint64_t lost_samples;
 
+// Type: SAMPLE_BUFFER_INFO
+// Direction: inplace_sampler to simpleperf
+// Data:
+//   uint32_t size;  // size of SampleRingBuffer::data[]
+// A file descriptor referring to the shared memory holding the
+// SampleRingBuffer is attached to the message as SCM_RIGHTS ancillary data.
+// After this message, SAMPLE_INFO data is sent through the ring buffer
+// instead of socket messages. If inplace_sampler fails to create the shared
+// memory, the message isn't sent, and samples keep coming as SAMPLE_INFO
+// messages.
+
 
 #endif  // SIMPLE_PERF_INPLACE_SAMPLER_LIB_H_
@@ -20,8 +20,16 @@
 #include "dwarf_unwind.h"
 #include "environment.h"
 
+UnwindMapCache::UnwindMapCache() {}
+
+UnwindMapCache::~UnwindMapCache() {}
+
+BacktraceMap* UnwindMapCache::GetBacktraceMap(const ThreadEntry&) {
+  return nullptr;
+}
+
 std::vector<uint64_t> UnwindCallChain(int, const ThreadEntry&, const RegSet&,
-                                      const char*, size_t, bool) {
+                                      const char*, size_t, bool, UnwindMapCache*) {
   return std::vector<uint64_t>();
 }
 
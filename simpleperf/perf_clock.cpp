@@ -32,8 +32,24 @@
 #include "record.h"
 
 static bool perf_clock_initialized = false;
+static bool perf_clock_uses_clockid = false;
 static int64_t perf_clock_and_system_clock_diff_in_ns = 0;
 
+// Kernels >= 4.1 can be asked to generate timestamps directly from
+// CLOCK_MONOTONIC via perf_event_attr.use_clockid, making the calibration
+// below unnecessary.
+static bool IsSettingClockIdSupported() {
+  std::unique_ptr<EventTypeAndModifier> event_type =
+      ParseEventType("cpu-clock");
+  if (event_type == nullptr) {
+    return false;
+  }
+  perf_event_attr attr = CreateDefaultPerfEventAttr(event_type->event_type);
+  attr.use_clockid = 1;
+  attr.clockid = CLOCK_MONOTONIC;
+  return IsEventAttrSupported(attr);
+}
+
 struct ThreadArg {
   std::atomic<pid_t> thread_a_tid;
   std::atomic<bool> start_mmap;
@@ -155,7 +171,11 @@ static bool GetClockDiff(int64_t* clock_diff_in_ns) {
 
 bool InitPerfClock() {
   if (!perf_clock_initialized) {
-    if (!GetClockDiff(&perf_clock_and_system_clock_diff_in_ns)) {
+    if (IsSettingClockIdSupported()) {
+      // Sample timestamps are generated from CLOCK_MONOTONIC, the same clock
+      // as GetSystemClock(), so there is no clock difference to measure.
+      perf_clock_uses_clockid = true;
+    } else if (!GetClockDiff(&perf_clock_and_system_clock_diff_in_ns)) {
       return false;
     }
     perf_clock_initialized = true;
@@ -163,6 +183,11 @@ bool InitPerfClock() {
   return true;
 }
 
+bool PerfClockUsesClockId() {
+  CHECK(perf_clock_initialized);
+  return perf_clock_uses_clockid;
+}
+
 uint64_t GetPerfClock() {
   CHECK(perf_clock_initialized);
   return GetSystemClock() + perf_clock_and_system_clock_diff_in_ns;
@@ -24,8 +24,14 @@
 // buffer for perf event file, which might not be available during profiling.
 // And we'd better call the init function before profiling.
 // InitPerfClock() must be called before GetPerfClock().
+// On kernels supporting perf_event_attr.use_clockid, no calibration is done:
+// sample timestamps come directly from CLOCK_MONOTONIC. In that case
+// PerfClockUsesClockId() returns true, and events recorded for profiling must
+// set use_clockid too (see EventSelectionSet::SetClockId()).
 bool InitPerfClock();
 
+bool PerfClockUsesClockId();
+
 uint64_t GetPerfClock();
 
 #endif  // SIMPLE_PERF_PERF_CLOCK_H_
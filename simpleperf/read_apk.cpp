@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 
 #include <android-base/file.h>
@@ -33,6 +34,53 @@
 #include "utils.h"
 
 std::map<ApkInspector::ApkOffset, std::unique_ptr<EmbeddedElf>> ApkInspector::embedded_elf_cache_;
+std::list<std::pair<std::string, ApkInspector::ApkEntryTable>> ApkInspector::apk_entry_table_cache_;
+
+const ApkInspector::ApkEntryTable* ApkInspector::GetApkEntryTable(const std::string& apk_path) {
+  for (auto it = apk_entry_table_cache_.begin(); it != apk_entry_table_cache_.end(); ++it) {
+    if (it->first == apk_path) {
+      // Move to front, so frequently used apks stay in the cache.
+      apk_entry_table_cache_.splice(apk_entry_table_cache_.begin(), apk_entry_table_cache_, it);
+      return &apk_entry_table_cache_.front().second;
+    }
+  }
+  if (!IsValidApkPath(apk_path)) {
+    return nullptr;
+  }
+  FileHelper fhelper = FileHelper::OpenReadOnly(apk_path);
+  if (!fhelper) {
+    return nullptr;
+  }
+  ArchiveHelper ahelper(fhelper.fd(), apk_path);
+  if (!ahelper) {
+    return nullptr;
+  }
+  ZipArchiveHandle& handle = ahelper.archive_handle();
+  void* iteration_cookie;
+  if (StartIteration(handle, &iteration_cookie, nullptr, nullptr) < 0) {
+    return nullptr;
+  }
+  ApkEntryTable table;
+  ZipEntry zentry;
+  ZipString zname;
+  while (Next(iteration_cookie, &zentry, &zname) == 0) {
+    ApkEntry entry;
+    entry.name.assign(reinterpret_cast<const char*>(zname.name), zname.name_length);
+    entry.offset = zentry.offset;
+    entry.size = zentry.uncompressed_length;
+    entry.is_stored = zentry.method == kCompressStored &&
+                      zentry.compressed_length == zentry.uncompressed_length;
+    table.entries.push_back(std::move(entry));
+  }
+  EndIteration(iteration_cookie);
+  std::sort(table.entries.begin(), table.entries.end(),
+            [](const ApkEntry& e1, const ApkEntry& e2) { return e1.offset < e2.offset; });
+  if (apk_entry_table_cache_.size() >= APK_ENTRY_TABLE_CACHE_SIZE) {
+    apk_entry_table_cache_.pop_back();
+  }
+  apk_entry_table_cache_.emplace_front(apk_path, std::move(table));
+  return &apk_entry_table_cache_.front().second;
+}
 
 EmbeddedElf* ApkInspector::FindElfInApkByOffset(const std::string& apk_path, uint64_t file_offset) {
   // Already in cache?
@@ -49,94 +97,63 @@ EmbeddedElf* ApkInspector::FindElfInApkByOffset(const std::string& apk_path, uin
 
 std::unique_ptr<EmbeddedElf> ApkInspector::FindElfInApkByOffsetWithoutCache(const std::string& apk_path,
                                                                             uint64_t file_offset) {
-  // Crack open the apk(zip) file and take a look.
-  if (!IsValidApkPath(apk_path)) {
+  const ApkEntryTable* table = GetApkEntryTable(apk_path);
+  if (table == nullptr) {
     return nullptr;
   }
 
-  FileHelper fhelper = FileHelper::OpenReadOnly(apk_path);
-  if (!fhelper) {
+  // Look for an uncompressed entry whose range contains the mmap offset
+  // we're interested in. As entries don't overlap in the apk file, it is
+  // the last entry starting at or before file_offset.
+  auto it = std::upper_bound(table->entries.begin(), table->entries.end(), file_offset,
+                             [](uint64_t offset, const ApkEntry& entry) {
+                               return offset < entry.offset;
+                             });
+  if (it == table->entries.begin()) {
     return nullptr;
   }
-
-  ArchiveHelper ahelper(fhelper.fd(), apk_path);
-  if (!ahelper) {
+  --it;
+  if (!it->is_stored || file_offset >= it->offset + it->size) {
     return nullptr;
   }
-  ZipArchiveHandle &handle = ahelper.archive_handle();
 
-  // Iterate through the zip file. Look for a zip entry corresponding
-  // to an uncompressed blob whose range intersects with the mmap
-  // offset we're interested in.
-  void* iteration_cookie;
-  if (StartIteration(handle, &iteration_cookie, nullptr, nullptr) < 0) {
+  // We found something in the zip file at the right spot. Is it an ELF?
+  FileHelper fhelper = FileHelper::OpenReadOnly(apk_path);
+  if (!fhelper) {
     return nullptr;
   }
-  ZipEntry zentry;
-  ZipString zname;
-  bool found = false;
-  int zrc;
-  while ((zrc = Next(iteration_cookie, &zentry, &zname)) == 0) {
-    if (zentry.method == kCompressStored &&
-        file_offset >= static_cast<uint64_t>(zentry.offset) &&
-        file_offset < static_cast<uint64_t>(zentry.offset + zentry.uncompressed_length)) {
-      // Found.
-      found = true;
-      break;
-    }
-  }
-  EndIteration(iteration_cookie);
-  if (!found) {
+  if (lseek(fhelper.fd(), it->offset, SEEK_SET) != static_cast<off_t>(it->offset)) {
+    PLOG(ERROR) << "lseek() failed in " << apk_path << " offset " << it->offset;
     return nullptr;
   }
-
-  // We found something in the zip file at the right spot. Is it an ELF?
-  if (lseek(fhelper.fd(), zentry.offset, SEEK_SET) != zentry.offset) {
-    PLOG(ERROR) << "lseek() failed in " << apk_path << " offset " << zentry.offset;
-    return nullptr;
-  }
-  std::string entry_name;
-  entry_name.resize(zname.name_length,'\0');
-  memcpy(&entry_name[0], zname.name, zname.name_length);
   ElfStatus result = IsValidElfFile(fhelper.fd());
   if (result != ElfStatus::NO_ERROR) {
     LOG(ERROR) << "problems reading ELF from " << apk_path << " entry '"
-               << entry_name << "': " << result;
+               << it->name << "': " << result;
     return nullptr;
   }
 
   // Elf found: add EmbeddedElf to vector, update cache.
-  return std::unique_ptr<EmbeddedElf>(new EmbeddedElf(apk_path, entry_name, zentry.offset,
-                                                      zentry.uncompressed_length));
+  return std::unique_ptr<EmbeddedElf>(new EmbeddedElf(apk_path, it->name, it->offset, it->size));
 }
 
 std::unique_ptr<EmbeddedElf> ApkInspector::FindElfInApkByName(const std::string& apk_path,
                                                               const std::string& elf_filename) {
-  if (!IsValidApkPath(apk_path)) {
-    return nullptr;
-  }
-  FileHelper fhelper = FileHelper::OpenReadOnly(apk_path);
-  if (!fhelper) {
+  const ApkEntryTable* table = GetApkEntryTable(apk_path);
+  if (table == nullptr) {
     return nullptr;
   }
-  ArchiveHelper ahelper(fhelper.fd(), apk_path);
-  if (!ahelper) {
-    return nullptr;
-  }
-  ZipArchiveHandle& handle = ahelper.archive_handle();
-  ZipEntry zentry;
-  int32_t rc = FindEntry(handle, ZipString(elf_filename.c_str()), &zentry);
-  if (rc != 0) {
-    LOG(ERROR) << "failed to find " << elf_filename << " in " << apk_path
-        << ": " << ErrorCodeString(rc);
+  auto it = std::find_if(table->entries.begin(), table->entries.end(),
+                         [&](const ApkEntry& entry) { return entry.name == elf_filename; });
+  if (it == table->entries.end()) {
+    LOG(ERROR) << "failed to find " << elf_filename << " in " << apk_path;
     return nullptr;
   }
-  if (zentry.method != kCompressStored || zentry.compressed_length != zentry.uncompressed_length) {
+  if (!it->is_stored) {
     LOG(ERROR) << "shared library " << elf_filename << " in " << apk_path << " is compressed";
     return nullptr;
   }
-  return std::unique_ptr<EmbeddedElf>(new EmbeddedElf(apk_path, elf_filename, zentry.offset,
-                                                  zentry.uncompressed_length));
+  return std::unique_ptr<EmbeddedElf>(new EmbeddedElf(apk_path, it->name, it->offset, it->size));
 }
 
 bool IsValidApkPath(const std::string& apk_path) {
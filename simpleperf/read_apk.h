@@ -19,10 +19,12 @@
 
 #include <stdint.h>
 
+#include <list>
 #include <map>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include "read_elf.h"
 
@@ -76,13 +78,35 @@ class ApkInspector {
                                                          const std::string& elf_filename);
 
  private:
+  // Info of one entry in the zip index of an apk file.
+  struct ApkEntry {
+    std::string name;
+    uint64_t offset;
+    uint32_t size;  // uncompressed length
+    bool is_stored;  // whether the entry is uncompressed in the apk file
+  };
+
+  // Entries of one apk file, sorted by offset. Parsing the zip index is
+  // expensive for multidex apks, so it is done once per apk file, and offset
+  // queries become binary searches in the sorted entries.
+  struct ApkEntryTable {
+    std::vector<ApkEntry> entries;
+  };
+
   static std::unique_ptr<EmbeddedElf> FindElfInApkByOffsetWithoutCache(const std::string& apk_path,
                                                                        uint64_t file_offset);
+  // Return the entry table of [apk_path], parsing the apk file only when it
+  // isn't in apk_entry_table_cache_. Return nullptr if [apk_path] isn't a
+  // valid apk file. The returned pointer is valid until the next call.
+  static const ApkEntryTable* GetApkEntryTable(const std::string& apk_path);
 
   // First component of pair is APK file path, second is offset into APK.
   typedef std::pair<std::string, uint64_t> ApkOffset;
 
   static std::map<ApkOffset, std::unique_ptr<EmbeddedElf>> embedded_elf_cache_;
+  // LRU cache of parsed entry tables, most recently used in front.
+  static constexpr size_t APK_ENTRY_TABLE_CACHE_SIZE = 16;
+  static std::list<std::pair<std::string, ApkEntryTable>> apk_entry_table_cache_;
 };
 
 // Export for test only.
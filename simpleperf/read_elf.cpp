@@ -19,8 +19,10 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <limits>
@@ -382,6 +384,246 @@ ElfStatus ParseSymbolsFromELFFile(const llvm::object::ELFObjectFile<ELFT>* elf,
   return result;
 }
 
+// The lean symbol parsing path below maps the file and walks .symtab/.dynsym
+// in place, so only the pages of the symbol table and its string table are
+// read. ELFObjectFile materializes symbol iterators which look up and
+// validate every field, and that dominates first-report latency on big files
+// like libart.so. Files the lean path can't handle (big endian, malformed
+// headers) fall back to the ELFObjectFile path.
+
+// Maps [file_offset, file_offset + file_size) of a file read only, taking
+// care of page alignment for embedded ELF files in APKs.
+class MappedElfFile {
+ public:
+  MappedElfFile() : map_addr_(nullptr), map_len_(0), data_(nullptr), size_(0) {}
+
+  ~MappedElfFile() {
+    if (map_addr_ != nullptr) {
+      munmap(map_addr_, map_len_);
+    }
+  }
+
+  bool Map(int fd, uint64_t file_offset, uint64_t file_size) {
+    uint64_t page_mask = static_cast<uint64_t>(getpagesize()) - 1;
+    uint64_t aligned_offset = file_offset & ~page_mask;
+    map_len_ = file_size + (file_offset - aligned_offset);
+    map_addr_ = mmap(nullptr, map_len_, PROT_READ, MAP_PRIVATE, fd,
+                     static_cast<off_t>(aligned_offset));
+    if (map_addr_ == MAP_FAILED) {
+      map_addr_ = nullptr;
+      return false;
+    }
+    data_ = static_cast<const char*>(map_addr_) + (file_offset - aligned_offset);
+    size_ = file_size;
+    return true;
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  void* map_addr_;
+  size_t map_len_;
+  const char* data_;
+  size_t size_;
+};
+
+template <typename Ehdr, typename Shdr, typename Sym>
+ElfStatus ParseSymbolsFromMappedElfFile(const char* data, size_t size,
+                                        const BuildId& expected_build_id,
+                                        const std::function<void(const ElfFileSymbol&)>& callback) {
+  // Validate everything needed before emitting any symbol, so a
+  // FILE_MALFORMED result means no callback has been called and the caller
+  // can safely fall back to the ELFObjectFile path.
+  if (size < sizeof(Ehdr)) {
+    return ElfStatus::FILE_MALFORMED;
+  }
+  const Ehdr* ehdr = reinterpret_cast<const Ehdr*>(data);
+  bool is_arm = (ehdr->e_machine == llvm::ELF::EM_ARM ||
+                 ehdr->e_machine == llvm::ELF::EM_AARCH64);
+  size_t shnum = ehdr->e_shnum;
+  if (ehdr->e_shoff == 0 || shnum == 0 || ehdr->e_shentsize != sizeof(Shdr) ||
+      ehdr->e_shstrndx >= shnum) {
+    // Also covers files using extended section numbering.
+    return ElfStatus::FILE_MALFORMED;
+  }
+  if (ehdr->e_shoff > size || shnum > (size - ehdr->e_shoff) / sizeof(Shdr)) {
+    return ElfStatus::FILE_MALFORMED;
+  }
+  const Shdr* shdrs = reinterpret_cast<const Shdr*>(data + ehdr->e_shoff);
+  auto section_data = [&](const Shdr& shdr) -> const char* {
+    if (shdr.sh_offset >= size || shdr.sh_size > size - shdr.sh_offset) {
+      return nullptr;
+    }
+    return data + shdr.sh_offset;
+  };
+  const Shdr& shstr = shdrs[ehdr->e_shstrndx];
+  const char* shstrtab = section_data(shstr);
+  if (shstrtab == nullptr || shstr.sh_size == 0 ||
+      shstrtab[shstr.sh_size - 1] != '\0') {
+    return ElfStatus::FILE_MALFORMED;
+  }
+  auto section_name = [&](const Shdr& shdr) -> const char* {
+    return (shdr.sh_name < shstr.sh_size) ? shstrtab + shdr.sh_name : "";
+  };
+
+  const Shdr* symtab = nullptr;
+  const Shdr* dynsym = nullptr;
+  const Shdr* plt = nullptr;
+  const Shdr* debugdata = nullptr;
+  size_t text_ndx = llvm::ELF::SHN_UNDEF;
+  BuildId build_id;
+  bool has_build_id = false;
+  for (size_t i = 0; i < shnum; ++i) {
+    const Shdr& shdr = shdrs[i];
+    if (shdr.sh_type == llvm::ELF::SHT_SYMTAB) {
+      symtab = &shdr;
+    } else if (shdr.sh_type == llvm::ELF::SHT_DYNSYM) {
+      dynsym = &shdr;
+    } else if (shdr.sh_type == llvm::ELF::SHT_NOTE && !has_build_id) {
+      const char* p = section_data(shdr);
+      if (p != nullptr) {
+        has_build_id = GetBuildIdFromNoteSection(p, shdr.sh_size, &build_id);
+      }
+    }
+    const char* name = section_name(shdr);
+    if (strcmp(name, ".text") == 0) {
+      text_ndx = i;
+    } else if (strcmp(name, ".plt") == 0) {
+      plt = &shdr;
+    } else if (strcmp(name, ".gnu_debugdata") == 0) {
+      debugdata = &shdr;
+    }
+  }
+  if (!expected_build_id.IsEmpty()) {
+    if (!has_build_id) {
+      return ElfStatus::NO_BUILD_ID;
+    }
+    if (build_id != expected_build_id) {
+      return ElfStatus::BUILD_ID_MISMATCH;
+    }
+  }
+  const Shdr* chosen = (symtab != nullptr) ? symtab : dynsym;
+  const Sym* syms = nullptr;
+  size_t sym_count = 0;
+  const char* strtab = nullptr;
+  size_t strtab_size = 0;
+  if (chosen != nullptr) {
+    if (chosen->sh_entsize != sizeof(Sym) || chosen->sh_link >= shnum) {
+      return ElfStatus::FILE_MALFORMED;
+    }
+    const char* sym_data = section_data(*chosen);
+    const Shdr& strtab_shdr = shdrs[chosen->sh_link];
+    strtab = section_data(strtab_shdr);
+    strtab_size = strtab_shdr.sh_size;
+    if (sym_data == nullptr || strtab == nullptr || strtab_size == 0 ||
+        strtab[strtab_size - 1] != '\0') {
+      return ElfStatus::FILE_MALFORMED;
+    }
+    syms = reinterpret_cast<const Sym*>(sym_data);
+    sym_count = chosen->sh_size / sizeof(Sym);
+  }
+
+  if (plt != nullptr) {
+    // Same as AddSymbolForPltSection(): use one @plt symbol to represent
+    // instructions in .plt section.
+    ElfFileSymbol symbol;
+    symbol.vaddr = plt->sh_addr;
+    symbol.len = plt->sh_size;
+    symbol.is_func = true;
+    symbol.is_label = true;
+    symbol.is_in_text_section = true;
+    symbol.name = "@plt";
+    callback(symbol);
+  }
+
+  for (size_t i = 1; i < sym_count; ++i) {
+    const Sym& sym = syms[i];
+    if (sym.st_name == 0 || sym.st_name >= strtab_size) {
+      continue;
+    }
+    size_t shndx = sym.st_shndx;
+    if (shndx == llvm::ELF::SHN_UNDEF || shndx >= shnum) {
+      continue;
+    }
+    ElfFileSymbol symbol;
+    symbol.is_in_text_section = (shndx == text_ndx);
+    symbol.name = strtab + sym.st_name;
+    symbol.vaddr = sym.st_value;
+    if ((symbol.vaddr & 1) != 0 && is_arm) {
+      // Arm sets bit 0 to mark it as thumb code, remove the flag.
+      symbol.vaddr &= ~1;
+    }
+    symbol.len = sym.st_size;
+    unsigned char symbol_type = sym.st_info & 0xf;
+    if (symbol_type == llvm::ELF::STT_FUNC) {
+      symbol.is_func = true;
+    } else if (symbol_type == llvm::ELF::STT_NOTYPE) {
+      if (symbol.is_in_text_section) {
+        symbol.is_label = true;
+        if (is_arm) {
+          // Remove mapping symbols in arm.
+          const char* p = (symbol.name.compare(0, linker_prefix.size(), linker_prefix) == 0)
+                              ? symbol.name.c_str() + linker_prefix.size()
+                              : symbol.name.c_str();
+          if (IsArmMappingSymbol(p)) {
+            symbol.is_label = false;
+          }
+        }
+      }
+    }
+    callback(symbol);
+  }
+
+  if (symtab != nullptr) {
+    return ElfStatus::NO_ERROR;
+  }
+  if (debugdata == nullptr) {
+    return ElfStatus::NO_SYMBOL_TABLE;
+  }
+  // Like the ELFObjectFile path, parse the compressed symbol table in
+  // .gnu_debugdata after the dynamic symbols.
+  std::string compressed_data(section_data(*debugdata), debugdata->sh_size);
+  std::string decompressed_data;
+  if (XzDecompress(compressed_data, &decompressed_data)) {
+    BinaryWrapper wrapper;
+    ElfStatus result = OpenObjectFileFromString(decompressed_data, &wrapper);
+    if (result == ElfStatus::NO_ERROR) {
+      if (auto elf = llvm::dyn_cast<llvm::object::ELF32LEObjectFile>(wrapper.obj)) {
+        result = ParseSymbolsFromELFFile(elf, callback);
+      } else if (auto elf = llvm::dyn_cast<llvm::object::ELF64LEObjectFile>(wrapper.obj)) {
+        result = ParseSymbolsFromELFFile(elf, callback);
+      }
+    }
+    // Dynamic symbols have been emitted, don't make the caller fall back
+    // and emit them again.
+    return (result == ElfStatus::FILE_MALFORMED) ? ElfStatus::NO_SYMBOL_TABLE
+                                                 : result;
+  }
+  return ElfStatus::NO_ERROR;
+}
+
+static ElfStatus ParseSymbolsFromMappedElfFile(const char* data, size_t size,
+                                               const BuildId& expected_build_id,
+                                               const std::function<void(const ElfFileSymbol&)>& callback) {
+  static const char elf_magic[] = {0x7f, 'E', 'L', 'F'};
+  if (size < llvm::ELF::EI_NIDENT || memcmp(data, elf_magic, 4) != 0 ||
+      data[llvm::ELF::EI_DATA] != llvm::ELF::ELFDATA2LSB) {
+    return ElfStatus::FILE_MALFORMED;
+  }
+  if (data[llvm::ELF::EI_CLASS] == llvm::ELF::ELFCLASS32) {
+    return ParseSymbolsFromMappedElfFile<llvm::ELF::Elf32_Ehdr, llvm::ELF::Elf32_Shdr,
+                                         llvm::ELF::Elf32_Sym>(data, size, expected_build_id,
+                                                               callback);
+  }
+  if (data[llvm::ELF::EI_CLASS] == llvm::ELF::ELFCLASS64) {
+    return ParseSymbolsFromMappedElfFile<llvm::ELF::Elf64_Ehdr, llvm::ELF::Elf64_Shdr,
+                                         llvm::ELF::Elf64_Sym>(data, size, expected_build_id,
+                                                               callback);
+  }
+  return ElfStatus::FILE_MALFORMED;
+}
+
 ElfStatus MatchBuildId(llvm::object::ObjectFile* obj, const BuildId& expected_build_id) {
   if (expected_build_id.IsEmpty()) {
     return ElfStatus::NO_ERROR;
@@ -410,6 +652,28 @@ ElfStatus ParseSymbolsFromElfFile(const std::string& filename,
 ElfStatus ParseSymbolsFromEmbeddedElfFile(const std::string& filename, uint64_t file_offset,
                                      uint32_t file_size, const BuildId& expected_build_id,
                                      const std::function<void(const ElfFileSymbol&)>& callback) {
+  {
+    FileHelper fhelper = FileHelper::OpenReadOnly(filename);
+    if (!fhelper) {
+      return ElfStatus::READ_FAILED;
+    }
+    uint64_t size = file_size;
+    if (size == 0) {
+      size = GetFileSize(filename);
+      if (size == 0) {
+        return ElfStatus::READ_FAILED;
+      }
+    }
+    MappedElfFile mapped;
+    if (mapped.Map(fhelper.fd(), file_offset, size)) {
+      ElfStatus result = ParseSymbolsFromMappedElfFile(
+          mapped.data(), mapped.size(), expected_build_id, callback);
+      if (result != ElfStatus::FILE_MALFORMED) {
+        return result;
+      }
+      // Fall back to the ELFObjectFile path below.
+    }
+  }
   BinaryWrapper wrapper;
   ElfStatus result = OpenObjectFile(filename, file_offset, file_size, &wrapper);
   if (result != ElfStatus::NO_ERROR) {
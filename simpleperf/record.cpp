@@ -467,8 +467,8 @@ SampleRecord::SampleRecord(const perf_event_attr& attr, uint64_t id,
   sample_type = attr.sample_type;
   CHECK_EQ(0u, sample_type & ~(PERF_SAMPLE_IP | PERF_SAMPLE_TID
       | PERF_SAMPLE_TIME | PERF_SAMPLE_ID | PERF_SAMPLE_CPU
-      | PERF_SAMPLE_PERIOD | PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_REGS_USER
-      | PERF_SAMPLE_STACK_USER));
+      | PERF_SAMPLE_PERIOD | PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_RAW
+      | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER));
   ip_data.ip = ip;
   tid_data.pid = pid;
   tid_data.tid = tid;
@@ -478,7 +478,9 @@ SampleRecord::SampleRecord(const perf_event_attr& attr, uint64_t id,
   cpu_data.res = 0;
   period_data.period = period;
   callchain_data.ip_nr = ips.size();
-  raw_data.size = 0;
+  // An empty raw data block, like the kernel dumps for events having no raw
+  // data when PERF_SAMPLE_RAW is set.
+  raw_data.size = (sample_type & PERF_SAMPLE_RAW) ? sizeof(uint32_t) : 0;
   branch_stack_data.stack_nr = 0;
   regs_user_data.abi = 0;
   regs_user_data.reg_mask = 0;
@@ -506,6 +508,9 @@ SampleRecord::SampleRecord(const perf_event_attr& attr, uint64_t id,
   if (sample_type & PERF_SAMPLE_CALLCHAIN) {
     size += sizeof(uint64_t) * (ips.size() + 1);
   }
+  if (sample_type & PERF_SAMPLE_RAW) {
+    size += sizeof(uint32_t) + raw_data.size;
+  }
   if (sample_type & PERF_SAMPLE_REGS_USER) {
     size += sizeof(uint64_t);
   }
@@ -540,6 +545,12 @@ SampleRecord::SampleRecord(const perf_event_attr& attr, uint64_t id,
     callchain_data.ips = reinterpret_cast<uint64_t*>(p);
     MoveToBinaryFormat(ips.data(), ips.size(), p);
   }
+  if (sample_type & PERF_SAMPLE_RAW) {
+    MoveToBinaryFormat(raw_data.size, p);
+    uint32_t dummy_raw = 0;
+    raw_data.data = p;
+    MoveToBinaryFormat(dummy_raw, p);
+  }
   if (sample_type & PERF_SAMPLE_REGS_USER) {
     MoveToBinaryFormat(regs_user_data.abi, p);
   }
@@ -550,6 +561,28 @@ SampleRecord::SampleRecord(const perf_event_attr& attr, uint64_t id,
   UpdateBinary(new_binary);
 }
 
+void SampleRecord::TruncateUserStack() {
+  if ((sample_type & PERF_SAMPLE_STACK_USER) == 0 ||
+      stack_user_data.size == 0) {
+    return;
+  }
+  // GetValidStackSize() returns the full dump when dyn_size is 0, so kernels
+  // not reporting dyn_size keep their stacks untouched.
+  uint64_t new_size = Align(GetValidStackSize(), sizeof(uint64_t));
+  if (new_size >= stack_user_data.size) {
+    return;
+  }
+  // The stack dump is the last part of a sample record, laid out as
+  // [u64 size][data][u64 dyn_size], so it can be shrunk in place.
+  char* p = const_cast<char*>(stack_user_data.data);
+  *reinterpret_cast<uint64_t*>(p - sizeof(uint64_t)) = new_size;
+  *reinterpret_cast<uint64_t*>(p + new_size) = stack_user_data.dyn_size;
+  SetSize(size() - (stack_user_data.size - new_size));
+  stack_user_data.size = new_size;
+  char* header_p = const_cast<char*>(binary_);
+  MoveToBinaryFormat(header, header_p);
+}
+
 void SampleRecord::ReplaceRegAndStackWithCallChain(
     const std::vector<uint64_t>& ips) {
   uint32_t size_added_in_callchain = sizeof(uint64_t) * (ips.size() + 1);
@@ -46,6 +46,10 @@ enum user_record_type {
   SIMPLE_PERF_RECORD_SPLIT,
   SIMPLE_PERF_RECORD_SPLIT_END,
   SIMPLE_PERF_RECORD_EVENT_ID,
+  // A compressed block of serialized records. Its data is a uint32_t
+  // decompressed size, followed by zlib-compressed record data. A serialized
+  // record can span two or more compressed records.
+  SIMPLE_PERF_RECORD_COMPRESSED,
 };
 
 // perf_event_header uses u16 to store record size. However, that is not
@@ -387,6 +391,11 @@ struct SampleRecord : public Record {
                uint64_t period, const std::vector<uint64_t>& ips);
 
   void ReplaceRegAndStackWithCallChain(const std::vector<uint64_t>& ips);
+  // Shrink the user stack dump to its valid part (dyn_size). The kernel
+  // always copies sample_stack_user bytes per sample, so shallow stacks
+  // carry mostly garbage padding, which dominates record file size when raw
+  // stacks are written instead of being replaced by unwound callchains.
+  void TruncateUserStack();
   uint64_t Timestamp() const override;
   uint32_t Cpu() const override;
   uint64_t Id() const override;
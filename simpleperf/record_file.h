@@ -19,11 +19,14 @@
 
 #include <stdio.h>
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <android-base/macros.h>
@@ -44,6 +47,17 @@ class RecordFileWriter {
 
   bool WriteAttrSection(const std::vector<EventAttrWithId>& attr_ids);
   bool WriteRecord(const Record& record);
+  // Write an already serialized record of [type]. Used by RecordWriteQueue,
+  // whose writer thread only sees serialized records. [timestamp] is the
+  // record's timestamp, used to build the record time index; pass 0 when the
+  // record has none.
+  bool WriteRecordData(uint32_t type, const void* buf, size_t size,
+                       uint64_t timestamp = 0);
+
+  // Compress record data written afterwards. Records are collected in a
+  // pending buffer and written as SIMPLE_PERF_RECORD_COMPRESSED records, one
+  // per compressed block. It should be called before writing any record.
+  void SetCompressRecords(bool enable) { compress_records_ = enable; }
 
   bool ReadDataSection(const std::function<void(const Record*)>& callback);
 
@@ -52,10 +66,21 @@ class RecordFileWriter {
   bool WriteFeatureString(int feature, const std::string& s);
   bool WriteCmdlineFeature(const std::vector<std::string>& cmdline);
   bool WriteBranchStackFeature();
+  // Write serialized tracing formats, see SerializeTracingFormats().
+  bool WriteTracingFormatCacheFeature(const std::vector<char>& data);
   bool WriteFileFeature(const std::string& file_path,
                         uint32_t file_type,
                         uint64_t min_vaddr,
                         const std::vector<const Symbol*>& symbols);
+  // Write the record type index feature section, mapping each record type to
+  // the data section offsets of its records, see record_file_format.h. Don't
+  // call it when SetCompressRecords() is enabled: records inside compressed
+  // blocks have no seekable offsets, so no index is collected for them.
+  bool WriteRecordTypeIndexFeature();
+  // Write the record time index feature section, mapping record timestamps
+  // to data section offsets, see record_file_format.h. Like the record type
+  // index, don't call it when SetCompressRecords() is enabled.
+  bool WriteRecordTimeIndexFeature();
   bool EndWriteFeatures();
 
   // Normally, Close() should be called after writing. But if something
@@ -70,6 +95,11 @@ class RecordFileWriter {
                              std::vector<std::string>* hit_user_files);
   bool WriteFileHeader();
   bool WriteData(const void* buf, size_t len);
+  // Compress pending record data into SIMPLE_PERF_RECORD_COMPRESSED records,
+  // one per block of COMPRESSION_BLOCK_SIZE bytes. If [flush], also compress
+  // the incomplete last block.
+  bool WriteCompressedRecords(bool flush);
+  void PreAllocateData(uint64_t file_end);
   bool Write(const void* buf, size_t len);
   bool Read(void* buf, size_t len);
   bool GetFilePos(uint64_t* file_pos);
@@ -87,8 +117,25 @@ class RecordFileWriter {
   uint64_t data_section_size_;
   uint64_t feature_section_offset_;
 
+  bool compress_records_;
+  std::vector<char> compress_pending_data_;
+
+  // File offset up to which blocks have been preallocated with fallocate().
+  uint64_t preallocated_size_;
+  bool preallocate_failed_;
+
   std::map<int, PerfFileFormat::SectionDesc> features_;
   size_t feature_count_;
+  // Data section offsets of the written records, by record type, collected
+  // for WriteRecordTypeIndexFeature(). Costs 8 bytes of memory per record
+  // while recording, against an average record size near 100 bytes.
+  std::map<uint32_t, std::vector<uint64_t>> record_type_index_;
+  // (offset, max timestamp of records before offset) pairs sampled about
+  // every TIME_INDEX_INTERVAL bytes of record data, collected for
+  // WriteRecordTimeIndexFeature().
+  std::vector<std::pair<uint64_t, uint64_t>> record_time_index_;
+  uint64_t max_record_time_;
+  uint64_t next_time_index_offset_;
 
   DISALLOW_COPY_AND_ASSIGN(RecordFileWriter);
 };
@@ -96,8 +143,17 @@ class RecordFileWriter {
 // RecordFileReader read contents from a perf record file, like perf.data.
 class RecordFileReader {
  public:
+  // Open [filename] for reading. If [filename] doesn't exist but chunk files
+  // written by `simpleperf record --split-size` do, open the newest chunk
+  // and stitch the earlier chunks in when reading data sections and
+  // features.
   static std::unique_ptr<RecordFileReader> CreateInstance(const std::string& filename);
 
+  // Return the chunk files ("<filename>.1", "<filename>.2", ...) written by
+  // `simpleperf record --split-size`, sorted by chunk index. Chunks deleted
+  // by --max-files leave a gap at the front of the sequence.
+  static std::vector<std::string> GetSplitFileNames(const std::string& filename);
+
   ~RecordFileReader();
 
   const PerfFileFormat::FileHeader& FileHeader() const {
@@ -119,8 +175,14 @@ class RecordFileReader {
   bool HasFeature(int feature) const {
     return feature_section_descriptors_.find(feature) != feature_section_descriptors_.end();
   }
+  // Read the data of a feature section. Each section is only read from the
+  // file once and cached, as commands request the same sections repeatedly.
   bool ReadFeatureSection(int feature, std::vector<char>* data);
 
+  // Return a map from file path to build id, parsed once from the BUILD_ID
+  // feature section.
+  const std::unordered_map<std::string, BuildId>& ReadBuildIdMap();
+
   // There are two ways to read records in data section: one is by calling
   // ReadDataSection(), and [callback] is called for each Record. the other
   // is by calling ReadRecord() in a loop.
@@ -129,6 +191,49 @@ class RecordFileReader {
   bool ReadDataSection(const std::function<bool(std::unique_ptr<Record>)>& callback,
                        bool sorted = true);
 
+  // Like ReadDataSection() with sorted = false, but records whose header type
+  // is rejected by [type_filter] are skipped using only the record header,
+  // without being parsed. Used to inspect big record files cheaply.
+  bool ReadDataSectionFiltered(
+      const std::function<bool(uint32_t)>& type_filter,
+      const std::function<bool(std::unique_ptr<Record>)>& callback);
+
+  // Like ReadDataSectionFiltered(), but passes the raw bytes of each accepted
+  // record (after SPLIT reassembly and decompression) instead of parsing them.
+  bool ReadDataSectionRaw(
+      const std::function<bool(uint32_t)>& type_filter,
+      const std::function<bool(uint32_t, const char*, size_t)>& callback);
+
+  // Return the record type index parsed from the RECORD_TYPE_INDEX feature
+  // section, mapping record type to the data section offsets of its records.
+  // Return nullptr if the file has no (valid) index.
+  const std::map<uint32_t, std::vector<uint64_t>>* ReadRecordTypeIndex();
+
+  // Return the record time index parsed from the RECORD_TIME_INDEX feature
+  // section, mapping data section offsets to the maximum timestamp of the
+  // records before them. Return nullptr if the file has no (valid) index, or
+  // if its records carry no timestamps.
+  const std::vector<std::pair<uint64_t, uint64_t>>* ReadRecordTimeIndex();
+
+  // Pass the records with timestamps in [begin_time, end_time) to
+  // [callback], sorted like ReadDataSection(), preceded by the non-sample
+  // records from before the range so callers see the thread and map state
+  // the in-range samples depend on. Seeks near the start of the range using
+  // the record time index and stops shortly after its end, skipping the I/O
+  // and parsing for the rest of the data section; without an index, falls
+  // back to scanning from the beginning.
+  bool ReadDataSectionTimeRange(
+      uint64_t begin_time, uint64_t end_time,
+      const std::function<bool(std::unique_ptr<Record>)>& callback);
+
+  // Pass each record whose type is in [types] to [callback], in file order.
+  // Seeks straight to the records using the record type index when the file
+  // has one, and falls back to scanning the data section like
+  // ReadDataSectionFiltered() otherwise.
+  bool ReadRecordsOfTypes(
+      const std::unordered_set<uint32_t>& types,
+      const std::function<bool(std::unique_ptr<Record>)>& callback);
+
   // Read next record. If read successfully, set [record] and return true.
   // If there is no more records, set [record] to nullptr and return true.
   // Otherwise return false.
@@ -158,28 +263,81 @@ class RecordFileReader {
 
  private:
   RecordFileReader(const std::string& filename, FILE* fp);
+  void LoadFileFeatures(ThreadTree& thread_tree);
   bool ReadHeader();
   bool ReadAttrSection();
   bool ReadIdsForAttr(const PerfFileFormat::FileAttr& attr, std::vector<uint64_t>* ids);
   bool ReadFeatureSectionDescriptors();
+  void MmapWholeFile();
+  // Start a background thread hinting the kernel to read the data section
+  // ahead of the parse cursor, so cold cache traversal from slow storage
+  // overlaps I/O with parsing instead of alternating them. The thread stays
+  // a bounded window ahead of data_consumed_pos_, and exits on its own after
+  // hinting the whole section.
+  void StartDataSectionPrefetch();
+  void StopDataSectionPrefetch();
   std::unique_ptr<Record> ReadRecord(uint64_t* nbytes_read);
+  // Read the record starting at [offset] relative to the data section start,
+  // reassembling a SPLIT sequence if the offset points at one.
+  std::unique_ptr<Record> ReadRecordAtOffset(uint64_t offset);
+  const char* ReadRecordData(std::unique_ptr<char[]>* pp,
+                             uint64_t* nbytes_read);
+  std::unique_ptr<Record> ParseRecord(const char* record_p,
+                                      std::unique_ptr<char[]> p);
   bool Read(void* buf, size_t len);
   void ProcessEventIdRecord(const EventIdRecord& r);
+  // Decompress the data of a SIMPLE_PERF_RECORD_COMPRESSED record and append
+  // it to decompressed_data_. As a serialized record can span compressed
+  // records, decompressed_data_ may end with an incomplete record.
+  bool DecompressRecordData(const char* data, size_t size);
+  bool HasCompleteDecompressedRecord() {
+    if (decompressed_pos_ + Record::header_size() > decompressed_data_.size()) {
+      return false;
+    }
+    RecordHeader header(decompressed_data_.data() + decompressed_pos_);
+    return decompressed_pos_ + header.size <= decompressed_data_.size();
+  }
 
   const std::string filename_;
   FILE* record_fp_;
+  // For a split chunk sequence, the chunk files recorded before this one, in
+  // record order.
+  std::vector<std::string> split_filenames_;
+  // If the file is mapped successfully, records hold pointers into the mapped
+  // file instead of owning copies, avoiding a per-record allocation.
+  char* mmap_addr_;
+  size_t mmap_len_;
 
   PerfFileFormat::FileHeader header_;
   std::vector<PerfFileFormat::FileAttr> file_attrs_;
   std::vector<std::vector<uint64_t>> event_ids_for_file_attrs_;
   std::unordered_map<uint64_t, size_t> event_id_to_attr_map_;
   std::map<int, PerfFileFormat::SectionDesc> feature_section_descriptors_;
+  std::map<int, std::vector<char>> feature_section_cache_;
+  std::unordered_map<std::string, BuildId> build_id_map_;
+  bool build_id_map_loaded_;
+  std::map<uint32_t, std::vector<uint64_t>> record_type_index_;
+  bool record_type_index_loaded_;
+  bool record_type_index_valid_;
+  std::vector<std::pair<uint64_t, uint64_t>> record_time_index_;
+  bool record_time_index_loaded_;
+  bool record_time_index_valid_;
 
   size_t event_id_pos_in_sample_records_;
   size_t event_id_reverse_pos_in_non_sample_records_;
 
   std::unique_ptr<RecordCache> record_cache_;
   uint64_t read_record_size_;
+  // Bytes of the data section consumed so far, updated by ReadRecordData()
+  // and read by the prefetch thread to pace itself.
+  std::atomic<uint64_t> data_consumed_pos_;
+  std::atomic<bool> stop_prefetch_;
+  std::thread prefetch_thread_;
+  // Record data decompressed from SIMPLE_PERF_RECORD_COMPRESSED records,
+  // waiting to be parsed. Already parsed data before decompressed_pos_ is
+  // discarded when new compressed records are decompressed.
+  std::vector<char> decompressed_data_;
+  size_t decompressed_pos_;
 
   DISALLOW_COPY_AND_ASSIGN(RecordFileReader);
 };
@@ -26,6 +26,11 @@
 //    data section
 //    feature section
 //
+//  When the data section is written with compression enabled, it contains
+//  SIMPLE_PERF_RECORD_COMPRESSED records, each storing a zlib-compressed
+//  block of serialized records. RecordFileReader decompresses them
+//  transparently.
+//
 //  The feature section has the following structure:
 //    a section descriptor array, each element contains the section information of one add_feature.
 //    data section of feature 1
@@ -48,6 +53,59 @@
 //    } symbol_table;
 //  };
 
+// tracing format cache feature section:
+//  It stores the TracingFormat structs parsed from the event format files in
+//  the tracing data feature section, so readers don't need to parse the
+//  format files again.
+//
+//  uint32_t format_count;
+//  struct {
+//    char system_name[];  // ended by '\0'
+//    char name[];         // ended by '\0'
+//    uint64_t id;
+//    uint32_t field_count;
+//    struct {
+//      char name[];  // ended by '\0'
+//      uint32_t offset;
+//      uint32_t elem_size;
+//      uint32_t elem_count;
+//      uint32_t is_signed;
+//    } fields[field_count];
+//  } formats[format_count];
+
+// record type index feature section:
+//  It maps each record type in the data section to the offsets of its
+//  records, so a consumer of one record type (like LOST records) can seek
+//  straight to them instead of scanning the whole data section. Offsets are
+//  relative to the start of the data section and point at record headers;
+//  for a record written as a SPLIT sequence, at its first SPLIT record. The
+//  index is not written when the data section is compressed, as records
+//  inside compressed blocks have no seekable offsets.
+//
+//  uint32_t type_count;
+//  struct {
+//    uint32_t type;
+//    uint32_t record_count;
+//    uint64_t offsets[record_count];
+//  } types[type_count];
+
+// record time index feature section:
+//  It maps record timestamps to data section offsets, so a reader asked for
+//  a time range can seek near the start of the range instead of parsing the
+//  data section from the beginning. An entry is sampled about every
+//  TIME_INDEX_INTERVAL bytes of record data; max_time is the maximum
+//  timestamp of all records written before offset, so seeking to the last
+//  entry with max_time below the range start can only skip records from
+//  before the range. The last entry is always written at the end of the data
+//  section. Like the record type index, it is not written when the data
+//  section is compressed.
+//
+//  uint32_t entry_count;
+//  struct {
+//    uint64_t offset;    // relative to the start of the data section
+//    uint64_t max_time;
+//  } entries[entry_count];
+
 namespace PerfFileFormat {
 
 enum {
@@ -74,6 +132,9 @@ enum {
 
   FEAT_SIMPLEPERF_START = 128,
   FEAT_FILE = FEAT_SIMPLEPERF_START,
+  FEAT_TRACING_FORMAT_CACHE,
+  FEAT_RECORD_TYPE_INDEX,
+  FEAT_RECORD_TIME_INDEX,
   FEAT_MAX_NUM = 256,
 };
 
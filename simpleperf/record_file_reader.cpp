@@ -16,37 +16,105 @@
 
 #include "record_file.h"
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include <set>
 #include <vector>
 
 #include <android-base/logging.h>
 
+#include <zlib.h>
+
 #include "event_attr.h"
 #include "record.h"
 #include "utils.h"
 
 using namespace PerfFileFormat;
 
+std::vector<std::string> RecordFileReader::GetSplitFileNames(
+    const std::string& filename) {
+  std::string dirname = ".";
+  std::string basename = filename;
+  size_t pos = filename.rfind('/');
+  if (pos != std::string::npos) {
+    dirname = filename.substr(0, pos);
+    basename = filename.substr(pos + 1);
+  }
+  std::vector<std::pair<uint64_t, std::string>> chunks;
+  DIR* dir = opendir(dirname.c_str());
+  if (dir == nullptr) {
+    return std::vector<std::string>();
+  }
+  dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    std::string name = entry->d_name;
+    if (name.size() <= basename.size() + 1 ||
+        name.compare(0, basename.size(), basename) != 0 ||
+        name[basename.size()] != '.') {
+      continue;
+    }
+    const char* index_str = name.c_str() + basename.size() + 1;
+    char* endptr;
+    uint64_t index = strtoull(index_str, &endptr, 10);
+    if (endptr == index_str || *endptr != '\0') {
+      continue;
+    }
+    chunks.push_back(std::make_pair(index, dirname + "/" + name));
+  }
+  closedir(dir);
+  std::sort(chunks.begin(), chunks.end());
+  std::vector<std::string> result;
+  for (auto& chunk : chunks) {
+    result.push_back(std::move(chunk.second));
+  }
+  return result;
+}
+
 std::unique_ptr<RecordFileReader> RecordFileReader::CreateInstance(const std::string& filename) {
   std::string mode = std::string("rb") + CLOSE_ON_EXEC_MODE;
   FILE* fp = fopen(filename.c_str(), mode.c_str());
   if (fp == nullptr) {
-    PLOG(ERROR) << "failed to open record file '" << filename << "'";
-    return nullptr;
+    // The record may be a split chunk sequence written by
+    // `simpleperf record --split-size`, which has no file at [filename]
+    // itself.
+    std::vector<std::string> chunks = GetSplitFileNames(filename);
+    if (chunks.empty()) {
+      PLOG(ERROR) << "failed to open record file '" << filename << "'";
+      return nullptr;
+    }
+    // Open the newest chunk as the main file. The data sections and features
+    // of the earlier chunks are stitched in by ReadDataSection() and
+    // LoadBuildIdAndFileFeatures().
+    std::unique_ptr<RecordFileReader> reader = CreateInstance(chunks.back());
+    if (reader != nullptr) {
+      chunks.pop_back();
+      reader->split_filenames_ = std::move(chunks);
+    }
+    return reader;
   }
   auto reader = std::unique_ptr<RecordFileReader>(new RecordFileReader(filename, fp));
   if (!reader->ReadHeader() || !reader->ReadAttrSection() ||
       !reader->ReadFeatureSectionDescriptors()) {
     return nullptr;
   }
+  reader->MmapWholeFile();
   return reader;
 }
 
 RecordFileReader::RecordFileReader(const std::string& filename, FILE* fp)
-    : filename_(filename), record_fp_(fp), event_id_pos_in_sample_records_(0),
-      event_id_reverse_pos_in_non_sample_records_(0), read_record_size_(0) {
+    : filename_(filename), record_fp_(fp), mmap_addr_(nullptr), mmap_len_(0),
+      event_id_pos_in_sample_records_(0),
+      event_id_reverse_pos_in_non_sample_records_(0), read_record_size_(0),
+      data_consumed_pos_(0), stop_prefetch_(false), decompressed_pos_(0),
+      build_id_map_loaded_(false), record_type_index_loaded_(false),
+      record_type_index_valid_(false), record_time_index_loaded_(false),
+      record_time_index_valid_(false) {
 }
 
 RecordFileReader::~RecordFileReader() {
@@ -57,6 +125,15 @@ RecordFileReader::~RecordFileReader() {
 
 bool RecordFileReader::Close() {
   bool result = true;
+  StopDataSectionPrefetch();
+  if (mmap_addr_ != nullptr) {
+    if (munmap(mmap_addr_, mmap_len_) == -1) {
+      PLOG(ERROR) << "failed to munmap record file '" << filename_ << "'";
+      result = false;
+    }
+    mmap_addr_ = nullptr;
+    mmap_len_ = 0;
+  }
   if (fclose(record_fp_) != 0) {
     PLOG(ERROR) << "failed to close record file '" << filename_ << "'";
     result = false;
@@ -165,8 +242,56 @@ bool RecordFileReader::ReadIdsForAttr(const FileAttr& attr, std::vector<uint64_t
   return true;
 }
 
+void RecordFileReader::StartDataSectionPrefetch() {
+#if defined(__linux__)
+  if (prefetch_thread_.joinable() || header_.data.size == 0) {
+    return;
+  }
+  int fd = fileno(record_fp_);
+  uint64_t data_offset = header_.data.offset;
+  uint64_t data_size = header_.data.size;
+  prefetch_thread_ = std::thread([this, fd, data_offset, data_size]() {
+    // How far the prefetcher may run ahead of the parse cursor. Hinting the
+    // whole section at once could let early pages be evicted again before
+    // they are parsed on files bigger than memory.
+    constexpr uint64_t kPrefetchWindowBytes = 64 * 1024 * 1024;
+    constexpr uint64_t kPrefetchChunkBytes = 2 * 1024 * 1024;
+    uint64_t pos = 0;
+    while (pos < data_size && !stop_prefetch_) {
+      if (pos > data_consumed_pos_ + kPrefetchWindowBytes) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      uint64_t len = std::min(kPrefetchChunkBytes, data_size - pos);
+      // The hint starts asynchronous readahead into the page cache, which
+      // also backs the mapped file in mmap mode.
+      posix_fadvise(fd, data_offset + pos, len, POSIX_FADV_WILLNEED);
+      pos += len;
+    }
+  });
+#endif  // defined(__linux__)
+}
+
+void RecordFileReader::StopDataSectionPrefetch() {
+  if (prefetch_thread_.joinable()) {
+    stop_prefetch_ = true;
+    prefetch_thread_.join();
+    stop_prefetch_ = false;
+  }
+}
+
 bool RecordFileReader::ReadDataSection(
     const std::function<bool(std::unique_ptr<Record>)>& callback, bool sorted) {
+  // Stitch in earlier chunks of a split chunk sequence. Each chunk is sorted
+  // on its own, and chunks don't overlap in time, so the whole sequence is
+  // passed to [callback] in order.
+  for (const auto& filename : split_filenames_) {
+    std::unique_ptr<RecordFileReader> reader = CreateInstance(filename);
+    if (reader == nullptr || !reader->ReadDataSection(callback, sorted)) {
+      return false;
+    }
+  }
+  StartDataSectionPrefetch();
   std::unique_ptr<Record> record;
   while (ReadRecord(record, sorted)) {
     if (record == nullptr) {
@@ -179,6 +304,341 @@ bool RecordFileReader::ReadDataSection(
   return false;
 }
 
+bool RecordFileReader::ReadDataSectionFiltered(
+    const std::function<bool(uint32_t)>& type_filter,
+    const std::function<bool(std::unique_ptr<Record>)>& callback) {
+  if (fseek(record_fp_, header_.data.offset, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  StartDataSectionPrefetch();
+  uint64_t nbytes_read = 0;
+  while (nbytes_read < header_.data.size || HasCompleteDecompressedRecord()) {
+    std::unique_ptr<char[]> p;
+    const char* record_p = ReadRecordData(&p, &nbytes_read);
+    if (record_p == nullptr) {
+      return false;
+    }
+    RecordHeader header(record_p);
+    // EVENT_ID records map event ids to attrs and must always be parsed, or
+    // records in files with multiple attrs are parsed with the wrong attr.
+    if (header.type != SIMPLE_PERF_RECORD_EVENT_ID &&
+        !type_filter(header.type)) {
+      continue;
+    }
+    std::unique_ptr<Record> record = ParseRecord(record_p, std::move(p));
+    if (record == nullptr) {
+      return false;
+    }
+    if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+      ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
+      if (!type_filter(record->type())) {
+        continue;
+      }
+    }
+    if (!callback(std::move(record))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RecordFileReader::ReadDataSectionRaw(
+    const std::function<bool(uint32_t)>& type_filter,
+    const std::function<bool(uint32_t, const char*, size_t)>& callback) {
+  if (fseek(record_fp_, header_.data.offset, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  StartDataSectionPrefetch();
+  uint64_t nbytes_read = 0;
+  while (nbytes_read < header_.data.size || HasCompleteDecompressedRecord()) {
+    std::unique_ptr<char[]> p;
+    const char* record_p = ReadRecordData(&p, &nbytes_read);
+    if (record_p == nullptr) {
+      return false;
+    }
+    RecordHeader header(record_p);
+    if (!type_filter(header.type)) {
+      continue;
+    }
+    if (!callback(header.type, record_p, header.size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const std::map<uint32_t, std::vector<uint64_t>>*
+RecordFileReader::ReadRecordTypeIndex() {
+  if (!record_type_index_loaded_) {
+    record_type_index_loaded_ = true;
+    std::vector<char> data;
+    if (HasFeature(FEAT_RECORD_TYPE_INDEX) &&
+        ReadFeatureSection(FEAT_RECORD_TYPE_INDEX, &data) &&
+        data.size() >= sizeof(uint32_t)) {
+      const char* p = data.data();
+      const char* end = p + data.size();
+      uint32_t type_count;
+      MoveFromBinaryFormat(type_count, p);
+      record_type_index_valid_ = true;
+      for (uint32_t i = 0; i < type_count; ++i) {
+        uint32_t type;
+        uint32_t record_count;
+        if (static_cast<size_t>(end - p) < 2 * sizeof(uint32_t)) {
+          record_type_index_valid_ = false;
+          break;
+        }
+        MoveFromBinaryFormat(type, p);
+        MoveFromBinaryFormat(record_count, p);
+        if (static_cast<uint64_t>(end - p) <
+            static_cast<uint64_t>(record_count) * sizeof(uint64_t)) {
+          record_type_index_valid_ = false;
+          break;
+        }
+        std::vector<uint64_t>& offsets = record_type_index_[type];
+        offsets.resize(record_count);
+        MoveFromBinaryFormat(offsets.data(), record_count, p);
+      }
+      if (!record_type_index_valid_) {
+        LOG(ERROR) << "invalid record type index in " << filename_;
+        record_type_index_.clear();
+      }
+    }
+  }
+  return record_type_index_valid_ ? &record_type_index_ : nullptr;
+}
+
+const std::vector<std::pair<uint64_t, uint64_t>>*
+RecordFileReader::ReadRecordTimeIndex() {
+  if (!record_time_index_loaded_) {
+    record_time_index_loaded_ = true;
+    std::vector<char> data;
+    if (HasFeature(FEAT_RECORD_TIME_INDEX) &&
+        ReadFeatureSection(FEAT_RECORD_TIME_INDEX, &data) &&
+        data.size() >= sizeof(uint32_t)) {
+      const char* p = data.data();
+      const char* end = p + data.size();
+      uint32_t entry_count;
+      MoveFromBinaryFormat(entry_count, p);
+      record_time_index_valid_ =
+          static_cast<uint64_t>(end - p) ==
+          static_cast<uint64_t>(entry_count) * 2 * sizeof(uint64_t);
+      for (uint32_t i = 0; record_time_index_valid_ && i < entry_count; ++i) {
+        uint64_t offset;
+        uint64_t max_time;
+        MoveFromBinaryFormat(offset, p);
+        MoveFromBinaryFormat(max_time, p);
+        // Both offsets and max timestamps grow monotonically, see
+        // record_file_format.h.
+        if (offset > header_.data.size ||
+            (!record_time_index_.empty() &&
+             (offset < record_time_index_.back().first ||
+              max_time < record_time_index_.back().second))) {
+          record_time_index_valid_ = false;
+        } else {
+          record_time_index_.emplace_back(offset, max_time);
+        }
+      }
+      if (!record_time_index_valid_) {
+        LOG(ERROR) << "invalid record time index in " << filename_;
+        record_time_index_.clear();
+      } else if (record_time_index_.empty() ||
+                 record_time_index_.back().second == 0) {
+        // The records carry no timestamps, so the index can't locate
+        // anything. Not an error, just useless.
+        record_time_index_valid_ = false;
+        record_time_index_.clear();
+      }
+    }
+  }
+  return record_time_index_valid_ ? &record_time_index_ : nullptr;
+}
+
+bool RecordFileReader::ReadRecordsOfTypes(
+    const std::unordered_set<uint32_t>& types,
+    const std::function<bool(std::unique_ptr<Record>)>& callback) {
+  const std::map<uint32_t, std::vector<uint64_t>>* index = ReadRecordTypeIndex();
+  if (index == nullptr) {
+    auto type_filter = [&](uint32_t type) {
+      return types.find(type) != types.end();
+    };
+    return ReadDataSectionFiltered(type_filter, callback);
+  }
+  // Records in files with multiple attrs need the EVENT_ID records to be
+  // parsed with the attr they were recorded with.
+  if (file_attrs_.size() > 1) {
+    auto it = index->find(SIMPLE_PERF_RECORD_EVENT_ID);
+    if (it != index->end()) {
+      for (uint64_t offset : it->second) {
+        std::unique_ptr<Record> record = ReadRecordAtOffset(offset);
+        if (record == nullptr) {
+          return false;
+        }
+        ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
+      }
+    }
+  }
+  std::vector<uint64_t> offsets;
+  for (uint32_t type : types) {
+    auto it = index->find(type);
+    if (it != index->end()) {
+      offsets.insert(offsets.end(), it->second.begin(), it->second.end());
+    }
+  }
+  // Merge the per-type offset lists back into file order.
+  std::sort(offsets.begin(), offsets.end());
+  for (uint64_t offset : offsets) {
+    std::unique_ptr<Record> record = ReadRecordAtOffset(offset);
+    if (record == nullptr) {
+      return false;
+    }
+    if (!callback(std::move(record))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<Record> RecordFileReader::ReadRecordAtOffset(uint64_t offset) {
+  if (offset >= header_.data.size) {
+    LOG(ERROR) << "record offset out of the data section in " << filename_;
+    return nullptr;
+  }
+  if (mmap_addr_ == nullptr &&
+      fseek(record_fp_, header_.data.offset + offset, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return nullptr;
+  }
+  // ReadRecordData() reads at [nbytes_read] bytes into the data section,
+  // reassembling a SPLIT sequence if the offset points at one. Indexed files
+  // are never compressed, so no decompression state is involved.
+  uint64_t nbytes_read = offset;
+  return ReadRecord(&nbytes_read);
+}
+
+bool RecordFileReader::ReadDataSectionTimeRange(
+    uint64_t begin_time, uint64_t end_time,
+    const std::function<bool(std::unique_ptr<Record>)>& callback) {
+  // Stitch in earlier chunks of a split chunk sequence like
+  // ReadDataSection(). Chunks from before the range only contribute their
+  // non-sample records, and their scans stop early.
+  for (const auto& filename : split_filenames_) {
+    std::unique_ptr<RecordFileReader> reader = CreateInstance(filename);
+    if (reader == nullptr ||
+        !reader->ReadDataSectionTimeRange(begin_time, end_time, callback)) {
+      return false;
+    }
+  }
+  // Records are written slightly out of time order (per-cpu buffers are
+  // drained in turn), so scan on past end_time until the maximum seen
+  // timestamp exceeds it by this much before stopping.
+  constexpr uint64_t TIME_RANGE_SLACK_IN_NS = 1000000000;
+  const std::vector<std::pair<uint64_t, uint64_t>>* time_index =
+      ReadRecordTimeIndex();
+  const std::map<uint32_t, std::vector<uint64_t>>* type_index =
+      ReadRecordTypeIndex();
+  uint64_t start_offset = 0;
+  if (time_index != nullptr && type_index != nullptr) {
+    // An entry's max timestamp covers every record before its offset, so
+    // seeking to the last entry with max_time < begin_time can only skip
+    // records from before the range. The type index is also needed, to
+    // replay the non-sample records from the skipped prefix; without it,
+    // scan the whole section.
+    for (const auto& entry : *time_index) {
+      if (entry.second >= begin_time) {
+        break;
+      }
+      start_offset = entry.first;
+    }
+  }
+  if (start_offset > 0) {
+    // Replay the non-sample records (COMM, MMAP, FORK, ...) from the skipped
+    // prefix, so callers see the thread and map state the in-range samples
+    // depend on. Non-sample records are rare, so reading them by offset is
+    // cheap.
+    std::vector<uint64_t> offsets;
+    for (const auto& pair : *type_index) {
+      if (pair.first == PERF_RECORD_SAMPLE) {
+        continue;
+      }
+      for (uint64_t offset : pair.second) {
+        if (offset < start_offset) {
+          offsets.push_back(offset);
+        }
+      }
+    }
+    // Merge the per-type offset lists back into file order.
+    std::sort(offsets.begin(), offsets.end());
+    for (uint64_t offset : offsets) {
+      std::unique_ptr<Record> record = ReadRecordAtOffset(offset);
+      if (record == nullptr) {
+        return false;
+      }
+      if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+        ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
+      }
+      if (!callback(std::move(record))) {
+        return false;
+      }
+    }
+  } else {
+    // Only prefetch when scanning from the start: the prefetch thread hints
+    // the data section from the beginning, which would read back the very
+    // prefix the seek skips.
+    StartDataSectionPrefetch();
+  }
+  if (fseek(record_fp_, header_.data.offset + start_offset, SEEK_SET) != 0) {
+    PLOG(ERROR) << "fseek() failed";
+    return false;
+  }
+  bool has_timestamp = true;
+  for (const auto& attr : file_attrs_) {
+    if (!IsTimestampSupported(attr.attr)) {
+      has_timestamp = false;
+      break;
+    }
+  }
+  // Sort the records passed to [callback] like ReadDataSection() does.
+  RecordCache cache(has_timestamp);
+  uint64_t nbytes_read = start_offset;
+  uint64_t max_seen_time = 0;
+  while (nbytes_read < header_.data.size || HasCompleteDecompressedRecord()) {
+    std::unique_ptr<Record> record = ReadRecord(&nbytes_read);
+    if (record == nullptr) {
+      return false;
+    }
+    if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
+      ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
+    }
+    uint64_t time = record->Timestamp();
+    if (time > max_seen_time) {
+      max_seen_time = time;
+    }
+    if (max_seen_time >= end_time &&
+        max_seen_time - end_time >= TIME_RANGE_SLACK_IN_NS) {
+      break;
+    }
+    // Samples outside the range are dropped; other records are passed
+    // unconditionally, as callers need them to interpret the samples.
+    if (record->type() == PERF_RECORD_SAMPLE &&
+        (time < begin_time || time >= end_time)) {
+      continue;
+    }
+    cache.Push(std::move(record));
+    record = cache.Pop();
+    if (record != nullptr && !callback(std::move(record))) {
+      return false;
+    }
+  }
+  for (auto& record : cache.PopAll()) {
+    if (!callback(std::move(record))) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool RecordFileReader::ReadRecord(std::unique_ptr<Record>& record,
                                   bool sorted) {
   if (read_record_size_ == 0) {
@@ -196,7 +656,9 @@ bool RecordFileReader::ReadRecord(std::unique_ptr<Record>& record,
     record_cache_.reset(new RecordCache(has_timestamp));
   }
   record = nullptr;
-  while (read_record_size_ < header_.data.size && record == nullptr) {
+  while ((read_record_size_ < header_.data.size ||
+          HasCompleteDecompressedRecord()) &&
+         record == nullptr) {
     record = ReadRecord(&read_record_size_);
     if (record == nullptr) {
       return false;
@@ -215,50 +677,152 @@ bool RecordFileReader::ReadRecord(std::unique_ptr<Record>& record,
   return true;
 }
 
+// Map the whole record file. Records then hold pointers into the mapped file,
+// which avoids allocating and copying a buffer per record. MAP_PRIVATE makes
+// in-place modification of records (like in
+// SampleRecord::ReplaceRegAndStackWithCallChain()) copy-on-write, without
+// touching the file. If mmap() fails (like when the address space is not big
+// enough for the file on 32-bit hosts), silently fall back to buffered reads.
+void RecordFileReader::MmapWholeFile() {
+  struct stat st;
+  if (fstat(fileno(record_fp_), &st) != 0) {
+    return;
+  }
+  size_t len = static_cast<size_t>(st.st_size);
+  void* addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fileno(record_fp_), 0);
+  if (addr == MAP_FAILED) {
+    return;
+  }
+  mmap_addr_ = static_cast<char*>(addr);
+  mmap_len_ = len;
+}
+
 std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
-  char header_buf[Record::header_size()];
-  if (!Read(header_buf, Record::header_size())) {
+  std::unique_ptr<char[]> p;
+  const char* record_p = ReadRecordData(&p, nbytes_read);
+  if (record_p == nullptr) {
     return nullptr;
   }
-  RecordHeader header(header_buf);
+  return ParseRecord(record_p, std::move(p));
+}
+
+// Read the raw bytes of the next record, reassembling SPLIT records and
+// decompressing COMPRESSED records as needed. Return a pointer to the bytes,
+// pointing either into the mapped file or into an owned buffer returned in
+// [*pp]. Return nullptr on failure.
+const char* RecordFileReader::ReadRecordData(std::unique_ptr<char[]>* pp,
+                                             uint64_t* nbytes_read) {
+  const char* record_p = nullptr;
   std::unique_ptr<char[]> p;
-  if (header.type == SIMPLE_PERF_RECORD_SPLIT) {
-    // Read until meeting a RECORD_SPLIT_END record.
-    std::vector<char> buf;
-    size_t cur_size = 0;
-    char header_buf[Record::header_size()];
-    while (header.type == SIMPLE_PERF_RECORD_SPLIT) {
-      size_t bytes_to_read = header.size - Record::header_size();
-      buf.resize(cur_size + bytes_to_read);
-      if (!Read(&buf[cur_size], bytes_to_read)) {
-        return nullptr;
+  if (HasCompleteDecompressedRecord()) {
+    // Return records in an owned copy, as decompressed_data_ is reused when
+    // the next compressed record is decompressed.
+    const char* q = decompressed_data_.data() + decompressed_pos_;
+    RecordHeader decompressed_header(q);
+    p.reset(new char[decompressed_header.size]);
+    memcpy(p.get(), q, decompressed_header.size);
+    decompressed_pos_ += decompressed_header.size;
+    record_p = p.get();
+  } else if (mmap_addr_ != nullptr) {
+    record_p = mmap_addr_ + header_.data.offset + *nbytes_read;
+    RecordHeader header(record_p);
+    if (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+      // Collect SPLIT record payloads into a continuous buffer, until meeting
+      // a RECORD_SPLIT_END record.
+      std::vector<char> buf;
+      const char* split_p = record_p;
+      while (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+        buf.insert(buf.end(), split_p + Record::header_size(),
+                   split_p + header.size);
+        *nbytes_read += header.size;
+        split_p += header.size;
+        header = RecordHeader(split_p);
       }
-      cur_size += bytes_to_read;
-      *nbytes_read += header.size;
-      if (!Read(header_buf, Record::header_size())) {
+      if (header.type != SIMPLE_PERF_RECORD_SPLIT_END) {
+        LOG(ERROR) << "SPLIT records are not followed by a SPLIT_END record.";
         return nullptr;
       }
-      header = RecordHeader(header_buf);
+      *nbytes_read += header.size;
+      p.reset(new char[buf.size()]);
+      memcpy(p.get(), buf.data(), buf.size());
+      record_p = p.get();
+    } else {
+      *nbytes_read += header.size;
     }
-    if (header.type != SIMPLE_PERF_RECORD_SPLIT_END) {
-      LOG(ERROR) << "SPLIT records are not followed by a SPLIT_END record.";
+  } else {
+    char header_buf[Record::header_size()];
+    if (!Read(header_buf, Record::header_size())) {
       return nullptr;
     }
-    *nbytes_read += header.size;
-    header = RecordHeader(buf.data());
-    p.reset(new char[header.size]);
-    memcpy(p.get(), buf.data(), buf.size());
-  } else {
-    p.reset(new char[header.size]);
-    memcpy(p.get(), header_buf, Record::header_size());
-    if (header.size > Record::header_size()) {
-      if (!Read(p.get() + Record::header_size(), header.size - Record::header_size())) {
+    RecordHeader header(header_buf);
+    if (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+      // Read until meeting a RECORD_SPLIT_END record.
+      std::vector<char> buf;
+      size_t cur_size = 0;
+      char header_buf[Record::header_size()];
+      while (header.type == SIMPLE_PERF_RECORD_SPLIT) {
+        size_t bytes_to_read = header.size - Record::header_size();
+        buf.resize(cur_size + bytes_to_read);
+        if (!Read(&buf[cur_size], bytes_to_read)) {
+          return nullptr;
+        }
+        cur_size += bytes_to_read;
+        *nbytes_read += header.size;
+        if (!Read(header_buf, Record::header_size())) {
+          return nullptr;
+        }
+        header = RecordHeader(header_buf);
+      }
+      if (header.type != SIMPLE_PERF_RECORD_SPLIT_END) {
+        LOG(ERROR) << "SPLIT records are not followed by a SPLIT_END record.";
         return nullptr;
       }
+      *nbytes_read += header.size;
+      header = RecordHeader(buf.data());
+      p.reset(new char[header.size]);
+      memcpy(p.get(), buf.data(), buf.size());
+    } else {
+      p.reset(new char[header.size]);
+      memcpy(p.get(), header_buf, Record::header_size());
+      if (header.size > Record::header_size()) {
+        if (!Read(p.get() + Record::header_size(), header.size - Record::header_size())) {
+          return nullptr;
+        }
+      }
+      *nbytes_read += header.size;
+    }
+    record_p = p.get();
+  }
+
+  RecordHeader header(record_p);
+  if (header.type == SIMPLE_PERF_RECORD_COMPRESSED) {
+    if (!DecompressRecordData(record_p + Record::header_size(),
+                              header.size - Record::header_size())) {
+      return nullptr;
     }
-    *nbytes_read += header.size;
+    // A serialized record can span compressed records. If the decompressed
+    // data still ends with an incomplete record, the recursive call reads the
+    // next compressed record.
+    if (!HasCompleteDecompressedRecord() &&
+        *nbytes_read == header_.data.size) {
+      LOG(ERROR) << "compressed record data ends with an incomplete record in "
+                 << filename_;
+      return nullptr;
+    }
+    return ReadRecordData(pp, nbytes_read);
   }
+  data_consumed_pos_ = *nbytes_read;
+  *pp = std::move(p);
+  return record_p;
+}
 
+// Parse the raw bytes of a record into a Record subclass, selecting the
+// perf_event_attr it was recorded with. [p] is the owned buffer behind
+// [record_p], or nullptr if [record_p] points into the mapped file.
+std::unique_ptr<Record> RecordFileReader::ParseRecord(const char* record_p,
+                                                      std::unique_ptr<char[]> p) {
+  RecordHeader header(record_p);
   const perf_event_attr* attr = &file_attrs_[0].attr;
   if (file_attrs_.size() > 1 && header.type < PERF_RECORD_USER_DEFINED_TYPE_START) {
     bool has_event_id = false;
@@ -266,12 +830,12 @@ std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
     if (header.type == PERF_RECORD_SAMPLE) {
       if (header.size > event_id_pos_in_sample_records_ + sizeof(uint64_t)) {
         has_event_id = true;
-        event_id = *reinterpret_cast<uint64_t*>(p.get() + event_id_pos_in_sample_records_);
+        event_id = *reinterpret_cast<const uint64_t*>(record_p + event_id_pos_in_sample_records_);
       }
     } else {
       if (header.size > event_id_reverse_pos_in_non_sample_records_) {
         has_event_id = true;
-        event_id = *reinterpret_cast<uint64_t*>(p.get() + header.size - event_id_reverse_pos_in_non_sample_records_);
+        event_id = *reinterpret_cast<const uint64_t*>(record_p + header.size - event_id_reverse_pos_in_non_sample_records_);
       }
     }
     if (has_event_id) {
@@ -281,7 +845,30 @@ std::unique_ptr<Record> RecordFileReader::ReadRecord(uint64_t* nbytes_read) {
       }
     }
   }
-  return ReadRecordFromOwnedBuffer(*attr, header.type, p.release());
+  if (p != nullptr) {
+    return ReadRecordFromOwnedBuffer(*attr, header.type, p.release());
+  }
+  return ReadRecordFromBuffer(*attr, header.type, record_p);
+}
+
+bool RecordFileReader::DecompressRecordData(const char* data, size_t size) {
+  // Discard already parsed data before appending the new block.
+  decompressed_data_.erase(decompressed_data_.begin(),
+                           decompressed_data_.begin() + decompressed_pos_);
+  decompressed_pos_ = 0;
+  uint32_t decompressed_size;
+  MoveFromBinaryFormat(decompressed_size, data);
+  size_t old_size = decompressed_data_.size();
+  decompressed_data_.resize(old_size + decompressed_size);
+  uLongf dest_len = decompressed_size;
+  if (uncompress(reinterpret_cast<Bytef*>(&decompressed_data_[old_size]),
+                 &dest_len, reinterpret_cast<const Bytef*>(data),
+                 size - sizeof(uint32_t)) != Z_OK ||
+      dest_len != decompressed_size) {
+    LOG(ERROR) << "failed to decompress record data in " << filename_;
+    return false;
+  }
+  return true;
 }
 
 bool RecordFileReader::Read(void* buf, size_t len) {
@@ -308,6 +895,11 @@ size_t RecordFileReader::GetAttrIndexOfRecord(const Record* record) {
 }
 
 bool RecordFileReader::ReadFeatureSection(int feature, std::vector<char>* data) {
+  auto cache_it = feature_section_cache_.find(feature);
+  if (cache_it != feature_section_cache_.end()) {
+    *data = cache_it->second;
+    return true;
+  }
   const std::map<int, SectionDesc>& section_map = FeatureSectionDescriptors();
   auto it = section_map.find(feature);
   if (it == section_map.end()) {
@@ -315,16 +907,16 @@ bool RecordFileReader::ReadFeatureSection(int feature, std::vector<char>* data)
   }
   SectionDesc section = it->second;
   data->resize(section.size);
-  if (section.size == 0) {
-    return true;
-  }
-  if (fseek(record_fp_, section.offset, SEEK_SET) != 0) {
-    PLOG(ERROR) << "fseek() failed";
-    return false;
-  }
-  if (!Read(data->data(), data->size())) {
-    return false;
+  if (section.size != 0) {
+    if (fseek(record_fp_, section.offset, SEEK_SET) != 0) {
+      PLOG(ERROR) << "fseek() failed";
+      return false;
+    }
+    if (!Read(data->data(), data->size())) {
+      return false;
+    }
   }
+  feature_section_cache_[feature] = *data;
   return true;
 }
 
@@ -434,14 +1026,38 @@ bool RecordFileReader::ReadFileFeature(size_t& read_pos,
   return true;
 }
 
+const std::unordered_map<std::string, BuildId>& RecordFileReader::ReadBuildIdMap() {
+  if (!build_id_map_loaded_) {
+    for (auto& r : ReadBuildIdFeature()) {
+      build_id_map_[r.filename] = r.build_id;
+    }
+    build_id_map_loaded_ = true;
+  }
+  return build_id_map_;
+}
+
 void RecordFileReader::LoadBuildIdAndFileFeatures(ThreadTree& thread_tree) {
-  std::vector<BuildIdRecord> records = ReadBuildIdFeature();
   std::vector<std::pair<std::string, BuildId>> build_ids;
-  for (auto& r : records) {
-    build_ids.push_back(std::make_pair(r.filename, r.build_id));
+  // Aggregate features over all chunks of a split chunk sequence: a dso is
+  // only guaranteed to appear in the chunks whose samples hit it.
+  for (const auto& filename : split_filenames_) {
+    std::unique_ptr<RecordFileReader> reader = CreateInstance(filename);
+    if (reader == nullptr) {
+      continue;
+    }
+    for (auto& pair : reader->ReadBuildIdMap()) {
+      build_ids.push_back(pair);
+    }
+    reader->LoadFileFeatures(thread_tree);
+  }
+  for (auto& pair : ReadBuildIdMap()) {
+    build_ids.push_back(pair);
   }
   Dso::SetBuildIds(build_ids);
+  LoadFileFeatures(thread_tree);
+}
 
+void RecordFileReader::LoadFileFeatures(ThreadTree& thread_tree) {
   if (HasFeature(PerfFileFormat::FEAT_FILE)) {
     std::string file_path;
     uint32_t file_type;
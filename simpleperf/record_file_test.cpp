@@ -157,3 +157,92 @@ TEST_F(RecordFileTest, record_more_than_one_attr) {
     ASSERT_EQ(attrs[i].ids, attr_ids_[i].ids);
   }
 }
+
+TEST_F(RecordFileTest, compressed_records) {
+  // Write to a record file with compression enabled.
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+
+  // Write attr section.
+  AddEventType("cpu-cycles");
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+
+  // Write data section. Write enough records to span several compressed
+  // blocks.
+  writer->SetCompressRecords(true);
+  MmapRecord mmap_record(*(attr_ids_[0].attr), true, 1, 1, 0x1000, 0x2000,
+                         0x3000, "mmap_record_example", attr_ids_[0].ids[0]);
+  constexpr size_t RECORD_COUNT = 10000;
+  for (size_t i = 0; i < RECORD_COUNT; ++i) {
+    ASSERT_TRUE(writer->WriteRecord(mmap_record));
+  }
+  ASSERT_TRUE(writer->Close());
+
+  // Read from a record file. Records are decompressed transparently.
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  std::vector<std::unique_ptr<Record>> records = reader->DataSection();
+  ASSERT_EQ(RECORD_COUNT, records.size());
+  for (auto& record : records) {
+    CheckRecordEqual(mmap_record, *record);
+  }
+  ASSERT_TRUE(reader->Close());
+}
+
+TEST_F(RecordFileTest, read_data_section_time_range) {
+  // Write to a record file.
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(writer != nullptr);
+
+  // Write attr section.
+  AddEventType("cpu-cycles");
+  attrs_[0]->sample_type |= PERF_SAMPLE_TIME;
+  ASSERT_TRUE(writer->WriteAttrSection(attr_ids_));
+
+  // Write data section: an mmap record from before the time range, then
+  // enough big sample records to span several time index intervals, so
+  // reading a late range has to seek and replay the mmap record from the
+  // skipped prefix.
+  MmapRecord mmap_record(*(attr_ids_[0].attr), true, 1, 1, 0x1000, 0x2000,
+                         0x3000, "mmap_record_example", attr_ids_[0].ids[0],
+                         100);
+  ASSERT_TRUE(writer->WriteRecord(mmap_record));
+  std::vector<uint64_t> ips(1000, 0x1000);
+  constexpr size_t SAMPLE_COUNT = 300;
+  for (size_t i = 0; i < SAMPLE_COUNT; ++i) {
+    SampleRecord sample_record(*(attr_ids_[0].attr), attr_ids_[0].ids[0],
+                               0x1000, 1, 1, 1000 + i, 0, 1, ips);
+    ASSERT_TRUE(writer->WriteRecord(sample_record));
+  }
+
+  // Write feature section.
+  ASSERT_TRUE(writer->BeginWriteFeatures(2));
+  ASSERT_TRUE(writer->WriteRecordTypeIndexFeature());
+  ASSERT_TRUE(writer->WriteRecordTimeIndexFeature());
+  ASSERT_TRUE(writer->EndWriteFeatures());
+  ASSERT_TRUE(writer->Close());
+
+  // Read back the time range [1280, 1290): the mmap record is replayed from
+  // the skipped prefix, and of the samples only those in the range are
+  // passed.
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile_.path);
+  ASSERT_TRUE(reader != nullptr);
+  ASSERT_TRUE(reader->ReadRecordTimeIndex() != nullptr);
+  size_t mmap_count = 0;
+  std::vector<uint64_t> sample_times;
+  ASSERT_TRUE(reader->ReadDataSectionTimeRange(
+      1280, 1290, [&](std::unique_ptr<Record> record) {
+        if (record->type() == PERF_RECORD_SAMPLE) {
+          sample_times.push_back(record->Timestamp());
+        } else if (record->type() == PERF_RECORD_MMAP) {
+          mmap_count++;
+        }
+        return true;
+      }));
+  ASSERT_EQ(1u, mmap_count);
+  ASSERT_EQ(10u, sample_times.size());
+  for (size_t i = 0; i < sample_times.size(); ++i) {
+    ASSERT_EQ(1280 + i, sample_times[i]);
+  }
+  ASSERT_TRUE(reader->Close());
+}
@@ -19,7 +19,9 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -28,6 +30,8 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 
+#include <zlib.h>
+
 #include "event_attr.h"
 #include "perf_event.h"
 #include "record.h"
@@ -59,7 +63,12 @@ RecordFileWriter::RecordFileWriter(const std::string& filename, FILE* fp)
       data_section_offset_(0),
       data_section_size_(0),
       feature_section_offset_(0),
-      feature_count_(0) {
+      compress_records_(false),
+      preallocated_size_(0),
+      preallocate_failed_(false),
+      feature_count_(0),
+      max_record_time_(0),
+      next_time_index_offset_(0) {
 }
 
 RecordFileWriter::~RecordFileWriter() {
@@ -120,18 +129,45 @@ bool RecordFileWriter::WriteAttrSection(const std::vector<EventAttrWithId>& attr
 }
 
 bool RecordFileWriter::WriteRecord(const Record& record) {
+  return WriteRecordData(record.type(), record.Binary(), record.size(),
+                         record.Timestamp());
+}
+
+bool RecordFileWriter::WriteRecordData(uint32_t type, const void* buf,
+                                       size_t size, uint64_t timestamp) {
+  if (compress_records_) {
+    // Collect serialized records in compress_pending_data_, and write them
+    // compressed in blocks. Custom records with 32-bit sizes stay intact in
+    // the decompressed stream, so no SPLIT records are needed.
+    const char* p = static_cast<const char*>(buf);
+    compress_pending_data_.insert(compress_pending_data_.end(), p, p + size);
+    return WriteCompressedRecords(false);
+  }
+  // The index stores the offset of the record header; for an oversized
+  // record written as a SPLIT sequence below, of its first SPLIT record.
+  record_type_index_[type].push_back(data_section_size_);
+  // Sample a time index entry about every TIME_INDEX_INTERVAL bytes of
+  // record data. The entry stores the maximum timestamp of the records
+  // before it, so a reader seeking to it can only skip earlier records.
+  constexpr uint64_t TIME_INDEX_INTERVAL = 1024 * 1024;
+  if (data_section_size_ >= next_time_index_offset_) {
+    record_time_index_.emplace_back(data_section_size_, max_record_time_);
+    next_time_index_offset_ = data_section_size_ + TIME_INDEX_INTERVAL;
+  }
+  if (timestamp > max_record_time_) {
+    max_record_time_ = timestamp;
+  }
   // linux-tools-perf only accepts records with size <= 65535 bytes. To make
   // perf.data generated by simpleperf be able to be parsed by linux-tools-perf,
   // Split simpleperf custom records which are > 65535 into a bunch of
   // RECORD_SPLIT records, followed by a RECORD_SPLIT_END record.
   constexpr uint32_t RECORD_SIZE_LIMIT = 65535;
-  if (record.size() <= RECORD_SIZE_LIMIT) {
-    WriteData(record.Binary(), record.size());
-    return true;
+  if (size <= RECORD_SIZE_LIMIT) {
+    return WriteData(buf, size);
   }
-  CHECK_GT(record.type(), SIMPLE_PERF_RECORD_TYPE_START);
-  const char* p = record.Binary();
-  uint32_t left_bytes = static_cast<uint32_t>(record.size());
+  CHECK_GT(type, SIMPLE_PERF_RECORD_TYPE_START);
+  const char* p = static_cast<const char*>(buf);
+  uint32_t left_bytes = static_cast<uint32_t>(size);
   RecordHeader header;
   header.type = SIMPLE_PERF_RECORD_SPLIT;
   char header_buf[Record::header_size()];
@@ -158,6 +194,7 @@ bool RecordFileWriter::WriteRecord(const Record& record) {
 }
 
 bool RecordFileWriter::WriteData(const void* buf, size_t len) {
+  PreAllocateData(data_section_offset_ + data_section_size_ + len);
   if (!Write(buf, len)) {
     return false;
   }
@@ -165,6 +202,63 @@ bool RecordFileWriter::WriteData(const void* buf, size_t len) {
   return true;
 }
 
+void RecordFileWriter::PreAllocateData(uint64_t file_end) {
+  if (file_end <= preallocated_size_ || preallocate_failed_) {
+    return;
+  }
+  // Reserve blocks well ahead of the write position, so the filesystem
+  // doesn't allocate blocks and update metadata on every buffer flush. Block
+  // allocation is a main source of write stalls on flash, and write stalls
+  // in the record loop show up as lost samples. FALLOC_FL_KEEP_SIZE keeps
+  // the file size at the written data; the unused part of the reservation is
+  // returned in Close().
+  constexpr uint64_t PREALLOCATE_CHUNK_SIZE = 16 * 1024 * 1024;
+  uint64_t new_size = Align(file_end, PREALLOCATE_CHUNK_SIZE);
+  if (fallocate(fileno(record_fp_), FALLOC_FL_KEEP_SIZE, 0, new_size) == -1) {
+    // Not supported on all filesystems. Fall back to allocation on write.
+    preallocate_failed_ = true;
+    return;
+  }
+  preallocated_size_ = new_size;
+}
+
+bool RecordFileWriter::WriteCompressedRecords(bool flush) {
+  // Keep each compressed record below 65535 bytes, so they don't need SPLIT
+  // records themselves: compressBound(COMPRESSION_BLOCK_SIZE) plus the record
+  // header and the decompressed size field stays below the limit.
+  constexpr size_t COMPRESSION_BLOCK_SIZE = 60000;
+  size_t pos = 0;
+  while (compress_pending_data_.size() - pos >= COMPRESSION_BLOCK_SIZE ||
+         (flush && pos < compress_pending_data_.size())) {
+    uint32_t block_size = static_cast<uint32_t>(
+        std::min(COMPRESSION_BLOCK_SIZE, compress_pending_data_.size() - pos));
+    uLongf compressed_size = compressBound(block_size);
+    std::vector<char> buf(Record::header_size() + sizeof(uint32_t) +
+                          compressed_size);
+    if (compress2(reinterpret_cast<Bytef*>(&buf[Record::header_size() +
+                                               sizeof(uint32_t)]),
+                  &compressed_size,
+                  reinterpret_cast<const Bytef*>(&compress_pending_data_[pos]),
+                  block_size, Z_BEST_SPEED) != Z_OK) {
+      LOG(ERROR) << "failed to compress record data";
+      return false;
+    }
+    RecordHeader header;
+    header.type = SIMPLE_PERF_RECORD_COMPRESSED;
+    header.size = Record::header_size() + sizeof(uint32_t) + compressed_size;
+    char* p = buf.data();
+    header.MoveToBinaryFormat(p);
+    MoveToBinaryFormat(block_size, p);
+    if (!WriteData(buf.data(), header.size)) {
+      return false;
+    }
+    pos += block_size;
+  }
+  compress_pending_data_.erase(compress_pending_data_.begin(),
+                               compress_pending_data_.begin() + pos);
+  return true;
+}
+
 bool RecordFileWriter::Write(const void* buf, size_t len) {
   if (fwrite(buf, len, 1, record_fp_) != 1) {
     PLOG(ERROR) << "failed to write to record file '" << filename_ << "'";
@@ -182,11 +276,15 @@ bool RecordFileWriter::Read(void* buf, size_t len) {
 }
 
 bool RecordFileWriter::ReadDataSection(const std::function<void(const Record*)>& callback) {
+  if (compress_records_ && !WriteCompressedRecords(true)) {
+    return false;
+  }
   if (fseek(record_fp_, data_section_offset_, SEEK_SET) == -1) {
     PLOG(ERROR) << "fseek() failed";
     return false;
   }
   std::vector<char> record_buf(512);
+  std::vector<char> decompressed;
   uint64_t read_pos = 0;
   while (read_pos < data_section_size_) {
     if (!Read(record_buf.data(), Record::header_size())) {
@@ -200,8 +298,40 @@ bool RecordFileWriter::ReadDataSection(const std::function<void(const Record*)>&
       return false;
     }
     read_pos += header.size;
-    std::unique_ptr<Record> r = ReadRecordFromBuffer(event_attr_, header.type, record_buf.data());
-    callback(r.get());
+    if (header.type == SIMPLE_PERF_RECORD_COMPRESSED) {
+      // Append the decompressed block, then report all complete records in
+      // [decompressed]. A record can span compressed records, so an
+      // incomplete record is kept for the next block.
+      const char* p = record_buf.data() + Record::header_size();
+      uint32_t decompressed_size;
+      MoveFromBinaryFormat(decompressed_size, p);
+      size_t old_size = decompressed.size();
+      decompressed.resize(old_size + decompressed_size);
+      uLongf dest_len = decompressed_size;
+      if (uncompress(reinterpret_cast<Bytef*>(&decompressed[old_size]),
+                     &dest_len, reinterpret_cast<const Bytef*>(p),
+                     header.size - Record::header_size() - sizeof(uint32_t)) !=
+              Z_OK ||
+          dest_len != decompressed_size) {
+        LOG(ERROR) << "failed to decompress record data in " << filename_;
+        return false;
+      }
+      size_t pos = 0;
+      while (pos + Record::header_size() <= decompressed.size()) {
+        RecordHeader rh(&decompressed[pos]);
+        if (pos + rh.size > decompressed.size()) {
+          break;
+        }
+        std::unique_ptr<Record> r =
+            ReadRecordFromBuffer(event_attr_, rh.type, &decompressed[pos]);
+        callback(r.get());
+        pos += rh.size;
+      }
+      decompressed.erase(decompressed.begin(), decompressed.begin() + pos);
+    } else {
+      std::unique_ptr<Record> r = ReadRecordFromBuffer(event_attr_, header.type, record_buf.data());
+      callback(r.get());
+    }
   }
   return true;
 }
@@ -217,6 +347,11 @@ bool RecordFileWriter::GetFilePos(uint64_t* file_pos) {
 }
 
 bool RecordFileWriter::BeginWriteFeatures(size_t feature_count) {
+  // Make sure all record data reaches the data section before its size is
+  // used to position the feature section.
+  if (compress_records_ && !WriteCompressedRecords(true)) {
+    return false;
+  }
   feature_section_offset_ = data_section_offset_ + data_section_size_;
   feature_count_ = feature_count;
   uint64_t feature_header_size = feature_count * sizeof(SectionDesc);
@@ -294,6 +429,17 @@ bool RecordFileWriter::WriteBranchStackFeature() {
   return WriteFeatureEnd(FEAT_BRANCH_STACK);
 }
 
+bool RecordFileWriter::WriteTracingFormatCacheFeature(
+    const std::vector<char>& data) {
+  if (!WriteFeatureBegin(FEAT_TRACING_FORMAT_CACHE)) {
+    return false;
+  }
+  if (!Write(data.data(), data.size())) {
+    return false;
+  }
+  return WriteFeatureEnd(FEAT_TRACING_FORMAT_CACHE);
+}
+
 bool RecordFileWriter::WriteFileFeature(const std::string& file_path,
                                         uint32_t file_type,
                                         uint64_t min_vaddr,
@@ -328,6 +474,51 @@ bool RecordFileWriter::WriteFileFeature(const std::string& file_path,
   return WriteFeatureEnd(FEAT_FILE);
 }
 
+bool RecordFileWriter::WriteRecordTypeIndexFeature() {
+  CHECK(!compress_records_);
+  if (!WriteFeatureBegin(FEAT_RECORD_TYPE_INDEX)) {
+    return false;
+  }
+  uint32_t type_count = static_cast<uint32_t>(record_type_index_.size());
+  if (!Write(&type_count, sizeof(type_count))) {
+    return false;
+  }
+  for (const auto& pair : record_type_index_) {
+    uint32_t type = pair.first;
+    uint32_t record_count = static_cast<uint32_t>(pair.second.size());
+    if (!Write(&type, sizeof(type)) ||
+        !Write(&record_count, sizeof(record_count)) ||
+        !Write(pair.second.data(), record_count * sizeof(uint64_t))) {
+      return false;
+    }
+  }
+  return WriteFeatureEnd(FEAT_RECORD_TYPE_INDEX);
+}
+
+bool RecordFileWriter::WriteRecordTimeIndexFeature() {
+  CHECK(!compress_records_);
+  if (!WriteFeatureBegin(FEAT_RECORD_TIME_INDEX)) {
+    return false;
+  }
+  // Close the index with an entry at the end of the data section, covering
+  // the records after the last sampled entry.
+  uint32_t entry_count = static_cast<uint32_t>(record_time_index_.size()) + 1;
+  if (!Write(&entry_count, sizeof(entry_count))) {
+    return false;
+  }
+  for (const auto& pair : record_time_index_) {
+    if (!Write(&pair.first, sizeof(pair.first)) ||
+        !Write(&pair.second, sizeof(pair.second))) {
+      return false;
+    }
+  }
+  if (!Write(&data_section_size_, sizeof(data_section_size_)) ||
+      !Write(&max_record_time_, sizeof(max_record_time_))) {
+    return false;
+  }
+  return WriteFeatureEnd(FEAT_RECORD_TIME_INDEX);
+}
+
 bool RecordFileWriter::WriteFeatureBegin(int feature) {
   auto it = features_.find(feature);
   if (it == features_.end()) {
@@ -398,12 +589,30 @@ bool RecordFileWriter::Close() {
   CHECK(record_fp_ != nullptr);
   bool result = true;
 
+  // Flush pending record data when the data section is closed without
+  // writing a feature section. Otherwise the pending data has already been
+  // flushed before the feature section was positioned.
+  if (compress_records_ && feature_section_offset_ == 0 &&
+      !WriteCompressedRecords(true)) {
+    result = false;
+  }
+
   // Write file header. We gather enough information to write file header only after
   // writing data section and feature section.
   if (!WriteFileHeader()) {
     result = false;
   }
 
+  // Return the unused part of the last preallocated chunk.
+  if (preallocated_size_ != 0 && fflush(record_fp_) == 0) {
+    struct stat st;
+    int fd = fileno(record_fp_);
+    if (fstat(fd, &st) == 0 && ftruncate(fd, st.st_size) == -1) {
+      PLOG(WARNING) << "failed to trim preallocated space in '" << filename_
+                    << "'";
+    }
+  }
+
   if (fclose(record_fp_) != 0) {
     PLOG(ERROR) << "failed to close record file '" << filename_ << "'";
     result = false;
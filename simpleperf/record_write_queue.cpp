@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "record_write_queue.h"
+
+#include <unistd.h>
+
+#include <android-base/logging.h>
+
+#include "record.h"
+#include "record_file.h"
+#include "utils.h"
+
+// Sleep time of a thread waiting for the other side of the queue to make
+// progress. The queue is sized so this only happens when the queue is
+// completely full or completely empty.
+static constexpr useconds_t WAIT_USEC = 500;
+
+RecordWriteQueue::RecordWriteQueue(RecordFileWriter* writer,
+                                   size_t queue_slot_count)
+    : writer_(writer),
+      slots_(queue_slot_count),
+      head_(0),
+      tail_(0),
+      stop_(false),
+      write_error_(false) {
+  CHECK(IsPowerOfTwo(queue_slot_count));
+}
+
+RecordWriteQueue::~RecordWriteQueue() {
+  if (writer_thread_.joinable()) {
+    Stop();
+  }
+}
+
+bool RecordWriteQueue::Start() {
+  writer_thread_ = std::thread([this]() { WriterThread(); });
+  return true;
+}
+
+bool RecordWriteQueue::IsFull() const {
+  return tail_.load(std::memory_order_relaxed) -
+             head_.load(std::memory_order_acquire) ==
+         slots_.size();
+}
+
+bool RecordWriteQueue::IsEmpty() const {
+  return head_.load(std::memory_order_relaxed) ==
+         tail_.load(std::memory_order_acquire);
+}
+
+bool RecordWriteQueue::PushRecord(const Record& record) {
+  while (IsFull()) {
+    if (write_error_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    usleep(WAIT_USEC);
+  }
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  Entry& entry = slots_[tail & (slots_.size() - 1)];
+  entry.type = record.type();
+  entry.timestamp = record.Timestamp();
+  entry.data.assign(record.Binary(), record.Binary() + record.size());
+  // Release order makes the slot content visible to the writer thread.
+  tail_.store(tail + 1, std::memory_order_release);
+  return !write_error_.load(std::memory_order_relaxed);
+}
+
+void RecordWriteQueue::WriterThread() {
+  while (true) {
+    if (IsEmpty()) {
+      if (stop_.load(std::memory_order_acquire)) {
+        break;
+      }
+      usleep(WAIT_USEC);
+      continue;
+    }
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    Entry& entry = slots_[head & (slots_.size() - 1)];
+    if (!write_error_.load(std::memory_order_relaxed) &&
+        !writer_->WriteRecordData(entry.type, entry.data.data(),
+                                  entry.data.size(), entry.timestamp)) {
+      write_error_.store(true, std::memory_order_relaxed);
+    }
+    // Free the slot for reuse by the producer thread.
+    entry.data = std::vector<char>();
+    head_.store(head + 1, std::memory_order_release);
+  }
+}
+
+bool RecordWriteQueue::Stop() {
+  stop_.store(true, std::memory_order_release);
+  writer_thread_.join();
+  return !write_error_.load(std::memory_order_relaxed);
+}
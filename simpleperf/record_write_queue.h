@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIMPLE_PERF_RECORD_WRITE_QUEUE_H_
+#define SIMPLE_PERF_RECORD_WRITE_QUEUE_H_
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <android-base/macros.h>
+
+class Record;
+class RecordFileWriter;
+
+// RecordWriteQueue decouples reading records from mapped buffers and writing
+// records to the record file. The thread draining mapped buffers pushes
+// serialized records into a lock-free single-producer single-consumer queue,
+// and a dedicated writer thread pops records from the queue and does the file
+// I/O. So draining mapped buffers doesn't wait for disk writes, which reduces
+// samples lost to ring buffer overflow when the disk stalls.
+class RecordWriteQueue {
+ public:
+  RecordWriteQueue(RecordFileWriter* writer, size_t queue_slot_count = 8192);
+  ~RecordWriteQueue();
+
+  // Start the writer thread. Should be called before PushRecord().
+  bool Start();
+  // Called on the producer thread. Serializes [record] into the queue. If the
+  // queue is full, waits until the writer thread catches up. Returns false if
+  // the writer thread has failed to write the record file.
+  bool PushRecord(const Record& record);
+  // Flush pending records, stop the writer thread and wait for it. Returns
+  // false if any record failed to be written.
+  bool Stop();
+
+ private:
+  struct Entry {
+    uint32_t type;
+    uint64_t timestamp;
+    std::vector<char> data;
+  };
+
+  bool IsFull() const;
+  bool IsEmpty() const;
+  void WriterThread();
+
+  RecordFileWriter* writer_;
+  std::vector<Entry> slots_;
+  // Indices of the next slot to pop/push. Only the writer thread advances
+  // head_, only the producer thread advances tail_.
+  std::atomic<uint64_t> head_;
+  std::atomic<uint64_t> tail_;
+  std::atomic<bool> stop_;
+  std::atomic<bool> write_error_;
+  std::thread writer_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordWriteQueue);
+};
+
+#endif  // SIMPLE_PERF_RECORD_WRITE_QUEUE_H_
@@ -71,6 +71,15 @@ struct CallChain {
   CallChainEntry* entries;
 };
 
+// A sample together with its event, symbol and callchain. Used by
+// GetSampleBatch() to return many samples in one call.
+struct SampleBatchEntry {
+  Sample sample;
+  Event event;
+  SymbolEntry symbol;
+  CallChain callchain;
+};
+
 // Create a new instance,
 // pass the instance to the other functions below.
 ReportLib* CreateReportLib() EXPORT;
@@ -83,12 +92,24 @@ bool SetSymfs(ReportLib* report_lib, const char* symfs_dir) EXPORT;
 bool SetRecordFile(ReportLib* report_lib, const char* record_file) EXPORT;
 bool SetKallsymsFile(ReportLib* report_lib, const char* kallsyms_file) EXPORT;
 void ShowIpForUnknownSymbol(ReportLib* report_lib) EXPORT;
+// Share loaded user dsos with other ReportLib instances in this process
+// through a refcounted, thread-safe cache, instead of loading a private copy
+// per instance. Call before reading samples.
+void UseSharedDsos(ReportLib* report_lib) EXPORT;
 
 Sample* GetNextSample(ReportLib* report_lib) EXPORT;
 Event* GetEventOfCurrentSample(ReportLib* report_lib) EXPORT;
 SymbolEntry* GetSymbolOfCurrentSample(ReportLib* report_lib) EXPORT;
 CallChain* GetCallChainOfCurrentSample(ReportLib* report_lib) EXPORT;
 
+// Fill [entries] with up to [max_count] samples and their events, symbols and
+// callchains. Return the number of filled entries, which is less than
+// [max_count] only when the record file runs out of samples. Pointers in the
+// filled entries are owned by [report_lib], and stay valid until the next
+// GetNextSample() or GetSampleBatch() call.
+size_t GetSampleBatch(ReportLib* report_lib, SampleBatchEntry* entries,
+                      size_t max_count) EXPORT;
+
 const char* GetBuildIdForPath(ReportLib* report_lib, const char* path) EXPORT;
 }
 
@@ -127,16 +148,20 @@ class ReportLib {
 
   void ShowIpForUnknownSymbol() { thread_tree_.ShowIpForUnknownSymbol(); }
 
+  void UseSharedDsos() { thread_tree_.UseSharedDsos(); }
+
   Sample* GetNextSample();
   Event* GetEventOfCurrentSample();
   SymbolEntry* GetSymbolOfCurrentSample();
   CallChain* GetCallChainOfCurrentSample();
+  size_t GetSampleBatch(SampleBatchEntry* entries, size_t max_count);
 
   const char* GetBuildIdForPath(const char* path);
 
  private:
   Sample* GetCurrentSample();
   bool OpenRecordFileIfNecessary();
+  bool MoveToNextSample();
   Mapping* AddMapping(const MapEntry& map);
 
   std::unique_ptr<android::base::ScopedLogSeverity> log_severity_;
@@ -151,6 +176,8 @@ class ReportLib {
   CallChain current_callchain_;
   std::vector<std::unique_ptr<Mapping>> current_mappings_;
   std::vector<CallChainEntry> callchain_entries_;
+  // Keeps the callchain entries of all samples in the current batch alive.
+  std::vector<std::vector<CallChainEntry>> batch_callchains_;
   std::string build_id_string_;
   int update_flag_;
   std::vector<EventAttrWithName> event_attrs_;
@@ -192,13 +219,22 @@ Sample* ReportLib::GetNextSample() {
   if (!OpenRecordFileIfNecessary()) {
     return nullptr;
   }
+  if (!MoveToNextSample()) {
+    return nullptr;
+  }
+  current_mappings_.clear();
+  batch_callchains_.clear();
+  return GetCurrentSample();
+}
+
+bool ReportLib::MoveToNextSample() {
   while (true) {
     std::unique_ptr<Record> record;
     if (!record_file_reader_->ReadRecord(record)) {
-      return nullptr;
+      return false;
     }
     if (record == nullptr) {
-      return nullptr;
+      return false;
     }
     thread_tree_.Update(*record);
     if (record->type() == PERF_RECORD_SAMPLE) {
@@ -207,8 +243,31 @@ Sample* ReportLib::GetNextSample() {
     }
   }
   update_flag_ = 0;
+  return true;
+}
+
+size_t ReportLib::GetSampleBatch(SampleBatchEntry* entries, size_t max_count) {
+  if (!OpenRecordFileIfNecessary()) {
+    return 0;
+  }
+  // Mappings and callchain entries of the previous batch are invalidated here,
+  // but ones of the samples in this batch stay valid until the next call.
   current_mappings_.clear();
-  return GetCurrentSample();
+  batch_callchains_.clear();
+  size_t count = 0;
+  while (count < max_count && MoveToNextSample()) {
+    SampleBatchEntry& entry = entries[count++];
+    entry.sample = *GetCurrentSample();
+    entry.event = *GetEventOfCurrentSample();
+    entry.symbol = *GetSymbolOfCurrentSample();
+    GetCallChainOfCurrentSample();
+    // Move the callchain entries into batch storage, so they survive moving
+    // to the next sample in the batch.
+    batch_callchains_.push_back(std::move(callchain_entries_));
+    entry.callchain.nr = batch_callchains_.back().size();
+    entry.callchain.entries = batch_callchains_.back().data();
+  }
+  return count;
 }
 
 Sample* ReportLib::GetCurrentSample() {
@@ -363,6 +422,10 @@ bool SetRecordFile(ReportLib* report_lib, const char* record_file) {
   return report_lib->SetRecordFile(record_file);
 }
 
+void UseSharedDsos(ReportLib* report_lib) {
+  return report_lib->UseSharedDsos();
+}
+
 void ShowIpForUnknownSymbol(ReportLib* report_lib) {
   return report_lib->ShowIpForUnknownSymbol();
 }
@@ -387,6 +450,11 @@ CallChain* GetCallChainOfCurrentSample(ReportLib* report_lib) {
   return report_lib->GetCallChainOfCurrentSample();
 }
 
+size_t GetSampleBatch(ReportLib* report_lib, SampleBatchEntry* entries,
+                      size_t max_count) {
+  return report_lib->GetSampleBatch(entries, max_count);
+}
+
 const char* GetBuildIdForPath(ReportLib* report_lib, const char* path) {
   return report_lib->GetBuildIdForPath(path);
 }
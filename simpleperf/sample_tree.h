@@ -23,6 +23,7 @@
 #include "record.h"
 #include "SampleComparator.h"
 #include "SampleDisplayer.h"
+#include "SampleSet.h"
 #include "thread_tree.h"
 
 // A SampleTree is a collection of samples. A profiling report is mainly about
@@ -59,7 +60,9 @@ class SampleTreeBuilder {
         use_branch_address_(false),
         build_callchain_(false),
         use_caller_as_callchain_root_(false),
-        strict_unwind_arch_check_(false) {}
+        insert_callchain_for_leaf_only_(false),
+        strict_unwind_arch_check_(false),
+        callchain_node_limit_(0) {}
 
   virtual ~SampleTreeBuilder() {}
 
@@ -77,6 +80,21 @@ class SampleTreeBuilder {
     strict_unwind_arch_check_ = strict_unwind_arch_check;
   }
 
+  // Bound the number of nodes kept in the callchain tree of each sample. Cold
+  // call chains are folded into their prefix when the limit is exceeded. 0
+  // means no limit.
+  void SetCallChainNodeLimit(size_t max_node_count) {
+    callchain_node_limit_ = max_node_count;
+  }
+
+  // Insert each sample's whole call chain only into the callchain tree of its
+  // leaf entry, instead of inserting every chain suffix into the tree of every
+  // entry on the chain. Then each root-to-leaf path carrying a period stands
+  // for one distinct call stack, which is what folded stack output needs.
+  // It should be used with use_caller_as_callchain_root being false, so chains
+  // grow from the leaf towards its callers.
+  void SetInsertCallChainForLeafOnly() { insert_callchain_for_leaf_only_ = true; }
+
   void ProcessSampleRecord(const SampleRecord& r) {
     if (use_branch_address_ && (r.sample_type & PERF_SAMPLE_BRANCH_STACK)) {
       for (uint64_t i = 0; i < r.branch_stack_data.stack_nr; ++i) {
@@ -109,10 +127,12 @@ class SampleTreeBuilder {
         RegSet regs = CreateRegSet(r.regs_user_data.abi,
                                    r.regs_user_data.reg_mask,
                                    r.regs_user_data.regs);
+        ResolveThreadMaps(thread);
         std::vector<uint64_t> unwind_ips =
             UnwindCallChain(r.regs_user_data.abi, *thread, regs,
                             r.stack_user_data.data,
-                            r.GetValidStackSize(), strict_unwind_arch_check_);
+                            r.GetValidStackSize(), strict_unwind_arch_check_,
+                            &unwind_map_cache_);
         if (!unwind_ips.empty()) {
           ips.push_back(PERF_CONTEXT_USER);
           ips.insert(ips.end(), unwind_ips.begin(), unwind_ips.end());
@@ -157,6 +177,17 @@ class SampleTreeBuilder {
         if (use_caller_as_callchain_root_) {
           std::reverse(callchain.begin(), callchain.end());
         }
+        if (insert_callchain_for_leaf_only_) {
+          // Chains a leaf entry doesn't cover show up as the difference
+          // between its period and its tree's children_period, so chains
+          // without caller entries need no insertion.
+          EntryT* leaf = callchain[0];
+          callchain.erase(callchain.begin());
+          if (!callchain.empty()) {
+            InsertCallChainForSample(leaf, callchain, acc_info);
+          }
+          return;
+        }
         while (callchain.size() >= 2) {
           EntryT* sample = callchain[0];
           callchain.erase(callchain.begin());
@@ -171,14 +202,38 @@ class SampleTreeBuilder {
     }
   }
 
-  std::vector<EntryT*> GetSamples() const {
-    std::vector<EntryT*> result;
-    for (auto& entry : sample_set_) {
-      result.push_back(entry);
+  // Merge samples from [other] into this builder. Both builders should be
+  // created with the same comparator and process samples against the same
+  // thread tree, so fields compared by the comparator reference identical
+  // objects. It is used to combine sample trees built by different worker
+  // threads. [other] is emptied.
+  void Merge(SampleTreeBuilder& other) {
+    for (EntryT* sample : other.sample_set_.GetEntries()) {
+      EntryT* merged = sample_set_.Find(sample);
+      if (merged == nullptr) {
+        sample_set_.Insert(sample);
+      } else {
+        merged->callchain.Merge(
+            sample->callchain, [&](const EntryT* s1, const EntryT* s2) {
+              return sample_comparator_.IsSameSample(s1, s2);
+            });
+        MergeSample(merged, sample);
+      }
     }
-    return result;
+    other.sample_set_.clear();
+    // Keep the other builder's entries alive, as merged samples' callchains
+    // may reference them.
+    for (auto& sample : other.sample_storage_) {
+      sample_storage_.push_back(std::move(sample));
+    }
+    other.sample_storage_.clear();
+    other.callchain_sample_set_.clear();
   }
 
+  // Return the samples in unspecified order; callers wanting a sorted report
+  // pass them through SampleTreeSorter.
+  std::vector<EntryT*> GetSamples() const { return sample_set_.GetEntries(); }
+
  protected:
   virtual EntryT* CreateSample(const SampleRecord& r, bool in_kernel,
                                AccumulateInfoT* acc_info) = 0;
@@ -189,6 +244,9 @@ class SampleTreeBuilder {
                                         const std::vector<EntryT*>& callchain,
                                         const AccumulateInfoT& acc_info) = 0;
   virtual const ThreadEntry* GetThreadOfSample(EntryT*) = 0;
+  // Make sure all maps of [thread] are resolved, as the dwarf unwinder
+  // iterates them directly instead of going through ThreadTree::FindMap().
+  virtual void ResolveThreadMaps(const ThreadEntry* thread) = 0;
   virtual uint64_t GetPeriodForCallChain(const AccumulateInfoT& acc_info) = 0;
   virtual bool FilterSample(const EntryT*) { return true; }
 
@@ -201,15 +259,13 @@ class SampleTreeBuilder {
       return nullptr;
     }
     UpdateSummary(sample.get());
-    EntryT* result;
-    auto it = sample_set_.find(sample.get());
-    if (it == sample_set_.end()) {
+    EntryT* result = sample_set_.Find(sample.get());
+    if (result == nullptr) {
       result = sample.get();
-      sample_set_.insert(sample.get());
+      sample_set_.Insert(sample.get());
       sample_storage_.push_back(std::move(sample));
     } else {
-      result = *it;
-      MergeSample(*it, sample.get());
+      MergeSample(result, sample.get());
     }
     return result;
   }
@@ -221,23 +277,22 @@ class SampleTreeBuilder {
     }
     if (!FilterSample(sample.get())) {
       // Store in callchain_sample_set_ for use in other EntryT's callchain.
-      auto it = callchain_sample_set_.find(sample.get());
-      if (it != callchain_sample_set_.end()) {
-        return *it;
+      EntryT* result = callchain_sample_set_.Find(sample.get());
+      if (result != nullptr) {
+        return result;
       }
-      EntryT* result = sample.get();
-      callchain_sample_set_.insert(sample.get());
+      result = sample.get();
+      callchain_sample_set_.Insert(sample.get());
       sample_storage_.push_back(std::move(sample));
       return result;
     }
 
-    auto it = sample_set_.find(sample.get());
-    if (it != sample_set_.end()) {
-      EntryT* sample = *it;
+    EntryT* merged = sample_set_.Find(sample.get());
+    if (merged != nullptr) {
       // Process only once for recursive function call.
-      if (std::find(callchain.begin(), callchain.end(), sample) !=
+      if (std::find(callchain.begin(), callchain.end(), merged) !=
           callchain.end()) {
-        return sample;
+        return merged;
       }
     }
     return InsertSample(std::move(sample));
@@ -247,26 +302,42 @@ class SampleTreeBuilder {
                                 const std::vector<EntryT*>& callchain,
                                 const AccumulateInfoT& acc_info) {
     uint64_t period = GetPeriodForCallChain(acc_info);
+    if (callchain_node_limit_ != 0) {
+      sample->callchain.SetNodeLimit(callchain_node_limit_);
+    }
     sample->callchain.AddCallChain(
         callchain, period, [&](const EntryT* s1, const EntryT* s2) {
           return sample_comparator_.IsSameSample(s1, s2);
         });
   }
 
-  std::set<EntryT*, SampleComparator<EntryT>> sample_set_;
+  // Remove all samples and callchain samples, keeping summary information.
+  // Used by builders spilling samples to disk.
+  void ClearSamples() {
+    sample_set_.clear();
+    callchain_sample_set_.clear();
+    sample_storage_.clear();
+  }
+
+  SampleSet<EntryT> sample_set_;
   bool accumulate_callchain_;
 
  private:
   const SampleComparator<EntryT> sample_comparator_;
   // If a CallChainSample is filtered out, it is stored in callchain_sample_set_
   // and only used in other EntryT's callchain.
-  std::set<EntryT*, SampleComparator<EntryT>> callchain_sample_set_;
+  SampleSet<EntryT> callchain_sample_set_;
   std::vector<std::unique_ptr<EntryT>> sample_storage_;
 
   bool use_branch_address_;
   bool build_callchain_;
   bool use_caller_as_callchain_root_;
+  bool insert_callchain_for_leaf_only_;
   bool strict_unwind_arch_check_;
+  size_t callchain_node_limit_;
+  // Each builder has its own cache, so worker threads sharing a thread tree
+  // don't need to synchronize on it.
+  UnwindMapCache unwind_map_cache_;
 };
 
 template <typename EntryT>
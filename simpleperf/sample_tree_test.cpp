@@ -16,6 +16,8 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+
 #include "sample_tree.h"
 #include "thread_tree.h"
 
@@ -84,6 +86,7 @@ class TestSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, int> {
   const ThreadEntry* GetThreadOfSample(SampleEntry*) override {
     return nullptr;
   }
+  void ResolveThreadMaps(const ThreadEntry*) override {}
   uint64_t GetPeriodForCallChain(const int&) override { return 0; }
   void MergeSample(SampleEntry* sample1, SampleEntry* sample2) override {
     sample1->sample_count += sample2->sample_count;
@@ -106,8 +109,11 @@ static void SampleMatchExpectation(const SampleEntry& sample,
   *has_error = false;
 }
 
-static void CheckSamples(const std::vector<SampleEntry*>& samples,
+static void CheckSamples(std::vector<SampleEntry*> samples,
                          const std::vector<SampleEntry>& expected_samples) {
+  // GetSamples() doesn't return samples in comparator order, sort them to
+  // compare with expected_samples.
+  std::sort(samples.begin(), samples.end(), TestSampleComparator());
   ASSERT_EQ(samples.size(), expected_samples.size());
   for (size_t i = 0; i < samples.size(); ++i) {
     bool has_error;
@@ -89,6 +89,13 @@ class CallChainStructure(ct.Structure):
                 ('entries', ct.POINTER(CallChainEntryStructure))]
 
 
+class SampleBatchEntryStruct(ct.Structure):
+    _fields_ = [('sample', SampleStruct),
+                ('event', EventStruct),
+                ('symbol', SymbolStruct),
+                ('callchain', CallChainStructure)]
+
+
 # convert char_p to str for python3.
 class SampleStructUsingStr(object):
     def __init__(self, sample):
@@ -150,6 +157,7 @@ class ReportLib(object):
         self._SetRecordFileFunc = self._lib.SetRecordFile
         self._SetKallsymsFileFunc = self._lib.SetKallsymsFile
         self._ShowIpForUnknownSymbolFunc = self._lib.ShowIpForUnknownSymbol
+        self._UseSharedDsosFunc = self._lib.UseSharedDsos
         self._GetNextSampleFunc = self._lib.GetNextSample
         self._GetNextSampleFunc.restype = ct.POINTER(SampleStruct)
         self._GetEventOfCurrentSampleFunc = self._lib.GetEventOfCurrentSample
@@ -159,10 +167,13 @@ class ReportLib(object):
         self._GetCallChainOfCurrentSampleFunc = self._lib.GetCallChainOfCurrentSample
         self._GetCallChainOfCurrentSampleFunc.restype = ct.POINTER(
             CallChainStructure)
+        self._GetSampleBatchFunc = self._lib.GetSampleBatch
+        self._GetSampleBatchFunc.restype = ct.c_size_t
         self._GetBuildIdForPathFunc = self._lib.GetBuildIdForPath
         self._GetBuildIdForPathFunc.restype = ct.c_char_p
         self._instance = self._CreateReportLibFunc()
         assert(not _is_null(self._instance))
+        self._batch_buffer = None
 
         self.convert_to_str = (sys.version_info >= (3, 0))
 
@@ -200,6 +211,12 @@ class ReportLib(object):
     def ShowIpForUnknownSymbol(self):
         self._ShowIpForUnknownSymbolFunc(self.getInstance())
 
+    def UseSharedDsos(self):
+        """ Share loaded user dsos with other ReportLib instances in this
+            process instead of loading a private copy per instance. Call
+            before reading samples. """
+        self._UseSharedDsosFunc(self.getInstance())
+
     def SetKallsymsFile(self, kallsym_file):
         """ Set the file path to a copy of the /proc/kallsyms file (for off device decoding) """
         cond = self._SetKallsymsFileFunc(self.getInstance(), _char_pt(kallsym_file))
@@ -234,6 +251,31 @@ class ReportLib(object):
             return CallChainStructureUsingStr(callchain[0])
         return callchain[0]
 
+    def GetSampleBatch(self, max_count=1000):
+        """ Return a list of up to max_count (sample, event, symbol, callchain)
+            tuples using one native call, which is much faster than calling
+            GetNextSample() and the other per-sample functions in a loop. An
+            empty list means no samples are left. Without convert_to_str, the
+            returned entries point into a shared buffer, and are only valid
+            until the next GetSampleBatch() or GetNextSample() call.
+        """
+        if self._batch_buffer is None or len(self._batch_buffer) < max_count:
+            self._batch_buffer = (SampleBatchEntryStruct * max_count)()
+        count = self._GetSampleBatchFunc(self.getInstance(), self._batch_buffer,
+                                         ct.c_size_t(max_count))
+        result = []
+        for i in range(count):
+            entry = self._batch_buffer[i]
+            if self.convert_to_str:
+                result.append((SampleStructUsingStr(entry.sample),
+                               EventStructUsingStr(entry.event),
+                               SymbolStructUsingStr(entry.symbol),
+                               CallChainStructureUsingStr(entry.callchain)))
+            else:
+                result.append((entry.sample, entry.event, entry.symbol,
+                               entry.callchain))
+        return result
+
     def GetBuildIdForPath(self, path):
         build_id = self._GetBuildIdForPathFunc(self.getInstance(), _char_pt(path))
         assert(not _is_null(build_id))
@@ -277,6 +319,23 @@ class TestReportLib(unittest.TestCase):
                 self.assertEqual(symbol.symbol_addr, 0x4004ed)
         self.assertTrue(found_func2)
 
+    def test_sample_batch(self):
+        found_sample = False
+        while True:
+            batch = self.report_lib.GetSampleBatch(max_count=16)
+            if not batch:
+                break
+            for sample, event, symbol, callchain in batch:
+                if sample.ip == 0x4004ff and sample.time == 7637889424953:
+                    found_sample = True
+                    self.assertEqual(sample.pid, 15926)
+                    self.assertEqual(sample.thread_comm, 't2')
+                    self.assertEqual(sample.cpu, 5)
+                    self.assertEqual(event.name, 'cpu-cycles')
+                    self.assertNotEqual(symbol.dso_name, '')
+                    self.assertEqual(callchain.nr, 0)
+        self.assertTrue(found_sample)
+
     def test_sample(self):
         found_sample = False
         while True:
@@ -18,39 +18,21 @@
 
 #include <inttypes.h>
 
-#include <limits>
+#include <algorithm>
 
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 
 #include "perf_event.h"
 #include "record.h"
+#include "utils.h"
 
 namespace simpleperf {
 
-bool MapComparator::operator()(const MapEntry* map1,
-                               const MapEntry* map2) const {
-  if (map1->start_addr != map2->start_addr) {
-    return map1->start_addr < map2->start_addr;
-  }
-  // Compare map->len instead of map->get_end_addr() here. Because we set map's
-  // len to std::numeric_limits<uint64_t>::max() in FindMapByAddr(), which makes
-  // map->get_end_addr() overflow.
-  if (map1->len != map2->len) {
-    return map1->len < map2->len;
-  }
-  if (map1->time != map2->time) {
-    return map1->time < map2->time;
-  }
-  return false;
-}
-
 void ThreadTree::SetThreadName(int pid, int tid, const std::string& comm) {
   ThreadEntry* thread = FindThreadOrNew(pid, tid);
   if (comm != thread->comm) {
-    thread_comm_storage_.push_back(
-        std::unique_ptr<std::string>(new std::string(comm)));
-    thread->comm = thread_comm_storage_.back()->c_str();
+    thread->comm = GlobalStringInterner().Intern(comm);
   }
 }
 
@@ -59,8 +41,12 @@ void ThreadTree::ForkThread(int pid, int tid, int ppid, int ptid) {
   ThreadEntry* child = FindThreadOrNew(pid, tid);
   child->comm = parent->comm;
   if (pid != ppid) {
-    // Copy maps from parent process.
-    *child->maps = *parent->maps;
+    // Share the parent's map content instead of copying it; the first
+    // mutation on either side detaches its own copy. Zygote-style traces
+    // fork thousands of children from a parent with thousands of maps,
+    // and most children never mmap before their next exec.
+    child->maps->content = parent->maps->content;
+    child->maps->version = ++map_version_counter_;
   }
 }
 
@@ -108,9 +94,8 @@ void ThreadTree::AddKernelMap(uint64_t start_addr, uint64_t len, uint64_t pgoff,
   Dso* dso = FindKernelDsoOrNew(filename);
   MapEntry* map =
       AllocateMap(MapEntry(start_addr, len, pgoff, time, dso, true));
-  FixOverlappedMap(&kernel_maps_, map);
-  auto pair = kernel_maps_.insert(map);
-  CHECK(pair.second);
+  kernel_maps_.MutableContent()->pending.push_back(map);
+  kernel_maps_.version = ++map_version_counter_;
 }
 
 Dso* ThreadTree::FindKernelDsoOrNew(const std::string& filename) {
@@ -133,12 +118,20 @@ void ThreadTree::AddThreadMap(int pid, int tid, uint64_t start_addr,
   Dso* dso = FindUserDsoOrNew(filename);
   MapEntry* map =
       AllocateMap(MapEntry(start_addr, len, pgoff, time, dso, false));
-  FixOverlappedMap(thread->maps, map);
-  auto pair = thread->maps->insert(map);
-  CHECK(pair.second);
+  thread->maps->MutableContent()->pending.push_back(map);
+  thread->maps->version = ++map_version_counter_;
 }
 
 Dso* ThreadTree::FindUserDsoOrNew(const std::string& filename) {
+  if (use_shared_dsos_) {
+    auto it = shared_user_dso_tree_.find(filename);
+    if (it == shared_user_dso_tree_.end()) {
+      it = shared_user_dso_tree_
+               .emplace(filename, DsoCache::Instance().FindUserDsoOrNew(filename))
+               .first;
+    }
+    return it->second.get();
+  }
   auto it = user_dso_tree_.find(filename);
   if (it == user_dso_tree_.end()) {
     user_dso_tree_[filename] = Dso::CreateDso(DSO_ELF_FILE, filename);
@@ -153,47 +146,69 @@ MapEntry* ThreadTree::AllocateMap(const MapEntry& value) {
   return map;
 }
 
-void ThreadTree::FixOverlappedMap(MapSet* maps, const MapEntry* map) {
-  for (auto it = maps->begin(); it != maps->end();) {
-    if ((*it)->start_addr >= map->get_end_addr()) {
-      // No more overlapped maps.
-      break;
+void ThreadTree::ResolvePendingMaps(MapSet* map_set) {
+  // Resolving doesn't change the logical map content, so mutate the
+  // content in place even when it is shared after a fork: every sharer
+  // benefits from the merge and none needs to redo it.
+  MapSet::Content* content = map_set->content.get();
+  // Apply pending maps in creation order, so a later map overrides the
+  // overlapped parts of earlier maps.
+  for (MapEntry* map : content->pending) {
+    // A zero-length map can't be hit by any address, so don't let it split
+    // other maps.
+    if (map->len == 0) {
+      continue;
     }
-    if ((*it)->get_end_addr() <= map->start_addr) {
-      ++it;
-    } else {
-      MapEntry* old = *it;
-      if (old->start_addr < map->start_addr) {
-        MapEntry* before = AllocateMap(
-            MapEntry(old->start_addr, map->start_addr - old->start_addr,
-                     old->pgoff, old->time, old->dso, old->in_kernel));
-        maps->insert(before);
-      }
-      if (old->get_end_addr() > map->get_end_addr()) {
-        MapEntry* after = AllocateMap(MapEntry(
-            map->get_end_addr(), old->get_end_addr() - map->get_end_addr(),
-            map->get_end_addr() - old->start_addr + old->pgoff, old->time,
-            old->dso, old->in_kernel));
-        maps->insert(after);
-      }
-
-      it = maps->erase(it);
+    std::vector<MapEntry*>& maps = content->maps;
+    // Maps in [maps] are non-overlapping and sorted by start_addr, so their
+    // end addresses are also sorted. Find the first map ending after
+    // map->start_addr.
+    auto first = std::lower_bound(maps.begin(), maps.end(), map->start_addr,
+                                  [](const MapEntry* m, uint64_t addr) {
+                                    return m->get_end_addr() <= addr;
+                                  });
+    auto last = first;
+    while (last != maps.end() && (*last)->start_addr < map->get_end_addr()) {
+      ++last;
+    }
+    // Maps in [first, last) are overlapped with [map]. Replace them with
+    // [map], keeping their non-overlapped parts.
+    std::vector<MapEntry*> pieces;
+    if (first != last && (*first)->start_addr < map->start_addr) {
+      MapEntry* old = *first;
+      pieces.push_back(AllocateMap(
+          MapEntry(old->start_addr, map->start_addr - old->start_addr,
+                   old->pgoff, old->time, old->dso, old->in_kernel)));
     }
+    pieces.push_back(map);
+    if (first != last && (*(last - 1))->get_end_addr() > map->get_end_addr()) {
+      MapEntry* old = *(last - 1);
+      pieces.push_back(AllocateMap(MapEntry(
+          map->get_end_addr(), old->get_end_addr() - map->get_end_addr(),
+          map->get_end_addr() - old->start_addr + old->pgoff, old->time,
+          old->dso, old->in_kernel)));
+    }
+    auto it = maps.erase(first, last);
+    maps.insert(it, pieces.begin(), pieces.end());
   }
+  content->pending.clear();
 }
 
 static bool IsAddrInMap(uint64_t addr, const MapEntry* map) {
   return (addr >= map->start_addr && addr < map->get_end_addr());
 }
 
-static MapEntry* FindMapByAddr(const MapSet& maps, uint64_t addr) {
-  // Construct a map_entry which is strictly after the searched map_entry, based
-  // on MapComparator.
-  MapEntry find_map(addr, std::numeric_limits<uint64_t>::max(), 0,
-                    std::numeric_limits<uint64_t>::max(), nullptr, false);
-  auto it = maps.upper_bound(&find_map);
-  if (it != maps.begin() && IsAddrInMap(addr, *--it)) {
-    return *it;
+MapEntry* ThreadTree::FindMapByAddr(MapSet& map_set, uint64_t addr) {
+  if (!map_set.pending().empty()) {
+    ResolvePendingMaps(&map_set);
+  }
+  const std::vector<MapEntry*>& maps = map_set.maps();
+  auto it = std::upper_bound(maps.begin(), maps.end(), addr,
+                             [](uint64_t addr, const MapEntry* m) {
+                               return addr < m->start_addr;
+                             });
+  if (it != maps.begin() && IsAddrInMap(addr, *(it - 1))) {
+    return *(it - 1);
   }
   return nullptr;
 }
@@ -260,9 +275,8 @@ const Symbol* ThreadTree::FindKernelSymbol(uint64_t ip) {
 
 void ThreadTree::ClearThreadAndMap() {
   thread_tree_.clear();
-  thread_comm_storage_.clear();
   map_set_storage_.clear();
-  kernel_maps_.clear();
+  kernel_maps_.content = std::make_shared<MapSet::Content>();
   map_storage_.clear();
 }
 
@@ -276,6 +290,8 @@ void ThreadTree::AddDsoInfo(const std::string& file_path, uint32_t file_type,
     dso = FindUserDsoOrNew(file_path);
   }
   dso->SetMinVirtualAddress(min_vaddr);
+  // For a dso shared through DsoCache, SetSymbols keeps the symbols the
+  // first user provided, so symbol pointers handed out stay valid.
   dso->SetSymbols(symbols);
 }
 
@@ -322,6 +338,9 @@ std::vector<Dso*> ThreadTree::GetAllDsos() const {
   for (auto& p : user_dso_tree_) {
     result.push_back(p.second.get());
   }
+  for (auto& p : shared_user_dso_tree_) {
+    result.push_back(p.second.get());
+  }
   return result;
 }
 
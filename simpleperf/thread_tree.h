@@ -21,7 +21,7 @@
 
 #include <limits>
 #include <memory>
-#include <set>
+#include <vector>
 
 #include "dso.h"
 
@@ -55,12 +55,43 @@ struct MapEntry {
   uint64_t get_end_addr() const { return start_addr + len; }
 };
 
-struct MapComparator {
-  bool operator()(const MapEntry* map1, const MapEntry* map2) const;
+// MapSet holds the maps of a thread group or the kernel. Newly added maps
+// are appended to [pending] in O(1), and are merged into the sorted [maps]
+// vector at the next address lookup. Resolving overlapped maps lazily
+// amortizes the cost of mmap storms, where many maps are added between two
+// lookups.
+// The map content lives behind a shared_ptr so a fork can share the
+// parent's content in O(1); the first logical mutation on either side
+// makes a private copy (copy-on-write). Threads in one thread group keep
+// sharing by pointing at the same MapSet object, which is unaffected.
+struct MapSet {
+  struct Content {
+    // Non-overlapping maps, sorted by start_addr.
+    std::vector<MapEntry*> maps;
+    // Newly added maps in creation order, not merged into [maps] yet.
+    std::vector<MapEntry*> pending;
+  };
+
+  std::shared_ptr<Content> content = std::make_shared<Content>();
+  // Bumped by ThreadTree whenever the maps change. Users caching state derived
+  // from the maps (like the dwarf unwinder's parsed map state) compare it to
+  // detect stale caches. Values are unique across all MapSets, so a cache
+  // entry can't be revalidated by an unrelated MapSet reusing its address.
+  uint64_t version = 0;
+
+  const std::vector<MapEntry*>& maps() const { return content->maps; }
+  const std::vector<MapEntry*>& pending() const { return content->pending; }
+
+  // Call before a logical mutation. If the content is still shared with
+  // another MapSet after a fork, detach by copying it first.
+  Content* MutableContent() {
+    if (content.use_count() > 1) {
+      content = std::make_shared<Content>(*content);
+    }
+    return content.get();
+  }
 };
 
-using MapSet = std::set<MapEntry*, MapComparator>;
-
 struct ThreadEntry {
   int pid;
   int tid;
@@ -74,7 +105,9 @@ struct ThreadEntry {
 class ThreadTree {
  public:
   ThreadTree()
-      : show_ip_for_unknown_symbol_(false),
+      : map_version_counter_(0),
+        use_shared_dsos_(false),
+        show_ip_for_unknown_symbol_(false),
         show_mark_for_unknown_symbol_(false),
         unknown_symbol_("unknown", 0,
                         std::numeric_limits<unsigned long long>::max()) {
@@ -101,6 +134,16 @@ class ThreadTree {
                            uint64_t* pvaddr_in_file, Dso** pdso = nullptr);
   const Symbol* FindKernelSymbol(uint64_t ip);
   const Symbol* UnknownSymbol() const { return &unknown_symbol_; }
+  // Merge pending maps of [thread], so thread->maps->maps() can be iterated
+  // directly, like by the dwarf unwinder.
+  void ResolveMaps(const ThreadEntry* thread) {
+    ResolvePendingMaps(thread->maps);
+  }
+
+  // Take user dsos from the process-wide DsoCache instead of loading private
+  // copies, so thread trees living in different threads (like one ReportLib
+  // per trace) symbolize against shared dsos. Call before processing records.
+  void UseSharedDsos() { use_shared_dsos_ = true; }
 
   void ShowIpForUnknownSymbol() { show_ip_for_unknown_symbol_ = true; }
   void ShowMarkForUnknownSymbol() {
@@ -124,12 +167,15 @@ class ThreadTree {
   Dso* FindKernelDsoOrNew(const std::string& filename);
   Dso* FindUserDsoOrNew(const std::string& filename);
   MapEntry* AllocateMap(const MapEntry& value);
-  void FixOverlappedMap(MapSet* maps, const MapEntry* map);
+  void ResolvePendingMaps(MapSet* maps);
+  MapEntry* FindMapByAddr(MapSet& maps, uint64_t addr);
 
   std::unordered_map<int, std::unique_ptr<ThreadEntry>> thread_tree_;
-  std::vector<std::unique_ptr<std::string>> thread_comm_storage_;
 
   std::vector<std::unique_ptr<MapSet>> map_set_storage_;
+  // Source of MapSet::version values. Monotonic and never reset, so versions
+  // stay unique even after ClearThreadAndMap().
+  uint64_t map_version_counter_;
   MapSet kernel_maps_;
   std::vector<std::unique_ptr<MapEntry>> map_storage_;
   MapEntry unknown_map_;
@@ -137,7 +183,11 @@ class ThreadTree {
   std::unique_ptr<Dso> kernel_dso_;
   std::unordered_map<std::string, std::unique_ptr<Dso>> module_dso_tree_;
   std::unordered_map<std::string, std::unique_ptr<Dso>> user_dso_tree_;
+  // User dsos taken from the process-wide DsoCache when use_shared_dsos_ is
+  // set. The shared_ptrs keep the cache entries alive for our lifetime.
+  std::unordered_map<std::string, std::shared_ptr<Dso>> shared_user_dso_tree_;
   std::unique_ptr<Dso> unknown_dso_;
+  bool use_shared_dsos_;
   bool show_ip_for_unknown_symbol_;
   bool show_mark_for_unknown_symbol_;
   Symbol unknown_symbol_;
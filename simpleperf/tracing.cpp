@@ -390,12 +390,106 @@ std::string Tracing::GetTracingEventNameHavingId(uint64_t trace_event_id) {
   return "";
 }
 
+bool Tracing::LoadTracingFormatCache(const std::vector<char>& data) {
+  return DeserializeTracingFormats(data, &tracing_formats_);
+}
+
+std::vector<char> Tracing::DumpTracingFormatCache() {
+  if (tracing_formats_.empty()) {
+    tracing_formats_ = tracing_file_->LoadTracingFormatsFromEventFiles();
+  }
+  return SerializeTracingFormats(tracing_formats_);
+}
+
 const std::string& Tracing::GetKallsyms() const {
   return tracing_file_->GetKallsymsFile();
 }
 
 uint32_t Tracing::GetPageSize() const { return tracing_file_->GetPageSize(); }
 
+std::vector<char> SerializeTracingFormats(
+    const std::vector<TracingFormat>& formats) {
+  std::vector<char> data;
+  AppendData(data, static_cast<uint32_t>(formats.size()));
+  for (const auto& format : formats) {
+    AppendData(data, format.system_name);
+    AppendData(data, format.name);
+    AppendData(data, format.id);
+    AppendData(data, static_cast<uint32_t>(format.fields.size()));
+    for (const auto& field : format.fields) {
+      AppendData(data, field.name);
+      AppendData(data, static_cast<uint32_t>(field.offset));
+      AppendData(data, static_cast<uint32_t>(field.elem_size));
+      AppendData(data, static_cast<uint32_t>(field.elem_count));
+      AppendData(data, static_cast<uint32_t>(field.is_signed ? 1 : 0));
+    }
+  }
+  return data;
+}
+
+static bool ReadCachedString(const char*& p, const char* end, std::string* s) {
+  const char* string_end =
+      static_cast<const char*>(memchr(p, '\0', end - p));
+  if (string_end == nullptr) {
+    return false;
+  }
+  s->assign(p, string_end);
+  p = string_end + 1;
+  return true;
+}
+
+bool DeserializeTracingFormats(const std::vector<char>& data,
+                               std::vector<TracingFormat>* formats) {
+  const char* p = data.data();
+  const char* end = data.data() + data.size();
+  auto has_bytes = [&](size_t size) {
+    return static_cast<size_t>(end - p) >= size;
+  };
+  uint32_t format_count;
+  if (!has_bytes(sizeof(format_count))) {
+    LOG(ERROR) << "broken tracing format cache";
+    return false;
+  }
+  MoveFromBinaryFormat(format_count, p);
+  formats->clear();
+  for (uint32_t i = 0; i < format_count; ++i) {
+    TracingFormat format;
+    if (!ReadCachedString(p, end, &format.system_name) ||
+        !ReadCachedString(p, end, &format.name) ||
+        !has_bytes(sizeof(uint64_t) + sizeof(uint32_t))) {
+      LOG(ERROR) << "broken tracing format cache";
+      return false;
+    }
+    MoveFromBinaryFormat(format.id, p);
+    uint32_t field_count;
+    MoveFromBinaryFormat(field_count, p);
+    for (uint32_t j = 0; j < field_count; ++j) {
+      TracingField field;
+      if (!ReadCachedString(p, end, &field.name) ||
+          !has_bytes(sizeof(uint32_t) * 4)) {
+        LOG(ERROR) << "broken tracing format cache";
+        return false;
+      }
+      uint32_t value;
+      MoveFromBinaryFormat(value, p);
+      field.offset = value;
+      MoveFromBinaryFormat(value, p);
+      field.elem_size = value;
+      MoveFromBinaryFormat(value, p);
+      field.elem_count = value;
+      MoveFromBinaryFormat(value, p);
+      field.is_signed = (value == 1);
+      format.fields.push_back(field);
+    }
+    formats->push_back(std::move(format));
+  }
+  if (p != end) {
+    LOG(ERROR) << "broken tracing format cache";
+    return false;
+  }
+  return true;
+}
+
 bool GetTracingData(const std::vector<const EventType*>& event_types,
                     std::vector<char>* data) {
   data->clear();
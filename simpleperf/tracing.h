@@ -78,6 +78,13 @@ class Tracing {
   const std::string& GetKallsyms() const;
   uint32_t GetPageSize() const;
 
+  // Take parsed formats from a tracing format cache feature section, so
+  // GetTracingFormatHavingId() doesn't need to parse the event format files.
+  bool LoadTracingFormatCache(const std::vector<char>& data);
+  // Return the parsed formats serialized for a tracing format cache feature
+  // section, parsing the event format files if not done yet.
+  std::vector<char> DumpTracingFormatCache();
+
  private:
   TracingFile* tracing_file_;
   std::vector<TracingFormat> tracing_formats_;
@@ -86,4 +93,11 @@ class Tracing {
 bool GetTracingData(const std::vector<const EventType*>& event_types,
                     std::vector<char>* data);
 
+// Serialization of TracingFormat structs, used by the tracing format cache
+// feature section. The layout is described in record_file_format.h.
+std::vector<char> SerializeTracingFormats(
+    const std::vector<TracingFormat>& formats);
+bool DeserializeTracingFormats(const std::vector<char>& data,
+                               std::vector<TracingFormat>* formats);
+
 #endif  // SIMPLE_PERF_TRACING_H_
@@ -61,6 +61,22 @@ const char* OneTimeFreeAllocator::AllocateString(const std::string& s) {
 }
 
 
+const char* StringInterner::Intern(const std::string& s) {
+  std::lock_guard<std::mutex> guard(lock_);
+  return pool_.insert(s).first->c_str();
+}
+
+void StringInterner::Clear() {
+  std::lock_guard<std::mutex> guard(lock_);
+  pool_.clear();
+}
+
+StringInterner& GlobalStringInterner() {
+  static StringInterner interner;
+  return interner;
+}
+
+
 FileHelper FileHelper::OpenReadOnly(const std::string& filename) {
     int fd = TEMP_FAILURE_RETRY(open(filename.c_str(), O_RDONLY | O_BINARY));
     return FileHelper(fd);
@@ -20,7 +20,9 @@
 #include <stddef.h>
 #include <time.h>
 
+#include <mutex>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -59,6 +61,27 @@ class OneTimeFreeAllocator {
   char* end_;
 };
 
+// StringInterner stores each distinct string only once, and returns pointers
+// which are valid until Clear(). Interning equal strings returns the same
+// pointer, so frequently repeated names (like thread comms) are stored once
+// and can be checked for equality by comparing pointers. Interning is
+// thread-safe, as dsos shared through DsoCache intern symbol names from
+// multiple threads.
+class StringInterner {
+ public:
+  const char* Intern(const std::string& s);
+  void Clear();
+
+ private:
+  std::mutex lock_;
+  std::unordered_set<std::string> pool_;
+};
+
+// Return the global string interner, shared by thread comms and symbol names.
+// It is cleared together with the other global symbol state when the last Dso
+// is destroyed.
+StringInterner& GlobalStringInterner();
+
 class FileHelper {
  public:
   static FileHelper OpenReadOnly(const std::string& filename);
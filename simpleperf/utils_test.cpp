@@ -73,3 +73,14 @@ TEST(utils, ConvertBytesToValue) {
   ASSERT_EQ(0x05040302ULL, ConvertBytesToValue(buf + 2, 4));
   ASSERT_EQ(0x0706050403020100ULL, ConvertBytesToValue(buf, 8));
 }
+
+TEST(utils, StringInterner) {
+  StringInterner interner;
+  const char* s1 = interner.Intern("thread1");
+  const char* s2 = interner.Intern("thread2");
+  ASSERT_STREQ("thread1", s1);
+  ASSERT_STREQ("thread2", s2);
+  ASSERT_NE(s1, s2);
+  ASSERT_EQ(s1, interner.Intern("thread1"));
+  ASSERT_EQ(s2, interner.Intern(std::string("thread2")));
+}
@@ -18,12 +18,20 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include <android-base/logging.h>
 
+// Process-shared futex, so no FUTEX_PRIVATE_FLAG.
+static int futex(volatile uint32_t* uaddr, int op, uint32_t val) {
+  return syscall(__NR_futex, uaddr, op, val, nullptr, nullptr, 0);
+}
+
 std::unique_ptr<Workload> Workload::CreateWorkload(const std::vector<std::string>& args) {
   std::unique_ptr<Workload> workload(new Workload(args, std::function<void ()>()));
   if (workload != nullptr && workload->CreateNewProcess()) {
@@ -47,8 +55,8 @@ Workload::~Workload() {
       Workload::WaitChildProcess(true, true);
     }
   }
-  if (start_signal_fd_ != -1) {
-    close(start_signal_fd_);
+  if (start_barrier_ != nullptr) {
+    munmap(const_cast<uint32_t*>(start_barrier_), sizeof(uint32_t));
   }
   if (exec_child_fd_ != -1) {
     close(exec_child_fd_);
@@ -58,83 +66,80 @@ Workload::~Workload() {
 bool Workload::CreateNewProcess() {
   CHECK_EQ(work_state_, NotYetCreateNewProcess);
 
-  int start_signal_pipe[2];
-  if (pipe2(start_signal_pipe, O_CLOEXEC) != 0) {
-    PLOG(ERROR) << "pipe2() failed";
+  void* barrier_page = mmap(nullptr, sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (barrier_page == MAP_FAILED) {
+    PLOG(ERROR) << "mmap() failed";
     return false;
   }
+  start_barrier_ = static_cast<uint32_t*>(barrier_page);
+  *start_barrier_ = 0;
 
   int exec_child_pipe[2];
   if (pipe2(exec_child_pipe, O_CLOEXEC) != 0) {
     PLOG(ERROR) << "pipe2() failed";
-    close(start_signal_pipe[0]);
-    close(start_signal_pipe[1]);
     return false;
   }
 
   pid_t pid = fork();
   if (pid == -1) {
     PLOG(ERROR) << "fork() failed";
-    close(start_signal_pipe[0]);
-    close(start_signal_pipe[1]);
     close(exec_child_pipe[0]);
     close(exec_child_pipe[1]);
     return false;
   } else if (pid == 0) {
     // In child process.
-    close(start_signal_pipe[1]);
     close(exec_child_pipe[0]);
-    ChildProcessFn(start_signal_pipe[0], exec_child_pipe[1]);
+    ChildProcessFn(exec_child_pipe[1]);
     _exit(0);
   }
   // In parent process.
-  close(start_signal_pipe[0]);
   close(exec_child_pipe[1]);
-  start_signal_fd_ = start_signal_pipe[1];
   exec_child_fd_ = exec_child_pipe[0];
   work_pid_ = pid;
   work_state_ = NotYetStartNewProcess;
   return true;
 }
 
-void Workload::ChildProcessFn(int start_signal_fd, int exec_child_fd) {
+void Workload::ChildProcessFn(int exec_child_fd) {
   // Die if parent exits.
   prctl(PR_SET_PDEATHSIG, SIGHUP, 0, 0, 0);
 
-  char start_signal = 0;
-  ssize_t nread = TEMP_FAILURE_RETRY(read(start_signal_fd, &start_signal, 1));
-  if (nread == 1 && start_signal == 1) {
-    close(start_signal_fd);
-    if (child_proc_function_) {
-      close(exec_child_fd);
-      child_proc_function_();
-    } else {
-      char* argv[child_proc_args_.size() + 1];
-      for (size_t i = 0; i < child_proc_args_.size(); ++i) {
-        argv[i] = &child_proc_args_[i][0];
-      }
-      argv[child_proc_args_.size()] = nullptr;
-      execvp(argv[0], argv);
-      // If execvp() succeed, we will not arrive here. But if it failed, we need to
-      // report the failure to the parent process by writing 1 to exec_child_fd.
-      int saved_errno = errno;
-      char exec_child_failed = 1;
-      TEMP_FAILURE_RETRY(write(exec_child_fd, &exec_child_failed, 1));
-      close(exec_child_fd);
-      errno = saved_errno;
-      PLOG(ERROR) << "child process failed to execvp(" << argv[0] << ")";
-    }
+  // Prepare argv before waiting, so only execvp() itself remains between the
+  // wakeup and the first workload instruction.
+  char* argv[child_proc_args_.size() + 1];
+  for (size_t i = 0; i < child_proc_args_.size(); ++i) {
+    argv[i] = &child_proc_args_[i][0];
+  }
+  argv[child_proc_args_.size()] = nullptr;
+
+  // Wait on the shared-memory barrier. If the parent has stored 1 already,
+  // FUTEX_WAIT fails with EAGAIN immediately; on a spurious wakeup the loop
+  // waits again.
+  while (*start_barrier_ != 1) {
+    futex(start_barrier_, FUTEX_WAIT, 0);
+  }
+  if (child_proc_function_) {
+    close(exec_child_fd);
+    child_proc_function_();
   } else {
-    PLOG(ERROR) << "child process failed to receive start_signal, nread = " << nread;
+    execvp(argv[0], argv);
+    // If execvp() succeed, we will not arrive here. But if it failed, we need to
+    // report the failure to the parent process by writing 1 to exec_child_fd.
+    int saved_errno = errno;
+    char exec_child_failed = 1;
+    TEMP_FAILURE_RETRY(write(exec_child_fd, &exec_child_failed, 1));
+    close(exec_child_fd);
+    errno = saved_errno;
+    PLOG(ERROR) << "child process failed to execvp(" << argv[0] << ")";
   }
 }
 
 bool Workload::Start() {
   CHECK_EQ(work_state_, NotYetStartNewProcess);
-  char start_signal = 1;
-  ssize_t nwrite = TEMP_FAILURE_RETRY(write(start_signal_fd_, &start_signal, 1));
-  if (nwrite != 1) {
-    PLOG(ERROR) << "write start signal failed";
+  __atomic_store_n(start_barrier_, 1, __ATOMIC_RELEASE);
+  if (futex(start_barrier_, FUTEX_WAKE, 1) == -1) {
+    PLOG(ERROR) << "futex(FUTEX_WAKE) failed";
     return false;
   }
   char exec_child_failed;
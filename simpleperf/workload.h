@@ -17,6 +17,7 @@
 #ifndef SIMPLE_PERF_WORKLOAD_H_
 #define SIMPLE_PERF_WORKLOAD_H_
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <chrono>
 #include <functional>
@@ -54,12 +55,12 @@ class Workload {
         child_proc_args_(args),
         child_proc_function_(function),
         work_pid_(-1),
-        start_signal_fd_(-1),
+        start_barrier_(nullptr),
         exec_child_fd_(-1) {
   }
 
   bool CreateNewProcess();
-  void ChildProcessFn(int start_signal_fd, int exec_child_fd);
+  void ChildProcessFn(int exec_child_fd);
   bool WaitChildProcess(bool wait_forever, bool is_child_killed);
 
   WorkState work_state_;
@@ -67,7 +68,10 @@ class Workload {
   std::vector<std::string> child_proc_args_;
   std::function<void ()> child_proc_function_;
   pid_t work_pid_;
-  int start_signal_fd_;  // The parent process writes 1 to start workload in the child process.
+  // A futex in shared memory. The child process waits on it after being
+  // created, and the parent process stores 1 and wakes it to start the
+  // workload, which is much cheaper than a pipe round trip.
+  volatile uint32_t* start_barrier_;
   int exec_child_fd_;    // The child process writes 1 to notify that execvp() failed.
 
   DISALLOW_COPY_AND_ASSIGN(Workload);
@@ -17,6 +17,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #include <time.h>
 #include <linux/input.h>
 
@@ -55,13 +56,83 @@ static void clear()
     gr_flip();
 }
 
-static void draw(const char *resname)
+/* decode-ahead pipeline: the next image is decoded on a worker thread
+ * into its own surface while the current one is on screen, so a flip is
+ * never stalled behind PNG decode (visible as a hitch on large panels).
+ * gr_flip() already page-flips between the two framebuffer pages; this
+ * adds the second decode surface that keeps them fed. */
+
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static const char *prefetch_name;
+static GRSurface *prefetch_surface;
+static bool prefetch_done;
+static bool prefetch_exit;
+
+static void *prefetch_worker(void *)
+{
+    pthread_mutex_lock(&prefetch_mutex);
+    while (!prefetch_exit) {
+        if (prefetch_name == NULL) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+            continue;
+        }
+        const char *resname = prefetch_name;
+        pthread_mutex_unlock(&prefetch_mutex);
+
+        GRSurface *surface = NULL;
+        if (res_create_display_surface(resname, &surface) < 0) {
+            LOGE("failed to create surface for %s\n", resname);
+            surface = NULL;
+        }
+
+        pthread_mutex_lock(&prefetch_mutex);
+        prefetch_surface = surface;
+        prefetch_name = NULL;
+        prefetch_done = true;
+        pthread_cond_signal(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+    return NULL;
+}
+
+static void start_prefetch(const char *resname)
+{
+    pthread_mutex_lock(&prefetch_mutex);
+    prefetch_done = false;
+    prefetch_surface = NULL;
+    prefetch_name = resname;
+    pthread_cond_signal(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+static GRSurface *finish_prefetch()
+{
+    pthread_mutex_lock(&prefetch_mutex);
+    while (!prefetch_done) {
+        pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+    }
+    GRSurface *surface = prefetch_surface;
+    prefetch_surface = NULL;
+    prefetch_done = false;
+    pthread_mutex_unlock(&prefetch_mutex);
+    return surface;
+}
+
+static void stop_prefetch(pthread_t thread)
+{
+    pthread_mutex_lock(&prefetch_mutex);
+    prefetch_exit = true;
+    pthread_cond_signal(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
+    pthread_join(thread, NULL);
+}
+
+static void draw(GRSurface *surface)
 {
-    GRSurface* surface;
     int w, h, x, y;
 
-    if (res_create_display_surface(resname, &surface) < 0) {
-        LOGE("failed to create surface for %s\n", resname);
+    if (surface == NULL) {
         return;
     }
 
@@ -116,11 +187,23 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
+    pthread_t prefetch_thread;
+    if (pthread_create(&prefetch_thread, NULL, prefetch_worker, NULL) != 0) {
+        LOGE("failed to create prefetch thread\n");
+        return EXIT_FAILURE;
+    }
+    start_prefetch(argv[optind]);
+
     /* display all images except the last one, switch to next image after
      * timeout or user input */
 
     while (optind < argc - 1) {
-        draw(argv[optind++]);
+        GRSurface *surface = finish_prefetch();
+        /* decode of the next image overlaps with the blit and the wait
+         * below */
+        start_prefetch(argv[optind + 1]);
+        draw(surface);
+        optind++;
 
         start = android::uptimeMillis();
         long int timeout_remaining = timeout;
@@ -141,10 +224,11 @@ int main(int argc, char **argv)
      * image and wait until the power button is pressed or LAST_TIMEOUT_MS
      * has elapsed */
 
+    GRSurface *last_surface = finish_prefetch();
     if (input) {
         start = android::uptimeMillis();
 
-        draw(argv[optind]);
+        draw(last_surface);
 
         do {
             if (ev_wait(timeout) == 0) {
@@ -155,8 +239,11 @@ int main(int argc, char **argv)
                 break;
             }
         } while (key_code != KEY_POWER);
+    } else if (last_surface != NULL) {
+        res_free_surface(last_surface);
     }
 
+    stop_prefetch(prefetch_thread);
     clear();
     gr_exit();
     ev_exit();
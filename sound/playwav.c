@@ -8,6 +8,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/ioctl.h>
@@ -34,17 +35,113 @@ struct msm_audio_stats {
     uint32_t out_bytes;
     uint32_t unused[3];
 };
-    
+
+/* -bench: per-period timing telemetry so the tool doubles as a latency
+ * benchmark. The msm pcm device only exposes blocking per-period writes
+ * (no mmap pointer interface), so the write call itself is the period
+ * clock: each write should complete one period time after the previous
+ * one. Deviation from that is jitter, and the DSP consuming everything
+ * we have queued (out_bytes catching up to written bytes) is an
+ * underrun. Late reads on the record side are counted as overruns. */
+
+#define JITTER_BUCKETS 20
+
+struct bench_state {
+    unsigned long long start_ns;
+    unsigned long long last_ns;
+    unsigned long long expected_ns;
+    unsigned long long min_ns;
+    unsigned long long max_ns;
+    unsigned long long sum_ns;
+    unsigned periods;
+    unsigned xruns;
+    unsigned hist[JITTER_BUCKETS];
+};
+
+static int bench;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_init(struct bench_state *b, unsigned long long expected_ns)
+{
+    memset(b, 0, sizeof(*b));
+    b->expected_ns = expected_ns;
+    b->min_ns = ~0ull;
+    b->start_ns = b->last_ns = now_ns();
+}
+
+static void bench_xrun(struct bench_state *b, const char *what)
+{
+    unsigned long long t = now_ns() - b->start_ns;
+    b->xruns++;
+    fprintf(stderr, "%s %u at %llu.%06llu s\n",
+            what, b->xruns, t / 1000000000ull,
+            (t % 1000000000ull) / 1000);
+}
+
+static void bench_period(struct bench_state *b)
+{
+    unsigned long long now = now_ns();
+    unsigned long long delta = now - b->last_ns;
+    unsigned long long jitter_us;
+    unsigned bucket = 0;
+
+    b->last_ns = now;
+    b->periods++;
+    b->sum_ns += delta;
+    if (delta < b->min_ns)
+        b->min_ns = delta;
+    if (delta > b->max_ns)
+        b->max_ns = delta;
+
+    jitter_us = (delta > b->expected_ns ? delta - b->expected_ns
+                                        : b->expected_ns - delta) / 1000;
+    while (jitter_us > 0 && bucket < JITTER_BUCKETS - 1) {
+        jitter_us >>= 1;
+        bucket++;
+    }
+    b->hist[bucket]++;
+}
+
+static void bench_report(const struct bench_state *b, const char *what)
+{
+    unsigned i;
+
+    fprintf(stderr, "bench(%s): periods=%u %ss=%u expected_us=%llu "
+            "min_us=%llu avg_us=%llu max_us=%llu\n",
+            what, b->periods, (*what == 'p') ? "underrun" : "overrun",
+            b->xruns, b->expected_ns / 1000, b->min_ns / 1000,
+            b->periods ? b->sum_ns / b->periods / 1000 : 0,
+            b->max_ns / 1000);
+    fprintf(stderr, "jitter histogram (us):\n");
+    for (i = 0; i < JITTER_BUCKETS; i++) {
+        if (!b->hist[i])
+            continue;
+        if (i == 0)
+            fprintf(stderr, "  <1              %u\n", b->hist[i]);
+        else
+            fprintf(stderr, "  %8u-%-8u %u\n",
+                    1u << (i - 1), (1u << i) - 1, b->hist[i]);
+    }
+}
+
 int pcm_play(unsigned rate, unsigned channels,
              int (*fill)(void *buf, unsigned sz, void *cookie),
              void *cookie)
 {
     struct msm_audio_config config;
     struct msm_audio_stats stats;
+    struct bench_state b;
+    unsigned written = 0;
     unsigned sz, n;
     char buf[8192];
     int afd;
-    
+
     afd = open("/dev/msm_pcm_out", O_RDWR);
     if (afd < 0) {
         perror("pcm_play: cannot open audio device");
@@ -74,23 +171,34 @@ int pcm_play(unsigned rate, unsigned channels,
             break;
         if (write(afd, buf, sz) != sz)
             break;
+        written += sz;
     }
 
     fprintf(stderr,"start\n");
     ioctl(afd, AUDIO_START, 0);
 
+    /* one period of 16 bit frames */
+    bench_init(&b, (unsigned long long)sz * 1000000000ull /
+               (rate * channels * 2));
+
     for (;;) {
-#if 0
-        if (ioctl(afd, AUDIO_GET_STATS, &stats) == 0)
-            fprintf(stderr,"%10d\n", stats.out_bytes);
-#endif
+        if (bench && ioctl(afd, AUDIO_GET_STATS, &stats) == 0 &&
+            stats.out_bytes >= written) {
+            /* the DSP drained everything we queued before we refilled */
+            bench_xrun(&b, "underrun");
+        }
         if (fill(buf, sz, cookie))
             break;
         if (write(afd, buf, sz) != sz)
             break;
+        written += sz;
+        if (bench)
+            bench_period(&b);
     }
 
 done:
+    if (bench)
+        bench_report(&b, "play");
     close(afd);
     return 0;
 }
@@ -195,11 +303,12 @@ int wav_rec(const char *fn, unsigned channels, unsigned rate)
     struct wav_header hdr;
     unsigned char buf[8192];
     struct msm_audio_config cfg;
+    struct bench_state b;
     unsigned sz, n;
     int fd, afd;
     unsigned total = 0;
     unsigned char tmp;
-    
+
     hdr.riff_id = ID_RIFF;
     hdr.riff_sz = 0;
     hdr.riff_fmt = ID_WAVE;
@@ -261,6 +370,10 @@ int wav_rec(const char *fn, unsigned channels, unsigned rate)
     fcntl(0, F_SETFL, O_NONBLOCK);
     fprintf(stderr,"\n*** RECORDING * HIT ENTER TO STOP ***\n");
 
+    /* one period of 16 bit frames */
+    bench_init(&b, (unsigned long long)sz * 1000000000ull /
+               (cfg.sample_rate * cfg.channel_count * 2));
+
     for (;;) {
         while (read(0, &tmp, 1) == 1) {
             if ((tmp == 13) || (tmp == 10)) goto done;
@@ -269,6 +382,12 @@ int wav_rec(const char *fn, unsigned channels, unsigned rate)
             perror("cannot read buffer");
             goto fail;
         }
+        if (bench) {
+            /* a read arriving late means the driver ring overwrote */
+            if (now_ns() - b.last_ns > b.expected_ns + b.expected_ns / 2)
+                bench_xrun(&b, "overrun");
+            bench_period(&b);
+        }
         if (write(fd, buf, sz) != sz) {
             perror("cannot write buffer");
             goto fail;
@@ -277,6 +396,8 @@ int wav_rec(const char *fn, unsigned channels, unsigned rate)
 
     }
 done:
+    if (bench)
+        bench_report(&b, "rec");
     close(afd);
 
         /* update lengths in header */
@@ -346,6 +467,8 @@ int main(int argc, char **argv)
             channels = 2;
         } else if (!strcmp(argv[0],"-mono")) {
             channels = 1;
+        } else if (!strcmp(argv[0],"-bench")) {
+            bench = 1;
         } else if (!strcmp(argv[0],"-rate")) {
             argc--;
             argv++;
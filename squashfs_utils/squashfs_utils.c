@@ -20,8 +20,11 @@
 #include <cutils/klog.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "squashfs_fs.h"
@@ -86,3 +89,95 @@ cleanup:
     close(data_device);
     return ret;
 }
+
+/* parsed superblocks, keyed by device path */
+struct sb_cache_entry {
+    char *path;
+    struct squashfs_info info;
+    struct sb_cache_entry *next;
+};
+
+static struct sb_cache_entry *sb_cache = NULL;
+static pthread_mutex_t sb_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Parse the superblock through a private mapping instead of a read; the
+ * page stays in the page cache for the next caller. Falls back to the
+ * read path for targets that cannot be mapped. */
+static int parse_sb_mmap(const char *blk_device, struct squashfs_info *info)
+{
+    int fd;
+    int ret;
+    void *addr;
+
+    fd = TEMP_FAILURE_RETRY(open(blk_device, O_RDONLY | O_CLOEXEC));
+    if (fd == -1) {
+        ERROR("Error opening block device (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    addr = mmap(NULL, sizeof(struct squashfs_super_block), PROT_READ,
+                MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return squashfs_parse_sb(blk_device, info);
+    }
+
+    ret = squashfs_parse_sb_buffer(addr, info);
+    if (ret == -1) {
+        ERROR("Not a valid squashfs filesystem\n");
+    }
+    munmap(addr, sizeof(struct squashfs_super_block));
+    return ret;
+}
+
+int squashfs_parse_sb_cached(const char *blk_device, struct squashfs_info *info)
+{
+    struct sb_cache_entry *entry;
+
+    pthread_mutex_lock(&sb_cache_lock);
+    for (entry = sb_cache; entry != NULL; entry = entry->next) {
+        if (!strcmp(entry->path, blk_device)) {
+            *info = entry->info;
+            pthread_mutex_unlock(&sb_cache_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&sb_cache_lock);
+
+    if (parse_sb_mmap(blk_device, info) == -1) {
+        return -1;
+    }
+
+    entry = malloc(sizeof(struct sb_cache_entry));
+    if (entry == NULL) {
+        /* the caller still has the result, only caching failed */
+        return 0;
+    }
+    entry->path = strdup(blk_device);
+    if (entry->path == NULL) {
+        free(entry);
+        return 0;
+    }
+    entry->info = *info;
+
+    pthread_mutex_lock(&sb_cache_lock);
+    entry->next = sb_cache;
+    sb_cache = entry;
+    pthread_mutex_unlock(&sb_cache_lock);
+
+    return 0;
+}
+
+void squashfs_drop_sb_cache(void)
+{
+    struct sb_cache_entry *entry, *next;
+
+    pthread_mutex_lock(&sb_cache_lock);
+    for (entry = sb_cache; entry != NULL; entry = next) {
+        next = entry->next;
+        free(entry->path);
+        free(entry);
+    }
+    sb_cache = NULL;
+    pthread_mutex_unlock(&sb_cache_lock);
+}
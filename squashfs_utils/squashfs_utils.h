@@ -34,6 +34,10 @@ struct squashfs_info {
 size_t squashfs_get_sb_size();
 int squashfs_parse_sb_buffer(const void *data, struct squashfs_info *info);
 int squashfs_parse_sb(const char *blk_device, struct squashfs_info *info);
+/* Like squashfs_parse_sb, but remembers the result per device path so
+ * repeated queries do not touch the device again. */
+int squashfs_parse_sb_cached(const char *blk_device, struct squashfs_info *info);
+void squashfs_drop_sb_cache(void);
 
 #ifdef __cplusplus
 }
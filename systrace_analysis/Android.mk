@@ -0,0 +1,24 @@
+# Copyright 2017 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH:= $(call my-dir)
+
+# Native trace analyzer, see analyze_trace.cpp.
+include $(CLEAR_VARS)
+LOCAL_CLANG := true
+LOCAL_MODULE := trace_analyzer
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := trace_parser.cpp analyze_trace.cpp
+LOCAL_CFLAGS := -Wall -Werror -O2
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Native analyzer for ftrace/atrace captures. Computes cpu residency and the
+   top uninterruptibly-blocked threads from the sched events, and prints the
+   results as json, replacing the much slower javascript post-processing
+   driven by analyze_trace.py. */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trace_parser.h"
+
+using namespace systrace_analysis;
+
+struct BlockReason {
+  uint64_t time = 0;  // microseconds
+  uint64_t count = 0;
+};
+
+struct ThreadStats {
+  const char* name = nullptr;
+  int pid = 0;
+  // cpu residency
+  uint64_t run_time = 0;            // microseconds, all cpus
+  std::map<int, uint64_t> cpu_time; // microseconds per cpu
+  // uninterruptible sleep
+  uint64_t blocked_time = 0;
+  uint64_t blocked_count = 0;
+  uint64_t max_blocked_time = 0;
+  std::unordered_map<const char*, BlockReason> reasons;  // by interned caller
+  // state while parsing
+  uint64_t block_start = 0;
+  uint64_t last_block_time = 0;
+  bool blocked = false;
+};
+
+struct CpuState {
+  uint64_t last_switch = 0;
+  int running_pid = -1;  // unknown until the first switch
+  uint64_t busy_time = 0;
+};
+
+class Analyzer {
+ public:
+  bool Run(const std::string& trace_file);
+  void PrintJson(FILE* fp, size_t top_count);
+
+ private:
+  ThreadStats* FindThread(int pid) {
+    ThreadStats* t = &threads_[pid];
+    t->pid = pid;
+    return t;
+  }
+
+  void SetThreadName(ThreadStats* t, const char* comm, size_t len) {
+    // Keep the latest comm seen for the thread.
+    t->name = interner_.Intern(comm, len);
+  }
+
+  void OnSchedSwitch(const TraceEvent& e);
+  void OnSchedWakeup(const TraceEvent& e);
+  void OnBlockedReason(const TraceEvent& e);
+
+  FtraceParser parser_;
+  StringInterner interner_;
+  std::unordered_map<int, ThreadStats> threads_;
+  std::map<int, CpuState> cpus_;
+};
+
+void Analyzer::OnSchedSwitch(const TraceEvent& e) {
+  int64_t prev_pid = GetIntField(e, "prev_pid=", -1);
+  int64_t next_pid = GetIntField(e, "next_pid=", -1);
+  if (prev_pid < 0 || next_pid < 0) {
+    return;
+  }
+  CpuState* cpu = &cpus_[e.cpu];
+  // The interval since the last switch on this cpu belongs to the outgoing
+  // thread. Before the first switch the running thread is unknown, so the
+  // outgoing pid of this event stands in for it.
+  int running_pid = cpu->running_pid >= 0 ? cpu->running_pid : (int)prev_pid;
+  if (cpu->last_switch != 0 && e.timestamp > cpu->last_switch) {
+    uint64_t delta = e.timestamp - cpu->last_switch;
+    ThreadStats* t = FindThread(running_pid);
+    t->run_time += delta;
+    t->cpu_time[e.cpu] += delta;
+    if (running_pid != 0) {  // pid 0 is the idle thread
+      cpu->busy_time += delta;
+    }
+  }
+  cpu->last_switch = e.timestamp;
+  cpu->running_pid = (int)next_pid;
+
+  const char* comm;
+  size_t comm_len;
+  ThreadStats* prev = FindThread((int)prev_pid);
+  if (GetStrField(e, "prev_comm=", &comm, &comm_len)) {
+    SetThreadName(prev, comm, comm_len);
+  }
+  if (GetStrField(e, "next_comm=", &comm, &comm_len)) {
+    SetThreadName(FindThread((int)next_pid), comm, comm_len);
+  }
+
+  // A prev_state containing D means the thread went to sleep
+  // uninterruptibly; the block lasts until its next wakeup.
+  const char* state;
+  size_t state_len;
+  if (prev_pid != 0 && GetStrField(e, "prev_state=", &state, &state_len) &&
+      memchr(state, 'D', state_len) != nullptr) {
+    prev->blocked = true;
+    prev->block_start = e.timestamp;
+  }
+}
+
+void Analyzer::OnSchedWakeup(const TraceEvent& e) {
+  int64_t pid = GetIntField(e, "pid=", -1);
+  if (pid < 0) {
+    return;
+  }
+  ThreadStats* t = FindThread((int)pid);
+  if (!t->blocked) {
+    return;
+  }
+  t->blocked = false;
+  uint64_t delta =
+      e.timestamp > t->block_start ? e.timestamp - t->block_start : 0;
+  t->blocked_time += delta;
+  t->blocked_count++;
+  t->last_block_time = delta;
+  if (delta > t->max_blocked_time) {
+    t->max_blocked_time = delta;
+  }
+}
+
+void Analyzer::OnBlockedReason(const TraceEvent& e) {
+  int64_t pid = GetIntField(e, "pid=", -1);
+  const char* caller;
+  size_t caller_len;
+  if (pid < 0 || !GetStrField(e, "caller=", &caller, &caller_len)) {
+    return;
+  }
+  ThreadStats* t = FindThread((int)pid);
+  // The reason is logged at wakeup, right after the wakeup event closed the
+  // blocked interval, so attribute the last interval's time to the caller.
+  BlockReason* reason = &t->reasons[interner_.Intern(caller, caller_len)];
+  reason->time += t->last_block_time;
+  reason->count++;
+}
+
+bool Analyzer::Run(const std::string& trace_file) {
+  if (!parser_.Open(trace_file)) {
+    return false;
+  }
+  using namespace std::placeholders;
+  parser_.AddEventHandler("sched_switch",
+                          std::bind(&Analyzer::OnSchedSwitch, this, _1));
+  FtraceParser::EventHandler wakeup =
+      std::bind(&Analyzer::OnSchedWakeup, this, _1);
+  parser_.AddEventHandler("sched_wakeup", wakeup);
+  parser_.AddEventHandler("sched_wakeup_new", wakeup);
+  parser_.AddEventHandler("sched_blocked_reason",
+                          std::bind(&Analyzer::OnBlockedReason, this, _1));
+  if (!parser_.Parse()) {
+    fprintf(stderr, "no events parsed from %s\n", trace_file.c_str());
+    return false;
+  }
+  // Account the tail from the last switch on each cpu to the trace end.
+  for (auto& p : cpus_) {
+    CpuState* cpu = &p.second;
+    if (cpu->running_pid >= 0 && parser_.end_time() > cpu->last_switch) {
+      uint64_t delta = parser_.end_time() - cpu->last_switch;
+      ThreadStats* t = FindThread(cpu->running_pid);
+      t->run_time += delta;
+      t->cpu_time[p.first] += delta;
+      if (cpu->running_pid != 0) {
+        cpu->busy_time += delta;
+      }
+    }
+  }
+  return true;
+}
+
+static double ToMs(uint64_t us) {
+  return us / 1000.0;
+}
+
+static void PrintJsonString(FILE* fp, const char* s) {
+  fputc('"', fp);
+  for (; s != nullptr && *s != '\0'; ++s) {
+    if (*s == '"' || *s == '\\') {
+      fprintf(fp, "\\%c", *s);
+    } else if ((unsigned char)*s < 0x20) {
+      fprintf(fp, "\\u%04x", *s);
+    } else {
+      fputc(*s, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+void Analyzer::PrintJson(FILE* fp, size_t top_count) {
+  uint64_t duration = parser_.end_time() - parser_.start_time();
+
+  fprintf(fp, "{\n");
+  fprintf(fp,
+          "  \"trace\": {\"duration_ms\": %.3f, \"events\": %llu},\n",
+          ToMs(duration), (unsigned long long)parser_.event_count());
+
+  fprintf(fp, "  \"cpu_residency\": [\n");
+  for (auto it = cpus_.begin(); it != cpus_.end(); ++it) {
+    double percent =
+        duration > 0 ? it->second.busy_time * 100.0 / duration : 0;
+    fprintf(fp, "    {\"cpu\": %d, \"busy_ms\": %.3f, \"busy_percent\": %.2f}%s\n",
+            it->first, ToMs(it->second.busy_time), percent,
+            std::next(it) != cpus_.end() ? "," : "");
+  }
+  fprintf(fp, "  ],\n");
+
+  std::vector<const ThreadStats*> by_run_time;
+  std::vector<const ThreadStats*> by_blocked_time;
+  for (const auto& p : threads_) {
+    if (p.second.run_time > 0) {
+      by_run_time.push_back(&p.second);
+    }
+    if (p.second.blocked_time > 0) {
+      by_blocked_time.push_back(&p.second);
+    }
+  }
+  auto run_time_greater = [](const ThreadStats* a, const ThreadStats* b) {
+    return a->run_time > b->run_time;
+  };
+  auto blocked_time_greater = [](const ThreadStats* a, const ThreadStats* b) {
+    return a->blocked_time > b->blocked_time;
+  };
+  std::sort(by_run_time.begin(), by_run_time.end(), run_time_greater);
+  std::sort(by_blocked_time.begin(), by_blocked_time.end(),
+            blocked_time_greater);
+  if (by_run_time.size() > top_count) {
+    by_run_time.resize(top_count);
+  }
+  if (by_blocked_time.size() > top_count) {
+    by_blocked_time.resize(top_count);
+  }
+
+  fprintf(fp, "  \"thread_residency\": [\n");
+  for (size_t i = 0; i < by_run_time.size(); ++i) {
+    const ThreadStats* t = by_run_time[i];
+    fprintf(fp, "    {\"name\": ");
+    PrintJsonString(fp, t->name != nullptr ? t->name : "<unknown>");
+    fprintf(fp, ", \"pid\": %d, \"run_ms\": %.3f, \"cpus\": {", t->pid,
+            ToMs(t->run_time));
+    for (auto it = t->cpu_time.begin(); it != t->cpu_time.end(); ++it) {
+      fprintf(fp, "\"%d\": %.3f%s", it->first, ToMs(it->second),
+              std::next(it) != t->cpu_time.end() ? ", " : "");
+    }
+    fprintf(fp, "}}%s\n", i + 1 != by_run_time.size() ? "," : "");
+  }
+  fprintf(fp, "  ],\n");
+
+  fprintf(fp, "  \"top_blockers\": [\n");
+  for (size_t i = 0; i < by_blocked_time.size(); ++i) {
+    const ThreadStats* t = by_blocked_time[i];
+    fprintf(fp, "    {\"name\": ");
+    PrintJsonString(fp, t->name != nullptr ? t->name : "<unknown>");
+    fprintf(fp,
+            ", \"pid\": %d, \"blocked_ms\": %.3f, \"blocks\": %llu, "
+            "\"max_blocked_ms\": %.3f, \"reasons\": [",
+            t->pid, ToMs(t->blocked_time),
+            (unsigned long long)t->blocked_count, ToMs(t->max_blocked_time));
+    std::vector<std::pair<const char*, const BlockReason*>> reasons;
+    for (const auto& p : t->reasons) {
+      reasons.push_back(std::make_pair(p.first, &p.second));
+    }
+    std::sort(reasons.begin(), reasons.end(),
+              [](const std::pair<const char*, const BlockReason*>& a,
+                 const std::pair<const char*, const BlockReason*>& b) {
+                return a.second->time > b.second->time;
+              });
+    for (size_t j = 0; j < reasons.size(); ++j) {
+      fprintf(fp, "{\"caller\": ");
+      PrintJsonString(fp, reasons[j].first);
+      fprintf(fp, ", \"blocked_ms\": %.3f, \"count\": %llu}%s",
+              ToMs(reasons[j].second->time),
+              (unsigned long long)reasons[j].second->count,
+              j + 1 != reasons.size() ? ", " : "");
+    }
+    fprintf(fp, "]}%s\n", i + 1 != by_blocked_time.size() ? "," : "");
+  }
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+}
+
+static int Usage() {
+  printf("trace_analyzer: analyze an ftrace/atrace capture natively.\n"
+         "\n"
+         "usage: trace_analyzer [ options ] TRACE_FILE\n"
+         "options:\n"
+         "  -h                 show this help\n"
+         "  -n COUNT           threads to list per table (default 20)\n"
+         "  -o FILE            write json to FILE instead of stdout\n"
+         "\n"
+         "TRACE_FILE is raw atrace/ftrace output, or a systrace html file\n"
+         "with embedded trace data.\n");
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  size_t top_count = 20;
+  std::string output_file;
+
+  int c;
+  while ((c = getopt(argc, argv, "hn:o:")) != -1) {
+    switch (c) {
+      case 'n':
+        top_count = strtoul(optarg, nullptr, 10);
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'h':
+      default:
+        return Usage();
+    }
+  }
+  if (optind + 1 != argc) {
+    return Usage();
+  }
+
+  Analyzer analyzer;
+  if (!analyzer.Run(argv[optind])) {
+    return 1;
+  }
+
+  FILE* fp = stdout;
+  if (!output_file.empty()) {
+    fp = fopen(output_file.c_str(), "w");
+    if (fp == nullptr) {
+      fprintf(stderr, "failed to open %s: %s\n", output_file.c_str(),
+              strerror(errno));
+      return 1;
+    }
+  }
+  analyzer.PrintJson(fp, top_count);
+  if (fp != stdout) {
+    fclose(fp);
+  }
+  return 0;
+}
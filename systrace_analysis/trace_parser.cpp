@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace_parser.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace systrace_analysis {
+
+static uint64_t HashName(const char* s, size_t len) {
+  // FNV-1a.
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h = (h ^ static_cast<uint8_t>(s[i])) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static const char* FindField(const TraceEvent& e, const char* field,
+                             size_t field_len) {
+  const char* p = e.args;
+  const char* end = e.args + e.args_len;
+  while (p + field_len < end) {
+    const char* hit = static_cast<const char*>(
+        memmem(p, end - p, field, field_len));
+    if (hit == nullptr) {
+      return nullptr;
+    }
+    // Only accept the field at the start of args or after a space, so
+    // "pid=" doesn't match inside "prev_pid=".
+    if (hit == e.args || hit[-1] == ' ') {
+      return hit + field_len;
+    }
+    p = hit + 1;
+  }
+  return nullptr;
+}
+
+int64_t GetIntField(const TraceEvent& e, const char* field,
+                    int64_t default_value) {
+  const char* p = FindField(e, field, strlen(field));
+  if (p == nullptr) {
+    return default_value;
+  }
+  return strtoll(p, nullptr, 10);
+}
+
+bool GetStrField(const TraceEvent& e, const char* field, const char** value,
+                 size_t* len) {
+  const char* p = FindField(e, field, strlen(field));
+  if (p == nullptr) {
+    return false;
+  }
+  const char* end = e.args + e.args_len;
+  const char* q = p;
+  while (q < end && *q != ' ') {
+    ++q;
+  }
+  *value = p;
+  *len = q - p;
+  return true;
+}
+
+const char* StringInterner::Intern(const char* s, size_t len) {
+  return pool_.insert(std::string(s, len)).first->c_str();
+}
+
+FtraceParser::FtraceParser()
+    : map_addr_(nullptr),
+      map_size_(0),
+      data_(nullptr),
+      size_(0),
+      start_time_(0),
+      end_time_(0),
+      event_count_(0) {}
+
+FtraceParser::~FtraceParser() {
+  if (map_addr_ != nullptr) {
+    munmap(map_addr_, map_size_);
+  }
+}
+
+bool FtraceParser::Open(const std::string& path) {
+  int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY));
+  if (fd == -1) {
+    fprintf(stderr, "failed to open %s: %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "failed to stat %s\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  map_size_ = st.st_size;
+  map_addr_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map_addr_ == MAP_FAILED) {
+    fprintf(stderr, "failed to mmap %s: %s\n", path.c_str(), strerror(errno));
+    map_addr_ = nullptr;
+    return false;
+  }
+  // The trace is read front to back exactly once.
+  madvise(map_addr_, map_size_, MADV_SEQUENTIAL);
+  data_ = static_cast<const char*>(map_addr_);
+  size_ = map_size_;
+  return true;
+}
+
+void FtraceParser::AddEventHandler(const std::string& event_name,
+                                   const EventHandler& handler) {
+  uint64_t hash = HashName(event_name.c_str(), event_name.size());
+  handlers_[hash] = HandlerEntry{event_name, handler};
+}
+
+bool FtraceParser::Parse() {
+  if (data_ == nullptr) {
+    return false;
+  }
+  const char* end = data_ + size_;
+  if (size_ > 0 && data_[0] == '<') {
+    // systrace html; parse the embedded trace-data sections.
+    static const char kMarker[] =
+        "<script class=\"trace-data\" type=\"application/text\">";
+    static const char kEndMarker[] = "</script>";
+    const char* p = data_;
+    bool found = false;
+    while (p < end) {
+      const char* begin = static_cast<const char*>(
+          memmem(p, end - p, kMarker, sizeof(kMarker) - 1));
+      if (begin == nullptr) {
+        break;
+      }
+      begin += sizeof(kMarker) - 1;
+      const char* section_end = static_cast<const char*>(
+          memmem(begin, end - begin, kEndMarker, sizeof(kEndMarker) - 1));
+      if (section_end == nullptr) {
+        section_end = end;
+      }
+      ParseRange(begin, section_end);
+      found = true;
+      p = section_end;
+    }
+    if (!found) {
+      fprintf(stderr, "no trace-data sections found in html input\n");
+      return false;
+    }
+  } else {
+    ParseRange(data_, end);
+  }
+  return event_count_ > 0;
+}
+
+void FtraceParser::ParseRange(const char* p, const char* end) {
+  while (p < end) {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (eol == nullptr) {
+      eol = end;
+    }
+    if (p < eol && *p != '#') {
+      ParseLine(p, eol);
+    }
+    p = eol + 1;
+  }
+}
+
+// Event lines look like
+//   <comm>-<pid>  (<tgid>) [<cpu>] <flags> <secs>.<usecs>: <event>: <args>
+// where the tgid and flags columns may be missing.
+void FtraceParser::ParseLine(const char* p, const char* end) {
+  // [cpu] column; searched first, as the comm can contain anything.
+  const char* cpu_start = static_cast<const char*>(
+      memmem(p, end - p, " [", 2));
+  if (cpu_start == nullptr) {
+    return;
+  }
+  const char* q = cpu_start + 2;
+  int cpu = 0;
+  if (q >= end || *q < '0' || *q > '9') {
+    return;
+  }
+  while (q < end && *q >= '0' && *q <= '9') {
+    cpu = cpu * 10 + (*q - '0');
+    ++q;
+  }
+  if (q >= end || *q != ']') {
+    return;
+  }
+  ++q;
+
+  // comm-pid, possibly followed by a (tgid) column before the cpu.
+  const char* head_end = cpu_start;
+  if (head_end > p && head_end[-1] == ')') {
+    const char* paren = head_end - 1;
+    while (paren > p && *paren != '(') {
+      --paren;
+    }
+    while (paren > p && paren[-1] == ' ') {
+      --paren;
+    }
+    head_end = paren;
+  }
+  const char* comm = p;
+  while (comm < head_end && *comm == ' ') {
+    ++comm;
+  }
+  const char* dash = head_end;
+  while (dash > comm && *dash != '-') {
+    --dash;
+  }
+  if (dash == comm) {
+    return;
+  }
+  int pid = atoi(dash + 1);
+
+  // flags column(s), then "<secs>.<usecs>:".
+  uint64_t secs = 0;
+  uint64_t usecs = 0;
+  while (q < end) {
+    while (q < end && *q == ' ') {
+      ++q;
+    }
+    const char* token = q;
+    bool is_time = *q >= '0' && *q <= '9';
+    while (q < end && *q != ' ') {
+      if (is_time && *q == ':') {
+        break;
+      }
+      ++q;
+    }
+    if (is_time && q < end && *q == ':') {
+      const char* dot = static_cast<const char*>(
+          memchr(token, '.', q - token));
+      if (dot != nullptr) {
+        secs = strtoull(token, nullptr, 10);
+        int digits = 0;
+        for (const char* d = dot + 1; d < q; ++d) {
+          usecs = usecs * 10 + (*d - '0');
+          ++digits;
+        }
+        while (digits < 6) {
+          usecs *= 10;
+          ++digits;
+        }
+        ++q;
+        break;
+      }
+    }
+    if (q >= end) {
+      return;
+    }
+  }
+  uint64_t timestamp = secs * 1000000 + usecs;
+
+  // "<event>: <args>".
+  while (q < end && *q == ' ') {
+    ++q;
+  }
+  const char* name = q;
+  while (q < end && *q != ':') {
+    ++q;
+  }
+  if (q >= end || q == name) {
+    return;
+  }
+  size_t name_len = q - name;
+  ++q;
+  while (q < end && *q == ' ') {
+    ++q;
+  }
+
+  if (event_count_ == 0 || timestamp < start_time_) {
+    start_time_ = timestamp;
+  }
+  if (timestamp > end_time_) {
+    end_time_ = timestamp;
+  }
+  ++event_count_;
+
+  auto it = handlers_.find(HashName(name, name_len));
+  if (it == handlers_.end() ||
+      it->second.name.compare(0, std::string::npos, name, name_len) != 0) {
+    return;
+  }
+  TraceEvent e;
+  e.timestamp = timestamp;
+  e.cpu = cpu;
+  e.pid = pid;
+  e.comm = comm;
+  e.comm_len = dash - comm;
+  e.args = q;
+  e.args_len = end - q;
+  it->second.handler(e);
+}
+
+}  // namespace systrace_analysis
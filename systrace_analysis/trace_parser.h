@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTRACE_ANALYSIS_TRACE_PARSER_H_
+#define SYSTRACE_ANALYSIS_TRACE_PARSER_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace systrace_analysis {
+
+// One parsed ftrace event line. The string fields point into the mmap'd
+// trace and are only valid during the handler call; use StringInterner to
+// keep a name across events.
+struct TraceEvent {
+  uint64_t timestamp;  // microseconds since trace clock start
+  int cpu;
+  int pid;
+  const char* comm;
+  size_t comm_len;
+  const char* args;  // text after "<event_name>: ", up to end of line
+  size_t args_len;
+};
+
+// Returns the integer value of [field] (like "prev_pid=") in the event args,
+// or [default_value] if the field is missing.
+int64_t GetIntField(const TraceEvent& e, const char* field,
+                    int64_t default_value);
+
+// Points [*value]/[*len] at the value of [field] in the event args, ending
+// at the next space. Returns false if the field is missing.
+bool GetStrField(const TraceEvent& e, const char* field, const char** value,
+                 size_t* len);
+
+// Stores each distinct string only once and returns pointers valid for the
+// interner's lifetime, so per-event names (like thread comms) from the
+// mmap'd trace can be kept and compared by pointer.
+class StringInterner {
+ public:
+  const char* Intern(const char* s, size_t len);
+
+ private:
+  std::unordered_set<std::string> pool_;
+};
+
+// Parses ftrace/atrace text. The input file is mmap'd and scanned in place,
+// and event lines are dispatched through a per-event handler table, so time
+// is only spent on the events an analysis subscribed to. Accepts both raw
+// atrace output and systrace html, whose embedded trace-data sections are
+// located and parsed directly.
+class FtraceParser {
+ public:
+  typedef std::function<void(const TraceEvent&)> EventHandler;
+
+  FtraceParser();
+  ~FtraceParser();
+
+  bool Open(const std::string& path);
+
+  // Register [handler] for lines of [event_name]. Only one handler per
+  // event; registering again replaces it.
+  void AddEventHandler(const std::string& event_name,
+                       const EventHandler& handler);
+
+  // Parse all event lines, calling the registered handlers.
+  bool Parse();
+
+  // Valid after Parse(). Timestamps cover all parsed event lines, including
+  // events without a handler.
+  uint64_t start_time() const { return start_time_; }
+  uint64_t end_time() const { return end_time_; }
+  uint64_t event_count() const { return event_count_; }
+
+ private:
+  void ParseRange(const char* p, const char* end);
+  void ParseLine(const char* p, const char* end);
+
+  void* map_addr_;
+  size_t map_size_;
+  const char* data_;
+  size_t size_;
+  // Dispatch table keyed by a hash of the event name; entries keep the name
+  // to reject the (unlikely) colliding event.
+  struct HandlerEntry {
+    std::string name;
+    EventHandler handler;
+  };
+  std::unordered_map<uint64_t, HandlerEntry> handlers_;
+  uint64_t start_time_;
+  uint64_t end_time_;
+  uint64_t event_count_;
+};
+
+}  // namespace systrace_analysis
+
+#endif  // SYSTRACE_ANALYSIS_TRACE_PARSER_H_
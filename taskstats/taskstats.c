@@ -21,6 +21,7 @@
  * about the reported fields.
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
 #include <netlink/attr.h>
@@ -28,8 +29,10 @@
 #include <netlink/genl/ctrl.h>
 #include <netlink/handlers.h>
 #include <netlink/msg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/cdefs.h>
 #include <time.h>
 #include <unistd.h>
@@ -42,6 +45,34 @@ struct TaskStatistics {
     struct taskstats stats;
 };
 
+/*
+ * Binary snapshot format written by --all: a SnapshotHeader followed by
+ * record_size-byte SnapshotRecords, one per task queried plus one per task
+ * that exited while the snapshot was being taken.
+ */
+#define SNAPSHOT_MAGIC 0x534b5354 /* "TSKS" */
+#define SNAPSHOT_BATCHED_REQUESTS 64
+#define MAX_CPUMASK_SIZE 32
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+};
+
+struct SnapshotRecord {
+    uint32_t pid;
+    uint32_t tgid;
+    struct taskstats stats;
+};
+
+struct SnapshotState {
+    FILE* output;
+    int outstanding;
+    unsigned records;
+};
+
 int print_receive_error(struct sockaddr_nl* address __unused,
                         struct nlmsgerr* error, void* arg __unused) {
     fprintf(stderr, "Netlink receive error: %s\n", strerror(-error->error));
@@ -67,12 +98,12 @@ void parse_aggregate_task_stats(struct nlattr* attr, int attr_size,
     }
 }
 
-int parse_task_stats(struct nl_msg* msg, void* arg) {
-    struct TaskStatistics* stats = (struct TaskStatistics*)arg;
+void parse_task_stats_reply(struct nl_msg* msg, struct TaskStatistics* stats) {
     struct genlmsghdr* gnlh = (struct genlmsghdr*)nlmsg_data(nlmsg_hdr(msg));
     struct nlattr* attr = genlmsg_attrdata(gnlh, 0);
     int remaining = genlmsg_attrlen(gnlh, 0);
 
+    memset(stats, 0, sizeof(*stats));
     nla_for_each_attr(attr, attr, remaining, remaining) {
         switch (attr->nla_type) {
             case TASKSTATS_TYPE_AGGR_PID:
@@ -84,14 +115,15 @@ int parse_task_stats(struct nl_msg* msg, void* arg) {
                 break;
         }
     }
-    return NL_STOP;
 }
 
-int query_task_stats(struct nl_sock* netlink_socket, int family_id,
-                     int command_type, int parameter,
-                     struct TaskStatistics* stats) {
-    memset(stats, 0, sizeof(*stats));
+int parse_task_stats(struct nl_msg* msg, void* arg) {
+    parse_task_stats_reply(msg, (struct TaskStatistics*)arg);
+    return NL_STOP;
+}
 
+int send_stats_request(struct nl_sock* netlink_socket, int family_id,
+                       int command_type, int parameter) {
     struct nl_msg* message = nlmsg_alloc();
     genlmsg_put(message, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, 0,
 		TASKSTATS_CMD_GET, TASKSTATS_VERSION);
@@ -99,6 +131,16 @@ int query_task_stats(struct nl_sock* netlink_socket, int family_id,
 
     int result = nl_send_auto_complete(netlink_socket, message);
     nlmsg_free(message);
+    return result;
+}
+
+int query_task_stats(struct nl_sock* netlink_socket, int family_id,
+                     int command_type, int parameter,
+                     struct TaskStatistics* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    int result = send_stats_request(netlink_socket, family_id, command_type,
+                                    parameter);
     if (result < 0) {
         return result;
     }
@@ -115,6 +157,161 @@ int query_task_stats(struct nl_sock* netlink_socket, int family_id,
     return stats->pid || stats->tgid;
 }
 
+/*
+ * NL_CB_VALID callback for snapshot mode: append one binary record per
+ * reply (or exit record) to the snapshot file.
+ */
+int write_snapshot_record(struct nl_msg* msg, void* arg) {
+    struct SnapshotState* state = (struct SnapshotState*)arg;
+    struct TaskStatistics stats;
+
+    parse_task_stats_reply(msg, &stats);
+    if (stats.pid || stats.tgid) {
+        struct SnapshotRecord record;
+        record.pid = stats.pid;
+        record.tgid = stats.tgid;
+        record.stats = stats.stats;
+        fwrite(&record, sizeof(record), 1, state->output);
+        state->records++;
+    }
+    if (state->outstanding > 0) {
+        state->outstanding--;
+    }
+    return NL_OK;
+}
+
+/*
+ * Error callback for snapshot mode. Tasks routinely exit between the /proc
+ * scan and the query, so ESRCH is expected and silently skipped.
+ */
+int skip_request_error(struct sockaddr_nl* address __unused,
+                       struct nlmsgerr* error, void* arg) {
+    struct SnapshotState* state = (struct SnapshotState*)arg;
+    if (error->error != -ESRCH) {
+        fprintf(stderr, "Netlink receive error: %s\n",
+                strerror(-error->error));
+    }
+    if (state->outstanding > 0) {
+        state->outstanding--;
+    }
+    return NL_SKIP;
+}
+
+int set_exit_listener_cpumask(struct nl_sock* netlink_socket, int family_id,
+                              int attribute) {
+    char cpumask[MAX_CPUMASK_SIZE];
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (cpus > 1) {
+        snprintf(cpumask, sizeof(cpumask), "0-%ld", cpus - 1);
+    } else {
+        snprintf(cpumask, sizeof(cpumask), "0");
+    }
+
+    struct nl_msg* message = nlmsg_alloc();
+    genlmsg_put(message, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, 0,
+		TASKSTATS_CMD_GET, TASKSTATS_VERSION);
+    nla_put_string(message, attribute, cpumask);
+
+    int result = nl_send_auto_complete(netlink_socket, message);
+    nlmsg_free(message);
+    return result;
+}
+
+void receive_batched_replies(struct nl_sock* netlink_socket,
+                             struct nl_cb* callbacks,
+                             struct SnapshotState* state) {
+    while (state->outstanding > 0) {
+        if (nl_recvmsgs(netlink_socket, callbacks) < 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * Walk /proc and query the delay accounting stats of every thread in the
+ * system, batching SNAPSHOT_BATCHED_REQUESTS pid queries per netlink
+ * round trip. Exit records streamed to the cpumask listener socket while
+ * the scan runs are appended afterwards, so short-lived tasks that die
+ * mid-scan still show up in the snapshot.
+ */
+int snapshot_all_tasks(struct nl_sock* query_socket,
+                       struct nl_sock* listener_socket, int family_id,
+                       FILE* output) {
+    struct SnapshotState query_state = {output, 0, 0};
+    struct SnapshotState exit_state = {output, 0, 0};
+
+    struct SnapshotHeader header = {SNAPSHOT_MAGIC, TASKSTATS_VERSION,
+                                    sizeof(struct SnapshotRecord), 0};
+    fwrite(&header, sizeof(header), 1, output);
+
+    struct nl_cb* query_callbacks = nl_cb_get(nl_cb_alloc(NL_CB_CUSTOM));
+    nl_cb_set(query_callbacks, NL_CB_VALID, NL_CB_CUSTOM,
+              &write_snapshot_record, &query_state);
+    nl_cb_err(query_callbacks, NL_CB_CUSTOM, &skip_request_error,
+              &query_state);
+
+    struct nl_cb* exit_callbacks = nl_cb_get(nl_cb_alloc(NL_CB_CUSTOM));
+    nl_cb_set(exit_callbacks, NL_CB_VALID, NL_CB_CUSTOM,
+              &write_snapshot_record, &exit_state);
+    nl_cb_err(exit_callbacks, NL_CB_CUSTOM, &skip_request_error, &exit_state);
+
+    DIR* proc = opendir("/proc");
+    if (!proc) {
+        fprintf(stderr, "Could not open /proc\n");
+        nl_cb_put(exit_callbacks);
+        nl_cb_put(query_callbacks);
+        return -1;
+    }
+
+    struct dirent* process_entry;
+    while ((process_entry = readdir(proc))) {
+        int pid = atoi(process_entry->d_name);
+        if (pid <= 0) {
+            continue;
+        }
+
+        char task_path[32];
+        snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
+        DIR* task_dir = opendir(task_path);
+        if (!task_dir) {
+            continue;  /* process exited during the scan */
+        }
+
+        struct dirent* task_entry;
+        while ((task_entry = readdir(task_dir))) {
+            int tid = atoi(task_entry->d_name);
+            if (tid <= 0) {
+                continue;
+            }
+            if (send_stats_request(query_socket, family_id,
+                                   TASKSTATS_CMD_ATTR_PID, tid) < 0) {
+                continue;
+            }
+            query_state.outstanding++;
+            if (query_state.outstanding >= SNAPSHOT_BATCHED_REQUESTS) {
+                receive_batched_replies(query_socket, query_callbacks,
+                                        &query_state);
+            }
+        }
+        closedir(task_dir);
+    }
+    closedir(proc);
+    receive_batched_replies(query_socket, query_callbacks, &query_state);
+
+    /* Drain the exit records that accumulated during the scan. */
+    nl_socket_set_nonblocking(listener_socket);
+    while (nl_recvmsgs(listener_socket, exit_callbacks) >= 0)
+        ;
+
+    nl_cb_put(exit_callbacks);
+    nl_cb_put(query_callbacks);
+
+    fprintf(stderr, "Wrote %u task records and %u exit records\n",
+            query_state.records, exit_state.records);
+    return 0;
+}
+
 double average_ms(unsigned long long total, unsigned long long count) {
     if (!count) {
         return 0;
@@ -246,9 +443,12 @@ void print_usage() {
          "  --pid PID     Print stats for the process id PID\n"
          "  --tgid TGID   Print stats for the thread group id TGID\n"
          "  --raw         Print raw numbers instead of human readable units\n"
+         "  --all FILE    Write a binary snapshot of every task's stats to\n"
+         "                FILE ('-' for stdout), including tasks that exit\n"
+         "                while the snapshot is taken\n"
          "\n"
-         "Either PID or TGID must be specified. For more documentation about "
-         "the reported fields, see\n"
+         "Either PID, TGID or --all must be specified. For more documentation "
+         "about the reported fields, see\n"
          "https://www.kernel.org/doc/Documentation/accounting/"
          "taskstats-struct.txt\n");
 }
@@ -257,12 +457,16 @@ int main(int argc, char** argv) {
     int command_type = 0;
     int pid = 0;
     int human_readable = 1;
+    const char* snapshot_path = NULL;
+    struct nl_sock* listener_socket = NULL;
+    FILE* snapshot_file = NULL;
 
     const struct option long_options[] = {
         {"help", no_argument, 0, 0},
         {"pid", required_argument, 0, 0},
         {"tgid", required_argument, 0, 0},
         {"raw", no_argument, 0, 0},
+        {"all", required_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -288,13 +492,16 @@ int main(int argc, char** argv) {
             case 3:
                 human_readable = 0;
                 break;
+            case 4:
+                snapshot_path = optarg;
+                break;
             default:
                 break;
         };
     }
 
-    if (!pid) {
-        printf("Either PID or TGID must be specified\n");
+    if (!pid && !snapshot_path) {
+        printf("Either PID, TGID or --all must be specified\n");
         return EXIT_FAILURE;
     }
 
@@ -316,6 +523,67 @@ int main(int argc, char** argv) {
                "(does your kernel support taskstats?)");
         goto error;
     }
+
+    if (snapshot_path) {
+        /*
+         * Snapshot mode pipelines requests and matches replies by the pid
+         * echoed in the reply, so sequence checking and acks must be off.
+         * This has to happen after genl_ctrl_resolve(), which relies on
+         * both.
+         */
+        nl_socket_disable_auto_ack(netlink_socket);
+        nl_socket_disable_seq_check(netlink_socket);
+        nl_socket_set_buffer_size(netlink_socket, 1024 * 1024, 0);
+
+        if (strcmp(snapshot_path, "-") == 0) {
+            snapshot_file = stdout;
+        } else {
+            snapshot_file = fopen(snapshot_path, "we");
+            if (!snapshot_file) {
+                fprintf(stderr, "Could not open %s\n", snapshot_path);
+                goto error;
+            }
+        }
+
+        /*
+         * Exit records are delivered to whichever socket registered the
+         * cpumask, so use a dedicated listener socket for them.
+         */
+        listener_socket = nl_socket_alloc();
+        if (!listener_socket) {
+            fprintf(stderr, "Unable to allocate netlink socket\n");
+            goto error;
+        }
+        nl_socket_disable_auto_ack(listener_socket);
+        nl_socket_disable_seq_check(listener_socket);
+        nl_socket_set_buffer_size(listener_socket, 1024 * 1024, 0);
+        ret = genl_connect(listener_socket);
+        if (ret < 0) {
+            nl_perror(ret, "Unable to open netlink socket (are you root?)");
+            goto error;
+        }
+        ret = set_exit_listener_cpumask(listener_socket, family_id,
+                                        TASKSTATS_CMD_ATTR_REGISTER_CPUMASK);
+        if (ret < 0) {
+            nl_perror(ret, "Failed to register for exit records");
+            goto error;
+        }
+
+        ret = snapshot_all_tasks(netlink_socket, listener_socket, family_id,
+                                 snapshot_file);
+        set_exit_listener_cpumask(listener_socket, family_id,
+                                  TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK);
+        if (ret < 0) {
+            goto error;
+        }
+        if (snapshot_file != stdout) {
+            fclose(snapshot_file);
+        }
+        nl_socket_free(listener_socket);
+        nl_socket_free(netlink_socket);
+        return EXIT_SUCCESS;
+    }
+
     struct TaskStatistics stats;
     ret = query_task_stats(netlink_socket, family_id, command_type, pid, &stats);
     if (ret < 0) {
@@ -328,6 +596,12 @@ int main(int argc, char** argv) {
     return EXIT_SUCCESS;
 
 error:
+    if (snapshot_file && snapshot_file != stdout) {
+        fclose(snapshot_file);
+    }
+    if (listener_socket) {
+        nl_socket_free(listener_socket);
+    }
     if (netlink_socket) {
         nl_socket_free(netlink_socket);
     }
@@ -21,6 +21,8 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <gtest/gtest.h>
 #include <linux/ioctl.h>
 #include <sound/asound.h>
@@ -160,6 +162,200 @@ int getPcmParams(unsigned int i)
     return 0;
 }
 
+/*
+ * Loopback round-trip latency benchmark.
+ *
+ * Plays a full-scale impulse on a playback PCM and waits for it to come
+ * back on a capture PCM that is wired back to it (an external loopback
+ * cable, or the aloop card). Both streams use mmap access so the data
+ * path matches latency-sensitive clients, and the arrival time of the
+ * impulse is derived from the capture stream's hardware timestamp
+ * (pcm_get_htimestamp) instead of from when the reader woke up.
+ *
+ * The PCMs to use are named "card,device" through the environment:
+ *   PCMTEST_LOOPBACK_OUT=0,0 PCMTEST_LOOPBACK_IN=0,1 pcmtest
+ * The benchmark is skipped when they are not set, since it needs a
+ * physical or virtual loopback.
+ */
+
+#define LOOPBACK_RATE       48000
+#define LOOPBACK_CHANNELS   2
+#define LOOPBACK_TRIPS      10
+/* Samples smaller than this are treated as noise, not the impulse */
+#define IMPULSE_THRESHOLD   0x2000
+
+static bool parsePcmSpec(const char *spec, unsigned int *card,
+                         unsigned int *device)
+{
+    return spec != NULL && sscanf(spec, "%u,%u", card, device) == 2;
+}
+
+/*
+ * One impulse round trip at the given period size. The PCMs are opened
+ * fresh so the playback buffer is empty when the impulse is queued and
+ * no stale capture data can be mistaken for it. Returns false if the
+ * impulse never arrived.
+ */
+static bool measureTrip(unsigned int out_card, unsigned int out_device,
+                        unsigned int in_card, unsigned int in_device,
+                        unsigned int period_size, double *latency_msecs)
+{
+    struct pcm_config config;
+    struct pcm *out, *in;
+    bool found = false;
+
+    memset(&config, 0, sizeof(config));
+    config.channels = LOOPBACK_CHANNELS;
+    config.rate = LOOPBACK_RATE;
+    config.period_size = period_size;
+    config.period_count = 4;
+    config.format = PCM_FORMAT_S16_LE;
+
+    in = pcm_open(in_card, in_device, PCM_IN | PCM_MMAP | PCM_MONOTONIC,
+                  &config);
+    if (!in || !pcm_is_ready(in)) {
+        if (in)
+            pcm_close(in);
+        return false;
+    }
+    out = pcm_open(out_card, out_device, PCM_OUT | PCM_MMAP | PCM_MONOTONIC,
+                   &config);
+    if (!out || !pcm_is_ready(out)) {
+        if (out)
+            pcm_close(out);
+        pcm_close(in);
+        return false;
+    }
+
+    size_t period_bytes =
+        pcm_frames_to_bytes(out, period_size);
+    short *impulse = (short *)calloc(1, period_bytes);
+    short *silence = (short *)calloc(1, period_bytes);
+    short *rbuf = (short *)malloc(period_bytes);
+    if (!impulse || !silence || !rbuf) {
+        free(impulse);
+        free(silence);
+        free(rbuf);
+        pcm_close(out);
+        pcm_close(in);
+        return false;
+    }
+    for (unsigned int c = 0; c < LOOPBACK_CHANNELS; c++)
+        impulse[c] = 0x7fff;
+
+    /* Get the capture side running before the impulse is queued */
+    if (pcm_start(in) < 0) {
+        free(impulse);
+        free(silence);
+        free(rbuf);
+        pcm_close(out);
+        pcm_close(in);
+        return false;
+    }
+
+    struct timespec sent;
+    clock_gettime(CLOCK_MONOTONIC, &sent);
+    pcm_mmap_write(out, impulse, period_bytes);
+
+    /* Give up after about a second of captured audio */
+    unsigned int max_chunks = LOOPBACK_RATE / period_size + 1;
+    for (unsigned int chunk = 0; chunk < max_chunks && !found; chunk++) {
+        if (pcm_mmap_read(in, rbuf, period_bytes) < 0)
+            break;
+        /* Keep the playback side fed so it doesn't underrun */
+        pcm_mmap_write(out, silence, period_bytes);
+
+        for (unsigned int f = 0; f < period_size; f++) {
+            if (abs(rbuf[f * LOOPBACK_CHANNELS]) < IMPULSE_THRESHOLD)
+                continue;
+
+            unsigned int avail;
+            struct timespec tstamp;
+            if (pcm_get_htimestamp(in, &avail, &tstamp) < 0)
+                break;
+            /*
+             * tstamp matches the newest captured frame. The impulse
+             * frame is (frames left in this chunk) + (frames still in
+             * the driver buffer) older than that.
+             */
+            double age_msecs = (double)((period_size - f) + avail) *
+                1000.0 / LOOPBACK_RATE;
+            double trip_msecs =
+                (tstamp.tv_sec - sent.tv_sec) * 1000.0 +
+                (tstamp.tv_nsec - sent.tv_nsec) / 1000000.0 - age_msecs;
+            *latency_msecs = trip_msecs;
+            found = true;
+            break;
+        }
+    }
+
+    free(impulse);
+    free(silence);
+    free(rbuf);
+    pcm_close(out);
+    pcm_close(in);
+    return found;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double diff = *(const double *)a - *(const double *)b;
+    return (diff > 0) - (diff < 0);
+}
+
+TEST(pcmtest, LoopbackLatency) {
+    unsigned int out_card, out_device, in_card, in_device;
+    static const unsigned int period_sizes[] = { 128, 256, 512, 1024 };
+
+    const char *out_spec = getenv("PCMTEST_LOOPBACK_OUT");
+    const char *in_spec = getenv("PCMTEST_LOOPBACK_IN");
+    if (out_spec == NULL || in_spec == NULL) {
+        testPrintI(" LoopbackLatency: PCMTEST_LOOPBACK_OUT/IN not set,"
+                   " skipping");
+        return;
+    }
+    ASSERT_TRUE(parsePcmSpec(out_spec, &out_card, &out_device));
+    ASSERT_TRUE(parsePcmSpec(in_spec, &in_card, &in_device));
+
+    for (unsigned int s = 0; s < sizeof(period_sizes)/sizeof(unsigned int);
+         s++) {
+        unsigned int period_size = period_sizes[s];
+        double latencies[LOOPBACK_TRIPS];
+        unsigned int trips = 0;
+        double sum = 0;
+
+        /* Warm-up trip, discarded: the first open of a path can pay
+           one-time codec/DAPM costs */
+        double latency;
+        if (!measureTrip(out_card, out_device, in_card, in_device,
+                         period_size, &latency)) {
+            testPrintI(" LoopbackLatency: period %4u not supported or no"
+                       " signal, skipping", period_size);
+            continue;
+        }
+
+        for (unsigned int t = 0; t < LOOPBACK_TRIPS; t++) {
+            if (measureTrip(out_card, out_device, in_card, in_device,
+                            period_size, &latency)) {
+                latencies[trips++] = latency;
+                sum += latency;
+            }
+        }
+        EXPECT_GT(trips, 0U) << "All trips lost at period size "
+                             << period_size;
+        if (trips == 0)
+            continue;
+
+        qsort(latencies, trips, sizeof(double), cmpDouble);
+        testPrintI(" LoopbackLatency: period %4u: trips %u/%u min %0.2fms"
+                   " p50 %0.2fms p95 %0.2fms max %0.2fms avg %0.2fms",
+                   period_size, trips, LOOPBACK_TRIPS,
+                   latencies[0], latencies[trips / 2],
+                   latencies[(trips * 95) / 100], latencies[trips - 1],
+                   sum / trips);
+    }
+}
+
 TEST(pcmtest, CheckAudioDir) {
     pcms = getPcmNodes();
     ASSERT_GT(pcms, 0U);
@@ -192,6 +192,28 @@ uint32_t Profiler::resetEvents(uint32_t eventMask) noexcept {
             }
         }
 #endif
+
+        if (eventMask & EV_ITLB_REFS) {
+            pe.type = PERF_TYPE_HW_CACHE;
+            pe.config = PERF_COUNT_HW_CACHE_ITLB |
+                (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS<<16);
+            mCountersFd[ITLB_REFS] = perf_event_open(&pe, 0, -1, groupFd, 0);
+            if (mCountersFd[ITLB_REFS] > 0) {
+                mIds[ITLB_REFS] = count++;
+                mEnabledEvents |= EV_ITLB_REFS;
+            }
+        }
+
+        if (eventMask & EV_ITLB_MISSES) {
+            pe.type = PERF_TYPE_HW_CACHE;
+            pe.config = PERF_COUNT_HW_CACHE_ITLB |
+                (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+            mCountersFd[ITLB_MISSES] = perf_event_open(&pe, 0, -1, groupFd, 0);
+            if (mCountersFd[ITLB_MISSES] > 0) {
+                mIds[ITLB_MISSES] = count++;
+                mEnabledEvents |= EV_ITLB_MISSES;
+            }
+        }
     }
 #endif // __linux__
     return mEnabledEvents;
@@ -41,6 +41,8 @@ class Profiler {
         BRANCH_MISSES   = 5,
         ICACHE_REFS     = 6,
         ICACHE_MISSES   = 7,
+        ITLB_REFS       = 8,
+        ITLB_MISSES     = 9,
 
         // Must be last one
         EVENT_COUNT
@@ -56,10 +58,13 @@ public:
         EV_BPU_MISSES = 1 << BRANCH_MISSES,
         EV_L1I_REFS   = 1 << ICACHE_REFS,
         EV_L1I_MISSES = 1 << ICACHE_MISSES,
+        EV_ITLB_REFS  = 1 << ITLB_REFS,
+        EV_ITLB_MISSES = 1 << ITLB_MISSES,
         // helpers
         EV_L1D_RATES = EV_L1D_REFS | EV_L1D_MISSES,
         EV_L1I_RATES = EV_L1I_REFS | EV_L1I_MISSES,
         EV_BPU_RATES = EV_BPU_REFS | EV_BPU_MISSES,
+        EV_ITLB_RATES = EV_ITLB_REFS | EV_ITLB_MISSES,
     };
 
     static Profiler& get() noexcept;
@@ -108,6 +113,8 @@ public:
         uint64_t getL1IMisses() const           { return counters[ICACHE_MISSES].value; }
         uint64_t getBranchInstructions() const  { return counters[BRANCHES].value; }
         uint64_t getBranchMisses() const        { return counters[BRANCH_MISSES].value; }
+        uint64_t getITLBReferences() const      { return counters[ITLB_REFS].value; }
+        uint64_t getITLBMisses() const          { return counters[ITLB_MISSES].value; }
 
         std::chrono::duration<uint64_t, std::nano> getWallTime() const {
             return std::chrono::duration<uint64_t, std::nano>(time_enabled);
@@ -215,6 +222,10 @@ public:
         return (mCountersFd[ICACHE_REFS] >= 0) && (mCountersFd[ICACHE_MISSES] >= 0);
     }
 
+    bool hasITLBRates() const noexcept {
+        return (mCountersFd[ITLB_REFS] >= 0) && (mCountersFd[ITLB_MISSES] >= 0);
+    }
+
 private:
     Profiler() noexcept;
     ~Profiler() noexcept;
@@ -1,10 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <getopt.h>
 
 #include <thread>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 #include <sched.h>
 
@@ -17,10 +21,189 @@ static constexpr size_t CACHE_LINE_SIZE = 64;
 static constexpr size_t MAX_ITERATIONS_COUNT = MAX_CODE_SIZE / CACHE_LINE_SIZE;
 static constexpr size_t REPETITIONS = 0x800000L;
 
+// Sweep mode defaults: footprints from 16 KiB to 8 MiB, roughly this
+// many bytes of generated code executed per footprint measurement.
+static constexpr size_t SWEEP_MIN_KB = 16;
+static constexpr size_t SWEEP_MAX_KB = 8*1024;
+static constexpr size_t SWEEP_BYTES_PER_STEP = 128*1024*1024;
+
 
 using namespace utils;
 
 static cpu_set_t g_cpu_set;
+static bool g_sweep = false;
+static bool g_random_pattern = false;
+static size_t g_sweep_min_kb = SWEEP_MIN_KB;
+static size_t g_sweep_max_kb = SWEEP_MAX_KB;
+
+// ----------------------------------------------------------------------------
+// Footprint sweep: generated function chains.
+//
+// Each chain is built out of cache-line sized code blocks that end in a
+// direct unconditional branch to the next block (the last block returns).
+// Direct branches are statically predictable, so the branch predictor is
+// effectively taken out of the measurement and the curves show icache and
+// iTLB behavior; the branch MPKI column is reported so that isolation can
+// be verified. The sequential pattern lays the blocks out in address
+// order (best case for the prefetcher), the random pattern visits every
+// block once in a random order (defeats prefetch, stresses the iTLB).
+// ----------------------------------------------------------------------------
+
+// Fills in one code block ending in a branch to 'target', or a return if
+// 'target' is SIZE_MAX.
+static void emitBlock(uint8_t* base, size_t block, size_t target) {
+    uint8_t* code = base + block * CACHE_LINE_SIZE;
+#if defined(__aarch64__) || defined(__arm__)
+    uint32_t* insn = reinterpret_cast<uint32_t*>(code);
+    size_t const numInsns = CACHE_LINE_SIZE / sizeof(uint32_t);
+#if defined(__aarch64__)
+    uint32_t const nop = 0xd503201f;
+    uint32_t const ret = 0xd65f03c0;
+#else
+    uint32_t const nop = 0xe1a00000;    // mov r0, r0
+    uint32_t const ret = 0xe12fff1e;    // bx lr
+#endif
+    for (size_t i = 0; i < numInsns - 1; i++) {
+        insn[i] = nop;
+    }
+    if (target == SIZE_MAX) {
+        insn[numInsns - 1] = ret;
+    } else {
+        uint8_t* branch = code + CACHE_LINE_SIZE - sizeof(uint32_t);
+        intptr_t offset = (base + target * CACHE_LINE_SIZE) - branch;
+#if defined(__aarch64__)
+        insn[numInsns - 1] = 0x14000000 | ((offset >> 2) & 0x03ffffff);
+#else
+        // The arm pc is 8 bytes ahead of the executing instruction.
+        insn[numInsns - 1] = 0xea000000 | (((offset - 8) >> 2) & 0x00ffffff);
+#endif
+    }
+#elif defined(__i386__) || defined(__x86_64__)
+    for (size_t i = 0; i < CACHE_LINE_SIZE - 5; i++) {
+        code[i] = 0x90;                 // nop
+    }
+    if (target == SIZE_MAX) {
+        code[CACHE_LINE_SIZE - 5] = 0xc3;    // ret
+    } else {
+        uint8_t* branch = code + CACHE_LINE_SIZE - 5;
+        int32_t offset = int32_t((base + target * CACHE_LINE_SIZE) - (branch + 5));
+        branch[0] = 0xe9;               // jmp rel32
+        memcpy(&branch[1], &offset, sizeof(offset));
+    }
+#else
+#error "no code emitter for this architecture"
+#endif
+}
+
+// Builds an executable chain of numBlocks blocks and returns its entry
+// point, or nullptr on failure.
+static void (*buildChain(size_t numBlocks, bool randomPattern))() {
+    size_t size = numBlocks * CACHE_LINE_SIZE;
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap of chain failed");
+        return nullptr;
+    }
+    uint8_t* base = static_cast<uint8_t*>(mem);
+
+    // next[i] is the block branched to from block i. Every block is
+    // visited exactly once; the block that would close the cycle back to
+    // the entry returns instead.
+    std::vector<size_t> next(numBlocks);
+    if (randomPattern) {
+        // Sattolo's algorithm: a uniformly random single cycle.
+        std::vector<size_t> perm(numBlocks);
+        for (size_t i = 0; i < numBlocks; i++) {
+            perm[i] = i;
+        }
+        srand(1);
+        for (size_t i = numBlocks - 1; i > 0; i--) {
+            size_t j = size_t(rand()) % i;
+            std::swap(perm[i], perm[j]);
+        }
+        for (size_t i = 0; i < numBlocks; i++) {
+            next[perm[i]] = perm[(i + 1) % numBlocks];
+        }
+    } else {
+        for (size_t i = 0; i < numBlocks; i++) {
+            next[i] = (i + 1) % numBlocks;
+        }
+    }
+
+    for (size_t i = 0; i < numBlocks; i++) {
+        emitBlock(base, i, next[i] == 0 ? SIZE_MAX : next[i]);
+    }
+
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        perror("mprotect of chain failed");
+        munmap(mem, size);
+        return nullptr;
+    }
+    __builtin___clear_cache(reinterpret_cast<char*>(base),
+            reinterpret_cast<char*>(base) + size);
+
+    return reinterpret_cast<void (*)()>(base);
+}
+
+static int runFootprintSweep() {
+    Profiler& profiler = Profiler::get();
+    profiler.resetEvents(Profiler::EV_CPU_CYCLES | Profiler::EV_L1I_RATES |
+            Profiler::EV_BPU_RATES | Profiler::EV_ITLB_RATES);
+
+    if (!profiler.isValid()) {
+        fprintf(stderr, "performance counters not enabled. try \"setprop security.perf_harden 0\"\n");
+        return 0;
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    printf("pattern: %s\n", g_random_pattern ? "random" : "sequential");
+    printf("[KiB]\t[cyc/line]\t[L1I MPKI]\t[iTLB MPKI]\t[BP MPKI]\t[ns/line]\n");
+
+    Profiler::Counters counters;
+
+    for (size_t kb = g_sweep_min_kb; kb <= g_sweep_max_kb; kb *= 2) {
+        size_t numBlocks = kb * 1024 / CACHE_LINE_SIZE;
+        void (*chain)() = buildChain(numBlocks, g_random_pattern);
+        if (chain == nullptr) {
+            return -1;
+        }
+
+        size_t iterations = SWEEP_BYTES_PER_STEP / (kb * 1024);
+        if (iterations == 0) {
+            iterations = 1;
+        }
+        double linesExecuted = double(numBlocks) * double(iterations);
+
+        // Warm up the page tables and let the footprint reach steady
+        // state before counting.
+        chain();
+
+        profiler.reset();
+        auto now = std::chrono::steady_clock::now();
+        profiler.start();
+        for (size_t i = 0; i < iterations; i++) {
+            chain();
+        }
+        profiler.stop();
+        auto duration = std::chrono::steady_clock::now() - now;
+
+        profiler.readCounters(&counters);
+
+        std::cout << kb << "\t"
+            << counters.getCpuCycles()/linesExecuted << "\t\t"
+            << counters.getMPKI(counters.getL1IMisses()) << "\t\t"
+            << counters.getMPKI(counters.getITLBMisses()) << "\t\t"
+            << counters.getMPKI(counters.getBranchMisses()) << "\t\t"
+            << duration.count()/linesExecuted << "\t"
+            << std::endl;
+
+        munmap(reinterpret_cast<void*>(chain), numBlocks * CACHE_LINE_SIZE);
+    }
+
+    return 0;
+}
 
 static void printUsage(char* name) {
     std::string exec_name(name);
@@ -35,6 +218,17 @@ static void printUsage(char* name) {
             "       print this message\n\n"
             "   --affinity=N, -a N\n"
             "       Specify which CPU the test should run on.\n\n"
+            "   --sweep, -s\n"
+            "       Sweep generated code footprints instead of the fixed\n"
+            "       128 KiB test, reporting icache, iTLB and branch miss\n"
+            "       rates per footprint.\n\n"
+            "   --random, -r\n"
+            "       Visit the generated blocks in random order instead of\n"
+            "       sequentially (sweep mode only).\n\n"
+            "   --min=KB, -m KB\n"
+            "       Smallest footprint to sweep, in KiB (default 16).\n\n"
+            "   --max=KB, -M KB\n"
+            "       Largest footprint to sweep, in KiB (default 8192).\n\n"
     );
     const std::string from("ICACHE");
     for (size_t pos = usage.find(from); pos != std::string::npos; pos = usage.find(from, pos)) {
@@ -44,10 +238,14 @@ static void printUsage(char* name) {
 }
 
 static int handleCommandLineArgments(int argc, char* argv[]) {
-    static constexpr const char* OPTSTR = "ha:";
+    static constexpr const char* OPTSTR = "ha:srm:M:";
     static const struct option OPTIONS[] = {
             { "help",                 no_argument, 0, 'h' },
             { "affinity",       required_argument, 0, 'a' },
+            { "sweep",                no_argument, 0, 's' },
+            { "random",               no_argument, 0, 'r' },
+            { "min",            required_argument, 0, 'm' },
+            { "max",            required_argument, 0, 'M' },
             { 0, 0, 0, 0 }  // termination of the option list
     };
     int opt;
@@ -60,7 +258,23 @@ static int handleCommandLineArgments(int argc, char* argv[]) {
                 printUsage(argv[0]);
                 exit(0);
                 break;
-            case 'a':
+            case 's':
+                g_sweep = true;
+                break;
+            case 'r':
+                g_random_pattern = true;
+                break;
+            case 'm':
+                g_sweep_min_kb = std::stoi(arg);
+                if (g_sweep_min_kb == 0) {
+                    std::cerr << "KB must be > 0" << std::endl;
+                    exit(0);
+                }
+                break;
+            case 'M':
+                g_sweep_max_kb = std::stoi(arg);
+                break;
+            case 'a': {
                 size_t cpu = std::stoi(arg);
                 if (cpu < std::thread::hardware_concurrency()) {
                     CPU_SET(cpu, &g_cpu_set);
@@ -69,6 +283,7 @@ static int handleCommandLineArgments(int argc, char* argv[]) {
                     exit(0);
                 }
                 break;
+            }
         }
     }
     return optind;
@@ -84,6 +299,14 @@ int main(int argc, char* argv[]) {
         sched_setaffinity(gettid(), sizeof(g_cpu_set), &g_cpu_set);
     }
 
+    if (g_sweep) {
+        if (g_sweep_max_kb < g_sweep_min_kb) {
+            std::cerr << "--max must be >= --min" << std::endl;
+            return 0;
+        }
+        return runFootprintSweep();
+    }
+
     Profiler& profiler = Profiler::get();
     profiler.resetEvents(Profiler::EV_CPU_CYCLES | Profiler::EV_L1I_RATES);
 
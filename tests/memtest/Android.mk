@@ -10,6 +10,7 @@ LOCAL_SRC_FILES := \
     fptest.cpp \
     thumb.cpp \
     bandwidth.cpp \
+    falsesharing.cpp \
 
 LOCAL_MODULE := memtest
 LOCAL_MODULE_TAGS := debug
@@ -18,7 +19,11 @@ LOCAL_CFLAGS += \
     -Wall \
     -Werror \
 
-LOCAL_MULTILIB := 32
+# The 64-bit build gets the ldp/stp, NEON q register and SVE kernels;
+# the 32-bit build keeps the original arm kernels.
+LOCAL_MULTILIB := both
+LOCAL_MODULE_STEM_32 := $(LOCAL_MODULE)32
+LOCAL_MODULE_STEM_64 := $(LOCAL_MODULE)64
 
 LOCAL_SANITIZE := never
 
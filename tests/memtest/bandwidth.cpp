@@ -97,7 +97,12 @@ BandwidthBenchmark *createBandwidthBenchmarkObject(arg_t values) {
     if (values.count("size") > 0) {
         size = values["size"].int_value;
     }
-    if (strcmp(name, "copy_ldrd_strd") == 0) {
+    if (strcmp(name, "memcpy") == 0) {
+        bench = new MemcpyBenchmark();
+    } else if (strcmp(name, "memset") == 0) {
+        bench = new MemsetBenchmark();
+#if defined(__arm__)
+    } else if (strcmp(name, "copy_ldrd_strd") == 0) {
         bench = new CopyLdrdStrdBenchmark();
     } else if (strcmp(name, "copy_ldmia_stmia") == 0) {
         bench = new CopyLdmiaStmiaBenchmark();
@@ -107,8 +112,6 @@ BandwidthBenchmark *createBandwidthBenchmarkObject(arg_t values) {
         bench = new CopyVldrVstrBenchmark();
     } else if (strcmp(name, "copy_vldmia_vstmia") == 0) {
         bench = new CopyVldmiaVstmiaBenchmark();
-    } else if (strcmp(name, "memcpy") == 0) {
-        bench = new MemcpyBenchmark();
     } else if (strcmp(name, "write_strd") == 0) {
         bench = new WriteStrdBenchmark();
     } else if (strcmp(name, "write_stmia") == 0) {
@@ -119,8 +122,6 @@ BandwidthBenchmark *createBandwidthBenchmarkObject(arg_t values) {
         bench = new WriteVstrBenchmark();
     } else if (strcmp(name, "write_vstmia") == 0) {
         bench = new WriteVstmiaBenchmark();
-    } else if (strcmp(name, "memset") == 0) {
-        bench = new MemsetBenchmark();
     } else if (strcmp(name, "read_ldrd") == 0) {
         bench = new ReadLdrdBenchmark();
     } else if (strcmp(name, "read_ldmia") == 0) {
@@ -131,6 +132,30 @@ BandwidthBenchmark *createBandwidthBenchmarkObject(arg_t values) {
         bench = new ReadVldrBenchmark();
     } else if (strcmp(name, "read_vldmia") == 0) {
         bench = new ReadVldmiaBenchmark();
+#elif defined(__aarch64__)
+    } else if (strcmp(name, "copy_ldp_stp") == 0) {
+        bench = new CopyLdpStpBenchmark();
+    } else if (strcmp(name, "copy_ldp_stp_q") == 0) {
+        bench = new CopyLdpStpQBenchmark();
+    } else if (strcmp(name, "copy_ld1_st1") == 0) {
+        bench = new CopyLd1St1Benchmark();
+    } else if (strcmp(name, "write_stp") == 0) {
+        bench = new WriteStpBenchmark();
+    } else if (strcmp(name, "write_stp_q") == 0) {
+        bench = new WriteStpQBenchmark();
+    } else if (strcmp(name, "read_ldp") == 0) {
+        bench = new ReadLdpBenchmark();
+    } else if (strcmp(name, "read_ldp_q") == 0) {
+        bench = new ReadLdpQBenchmark();
+#if defined(__ARM_FEATURE_SVE)
+    } else if (strcmp(name, "copy_sve") == 0) {
+        bench = new CopySveBenchmark();
+    } else if (strcmp(name, "write_sve") == 0) {
+        bench = new WriteSveBenchmark();
+    } else if (strcmp(name, "read_sve") == 0) {
+        bench = new ReadSveBenchmark();
+#endif
+#endif
     } else {
         printf("Unknown type name %s\n", name);
         return NULL;
@@ -319,7 +344,7 @@ int per_core_bandwidth(int argc, char** argv) {
         }
     }
 
-    printf("Running on %d cores\n", cpu_list.size());
+    printf("Running on %zu cores\n", cpu_list.size());
     printf("  run_time = %ds\n", values["run_time"].int_value);
     printf("  size = %d\n", values["size"].int_value);
     printf("  num_warm_loops = %d\n", values["num_warm_loops"].int_value);
@@ -412,9 +437,9 @@ bool run_bandwidth_benchmark(int argc, char** argv, const char *name,
         if (!preamble_printed) {
             preamble_printed = true;
             printf("Benchmarking %s bandwidth\n", name);
-            printf("  size = %d\n", (*it)->size());
-            printf("  num_warm_loops = %d\n", (*it)->num_warm_loops());
-            printf("  num_loops = %d\n\n", (*it)->num_loops());
+            printf("  size = %zu\n", (*it)->size());
+            printf("  num_warm_loops = %zu\n", (*it)->num_warm_loops());
+            printf("  num_loops = %zu\n\n", (*it)->num_loops());
         }
         (*it)->run();
         printf("  %s bandwidth with %s: %0.2f MB/s\n", name, (*it)->getName(),
@@ -426,11 +451,20 @@ bool run_bandwidth_benchmark(int argc, char** argv, const char *name,
 
 int copy_bandwidth(int argc, char** argv) {
     std::vector<BandwidthBenchmark*> bench_objs;
+#if defined(__arm__)
     bench_objs.push_back(new CopyLdrdStrdBenchmark());
     bench_objs.push_back(new CopyLdmiaStmiaBenchmark());
     bench_objs.push_back(new CopyVld1Vst1Benchmark());
     bench_objs.push_back(new CopyVldrVstrBenchmark());
     bench_objs.push_back(new CopyVldmiaVstmiaBenchmark());
+#elif defined(__aarch64__)
+    bench_objs.push_back(new CopyLdpStpBenchmark());
+    bench_objs.push_back(new CopyLdpStpQBenchmark());
+    bench_objs.push_back(new CopyLd1St1Benchmark());
+#if defined(__ARM_FEATURE_SVE)
+    bench_objs.push_back(new CopySveBenchmark());
+#endif
+#endif
     bench_objs.push_back(new MemcpyBenchmark());
 
     if (!run_bandwidth_benchmark(argc, argv, "copy", bench_objs)) {
@@ -441,11 +475,19 @@ int copy_bandwidth(int argc, char** argv) {
 
 int write_bandwidth(int argc, char** argv) {
     std::vector<BandwidthBenchmark*> bench_objs;
+#if defined(__arm__)
     bench_objs.push_back(new WriteStrdBenchmark());
     bench_objs.push_back(new WriteStmiaBenchmark());
     bench_objs.push_back(new WriteVst1Benchmark());
     bench_objs.push_back(new WriteVstrBenchmark());
     bench_objs.push_back(new WriteVstmiaBenchmark());
+#elif defined(__aarch64__)
+    bench_objs.push_back(new WriteStpBenchmark());
+    bench_objs.push_back(new WriteStpQBenchmark());
+#if defined(__ARM_FEATURE_SVE)
+    bench_objs.push_back(new WriteSveBenchmark());
+#endif
+#endif
     bench_objs.push_back(new MemsetBenchmark());
 
     if (!run_bandwidth_benchmark(argc, argv, "write", bench_objs)) {
@@ -457,11 +499,19 @@ int write_bandwidth(int argc, char** argv) {
 
 int read_bandwidth(int argc, char** argv) {
     std::vector<BandwidthBenchmark*> bench_objs;
+#if defined(__arm__)
     bench_objs.push_back(new ReadLdrdBenchmark());
     bench_objs.push_back(new ReadLdmiaBenchmark());
     bench_objs.push_back(new ReadVld1Benchmark());
     bench_objs.push_back(new ReadVldrBenchmark());
     bench_objs.push_back(new ReadVldmiaBenchmark());
+#elif defined(__aarch64__)
+    bench_objs.push_back(new ReadLdpBenchmark());
+    bench_objs.push_back(new ReadLdpQBenchmark());
+#if defined(__ARM_FEATURE_SVE)
+    bench_objs.push_back(new ReadSveBenchmark());
+#endif
+#endif
 
     if (!run_bandwidth_benchmark(argc, argv, "read", bench_objs)) {
         return -1;
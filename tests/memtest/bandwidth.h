@@ -20,6 +20,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+
+// Old uapi headers do not know about SVE yet.
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+#endif
+
 #include "utils/Compat.h"
 #include "memtest.h"
 
@@ -51,7 +60,10 @@ public:
         return true;
     }
 
-    bool canRun() { return !usesNeon() || isNeonSupported(); }
+    bool canRun() {
+        return (!usesNeon() || isNeonSupported()) &&
+               (!usesSve() || isSveSupported());
+    }
 
     virtual bool setSize(size_t size) = 0;
 
@@ -61,14 +73,26 @@ public:
 
     virtual bool usesNeon() { return false; }
 
+    virtual bool usesSve() { return false; }
+
     bool isNeonSupported() {
-#if defined(__ARM_NEON__)
+#if defined(__ARM_NEON__) || defined(__aarch64__)
         return true;
 #else
         return false;
 #endif
     }
 
+    // SVE support varies across cores in the arm64 fleet, so it has to
+    // be detected at runtime, not at compile time.
+    bool isSveSupported() {
+#if defined(__aarch64__)
+        return (getauxval(AT_HWCAP) & HWCAP_SVE) != 0;
+#else
+        return false;
+#endif
+    }
+
     // Accessors/mutators.
     double mb_per_sec() { return _mb_per_sec; }
     size_t num_warm_loops() { return _num_warm_loops; }
@@ -170,6 +194,7 @@ protected:
     static const unsigned int DEFAULT_COPY_SIZE = 8000;
 };
 
+#if defined(__arm__)
 class CopyLdrdStrdBenchmark : public CopyBandwidthBenchmark {
 public:
     CopyLdrdStrdBenchmark() : CopyBandwidthBenchmark() { }
@@ -409,6 +434,168 @@ protected:
 #endif
     }
 };
+#endif  // __arm__
+
+#if defined(__aarch64__)
+class CopyLdpStpBenchmark : public CopyBandwidthBenchmark {
+public:
+    CopyLdpStpBenchmark() : CopyBandwidthBenchmark() { }
+    virtual ~CopyLdpStpBenchmark() {}
+
+    const char *getName() { return "ldp/stp"; }
+
+protected:
+    // Copy using 64-bit ldp/stp instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+            "mov x3, %3\n"
+
+            "0:\n"
+            "lsr x4, x2, #6\n"
+
+            "1:\n"
+            "ldp x5, x6, [x0]\n"
+            "stp x5, x6, [x1]\n"
+            "ldp x5, x6, [x0, #16]\n"
+            "stp x5, x6, [x1, #16]\n"
+            "ldp x5, x6, [x0, #32]\n"
+            "stp x5, x6, [x1, #32]\n"
+            "ldp x5, x6, [x0, #48]\n"
+            "stp x5, x6, [x1, #48]\n"
+
+            "add  x0, x0, #64\n"
+            "add  x1, x1, #64\n"
+            "subs x4, x4, #1\n"
+            "b.gt 1b\n"
+
+            "sub x0, x0, x2\n"
+            "sub x1, x1, x2\n"
+            "subs x3, x3, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_src), "r" (_dst), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "x4", "x5", "x6", "cc", "memory");
+    }
+};
+
+class CopyLdpStpQBenchmark : public CopyBandwidthBenchmark {
+public:
+    CopyLdpStpQBenchmark() : CopyBandwidthBenchmark() { }
+    virtual ~CopyLdpStpQBenchmark() {}
+
+    const char *getName() { return "ldp/stp q"; }
+
+    bool usesNeon() { return true; }
+
+protected:
+    // Copy using NEON q register ldp/stp instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+            "mov x3, %3\n"
+
+            "0:\n"
+            "lsr x4, x2, #6\n"
+
+            "1:\n"
+            "ldp q0, q1, [x0]\n"
+            "stp q0, q1, [x1]\n"
+            "ldp q2, q3, [x0, #32]\n"
+            "stp q2, q3, [x1, #32]\n"
+
+            "add  x0, x0, #64\n"
+            "add  x1, x1, #64\n"
+            "subs x4, x4, #1\n"
+            "b.gt 1b\n"
+
+            "sub x0, x0, x2\n"
+            "sub x1, x1, x2\n"
+            "subs x3, x3, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_src), "r" (_dst), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "x4", "v0", "v1", "v2", "v3", "cc", "memory");
+    }
+};
+
+class CopyLd1St1Benchmark : public CopyBandwidthBenchmark {
+public:
+    CopyLd1St1Benchmark() : CopyBandwidthBenchmark() { }
+    virtual ~CopyLd1St1Benchmark() {}
+
+    const char *getName() { return "ld1/st1"; }
+
+    bool usesNeon() { return true; }
+
+protected:
+    // Copy using four register ld1/st1 instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+            "mov x3, %3\n"
+
+            "0:\n"
+            "lsr x4, x2, #6\n"
+
+            "1:\n"
+            "ld1 {v0.16b, v1.16b, v2.16b, v3.16b}, [x0], #64\n"
+            "subs x4, x4, #1\n"
+            "st1 {v0.16b, v1.16b, v2.16b, v3.16b}, [x1], #64\n"
+            "b.gt 1b\n"
+
+            "sub x0, x0, x2\n"
+            "sub x1, x1, x2\n"
+            "subs x3, x3, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_src), "r" (_dst), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "x4", "v0", "v1", "v2", "v3", "cc", "memory");
+    }
+};
+
+#if defined(__ARM_FEATURE_SVE)
+class CopySveBenchmark : public CopyBandwidthBenchmark {
+public:
+    CopySveBenchmark() : CopyBandwidthBenchmark() { }
+    virtual ~CopySveBenchmark() {}
+
+    const char *getName() { return "sve ld1b/st1b"; }
+
+    bool usesSve() { return true; }
+
+protected:
+    // Copy using SVE ld1b/st1b instructions. The predicated loop is
+    // vector length agnostic, so the same code runs on any SVE core.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+            "mov x3, %3\n"
+
+            "0:\n"
+            "mov x4, #0\n"
+            "whilelo p0.b, x4, x2\n"
+
+            "1:\n"
+            "ld1b z0.b, p0/z, [x0, x4]\n"
+            "st1b z0.b, p0, [x1, x4]\n"
+            "incb x4\n"
+            "whilelo p0.b, x4, x2\n"
+            "b.mi 1b\n"
+
+            "subs x3, x3, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_src), "r" (_dst), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "x4", "p0", "z0", "cc", "memory");
+    }
+};
+#endif  // __ARM_FEATURE_SVE
+#endif  // __aarch64__
 
 class MemcpyBenchmark : public CopyBandwidthBenchmark {
 public:
@@ -493,6 +680,7 @@ public:
     }
 };
 
+#if defined(__arm__)
 class WriteStrdBenchmark : public WriteBandwidthBenchmark {
 public:
     WriteStrdBenchmark() : WriteBandwidthBenchmark() { }
@@ -726,6 +914,133 @@ protected:
 #endif
     }
 };
+#endif  // __arm__
+
+#if defined(__aarch64__)
+class WriteStpBenchmark : public WriteBandwidthBenchmark {
+public:
+    WriteStpBenchmark() : WriteBandwidthBenchmark() { }
+    virtual ~WriteStpBenchmark() {}
+
+    const char *getName() { return "stp"; }
+
+protected:
+    // Write a given value using 64-bit stp instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+
+            "mov x4, #0\n"
+            "movz x6, #0x0101\n"
+            "movk x6, #0x0101, lsl #16\n"
+            "movk x6, #0x0101, lsl #32\n"
+            "movk x6, #0x0101, lsl #48\n"
+
+            "0:\n"
+            "lsr x3, x1, #6\n"
+
+            "add x4, x4, x6\n"
+            "mov x5, x4\n"
+
+            "1:\n"
+            "subs x3, x3, #1\n"
+            "stp x4, x5, [x0]\n"
+            "stp x4, x5, [x0, #16]\n"
+            "stp x4, x5, [x0, #32]\n"
+            "stp x4, x5, [x0, #48]\n"
+            "add  x0, x0, #64\n"
+            "b.gt 1b\n"
+
+            "sub x0, x0, x1\n"
+            "subs x2, x2, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_buffer), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "x4", "x5", "x6", "cc", "memory");
+    }
+};
+
+class WriteStpQBenchmark : public WriteBandwidthBenchmark {
+public:
+    WriteStpQBenchmark() : WriteBandwidthBenchmark() { }
+    virtual ~WriteStpQBenchmark() {}
+
+    const char *getName() { return "stp q"; }
+
+    bool usesNeon() { return true; }
+
+protected:
+    // Write a given value using NEON q register stp instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+            "mov w4, #0\n"
+
+            "0:\n"
+            "lsr x3, x1, #6\n"
+
+            "add w4, w4, #1\n"
+            "dup v0.16b, w4\n"
+            "mov v1.16b, v0.16b\n"
+
+            "1:\n"
+            "subs x3, x3, #1\n"
+            "stp q0, q1, [x0]\n"
+            "stp q0, q1, [x0, #32]\n"
+            "add  x0, x0, #64\n"
+            "b.gt 1b\n"
+
+            "sub x0, x0, x1\n"
+            "subs x2, x2, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_buffer), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "x4", "v0", "v1", "cc", "memory");
+    }
+};
+
+#if defined(__ARM_FEATURE_SVE)
+class WriteSveBenchmark : public WriteBandwidthBenchmark {
+public:
+    WriteSveBenchmark() : WriteBandwidthBenchmark() { }
+    virtual ~WriteSveBenchmark() {}
+
+    const char *getName() { return "sve st1b"; }
+
+    bool usesSve() { return true; }
+
+protected:
+    // Write a given value using SVE st1b instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+            "mov w5, #0\n"
+
+            "0:\n"
+            "mov x4, #0\n"
+            "whilelo p0.b, x4, x1\n"
+
+            "add w5, w5, #1\n"
+            "dup z0.b, w5\n"
+
+            "1:\n"
+            "st1b z0.b, p0, [x0, x4]\n"
+            "incb x4\n"
+            "whilelo p0.b, x4, x1\n"
+            "b.mi 1b\n"
+
+            "subs x2, x2, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_buffer), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x4", "x5", "p0", "z0", "cc", "memory");
+    }
+};
+#endif  // __ARM_FEATURE_SVE
+#endif  // __aarch64__
 
 class MemsetBenchmark : public WriteBandwidthBenchmark {
 public:
@@ -742,6 +1057,7 @@ protected:
     }
 };
 
+#if defined(__arm__)
 class ReadLdrdBenchmark : public SingleBufferBandwidthBenchmark {
 public:
     ReadLdrdBenchmark() : SingleBufferBandwidthBenchmark() { }
@@ -938,5 +1254,114 @@ protected:
 #endif
     }
 };
+#endif  // __arm__
+
+#if defined(__aarch64__)
+class ReadLdpBenchmark : public SingleBufferBandwidthBenchmark {
+public:
+    ReadLdpBenchmark() : SingleBufferBandwidthBenchmark() { }
+    virtual ~ReadLdpBenchmark() {}
+
+    const char *getName() { return "ldp"; }
+
+protected:
+    // Read the buffer using 64-bit ldp instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+
+            "0:\n"
+            "lsr x3, x1, #6\n"
+
+            "1:\n"
+            "subs x3, x3, #1\n"
+            "ldp x4, x5, [x0]\n"
+            "ldp x4, x5, [x0, #16]\n"
+            "ldp x4, x5, [x0, #32]\n"
+            "ldp x4, x5, [x0, #48]\n"
+            "add  x0, x0, #64\n"
+            "b.gt 1b\n"
+
+            "sub x0, x0, x1\n"
+            "subs x2, x2, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_buffer), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "x4", "x5", "cc", "memory");
+    }
+};
+
+class ReadLdpQBenchmark : public SingleBufferBandwidthBenchmark {
+public:
+    ReadLdpQBenchmark() : SingleBufferBandwidthBenchmark() { }
+    virtual ~ReadLdpQBenchmark() {}
+
+    const char *getName() { return "ldp q"; }
+
+    bool usesNeon() { return true; }
+
+protected:
+    // Read the buffer using NEON q register ldp instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+
+            "0:\n"
+            "lsr x3, x1, #6\n"
+
+            "1:\n"
+            "subs x3, x3, #1\n"
+            "ldp q0, q1, [x0]\n"
+            "ldp q2, q3, [x0, #32]\n"
+            "add  x0, x0, #64\n"
+            "b.gt 1b\n"
+
+            "sub x0, x0, x1\n"
+            "subs x2, x2, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_buffer), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x3", "v0", "v1", "v2", "v3", "cc", "memory");
+    }
+};
+
+#if defined(__ARM_FEATURE_SVE)
+class ReadSveBenchmark : public SingleBufferBandwidthBenchmark {
+public:
+    ReadSveBenchmark() : SingleBufferBandwidthBenchmark() { }
+    virtual ~ReadSveBenchmark() {}
+
+    const char *getName() { return "sve ld1b"; }
+
+    bool usesSve() { return true; }
+
+protected:
+    // Read the buffer using SVE ld1b instructions.
+    void bench(size_t num_loops) {
+        asm volatile(
+            "mov x0, %0\n"
+            "mov x1, %1\n"
+            "mov x2, %2\n"
+
+            "0:\n"
+            "mov x4, #0\n"
+            "whilelo p0.b, x4, x1\n"
+
+            "1:\n"
+            "ld1b z0.b, p0/z, [x0, x4]\n"
+            "incb x4\n"
+            "whilelo p0.b, x4, x1\n"
+            "b.mi 1b\n"
+
+            "subs x2, x2, #1\n"
+            "b.gt 0b\n"
+        :: "r" (_buffer), "r" (_size), "r" (num_loops)
+        : "x0", "x1", "x2", "x4", "p0", "z0", "cc", "memory");
+    }
+};
+#endif  // __ARM_FEATURE_SVE
+#endif  // __aarch64__
 
 #endif  // __BANDWIDTH_H__
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "memtest.h"
+
+// From bandwidth.cpp.
+bool getAvailCpus(std::vector<int> *cpu_list);
+
+// Two counters inside this distance share a cache line on every core we
+// ship; counters this far apart never do.
+#define SHARED_STRIDE 8
+#define PADDED_STRIDE 128
+
+// There is no architecturally portable snoop event, so last level cache
+// misses stand in for coherence traffic: a load or store that finds the
+// line dirty in another core's cache counts as a miss on the cores we
+// care about.
+static int perfOpenMisses() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+typedef struct {
+    int core;
+    size_t iters;
+    volatile uint64_t *counter;
+    volatile bool *run;
+    nsecs_t time_ns;
+    long long misses;
+} sharing_arg_t;
+
+static void *runSharingThread(void *data) {
+    sharing_arg_t *arg = reinterpret_cast<sharing_arg_t *>(data);
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(arg->core, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+        perror("sched_setaffinity failed");
+        return NULL;
+    }
+
+    int miss_fd = perfOpenMisses();
+
+    // Spinloop waiting for the run variable to get set to true.
+    while (!*arg->run) {
+    }
+
+    if (miss_fd >= 0) {
+        ioctl(miss_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(miss_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    nsecs_t t = system_time();
+    volatile uint64_t *counter = arg->counter;
+    for (size_t i = 0; i < arg->iters; i++) {
+        (*counter)++;
+    }
+    arg->time_ns = system_time() - t;
+    arg->misses = -1;
+    if (miss_fd >= 0) {
+        ioctl(miss_fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long value;
+        if (read(miss_fd, &value, sizeof(value)) == sizeof(value)) {
+            arg->misses = value;
+        }
+        close(miss_fd);
+    }
+
+    return NULL;
+}
+
+// Runs one pair of pinned threads updating counters stride bytes apart
+// and returns the combined update rate in Mops/s. Per-thread miss
+// counts are accumulated into *misses (-1 if the counter is
+// unavailable).
+static double runSharingPair(int core1, int core2, size_t iters,
+                             size_t stride, uint8_t *slab,
+                             long long *misses) {
+    sharing_arg_t args[2];
+    pthread_t threads[2];
+    volatile bool run = false;
+
+    memset(slab, 0, 2 * PADDED_STRIDE);
+    for (int i = 0; i < 2; i++) {
+        args[i].core = (i == 0) ? core1 : core2;
+        args[i].iters = iters;
+        args[i].time_ns = 0;
+        args[i].counter = reinterpret_cast<volatile uint64_t *>(
+            slab + i * stride);
+        args[i].run = &run;
+        if (pthread_create(&threads[i], NULL, runSharingThread,
+                           (void *)&args[i]) != 0) {
+            printf("Failed to launch thread %d\n", i);
+            return -1;
+        }
+    }
+
+    // Kick start the threads.
+    run = true;
+
+    double mops = 0;
+    *misses = 0;
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+        if (args[i].time_ns == 0) {
+            return -1;
+        }
+        mops += iters * 1000.0 / args[i].time_ns;
+        if (args[i].misses < 0 || *misses < 0) {
+            *misses = -1;
+        } else {
+            *misses += args[i].misses;
+        }
+    }
+    return mops;
+}
+
+int false_sharing_test(int argc, char **argv) {
+    size_t iters = 5000000;
+    int only_core1 = -1;
+    int only_core2 = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iters") == 0 && i + 1 < argc) {
+            iters = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--cores") == 0 && i + 2 < argc) {
+            only_core1 = atoi(argv[++i]);
+            only_core2 = atoi(argv[++i]);
+        } else {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (setpriority(PRIO_PROCESS, 0, -20)) {
+        perror("Unable to raise priority of process.");
+        return -1;
+    }
+
+    std::vector<int> cpu_list;
+    if (only_core1 >= 0) {
+        cpu_list.push_back(only_core1);
+        cpu_list.push_back(only_core2);
+    } else if (!getAvailCpus(&cpu_list)) {
+        printf("Failed to get available cpu list.\n");
+        return -1;
+    }
+    if (cpu_list.size() < 2) {
+        printf("Need at least two cpus.\n");
+        return -1;
+    }
+
+    uint8_t *slab;
+    if (posix_memalign(reinterpret_cast<void **>(&slab), PADDED_STRIDE,
+                       2 * PADDED_STRIDE) != 0) {
+        printf("Failed to allocate counter slab.\n");
+        return -1;
+    }
+
+    printf("False sharing, %zu updates per thread\n", iters);
+    printf("  padded: counters %d bytes apart (separate lines)\n",
+           PADDED_STRIDE);
+    printf("  shared: counters %d bytes apart (same line)\n\n",
+           SHARED_STRIDE);
+
+    // Sweep every core pair so asymmetric interconnect costs (such as
+    // big to LITTLE snoops crossing the cluster boundary) stand out
+    // against same cluster pairs.
+    for (size_t a = 0; a < cpu_list.size(); a++) {
+        for (size_t b = a + 1; b < cpu_list.size(); b++) {
+            long long padded_misses;
+            long long shared_misses;
+            double padded = runSharingPair(cpu_list[a], cpu_list[b], iters,
+                                           PADDED_STRIDE, slab,
+                                           &padded_misses);
+            double shared = runSharingPair(cpu_list[a], cpu_list[b], iters,
+                                           SHARED_STRIDE, slab,
+                                           &shared_misses);
+            if (padded < 0 || shared < 0) {
+                free(slab);
+                return -1;
+            }
+            printf("  cores %d-%d: padded %0.1f Mops/s, shared %0.1f Mops/s "
+                   "(%0.1f%% slower)",
+                   cpu_list[a], cpu_list[b], padded, shared,
+                   (padded - shared) * 100.0 / padded);
+            if (shared_misses >= 0) {
+                printf(", misses %lld -> %lld", padded_misses, shared_misses);
+            }
+            printf("\n");
+        }
+    }
+
+    free(slab);
+    return 0;
+}
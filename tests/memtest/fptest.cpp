@@ -26,9 +26,12 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 
-#ifdef __ARM_NEON__
+#if defined(__ARM_NEON__) || defined(__aarch64__)
 #include <arm_neon.h>
 #endif
+#if defined(__ARM_FEATURE_SVE)
+#include <arm_sve.h>
+#endif
 
 
 typedef long long nsecs_t;
@@ -121,6 +124,161 @@ static void test_fma() {
 }
 #endif
 
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+
+// Peak throughput kernels. Eight independent accumulator chains keep
+// the FMA pipes full with no loop-carried dependency between chains;
+// each chain computes a = c + a * m, which converges to c / (1 - m) so
+// the values stay in normal range for the whole run.
+#define PEAK_CHAINS 8
+#define PEAK_LOOPS (32 * 1000 * 1000)
+
+#if defined(__aarch64__)
+#define FMAQ(c, a, m) vfmaq_f32(c, a, m)
+#else
+// No fused multiply-add before VFPv4; vmla still retires two flops.
+#define FMAQ(c, a, m) vmlaq_f32(c, a, m)
+#endif
+
+static double test_peak_fma_neon() {
+    float32x4_t m = vdupq_n_f32(0.999f);
+    float32x4_t c = vdupq_n_f32(0.0001f);
+    float32x4_t a0 = vdupq_n_f32(0.10f);
+    float32x4_t a1 = vdupq_n_f32(0.11f);
+    float32x4_t a2 = vdupq_n_f32(0.12f);
+    float32x4_t a3 = vdupq_n_f32(0.13f);
+    float32x4_t a4 = vdupq_n_f32(0.14f);
+    float32x4_t a5 = vdupq_n_f32(0.15f);
+    float32x4_t a6 = vdupq_n_f32(0.16f);
+    float32x4_t a7 = vdupq_n_f32(0.17f);
+
+    nsecs_t t = system_time();
+    for (int ct = 0; ct < PEAK_LOOPS; ct++) {
+        a0 = FMAQ(c, a0, m);
+        a1 = FMAQ(c, a1, m);
+        a2 = FMAQ(c, a2, m);
+        a3 = FMAQ(c, a3, m);
+        a4 = FMAQ(c, a4, m);
+        a5 = FMAQ(c, a5, m);
+        a6 = FMAQ(c, a6, m);
+        a7 = FMAQ(c, a7, m);
+    }
+    t = system_time() - t;
+
+    // Keep the result live so the loop cannot be thrown away.
+    float32x4_t s = vaddq_f32(vaddq_f32(a0, a1), vaddq_f32(a2, a3));
+    s = vaddq_f32(s, vaddq_f32(vaddq_f32(a4, a5), vaddq_f32(a6, a7)));
+    vst1q_f32(data_f, s);
+
+    double flops = (double)PEAK_LOOPS * PEAK_CHAINS * 4 * 2;
+    return flops / ((double)t / 1e9) / 1e9;
+}
+
+#if defined(__ARM_FEATURE_SVE)
+// Same chains at whatever vector length the core implements.
+static double test_peak_fma_sve() {
+    svbool_t pg = svptrue_b32();
+    svfloat32_t m = svdup_f32(0.999f);
+    svfloat32_t c = svdup_f32(0.0001f);
+    svfloat32_t a0 = svdup_f32(0.10f);
+    svfloat32_t a1 = svdup_f32(0.11f);
+    svfloat32_t a2 = svdup_f32(0.12f);
+    svfloat32_t a3 = svdup_f32(0.13f);
+    svfloat32_t a4 = svdup_f32(0.14f);
+    svfloat32_t a5 = svdup_f32(0.15f);
+    svfloat32_t a6 = svdup_f32(0.16f);
+    svfloat32_t a7 = svdup_f32(0.17f);
+
+    nsecs_t t = system_time();
+    for (int ct = 0; ct < PEAK_LOOPS; ct++) {
+        a0 = svmla_f32_x(pg, c, a0, m);
+        a1 = svmla_f32_x(pg, c, a1, m);
+        a2 = svmla_f32_x(pg, c, a2, m);
+        a3 = svmla_f32_x(pg, c, a3, m);
+        a4 = svmla_f32_x(pg, c, a4, m);
+        a5 = svmla_f32_x(pg, c, a5, m);
+        a6 = svmla_f32_x(pg, c, a6, m);
+        a7 = svmla_f32_x(pg, c, a7, m);
+    }
+    t = system_time() - t;
+
+    svfloat32_t s = svadd_f32_x(pg, svadd_f32_x(pg, a0, a1),
+                                svadd_f32_x(pg, a2, a3));
+    s = svadd_f32_x(pg, s, svadd_f32_x(pg, svadd_f32_x(pg, a4, a5),
+                                       svadd_f32_x(pg, a6, a7)));
+    svst1_f32(pg, data_f, s);
+
+    double flops = (double)PEAK_LOOPS * PEAK_CHAINS * svcntw() * 2;
+    return flops / ((double)t / 1e9) / 1e9;
+}
+#endif
+
+static long read_cpu_max_khz(int cpu) {
+    char path[128];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    long khz = -1;
+    if (fscanf(f, "%ld", &khz) != 1) {
+        khz = -1;
+    }
+    fclose(f);
+    return khz;
+}
+
+static void print_peak(const char *name, int cpu, double gflops,
+                       int lanes) {
+    long khz = read_cpu_max_khz(cpu);
+    if (khz > 0) {
+        // Assumes one vector FMA retired per cycle; cores with two FMA
+        // pipes legitimately report above 100%.
+        double peak = (khz / 1e6) * lanes * 2;
+        printf("cpu %d: %s %0.2f GFLOPS (%0.0f%% of %0.1f GFLOPS at "
+               "%ld MHz, one %d-lane FMA/cycle)\n",
+               cpu, name, gflops, gflops * 100.0 / peak, peak, khz / 1000,
+               lanes);
+    } else {
+        printf("cpu %d: %s %0.2f GFLOPS\n", cpu, name, gflops);
+    }
+}
+
+// Runs the peak kernels pinned to each available core in turn so the
+// big and LITTLE numbers are reported separately.
+static void test_peak() {
+    cpu_set_t avail;
+    CPU_ZERO(&avail);
+    if (sched_getaffinity(0, sizeof(avail), &avail) != 0) {
+        perror("sched_getaffinity failed");
+        return;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &avail)) {
+            continue;
+        }
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (sched_setaffinity(0, sizeof(one), &one) != 0) {
+            perror("sched_setaffinity failed");
+            continue;
+        }
+        // First run ramps the governor, second run is reported.
+        test_peak_fma_neon();
+        print_peak("neon fma", cpu, test_peak_fma_neon(), 4);
+#if defined(__ARM_FEATURE_SVE)
+        test_peak_fma_sve();
+        print_peak("sve fma", cpu, test_peak_fma_sve(), (int)svcntw());
+#endif
+    }
+
+    sched_setaffinity(0, sizeof(avail), &avail);
+}
+#endif
+
 int fp_test(int, char**) {
     test_mad();
 
@@ -128,5 +286,9 @@ int fp_test(int, char**) {
     test_fma();
 #endif
 
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+    test_peak();
+#endif
+
     return 0;
 }
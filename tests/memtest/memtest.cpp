@@ -42,6 +42,15 @@ static void usage(char* p) {
            "  write_bandwidth [--size BYTES_TO_WRITE]\n"
            "  read_bandwidth [--size BYTES_TO_COPY]\n"
            "  per_core_bandwidth [--size BYTES]\n"
+#if defined(__aarch64__)
+           "    --type copy_ldp_stp | copy_ldp_stp_q | copy_ld1_st1 | copy_sve |\n"
+           "           memcpy | write_stp | write_stp_q | write_sve | memset |\n"
+           "           read_ldp | read_ldp_q | read_sve\n"
+           "  multithread_bandwidth [--size BYTES]\n"
+           "    --type copy_ldp_stp | copy_ldp_stp_q | copy_ld1_st1 | copy_sve |\n"
+           "           memcpy | write_stp | write_stp_q | write_sve | memset |\n"
+           "           read_ldp | read_ldp_q | read_sve\n"
+#else
            "    --type copy_ldrd_strd | copy_ldmia_stmia | copy_vld1_vst1 |\n"
            "           copy_vldr_vstr | copy_vldmia_vstmia | memcpy | write_strd |\n"
            "           write_stmia | write_vst1 | write_vstr | write_vstmia | memset |\n"
@@ -51,7 +60,9 @@ static void usage(char* p) {
            "           copy_vldr_vstr | copy_vldmia_vstmia | memcpy | write_strd |\n"
            "           write_stmia | write_vst1 | write_vstr | write_vstmia | memset |\n"
            "           read_ldrd | read_ldmia | read_vld1 | read_vldr | read_vldmia\n"
+#endif
            "    --num_threads NUM_THREADS_TO_RUN\n"
+           "  false_sharing [--iters UPDATES_PER_THREAD] [--cores CORE1 CORE2]\n"
            "  malloc [fill]\n"
            "  madvise\n"
            "  resampler\n"
@@ -65,6 +76,7 @@ int write_bandwidth(int argc, char** argv);
 int read_bandwidth(int argc, char** argv);
 int per_core_bandwidth(int argc, char** argv);
 int multithread_bandwidth(int argc, char** argv);
+int false_sharing_test(int argc, char** argv);
 int malloc_test(int argc, char** argv);
 int madvise_test(int argc, char** argv);
 int stack_smasher_test(int argc, char** argv);
@@ -87,6 +99,7 @@ function_t function_table[] = {
     { "read_bandwidth", read_bandwidth },
     { "per_core_bandwidth", per_core_bandwidth },
     { "multithread_bandwidth", multithread_bandwidth },
+    { "false_sharing", false_sharing_test },
 };
 
 int main(int argc, char** argv) {
@@ -6,7 +6,7 @@ extern "C" void thumb_function_1(int* p);
 extern "C" void thumb_function_2(int* p);
 
 extern "C" _Unwind_Reason_Code trace_function(_Unwind_Context* context, void *) {
-    printf("0x%x\n", _Unwind_GetIP(context));
+    printf("0x%lx\n", (unsigned long)_Unwind_GetIP(context));
     fflush(stdout);
     return _URC_NO_REASON;
 }
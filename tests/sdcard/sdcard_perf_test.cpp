@@ -33,8 +33,12 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <malloc.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
 #include <linux/fadvise.h>
 #include <unistd.h>
 #include <fts.h>
@@ -106,6 +110,97 @@ const char *kAppName = "sdcard_perf_test";
 const char *kTestDir = "/sdcard/perf";
 const bool kVerbose = false;
 
+// O_DIRECT buffers must be block aligned, a page is always enough.
+const size_t kAioBufferAlignment = 4096;
+
+// Bionic does not ship libaio, go straight to the kernel.
+int io_setup(unsigned nr_events, aio_context_t *ctx)
+{
+    return syscall(__NR_io_setup, nr_events, ctx);
+}
+
+int io_destroy(aio_context_t ctx)
+{
+    return syscall(__NR_io_destroy, ctx);
+}
+
+int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+    return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+int io_getevents(aio_context_t ctx, long min_nr, long nr,
+                 struct io_event *events, struct timespec *timeout)
+{
+    return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+double nowSeconds()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Completion latencies for the aio engine. The StopWatch class times
+// one interval at a time which does not work with several requests in
+// flight, so the aio paths record one sample per completion here and
+// print percentiles when the test is done.
+class LatencyStats {
+  public:
+    LatencyStats(const char *name)
+        : mName(name), mSamples(NULL), mNum(0), mCapacity(0) { }
+
+    ~LatencyStats() { free(mSamples); }
+
+    void add(double seconds)
+    {
+        if (mNum == mCapacity)
+        {
+            mCapacity = mCapacity ? mCapacity * 2 : 1024;
+            mSamples = (double *)realloc(mSamples, mCapacity * sizeof(double));
+        }
+        mSamples[mNum++] = seconds;
+    }
+
+    // Print a '#' commented summary like StopWatch::sprint does.
+    void print()
+    {
+        if (0 == mNum)
+        {
+            return;
+        }
+        qsort(mSamples, mNum, sizeof(double), compareDouble);
+        printf("# %s latency: samples: %d p50: %f p90: %f p99: %f max: %f ms\n",
+               mName, int(mNum),
+               percentile(50), percentile(90), percentile(99),
+               mSamples[mNum - 1] * 1000.0);
+    }
+
+  private:
+    static int compareDouble(const void *lhs, const void *rhs)
+    {
+        double delta = *(const double *)lhs - *(const double *)rhs;
+        return (delta > 0.0) - (delta < 0.0);
+    }
+
+    // @param p Percentile requested, e.g 99.
+    // @return The pth percentile in milliseconds.
+    double percentile(int p)
+    {
+        size_t idx = (mNum * p + 99) / 100;
+
+        if (idx > 0) --idx;
+        return mSamples[idx] * 1000.0;
+    }
+
+    const char *mName;
+    double *mSamples;
+    size_t mNum;
+    size_t mCapacity;
+};
+
 // Used by getopt to parse the command line.
 struct option long_options[] = {
     {"size", required_argument, 0, 's'},
@@ -114,6 +209,8 @@ struct option long_options[] = {
     {"iterations",  required_argument, 0, 'i'},
     {"procnb",  required_argument, 0, 'p'},
     {"test",  required_argument, 0, 't'},
+    {"engine",  required_argument, 0, 'E'},
+    {"queue-depth",  required_argument, 0, 'q'},
     {"dump",  no_argument, 0, 'd'},
     {"cpu-scaling",  no_argument, 0, 'c'},
     {"sync",  required_argument, 0, 'f'},
@@ -121,6 +218,7 @@ struct option long_options[] = {
     {"no-new-fair-sleepers", no_argument, 0, 'z'},
     {"no-normalized-sleepers", no_argument, 0, 'Z'},
     {"fadvise", required_argument, 0, 'a'},
+    {"cache-state", required_argument, 0, 'C'},
     {"help", no_argument, 0, 'h'},
     {0, 0, 0, 0},
 };
@@ -135,6 +233,11 @@ void usage()
            "  -D --depth:       Depth of directory tree to create for traversal.\n"
            "  -i --iterations:  Number of time a process should carry its task.\n"
            "  -p --procnb:      Number of processes to use.\n"
+           "  -E --engine:      sync|aio I/O engine for read/write tests. Default: sync.\n"
+           "                    aio opens the files with O_DIRECT and keeps several\n"
+           "                    requests in flight, and reports completion latency\n"
+           "                    percentiles.\n"
+           "  -q --queue-depth: Max in-flight requests for the aio engine. Default: 8.\n"
            "  -d --dump:        Print the raw timing on stdout.\n"
            "  -c --cpu-scaling: Enable cpu scaling.\n"
            "  -s --sync: fsync|sync Use fsync or sync in write test. Default: no sync call.\n"
@@ -142,6 +245,11 @@ void usage()
            "  -z --no-new-fair-sleepers: Turn them off. You need to mount debugfs.\n"
            "  -Z --no-normalized-sleepers: Turn them off. You need to mount debugfs.\n"
            "  -a --fadvise:     Specify an fadvise policy (not supported).\n"
+           "  -C --cache-state: default|drop|cold|warm page cache state of the\n"
+           "                    test files when timing starts. drop uses the\n"
+           "                    global drop_caches, cold evicts per file with\n"
+           "                    fadvise(DONTNEED), warm prefetches and reads each\n"
+           "                    file. All but default are verified with mincore.\n"
            );
 }
 
@@ -191,6 +299,7 @@ void printHeader(int argc, char **argv, const TestCase& testCase)
         }
     }
     printf("# Fadvise: %s\n", testCase.fadviseAsStr());
+    printf("# Cache state: %s\n", testCase.cacheStateAsStr());
 }
 
 // Remove all the files under kTestDir and clear the caches.
@@ -211,7 +320,7 @@ void parseCmdLine(int argc, char **argv, TestCase *testCase)\
         int option_index = 0;
 
         c = getopt_long (argc, argv,
-                         "hS:s:D:i:p:t:dcf:ezZa:",
+                         "hS:s:D:i:p:t:E:q:dcf:ezZa:C:",
                          long_options,
                          &option_index);
         // Detect the end of the options.
@@ -240,6 +349,22 @@ void parseCmdLine(int argc, char **argv, TestCase *testCase)\
                 testCase->setTypeFromName(optarg);
                 printf("# Test name %s\n", testCase->name());
                 break;
+            case 'E':
+                if (!testCase->setEngineFromName(optarg))
+                {
+                    fprintf(stderr, "Unknown engine %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                printf("# Engine: %s\n", testCase->engineAsStr());
+                break;
+            case 'q':
+                testCase->setQueueDepth(atoi(optarg));
+                if (testCase->queueDepth() == 0)
+                {
+                    fprintf(stderr, "Queue depth must be > 0\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'd':
                 testCase->setDump();
                 break;
@@ -267,6 +392,13 @@ void parseCmdLine(int argc, char **argv, TestCase *testCase)\
             case 'a':  // fadvise
                 testCase->setFadvise(optarg);
                 break;
+            case 'C':  // cache state
+                if (!testCase->setCacheStateFromName(optarg))
+                {
+                    fprintf(stderr, "Unknown cache state %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'h':
                 usage();
                 exit(0);
@@ -277,6 +409,75 @@ void parseCmdLine(int argc, char **argv, TestCase *testCase)\
     }
 }
 
+// Put the files created for a read test in the page cache state the
+// user asked for, then verify with mincore that the state actually
+// held before the timers start. CACHE_DEFAULT keeps the historical
+// behavior (global sync + drop, no verification) so old runs stay
+// comparable.
+// @param testCase has the cache state and file parameters.
+// @param iter number of files written by this child.
+void setupCacheState(TestCase *testCase, size_t iter)
+{
+    if (TestCase::CACHE_DEFAULT == testCase->cacheState())
+    {
+        android::syncAndDropCaches();
+        return;
+    }
+
+    if (TestCase::CACHE_DROP == testCase->cacheState())
+    {
+        android::syncAndDropCaches();
+    }
+    else
+    {
+        sync();  // dirty pages are not evictable.
+    }
+
+    double minResident = 1.0;
+    double maxResident = 0.0;
+    bool verified = false;
+
+    for (size_t i = 0; i < iter; ++i)
+    {
+        char filename[80] = {'\0',};
+
+        sprintf(filename, "%s/file-%d-%d", kTestDir, i, testCase->pid());
+        if (TestCase::CACHE_COLD == testCase->cacheState())
+        {
+            android::fadviseFile(filename, POSIX_FADV_DONTNEED);
+        }
+        else if (TestCase::CACHE_WARM == testCase->cacheState())
+        {
+            android::fadviseFile(filename, POSIX_FADV_WILLNEED);
+            android::warmFile(filename);
+        }
+
+        double resident = android::residentFraction(filename);
+        if (resident < 0.0)
+        {
+            continue;
+        }
+        verified = true;
+        if (resident < minResident) minResident = resident;
+        if (resident > maxResident) maxResident = resident;
+    }
+
+    if (!verified)
+    {
+        printf("# Cache state %s: pid %d not verified\n",
+               testCase->cacheStateAsStr(), testCase->pid());
+        return;
+    }
+
+    bool held = TestCase::CACHE_WARM == testCase->cacheState()
+            ? minResident >= 0.99 : maxResident <= 0.01;
+
+    printf("# Cache state %s: pid %d resident min %.1f%% max %.1f%%%s\n",
+           testCase->cacheStateAsStr(), testCase->pid(),
+           minResident * 100.0, maxResident * 100.0,
+           held ? "" : " (DID NOT HOLD)");
+}
+
 // ----------------------------------------------------------------------
 // READ TEST
 
@@ -394,7 +595,7 @@ bool testRead(TestCase *testCase) {
     }
     if (kVerbose) printf("Child %d all chunk written\n", testCase->pid());
 
-    android::syncAndDropCaches();
+    setupCacheState(testCase, iter);
     testCase->signalParentAndWait();
 
     // Start the read test.
@@ -598,6 +799,224 @@ fail:
     return res;
 }
 
+// ----------------------------------------------------------------------
+// AIO READ/WRITE
+
+// Drive one file worth of I/O, keeping up to queue-depth requests in
+// flight with io_submit. Each slot has its own aligned buffer and
+// aio_data carries the slot index so a completion can be matched with
+// its submit time.
+// @param fd File opened with O_DIRECT.
+// @param isWrite Submit IOCB_CMD_PWRITE requests instead of PREAD.
+// @param testCase has the chunk size, data size and queue depth.
+// @param stats Completion latencies, one sample per chunk.
+bool aioTransfer(int fd, bool isWrite, TestCase *testCase, LatencyStats *stats)
+{
+    const size_t chunkSize = testCase->chunkSize();
+    const size_t nrChunks = testCase->dataSize() / chunkSize;
+    const size_t queueDepth = min(testCase->queueDepth(), nrChunks);
+
+    aio_context_t ctx = 0;
+    if (io_setup(queueDepth, &ctx) < 0)
+    {
+        fprintf(stderr, "io_setup failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    struct iocb *iocbs = new struct iocb[queueDepth];
+    struct io_event *events = new struct io_event[queueDepth];
+    double *submitTime = new double[queueDepth];
+    char **buffers = new char*[queueDepth];
+    size_t *freeSlots = new size_t[queueDepth];
+    size_t freeNb = queueDepth;
+
+    for (size_t i = 0; i < queueDepth; ++i)
+    {
+        buffers[i] = (char *)memalign(kAioBufferAlignment, chunkSize);
+        if (isWrite)
+        {
+            memset(buffers[i], 0xaa, chunkSize);
+        }
+        freeSlots[i] = i;
+    }
+
+    bool ok = true;
+    size_t submitted = 0;
+    size_t completed = 0;
+    off_t offset = 0;
+
+    while (ok && completed < nrChunks)
+    {
+        // Top up the queue.
+        while (freeNb > 0 && submitted < nrChunks)
+        {
+            size_t slot = freeSlots[--freeNb];
+            struct iocb *cb = &iocbs[slot];
+
+            memset(cb, 0, sizeof(*cb));
+            cb->aio_fildes = fd;
+            cb->aio_lio_opcode = isWrite ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+            cb->aio_buf = (uintptr_t)buffers[slot];
+            cb->aio_nbytes = chunkSize;
+            cb->aio_offset = offset;
+            cb->aio_data = slot;
+
+            submitTime[slot] = nowSeconds();
+            if (io_submit(ctx, 1, &cb) != 1)
+            {
+                fprintf(stderr, "io_submit failed: %s\n", strerror(errno));
+                ok = false;
+                break;
+            }
+            offset += chunkSize;
+            ++submitted;
+        }
+        if (!ok) break;
+
+        int nr = io_getevents(ctx, 1, queueDepth, events, NULL);
+        if (nr < 0)
+        {
+            fprintf(stderr, "io_getevents failed: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+
+        double now = nowSeconds();
+        for (int i = 0; i < nr; ++i)
+        {
+            size_t slot = events[i].data;
+
+            if (events[i].res != (long long)chunkSize)
+            {
+                fprintf(stderr, "Short aio %s: %lld\n",
+                        isWrite ? "write" : "read", (long long)events[i].res);
+                ok = false;
+            }
+            stats->add(now - submitTime[slot]);
+            freeSlots[freeNb++] = slot;
+            ++completed;
+        }
+    }
+
+    io_destroy(ctx);
+    for (size_t i = 0; i < queueDepth; ++i)
+    {
+        free(buffers[i]);
+    }
+    delete [] freeSlots;
+    delete [] buffers;
+    delete [] submitTime;
+    delete [] events;
+    delete [] iocbs;
+    return ok;
+}
+
+bool testAioWrite(TestCase *testCase)
+{
+    LatencyStats stats("aio_write");
+
+    testCase->signalParentAndWait();
+    testCase->testTimer()->start();
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < testCase->iter(); ++i)
+    {
+        char filename[80] = {'\0',};
+
+        sprintf(filename, "%s/file-%d-%d", kTestDir, i, testCase->pid());
+        testCase->openTimer()->start();
+        int fd = open(filename, O_RDWR | O_CREAT | O_DIRECT, S_IRWXU);
+        testCase->openTimer()->stop();
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "Open write failed.");
+            return false;
+        }
+
+        ok = aioTransfer(fd, true, testCase, &stats);
+
+        if (TestCase::FSYNC == testCase->sync())
+        {
+            testCase->syncTimer()->start();
+            fsync(fd);
+            testCase->syncTimer()->stop();
+        }
+        else if (TestCase::SYNC == testCase->sync())
+        {
+            testCase->syncTimer()->start();
+            sync();
+            testCase->syncTimer()->stop();
+        }
+        close(fd);
+    }
+    testCase->testTimer()->stop();
+    stats.print();
+    return ok;
+}
+
+bool testAioRead(TestCase *testCase)
+{
+    LatencyStats stats("aio_read");
+    size_t iter = testCase->iter();
+
+    // See testRead, same deal for concurrent read/write runs.
+    if (testCase->type() == TestCase::READ_WRITE)
+    {
+        iter *= TestCase::kReadWriteFactor;
+    }
+
+    // Setup the testcase by writing some dummy files.
+    for (size_t i = 0; i < iter; ++i)
+    {
+        char filename[80] = {'\0',};
+
+        sprintf(filename, "%s/file-%d-%d", kTestDir, i, testCase->pid());
+        if (!writeTestFile(testCase, filename))
+        {
+            return false;
+        }
+    }
+    if (kVerbose) printf("Child %d all chunk written\n", testCase->pid());
+
+    setupCacheState(testCase, iter);
+    testCase->signalParentAndWait();
+
+    testCase->testTimer()->start();
+    bool ok = true;
+    for (size_t i = 0; ok && i < iter; ++i)
+    {
+        char filename[80] = {'\0',};
+
+        sprintf(filename, "%s/file-%d-%d", kTestDir, i, testCase->pid());
+        testCase->openTimer()->start();
+        int fd = open(filename, O_RDONLY | O_DIRECT);
+        testCase->openTimer()->stop();
+
+        if (fd < 0)
+        {
+            fprintf(stderr, "Open read only failed.");
+            return false;
+        }
+
+        ok = aioTransfer(fd, false, testCase, &stats);
+        close(fd);
+    }
+    testCase->testTimer()->stop();
+    stats.print();
+    return ok;
+}
+
+// Same even/odd pid split as testReadWrite.
+bool testAioReadWrite(TestCase *testCase)
+{
+    if (getpid() & 0x1) {
+        return testAioRead(testCase);
+    } else {
+        return testAioWrite(testCase);
+    }
+}
+
 // ----------------------------------------------------------------------
 // TRAVERSE
 
@@ -686,29 +1105,39 @@ int main(int argc, char **argv)
     cleanup();
 
     parseCmdLine(argc, argv, &testCase);
+    if (testCase.engine() == TestCase::ENGINE_AIO)
+    {
+        testCase.alignForDirectIo();
+    }
     printHeader(argc, argv, testCase);
 
     printf("# File size %d kbytes\n", testCase.dataSize() / 1024);
     printf("# Chunk size %d kbytes\n", testCase.chunkSize() / 1024);
     printf("# Sync: %s\n", testCase.syncAsStr());
+    if (testCase.engine() == TestCase::ENGINE_AIO)
+    {
+        printf("# Queue depth: %d\n", testCase.queueDepth());
+    }
 
     if (!testCase.cpuScaling())
     {
         android::disableCpuScaling();
     }
 
+    bool aio = testCase.engine() == TestCase::ENGINE_AIO;
+
     switch(testCase.type()) {
         case TestCase::WRITE:
-            testCase.mTestBody = testWrite;
+            testCase.mTestBody = aio ? testAioWrite : testWrite;
             break;
         case TestCase::READ:
-            testCase.mTestBody = testRead;
+            testCase.mTestBody = aio ? testAioRead : testRead;
             break;
         case TestCase::OPEN_CREATE:
             testCase.mTestBody = testOpenCreate;
             break;
         case TestCase::READ_WRITE:
-            testCase.mTestBody = testReadWrite;
+            testCase.mTestBody = aio ? testAioReadWrite : testReadWrite;
             break;
         case TestCase::TRAVERSE:
             testCase.mTestBody = testTraverse;
@@ -32,6 +32,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -405,6 +406,108 @@ void fsyncAndDropCaches(int fd, int code)
 }
 
 
+bool fadviseFile(const char *filename, int advice)
+{
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+    {
+        printErrno("Failed to open", filename);
+        return false;
+    }
+    // Dirty pages are not dropped by DONTNEED, flush them first.
+    if (POSIX_FADV_DONTNEED == advice)
+    {
+        fsync(fd);
+    }
+    int err = posix_fadvise(fd, 0, 0, advice);
+    close(fd);
+    if (err != 0)
+    {
+        errno = err;
+        printErrno("Failed to fadvise", filename);
+        return false;
+    }
+    return true;
+}
+
+
+bool warmFile(const char *filename)
+{
+    char buffer[64 * 1024];
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+    {
+        printErrno("Failed to open", filename);
+        return false;
+    }
+
+    ssize_t s;
+    while ((s = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        continue;
+    }
+    close(fd);
+    if (s < 0)
+    {
+        printErrno("Failed to read", filename);
+        return false;
+    }
+    return true;
+}
+
+
+double residentFraction(const char *filename)
+{
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+    {
+        printErrno("Failed to open", filename);
+        return -1.0;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || 0 == sb.st_size)
+    {
+        close(fd);
+        return -1.0;
+    }
+
+    size_t pages = (sb.st_size + pageSize - 1) / pageSize;
+    void *addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+    if (MAP_FAILED == addr)
+    {
+        printErrno("Failed to mmap", filename);
+        return -1.0;
+    }
+
+    unsigned char *vec = new unsigned char[pages];
+    double fraction = -1.0;
+
+    if (mincore(addr, sb.st_size, vec) == 0)
+    {
+        size_t resident = 0;
+        for (size_t i = 0; i < pages; ++i)
+        {
+            if (vec[i] & 0x1) ++resident;
+        }
+        fraction = (double)resident / pages;
+    }
+    else
+    {
+        printErrno("Failed to mincore", filename);
+    }
+    delete [] vec;
+    munmap(addr, sb.st_size);
+    return fraction;
+}
+
+
 void resetDirectory(const char *directory)
 {
     DIR *dir = opendir(directory);
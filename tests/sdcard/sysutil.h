@@ -43,6 +43,9 @@ namespace android {
 // .forkOrExit            Fork a child or exit.
 // .syncAnddropCaches     Call sync an drop page/dentries/inodes caches.
 // .fsyncAnddropCaches    Call fsync an drop page/dentries/inodes caches.
+// .fadviseFile           Apply an fadvise to a whole file.
+// .warmFile              Pull a whole file in the page cache.
+// .residentFraction      How much of a file is in the page cache.
 // .resetDirectory        Delete (non-recursive) files in a directory.
 //
 // IPC function to synchonize a processes with their parent.
@@ -118,6 +121,22 @@ void syncAndDropCaches(int code = 3);
 //        * 3 To free pagecache, dentries and inodes.
 void fsyncAndDropCaches(int fd, int code = 3);
 
+// Apply an fadvise to the whole file.
+// @param filename Of the file to advise about.
+// @param advice   e.g POSIX_FADV_DONTNEED or POSIX_FADV_WILLNEED.
+// @return true if the advice was applied.
+bool fadviseFile(const char *filename, int advice);
+
+// Read the whole file once to pull it in the page cache.
+// @return true if the file was read completely.
+bool warmFile(const char *filename);
+
+// Fraction of the file's pages currently resident in the page cache,
+// measured with mincore. Use it to verify that a drop or a warm-up
+// actually held before timing starts.
+// @return A value in [0.0, 1.0], or -1.0 on error.
+double residentFraction(const char *filename);
+
 // Delete all the files in the given directory.  If the directory does
 // not exist, it is created.  Use this at the beginning of a test to
 // make sure you have a clean existing directory, previous run may
@@ -43,7 +43,9 @@ TestCase::TestCase(const char *appName)
     : mTestBody(NULL), mAppName(appName), mDataSize(1000 * 1000),
       mChunkSize(mDataSize), mTreeDepth(8), mIter(20), mNproc(1),
       mType(UNKNOWN_TEST),  mDump(false), mCpuScaling(false),
-      mSync(NO_SYNC), mFadvice(POSIX_FADV_NORMAL), mTruncateToSize(false),
+      mSync(NO_SYNC), mEngine(ENGINE_SYNC), mQueueDepth(8),
+      mFadvice(POSIX_FADV_NORMAL), mCacheState(CACHE_DEFAULT),
+      mTruncateToSize(false),
       mTestTimer(NULL)
 {
     // Make sure the cpu and phone are fully awake. The
@@ -190,6 +192,41 @@ const char *TestCase::syncAsStr() const
     return mSync == NO_SYNC ? "disabled" : (mSync == FSYNC ? "fsync" : "sync");
 }
 
+bool TestCase::setEngineFromName(const char *name)
+{
+    if (strcmp(name, "sync") == 0)
+    {
+        mEngine = ENGINE_SYNC;
+        return true;
+    }
+    else if (strcmp(name, "aio") == 0)
+    {
+        mEngine = ENGINE_AIO;
+        return true;
+    }
+    return false;
+}
+
+const char *TestCase::engineAsStr() const
+{
+    return mEngine == ENGINE_AIO ? "aio" : "sync";
+}
+
+void TestCase::alignForDirectIo()
+{
+    const size_t kPageSize = 4096;
+
+    mChunkSize = (mChunkSize + kPageSize - 1) & ~(kPageSize - 1);
+    if (mChunkSize > mDataSize)
+    {
+        mChunkSize = mDataSize = (mDataSize + kPageSize - 1) & ~(kPageSize - 1);
+    }
+    else
+    {
+        mDataSize = (mDataSize + mChunkSize - 1) / mChunkSize * mChunkSize;
+    }
+}
+
 void TestCase::setFadvise(const char *advice)
 {
     mFadvice = POSIX_FADV_NORMAL;
@@ -215,6 +252,42 @@ void TestCase::setFadvise(const char *advice)
     }
 }
 
+bool TestCase::setCacheStateFromName(const char *name)
+{
+    if (strcmp(name, "default") == 0)
+    {
+        mCacheState = CACHE_DEFAULT;
+    }
+    else if (strcmp(name, "drop") == 0)
+    {
+        mCacheState = CACHE_DROP;
+    }
+    else if (strcmp(name, "cold") == 0)
+    {
+        mCacheState = CACHE_COLD;
+    }
+    else if (strcmp(name, "warm") == 0)
+    {
+        mCacheState = CACHE_WARM;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+const char *TestCase::cacheStateAsStr() const
+{
+    switch (mCacheState) {
+        case CACHE_DEFAULT: return "default";
+        case CACHE_DROP: return "drop";
+        case CACHE_COLD: return "cold";
+        case CACHE_WARM: return "warm";
+        default: return "cache_unknown";
+    }
+}
+
 const char *TestCase::fadviseAsStr() const
 {
     switch (mFadvice) {
@@ -44,6 +44,13 @@ class TestCase {
     enum Type {UNKNOWN_TEST, WRITE, READ, OPEN_CREATE, READ_WRITE, TRAVERSE};
     enum Pipe {READ_FROM_CHILD = 0, WRITE_TO_PARENT, READ_FROM_PARENT, WRITE_TO_CHILD};
     enum Sync {NO_SYNC, FSYNC, SYNC};
+    enum Engine {ENGINE_SYNC, ENGINE_AIO};
+    // Page cache state for the test files when timing starts:
+    //   CACHE_DEFAULT  historical behavior, global sync + drop_caches.
+    //   CACHE_DROP     same as default but the state is verified.
+    //   CACHE_COLD     per file fadvise(DONTNEED), verified.
+    //   CACHE_WARM     per file fadvise(WILLNEED) + read pass, verified.
+    enum CacheState {CACHE_DEFAULT, CACHE_DROP, CACHE_COLD, CACHE_WARM};
 
     // Reads takes less time than writes. This is a basic
     // approximation of how much longer the read tasks must run to
@@ -85,6 +92,19 @@ class TestCase {
     void setSync(Sync s);
     const char *syncAsStr() const;
 
+    Engine engine() const { return mEngine; }
+    bool setEngineFromName(const char *name);
+    const char *engineAsStr() const;
+
+    size_t queueDepth() const { return mQueueDepth; }
+    void setQueueDepth(size_t val) { mQueueDepth = val; }
+
+    // The aio engine opens the test files with O_DIRECT so the
+    // in-flight requests really hit the device queue. O_DIRECT
+    // transfers must be block aligned: round the chunk size up to a
+    // page and the data size up to a chunk.
+    void alignForDirectIo();
+
     bool cpuScaling() const { return mCpuScaling; }
     void setCpuScaling() { mCpuScaling = true; }
 
@@ -95,6 +115,10 @@ class TestCase {
     void setFadvise(const char *advice);
     const char *fadviseAsStr() const;
 
+    CacheState cacheState() const { return mCacheState; }
+    bool setCacheStateFromName(const char *name);
+    const char *cacheStateAsStr() const;
+
     // Print the samples.
     void setDump() { StopWatch::setPrintRawMode(true); }
 
@@ -139,7 +163,10 @@ private:
     bool mDump;  // print the raw values instead of a human friendly report.
     bool mCpuScaling;  // true, do not turn off cpu scaling.
     Sync mSync;
+    Engine mEngine;
+    size_t mQueueDepth;  // max in-flight requests for the aio engine.
     int mFadvice;
+    CacheState mCacheState;
     // When new files are created, truncate them to the final size.
     bool mTruncateToSize;
 
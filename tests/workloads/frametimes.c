@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * frametimes: lightweight jank detector for the workloads scripts.
+ *
+ * Instead of a full atrace capture plus Python post-processing, this
+ * reads trace_pipe and parses only the userspace tracing_mark_write
+ * begin/end pairs that Choreographer (and SurfaceFlinger) emit around
+ * each frame, entirely in-process. Per-frame latency is printed live as
+ *
+ *   frame,<tid>,<end_ts>,<duration_us>,<janky>
+ *
+ * and a summary with total/janky/dropped frame counts is printed on
+ * exit. Only the gfx and view atrace tags are enabled, so the traced
+ * processes do nothing beyond the marker writes themselves.
+ *
+ * Needs root for the tracing files, like the rest of the harness.
+ */
+
+#include <cutils/properties.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ACTIVE 64
+#define MAX_LINE 1024
+
+/* gfx | view, the tags Choreographer and SurfaceFlinger trace under */
+#define FRAME_ATRACE_TAGS "0xa"
+
+static const char *tags_property = "debug.atrace.tags.enableflags";
+
+static const char *tracefs_roots[] = {
+    "/sys/kernel/debug/tracing",
+    "/d/tracing",
+    "/sys/kernel/tracing",
+};
+
+static const char *tracefs_root;
+static const char *frame_marker = "Choreographer#doFrame";
+static double jank_us = 16667;      /* one 60Hz vsync period */
+static int quiet;
+static volatile sig_atomic_t done;
+
+/* one in-flight frame per thread */
+static struct {
+    int tid;
+    double start_ts;
+    int depth;
+} active[MAX_ACTIVE];
+
+static unsigned long total_frames, janky_frames, dropped_frames;
+static double sum_us, max_us;
+static char saved_tracing_on[8] = "0";
+static char saved_tags[PROPERTY_VALUE_MAX];
+
+static void handle_signal(int signo) {
+    (void)signo;
+    done = 1;
+}
+
+static int tracefs_write(const char *name, const char *value) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", tracefs_root, name);
+    int fd = open(path, O_WRONLY);
+    if (fd == -1)
+        return -1;
+    ssize_t len = strlen(value);
+    ssize_t ret = write(fd, value, len);
+    close(fd);
+    return (ret == len) ? 0 : -1;
+}
+
+static void tracefs_read(const char *name, char *buf, size_t size) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", tracefs_root, name);
+    int fd = open(path, O_RDONLY);
+    buf[0] = '\0';
+    if (fd == -1)
+        return;
+    ssize_t n = read(fd, buf, size - 1);
+    if (n > 0) {
+        while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+            n--;
+        buf[n] = '\0';
+    }
+    close(fd);
+}
+
+static int find_tracefs(void) {
+    char path[128];
+    size_t i;
+    for (i = 0; i < sizeof(tracefs_roots) / sizeof(tracefs_roots[0]); i++) {
+        snprintf(path, sizeof(path), "%s/trace_pipe", tracefs_roots[i]);
+        if (access(path, R_OK) == 0) {
+            tracefs_root = tracefs_roots[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int slot_for_tid(int tid, int create) {
+    int i, free_slot = -1;
+    for (i = 0; i < MAX_ACTIVE; i++) {
+        if (active[i].tid == tid)
+            return i;
+        if (free_slot == -1 && active[i].tid == 0)
+            free_slot = i;
+    }
+    return create ? free_slot : -1;
+}
+
+static void frame_done(int tid, double start_ts, double end_ts) {
+    double dur_us = (end_ts - start_ts) * 1e6;
+    int janky = dur_us > jank_us;
+
+    total_frames++;
+    sum_us += dur_us;
+    if (dur_us > max_us)
+        max_us = dur_us;
+    if (janky) {
+        janky_frames++;
+        /* each full vsync period beyond the first is a dropped frame */
+        dropped_frames += (unsigned long)(dur_us / jank_us);
+    }
+    if (!quiet) {
+        printf("frame,%d,%.6f,%.0f,%d\n", tid, end_ts, dur_us, janky);
+        fflush(stdout);
+    }
+}
+
+/*
+ * Parse one trace_pipe line. Only tracing_mark_write events matter:
+ *
+ *   <comm>-<tid>  [001] ...1  386.126445: tracing_mark_write: B|<pid>|<name>
+ *   <comm>-<tid>  [001] ...1  386.129300: tracing_mark_write: E
+ *
+ * The begin/end pair runs on the writing thread, so frames are matched
+ * by the tid in the line prefix; nested begins from the same thread
+ * bump a depth count so the frame closes on its own end marker.
+ */
+static void parse_line(const char *line) {
+    const char *m = strstr(line, "tracing_mark_write: ");
+    if (!m)
+        return;
+
+    /* timestamp is the "seconds.usecs:" token right before the event */
+    const char *ts_end = m - 2;     /* back over ": " */
+    const char *ts = ts_end;
+    while (ts > line && ts[-1] != ' ')
+        ts--;
+    double now = atof(ts);
+
+    /* tid from the "comm-tid" prefix before the cpu field */
+    const char *bracket = strchr(line, '[');
+    if (!bracket)
+        return;
+    const char *p = bracket;
+    while (p > line && p[-1] == ' ')
+        p--;
+    while (p > line && p[-1] >= '0' && p[-1] <= '9')
+        p--;
+    int tid = atoi(p);
+    if (tid <= 0)
+        return;
+
+    const char *ev = m + strlen("tracing_mark_write: ");
+    if (ev[0] == 'B') {
+        const char *name = strchr(ev, '|');
+        if (name)
+            name = strchr(name + 1, '|');
+        if (!name)
+            return;
+        name++;
+
+        int slot = slot_for_tid(tid, 0);
+        if (slot >= 0) {
+            active[slot].depth++;
+        } else if (strncmp(name, frame_marker, strlen(frame_marker)) == 0) {
+            slot = slot_for_tid(tid, 1);
+            if (slot >= 0) {
+                active[slot].tid = tid;
+                active[slot].start_ts = now;
+                active[slot].depth = 1;
+            }
+        }
+    } else if (ev[0] == 'E') {
+        int slot = slot_for_tid(tid, 0);
+        if (slot >= 0 && --active[slot].depth == 0) {
+            frame_done(tid, active[slot].start_ts, now);
+            active[slot].tid = 0;
+        }
+    }
+}
+
+static void print_summary(void) {
+    printf("summary,frames=%lu,janky=%lu,dropped=%lu,avg_us=%.0f,max_us=%.0f\n",
+        total_frames, janky_frames, dropped_frames,
+        total_frames ? sum_us / total_frames : 0, max_us);
+    fflush(stdout);
+}
+
+static void usage(const char *cmd) {
+    fprintf(stderr,
+        "Usage: %s [-m marker] [-p period_ms] [-t seconds] [-q]\n"
+        "    -m name  frame marker to time (default %s)\n"
+        "    -p ms    vsync period for the jank threshold (default 16.67)\n"
+        "    -t secs  stop after this long (default: until SIGINT)\n"
+        "    -q       no per-frame lines, summary only\n",
+        cmd, frame_marker);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char line[MAX_LINE];
+    char path[128];
+    int opt, seconds = 0;
+    struct sigaction sa;
+
+    while ((opt = getopt(argc, argv, "m:p:t:qh")) != -1) {
+        switch (opt) {
+        case 'm':
+            frame_marker = optarg;
+            break;
+        case 'p':
+            jank_us = atof(optarg) * 1000;
+            if (jank_us <= 0)
+                usage(argv[0]);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (find_tracefs() != 0) {
+        fprintf(stderr, "No tracefs; is this kernel missing ftrace?\n");
+        return 1;
+    }
+
+    /* no SA_RESTART so the blocking read breaks off on the signal */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGALRM, &sa, NULL);
+    if (seconds > 0)
+        alarm(seconds);
+
+    /* only the userspace marker tags; no kernel events get enabled */
+    property_get(tags_property, saved_tags, "0");
+    property_set(tags_property, FRAME_ATRACE_TAGS);
+    tracefs_read("tracing_on", saved_tracing_on, sizeof(saved_tracing_on));
+    if (tracefs_write("tracing_on", "1") != 0) {
+        fprintf(stderr, "Can't enable tracing (are you root?)\n");
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/trace_pipe", tracefs_root);
+    FILE *pipe = fopen(path, "r");
+    if (!pipe) {
+        fprintf(stderr, "Can't open %s\n", path);
+        tracefs_write("tracing_on", saved_tracing_on);
+        return 1;
+    }
+
+    while (!done && fgets(line, sizeof(line), pipe))
+        parse_line(line);
+
+    fclose(pipe);
+    tracefs_write("tracing_on", saved_tracing_on);
+    property_set(tags_property, saved_tags);
+    print_summary();
+    return 0;
+}
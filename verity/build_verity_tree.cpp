@@ -10,10 +10,12 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <android-base/file.h>
@@ -73,20 +75,103 @@ int hash_block(const EVP_MD *md,
     return 0;
 }
 
+/* don't bother spawning a thread for fewer blocks than this */
+#define HASH_MIN_BLOCKS_PER_THREAD 512
+
+struct hash_thread_ctx {
+    const EVP_MD *md;
+    const unsigned char *in;
+    size_t in_size;
+    unsigned char *out;
+    const unsigned char *salt;
+    size_t salt_size;
+    size_t block_size;
+};
+
+static void *hash_blocks_thread(void *priv)
+{
+    struct hash_thread_ctx *ctx = (struct hash_thread_ctx *)priv;
+    unsigned char *out = ctx->out;
+    size_t s;
+
+    for (size_t i = 0; i < ctx->in_size; i += ctx->block_size) {
+        hash_block(ctx->md, ctx->in + i, ctx->block_size,
+                   ctx->salt, ctx->salt_size, out, &s);
+        out += s;
+    }
+
+    return NULL;
+}
+
 int hash_blocks(const EVP_MD *md,
                 const unsigned char *in, size_t in_size,
                 unsigned char *out, size_t *out_size,
                 const unsigned char *salt, size_t salt_size,
                 size_t block_size)
 {
-    size_t s;
-    *out_size = 0;
-    for (size_t i = 0; i < in_size; i += block_size) {
-        hash_block(md, in + i, block_size, salt, salt_size, out, &s);
-        out += s;
-        *out_size += s;
+    size_t hash_size = EVP_MD_size(md);
+    size_t blocks = div_round_up(in_size, block_size);
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads > (long)div_round_up(blocks, HASH_MIN_BLOCKS_PER_THREAD)) {
+        threads = div_round_up(blocks, HASH_MIN_BLOCKS_PER_THREAD);
+    }
+
+    if (threads <= 1) {
+        size_t s;
+        *out_size = 0;
+        for (size_t i = 0; i < in_size; i += block_size) {
+            hash_block(md, in + i, block_size, salt, salt_size, out, &s);
+            out += s;
+            *out_size += s;
+        }
+
+        return 0;
+    }
+
+    /* blocks are independent and block i's hash lands at out + i *
+       hash_size, so each thread hashes a contiguous range with its own
+       digest context and no synchronization */
+    size_t blocks_per_thread = div_round_up(blocks, threads);
+    struct hash_thread_ctx ctx[threads];
+    pthread_t handles[threads];
+    int spawned = 0;
+
+    for (long i = 0; i < threads; ++i) {
+        size_t first = i * blocks_per_thread;
+
+        if (first >= blocks) {
+            break;
+        }
+
+        size_t end = (first + blocks_per_thread) * block_size;
+
+        if (end > in_size) {
+            end = in_size;
+        }
+
+        ctx[i].md = md;
+        ctx[i].in = in + first * block_size;
+        ctx[i].in_size = end - first * block_size;
+        ctx[i].out = out + first * hash_size;
+        ctx[i].salt = salt;
+        ctx[i].salt_size = salt_size;
+        ctx[i].block_size = block_size;
+
+        if (pthread_create(&handles[i], NULL, hash_blocks_thread,
+                &ctx[i]) != 0) {
+            FATAL("failed to create hash thread\n");
+        }
+
+        spawned++;
+    }
+
+    for (int i = 0; i < spawned; ++i) {
+        pthread_join(handles[i], NULL);
     }
 
+    *out_size = blocks * hash_size;
     return 0;
 }
 
@@ -116,6 +201,14 @@ void usage(void)
            "  -a,--salt-str=<string>       set salt to <string>\n"
            "  -A,--salt-hex=<hex digits>   set salt to <hex digits>\n"
            "  -h                           show this help\n"
+           "  -i,--incremental=<tree>      reuse hashes from a prior tree file,\n"
+           "                               rehashing only the blocks marked in\n"
+           "                               the dirty map and their ancestors;\n"
+           "                               requires -d and the salt the prior\n"
+           "                               tree was built with\n"
+           "  -d,--dirty-map=<file>        bitmap of changed data blocks; bit\n"
+           "                               (i & 7) of byte (i >> 3) is set when\n"
+           "                               data block i has changed\n"
            "  -s,--verity-size=<data size> print the size of the verity tree\n"
            "  -v,                          enable verbose logging\n"
            "  -S                           treat <data image> as a sparse file\n"
@@ -132,18 +225,22 @@ int main(int argc, char **argv)
     size_t block_size = 4096;
     uint64_t calculate_size = 0;
     bool verbose = false;
+    char *prior_filename = NULL;
+    char *dirty_filename = NULL;
 
     while (1) {
         const static struct option long_options[] = {
             {"salt-str", required_argument, 0, 'a'},
             {"salt-hex", required_argument, 0, 'A'},
             {"help", no_argument, 0, 'h'},
+            {"incremental", required_argument, 0, 'i'},
+            {"dirty-map", required_argument, 0, 'd'},
             {"sparse", no_argument, 0, 'S'},
             {"verity-size", required_argument, 0, 's'},
             {"verbose", no_argument, 0, 'v'},
             {NULL, 0, 0, 0}
         };
-        int c = getopt_long(argc, argv, "a:A:hSs:v", long_options, NULL);
+        int c = getopt_long(argc, argv, "a:A:hi:d:Ss:v", long_options, NULL);
         if (c < 0) {
             break;
         }
@@ -175,6 +272,12 @@ int main(int argc, char **argv)
         case 'h':
             usage();
             return 1;
+        case 'i':
+            prior_filename = optarg;
+            break;
+        case 'd':
+            dirty_filename = optarg;
+            break;
         case 'S':
             sparse = true;
             break;
@@ -214,6 +317,19 @@ int main(int argc, char **argv)
     size_t hash_size = EVP_MD_size(md);
     assert(hash_size * 2 < block_size);
 
+    if (prior_filename || dirty_filename) {
+        if (!prior_filename || !dirty_filename) {
+            FATAL("-i and -d must be used together\n");
+        }
+        if (sparse) {
+            FATAL("incremental mode does not support sparse files\n");
+        }
+        if (!salt || !salt_size) {
+            FATAL("incremental mode requires the salt the prior tree was "
+                  "built with\n");
+        }
+    }
+
     if (!salt || !salt_size) {
         salt_size = hash_size;
         salt = new unsigned char[salt_size];
@@ -264,18 +380,31 @@ int main(int argc, char **argv)
         FATAL("failed to open %s\n", data_filename);
     }
 
-    struct sparse_file *file;
-    if (sparse) {
-        file = sparse_file_import(fd, false, false);
+    struct sparse_file *file = NULL;
+    int64_t len;
+
+    if (prior_filename) {
+        /* incremental mode reads only the dirty blocks, so it needs random
+           access to raw data instead of a streamed sparse image */
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            FATAL("failed to stat %s\n", data_filename);
+        }
+        len = st.st_size;
     } else {
-        file = sparse_file_import_auto(fd, false, verbose);
-    }
+        if (sparse) {
+            file = sparse_file_import(fd, false, false);
+        } else {
+            file = sparse_file_import_auto(fd, false, verbose);
+        }
+
+        if (!file) {
+            FATAL("failed to read file %s\n", data_filename);
+        }
 
-    if (!file) {
-        FATAL("failed to read file %s\n", data_filename);
+        len = sparse_file_len(file, false, false);
     }
 
-    int64_t len = sparse_file_len(file, false, false);
     if (len % block_size != 0) {
         FATAL("file size %" PRIu64 " is not a multiple of %zu bytes\n",
                 len, block_size);
@@ -315,31 +444,117 @@ int main(int argc, char **argv)
     unsigned char root_hash[hash_size];
     verity_tree_levels[levels] = root_hash;
 
-    struct sparse_hash_ctx ctx;
-    ctx.hashes = verity_tree_levels[0];
-    ctx.salt = salt;
-    ctx.salt_size = salt_size;
-    ctx.hash_size = hash_size;
-    ctx.block_size = block_size;
-    ctx.zero_block_hash = zero_block_hash;
-    ctx.md = md;
+    if (prior_filename) {
+        /* start from the prior tree and rehash only the paths from dirty
+           data blocks to the root */
+        std::string prior;
+        if (!android::base::ReadFileToString(prior_filename, &prior)) {
+            FATAL("failed to read prior tree '%s'\n", prior_filename);
+        }
+        if (prior.size() != verity_blocks * block_size) {
+            FATAL("prior tree '%s' is %zu bytes; expected %zu (data size "
+                  "changed?)\n", prior_filename, prior.size(),
+                  (size_t)(verity_blocks * block_size));
+        }
+        memcpy(verity_tree, prior.data(), prior.size());
 
-    sparse_file_callback(file, false, false, hash_chunk, &ctx);
+        std::string dirty;
+        if (!android::base::ReadFileToString(dirty_filename, &dirty)) {
+            FATAL("failed to read dirty map '%s'\n", dirty_filename);
+        }
 
-    sparse_file_destroy(file);
-    close(fd);
+        size_t data_blocks = len / block_size;
+        if (dirty.size() < div_round_up(data_blocks, 8)) {
+            FATAL("dirty map '%s' is too small for %zu data blocks\n",
+                    dirty_filename, data_blocks);
+        }
+
+        size_t hashes_per_block = div_round_up(block_size, hash_size);
+        size_t rehashed = 0;
 
-    for (int i = 0; i < levels; i++) {
-        size_t out_size;
-        hash_blocks(md,
-                verity_tree_levels[i], verity_tree_level_blocks[i] * block_size,
-                verity_tree_levels[i + 1], &out_size,
-                salt, salt_size, block_size);
-          if (i < levels - 1) {
-              assert(div_round_up(out_size, block_size) == verity_tree_level_blocks[i + 1]);
-          } else {
-              assert(out_size == hash_size);
-          }
+        /* rehash dirty data blocks into their leaf hashes, and mark the
+           leaf blocks they land in as dirty for the level above */
+        unsigned char *dirty_level = new unsigned char[
+            div_round_up(verity_tree_level_blocks[0], 8)]();
+        unsigned char block[block_size];
+
+        for (size_t b = 0; b < data_blocks; b++) {
+            if (!(dirty[b >> 3] & (1 << (b & 7)))) {
+                continue;
+            }
+            if (pread(fd, block, block_size, (off_t)b * block_size) !=
+                    (ssize_t)block_size) {
+                FATAL("failed to read block %zu from %s\n", b, data_filename);
+            }
+            hash_block(md, block, block_size, salt, salt_size,
+                       verity_tree_levels[0] + b * hash_size, NULL);
+
+            size_t parent = b / hashes_per_block;
+            dirty_level[parent >> 3] |= 1 << (parent & 7);
+            rehashed++;
+        }
+
+        /* propagate upwards; the top level is a single block feeding the
+           root hash and is always rehashed */
+        for (int i = 0; i < levels; i++) {
+            unsigned char *next_dirty = NULL;
+            if (i < levels - 1) {
+                next_dirty = new unsigned char[
+                    div_round_up(verity_tree_level_blocks[i + 1], 8)]();
+            }
+
+            for (size_t j = 0; j < verity_tree_level_blocks[i]; j++) {
+                if (i < levels - 1 &&
+                        !(dirty_level[j >> 3] & (1 << (j & 7)))) {
+                    continue;
+                }
+                hash_block(md, verity_tree_levels[i] + j * block_size,
+                           block_size, salt, salt_size,
+                           verity_tree_levels[i + 1] + j * hash_size, NULL);
+                if (next_dirty) {
+                    size_t parent = j / hashes_per_block;
+                    next_dirty[parent >> 3] |= 1 << (parent & 7);
+                }
+                rehashed++;
+            }
+
+            delete[] dirty_level;
+            dirty_level = next_dirty;
+        }
+
+        if (verbose) {
+            printf("rehashed %zu of %zu data and tree blocks\n", rehashed,
+                    data_blocks + verity_blocks);
+        }
+
+        close(fd);
+    } else {
+        struct sparse_hash_ctx ctx;
+        ctx.hashes = verity_tree_levels[0];
+        ctx.salt = salt;
+        ctx.salt_size = salt_size;
+        ctx.hash_size = hash_size;
+        ctx.block_size = block_size;
+        ctx.zero_block_hash = zero_block_hash;
+        ctx.md = md;
+
+        sparse_file_callback(file, false, false, hash_chunk, &ctx);
+
+        sparse_file_destroy(file);
+        close(fd);
+
+        for (int i = 0; i < levels; i++) {
+            size_t out_size;
+            hash_blocks(md,
+                    verity_tree_levels[i], verity_tree_level_blocks[i] * block_size,
+                    verity_tree_levels[i + 1], &out_size,
+                    salt, salt_size, block_size);
+              if (i < levels - 1) {
+                  assert(div_round_up(out_size, block_size) == verity_tree_level_blocks[i + 1]);
+              } else {
+                  assert(out_size == hash_size);
+              }
+        }
     }
 
     for (size_t i = 0; i < hash_size; i++) {
@@ -6,7 +6,7 @@ ifeq ($(HOST_OS),linux)
 LOCAL_SANITIZE := integer
 endif
 LOCAL_MODULE := fec
-LOCAL_SRC_FILES := main.cpp image.cpp
+LOCAL_SRC_FILES := main.cpp image.cpp rs_encode.cpp
 LOCAL_MODULE_TAGS := optional
 LOCAL_STATIC_LIBRARIES := \
     libsparse \
@@ -19,5 +19,9 @@ LOCAL_STATIC_LIBRARIES := \
     libsquashfs_utils
 LOCAL_SHARED_LIBRARIES := libbase
 LOCAL_CFLAGS += -Wall -Werror -O3
+# enable the pshufb kernel in rs_encode.cpp on x86 hosts
+ifneq ($(filter x86 x86_64,$(HOST_ARCH)),)
+LOCAL_CFLAGS += -mssse3
+endif
 LOCAL_C_INCLUDES += external/fec
 include $(BUILD_HOST_EXECUTABLE)
@@ -86,6 +86,10 @@ extern bool image_ecc_save(image *ctx);
 
 extern bool image_process(image_proc_func f, image *ctx);
 
+/* vectorized systematic RS(255, N) encoder (rs_encode.cpp); bit-exact with
+   driving encode_rs_char over the same range */
+extern void encode_rs_vec(image_proc_ctx *ctx);
+
 extern void image_init(image *ctx);
 extern void image_free(image *ctx);
 
@@ -28,6 +28,7 @@ extern "C" {
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <android-base/file.h>
 #include "image.h"
@@ -40,23 +41,6 @@ enum {
     MODE_GETVERITYSTART
 };
 
-static void encode_rs(struct image_proc_ctx *ctx)
-{
-    struct image *fcx = ctx->ctx;
-    int j;
-    uint8_t data[fcx->rs_n];
-    uint64_t i;
-
-    for (i = ctx->start; i < ctx->end; i += fcx->rs_n) {
-        for (j = 0; j < fcx->rs_n; ++j) {
-            data[j] = image_get_interleaved_byte(i + j, fcx);
-        }
-
-        encode_rs_char(ctx->rs, data, &fcx->fec[ctx->fec_pos]);
-        ctx->fec_pos += fcx->roots;
-    }
-}
-
 static void decode_rs(struct image_proc_ctx *ctx)
 {
     struct image *fcx = ctx->ctx;
@@ -109,6 +93,12 @@ static int usage()
            "  -S                                treat data as a sparse file\n"
            "encoding options:\n"
            "  -p, --padding=<bytes>             add padding after ECC data\n"
+           "  -I, --incremental=<file>          only re-encode stripes covering\n"
+           "                                    the data blocks listed in <file>\n"
+           "                                    (one block index or an inclusive\n"
+           "                                    <start>-<end> range per line);\n"
+           "                                    <fec> must already exist and is\n"
+           "                                    updated in place\n"
            "decoding options:\n"
            "  -i, --inplace                     correct <data> in place\n"
         );
@@ -200,10 +190,211 @@ static int encode(image& ctx, const std::vector<std::string>& inp_filenames,
         INFO("\trounds: %" PRIu64 "\n", ctx.rounds);
     }
 
-    if (!image_process(encode_rs, &ctx)) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!image_process(encode_rs_vec, &ctx)) {
         FATAL("failed to process input\n");
     }
 
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (double)(end.tv_sec - start.tv_sec) +
+        (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (elapsed > 0) {
+        INFO("encoded %" PRIu64 " MiB in %.1f s (%.1f MB/s)\n",
+            ctx.inp_size >> 20, elapsed,
+            (double)ctx.inp_size / (1024 * 1024) / elapsed);
+    }
+
+    if (!image_ecc_save(&ctx)) {
+        FATAL("failed to write output\n");
+    }
+
+    image_free(&ctx);
+    return 0;
+}
+
+/* reads a list of changed data blocks (one block index or an inclusive
+   <start>-<end> range per line) and returns the RS stripes whose codewords
+   cover any of them; data block b only contributes one byte column to
+   stripe b % rounds, so unchanged stripes keep their parity */
+static void parse_changed_blocks(const std::string& filename, image *ctx,
+        std::vector<uint64_t> *stripes)
+{
+    FILE *fp = fopen(filename.c_str(), "r");
+
+    if (!fp) {
+        FATAL("failed to open file '%s': %s\n", filename.c_str(),
+            strerror(errno));
+    }
+
+    std::vector<bool> changed(ctx->rounds, false);
+    char line[128];
+
+    while (fgets(line, sizeof(line), fp)) {
+        uint64_t start, end;
+        int rc = sscanf(line, "%" SCNu64 "-%" SCNu64, &start, &end);
+
+        if (rc == 1) {
+            end = start;
+        } else if (rc != 2) {
+            if (line[strspn(line, " \t\r\n")] == '\0') {
+                continue; /* blank line */
+            }
+
+            FATAL("invalid changed block list entry: %s", line);
+        }
+
+        if (start > end || end >= ctx->blocks) {
+            FATAL("invalid changed block range [%" PRIu64 ", %" PRIu64
+                "]: image has %" PRIu64 " blocks\n", start, end, ctx->blocks);
+        }
+
+        if (end - start + 1 >= ctx->rounds) {
+            /* every stripe is affected */
+            start = 0;
+            end = ctx->rounds - 1;
+        }
+
+        for (uint64_t b = start; b <= end; ++b) {
+            changed[b % ctx->rounds] = true;
+        }
+    }
+
+    fclose(fp);
+
+    for (uint64_t s = 0; s < ctx->rounds; ++s) {
+        if (changed[s]) {
+            stripes->push_back(s);
+        }
+    }
+}
+
+struct delta_proc_ctx {
+    image *ctx;
+    const uint64_t *stripes;
+    size_t count;
+};
+
+/* re-encodes the listed stripes; stripe s covers the interleaved bytes
+   [s * FEC_BLOCKSIZE * rs_n, (s + 1) * FEC_BLOCKSIZE * rs_n) and its parity
+   is the contiguous range starting at s * FEC_BLOCKSIZE * roots */
+static void *process_delta(void *cookie)
+{
+    delta_proc_ctx *d = (delta_proc_ctx *)cookie;
+    image *fcx = d->ctx;
+    image_proc_ctx args;
+
+    args.func = NULL;
+    args.id = -1;
+    args.ctx = fcx;
+    args.rv = 0;
+    args.rs = NULL;
+
+    for (size_t n = 0; n < d->count; ++n) {
+        uint64_t s = d->stripes[n];
+
+        args.start = s * FEC_BLOCKSIZE * fcx->rs_n;
+        args.end = (s + 1) * FEC_BLOCKSIZE * fcx->rs_n;
+        args.fec_pos = s * FEC_BLOCKSIZE * (uint64_t)fcx->roots;
+
+        encode_rs_vec(&args);
+    }
+
+    return NULL;
+}
+
+static int encode_incremental(image& ctx,
+        const std::vector<std::string>& inp_filenames,
+        const std::string& fec_filename, const std::string& blocks_filename)
+{
+    if (ctx.inplace) {
+        FATAL("invalid parameters: inplace can only used when decoding\n");
+    }
+
+    int roots = ctx.roots;
+
+    /* reuse parity from the existing output file for unchanged stripes */
+    if (!image_ecc_load(fec_filename, &ctx)) {
+        FATAL("failed to read ecc\n");
+    }
+
+    if (ctx.roots != roots) {
+        FATAL("'%s' encodes RS(255, %d); expected RS(255, %d)\n",
+            fec_filename.c_str(), ctx.rs_n, FEC_RSM - roots);
+    }
+
+    uint64_t inp_size = ctx.inp_size;
+
+    if (!image_load(inp_filenames, &ctx)) {
+        FATAL("failed to read input\n");
+    }
+
+    if (ctx.inp_size != inp_size) {
+        FATAL("size of input files (%" PRIu64 ") does not match the size "
+            "encoded in '%s' (%" PRIu64 ")\n", ctx.inp_size,
+            fec_filename.c_str(), inp_size);
+    }
+
+    std::vector<uint64_t> stripes;
+    parse_changed_blocks(blocks_filename, &ctx, &stripes);
+
+    INFO("re-encoding RS(255, %d) to '%s' for %zu of %" PRIu64 " stripes\n",
+        ctx.rs_n, fec_filename.c_str(), stripes.size(), ctx.rounds);
+
+    if (stripes.empty()) {
+        image_free(&ctx);
+        return 0;
+    }
+
+    int threads = ctx.threads;
+
+    if (threads < IMAGE_MIN_THREADS) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (threads < IMAGE_MIN_THREADS) {
+            threads = IMAGE_MIN_THREADS;
+        }
+    }
+
+    if ((size_t)threads > stripes.size()) {
+        threads = (int)stripes.size();
+    }
+    if (threads > IMAGE_MAX_THREADS) {
+        threads = IMAGE_MAX_THREADS;
+    }
+
+    pthread_t pthreads[threads];
+    delta_proc_ctx args[threads];
+
+    size_t stripes_per_thread = (stripes.size() + threads - 1) / threads;
+    size_t pos = 0;
+
+    for (int i = 0; i < threads; ++i) {
+        args[i].ctx = &ctx;
+        args[i].stripes = &stripes[pos];
+        args[i].count = stripes_per_thread;
+
+        if (args[i].count > stripes.size() - pos) {
+            args[i].count = stripes.size() - pos;
+        }
+
+        if (pthread_create(&pthreads[i], NULL, process_delta, &args[i]) != 0) {
+            FATAL("failed to create thread %d\n", i);
+        }
+
+        pos += args[i].count;
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        if (pthread_join(pthreads[i], NULL) != 0) {
+            FATAL("failed to join thread %d: %s\n", i, strerror(errno));
+        }
+    }
+
     if (!image_ecc_save(&ctx)) {
         FATAL("failed to write output\n");
     }
@@ -271,6 +462,7 @@ int main(int argc, char **argv)
 {
     std::string fec_filename;
     std::string out_filename;
+    std::string blocks_filename;
     std::vector<std::string> inp_filenames;
     int mode = MODE_ENCODE;
     image ctx;
@@ -291,10 +483,12 @@ int main(int argc, char **argv)
             {"get-ecc-start", required_argument, 0, 'E'},
             {"get-verity-start", required_argument, 0, 'V'},
             {"padding", required_argument, 0, 'p'},
+            {"incremental", required_argument, 0, 'I'},
             {"verbose", no_argument, 0, 'v'},
             {NULL, 0, 0, 0}
         };
-        int c = getopt_long(argc, argv, "hedSr:ij:s:E:V:p:v", long_options, NULL);
+        int c = getopt_long(argc, argv, "hedSr:ij:s:E:V:p:I:v", long_options,
+                    NULL);
         if (c < 0) {
             break;
         }
@@ -352,6 +546,12 @@ int main(int argc, char **argv)
                 FATAL("padding must be multiple of %u\n", FEC_BLOCKSIZE);
             }
             break;
+        case 'I':
+            if (mode != MODE_ENCODE) {
+                return usage();
+            }
+            blocks_filename = optarg;
+            break;
         case 'v':
             ctx.verbose = true;
             break;
@@ -401,6 +601,10 @@ int main(int argc, char **argv)
     case MODE_GETVERITYSTART:
         return get_start(mode, inp_filenames.front());
     case MODE_ENCODE:
+        if (!blocks_filename.empty()) {
+            return encode_incremental(ctx, inp_filenames, fec_filename,
+                        blocks_filename);
+        }
         return encode(ctx, inp_filenames, fec_filename);
     case MODE_DECODE:
         return decode(ctx, inp_filenames, fec_filename, out_filename);
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Vectorized systematic RS(255, N) encoder for the parameters in FEC_PARAMS.
+   Produces output bit-exact with encode_rs_char, but processes 16 codewords
+   per step: codeword w reads its j-th data byte from
+   input[w + j * rounds * FEC_BLOCKSIZE] (see fec_ecc_interleave), so the
+   same byte position of 16 adjacent codewords is a contiguous 16-byte load,
+   and the GF(2^8) multiply by each generator coefficient becomes two
+   byte-shuffle table lookups on the nibbles. */
+
+#undef NDEBUG
+
+extern "C" {
+    #include <fec.h>
+}
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+
+#if defined(__aarch64__)
+    #include <arm_neon.h>
+    #define RS_VECTOR
+    typedef uint8x16_t rs_vec;
+#elif defined(__SSSE3__)
+    #include <tmmintrin.h>
+    #define RS_VECTOR
+    typedef __m128i rs_vec;
+#endif
+
+#define RS_VECTOR_WIDTH 16
+
+/* GF(2^8) field generator polynomial from FEC_PARAMS */
+#define RS_GF_POLY 0x11d
+
+/* log/exp tables for the field; exp is doubled so exp[log[a] + log[b]]
+   needs no reduction mod 255 */
+static struct {
+    uint8_t exp[512];
+    uint8_t log[256];
+} gf;
+
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+static void gf_init()
+{
+    unsigned x = 1;
+
+    memset(&gf, 0, sizeof(gf));
+
+    for (int i = 0; i < 255; ++i) {
+        gf.exp[i] = (uint8_t)x;
+        gf.exp[i + 255] = (uint8_t)x;
+        gf.log[x] = (uint8_t)i;
+
+        x <<= 1;
+
+        if (x & 0x100) {
+            x ^= RS_GF_POLY;
+        }
+    }
+}
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+
+    return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+struct rs_encoder {
+    int roots;
+    /* generator polynomial in value form, lowest coefficient first; its
+       roots are alpha^0 .. alpha^(roots - 1) (fcr 0, prim 1, matching
+       FEC_PARAMS) */
+    uint8_t genpoly[FEC_RSM];
+    /* nibble multiplication tables: product with genpoly[c] is
+       mul_lo[c][x & 0xf] ^ mul_hi[c][x >> 4] */
+    uint8_t mul_lo[FEC_RSM][16];
+    uint8_t mul_hi[FEC_RSM][16];
+};
+
+static void rs_encoder_init(rs_encoder *e, int roots)
+{
+    assert(roots > 0 && roots < FEC_RSM);
+
+    pthread_once(&gf_once, gf_init);
+
+    e->roots = roots;
+    memset(e->genpoly, 0, sizeof(e->genpoly));
+    e->genpoly[0] = 1;
+
+    /* multiply (x + alpha^i) into the polynomial for each root */
+    for (int i = 0; i < roots; ++i) {
+        uint8_t root = gf.exp[i];
+
+        for (int j = i + 1; j > 0; --j) {
+            e->genpoly[j] = e->genpoly[j - 1] ^ gf_mul(e->genpoly[j], root);
+        }
+
+        e->genpoly[0] = gf_mul(e->genpoly[0], root);
+    }
+
+    for (int c = 0; c < roots; ++c) {
+        for (int x = 0; x < 16; ++x) {
+            e->mul_lo[c][x] = gf_mul(e->genpoly[c], (uint8_t)x);
+            e->mul_hi[c][x] = gf_mul(e->genpoly[c], (uint8_t)(x << 4));
+        }
+    }
+}
+
+/* encodes the single codeword w, writing roots parity bytes to parity;
+   the LFSR below is the same recurrence encode_rs_char runs, with the
+   generator coefficients in value instead of index form */
+static void encode_one(const rs_encoder *e, image *fcx, uint64_t w,
+        uint8_t *parity)
+{
+    uint8_t par[FEC_RSM] = {0};
+    uint64_t stride = fcx->rounds * FEC_BLOCKSIZE;
+    uint64_t offset = w;
+    int roots = e->roots;
+
+    for (int j = 0; j < fcx->rs_n; ++j, offset += stride) {
+        uint8_t data = offset < fcx->inp_size ? fcx->input[offset] : 0;
+        uint8_t fb = data ^ par[0];
+
+        for (int k = 0; k < roots; ++k) {
+            uint8_t next = k + 1 < roots ? par[k + 1] : 0;
+            par[k] = next ^ gf_mul(fb, e->genpoly[roots - 1 - k]);
+        }
+    }
+
+    memcpy(parity, par, roots);
+}
+
+#ifdef RS_VECTOR
+
+static inline rs_vec vec_load(const uint8_t *p)
+{
+#if defined(__aarch64__)
+    return vld1q_u8(p);
+#else
+    return _mm_loadu_si128((const __m128i *)p);
+#endif
+}
+
+static inline void vec_store(uint8_t *p, rs_vec v)
+{
+#if defined(__aarch64__)
+    vst1q_u8(p, v);
+#else
+    _mm_storeu_si128((__m128i *)p, v);
+#endif
+}
+
+static inline rs_vec vec_xor(rs_vec a, rs_vec b)
+{
+#if defined(__aarch64__)
+    return veorq_u8(a, b);
+#else
+    return _mm_xor_si128(a, b);
+#endif
+}
+
+static inline rs_vec vec_zero()
+{
+#if defined(__aarch64__)
+    return vdupq_n_u8(0);
+#else
+    return _mm_setzero_si128();
+#endif
+}
+
+/* multiplies every byte of x by the constant whose nibble tables are lo/hi */
+static inline rs_vec vec_mul(const uint8_t *lo, const uint8_t *hi, rs_vec x)
+{
+#if defined(__aarch64__)
+    uint8x16_t ln = vandq_u8(x, vdupq_n_u8(0x0f));
+    uint8x16_t hn = vshrq_n_u8(x, 4);
+    return veorq_u8(vqtbl1q_u8(vld1q_u8(lo), ln),
+                vqtbl1q_u8(vld1q_u8(hi), hn));
+#else
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i ln = _mm_and_si128(x, mask);
+    __m128i hn = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+    return _mm_xor_si128(
+        _mm_shuffle_epi8(vec_load(lo), ln),
+        _mm_shuffle_epi8(vec_load(hi), hn));
+#endif
+}
+
+/* encodes codewords [w, w + RS_VECTOR_WIDTH), one vector lane each */
+static void encode_group(const rs_encoder *e, image *fcx, uint64_t w,
+        uint8_t *parity)
+{
+    rs_vec par[FEC_RSM];
+    uint64_t stride = fcx->rounds * FEC_BLOCKSIZE;
+    uint64_t offset = w;
+    int roots = e->roots;
+
+    for (int k = 0; k < roots; ++k) {
+        par[k] = vec_zero();
+    }
+
+    for (int j = 0; j < fcx->rs_n; ++j, offset += stride) {
+        rs_vec data;
+
+        if (offset + RS_VECTOR_WIDTH <= fcx->inp_size) {
+            data = vec_load(&fcx->input[offset]);
+        } else {
+            /* codewords in the last round run past the input; the missing
+               bytes encode as zero, as in image_get_interleaved_byte */
+            uint8_t tmp[RS_VECTOR_WIDTH];
+
+            for (int l = 0; l < RS_VECTOR_WIDTH; ++l) {
+                tmp[l] = offset + l < fcx->inp_size ?
+                    fcx->input[offset + l] : 0;
+            }
+
+            data = vec_load(tmp);
+        }
+
+        rs_vec fb = vec_xor(data, par[0]);
+
+        for (int k = 0; k < roots; ++k) {
+            int c = roots - 1 - k;
+            rs_vec prod = vec_mul(e->mul_lo[c], e->mul_hi[c], fb);
+            par[k] = k + 1 < roots ? vec_xor(par[k + 1], prod) : prod;
+        }
+    }
+
+    /* scatter the lanes back into the per-codeword parity layout */
+    for (int k = 0; k < roots; ++k) {
+        uint8_t tmp[RS_VECTOR_WIDTH];
+
+        vec_store(tmp, par[k]);
+
+        for (int l = 0; l < RS_VECTOR_WIDTH; ++l) {
+            parity[(uint64_t)l * roots + k] = tmp[l];
+        }
+    }
+}
+
+#endif /* RS_VECTOR */
+
+void encode_rs_vec(image_proc_ctx *ctx)
+{
+    image *fcx = ctx->ctx;
+    rs_encoder enc;
+
+    assert(ctx->start % fcx->rs_n == 0);
+    assert(ctx->end % fcx->rs_n == 0);
+
+    rs_encoder_init(&enc, fcx->roots);
+
+    uint64_t w = ctx->start / fcx->rs_n;
+    uint64_t last = ctx->end / fcx->rs_n;
+
+#ifdef RS_VECTOR
+    for (; w + RS_VECTOR_WIDTH <= last; w += RS_VECTOR_WIDTH) {
+        encode_group(&enc, fcx, w, &fcx->fec[ctx->fec_pos]);
+        ctx->fec_pos += (uint64_t)RS_VECTOR_WIDTH * fcx->roots;
+    }
+#endif
+
+    for (; w < last; ++w) {
+        encode_one(&enc, fcx, w, &fcx->fec[ctx->fec_pos]);
+        ctx->fec_pos += fcx->roots;
+    }
+}
@@ -45,6 +45,11 @@ def encode(image, fec, roots):
     if subprocess.call([ "fec", "--roots= " + str(roots), image, fec ]) != 0:
         raise Exception("encoding failed")
 
+def encode_incremental(image, fec, blocks, roots):
+    if subprocess.call([ "fec", "--roots= " + str(roots),
+                         "--incremental=" + blocks, image, fec ]) != 0:
+        raise Exception("incremental encoding failed")
+
 def decode(image, fec, output):
     return subprocess.call([ "fec", "--decode", image, fec, output ])
 
@@ -83,6 +88,30 @@ def main(argv):
     if decode(temp_cor.name, temp_fec.name, temp_out.name) == 0:
         raise Exception("FAILED: corrected more than maximum number of errors?")
 
+    # incrementally re-encoding a changed block must produce the same parity
+    # as a full encode of the changed image
+    temp_new = tempfile.NamedTemporaryFile()
+    temp_lst = tempfile.NamedTemporaryFile()
+    temp_inc = tempfile.NamedTemporaryFile()
+    temp_ref = tempfile.NamedTemporaryFile()
+
+    shutil.copyfile(temp_img.name, temp_new.name)
+
+    block = random.randrange(0, os.stat(temp_new.name).st_size / blocksize)
+    corrupt(temp_new.name, block * blocksize, blocksize)
+
+    temp_lst.write("%d\n" % block)
+    temp_lst.flush()
+
+    shutil.copyfile(temp_fec.name, temp_inc.name)
+    encode_incremental(temp_new.name, temp_inc.name, temp_lst.name, roots)
+    encode(temp_new.name, temp_ref.name, roots)
+
+    if compare(temp_inc.name, temp_ref.name) != 0:
+        raise Exception("FAILED: incremental parity differs from full encode")
+    else:
+        print "incremental parity matches full encode"
+
     print "PASSED"
 
 if __name__ == '__main__':
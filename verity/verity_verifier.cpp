@@ -17,9 +17,12 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/test_utils.h>
@@ -71,36 +74,46 @@ static int verify_table(const char* key_path, const uint8_t* signature, size_t s
   return 0;
 }
 
-int main(int argc, char* argv[]) {
-  if (argc != 4 || strcmp(argv[2], "-mincrypt") != 0) {
-    printf("Usage: %s <image> -mincrypt <verity_key>\n"
-           "  image       the image file (raw or sparse image) to be verified\n"
-           "  verity_key  the verity key in mincrypt format (/verity_key on device)\n", argv[0]);
-    return 2;
-  }
-
-  // Get the raw image.
-  android::base::unique_fd fd(open(argv[1], O_RDONLY));
-  if (!fd) {
-    fprintf(stderr, "failed to open %s: %s\n", argv[1], strerror(errno));
-    return 1;
+static bool is_sparse_image(int fd) {
+  uint32_t magic;
+  if (TEMP_FAILURE_RETRY(pread(fd, &magic, sizeof(magic), 0)) !=
+      static_cast<ssize_t>(sizeof(magic))) {
+    return false;
   }
+  return magic == 0xed26ff3a;  // SPARSE_HEADER_MAGIC
+}
 
-  struct sparse_file* file = sparse_file_import_auto(fd, false, false);
-  if (file == nullptr) {
-    fprintf(stderr, "failed to read file %s\n", argv[1]);
+static int verify_image(const char* image_path, const char* key_path, bool print_path) {
+  android::base::unique_fd fd(open(image_path, O_RDONLY));
+  if (fd == -1) {
+    fprintf(stderr, "failed to open %s: %s\n", image_path, strerror(errno));
     return 1;
   }
 
-  TemporaryFile tf;
-  if (sparse_file_write(file, tf.fd, false, false, false) < 0) {
-    fprintf(stderr, "failed to write output file\n");
-    return 1;
+  // Sparse images have to be unsparsed into a temporary file first; raw
+  // images are verified in place, without copying the image anywhere.
+  std::string raw_path = image_path;
+  std::unique_ptr<TemporaryFile> tf;
+
+  if (is_sparse_image(fd)) {
+    struct sparse_file* file = sparse_file_import(fd, false, false);
+    if (file == nullptr) {
+      fprintf(stderr, "failed to read file %s\n", image_path);
+      return 1;
+    }
+
+    tf.reset(new TemporaryFile);
+    if (sparse_file_write(file, tf->fd, false, false, false) < 0) {
+      fprintf(stderr, "failed to write output file\n");
+      return 1;
+    }
+    sparse_file_destroy(file);
+    raw_path = tf->path;
   }
-  sparse_file_destroy(file);
 
-  // Verify.
-  fec::io input(tf.path);
+  // Opening the handle loads and validates the hash tree; O_DIRECT keeps a
+  // station verifying several units from fighting over the page cache.
+  fec::io input(raw_path, O_RDONLY, FEC_O_DIRECT);
   if (!input) {
     return 1;
   }
@@ -111,8 +124,45 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  int ret = verify_table(argv[3], verity.signature, sizeof(verity.signature),
+  int ret = verify_table(key_path, verity.signature, sizeof(verity.signature),
                          verity.table, verity.table_length);
-  printf("%s\n", ret == 0 ? "VERIFIED" : "FAILED");
+  if (print_path) {
+    printf("%s: %s\n", image_path, ret == 0 ? "VERIFIED" : "FAILED");
+  } else {
+    printf("%s\n", ret == 0 ? "VERIFIED" : "FAILED");
+  }
+  return ret == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 4 || strcmp(argv[argc - 2], "-mincrypt") != 0) {
+    printf("Usage: %s <image> [<image> ...] -mincrypt <verity_key>\n"
+           "  image       the image file (raw or sparse image) to be verified;\n"
+           "              multiple images are verified in parallel\n"
+           "  verity_key  the verity key in mincrypt format (/verity_key on device)\n", argv[0]);
+    return 2;
+  }
+
+  const char* key_path = argv[argc - 1];
+  int image_count = argc - 3;
+
+  if (image_count == 1) {
+    return verify_image(argv[1], key_path, false);
+  }
+
+  std::vector<std::thread> workers;
+  std::vector<int> results(image_count, 1);
+
+  for (int i = 0; i < image_count; ++i) {
+    workers.emplace_back([&results, i, argv, key_path]() {
+      results[i] = verify_image(argv[1 + i], key_path, true);
+    });
+  }
+
+  int ret = 0;
+  for (int i = 0; i < image_count; ++i) {
+    workers[i].join();
+    ret |= results[i];
+  }
   return ret;
 }
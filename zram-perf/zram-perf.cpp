@@ -1,6 +1,11 @@
 #include <iostream>
 #include <chrono>
 #include <numeric>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -27,6 +32,74 @@ void fillPageCompressible(uint32_t *page) {
     }
 }
 
+// Fill the leading entropy percent of the page with random words and
+// the rest with a repeated value, so the compressibility of the data
+// can be swept between fillPageCompressible (0) and fillPageRand (100).
+// Uses rand_r so concurrent writers do not share PRNG state.
+void fillPageEntropy(uint32_t *page, int entropy, unsigned int *seed) {
+    size_t words = page_size / sizeof(int);
+    size_t randWords = words * entropy / 100;
+    uint32_t val = rand_r(seed) & 0xfff;
+    for (size_t i = 0; i < randWords; i++) {
+        page[i] = rand_r(seed);
+    }
+    for (size_t i = randWords; i < words; i++) {
+        page[i] = val;
+    }
+}
+
+// A corpus of captured page images, replayed instead of the synthetic
+// fill patterns so compression ratios reflect real swap contents.
+class Corpus {
+    vector<uint8_t> m_data;
+public:
+    bool load(const string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cout << "Cannot open corpus " << path << ": " << strerror(errno)
+                 << endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0 ||
+                (st.st_size % page_size) != 0) {
+            cout << "Corpus " << path
+                 << " is not a non-empty multiple of the page size." << endl;
+            close(fd);
+            return false;
+        }
+        m_data.resize(st.st_size);
+        ssize_t ret = read(fd, m_data.data(), st.st_size);
+        close(fd);
+        if (ret != st.st_size) {
+            cout << "Cannot read corpus " << path << endl;
+            return false;
+        }
+        return true;
+    }
+    size_t numPages() const {
+        return m_data.size() / page_size;
+    }
+    const uint8_t *page(size_t i) const {
+        return &m_data[i * page_size];
+    }
+};
+
+// Actual ratio achieved by the device, so corpus and synthetic runs
+// can be compared on what the backend really delivered.
+void printZramRatio() {
+    FILE *f = fopen("/sys/block/zram0/mm_stat", "r");
+    if (f == NULL) {
+        return;
+    }
+    unsigned long long orig, compr;
+    if (fscanf(f, "%llu %llu", &orig, &compr) == 2 && compr > 0) {
+        cout << "compression ratio: " << (double)orig / compr
+             << " (" << orig << " -> " << compr << " bytes)" << endl;
+    }
+    fclose(f);
+}
+
 class AlignedAlloc {
     void *m_ptr;
 public:
@@ -60,11 +133,20 @@ public:
             close(m_fd);
         }
     }
-    void fillWithCompressible() {
+    int fd() {
+        return m_fd;
+    }
+    void fillWithCompressible(const Corpus *corpus) {
         size_t devSize = getSize();
         AlignedAlloc page(page_size, page_size);
+        size_t corpusIdx = 0;
         for (uint64_t offset = 0; offset < devSize; offset += page_size) {
-            fillPageCompressible((uint32_t*)page.ptr());
+            if (corpus) {
+                memcpy(page.ptr(), corpus->page(corpusIdx), page_size);
+                corpusIdx = (corpusIdx + 1) % corpus->numPages();
+            } else {
+                fillPageCompressible((uint32_t*)page.ptr());
+            }
             ssize_t ret = write(m_fd, page.ptr(), page_size);
             if (ret != page_size) {
                 cout << "write() failed" << endl;
@@ -92,16 +174,22 @@ public:
         size_t duration = chrono::duration_cast<chrono::microseconds>(end - start).count();
         cout << "read: " << (double)devSize * passes / 1024.0 / 1024.0 / (duration / 1000.0 / 1000.0) << "MB/s" << endl;
     }
-    void benchSequentialWrite() {
+    void benchSequentialWrite(const Corpus *corpus) {
         chrono::time_point<chrono::high_resolution_clock> start, end;
         size_t devSize = getSize();
         size_t passes = 4;
         AlignedAlloc page(page_size, page_size);
+        size_t corpusIdx = 0;
 
         start = chrono::high_resolution_clock::now();
         for (int i = 0; i < passes; i++) {
             for (uint64_t offset = 0; offset < devSize; offset += page_size) {
-                fillPageCompressible((uint32_t*)page.ptr());
+                if (corpus) {
+                    memcpy(page.ptr(), corpus->page(corpusIdx), page_size);
+                    corpusIdx = (corpusIdx + 1) % corpus->numPages();
+                } else {
+                    fillPageCompressible((uint32_t*)page.ptr());
+                }
                 if (offset == 0)
                     lseek(m_fd, offset, SEEK_SET);
                 ssize_t ret = write(m_fd, page.ptr(), page_size);
@@ -117,24 +205,349 @@ public:
     }
 };
 
-int bench(bool direct)
+// Latency histogram with power-of-two nanosecond buckets; bucket b
+// counts operations in [2^b, 2^(b+1)) ns.
+const size_t hist_buckets = 32;
+
+struct WorkerStats {
+    uint64_t ops = 0;
+    uint64_t hist[hist_buckets] = {0};
+    uint64_t max_ns = 0;
+};
+
+void mixedWorker(int fd, size_t devSize, bool writer,
+                 const vector<int> &entropies, size_t batchPages,
+                 const Corpus *corpus, unsigned int seed, atomic<bool> *stop,
+                 WorkerStats *stats) {
+    AlignedAlloc page(page_size, page_size);
+    size_t numPages = devSize / page_size;
+    size_t batchLeft = 0;
+    size_t entropyIdx = 0;
+
+    while (!stop->load()) {
+        uint64_t offset = (uint64_t)(rand_r(&seed) % numPages) * page_size;
+        if (writer) {
+            if (corpus) {
+                // Replay a random captured page, preserving the
+                // page-type mix of the capture.
+                memcpy(page.ptr(),
+                       corpus->page(rand_r(&seed) % corpus->numPages()),
+                       page_size);
+            } else {
+                // Each batch of pages is written at the next entropy
+                // level of the sweep.
+                if (batchLeft == 0) {
+                    batchLeft = batchPages;
+                    entropyIdx = (entropyIdx + 1) % entropies.size();
+                }
+                fillPageEntropy((uint32_t*)page.ptr(), entropies[entropyIdx],
+                                &seed);
+                batchLeft--;
+            }
+        }
+
+        auto start = chrono::high_resolution_clock::now();
+        ssize_t ret;
+        if (writer) {
+            ret = pwrite64(fd, page.ptr(), page_size, offset);
+        } else {
+            ret = pread64(fd, page.ptr(), page_size, offset);
+        }
+        auto end = chrono::high_resolution_clock::now();
+        if (ret != (ssize_t)page_size) {
+            cout << (writer ? "pwrite64()" : "pread64()") << " failed" << endl;
+            continue;
+        }
+
+        uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+        size_t bucket = 0;
+        while ((ns >> (bucket + 1)) != 0 && bucket < hist_buckets - 1) {
+            bucket++;
+        }
+        stats->hist[bucket]++;
+        stats->ops++;
+        if (ns > stats->max_ns) {
+            stats->max_ns = ns;
+        }
+    }
+}
+
+void printHistogram(const char *label, const vector<WorkerStats> &stats,
+                    size_t seconds) {
+    WorkerStats merged;
+    for (auto &s : stats) {
+        merged.ops += s.ops;
+        for (size_t b = 0; b < hist_buckets; b++) {
+            merged.hist[b] += s.hist[b];
+        }
+        if (s.max_ns > merged.max_ns) {
+            merged.max_ns = s.max_ns;
+        }
+    }
+    if (merged.ops == 0) {
+        return;
+    }
+
+    cout << label << ": " << stats.size() << " threads, " << merged.ops
+         << " ops, "
+         << (double)merged.ops * page_size / 1024.0 / 1024.0 / seconds
+         << "MB/s, max " << merged.max_ns / 1000.0 << "us" << endl;
+    for (size_t b = 0; b < hist_buckets; b++) {
+        if (merged.hist[b] == 0) {
+            continue;
+        }
+        cout << "  [" << ((uint64_t)1 << b) / 1000.0 << "us, "
+             << ((uint64_t)1 << (b + 1)) / 1000.0 << "us): "
+             << merged.hist[b] << endl;
+    }
+}
+
+int benchMixed(int readers, int writers, const vector<int> &entropies,
+               size_t seconds, size_t batchPages, const Corpus *corpus) {
+    BlockFd zramDev{zram_blkdev_path, true};
+    size_t devSize = zramDev.getSize();
+    if (devSize == 0) {
+        cout << "Cannot size " << zram_blkdev_path << endl;
+        return -1;
+    }
+
+    // Prefill the whole device with the corpus or the entropy sweep so
+    // readers decompress data resembling the write mix.
+    {
+        AlignedAlloc page(page_size, page_size);
+        unsigned int seed = 0;
+        size_t entropyIdx = 0;
+        size_t batchLeft = 0;
+        size_t corpusIdx = 0;
+        for (uint64_t offset = 0; offset < devSize; offset += page_size) {
+            if (corpus) {
+                memcpy(page.ptr(), corpus->page(corpusIdx), page_size);
+                corpusIdx = (corpusIdx + 1) % corpus->numPages();
+            } else {
+                if (batchLeft == 0) {
+                    batchLeft = batchPages;
+                    entropyIdx = (entropyIdx + 1) % entropies.size();
+                }
+                fillPageEntropy((uint32_t*)page.ptr(), entropies[entropyIdx],
+                                &seed);
+                batchLeft--;
+            }
+            ssize_t ret = pwrite64(zramDev.fd(), page.ptr(), page_size, offset);
+            if (ret != (ssize_t)page_size) {
+                cout << "prefill write failed" << endl;
+                return -1;
+            }
+        }
+    }
+    printZramRatio();
+
+    atomic<bool> stop{false};
+    vector<WorkerStats> readStats(readers);
+    vector<WorkerStats> writeStats(writers);
+    vector<thread> threads;
+    for (int i = 0; i < readers; i++) {
+        threads.emplace_back(mixedWorker, zramDev.fd(), devSize, false,
+                             cref(entropies), batchPages, corpus,
+                             (unsigned int)i + 1, &stop, &readStats[i]);
+    }
+    for (int i = 0; i < writers; i++) {
+        threads.emplace_back(mixedWorker, zramDev.fd(), devSize, true,
+                             cref(entropies), batchPages, corpus,
+                             (unsigned int)(readers + i + 1), &stop,
+                             &writeStats[i]);
+    }
+
+    this_thread::sleep_for(chrono::seconds(seconds));
+    stop.store(true);
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    cout << "mixed: " << readers << " readers, " << writers << " writers, "
+         << seconds << "s";
+    if (corpus) {
+        cout << ", corpus of " << corpus->numPages() << " pages" << endl;
+    } else {
+        cout << ", entropy sweep:";
+        for (int e : entropies) {
+            cout << " " << e << "%";
+        }
+        cout << ", batch " << batchPages << " pages" << endl;
+    }
+    printHistogram("read", readStats, seconds);
+    printHistogram("write", writeStats, seconds);
+    return 0;
+}
+
+int bench(bool direct, const Corpus *corpus)
 {
     BlockFd zramDev{zram_blkdev_path, direct};
 
-    zramDev.fillWithCompressible();
+    zramDev.fillWithCompressible(corpus);
+    printZramRatio();
     zramDev.benchSequentialRead();
-    zramDev.benchSequentialWrite();
+    zramDev.benchSequentialWrite(corpus);
+    return 0;
+}
+
+// Copy the current contents of the zram device into a replayable
+// corpus. Zero pages (unallocated swap) are skipped and every other
+// page is passed through one random byte-substitution for the whole
+// capture: a bijective mapping keeps the repetition structure the
+// compressor sees -- including zero runs, which map to themselves --
+// while making the original contents unrecoverable.
+int captureCorpus(const string &path, size_t maxPages)
+{
+    BlockFd zramDev{zram_blkdev_path, false};
+    size_t devSize = zramDev.getSize();
+    if (devSize == 0) {
+        cout << "Cannot size " << zram_blkdev_path << endl;
+        return -1;
+    }
+
+    int outFd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+    if (outFd < 0) {
+        cout << "Cannot create " << path << ": " << strerror(errno) << endl;
+        return -1;
+    }
+
+    uint8_t subst[256];
+    for (int i = 0; i < 256; i++) {
+        subst[i] = i;
+    }
+    for (int i = 255; i > 1; i--) {
+        int j = 1 + rand() % i;
+        uint8_t tmp = subst[i];
+        subst[i] = subst[j];
+        subst[j] = tmp;
+    }
+
+    AlignedAlloc page(page_size, page_size);
+    uint8_t *buf = (uint8_t*)page.ptr();
+    size_t captured = 0;
+    for (uint64_t offset = 0; offset < devSize; offset += page_size) {
+        ssize_t ret = pread64(zramDev.fd(), page.ptr(), page_size, offset);
+        if (ret != (ssize_t)page_size) {
+            cout << "pread64() failed at offset " << offset << endl;
+            break;
+        }
+        bool zero = true;
+        for (size_t i = 0; i < page_size; i++) {
+            if (buf[i] != 0) {
+                zero = false;
+                break;
+            }
+        }
+        if (zero) {
+            continue;
+        }
+        for (size_t i = 0; i < page_size; i++) {
+            buf[i] = subst[buf[i]];
+        }
+        ret = write(outFd, page.ptr(), page_size);
+        if (ret != (ssize_t)page_size) {
+            cout << "write() to corpus failed" << endl;
+            close(outFd);
+            return -1;
+        }
+        captured++;
+        if (maxPages != 0 && captured == maxPages) {
+            break;
+        }
+    }
+    close(outFd);
+
+    if (captured == 0) {
+        cout << "No non-zero pages on " << zram_blkdev_path
+             << "; is anything swapped out?" << endl;
+        return -1;
+    }
+    cout << "captured " << captured << " anonymized pages to " << path << endl;
     return 0;
 }
 
 int main(int argc, char *argv[])
 {
+    bool mixed = false;
+    int readers = 2;
+    int writers = 2;
+    size_t duration = 10;
+    size_t batchPages = 64;
+    vector<int> entropies{0, 50, 100};
+    string captureFile;
+    size_t capturePages = 0;
+    string corpusFile;
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == string("--mixed")) {
+            mixed = true;
+        } else if (i + 1 < argc) {
+            if (string(argv[i]) == string("--capture")) {
+                captureFile = argv[++i];
+            } else if (string(argv[i]) == string("--capture_pages")) {
+                capturePages = atoi(argv[++i]);
+            } else if (string(argv[i]) == string("--corpus")) {
+                corpusFile = argv[++i];
+            } else if (string(argv[i]) == string("--readers")) {
+                readers = atoi(argv[++i]);
+            } else if (string(argv[i]) == string("--writers")) {
+                writers = atoi(argv[++i]);
+            } else if (string(argv[i]) == string("--duration")) {
+                duration = atoi(argv[++i]);
+            } else if (string(argv[i]) == string("--batch")) {
+                batchPages = atoi(argv[++i]);
+            } else if (string(argv[i]) == string("--entropy")) {
+                entropies.clear();
+                stringstream list(argv[++i]);
+                string item;
+                while (getline(list, item, ',')) {
+                    int e = atoi(item.c_str());
+                    if (e < 0 || e > 100) {
+                        cout << "Entropy levels must be between 0 and 100."
+                             << endl;
+                        return -1;
+                    }
+                    entropies.push_back(e);
+                }
+            } else {
+                cout << "Unknown argument " << argv[i] << endl;
+                return -1;
+            }
+        } else {
+            cout << "The " << argv[i] << " option requires an argument."
+                 << endl;
+            return -1;
+        }
+    }
+    if (readers < 0 || writers < 0 || readers + writers == 0 ||
+        entropies.empty() || batchPages == 0) {
+        cout << "Invalid mixed workload configuration." << endl;
+        return -1;
+    }
+
+    // Capture reads the device while it is still active swap, so it
+    // must run before the swapoff below empties it.
+    if (!captureFile.empty()) {
+        return captureCorpus(captureFile, capturePages);
+    }
+
+    Corpus corpus;
+    if (!corpusFile.empty() && !corpus.load(corpusFile)) {
+        return -1;
+    }
+
     int result = swapoff(zram_blkdev_path);
     if (result < 0) {
         cout << "swapoff failed: " << strerror(errno) << endl;
     }
 
-    bench(1);
+    if (mixed) {
+        if (benchMixed(readers, writers, entropies, duration, batchPages,
+                       corpusFile.empty() ? nullptr : &corpus) < 0) {
+            return -1;
+        }
+    } else {
+        bench(1, corpusFile.empty() ? nullptr : &corpus);
+    }
 
     result = system((string("mkswap ") + string(zram_blkdev_path)).c_str());
     if (result < 0) {